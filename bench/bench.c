@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+#include <locale.h>
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#include "monit.h"
+#include "net.h"
+#include "event.h"
+#include "process.h"
+#include "latency.h"
+#include "md5.h"
+#include "sha1.h"
+#include "processor.h"
+#include "cervlet.h"
+
+// libmonit
+#include "Bootstrap.h"
+#include "io/File.h"
+#include "system/Net.h"
+
+
+/**
+ *  Microbenchmarks of the Monit hot paths and the scale test harness.
+ *
+ *  The program is linked with the Monit sources, monit.c is compiled with
+ *  its main() renamed (see the bench target in Makefile.am). It loads the
+ *  given control file, typically generated by bench/genconfig.sh.
+ *
+ *  The micro mode (default) runs one validation cycle to collect the
+ *  service data and then times:
+ *
+ *    - status_xml() and status_json() of all services
+ *    - Event_post() of a failure and a recovery for each service
+ *    - the content match of the file services with a content rule
+ *    - initprocesstree() over the live /proc
+ *    - Util_getDigests() and the former stdio/4 KB block MD5 + SHA1 path
+ *    - a HTTP request parsed and served by the http processor
+ *
+ *  The scale mode runs the given number of validation cycles, as "monit
+ *  validate" does once, and reports for each cycle its duration, the
+ *  resident memory size, the read and write system calls (Linux only) and
+ *  the heap allocations. The allocations are counted by the wrappers of
+ *  the C library allocator, the program is linked with -Wl,--wrap (GNU or
+ *  LLVM linker). The host services of the generated configuration test
+ *  the fake TCP endpoint the program listens at on localhost.
+ *
+ *  The results are printed as one JSON object to stdout.
+ *
+ *  Usage: monit_bench -c monitrc [-i iterations] [-k cycles] [-p port] [micro|scale]
+ *
+ *  @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+/* monit.c's main() is renamed by the preprocessor for this program */
+#undef main
+
+#define DIGEST_DATA (32 * 1024 * 1024)
+#define REQUEST "GET /_ping HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+static int iterations = 20;
+static boolean_t first = true;
+static volatile unsigned long allocations = 0;
+
+typedef struct {
+        long long rss;
+        long long syscr;
+        long long syscw;
+} Usage_T;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/* Append the benchmark result: items is the number of the objects (services, bytes, ...) processed by one iteration */
+static void _result(StringBuffer_T B, const char *name, const char *unit, int count, long long items, unsigned long long started) {
+        unsigned long long elapsed = Latency_now() - started;
+        StringBuffer_append(B,
+                "%s{\"name\":\"%s\",\"iterations\":%d,\"items\":%lld,\"unit\":\"%s\",\"usec\":%llu,\"usec_per_op\":%.3f,\"items_per_sec\":%.1f}",
+                first ? "" : ",",
+                name,
+                count,
+                items,
+                unit,
+                elapsed,
+                (double)elapsed / count,
+                elapsed ? (double)items * count * 1000000. / elapsed : 0.);
+        first = false;
+}
+
+
+static void _status(StringBuffer_T B, int services) {
+        StringBuffer_T S = StringBuffer_create(65536);
+        unsigned long long started = Latency_now();
+        for (int i = 0; i < iterations; i++) {
+                StringBuffer_clear(S);
+                status_xml(S, NULL, Level_Full, 2, "127.0.0.1");
+        }
+        _result(B, "status_xml", "services", iterations, services, started);
+        started = Latency_now();
+        for (int i = 0; i < iterations; i++) {
+                StringBuffer_clear(S);
+                status_json(S, NULL, Level_Full, 0, "127.0.0.1", NULL, NULL);
+        }
+        _result(B, "status_json", "services", iterations, services, started);
+        StringBuffer_free(&S);
+}
+
+
+static void _event(StringBuffer_T B, int services) {
+        unsigned long long started = Latency_now();
+        for (int i = 0; i < iterations; i++) {
+                for (Service_T s = servicelist; s; s = s->next) {
+                        Event_post(s, Event_Data, State_Failed, s->action_DATA, "benchmark failure");
+                        Event_post(s, Event_Data, State_Succeeded, s->action_DATA, "benchmark recovery");
+                }
+        }
+        _result(B, "event_post", "events", iterations, 2LL * services, started);
+}
+
+
+static void _match(StringBuffer_T B) {
+        long long bytes = 0;
+        int count = 0;
+        unsigned long long started = Latency_now();
+        for (int i = 0; i < iterations; i++) {
+                for (Service_T s = servicelist; s; s = s->next) {
+                        if (s->type == Service_File && s->matchlist) {
+                                // Match the whole file again
+                                s->inf->priv.file.readpos = 0;
+                                s->check(s);
+                                bytes += s->inf->priv.file.readpos;
+                                count++;
+                        }
+                }
+        }
+        if (count)
+                _result(B, "content_match", "bytes", iterations, bytes / iterations, started);
+}
+
+
+static void _processtree(StringBuffer_T B) {
+        if (! Run.doprocess)
+                return;
+        unsigned long long started = Latency_now();
+        for (int i = 0; i < iterations; i++) {
+                lockprocesstree(true);
+                initprocesstree(&ptree, &ptreesize, &oldptree, &oldptreesize);
+                unlockprocesstree();
+        }
+        _result(B, "initprocesstree", "processes", iterations, ptreesize, started);
+}
+
+
+static void _digests(StringBuffer_T B) {
+        FILE *f = tmpfile();
+        if (! f) {
+                LogError("Cannot create the digest data file -- %s\n", STRERROR);
+                return;
+        }
+        unsigned char block[65536];
+        for (int n = 0; n < DIGEST_DATA; n += sizeof(block)) {
+                for (int i = 0; i < (int)sizeof(block); i++)
+                        block[i] = (unsigned char)random();
+                if (fwrite(block, 1, sizeof(block), f) != sizeof(block)) {
+                        LogError("Cannot write the digest data file -- %s\n", STRERROR);
+                        fclose(f);
+                        return;
+                }
+        }
+        fflush(f);
+        int count = iterations < 5 ? iterations : 5;
+        unsigned char sha1[SHA1_DIGEST_SIZE], md5[16];
+        unsigned long long started = Latency_now();
+        for (int i = 0; i < count; i++) {
+                lseek(fileno(f), 0, SEEK_SET);
+                Util_getDigests(fileno(f), sha1, md5);
+        }
+        _result(B, "digests", "bytes", count, DIGEST_DATA, started);
+        // The former file checksum path: stdio with 4 KB blocks and the bundled MD5 and SHA1 implementations
+        started = Latency_now();
+        for (int i = 0; i < count; i++) {
+                md5_context_t md5context;
+                sha1_context_t sha1context;
+                md5_init(&md5context);
+                sha1_init(&sha1context);
+                rewind(f);
+                size_t n;
+                while ((n = fread(block, 1, 4096, f)) > 0) {
+                        md5_append(&md5context, (const md5_byte_t *)block, (int)n);
+                        sha1_append(&sha1context, block, n);
+                }
+                md5_finish(&md5context, (md5_byte_t *)md5);
+                sha1_finish(&sha1context, sha1);
+        }
+        _result(B, "digests_stdio_4k", "bytes", count, DIGEST_DATA, started);
+        fclose(f);
+}
+
+
+static void _http(StringBuffer_T B) {
+        int fd[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+                LogError("Cannot create the socket pair -- %s\n", STRERROR);
+                return;
+        }
+        struct sockaddr_un address = {.sun_family = AF_UNIX};
+        Socket_T S = Socket_createAccepted(fd[0], (struct sockaddr *)&address, sizeof(address), NULL);
+        Arena_T arena = Arena_new();
+        HttpWatch watch = NULL;
+        init_service();
+        int count = iterations * 100;
+        unsigned long long started = Latency_now();
+        for (int i = 0; i < count; i++) {
+                if (write(fd[1], REQUEST, sizeof(REQUEST) - 1) != sizeof(REQUEST) - 1) {
+                        LogError("Cannot send the request -- %s\n", STRERROR);
+                        break;
+                }
+                Http_Result result = http_processor(S, arena, true, &watch);
+                Arena_reset(arena);
+                // The response was written before http_processor() returned, drain it
+                char response[4096];
+                while (recv(fd[1], response, sizeof(response), MSG_DONTWAIT) > 0)
+                        ;
+                if (result != Http_KeepAlive) {
+                        LogError("Unexpected HTTP processor result %d\n", result);
+                        break;
+                }
+        }
+        _result(B, "http_request", "requests", count, 1, started);
+        Arena_free(&arena);
+        Socket_free(&S);
+        close(fd[1]);
+}
+
+
+static void _usage(Usage_T *u) {
+        u->rss = u->syscr = u->syscw = -1;
+#ifdef LINUX
+        FILE *f;
+        if ((f = fopen("/proc/self/statm", "r"))) {
+                long long size, resident;
+                if (fscanf(f, "%lld %lld", &size, &resident) == 2)
+                        u->rss = resident * sysconf(_SC_PAGESIZE);
+                fclose(f);
+        }
+        if ((f = fopen("/proc/self/io", "r"))) {
+                char line[STRLEN];
+                while (fgets(line, sizeof(line), f)) {
+                        sscanf(line, "syscr: %lld", &u->syscr);
+                        sscanf(line, "syscw: %lld", &u->syscw);
+                }
+                fclose(f);
+        }
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+                u->rss = usage.ru_maxrss * 1024LL; // The peak resident size only
+#endif
+}
+
+
+/* The fake endpoint of the host services, accept and close the connections */
+static void *_endpoint(void *args) {
+        Thread_detach(Thread_self());
+        int server = *(int *)args;
+        while (true) {
+                if (Net_canRead(server, 1000)) {
+                        int client = accept(server, NULL, NULL);
+                        if (client >= 0)
+                                close(client);
+                }
+        }
+        return NULL;
+}
+
+
+static void _scale(StringBuffer_T B, int cycles) {
+        StringBuffer_append(B, ",\"cycles\":[");
+        for (int i = 1; i <= cycles; i++) {
+                Usage_T before, after;
+                _usage(&before);
+                unsigned long allocated = allocations;
+                unsigned long long started = Latency_now();
+                int errors = validate();
+                unsigned long long elapsed = Latency_now() - started;
+                allocated = allocations - allocated;
+                _usage(&after);
+                StringBuffer_append(B,
+                        "%s{\"cycle\":%d,\"usec\":%llu,\"errors\":%d,\"rss\":%lld,\"read_syscalls\":%lld,\"write_syscalls\":%lld,\"allocations\":%lu}",
+                        i > 1 ? "," : "",
+                        i,
+                        elapsed,
+                        errors,
+                        after.rss,
+                        after.syscr >= 0 && before.syscr >= 0 ? after.syscr - before.syscr : -1,
+                        after.syscw >= 0 && before.syscw >= 0 ? after.syscw - before.syscw : -1,
+                        allocated);
+        }
+        StringBuffer_append(B, "]");
+}
+
+
+static void _init(char *controlfile) {
+        Run.once = true;
+        Mutex_init(Run.mutex);
+        Run.controlfile = controlfile;
+        Run.doprocess = init_process_info();
+        if (! parse(Run.controlfile))
+                exit(1);
+        if (! log_init())
+                exit(1);
+        if (! servicelist) {
+                LogError("No services has been specified\n");
+                exit(1);
+        }
+        file_init();
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+/* The C library allocator wrappers, see -Wl,--wrap in Makefile.am */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+
+void *__wrap_malloc(size_t size) {
+        __sync_fetch_and_add(&allocations, 1);
+        return __real_malloc(size);
+}
+
+
+void *__wrap_calloc(size_t count, size_t size) {
+        __sync_fetch_and_add(&allocations, 1);
+        return __real_calloc(count, size);
+}
+
+
+void *__wrap_realloc(void *p, size_t size) {
+        __sync_fetch_and_add(&allocations, 1);
+        return __real_realloc(p, size);
+}
+
+
+int main(int argc, char **argv) {
+        Bootstrap();
+        Bootstrap_setAbortHandler(vLogAbortHandler);
+        Bootstrap_setErrorHandler(vLogError);
+        setlocale(LC_ALL, "C");
+        prog = File_basename(argv[0]);
+#ifdef HAVE_OPENSSL
+        Ssl_start();
+#endif
+        init_env();
+        char *controlfile = NULL;
+        int cycles = 10, port = 2899, opt;
+        while ((opt = getopt(argc, argv, "c:i:k:p:")) != -1) {
+                switch (opt) {
+                        case 'c':
+                                controlfile = Str_dup(optarg);
+                                break;
+                        case 'i':
+                                iterations = Str_parseInt(optarg);
+                                break;
+                        case 'k':
+                                cycles = Str_parseInt(optarg);
+                                break;
+                        case 'p':
+                                port = Str_parseInt(optarg);
+                                break;
+                        default:
+                                fprintf(stderr, "Usage: %s -c monitrc [-i iterations] [-k cycles] [-p port] [micro|scale]\n", prog);
+                                exit(1);
+                }
+        }
+        const char *mode = argv[optind] ? argv[optind] : "micro";
+        if (! controlfile || iterations < 1 || cycles < 1 || ! (IS(mode, "micro") || IS(mode, "scale"))) {
+                fprintf(stderr, "Usage: %s -c monitrc [-i iterations] [-k cycles] [-p port] [micro|scale]\n", prog);
+                exit(1);
+        }
+        _init(controlfile);
+        int services = 0;
+        for (Service_T s = servicelist; s; s = s->next)
+                services++;
+        StringBuffer_T B = StringBuffer_create(4096);
+        StringBuffer_append(B, "{\"version\":\"%s\",\"mode\":\"%s\",\"services\":%d", VERSION, mode, services);
+        if (IS(mode, "scale")) {
+                int server = create_server_socket("127.0.0.1", port, 1024);
+                if (server < 0)
+                        exit(1);
+                Thread_T thread;
+                Thread_create(thread, _endpoint, &server);
+                _scale(B, cycles);
+        } else {
+                // Collect the service data first, so the status shows the complete service information
+                validate();
+                StringBuffer_append(B, ",\"benchmarks\":[");
+                _status(B, services);
+                _match(B);
+                _event(B, services);
+                _processtree(B);
+                _digests(B);
+                _http(B);
+                StringBuffer_append(B, "]");
+        }
+        StringBuffer_append(B, "}");
+        printf("%s\n", StringBuffer_toString(B));
+        StringBuffer_free(&B);
+        return 0;
+}
@@ -0,0 +1,91 @@
+#!/bin/sh
+# Copyright (C) Tildeslash Ltd. All rights reserved.
+#
+# Generate a synthetic Monit configuration for the benchmarks (see bench.c).
+#
+# Usage: genconfig.sh [-n services] [-t types] [-p port] -d directory
+#
+# Writes the control file directory/monitrc with the given number of
+# services (default 1000) of each type in the list (default "file"):
+#
+#   process     matches the monit_bench process, with cpu and memory rules
+#   file        the synthetic log, with a size rule
+#   filesystem  the root filesystem, with space and inode rules
+#   host        localhost with a TCP test of the fake endpoint at the port
+#               (default 2899), which monit_bench listens at in scale mode
+#   program     /bin/true, with an exit status rule
+#
+# The service bench_log matches the synthetic log directory/bench.log. The
+# state, id and log files are kept in the directory too.
+
+services=1000
+types="file"
+port=2899
+directory=""
+
+usage() {
+        echo "Usage: $0 [-n services] [-t types] [-p port] -d directory" >&2
+        exit 1
+}
+
+while getopts "n:t:p:d:" option; do
+        case $option in
+                n) services=$OPTARG ;;
+                t) types=$OPTARG ;;
+                p) port=$OPTARG ;;
+                d) directory=$OPTARG ;;
+                *) usage ;;
+        esac
+done
+
+[ -n "$directory" ] || usage
+
+for type in $types; do
+        case $type in
+                process|file|filesystem|host|program) ;;
+                *) echo "Unknown service type -- $type" >&2; exit 1 ;;
+        esac
+done
+
+mkdir -p "$directory" || exit 1
+directory=`cd "$directory" && pwd`
+
+# The log has 100000 lines (about 7 MB), every 100th line is an error
+awk 'BEGIN {
+        for (i = 0; i < 100000; i++)
+                printf("2024-01-01T00:00:%02d host app[%d]: %s request %d served in %d ms\n", i % 60, 1000 + i % 97, i % 100 ? "INFO" : "ERROR", i, i % 977);
+}' > "$directory/bench.log" || exit 1
+
+awk -v services="$services" -v types="$types" -v port="$port" -v directory="$directory" 'BEGIN {
+        printf("set log %s/monit.log\n", directory);
+        printf("set idfile %s/monit.id\n", directory);
+        printf("set statefile %s/monit.state\n\n", directory);
+        printf("check file bench_log with path %s/bench.log\n", directory);
+        printf("    if content = \"ERROR request [0-9]+\" then alert\n\n");
+        count = split(types, type, " ");
+        for (t = 1; t <= count; t++) {
+                for (i = 1; i <= services; i++) {
+                        if (type[t] == "process") {
+                                printf("check process process_%d matching \"monit_bench\"\n", i);
+                                printf("    if cpu > 95%% for 3 cycles then alert\n");
+                                printf("    if memory > 4 GB then alert\n");
+                        } else if (type[t] == "file") {
+                                printf("check file file_%d with path %s/bench.log\n", i, directory);
+                                printf("    if size > 100 MB then alert\n");
+                        } else if (type[t] == "filesystem") {
+                                printf("check filesystem filesystem_%d with path /\n", i);
+                                printf("    if space usage > 99%% then alert\n");
+                                printf("    if inode usage > 99%% then alert\n");
+                        } else if (type[t] == "host") {
+                                printf("check host host_%d with address 127.0.0.1\n", i);
+                                printf("    if failed port %d type tcp with timeout 5 seconds then alert\n", port);
+                        } else if (type[t] == "program") {
+                                printf("check program program_%d with path /bin/true\n", i);
+                                printf("    if status != 0 then alert\n");
+                        }
+                        printf("    group bench_%d\n\n", i % 10);
+                }
+        }
+}' > "$directory/monitrc" || exit 1
+
+chmod 600 "$directory/monitrc"
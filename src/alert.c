@@ -52,6 +52,8 @@
 #include "event.h"
 #include "net.h"
 #include "alert.h"
+#include "latency.h"
+#include "probe.h"
 
 // libmonit
 #include "system/Time.h"
@@ -158,8 +160,10 @@ Handler_Type handle_alert(Event_T E) {
                         }
                 }
                 if (list) {
+                        unsigned long long started = Latency_now();
                         if (sendmail(list))
                                 rv = Handler_Alert;
+                        PROBE3(alert__send, s->name, rv == Handler_Succeeded, Latency_now() - started);
                         gc_mail_list(&list);
                 }
         }
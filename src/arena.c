@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "arena.h"
+
+/**
+ *  Region allocator for configuration objects.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define ARENA_BLOCKSIZE 4096
+
+
+/* Alignment which is good for any object type */
+typedef union {
+        long l;
+        long long ll;
+        double d;
+        long double ld;
+        void *p;
+        void (*f)(void);
+} align_t;
+
+
+#define ALIGN(n) (((n) + sizeof(align_t) - 1) & ~(sizeof(align_t) - 1))
+
+
+typedef struct Block_T {
+        struct Block_T *next;
+        size_t size;    /**< Usable bytes in this block */
+        size_t used;    /**< Bytes allocated from this block */
+        align_t data[]; /**< Block memory */
+} *Block_T;
+
+
+#define T Arena_T
+struct T {
+        Block_T blocks; /**< The block list, the block being filled is first */
+        Block_T spare;  /**< Blocks released by Arena_reset() for reuse */
+};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static Block_T _newBlock(size_t size) {
+        Block_T b = CALLOC(1, sizeof(struct Block_T) + size);
+        b->size = size;
+        return b;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+T Arena_new() {
+        T A;
+        NEW(A);
+        return A;
+}
+
+
+void *Arena_alloc(T A, size_t size) {
+        ASSERT(A);
+        size = ALIGN(size ? size : 1);
+        Block_T b = A->blocks;
+        if (! b || b->size - b->used < size) {
+                if (size > ARENA_BLOCKSIZE / 4) {
+                        // Large object, use a dedicated block and keep filling the current one
+                        Block_T large = _newBlock(size);
+                        large->used = size;
+                        if (b) {
+                                large->next = b->next;
+                                b->next = large;
+                        } else {
+                                A->blocks = large;
+                        }
+                        return large->data;
+                }
+                if ((b = A->spare))
+                        A->spare = b->next;
+                else
+                        b = _newBlock(ARENA_BLOCKSIZE);
+                b->next = A->blocks;
+                A->blocks = b;
+        }
+        void *p = (char *)b->data + b->used;
+        b->used += size;
+        return p;
+}
+
+
+char *Arena_dup(T A, const char *s) {
+        if (! s)
+                return NULL;
+        size_t n = strlen(s) + 1;
+        return memcpy(Arena_alloc(A, n), s, n);
+}
+
+
+void Arena_trim(T A, void *p, size_t size) {
+        ASSERT(A);
+        Block_T b = A->blocks;
+        if (b && (char *)p >= (char *)b->data && (char *)p < (char *)b->data + b->used) {
+                size_t used = ALIGN((char *)p - (char *)b->data + size);
+                if (used < b->used) {
+                        memset((char *)b->data + used, 0, b->used - used);
+                        b->used = used;
+                }
+        }
+}
+
+
+void Arena_reset(T A) {
+        ASSERT(A);
+        for (Block_T b = A->blocks, next; b; b = next) {
+                next = b->next;
+                if (b->size == ARENA_BLOCKSIZE) {
+                        memset(b->data, 0, b->used);
+                        b->used = 0;
+                        b->next = A->spare;
+                        A->spare = b;
+                } else {
+                        FREE(b);
+                }
+        }
+        A->blocks = NULL;
+}
+
+
+void Arena_free(T *A) {
+        ASSERT(A && *A);
+        Arena_reset(*A);
+        for (Block_T b = (*A)->spare, next; b; b = next) {
+                next = b->next;
+                FREE(b);
+        }
+        FREE(*A);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_ARENA_H
+#define MONIT_ARENA_H
+
+
+/**
+ * An <b>Arena</b> is a region allocator for objects which live as long
+ * as the configuration which created them. Objects are allocated
+ * sequentially from large blocks, so the rule lists of a service are
+ * kept close together in memory, and they are not freed individually:
+ * the whole arena is released with one call. Each service owns an
+ * arena, holding its rule lists and event actions. The HTTP server
+ * keeps an arena per client connection for the parsed requests, which
+ * is reset after each request.
+ *
+ * @file
+ */
+
+
+#define T Arena_T
+typedef struct T *T;
+
+
+/**
+ * Create a new empty Arena
+ * @return A new Arena object
+ */
+T Arena_new();
+
+
+/**
+ * Allocate size bytes from the arena. The memory is zeroed and aligned
+ * for any object type. If the allocation fails, MemoryException is
+ * thrown
+ * @param A An Arena object
+ * @param size The number of bytes to allocate
+ * @return A pointer to the allocated memory
+ */
+void *Arena_alloc(T A, size_t size);
+
+
+/**
+ * Copy the string to the arena
+ * @param A An Arena object
+ * @param s The string to copy, may be NULL
+ * @return A copy of s allocated from the arena or NULL if s is NULL
+ */
+char *Arena_dup(T A, const char *s);
+
+
+/**
+ * Shrink the last allocation of the arena to size bytes, so a buffer
+ * allocated for the worst case can keep just the bytes it used. Nothing
+ * happens if p is not the last allocation
+ * @param A An Arena object
+ * @param p The last allocation as returned by Arena_alloc()
+ * @param size The new size in bytes
+ */
+void Arena_trim(T A, void *p, size_t size);
+
+
+/**
+ * Release all objects allocated from the arena. The blocks are kept for
+ * the next allocations, so an arena reused for short lived objects (for
+ * example one per HTTP connection) doesn't allocate in the steady state
+ * @param A An Arena object
+ */
+void Arena_reset(T A);
+
+
+/**
+ * Release all objects allocated from the arena and the arena itself
+ * @param A An Arena object reference
+ */
+void Arena_free(T *A);
+
+
+/**
+ * Allocate a new object of the pointer's type from the arena
+ * @param A An Arena object
+ * @param p The pointer to set
+ */
+#define ARENA_NEW(A, p) ((p) = Arena_alloc((A), (size_t)sizeof *(p)))
+
+
+#undef T
+#endif
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#include "monit.h"
+#include "cgroup.h"
+#include "latency.h"
+
+/**
+ *  Control group statistics - Linux cgroup v1 and v2 reader.
+ *
+ *  @file
+ */
+
+
+#ifdef LINUX
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+
+/* The counters read from the cgroup files in one update */
+typedef struct Sample_T {
+        unsigned long long cpu;                           /**< Total CPU time [us] */
+        unsigned long long memory;                           /**< Memory usage [B] */
+        unsigned long long read;                             /**< Total bytes read */
+        unsigned long long write;                         /**< Total bytes written */
+        boolean_t io;                                /**< Whether the I/O was read */
+        int tasks;                                            /**< Number of tasks */
+        int processes;                                    /**< Number of processes */
+} Sample_T;
+
+
+static int version = -1; // The hierarchy version, cached on the first use
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static int _version() {
+        if (version < 0) {
+                if (access(CGROUP_ROOT "/cgroup.controllers", R_OK) == 0)
+                        version = 2;
+                else if (access(CGROUP_ROOT "/memory", R_OK) == 0 || access(CGROUP_ROOT "/cpuacct", R_OK) == 0)
+                        version = 1;
+                else
+                        version = 0;
+        }
+        return version;
+}
+
+
+/**
+ * Read the file in the given cgroup directory into the buffer
+ */
+static boolean_t _read(const char *dir, const char *file, char *buf, int size) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return false;
+        ssize_t n = read(fd, buf, size - 1);
+        close(fd);
+        if (n < 0)
+                return false;
+        buf[n] = 0;
+        return true;
+}
+
+
+static boolean_t _number(const char *dir, const char *file, unsigned long long *value) {
+        char buf[64];
+        if (! _read(dir, file, buf, sizeof(buf)))
+                return false;
+        char *end;
+        *value = strtoull(buf, &end, 10);
+        return end != buf;
+}
+
+
+/**
+ * Find the value of the "key value" line in the buffer
+ */
+static boolean_t _key(const char *buf, const char *key, unsigned long long *value) {
+        size_t length = strlen(key);
+        for (const char *line = buf; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+                if (! strncmp(line, key, length) && line[length] == ' ') {
+                        *value = strtoull(line + length + 1, NULL, 10);
+                        return true;
+                }
+        }
+        return false;
+}
+
+
+/**
+ * Count the lines of the file (the members of cgroup.procs, tasks, ...)
+ * @return The number of lines or -1 if the file cannot be read
+ */
+static int _lines(const char *dir, const char *file) {
+        char path[PATH_MAX], buf[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+        int lines = 0;
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+                for (ssize_t i = 0; i < n; i++)
+                        if (buf[i] == '\n')
+                                lines++;
+        close(fd);
+        return n < 0 ? -1 : lines;
+}
+
+
+static boolean_t _hasController(const char *list, const char *controller) {
+        size_t length = strlen(controller);
+        for (const char *c = list; c; c = strchr(c, ',') ? strchr(c, ',') + 1 : NULL)
+                if (! strncmp(c, controller, length) && (c[length] == ',' || c[length] == 0))
+                        return true;
+        return false;
+}
+
+
+/**
+ * Get the cgroup directory. The controller is NULL for the unified
+ * hierarchy (cgroup v2), otherwise the cgroup v1 controller name
+ */
+static boolean_t _directory(Cgroup_T C, pid_t pid, const char *controller, char *dir, int size) {
+        const char *path = C->path;
+        char buf[8192];
+        if (pid) {
+                char proc[32];
+                snprintf(proc, sizeof(proc), "/proc/%d", (int)pid);
+                if (! _read(proc, "cgroup", buf, sizeof(buf)))
+                        return false;
+                path = NULL;
+                // The line format is "hierarchy-ID:controller-list:cgroup-path"
+                char *save = NULL;
+                for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+                        char *list = strchr(line, ':');
+                        char *p = list ? strchr(list + 1, ':') : NULL;
+                        if (p) {
+                                *p++ = 0;
+                                list++;
+                                if (controller ? _hasController(list, controller) : ! *list) {
+                                        path = p;
+                                        break;
+                                }
+                        }
+                }
+                if (! path)
+                        return false;
+        } else if (! strncmp(path, CGROUP_ROOT "/", sizeof(CGROUP_ROOT))) {
+                path += sizeof(CGROUP_ROOT) - 1;
+        }
+        snprintf(dir, size, "%s%s%s%s%s", CGROUP_ROOT, controller ? "/" : "", controller ? controller : "", *path == '/' ? "" : "/", path);
+        return true;
+}
+
+
+static boolean_t _updateV2(Cgroup_T C, pid_t pid, Sample_T *S) {
+        char dir[PATH_MAX], buf[8192];
+        if (! _directory(C, pid, NULL, dir, sizeof(dir)) || (S->processes = _lines(dir, "cgroup.procs")) < 0) {
+                DEBUG("cgroup '%s' not found\n", pid ? "of the process" : C->path);
+                return false;
+        }
+        if (_read(dir, "cpu.stat", buf, sizeof(buf)))
+                _key(buf, "usage_usec", &S->cpu);
+        _number(dir, "memory.current", &S->memory);
+        // The io.stat lines format is "major:minor rbytes=N wbytes=N rios=N wios=N ..."
+        if (_read(dir, "io.stat", buf, sizeof(buf))) {
+                S->io = true;
+                for (char *p = buf; (p = strstr(p, "rbytes=")); )
+                        S->read += strtoull(p + 7, &p, 10);
+                for (char *p = buf; (p = strstr(p, "wbytes=")); )
+                        S->write += strtoull(p + 7, &p, 10);
+        }
+        unsigned long long tasks;
+        S->tasks = _number(dir, "pids.current", &tasks) ? (int)tasks : _lines(dir, "cgroup.threads");
+        return true;
+}
+
+
+static boolean_t _updateV1(Cgroup_T C, pid_t pid, Sample_T *S) {
+        char dir[PATH_MAX], buf[8192];
+        boolean_t found = false;
+        if (_directory(C, pid, "cpuacct", dir, sizeof(dir)) && _number(dir, "cpuacct.usage", &S->cpu)) {
+                S->cpu /= 1000; // ns -> us
+                S->processes = _lines(dir, "cgroup.procs");
+                S->tasks = _lines(dir, "tasks");
+                found = true;
+        }
+        if (_directory(C, pid, "memory", dir, sizeof(dir)) && _number(dir, "memory.usage_in_bytes", &S->memory)) {
+                if (! found) {
+                        S->processes = _lines(dir, "cgroup.procs");
+                        S->tasks = _lines(dir, "tasks");
+                }
+                found = true;
+        }
+        if (! found) {
+                DEBUG("cgroup '%s' not found\n", pid ? "of the process" : C->path);
+                return false;
+        }
+        // The blkio lines format is "major:minor Read|Write|Sync|Async|Discard|Total N" and the summary "Total N"
+        if (_directory(C, pid, "blkio", dir, sizeof(dir)) && _read(dir, "blkio.throttle.io_service_bytes", buf, sizeof(buf))) {
+                S->io = true;
+                char *save = NULL;
+                for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+                        char operation[16];
+                        unsigned long long bytes;
+                        if (sscanf(line, "%*s %15s %llu", operation, &bytes) == 2) {
+                                if (IS(operation, "Read"))
+                                        S->read += bytes;
+                                else if (IS(operation, "Write"))
+                                        S->write += bytes;
+                        }
+                }
+        }
+        unsigned long long tasks;
+        if (_directory(C, pid, "pids", dir, sizeof(dir)) && _number(dir, "pids.current", &tasks))
+                S->tasks = (int)tasks;
+        return true;
+}
+
+
+static long long _rate(unsigned long long current, unsigned long long previous, unsigned long long elapsed) {
+        return current >= previous ? (long long)((double)(current - previous) * 1000000. / (double)elapsed) : -1LL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+boolean_t Cgroup_isSupported() {
+        return _version() > 0;
+}
+
+
+boolean_t Cgroup_update(Cgroup_T C, pid_t pid) {
+        ASSERT(C);
+        int v = _version();
+        if (! v) {
+                DEBUG("control groups are not available\n");
+                return false;
+        }
+        if (C->pid != pid || C->version != v) {
+                // Another process (or hierarchy), the counters are not comparable
+                Cgroup_reset(C);
+                C->pid = pid;
+                C->version = v;
+        }
+        Sample_T S = {.tasks = -1};
+        if (! (v == 2 ? _updateV2(C, pid, &S) : _updateV1(C, pid, &S))) {
+                Cgroup_reset(C);
+                return false;
+        }
+        unsigned long long now = Latency_now();
+        if (C->sampled && now > C->sampled) {
+                unsigned long long elapsed = now - C->sampled;
+                C->cpu_percent = S.cpu >= C->cpu_usage ? (short)(1000. * (double)(S.cpu - C->cpu_usage) / (double)elapsed / (systeminfo.cpus > 0 ? systeminfo.cpus : 1)) : -1;
+                C->read_rate = S.io ? _rate(S.read, C->read_bytes, elapsed) : -1LL;
+                C->write_rate = S.io ? _rate(S.write, C->write_bytes, elapsed) : -1LL;
+        }
+        C->cpu_usage = S.cpu;
+        C->read_bytes = S.read;
+        C->write_bytes = S.write;
+        C->sampled = now;
+        C->mem_kbyte = S.memory / 1024;
+        C->mem_percent = systeminfo.mem_kbyte_max > 0 ? (short)(1000. * (double)C->mem_kbyte / (double)systeminfo.mem_kbyte_max) : 0;
+        C->tasks = S.tasks;
+        C->processes = S.processes;
+        return true;
+}
+
+
+void Cgroup_reset(Cgroup_T C) {
+        ASSERT(C);
+        C->cpu_percent = -1;
+        C->mem_percent = 0;
+        C->mem_kbyte = 0LL;
+        C->tasks = -1;
+        C->processes = 0;
+        C->read_rate = -1LL;
+        C->write_rate = -1LL;
+        C->cpu_usage = 0ULL;
+        C->read_bytes = 0ULL;
+        C->write_bytes = 0ULL;
+        C->sampled = 0ULL;
+}
+
+
+#else
+
+
+boolean_t Cgroup_isSupported() {
+        return false;
+}
+
+
+boolean_t Cgroup_update(Cgroup_T C, pid_t pid) {
+        return false;
+}
+
+
+void Cgroup_reset(Cgroup_T C) {
+}
+
+
+#endif
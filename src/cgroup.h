@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_CGROUP_H
+#define MONIT_CGROUP_H
+
+
+/**
+ * Control group statistics.
+ *
+ * On Linux, Monit can read the resource usage accounted by the kernel for
+ * a control group: the CPU time, the memory usage, the block I/O bytes and
+ * the number of tasks and processes. Both the unified hierarchy (cgroup v2)
+ * and the legacy per-controller hierarchies (cgroup v1) are supported. The
+ * statistics are used by the "check cgroup" service and by the "cgroup
+ * totals" process option, which takes the process totals from the cgroup
+ * of the process instead of summarizing its children. On other platforms
+ * the control groups are not available.
+ *
+ *  @file
+ */
+
+
+/**
+ * Check if the control groups are available on this system
+ * @return true if supported, otherwise false
+ */
+boolean_t Cgroup_isSupported();
+
+
+/**
+ * Update the control group statistics. The CPU usage and the I/O rates are
+ * computed from the difference to the previous update, they are unknown
+ * (-1) after the first update
+ * @param C The cgroup statistics object
+ * @param pid If 0 the cgroup path from the object is used, otherwise the
+ * statistics are read for the cgroup of the given process
+ * @return true if succeeded, otherwise false
+ */
+boolean_t Cgroup_update(Cgroup_T C, pid_t pid);
+
+
+/**
+ * Reset the control group statistics, the rates are unknown until the
+ * next two updates
+ * @param C The cgroup statistics object
+ */
+void Cgroup_reset(Cgroup_T C);
+
+
+#endif
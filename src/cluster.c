@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "net.h"
+#include "socket.h"
+#include "cluster.h"
+
+
+/**
+ *  Remote host checks shared by the monit cluster members.
+ *
+ *  The members exchange the results through the /_cluster page of their
+ *  http interface: the first line is the member's monit id, each next
+ *  line is the last result of one host checked by the member:
+ *
+ *    name TAB sec usec error error_hint icmps [available response]... ports [available response]...
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+/* A peer which does not answer within the timeout is left out in this cycle, keep it short as the peers are asked sequentially */
+#define CLUSTER_TIMEOUT 2000
+
+/* The longest host result line, the longer lines are skipped */
+#define CLUSTER_LINE 4096
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/* Rendezvous hashing weight of the member for the service name: FNV-1a, finished with the MurmurHash3 mixer so the close ids spread well */
+static unsigned long long _score(const char *id, const char *name) {
+        unsigned long long h = 14695981039346656037ULL;
+        for (const unsigned char *p = (const unsigned char *)id; *p; p++)
+                h = (h ^ *p) * 1099511628211ULL;
+        h = (h ^ 0xff) * 1099511628211ULL;
+        for (const unsigned char *p = (const unsigned char *)name; *p; p++)
+                h = (h ^ *p) * 1099511628211ULL;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+}
+
+
+/* The members are ranked by the weight, the tie is broken by the id so all members agree on the order */
+static boolean_t _above(unsigned long long a, const char *aid, unsigned long long b, const char *bid) {
+        return a > b || (a == b && strcmp(aid, bid) > 0);
+}
+
+
+/* Ask the peer for its monit id and the results of the hosts it checks, returns false if the peer did not answer */
+static boolean_t _ask(Peer_T p, StringBuffer_T results) {
+        boolean_t answered = false;
+        Socket_T S = Socket_create(p->url->hostname, p->url->port, Socket_Tcp, Socket_Ip, (SslOptions_T){.use_ssl = IS(p->url->protocol, "https")}, CLUSTER_TIMEOUT);
+        if (S) {
+                char *auth = Util_getBasicAuthHeader(p->url->user, p->url->password);
+                Socket_print(S, "GET %s%s_cluster HTTP/1.0\r\n%s\r\n", p->url->path, Str_endsWith(p->url->path, "/") ? "" : "/", auth ? auth : "");
+                FREE(auth);
+                int status = 0;
+                char buf[CLUSTER_LINE];
+                /* Read past HTTP headers and check status */
+                while (Socket_readLine(S, buf, sizeof(buf))) {
+                        if (*buf == '\n' || *buf == '\r')
+                                break;
+                        if (Str_startsWith(buf, "HTTP/"))
+                                sscanf(buf, "HTTP/%*s %d", &status);
+                }
+                if (status == 200 && Socket_readLine(S, buf, sizeof(buf)) && *Str_trim(buf)) {
+                        snprintf(p->id, sizeof(p->id), "%s", buf);
+                        answered = true;
+                        /* The line longer than the buffer is skipped to its end */
+                        for (boolean_t whole = true; Socket_readLine(S, buf, sizeof(buf));) {
+                                boolean_t complete = Str_endsWith(buf, "\n");
+                                if (whole && complete)
+                                        StringBuffer_append(results, "%s", buf);
+                                whole = complete;
+                        }
+                } else {
+                        DEBUG("Cluster peer %s answered with status %d\n", p->url->url, status);
+                }
+                Socket_free(&S);
+        }
+        return answered;
+}
+
+
+/* Apply the host result sent by the peer, if the peer checks the host for this instance */
+static void _mirror(Peer_T p, char *line) {
+        char *name = line, *end = strchr(line, '\t');
+        if (! end)
+                return;
+        *end++ = 0;
+        Peer_T owner = NULL;
+        Service_T s = Util_getService(name);
+        if (! s || s->type != Service_Host || s->monitor == Monitor_Not || Cluster_owns(s, &owner) || owner != p)
+                return;
+        s->collected.tv_sec = strtoll(end, &end, 10);
+        s->collected.tv_usec = strtol(end, &end, 10);
+        s->error = (int)strtol(end, &end, 10);
+        s->error_hint = (int)strtol(end, &end, 10);
+        Icmp_T i = s->icmplist;
+        for (int n = (int)strtol(end, &end, 10); n > 0; n--) {
+                boolean_t available = strtol(end, &end, 10) != 0;
+                double response = strtod(end, &end);
+                if (i) {
+                        i->is_available = available;
+                        i->response = response;
+                        i = i->next;
+                }
+        }
+        Port_T port = s->portlist;
+        for (int n = (int)strtol(end, &end, 10); n > 0; n--) {
+                boolean_t available = strtol(end, &end, 10) != 0;
+                double response = strtod(end, &end);
+                if (port) {
+                        port->is_available = available;
+                        port->response = response;
+                        port = port->next;
+                }
+        }
+        s->monitor = Monitor_Yes;
+        DEBUG("'%s' status received from the cluster peer %s\n", s->name, p->url->url);
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void Cluster_update() {
+        int count = 0;
+        for (Peer_T p = Run.cluster.peers; p; p = p->next)
+                count++;
+        StringBuffer_T *results = CALLOC(count, sizeof(StringBuffer_T));
+        int index = 0;
+        for (Peer_T p = Run.cluster.peers; p; p = p->next, index++) {
+                results[index] = StringBuffer_create(STRLEN);
+                boolean_t up = _ask(p, results[index]);
+                if (up) {
+                        /* The configuration shared by all members lists the instance itself too, and one member may be listed by several urls */
+                        if (IS(p->id, Run.id)) {
+                                up = false;
+                        } else {
+                                for (Peer_T q = Run.cluster.peers; q != p; q = q->next) {
+                                        if (q->up && IS(q->id, p->id)) {
+                                                up = false;
+                                                break;
+                                        }
+                                }
+                        }
+                        if (! up)
+                                DEBUG("Cluster peer %s is not another member -- skipped\n", p->url->url);
+                }
+                if (up != p->up) {
+                        if (up)
+                                LogInfo("Cluster peer %s joined -- the remote host checks are shared\n", p->url->url);
+                        else
+                                LogWarning("Cluster peer %s does not answer -- its remote host checks are taken over\n", p->url->url);
+                        p->up = up;
+                }
+        }
+        /* The hosts checked by the other members wait for the owner's results, which are applied when the membership is known */
+        for (Service_T s = servicelist; s; s = s->next)
+                if (s->type == Service_Host && s->monitor != Monitor_Not && ! Cluster_owns(s, NULL))
+                        s->monitor |= Monitor_Waiting;
+        index = 0;
+        for (Peer_T p = Run.cluster.peers; p; p = p->next, index++) {
+                if (p->up && StringBuffer_length(results[index])) {
+                        char *lines = Str_dup(StringBuffer_toString(results[index]));
+                        for (char *line = lines, *next; line && *line; line = next) {
+                                if ((next = strchr(line, '\n')))
+                                        *next++ = 0;
+                                _mirror(p, line);
+                        }
+                        FREE(lines);
+                }
+                StringBuffer_free(&results[index]);
+        }
+        FREE(results);
+}
+
+
+void Cluster_status(StringBuffer_T B) {
+        ASSERT(B);
+        StringBuffer_append(B, "%s\n", Run.id);
+        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+                if (s->type != Service_Host || ! (s->monitor & Monitor_Yes) || ! Cluster_owns(s, NULL))
+                        continue;
+                int icmps = 0, ports = 0;
+                for (Icmp_T i = s->icmplist; i; i = i->next)
+                        icmps++;
+                for (Port_T p = s->portlist; p; p = p->next)
+                        ports++;
+                StringBuffer_append(B, "%s\t%lld %ld %d %d %d", s->name, (long long)s->collected.tv_sec, (long)s->collected.tv_usec, s->error, s->error_hint, icmps);
+                for (Icmp_T i = s->icmplist; i; i = i->next)
+                        StringBuffer_append(B, " %d %.6f", i->is_available ? 1 : 0, i->response);
+                StringBuffer_append(B, " %d", ports);
+                for (Port_T p = s->portlist; p; p = p->next)
+                        StringBuffer_append(B, " %d %.6f", p->is_available ? 1 : 0, p->response);
+                StringBuffer_append(B, "\n");
+        }
+}
+
+
+boolean_t Cluster_owns(Service_T s, Peer_T *owner) {
+        ASSERT(s);
+        if (s->type != Service_Host || ! Run.cluster.peers)
+                return true;
+        unsigned long long self = _score(Run.id, s->name), best = 0;
+        int rank = 0;
+        Peer_T top = NULL;
+        for (Peer_T p = Run.cluster.peers; p; p = p->next) {
+                if (p->up) {
+                        unsigned long long score = _score(p->id, s->name);
+                        if (_above(score, p->id, self, Run.id)) {
+                                rank++;
+                                if (! top || _above(score, p->id, best, top->id)) {
+                                        top = p;
+                                        best = score;
+                                }
+                        }
+                }
+        }
+        if (rank < Run.cluster.replicas)
+                return true;
+        if (owner)
+                *owner = top;
+        return false;
+}
+
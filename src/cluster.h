@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_CLUSTER_H
+#define MONIT_CLUSTER_H
+
+
+/**
+ * The monit cluster.
+ *
+ * The monit instances listed by the "set cluster" statement share the
+ * remote host checks: each remote host is checked by the members ranked
+ * highest for its service name (rendezvous hashing of the member id and
+ * the service name), the other members skip it. The membership is
+ * refreshed at the start of each cycle by asking each peer for its monit
+ * id using its http interface, so when a peer stops answering, the hosts
+ * it checked are taken over by the remaining members in the same cycle.
+ * A member, which is not reachable from the other members checks all the
+ * hosts itself. The same request returns the last results of the hosts
+ * checked by the peer, so the other members show the owner's status of
+ * each host instead of checking it. The alerts are sent by the owner.
+ *
+ *  @file
+ */
+
+
+/**
+ * Refresh the cluster membership. Each peer is asked for its monit id,
+ * the peers which did not answer are left out of the host assignment
+ * until they answer again. The peer listed in the configuration of the
+ * instance itself is recognized by the id and skipped. The hosts checked
+ * by the peers get the owner's last results, the hosts whose owner didn't
+ * send a result are waiting
+ */
+void Cluster_update();
+
+
+/**
+ * Write the monit id and the last results of the remote hosts checked by
+ * this instance for the cluster peers (the /_cluster page)
+ * @param B The output buffer
+ */
+void Cluster_status(StringBuffer_T B);
+
+
+/**
+ * Test if this instance checks the service. All services except the
+ * remote hosts, and all services of an instance without cluster peers,
+ * are checked locally
+ * @param s The service
+ * @param owner If not NULL and the service is checked by another member,
+ * set to the member which checks it
+ * @return true if the service is checked by this instance, otherwise false
+ */
+boolean_t Cluster_owns(Service_T s, Peer_T *owner);
+
+
+#endif
+
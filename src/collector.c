@@ -41,77 +41,522 @@
 #include <errno.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #include "monit.h"
 #include "socket.h"
 #include "event.h"
+#include "latency.h"
+#include "probe.h"
+
+// libmonit
+#include "system/Net.h"
+#include "system/Time.h"
+#include "exceptions/AssertException.h"
 
 
 /**
  *  Connect to a data collector servlet and send the event or status message.
+ *  The connection to each M/Monit server is kept open (HTTP/1.1 keep-alive)
+ *  and reused for the following messages. If more M/Monit servers are set
+ *  and the parallel mode is enabled, the message is sent to all servers at
+ *  once, each by its own sender thread.
  *
  *  @file
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+#define CHUNK_SIZE 8192
+
+
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* The parallel senders of one message */
+typedef struct myfanout {
+        int pending;                         /**< Senders which didn't finish yet */
+        int succeeded;                      /**< Senders which sent the message */
+        boolean_t abandoned;  /**< true if the caller doesn't wait for the rest */
+} *Fanout_T;
+
+/* The parallel sender thread argument */
+typedef struct mysender {
+        Mmonit_T C;                                          /**< The M/Monit server */
+        Event_T E;                           /**< Event copy or NULL for status */
+        Fanout_T fanout;                               /**< The message senders */
+} *Sender_T;
+
+/* The running parallel senders, guarded by the mutex */
+static struct {
+        int running;                           /**< Number of running senders */
+        Sem_T done;                        /**< Signaled when a sender finished */
+} senders = {.done = PTHREAD_COND_INITIALIZER};
+
+/* The JSON message stream */
+typedef struct mychunk {
+        Socket_T socket;                                       /**< The connection */
+        boolean_t failed;                          /**< true if the sending failed */
+} *Chunk_T;
+
+
 /* ----------------------------------------------------------------- Private */
 
 
 /**
- * Send message to the server
+ * Send message to the server. The message is gzip compressed if the server
+ * advertised the support in some previous response
+ * @param socket The connection
  * @param C An mmonit object
+ * @param type The content type
  * @param D Data to send
+ * @param size The data length
+ * @return true if the message sending succeeded otherwise false
+ */
+static boolean_t data_send(Socket_T socket, Mmonit_T C, const char *type, const char *D, size_t size) {
+        size_t length = size;
+        unsigned char *compressed = C->compress ? Util_gzip(D, size, &length) : NULL;
+        if (! compressed)
+                length = size;
+        char *auth = Util_getBasicAuthHeader(C->url->user, C->url->password);
+        char *head = Str_cat("POST %s HTTP/1.1\r\n"
+                             "Host: %s:%d\r\n"
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %lu\r\n"
+                             "%s"
+                             "Connection: keep-alive\r\n"
+                             "Pragma: no-cache\r\n"
+                             "Accept: */*\r\n"
+                             "User-Agent: Monit/%s\r\n"
+                             "%s"
+                             "\r\n",
+                             C->url->path,
+                             C->url->hostname, C->url->port,
+                             type,
+                             (unsigned long)length,
+                             compressed ? "Content-Encoding: gzip\r\n" : "",
+                             VERSION,
+                             auth ? auth : "");
+        FREE(auth);
+        /* The header and the message are sent with one gather write */
+        struct iovec iov[2] = {{.iov_base = head, .iov_len = strlen(head)}, {.iov_base = compressed ? (void *)compressed : (void *)D, .iov_len = length}};
+        int rv = Socket_writev(socket, iov, 2);
+        FREE(head);
+        FREE(compressed);
+        return rv < 0 ? false : true;
+}
+
+
+/**
+ * Send the buffered part of the JSON message as a HTTP chunk and clear the
+ * buffer. If sending failed, the rest of the message is dropped
+ * @param C A chunk object
+ * @param B Message buffer
+ */
+static void chunk_write(Chunk_T C, StringBuffer_T B) {
+        int length = StringBuffer_length(B);
+        if (length && ! C->failed) {
+                char size[16];
+                snprintf(size, sizeof(size), "%x\r\n", length);
+                struct iovec iov[3] = {{.iov_base = size, .iov_len = strlen(size)}, {.iov_base = (void *)StringBuffer_toString(B), .iov_len = length}, {.iov_base = "\r\n", .iov_len = 2}};
+                if (Socket_writev(C->socket, iov, 3) < 0)
+                        C->failed = true;
+        }
+        StringBuffer_clear(B);
+}
+
+
+/**
+ * The status_json() flush callback, the buffer is sent when it reached
+ * CHUNK_SIZE bytes, so the memory used by the message is bounded
+ * @param context A chunk object
+ * @param B Message buffer
+ */
+static void data_chunk(void *context, StringBuffer_T B) {
+        if (StringBuffer_length(B) >= CHUNK_SIZE)
+                chunk_write(context, B);
+}
+
+
+/**
+ * Stream the JSON message to the server. The message is rendered while it
+ * is sent using the chunked transfer encoding, it is not compressed
+ * @param socket The connection
+ * @param C An mmonit object
+ * @param sb The message buffer
+ * @param E An event object or NULL for status data
+ * @param since Send only the services changed since the given status
+ * generation (delta status report) or 0 for all services
+ * @param myip The client-side IP address
+ * @param generation Set to the status generation of the message
  * @return true if the message sending succeeded otherwise false
  */
-static boolean_t data_send(Socket_T socket, Mmonit_T C, const char *D) {
+static boolean_t data_stream(Socket_T socket, Mmonit_T C, StringBuffer_T sb, Event_T E, unsigned long long since, const char *myip, unsigned long long *generation) {
         char *auth = Util_getBasicAuthHeader(C->url->user, C->url->password);
         int rv = Socket_print(socket,
                               "POST %s HTTP/1.1\r\n"
                               "Host: %s:%d\r\n"
-                              "Content-Type: text/xml\r\n"
-                              "Content-Length: %lu\r\n"
+                              "Content-Type: application/json\r\n"
+                              "Transfer-Encoding: chunked\r\n"
+                              "Connection: keep-alive\r\n"
                               "Pragma: no-cache\r\n"
                               "Accept: */*\r\n"
                               "User-Agent: Monit/%s\r\n"
                               "%s"
-                              "\r\n"
-                              "%s",
+                              "\r\n",
                               C->url->path,
                               C->url->hostname, C->url->port,
-                              (unsigned long)strlen(D),
                               VERSION,
-                              auth ? auth : "",
-                              D);
+                              auth ? auth : "");
         FREE(auth);
-        if (rv <0) {
-                LogError("M/Monit: error sending data to %s -- %s\n", C->url->url, STRERROR);
+        if (rv < 0)
                 return false;
-        }
-        return true;
+        struct mychunk chunk = {.socket = socket};
+        *generation = status_json(sb, E, E ? Level_Summary : Level_Full, since, myip, data_chunk, &chunk);
+        chunk_write(&chunk, sb);
+        if (! chunk.failed && Socket_print(socket, "0\r\n\r\n") < 0)
+                chunk.failed = true;
+        return ! chunk.failed;
 }
 
 
 /**
- * Check that the server returns a valid HTTP response
+ * Read the server response. The headers and the body are consumed, so the
+ * connection can be used for the next message if the server keeps it open.
+ * If the server advertises the gzip support using the Accept-Encoding
+ * header, the next messages are compressed. The server can ask for the
+ * full status report using the "X-Monit-Report: full" header and to
+ * slow down using the "Retry-After" header
+ * @param socket The connection
  * @param C An mmonit object
- * @return true if the response is valid otherwise false
+ * @param response The response status line
+ * @param keepalive Set to true if the connection can be reused
+ * @param retryafter Set to the Retry-After delay in seconds or -1
+ * @return The HTTP status or -1 if the response cannot be read
  */
-static boolean_t data_check(Socket_T socket, Mmonit_T C) {
-        int  status;
+static int data_check(Socket_T socket, Mmonit_T C, char response[STRLEN], boolean_t *keepalive, int *retryafter) {
+        int status;
+        *keepalive = false;
+        *retryafter = -1;
+        if (! Socket_readLine(socket, response, STRLEN))
+                return -1;
+        Str_chomp(response);
+        if (sscanf(response, "%*s %d", &status) != 1)
+                return -1;
+        boolean_t close = ! Str_startsWith(response, "HTTP/1.1");
+        int content_length = -1;
         char buf[STRLEN];
-        if (! Socket_readLine(socket, buf, sizeof(buf))) {
-                LogError("M/Monit: error receiving data from %s -- %s\n", C->url->url, STRERROR);
+        while (true) {
+                if (! Socket_readLine(socket, buf, sizeof(buf)))
+                        return status; // Incomplete headers, the connection cannot be reused
+                if ((buf[0] == '\r' && buf[1] == '\n') || (buf[0] == '\n'))
+                        break;
+                Str_chomp(buf);
+                if (Str_startsWith(buf, "Content-Length")) {
+                        if (sscanf(buf, "%*s%*[: ]%d", &content_length) != 1 || content_length < 0)
+                                return status;
+                } else if (Str_startsWith(buf, "Connection") && Str_sub(buf, "close")) {
+                        close = true;
+                } else if (Str_startsWith(buf, "X-Monit-Report") && Str_sub(buf, "full")) {
+                        C->deltas = Run.mmonitdelta; // The server asks for the full status report
+                } else if (Str_startsWith(buf, "Retry-After")) {
+                        if (sscanf(buf, "%*s%*[: ]%d", retryafter) != 1 || *retryafter < 0)
+                                *retryafter = -1; // The HTTP-date form is not supported, the default backoff is used
+                } else if (Str_startsWith(buf, "Accept-Encoding")) {
+                        C->compress = Str_sub(buf, "gzip") ? true : false;
+                } else if (Str_startsWith(buf, "Transfer-Encoding")) {
+                        close = true; // We don't parse chunked body, drop the connection instead
+                }
+        }
+        if (content_length < 0)
+                return status;
+        /* Skip the body in the socket buffer, it's not needed */
+        while (content_length > 0) {
+                int n;
+                if (! Socket_peek(socket, 1, &n))
+                        return status;
+                n = n < content_length ? n : content_length;
+                Socket_skip(socket, n);
+                content_length -= n;
+        }
+        *keepalive = ! close;
+        return status;
+}
+
+
+/**
+ * Postpone the status reports if the server is overloaded (503 Service
+ * Unavailable or 429 Too Many Requests). The delay is the Retry-After
+ * time if the server sent it, otherwise it doubles with each consecutive
+ * response from MMONIT_BACKOFF_MIN up to MMONIT_BACKOFF_MAX seconds. A
+ * random part is added, so the Monit instances which were refused at the
+ * same time don't come back at the same time. The events are not
+ * postponed
+ * @param C An mmonit object
+ * @param status The HTTP status
+ * @param retryafter The Retry-After delay in seconds or -1
+ */
+static void data_backoff(Mmonit_T C, int status, int retryafter) {
+        if (status == 503 || status == 429) {
+                int delay = retryafter;
+                if (delay < 0) {
+                        delay = MMONIT_BACKOFF_MIN;
+                        for (int i = 0; i < C->backoffs && delay < MMONIT_BACKOFF_MAX; i++)
+                                delay *= 2;
+                        if (delay > MMONIT_BACKOFF_MAX)
+                                delay = MMONIT_BACKOFF_MAX;
+                }
+                delay += random() % (delay / 2 + 1);
+                C->backoffs++;
+                C->retry = Time_now() + delay;
+                LogWarning("M/Monit: %s is overloaded, the status reports are postponed for %d seconds\n", C->url->url, delay);
+        } else if (status >= 0 && status < 400) {
+                C->backoffs = 0;
+                C->retry = 0;
+        }
+}
+
+
+/**
+ * Send the message to the given M/Monit server. The persistent connection is
+ * reused if open, if it was closed by the server meanwhile, the message is
+ * sent again using a new connection
+ * @param C An mmonit object
+ * @param sb The message buffer
+ * @param E An event object or NULL for status data
+ * @param replay true if the event is replayed from the event queue, the
+ * status part of its XML message is the cached status of the cycle then
+ * @return true if the message was sent otherwise false
+ */
+static boolean_t data_post(Mmonit_T C, StringBuffer_T sb, Event_T E, boolean_t replay) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+                boolean_t reused = false;
+                if (C->socket) {
+                        // The idle connection is readable only if the server closed it (or sent garbage)
+                        if (Net_canRead(Socket_getSocket(C->socket), 0))
+                                Socket_free(&C->socket);
+                        else
+                                reused = true;
+                }
+                if (! C->socket && ! (C->socket = Socket_create(C->url->hostname, C->url->port, Socket_Tcp, Socket_Ip, C->ssl, C->timeout))) {
+                        LogError("M/Monit: cannot open a connection to %s\n", C->url->url);
+                        return false;
+                }
+                char buf[STRLEN];
+                StringBuffer_clear(sb);
+                boolean_t sent;
+                boolean_t delta = ! E && Run.mmonitdelta && C->generation && C->deltas < Run.mmonitdelta;
+                unsigned long long generation = 0;
+                unsigned long long started = Latency_now();
+                if (C->json) {
+                        sent = data_stream(C->socket, C, sb, E, delta ? C->generation : 0, Socket_getLocalHost(C->socket, buf, sizeof(buf)), &generation);
+                } else {
+                        if (E && replay) {
+                                status_xml_event(sb, E, Level_Summary, 2, Socket_getLocalHost(C->socket, buf, sizeof(buf)));
+                        } else if (E) {
+                                status_xml(sb, E, Level_Summary, 2, Socket_getLocalHost(C->socket, buf, sizeof(buf)));
+                        } else if (delta) {
+                                generation = status_xml_delta(sb, C->generation, Socket_getLocalHost(C->socket, buf, sizeof(buf)));
+                        } else {
+                                generation = status_xml_generation();
+                                status_xml_snapshot(sb, Level_Full, 2, Socket_getLocalHost(C->socket, buf, sizeof(buf)));
+                        }
+                        sent = data_send(C->socket, C, "text/xml", StringBuffer_toString(sb), StringBuffer_length(sb));
+                }
+                Latency_record(&Run.latency.report, started);
+                boolean_t keepalive = false;
+                int status = -1, retryafter = -1;
+                if (sent)
+                        status = data_check(C->socket, C, buf, &keepalive, &retryafter);
+                if (! keepalive)
+                        Socket_free(&C->socket);
+                data_backoff(C, status, retryafter);
+                if (status == 415 && C->compress && ! C->json) {
+                        DEBUG("M/Monit: %s doesn't accept compressed message, sending uncompressed\n", C->url->url);
+                        C->compress = false;
+                        attempt--;
+                        continue;
+                }
+                if (status >= 400) {
+                        LogError("M/Monit: %s message to %s failed -- %s\n", E ? "event" : "status", C->url->url, buf);
+                        C->generation = 0;
+                        return false;
+                } else if (status >= 0) {
+                        if (! E) {
+                                C->generation = generation;
+                                C->deltas = delta ? C->deltas + 1 : 0;
+                        }
+                        return true;
+                }
+                C->generation = 0;
+                if (! reused) {
+                        LogError("M/Monit: cannot send %s message to %s -- %s\n", E ? "event" : "status", C->url->url, STRERROR);
+                        return false;
+                }
+                DEBUG("M/Monit: persistent connection to %s was closed, reconnecting\n", C->url->url);
+        }
+        return false;
+}
+
+
+/**
+ * Forward the message of another Monit instance to the given M/Monit
+ * server (see relay.c). The persistent connection is reused as for the
+ * own messages
+ * @param C An mmonit object
+ * @param type The message content type
+ * @param D The message
+ * @param length The message length
+ * @return true if the message was sent otherwise false
+ */
+static boolean_t data_relay(Mmonit_T C, const char *type, const char *D, int length) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+                boolean_t reused = false;
+                if (C->socket) {
+                        if (Net_canRead(Socket_getSocket(C->socket), 0))
+                                Socket_free(&C->socket);
+                        else
+                                reused = true;
+                }
+                if (! C->socket && ! (C->socket = Socket_create(C->url->hostname, C->url->port, Socket_Tcp, Socket_Ip, C->ssl, C->timeout))) {
+                        LogError("M/Monit: cannot open a connection to %s\n", C->url->url);
+                        return false;
+                }
+                char buf[STRLEN];
+                boolean_t keepalive = false;
+                int retryafter = -1;
+                int status = data_send(C->socket, C, type, D, length) ? data_check(C->socket, C, buf, &keepalive, &retryafter) : -1;
+                if (! keepalive)
+                        Socket_free(&C->socket);
+                data_backoff(C, status, retryafter);
+                if (status == 415 && C->compress) {
+                        DEBUG("M/Monit: %s doesn't accept compressed message, sending uncompressed\n", C->url->url);
+                        C->compress = false;
+                        attempt--;
+                        continue;
+                }
+                if (status >= 400) {
+                        LogError("M/Monit: relayed message to %s failed -- %s\n", C->url->url, buf);
+                        return false;
+                } else if (status >= 0) {
+                        return true;
+                }
+                if (! reused) {
+                        LogError("M/Monit: cannot send relayed message to %s -- %s\n", C->url->url, STRERROR);
+                        return false;
+                }
+                DEBUG("M/Monit: persistent connection to %s was closed, reconnecting\n", C->url->url);
+        }
+        return false;
+}
+
+
+/**
+ * Check if the message can be sent to the given M/Monit server now. The
+ * server is skipped while a parallel sender still uses its connection and
+ * the status report is skipped while the server asked to slow down
+ * @param C An mmonit object
+ * @param E An event object or NULL for status data
+ * @return true if the message can be sent otherwise false
+ */
+static boolean_t data_ready(Mmonit_T C, Event_T E) {
+        if (C->busy) {
+                DEBUG("M/Monit: %s message to %s skipped, the previous message is still being sent\n", E ? "event" : "status", C->url->url);
                 return false;
         }
-        Str_chomp(buf);
-        int n = sscanf(buf, "%*s %d", &status);
-        if (n != 1 || (status >= 400)) {
-                LogError("M/Monit: message sending failed to %s -- %s\n", C->url->url, buf);
+        if (! E && C->retry > Time_now()) {
+                DEBUG("M/Monit: status message to %s postponed, the server asked to slow down\n", C->url->url);
                 return false;
         }
         return true;
 }
 
 
+/**
+ * The parallel sender thread, sends the message to one M/Monit server
+ * @param args A sender object
+ */
+static void *data_sender(void *args) {
+        Thread_detach(Thread_self());
+        Sender_T S = args;
+        StringBuffer_T sb = StringBuffer_create(256);
+        boolean_t sent = data_post(S->C, sb, S->E, false);
+        StringBuffer_free(&sb);
+        LOCK(mutex)
+        {
+                if (sent)
+                        DEBUG("M/Monit: %s message sent to %s\n", S->E ? "event" : "status", S->C->url->url);
+                S->C->busy = false;
+                if (sent)
+                        S->fanout->succeeded++;
+                if (--S->fanout->pending == 0 && S->fanout->abandoned)
+                        FREE(S->fanout);
+                senders.running--;
+                Sem_broadcast(senders.done);
+        }
+        END_LOCK;
+        if (S->E)
+                Event_copy_free(&S->E);
+        FREE(S);
+        return NULL;
+}
+
+
+/**
+ * Send the message to all M/Monit servers at once. With the first success
+ * semantics the caller returns as soon as some server accepted the message
+ * (the other senders finish in the background), with the all success
+ * semantics the caller waits for all servers and succeeds only if all of
+ * them accepted the message. Must be called with the mutex locked
+ * @param E An event object or NULL for status data
+ * @return If failed, return Handler_Mmonit flag or Handler_Succeeded flag if succeeded
+ */
+static Handler_Type data_fanout(Event_T E) {
+        int servers = 0;
+        Fanout_T F;
+        NEW(F);
+        for (Mmonit_T C = Run.mmonits; C; C = C->next) {
+                servers++;
+                if (! data_ready(C, E))
+                        continue;
+                Sender_T S;
+                NEW(S);
+                S->C = C;
+                S->E = E ? Event_copy(E) : NULL;
+                S->fanout = F;
+                TRY
+                {
+                        Thread_T thread;
+                        Thread_create(thread, data_sender, S);
+                        C->busy = true;
+                        F->pending++;
+                        senders.running++;
+                }
+                ELSE
+                {
+                        LogError("M/Monit: cannot create a sender thread for %s -- %s\n", C->url->url, Exception_frame.message);
+                        if (S->E)
+                                Event_copy_free(&S->E);
+                        FREE(S);
+                }
+                END_TRY;
+        }
+        // The senders cannot finish before we wait, they need the mutex
+        while (F->pending && ! (Run.mmonitparallel == Mmonit_FirstSuccess && F->succeeded))
+                Sem_wait(senders.done, mutex);
+        Handler_Type rv = (Run.mmonitparallel == Mmonit_FirstSuccess ? F->succeeded > 0 : F->succeeded == servers) ? Handler_Succeeded : Handler_Mmonit;
+        if (F->pending)
+                F->abandoned = true;
+        else
+                FREE(F);
+        return rv;
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
@@ -125,31 +570,106 @@ Handler_Type handle_mmonit(Event_T E) {
         /* The event is sent to mmonit just once - only in the case that the state changed */
         if (! Run.mmonits || (E && ! E->state_changed))
                 return Handler_Succeeded;
-        StringBuffer_T sb = StringBuffer_create(256);
-        for (Mmonit_T C = Run.mmonits; C; C = C->next) {
-                Socket_T  socket = Socket_create(C->url->hostname, C->url->port, Socket_Tcp, Socket_Ip, C->ssl, C->timeout);
-                if (! socket) {
-                        LogError("M/Monit: cannot open a connection to %s\n", C->url->url);
-                        goto error;
+        unsigned long long started = Latency_now();
+        if (Run.mmonitparallel != Mmonit_Sequential && Run.mmonits->next) {
+                LOCK(mutex)
+                {
+                        rv = data_fanout(E);
                 }
-                char buf[STRLEN];
-                status_xml(sb, E, E ? Level_Summary : Level_Full, 2, Socket_getLocalHost(socket, buf, sizeof(buf)));
-                if (! data_send(socket, C, StringBuffer_toString(sb))) {
-                        LogError("M/Monit: cannot send %s message to %s\n", E ? "event" : "status", C->url->url);
-                        goto error;
+                END_LOCK;
+                PROBE3(mmonit__send, E ? E->source : NULL, rv == Handler_Succeeded, Latency_now() - started);
+                return rv;
+        }
+        StringBuffer_T sb = StringBuffer_create(256);
+        LOCK(mutex)
+        {
+                for (Mmonit_T C = Run.mmonits; C; C = C->next) {
+                        if (! data_ready(C, E))
+                                continue;
+                        if (data_post(C, sb, E, false)) {
+                                rv = Handler_Succeeded; // Return success if at least one M/Monit succeeded
+                                DEBUG("M/Monit: %s message sent to %s\n", E ? "event" : "status", C->url->url);
+                        }
                 }
-                StringBuffer_clear(sb);
-                if (! data_check(socket, C)) {
-                        LogError("M/Monit: %s message to %s failed\n", E ? "event" : "status", C->url->url);
-                        goto error;
-                }
-                rv = Handler_Succeeded; // Return success if at least one M/Monit succeeded
-                DEBUG("M/Monit: %s message sent to %s\n", E ? "event" : "status", C->url->url);
-        error:
-                if (socket)
-                        Socket_free(&socket);
         }
+        END_LOCK;
         StringBuffer_free(&sb);
+        PROBE3(mmonit__send, E ? E->source : NULL, rv == Handler_Succeeded, Latency_now() - started);
+        return rv;
+}
+
+
+/**
+ * Forward the message of another Monit instance to mmonit
+ * @param type The message content type
+ * @param data The message
+ * @param length The message length
+ * @return If failed, return Handler_Mmonit flag or Handler_Succeeded flag if succeeded
+ */
+Handler_Type handle_mmonit_relay(const char *type, const char *data, int length) {
+        Handler_Type rv = Handler_Mmonit;
+        LOCK(mutex)
+        {
+                for (Mmonit_T C = Run.mmonits; C; C = C->next)
+                        if (! C->busy && data_relay(C, type, data, length))
+                                rv = Handler_Succeeded; // Return success if at least one M/Monit succeeded
+        }
+        END_LOCK;
         return rv;
 }
 
+
+/**
+ * Send the events replayed from the event queue to mmonit. The events are
+ * sent to each server one after another over its persistent connection
+ * while holding the lock once, the sending to the server stops on the
+ * first failure. The events are delivered if some server (or all servers
+ * with the "all success" parallel mode) accepted them
+ * @param E The events, the oldest first
+ * @param count The number of events
+ * @param sent Set to true for each delivered event
+ */
+void handle_mmonit_replay(Event_T *E, int count, boolean_t *sent) {
+        int servers = 0;
+        int *accepted = CALLOC(count, sizeof(int));
+        StringBuffer_T sb = StringBuffer_create(256);
+        LOCK(mutex)
+        {
+                for (Mmonit_T C = Run.mmonits; C; C = C->next) {
+                        servers++;
+                        if (! data_ready(C, E[0]))
+                                continue;
+                        int i;
+                        for (i = 0; i < count; i++) {
+                                /* The event is sent to mmonit just once - only in the case that the state changed */
+                                if (! E[i]->state_changed)
+                                        continue;
+                                if (! data_post(C, sb, E[i], true))
+                                        break;
+                                accepted[i]++;
+                        }
+                        DEBUG("M/Monit: %d of %d queued events sent to %s\n", i, count, C->url->url);
+                }
+        }
+        END_LOCK;
+        for (int i = 0; i < count; i++)
+                sent[i] = ! Run.mmonits || ! E[i]->state_changed || (Run.mmonitparallel == Mmonit_AllSuccess ? accepted[i] == servers : accepted[i] > 0);
+        StringBuffer_free(&sb);
+        FREE(accepted);
+}
+
+
+/**
+ * Wait for the parallel senders which still send some message in the
+ * background. Called before the M/Monit servers and the services are freed
+ */
+void handle_mmonit_wait() {
+        LOCK(mutex)
+        {
+                if (senders.running)
+                        DEBUG("M/Monit: waiting for %d message sender(s)\n", senders.running);
+                while (senders.running)
+                        Sem_wait(senders.done, mutex);
+        }
+        END_LOCK;
+}
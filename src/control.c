@@ -52,10 +52,27 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
 #include "monit.h"
 #include "net.h"
 #include "socket.h"
 #include "event.h"
+#include "procwatch.h"
 #include "system/Time.h"
 #include "exceptions/AssertException.h"
 
@@ -76,6 +93,48 @@ typedef enum {
 } __attribute__((__packed__)) Process_Status;
 
 
+typedef enum {
+        Job_Queued = 0,
+        Job_Running,
+        Job_Done
+} __attribute__((__packed__)) Job_State;
+
+
+typedef struct myjob {
+        Service_T s;                              /**< The service to start/stop */
+        Job_State state;                                     /**< The job state */
+        boolean_t restart;                 /**< true if the service is restarted */
+        boolean_t failed;            /**< true if the stop of the service failed */
+        int dependencies;        /**< Number of jobs which have to finish first */
+        int *depends;          /**< Indexes of the jobs which have to finish first */
+} *Job_T;
+
+
+/* The start/stop executor state, shared by the worker threads */
+static struct {
+        Action_Type action;                   /**< Action_Start or Action_Stop */
+        boolean_t unmonitor;      /**< Disable monitoring of the stopped services */
+        int count;                                          /**< Number of jobs */
+        int queued;                            /**< Number of jobs not started yet */
+        int running;                               /**< Number of running jobs */
+        struct myjob *jobs;                                         /**< The jobs */
+        Mutex_T mutex;
+        Sem_T done;                           /**< Signaled when some job finished */
+} executor = {.mutex = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+
+/* The queue of the service actions triggered by the events, see control_queue() */
+static struct {
+        int count;                                 /**< Number of queued actions */
+        int capacity;
+        struct {
+                char *service;                             /**< The service name */
+                Action_Type action;                       /**< The queued action */
+        } *items;
+        Mutex_T mutex;
+} queue = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -120,6 +179,14 @@ static int _commandExecute(Service_T S, command_t c, char *msg, int msglen, long
                         Command_vSetEnv(C, "MONIT_PROCESS_CHILDREN", "%d", S->inf->priv.process.children);
                         Command_vSetEnv(C, "MONIT_PROCESS_CPU_PERCENT", "%d", S->inf->priv.process.cpu_percent);
                 }
+                long long start = Time_milli();
+                boolean_t acquired = spawn_acquire((int)(*timeout / 1000));
+                *timeout -= (Time_milli() - start) * 1000;
+                if (! acquired) {
+                        snprintf(msg, msglen, "Program %s not started -- spawn limit of %d running programs reached", c->arg[0], Run.spawnlimit);
+                        Command_free(&C);
+                        return status;
+                }
                 Process_T P = Command_execute(C);
                 Command_free(&C);
                 if (P) {
@@ -144,13 +211,86 @@ static int _commandExecute(Service_T S, command_t c, char *msg, int msglen, long
                                 }
                         } while (n > 0 && Run.debug && total < 2048); // Limit the debug output (if the program will have endless output, such as 'yes' utility, we have to stop at some point to not spin here forever)
                         Process_free(&P); // Will kill the program if still running
+                        spawn_release();
+                } else {
+                        spawn_release();
                 }
         }
         return status;
 }
 
 
+/*
+ * Wait for the process with a pidfile: the pidfile directory is watched with
+ * inotify, so the process is checked when the pidfile was written. Returns
+ * false if the pidfile cannot be watched
+ */
+static boolean_t _waitPidfile(Service_T s, long *timeout, Process_Status *status) {
+#ifdef HAVE_SYS_INOTIFY_H
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+                return false;
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s", s->path);
+        char *slash = strrchr(dir, '/');
+        if (slash)
+                *(slash == dir ? slash + 1 : slash) = 0;
+        if (! slash || inotify_add_watch(fd, dir, IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO) < 0) {
+                close(fd);
+                return false;
+        }
+        *status = Process_Stopped;
+        do {
+                if (Util_isProcessRunning(s, false)) {
+                        *status = Process_Started;
+                        break;
+                }
+                long long start = Time_milli();
+                struct pollfd fds = {.fd = fd, .events = POLLIN};
+                // Check the process at least once per second, the process may be running already while the pidfile content was written before the watch was set up
+                if (poll(&fds, 1, *timeout < 1000000 ? (int)(*timeout / 1000) + 1 : 1000) > 0) {
+                        char buf[4096];
+                        while (read(fd, buf, sizeof(buf)) > 0)
+                                ;
+                }
+                *timeout -= (Time_milli() - start) * 1000;
+        } while (*timeout > 0 && ! Run.stopped);
+        close(fd);
+        return true;
+#else
+        return false;
+#endif
+}
+
+
+/*
+ * Wait for the process matching the pattern: the process table is scanned
+ * only when the process events watcher reported that some program was executed
+ */
+static boolean_t _waitMatch(Service_T s, long *timeout, Process_Status *status) {
+        if (! ProcWatch_isRunning())
+                return false;
+        unsigned long long seen = 0;
+        *status = Process_Stopped;
+        do {
+                long long start = Time_milli();
+                if (Util_isProcessRunning(s, true)) {
+                        *status = Process_Started;
+                        break;
+                }
+                // The start scripts usually execute more programs in a burst, coalesce them to at most one scan per 100ms
+                if (ProcWatch_waitExec(&seen, *timeout < 1000000 ? (int)(*timeout / 1000) + 1 : 1000))
+                        Time_usleep(100000);
+                *timeout -= (Time_milli() - start) * 1000;
+        } while (*timeout > 0 && ! Run.stopped);
+        return true;
+}
+
+
 static Process_Status _waitStart(Service_T s, long *timeout) {
+        Process_Status status;
+        if (s->matchlist ? _waitMatch(s, timeout, &status) : _waitPidfile(s, timeout, &status))
+                return status;
         long wait = 50000;
         do {
                 if (Util_isProcessRunning(s, true))
@@ -164,8 +304,28 @@ static Process_Status _waitStart(Service_T s, long *timeout) {
 
 
 static Process_Status _waitStop(int pid, long *timeout) {
+        if (! pid)
+                return Process_Stopped;
+        // The process descriptor becomes readable when the process exits
+        int fd = Util_openPidfd(pid);
+        if (fd >= 0) {
+                Process_Status status = Process_Started;
+                do {
+                        long long start = Time_milli();
+                        struct pollfd fds = {.fd = fd, .events = POLLIN};
+                        if (poll(&fds, 1, *timeout < 1000000 ? (int)(*timeout / 1000) + 1 : 1000) > 0) {
+                                status = Process_Stopped;
+                                break;
+                        }
+                        *timeout -= (Time_milli() - start) * 1000;
+                } while (*timeout > 0 && ! Run.stopped);
+                close(fd);
+                return status;
+        } else if (errno == ESRCH) {
+                return Process_Stopped;
+        }
         do {
-                if (! pid || (getpgid(pid) == -1 && errno != EPERM))
+                if (getpgid(pid) == -1 && errno != EPERM)
                         return Process_Stopped;
                 Time_usleep(100000);
                 *timeout -= 100000;
@@ -175,22 +335,10 @@ static Process_Status _waitStop(int pid, long *timeout) {
 
 
 /*
- * This is a post- fix recursive function for starting every service
- * that s depends on before starting s.
+ * This function simply starts the service s.
  * @param s A Service_T object
  */
-static void _doStart(Service_T s) {
-        ASSERT(s);
-        if (s->visited)
-                return;
-        s->visited = true;
-        if (s->dependantlist) {
-                for (Dependant_T d = s->dependantlist; d; d = d->next ) {
-                        Service_T parent = Util_getService(d->dependant);
-                        ASSERT(parent);
-                        _doStart(parent);
-                }
-        }
+static void _startService(Service_T s) {
         if (s->start) {
                 if (s->type != Service_Process || ! Util_isProcessRunning(s, false)) {
                         LogInfo("'%s' start: %s\n", s->name, s->start->arg[0]);
@@ -209,6 +357,27 @@ static void _doStart(Service_T s) {
 }
 
 
+/*
+ * This is a post- fix recursive function for starting every service
+ * that s depends on before starting s.
+ * @param s A Service_T object
+ */
+static void _doStart(Service_T s) {
+        ASSERT(s);
+        if (s->visited)
+                return;
+        s->visited = true;
+        if (s->dependantlist) {
+                for (Dependant_T d = s->dependantlist; d; d = d->next ) {
+                        Service_T parent = Util_getService(d->dependant);
+                        ASSERT(parent);
+                        _doStart(parent);
+                }
+        }
+        _startService(s);
+}
+
+
 /*
  * This function simply stops the service p.
  * @param s A Service_T object
@@ -339,24 +508,188 @@ static void _doDepend(Service_T s, Action_Type action, boolean_t flag) {
 }
 
 
+/*
+ * @return true if the service s depends on the service parent
+ */
+static boolean_t _dependsOn(Service_T s, Service_T parent) {
+        for (Dependant_T d = s->dependantlist; d; d = d->next)
+                if (IS(d->dependant, parent->name))
+                        return true;
+        return false;
+}
 
 
-/* ------------------------------------------------------------------ Public */
+/*
+ * Add the service s to the executor jobs
+ * @return true if the job was added, false if s is scheduled already
+ */
+static boolean_t _addJob(Service_T s) {
+        for (int i = 0; i < executor.count; i++)
+                if (executor.jobs[i].s == s)
+                        return false;
+        executor.jobs[executor.count++].s = s;
+        return true;
+}
 
 
-/**
- * Pass on to methods in http/cervlet.c to start/stop services
- * @param S A service name as stated in the config file
- * @param action A string describing the action to execute
- * @return false for error, otherwise true
+/*
+ * Add every service that s depends on to the executor jobs
  */
-boolean_t control_service_daemon(const char *S, const char *action) {
-        ASSERT(S);
-        ASSERT(action);
-        if (Util_getAction(action) == Action_Ignored) {
-                LogError("Cannot %s service '%s' -- invalid action %s\n", action, S, action);
-                return false;
+static void _addPrerequisites(Service_T s) {
+        for (Dependant_T d = s->dependantlist; d; d = d->next) {
+                Service_T parent = Util_getService(d->dependant);
+                if (parent && _addJob(parent))
+                        _addPrerequisites(parent);
+        }
+}
+
+
+/*
+ * Add every service that depends on s to the executor jobs
+ */
+static void _addDependants(Service_T s) {
+        for (Service_T child = servicelist; child; child = child->next)
+                if (_dependsOn(child, s) && _addJob(child))
+                        _addDependants(child);
+}
+
+
+static boolean_t _isRunnable(Job_T job) {
+        for (int i = 0; i < job->dependencies; i++)
+                if (executor.jobs[job->depends[i]].state != Job_Done)
+                        return false;
+        return true;
+}
+
+
+/*
+ * The executor worker. Picks the first queued job whose dependencies are
+ * done, so the services are started after the services they depend on (and
+ * stopped before them), while independent branches run in parallel
+ */
+static void *_worker(void *args) {
+        LOCK(executor.mutex)
+        {
+                while (executor.queued && ! Run.stopped) {
+                        Job_T job = NULL;
+                        for (int i = 0; i < executor.count; i++) {
+                                if (executor.jobs[i].state == Job_Queued && _isRunnable(&executor.jobs[i])) {
+                                        job = &executor.jobs[i];
+                                        break;
+                                }
+                        }
+                        if (! job) {
+                                if (! executor.running) {
+                                        /* No running job can unblock the queued jobs, they wait for each other */
+                                        for (int i = 0; i < executor.count; i++) {
+                                                if (executor.jobs[i].state == Job_Queued) {
+                                                        LogError("Found a depend loop involving the service '%s' -- skipping %d services\n", executor.jobs[i].s->name, executor.queued);
+                                                        break;
+                                                }
+                                        }
+                                        for (int i = 0; i < executor.count; i++)
+                                                executor.jobs[i].state = Job_Done;
+                                        executor.queued = 0;
+                                        Sem_broadcast(executor.done);
+                                        break;
+                                }
+                                /* All queued jobs wait for a running job of the service they depend on */
+                                Sem_wait(executor.done, executor.mutex);
+                                continue;
+                        }
+                        job->state = Job_Running;
+                        executor.queued--;
+                        executor.running++;
+                        /* The service may be handled by the action of some service earlier in this cycle */
+                        boolean_t skip = false;
+                        if (executor.action == Action_Start) {
+                                skip = job->s->visited;
+                                job->s->visited = true;
+                        }
+                        Mutex_unlock(executor.mutex);
+                        boolean_t restartable = job->restart && job->s->restart;
+                        if (executor.action == Action_Stop) {
+                                /* The service with the restart method is restarted in place at the start phase */
+                                if (! restartable)
+                                        job->failed = ! _doStop(job->s, executor.unmonitor);
+                        } else if (! skip) {
+                                if (restartable)
+                                        _doRestart(job->s);
+                                else if (job->restart && job->failed)
+                                        Util_monitorSet(job->s); // Only start if the stop succeeded, the restart is retried in the next cycle up to timeout limit
+                                else
+                                        _startService(job->s);
+                        }
+                        Mutex_lock(executor.mutex);
+                        executor.running--;
+                        job->state = Job_Done;
+                        Sem_broadcast(executor.done);
+                }
         }
+        END_LOCK;
+#ifdef HAVE_OPENSSL
+        Ssl_threadCleanup();
+#endif
+        return NULL;
+}
+
+
+/*
+ * Start or stop the executor jobs using the pool of Run.control_workers threads
+ * @param action Action_Start or Action_Stop
+ * @param unmonitor true if the monitoring of the stopped services should be disabled
+ */
+static void _execute(Action_Type action, boolean_t unmonitor) {
+        if (! executor.count)
+                return;
+        executor.action = action;
+        executor.unmonitor = unmonitor;
+        executor.queued = executor.count;
+        executor.running = 0;
+        for (int i = 0; i < executor.count; i++) {
+                Job_T job = &executor.jobs[i];
+                job->state = Job_Queued;
+                job->dependencies = 0;
+                for (int j = 0; j < executor.count; j++) {
+                        if (i != j && (action == Action_Start ? _dependsOn(job->s, executor.jobs[j].s) : _dependsOn(executor.jobs[j].s, job->s))) {
+                                RESIZE(job->depends, (job->dependencies + 1) * sizeof(int));
+                                job->depends[job->dependencies++] = j;
+                        }
+                }
+        }
+        int workers = Run.control_workers < executor.count ? Run.control_workers : executor.count;
+        Thread_T *threads = CALLOC(workers > 1 ? workers : 1, sizeof(Thread_T));
+        volatile int started = 0;
+        if (workers > 1) {
+                TRY
+                {
+                        for (; started < workers; started++)
+                                Thread_create(threads[started], _worker, NULL);
+                }
+                ELSE
+                {
+                        LogError("Service control -- cannot create worker thread -- %s\n", Exception_frame.message);
+                }
+                END_TRY;
+        }
+        if (! started) // Serial start/stop in the main thread
+                _worker(NULL);
+        for (int i = 0; i < started; i++)
+                Thread_join(threads[i]);
+        FREE(threads);
+        for (int i = 0; i < executor.count; i++)
+                FREE(executor.jobs[i].depends);
+}
+
+
+/*
+ * Send the action request to the monit daemon
+ * @param path The request path
+ * @param action The action name
+ * @param data The request body
+ * @return false for error, otherwise true
+ */
+static boolean_t _daemonAction(const char *path, const char *action, const char *data) {
         Socket_T socket = NULL;
         boolean_t rv = false;
         if (Run.httpd.flags & Httpd_Net)
@@ -377,11 +710,11 @@ boolean_t control_service_daemon(const char *S, const char *action) {
                          "Content-Length: %lu\r\n"
                          "%s"
                          "\r\n"
-                         "action=%s",
-                         S,
-                         (unsigned long)(strlen("action=") + strlen(action)),
+                         "%s",
+                         path,
+                         (unsigned long)strlen(data),
                          auth ? auth : "",
-                         action) < 0)
+                         data) < 0)
         {
                 LogError("Cannot send the command '%s' to the monit daemon -- %s\n", action ? action : "null", STRERROR);
                 goto err1;
@@ -433,6 +766,60 @@ err1:
 }
 
 
+
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+/**
+ * Pass on to methods in http/cervlet.c to start/stop services
+ * @param S A service name as stated in the config file
+ * @param action A string describing the action to execute
+ * @return false for error, otherwise true
+ */
+boolean_t control_service_daemon(const char *S, const char *action) {
+        ASSERT(S);
+        ASSERT(action);
+        if (Util_getAction(action) == Action_Ignored) {
+                LogError("Cannot %s service '%s' -- invalid action %s\n", action, S, action);
+                return false;
+        }
+        char *data = Str_cat("action=%s", action);
+        boolean_t rv = _daemonAction(S, action, data);
+        FREE(data);
+        return rv;
+}
+
+
+/**
+ * Pass on to methods in http/cervlet.c to start/stop the services of the
+ * group or all services in one request. The daemon resolves the group, so
+ * the request size doesn't depend on the number of services
+ * @param group The service group name or NULL for all services
+ * @param action A string describing the action to execute
+ * @return false for error, otherwise true
+ */
+boolean_t control_group_daemon(const char *group, const char *action) {
+        ASSERT(action);
+        if (Util_getAction(action) == Action_Ignored) {
+                LogError("Cannot %s services -- invalid action %s\n", action, action);
+                return false;
+        }
+        char *data;
+        if (group) {
+                char *name = Util_urlEncode((char *)group);
+                data = Str_cat("action=%s&group=%s", action, name);
+                FREE(name);
+        } else {
+                data = Str_cat("action=%s&all=true", action);
+        }
+        boolean_t rv = _daemonAction("_doaction", action, data);
+        FREE(data);
+        return rv;
+}
+
+
 /**
  * Check to see if we should try to start/stop service
  * @param S A service name as stated in the config file
@@ -513,6 +900,187 @@ boolean_t control_service(const char *S, Action_Type A) {
 }
 
 
+/**
+ * Start, stop or restart the services in the "depend on" order. The start
+ * and restart actions stop the services which depend on the given services
+ * first and start them again, together with the services the given services
+ * depend on, the same way as control_service() does. Independent branches of
+ * the dependency graph run in parallel using up to Run.control_workers
+ * threads. Other actions are performed for one service after another
+ * @param services The services
+ * @param count Number of services
+ * @param A An action id describing the action to execute
+ * @return false for error, otherwise true
+ */
+boolean_t control_services(Service_T *services, int count, Action_Type A) {
+        ASSERT(services);
+        if (A != Action_Start && A != Action_Stop && A != Action_Restart) {
+                boolean_t rv = true;
+                for (int i = 0; i < count; i++) {
+                        /* The service may be handled in the dependency chain of some service before */
+                        if (! services[i]->visited && ! control_service(services[i]->name, A))
+                                rv = false;
+                }
+                return rv;
+        }
+        int size = 0;
+        for (Service_T s = servicelist; s; s = s->next)
+                size++;
+        executor.count = 0;
+        executor.jobs = CALLOC(size, sizeof(struct myjob));
+        if (A == Action_Start) {
+                for (int i = 0; i < count; i++)
+                        _addDependants(services[i]);
+                _execute(Action_Stop, false);
+                int dependants = executor.count;
+                for (int i = 0; i < dependants; i++)
+                        _addPrerequisites(executor.jobs[i].s);
+                for (int i = 0; i < count; i++) {
+                        _addJob(services[i]);
+                        _addPrerequisites(services[i]);
+                }
+                _execute(Action_Start, false);
+        } else if (A == Action_Restart) {
+                for (int i = 0; i < count; i++) {
+                        LogInfo("'%s' trying to restart\n", services[i]->name);
+                        if (_addJob(services[i]))
+                                executor.jobs[executor.count - 1].restart = true;
+                }
+                int restarted = executor.count;
+                for (int i = 0; i < restarted; i++)
+                        _addDependants(executor.jobs[i].s);
+                _execute(Action_Stop, false);
+                int stopped = executor.count;
+                for (int i = 0; i < stopped; i++)
+                        _addPrerequisites(executor.jobs[i].s);
+                _execute(Action_Start, false);
+        } else {
+                for (int i = 0; i < count; i++) {
+                        _addJob(services[i]);
+                        _addDependants(services[i]);
+                }
+                _execute(Action_Stop, true);
+        }
+        FREE(executor.jobs);
+        executor.count = 0;
+        return true;
+}
+
+
+/**
+ * Queue the service action triggered by an event. The action is not done
+ * inline, the queue is processed at the end of the cycle, see
+ * control_queue_process(). A service has at most one queued action, if some
+ * action of the service is queued already, the stronger action is kept
+ * (unmonitor, stop, restart, start and monitor in this order), so the
+ * duplicate actions of the service are merged into one
+ * @param s The service
+ * @param A The action: start, stop, restart, monitor or unmonitor
+ */
+void control_queue(Service_T s, Action_Type A) {
+        ASSERT(s);
+        static const int strength[] = {
+                [Action_Monitor] = 1,
+                [Action_Start] = 2,
+                [Action_Restart] = 3,
+                [Action_Stop] = 4,
+                [Action_Unmonitor] = 5
+        };
+        if (A != Action_Start && A != Action_Stop && A != Action_Restart && A != Action_Monitor && A != Action_Unmonitor) {
+                LogError("Service '%s' -- invalid action %d\n", s->name, A);
+                return;
+        }
+        LOCK(queue.mutex)
+        {
+                int i = 0;
+                while (i < queue.count && ! IS(queue.items[i].service, s->name))
+                        i++;
+                if (i < queue.count) {
+                        DEBUG("'%s' %s action merged with the queued %s action\n", s->name, actionnames[A], actionnames[queue.items[i].action]);
+                        if (strength[A] > strength[queue.items[i].action])
+                                queue.items[i].action = A;
+                } else {
+                        if (queue.count == queue.capacity) {
+                                queue.capacity = queue.capacity ? queue.capacity * 2 : 16;
+                                RESIZE(queue.items, queue.capacity * sizeof(*queue.items));
+                        }
+                        queue.items[queue.count].service = Str_dup(s->name);
+                        queue.items[queue.count].action = A;
+                        queue.count++;
+                }
+        }
+        END_LOCK;
+}
+
+
+/**
+ * Perform the actions queued by control_queue(). The actions are batched
+ * per type and passed to control_services(), so the services restarted
+ * after a shared dependency failed are restarted in parallel (using up to
+ * Run.control_workers threads) in the "depend on" order. If the global
+ * restart limit is set (Run.restartlimit), at most that many services are
+ * started or restarted per cycle and the rest stays queued for the next
+ * cycle. The queue holds the service names, so the actions of the services
+ * removed by reload are dropped
+ */
+void control_queue_process() {
+        int count = 0;
+        struct {
+                char *service;
+                Action_Type action;
+        } *items = NULL;
+        int postponed = 0;
+        LOCK(queue.mutex)
+        {
+                if (queue.count) {
+                        items = CALLOC(queue.count, sizeof(*items));
+                        int starts = 0, kept = 0;
+                        for (int i = 0; i < queue.count; i++) {
+                                boolean_t start = queue.items[i].action == Action_Start || queue.items[i].action == Action_Restart;
+                                if (start && Run.restartlimit > 0 && starts >= Run.restartlimit) {
+                                        queue.items[kept++] = queue.items[i];
+                                        continue;
+                                }
+                                if (start)
+                                        starts++;
+                                items[count].service = queue.items[i].service;
+                                items[count].action = queue.items[i].action;
+                                count++;
+                        }
+                        postponed = queue.count = kept;
+                }
+        }
+        END_LOCK;
+        if (! count)
+                return;
+        if (postponed)
+                LogInfo("The restart limit of %d services per cycle reached -- %d actions postponed to the next cycle\n", Run.restartlimit, postponed);
+        Service_T *services = CALLOC(count, sizeof(Service_T));
+        /* The monitoring changes first, then the stops, the restarts and the starts, each type in one batch */
+        Action_Type batch[] = {Action_Unmonitor, Action_Monitor, Action_Stop, Action_Restart, Action_Start};
+        for (int b = 0; b < sizeof(batch) / sizeof(batch[0]); b++) {
+                int n = 0;
+                for (int i = 0; i < count; i++) {
+                        if (items[i].action == batch[b]) {
+                                Service_T s = Util_getService(items[i].service);
+                                if (s)
+                                        services[n++] = s;
+                                else
+                                        DEBUG("'%s' queued %s action dropped -- the service doesn't exist anymore\n", items[i].service, actionnames[batch[b]]);
+                        }
+                }
+                if (n) {
+                        control_services(services, n, batch[b]);
+                        reset_depend();
+                }
+        }
+        for (int i = 0; i < count; i++)
+                FREE(items[i].service);
+        FREE(items);
+        FREE(services);
+}
+
+
 /*
  * Reset the visited flags used when handling dependencies
  */
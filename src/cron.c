@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_CTYPE_H
+#include <ctype.h>
+#endif
+
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+
+#include "monit.h"
+#include "cron.h"
+
+/**
+ *  Compiled cron specification.
+ *
+ *  The next time search steps by whole months, days and hours while the
+ *  coarser field doesn't match and by minutes only within a matching hour.
+ *  The calendar arithmetic is left to mktime(), so the month lengths and
+ *  the daylight saving time changes are handled by the C library.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define CRON_HORIZON 366 // days, the longest search for the next time
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static inline boolean_t _isSet(unsigned long long mask, int bit) {
+        return (mask >> bit) & 1;
+}
+
+
+/* Parse one field, a comma separated list of N, N-M and *, into the bit mask of the values min..max */
+static const char *_field(const char *s, int min, int max, unsigned long long *mask) {
+        *mask = 0;
+        while (isspace((unsigned char)*s))
+                s++;
+        do {
+                int from, to;
+                if (*s == '*') {
+                        from = min;
+                        to = max;
+                        s++;
+                } else {
+                        char *end;
+                        if (! isdigit((unsigned char)*s))
+                                return NULL;
+                        from = to = (int)strtol(s, &end, 10);
+                        s = end;
+                        if (*s == '-') {
+                                if (! isdigit((unsigned char)*++s))
+                                        return NULL;
+                                to = (int)strtol(s, &end, 10);
+                                s = end;
+                        }
+                }
+                if (from < min || to > max || from > to)
+                        return NULL;
+                for (int i = from; i <= to; i++)
+                        *mask |= 1ULL << i;
+        } while (*s == ',' && s++);
+        return *s == 0 || isspace((unsigned char)*s) ? s : NULL;
+}
+
+
+static boolean_t _matches(Cron_T C, struct tm *tm) {
+        return _isSet(C->month, tm->tm_mon + 1) && _isSet(C->day, tm->tm_mday) && _isSet(C->weekday, tm->tm_wday) && _isSet(C->hour, tm->tm_hour) && _isSet(C->minute, tm->tm_min);
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+boolean_t Cron_compile(const char *spec, Cron_T C) {
+        ASSERT(spec);
+        ASSERT(C);
+        unsigned long long minute, hour, day, month, weekday;
+        const char *s = spec;
+        if (! (s = _field(s, 0, 59, &minute)) || ! (s = _field(s, 0, 23, &hour)) || ! (s = _field(s, 1, 31, &day)) || ! (s = _field(s, 1, 12, &month)) || ! (s = _field(s, 0, 6, &weekday)))
+                return false;
+        while (isspace((unsigned char)*s))
+                s++;
+        if (*s)
+                return false;
+        C->minute = minute;
+        C->hour = (unsigned int)hour;
+        C->day = (unsigned int)day;
+        C->month = (unsigned short)month;
+        C->weekday = (unsigned char)weekday;
+        C->next = C->checked = 0;
+        C->skip = false;
+        return true;
+}
+
+
+boolean_t Cron_matches(Cron_T C, time_t time) {
+        ASSERT(C);
+        struct tm tm;
+        localtime_r(&time, &tm);
+        return _matches(C, &tm);
+}
+
+
+time_t Cron_next(Cron_T C, time_t time, boolean_t match) {
+        ASSERT(C);
+        struct tm tm;
+        localtime_r(&time, &tm);
+        if (_matches(C, &tm) == match)
+                return time;
+        time_t t = time, horizon = time + CRON_HORIZON * 86400;
+        tm.tm_sec = 0;
+        tm.tm_min++;
+        while (t < horizon) {
+                tm.tm_isdst = -1;
+                if ((t = mktime(&tm)) == (time_t)-1)
+                        break;
+                if (match) {
+                        if (! _isSet(C->month, tm.tm_mon + 1)) {
+                                tm.tm_mon++;
+                                tm.tm_mday = 1;
+                                tm.tm_hour = tm.tm_min = 0;
+                        } else if (! _isSet(C->day, tm.tm_mday) || ! _isSet(C->weekday, tm.tm_wday)) {
+                                tm.tm_mday++;
+                                tm.tm_hour = tm.tm_min = 0;
+                        } else if (! _isSet(C->hour, tm.tm_hour)) {
+                                tm.tm_hour++;
+                                tm.tm_min = 0;
+                        } else if (! _isSet(C->minute, tm.tm_min)) {
+                                tm.tm_min++;
+                        } else {
+                                return t;
+                        }
+                } else {
+                        if (! _matches(C, &tm))
+                                return t;
+                        /* The whole hour matches if all minutes do, the next candidate is the next hour */
+                        if (C->minute == 0x0FFFFFFFFFFFFFFFULL) {
+                                tm.tm_hour++;
+                                tm.tm_min = 0;
+                        } else {
+                                tm.tm_min++;
+                        }
+                }
+        }
+        return horizon;
+}
+
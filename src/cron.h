@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_CRON_H
+#define MONIT_CRON_H
+
+
+/**
+ * Compiled cron specification of the "every" statement.
+ *
+ * The cron string is parsed once, when the configuration is loaded, into
+ * one bit mask per field. All five fields must match, the minute is the
+ * lowest resolution. The scheduler computes the next time when the match
+ * changes, so a service which waits for its cron window is not matched
+ * against the time in each cycle.
+ *
+ *  @file
+ */
+
+
+/**
+ * Parse the cron string into the bit masks
+ * @param spec The cron string: minute, hour, day of month, month and day
+ * of week fields separated with white-space, each field is a comma
+ * separated list of numbers, ranges (N-M) and wildcards (*)
+ * @param C The compiled cron specification
+ * @return true if the string was parsed, false if it is invalid
+ */
+boolean_t Cron_compile(const char *spec, Cron_T C);
+
+
+/**
+ * Test the time against the cron specification
+ * @param C The compiled cron specification
+ * @param time The time
+ * @return true if the local time matches all fields
+ */
+boolean_t Cron_matches(Cron_T C, time_t time);
+
+
+/**
+ * Get the first time, not earlier than the given time, which matches (or
+ * doesn't match) the cron specification. The time is the given time if
+ * it already has the requested match, otherwise the start of the minute
+ * which has it. If the match isn't found within a year, the time returned
+ * is a year later, the match is not earlier, so the search can continue
+ * from there
+ * @param C The compiled cron specification
+ * @param time The start of the search
+ * @param match true to find the matching time, false to find the time
+ * which doesn't match
+ * @return The time found
+ */
+time_t Cron_next(Cron_T C, time_t time, boolean_t match);
+
+
+#endif
@@ -26,6 +26,9 @@
 #define MONIT_DEVICE_H
 
 boolean_t filesystem_usage(Service_T);
+void filesystem_usage_batch(Service_T *, int, boolean_t *);
+void filesystem_usage_reset();
+boolean_t filesystem_mounts(unsigned int *, void (*)(const char *, const char *, dev_t, void *), void *);
 
 #endif
 
@@ -63,16 +63,121 @@
 #include "device.h"
 #include "device_sysdep.h"
 
+// libmonit
+#include "system/Time.h"
+#include "exceptions/AssertException.h"
 
-boolean_t filesystem_usage(Service_T s) {
-        ASSERT(s);
 
+/* ------------------------------------------------------------- Definitions */
+
+
+/* Seconds to wait for the filesystem statistics, e.g. of a hung NFS mount */
+#define FILESYSTEM_TIMEOUT 5
+
+
+/* Filesystem statistics collected in the current cycle */
+typedef struct Usage_T {
+        dev_t dev;
+        long long f_bsize;
+        long long f_blocks;
+        long long f_blocksfree;
+        long long f_blocksfreetotal;
+        long long f_files;
+        long long f_filesfree;
+        int flags;
+} *Usage_T;
+
+
+/* A filesystem statistics request, shared by the caller and the thread collecting it */
+typedef struct UsageRequest_T {
+        char *path;
+        int refcount;
+        boolean_t started;
+        boolean_t done;
+        boolean_t succeeded;
+        struct myinfo inf;
+        /* For internal use */
+        struct UsageRequest_T *next;
+} *UsageRequest_T;
+
+
+/* The requests of a batch, collected in turn by one thread */
+typedef struct UsageBatch_T {
+        int count;
+        UsageRequest_T *request;
+} *UsageBatch_T;
+
+
+static struct {
+        int count;
+        int size;
+        Usage_T usage;
+        UsageRequest_T pending;               /**< Requests which did not finish yet */
+        Mutex_T mutex;
+        Sem_T done;
+} cache = {.mutex = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static boolean_t _getCachedUsage(dev_t dev, Info_T inf) {
+        boolean_t found = false;
+        LOCK(cache.mutex)
+        {
+                for (int i = 0; i < cache.count; i++) {
+                        Usage_T u = &cache.usage[i];
+                        if (u->dev == dev) {
+                                inf->priv.filesystem.f_bsize = u->f_bsize;
+                                inf->priv.filesystem.f_blocks = u->f_blocks;
+                                inf->priv.filesystem.f_blocksfree = u->f_blocksfree;
+                                inf->priv.filesystem.f_blocksfreetotal = u->f_blocksfreetotal;
+                                inf->priv.filesystem.f_files = u->f_files;
+                                inf->priv.filesystem.f_filesfree = u->f_filesfree;
+                                inf->priv.filesystem.flags = u->flags;
+                                found = true;
+                                break;
+                        }
+                }
+        }
+        END_LOCK;
+        return found;
+}
+
+
+static void _setCachedUsage(dev_t dev, Info_T inf) {
+        LOCK(cache.mutex)
+        {
+                if (cache.count == cache.size) {
+                        cache.size = cache.size ? cache.size * 2 : 16;
+                        RESIZE(cache.usage, cache.size * sizeof(struct Usage_T));
+                }
+                Usage_T u = &cache.usage[cache.count++];
+                u->dev = dev;
+                u->f_bsize = inf->priv.filesystem.f_bsize;
+                u->f_blocks = inf->priv.filesystem.f_blocks;
+                u->f_blocksfree = inf->priv.filesystem.f_blocksfree;
+                u->f_blocksfreetotal = inf->priv.filesystem.f_blocksfreetotal;
+                u->f_files = inf->priv.filesystem.f_files;
+                u->f_filesfree = inf->priv.filesystem.f_filesfree;
+                u->flags = inf->priv.filesystem.flags;
+        }
+        END_LOCK;
+}
+
+
+/**
+ * Collect the filesystem statistics for the given path into inf. The
+ * statvfs() result is shared by all services on the same filesystem
+ * (device id) in one cycle.
+ */
+static boolean_t _usage(char *path, Info_T inf) {
         struct stat sb;
         char buf[PATH_MAX+1];
-        if (lstat(s->path, &sb) == 0) {
+        if (lstat(path, &sb) == 0) {
                 if (S_ISLNK(sb.st_mode)) {
                         // Symbolic link: dereference so we'll be able to find it in mnttab + get permissions of the target
-                        if (! realpath(s->path, buf)) {
+                        if (! realpath(path, buf)) {
                                 LogError("filesystem link error -- %s\n", STRERROR);
                                 return false;
                         }
@@ -90,33 +195,297 @@ boolean_t filesystem_usage(Service_T s) {
                         }
                 } else if (S_ISREG(sb.st_mode) || S_ISDIR(sb.st_mode)) {
                         // File or directory: we have mountpoint or filesystem subdirectory already (no need to map)
-                        snprintf(buf, sizeof(buf), "%s", s->path);
+                        snprintf(buf, sizeof(buf), "%s", path);
                 } else if (S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode)) {
                         // Block or character device: look for mountpoint
-                        if (! device_mountpoint_sysdep(s->path, buf, sizeof(buf)))
+                        if (! device_mountpoint_sysdep(path, buf, sizeof(buf)))
                                 return false;
                 } else {
-                        LogError("Cannot get filesystem for '%s' -- not file, directory nor device\n", s->path);
+                        LogError("Cannot get filesystem for '%s' -- not file, directory nor device\n", path);
                 }
         } else {
                 // Generic device string (such as sshfs connection info): look for mountpoint
-                if (! device_mountpoint_sysdep(s->path, buf, sizeof(buf)))
+                if (! device_mountpoint_sysdep(path, buf, sizeof(buf)))
                         return false;
                 if (stat(buf, &sb) != 0) {
                         LogError("filesystem %s doesn't exist\n", buf);
                         return false;
                 }
         }
-        if (filesystem_usage_sysdep(buf, s->inf)) {
-                s->inf->priv.filesystem.mode = sb.st_mode;
-                s->inf->priv.filesystem.uid = sb.st_uid;
-                s->inf->priv.filesystem.gid = sb.st_gid;
-                s->inf->priv.filesystem.inode_percent = s->inf->priv.filesystem.f_files > 0 ? (int)((1000.0 * (s->inf->priv.filesystem.f_files - s->inf->priv.filesystem.f_filesfree)) / (float)s->inf->priv.filesystem.f_files) : 0;
-                s->inf->priv.filesystem.space_percent = s->inf->priv.filesystem.f_blocks > 0 ? (int)((1000.0 * (s->inf->priv.filesystem.f_blocks - s->inf->priv.filesystem.f_blocksfreetotal)) / (float)s->inf->priv.filesystem.f_blocks) : 0;
-                s->inf->priv.filesystem.inode_total = s->inf->priv.filesystem.f_files - s->inf->priv.filesystem.f_filesfree;
-                s->inf->priv.filesystem.space_total = s->inf->priv.filesystem.f_blocks - s->inf->priv.filesystem.f_blocksfreetotal;
+        inf->priv.filesystem.mode = sb.st_mode;
+        inf->priv.filesystem.uid = sb.st_uid;
+        inf->priv.filesystem.gid = sb.st_gid;
+        struct stat fs;
+        boolean_t known = stat(buf, &fs) == 0;
+        if (known && _getCachedUsage(fs.st_dev, inf))
+                return true;
+        if (filesystem_usage_sysdep(buf, inf)) {
+                if (known)
+                        _setCachedUsage(fs.st_dev, inf);
                 return true;
         }
         return false;
 }
 
+
+static void _releaseRequest(UsageRequest_T R) {
+        if (--R->refcount == 0) {
+                FREE(R->path);
+                FREE(R);
+        }
+}
+
+
+static UsageRequest_T _newRequest(const char *path) {
+        UsageRequest_T R;
+        NEW(R);
+        R->path = Str_dup(path);
+        R->refcount = 2;
+        R->next = cache.pending;
+        cache.pending = R;
+        return R;
+}
+
+
+static boolean_t _isPending(const char *path) {
+        for (UsageRequest_T p = cache.pending; p; p = p->next)
+                if (IS(p->path, path))
+                        return true;
+        return false;
+}
+
+
+/* Must be called with the cache mutex locked */
+static void _finishRequest(UsageRequest_T R, boolean_t succeeded) {
+        R->succeeded = succeeded;
+        R->done = true;
+        for (UsageRequest_T *p = &cache.pending; *p; p = &(*p)->next) {
+                if (*p == R) {
+                        *p = R->next;
+                        break;
+                }
+        }
+        Sem_broadcast(cache.done);
+}
+
+
+static void _copyUsage(Info_T inf, UsageRequest_T R) {
+        inf->priv.filesystem.f_bsize = R->inf.priv.filesystem.f_bsize;
+        inf->priv.filesystem.f_blocks = R->inf.priv.filesystem.f_blocks;
+        inf->priv.filesystem.f_blocksfree = R->inf.priv.filesystem.f_blocksfree;
+        inf->priv.filesystem.f_blocksfreetotal = R->inf.priv.filesystem.f_blocksfreetotal;
+        inf->priv.filesystem.f_files = R->inf.priv.filesystem.f_files;
+        inf->priv.filesystem.f_filesfree = R->inf.priv.filesystem.f_filesfree;
+        inf->priv.filesystem._flags = inf->priv.filesystem.flags;
+        inf->priv.filesystem.flags = R->inf.priv.filesystem.flags;
+        inf->priv.filesystem.mode = R->inf.priv.filesystem.mode;
+        inf->priv.filesystem.uid = R->inf.priv.filesystem.uid;
+        inf->priv.filesystem.gid = R->inf.priv.filesystem.gid;
+        inf->priv.filesystem.inode_percent = inf->priv.filesystem.f_files > 0 ? (int)((1000.0 * (inf->priv.filesystem.f_files - inf->priv.filesystem.f_filesfree)) / (float)inf->priv.filesystem.f_files) : 0;
+        inf->priv.filesystem.space_percent = inf->priv.filesystem.f_blocks > 0 ? (int)((1000.0 * (inf->priv.filesystem.f_blocks - inf->priv.filesystem.f_blocksfreetotal)) / (float)inf->priv.filesystem.f_blocks) : 0;
+        inf->priv.filesystem.inode_total = inf->priv.filesystem.f_files - inf->priv.filesystem.f_filesfree;
+        inf->priv.filesystem.space_total = inf->priv.filesystem.f_blocks - inf->priv.filesystem.f_blocksfreetotal;
+}
+
+
+static void *_requestThread(void *args) {
+        UsageRequest_T R = args;
+        boolean_t succeeded = _usage(R->path, &R->inf);
+        LOCK(cache.mutex)
+        {
+                _finishRequest(R, succeeded);
+                _releaseRequest(R);
+        }
+        END_LOCK;
+        return NULL;
+}
+
+
+/**
+ * Collect the requests of the batch in turn. The requests which the caller
+ * cancelled after the timeout are skipped
+ */
+static void *_batchThread(void *args) {
+        UsageBatch_T B = args;
+        for (int i = 0; i < B->count; i++) {
+                UsageRequest_T R = B->request[i];
+                boolean_t cancelled;
+                LOCK(cache.mutex)
+                {
+                        cancelled = R->done;
+                        R->started = true;
+                }
+                END_LOCK;
+                boolean_t succeeded = cancelled ? false : _usage(R->path, &R->inf);
+                LOCK(cache.mutex)
+                {
+                        if (! R->done)
+                                _finishRequest(R, succeeded);
+                        _releaseRequest(R);
+                }
+                END_LOCK;
+        }
+        FREE(B->request);
+        FREE(B);
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+/**
+ * Get the filesystem statistics of the given service. The statistics are
+ * collected in a helper thread, so a hung filesystem (e.g. stale NFS
+ * server) fails the test after FILESYSTEM_TIMEOUT seconds instead of
+ * blocking the validation. While the request for the path is still
+ * pending, the next tests fail immediately.
+ */
+boolean_t filesystem_usage(Service_T s) {
+        ASSERT(s);
+
+        UsageRequest_T R = NULL;
+        boolean_t pending = false;
+        LOCK(cache.mutex)
+        {
+                if (! (pending = _isPending(s->path)))
+                        R = _newRequest(s->path);
+        }
+        END_LOCK;
+        if (pending) {
+                LogError("filesystem '%s' statistics are not available -- the previous request did not finish yet\n", s->path);
+                return false;
+        }
+        volatile boolean_t started = false;
+        TRY
+        {
+                Thread_T thread;
+                Thread_create(thread, _requestThread, R);
+                Thread_detach(thread);
+                started = true;
+        }
+        ELSE
+        {
+                LogError("filesystem '%s' cannot create thread -- %s\n", s->path, Exception_frame.message);
+        }
+        END_TRY;
+        if (! started) // Fallback to the synchronous request
+                _requestThread(R);
+        boolean_t succeeded = false;
+        LOCK(cache.mutex)
+        {
+                struct timespec wait = {.tv_sec = Time_now() + FILESYSTEM_TIMEOUT, .tv_nsec = 0};
+                while (! R->done && Time_now() < wait.tv_sec)
+                        Sem_timeWait(cache.done, cache.mutex, wait);
+                if (R->done) {
+                        if ((succeeded = R->succeeded))
+                                _copyUsage(s->inf, R);
+                } else {
+                        LogError("filesystem '%s' statistics timed out after %d seconds\n", s->path, FILESYSTEM_TIMEOUT);
+                }
+                _releaseRequest(R);
+        }
+        END_LOCK;
+        return succeeded;
+}
+
+
+/**
+ * Get the filesystem statistics of the services in one batch: one helper
+ * thread collects them in turn, instead of a thread per service. The
+ * batch shares the FILESYSTEM_TIMEOUT, the requests which the thread did
+ * not start until then are cancelled, so only the hung filesystem stays
+ * pending for the next cycles
+ * @param services The services to update
+ * @param count The number of services
+ * @param succeeded The result for each service
+ */
+void filesystem_usage_batch(Service_T *services, int count, boolean_t *succeeded) {
+        ASSERT(services);
+        ASSERT(succeeded);
+
+        UsageRequest_T *request = CALLOC(count > 0 ? count : 1, sizeof(UsageRequest_T));
+        UsageBatch_T B;
+        NEW(B);
+        B->request = CALLOC(count > 0 ? count : 1, sizeof(UsageRequest_T));
+        LOCK(cache.mutex)
+        {
+                for (int i = 0; i < count; i++) {
+                        succeeded[i] = false;
+                        if (! _isPending(services[i]->path))
+                                B->request[B->count++] = request[i] = _newRequest(services[i]->path);
+                }
+        }
+        END_LOCK;
+        for (int i = 0; i < count; i++)
+                if (! request[i])
+                        LogError("filesystem '%s' statistics are not available -- the previous request did not finish yet\n", services[i]->path);
+        if (! B->count) {
+                FREE(B->request);
+                FREE(B);
+                FREE(request);
+                return;
+        }
+        volatile boolean_t started = false;
+        TRY
+        {
+                Thread_T thread;
+                Thread_create(thread, _batchThread, B);
+                Thread_detach(thread);
+                started = true;
+        }
+        ELSE
+        {
+                LogError("filesystem statistics cannot create thread -- %s\n", Exception_frame.message);
+        }
+        END_TRY;
+        if (! started) // Fallback to the synchronous requests
+                _batchThread(B);
+        LOCK(cache.mutex)
+        {
+                struct timespec wait = {.tv_sec = Time_now() + FILESYSTEM_TIMEOUT, .tv_nsec = 0};
+                for (int i = 0; i < count; i++) {
+                        if (! request[i])
+                                continue;
+                        while (! request[i]->done && Time_now() < wait.tv_sec)
+                                Sem_timeWait(cache.done, cache.mutex, wait);
+                        if (! request[i]->done) {
+                                LogError("filesystem '%s' statistics timed out after %d seconds\n", services[i]->path, FILESYSTEM_TIMEOUT);
+                                // The request which didn't start yet is cancelled, the hung one stays pending
+                                if (! request[i]->started)
+                                        _finishRequest(request[i], false);
+                        } else if ((succeeded[i] = request[i]->succeeded)) {
+                                _copyUsage(services[i]->inf, request[i]);
+                        }
+                        _releaseRequest(request[i]);
+                }
+        }
+        END_LOCK;
+        FREE(request);
+}
+
+
+/**
+ * Get the mounted filesystems. The callback is called for each mount
+ * only if the mount table changed since the generation seen by the caller
+ * @param generation The mount table generation seen by the caller, updated on return. The caller initializes it to 0
+ * @param callback Called with the mountpoint, filesystem type and device id of each mount
+ * @param ap Callback argument
+ * @return true if the mount table is available, otherwise false
+ */
+boolean_t filesystem_mounts(unsigned int *generation, void (*callback)(const char *mountpoint, const char *fstype, dev_t dev, void *ap), void *ap) {
+        return device_mounts_sysdep(generation, callback, ap);
+}
+
+
+/**
+ * Drop the filesystem statistics collected in this cycle
+ */
+void filesystem_usage_reset() {
+        LOCK(cache.mutex)
+        {
+                cache.count = 0;
+        }
+        END_LOCK;
+}
+
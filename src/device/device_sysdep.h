@@ -26,6 +26,7 @@
 #define MONIT_DEVICE_SYSDEP_H
 
 char *device_mountpoint_sysdep(char *dev, char *buf, int buflen);
+boolean_t device_mounts_sysdep(unsigned int *generation, void (*callback)(const char *mountpoint, const char *fstype, dev_t dev, void *ap), void *ap);
 boolean_t filesystem_usage_sysdep(char *mntpoint, Info_T inf);
 
 #endif
@@ -80,6 +80,12 @@ char *device_mountpoint_sysdep(char *dev, char *buf, int buflen) {
 }
 
 
+boolean_t device_mounts_sysdep(unsigned int *generation, void (*callback)(const char *mountpoint, const char *fstype, dev_t dev, void *ap), void *ap) {
+        LogError("Unsupported mount table enumeration method\n");
+        return false;
+}
+
+
 boolean_t filesystem_usage_sysdep(char *mntpoint, Info_T inf) {
         struct statfs usage;
 
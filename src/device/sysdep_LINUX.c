@@ -54,34 +54,268 @@
 #include <mntent.h>
 #endif
 
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
+
 #include "monit.h"
 #include "device_sysdep.h"
 
 
-char *device_mountpoint_sysdep(char *dev, char *buf, int buflen) {
-        FILE *mntfd;
-        struct mntent *mnt;
+/* ------------------------------------------------------------- Definitions */
 
-        ASSERT(dev);
 
-        if ((mntfd = setmntent("/etc/mtab", "r")) == NULL) {
-                LogError("Cannot open /etc/mtab file\n");
-                return NULL;
+#define MOUNTINFO "/proc/self/mountinfo"
+
+
+typedef struct Mount_T {
+        char *device;                              /**< Mounted filesystem source */
+        char *resolved;          /**< Symbolic link target of the device or NULL */
+        char *mountpoint;
+        char *fstype;                                          /**< Filesystem type */
+        dev_t dev;                                       /**< Filesystem device id */
+        /* For internal use */
+        struct Mount_T *nextDevice;          /**< Next entry in the device bucket */
+        struct Mount_T *nextId;                  /**< Next entry in the id bucket */
+} *Mount_T;
+
+
+/**
+ * The mount table snapshot shared by the filesystem checks. It is read
+ * from /proc/self/mountinfo and re-read only when the kernel signals a
+ * change of the mount table on the open mountinfo descriptor (POLLPRI).
+ */
+static struct {
+        int fd;                                  /**< Polled mountinfo descriptor */
+        boolean_t stale;
+        unsigned int generation;       /**< Incremented when the table is re-read */
+        int count;
+        int size;                                        /**< Hash buckets count */
+        Mount_T entry;
+        Mount_T *byDevice;
+        Mount_T *byId;
+        Mutex_T mutex;
+} mounts = {.fd = -1, .stale = true, .mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static unsigned int _hash(const char *s) {
+        unsigned int h = 2166136261u;
+        while (*s)
+                h = (h ^ (unsigned char)*s++) * 16777619u;
+        return h;
+}
+
+
+/**
+ * Decode the octal escapes (e.g. \040 for space) used in mountinfo fields
+ */
+static char *_unescape(char *s) {
+        char *r = s, *w = s;
+        while (*r) {
+                if (r[0] == '\\' && r[1] >= '0' && r[1] <= '3' && r[2] >= '0' && r[2] <= '7' && r[3] >= '0' && r[3] <= '7') {
+                        *w++ = (char)((r[1] - '0') * 64 + (r[2] - '0') * 8 + (r[3] - '0'));
+                        r += 4;
+                } else {
+                        *w++ = *r++;
+                }
+        }
+        *w = 0;
+        return s;
+}
+
+
+static void _freeMounts() {
+        for (int i = 0; i < mounts.count; i++) {
+                FREE(mounts.entry[i].device);
+                FREE(mounts.entry[i].resolved);
+                FREE(mounts.entry[i].mountpoint);
+                FREE(mounts.entry[i].fstype);
         }
-        while ((mnt = getmntent(mntfd)) != NULL) {
-                /* Try to compare the the filesystem as is, if failed, try to use the symbolic link target */
-                if (IS(dev, mnt->mnt_fsname) || (realpath(mnt->mnt_fsname, buf) && IS(dev, buf))) {
-                        snprintf(buf, buflen, "%s", mnt->mnt_dir);
-                        endmntent(mntfd);
-                        return buf;
+        FREE(mounts.entry);
+        FREE(mounts.byDevice);
+        FREE(mounts.byId);
+        mounts.count = mounts.size = 0;
+}
+
+
+/**
+ * Parse one mountinfo line: "id parent major:minor root mountpoint options [optional fields] - fstype source superoptions"
+ */
+static boolean_t _parseMount(char *line, Mount_T m) {
+        unsigned int major, minor;
+        char root[PATH_MAX], mountpoint[PATH_MAX], fstype[STRLEN], source[PATH_MAX];
+        char *separator = strstr(line, " - ");
+        if (! separator || sscanf(line, "%*d %*d %u:%u %4095s %4095s", &major, &minor, root, mountpoint) != 4 || sscanf(separator + 3, "%255s %4095s", fstype, source) != 2)
+                return false;
+        m->dev = makedev(major, minor);
+        m->device = Str_dup(_unescape(source));
+        m->mountpoint = Str_dup(_unescape(mountpoint));
+        m->fstype = Str_dup(fstype);
+        if (*source == '/') {
+                char buf[PATH_MAX];
+                if (realpath(source, buf) && ! IS(buf, source))
+                        m->resolved = Str_dup(buf);
+        }
+        return true;
+}
+
+
+/**
+ * Read the mount table and index the entries by device path and device
+ * id. The entries are inserted in reverse so the first mount of a
+ * device is found first, as with the former sequential mtab lookup.
+ */
+static boolean_t _readMounts() {
+        FILE *f = fopen(MOUNTINFO, "r");
+        if (! f) {
+                LogError("Cannot open %s -- %s\n", MOUNTINFO, STRERROR);
+                return false;
+        }
+        _freeMounts();
+        int capacity = 64;
+        mounts.entry = CALLOC(capacity, sizeof(struct Mount_T));
+        char line[3 * PATH_MAX];
+        while (fgets(line, sizeof(line), f)) {
+                if (mounts.count == capacity) {
+                        capacity *= 2;
+                        RESIZE(mounts.entry, capacity * sizeof(struct Mount_T));
                 }
+                memset(&mounts.entry[mounts.count], 0, sizeof(struct Mount_T));
+                if (_parseMount(line, &mounts.entry[mounts.count]))
+                        mounts.count++;
+        }
+        fclose(f);
+        for (mounts.size = 64; mounts.size < 2 * mounts.count; mounts.size *= 2)
+                ;
+        mounts.byDevice = CALLOC(mounts.size, sizeof(Mount_T));
+        mounts.byId = CALLOC(mounts.size, sizeof(Mount_T));
+        for (int i = mounts.count - 1; i >= 0; i--) {
+                Mount_T m = &mounts.entry[i];
+                unsigned int d = _hash(m->device) & (mounts.size - 1), id = (unsigned int)(m->dev % mounts.size);
+                m->nextDevice = mounts.byDevice[d];
+                mounts.byDevice[d] = m;
+                m->nextId = mounts.byId[id];
+                mounts.byId[id] = m;
+        }
+        mounts.generation++;
+        DEBUG("Mount table loaded: %d filesystems\n", mounts.count);
+        return true;
+}
+
+
+/**
+ * Refresh the mount table snapshot if the kernel reported a change since the last lookup
+ */
+static boolean_t _refreshMounts() {
+        if (mounts.fd < 0) {
+                if ((mounts.fd = open(MOUNTINFO, O_RDONLY | O_CLOEXEC)) < 0) {
+                        LogError("Cannot open %s -- %s\n", MOUNTINFO, STRERROR);
+                        return false;
+                }
+                mounts.stale = true;
+        }
+        struct pollfd fd = {.fd = mounts.fd, .events = POLLPRI};
+        if (poll(&fd, 1, 0) > 0 && fd.revents & (POLLPRI | POLLERR))
+                mounts.stale = true;
+        if (mounts.stale) {
+                if (! _readMounts())
+                        return false;
+                mounts.stale = false;
         }
-        endmntent(mntfd);
-        LogError("Device %s not found in /etc/mtab\n", dev);
+        return true;
+}
+
+
+static Mount_T _findMount(char *dev) {
+        for (Mount_T m = mounts.byDevice[_hash(dev) & (mounts.size - 1)]; m; m = m->nextDevice)
+                if (IS(dev, m->device))
+                        return m;
+        // Try to compare with the symbolic link target of the filesystem source
+        for (int i = 0; i < mounts.count; i++)
+                if (mounts.entry[i].resolved && IS(dev, mounts.entry[i].resolved))
+                        return &mounts.entry[i];
+        // For a block device, look up by device id
+        struct stat sb;
+        if (stat(dev, &sb) == 0 && S_ISBLK(sb.st_mode))
+                for (Mount_T m = mounts.byId[(unsigned int)(sb.st_rdev % mounts.size)]; m; m = m->nextId)
+                        if (m->dev == sb.st_rdev)
+                                return m;
         return NULL;
 }
 
 
+/* ------------------------------------------------------------------ Public */
+
+
+char *device_mountpoint_sysdep(char *dev, char *buf, int buflen) {
+        ASSERT(dev);
+
+        char *mountpoint = NULL;
+        LOCK(mounts.mutex)
+        {
+                if (_refreshMounts()) {
+                        Mount_T m = _findMount(dev);
+                        if (m) {
+                                snprintf(buf, buflen, "%s", m->mountpoint);
+                                mountpoint = buf;
+                        }
+                }
+        }
+        END_LOCK;
+        if (! mountpoint)
+                LogError("Device %s not found in %s\n", dev, MOUNTINFO);
+        return mountpoint;
+}
+
+
+boolean_t device_mounts_sysdep(unsigned int *generation, void (*callback)(const char *mountpoint, const char *fstype, dev_t dev, void *ap), void *ap) {
+        ASSERT(generation);
+        ASSERT(callback);
+
+        boolean_t rv = false;
+        LOCK(mounts.mutex)
+        {
+                if (_refreshMounts()) {
+                        rv = true;
+                        if (*generation != mounts.generation) {
+                                *generation = mounts.generation;
+                                for (int i = 0; i < mounts.count; i++)
+                                        callback(mounts.entry[i].mountpoint, mounts.entry[i].fstype, mounts.entry[i].dev, ap);
+                        }
+                }
+        }
+        END_LOCK;
+        return rv;
+}
+
+
 boolean_t filesystem_usage_sysdep(char *mntpoint, Info_T inf) {
         struct statvfs usage;
 
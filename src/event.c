@@ -61,9 +61,15 @@
 #include "alert.h"
 #include "event.h"
 #include "process.h"
+#include "journal.h"
+#include "latency.h"
+#include "probe.h"
+#include "instance.h"
+#include "intern.h"
 
 // libmonit
 #include "io/File.h"
+#include "util/Str.h"
 #include "system/Time.h"
 
 /**
@@ -111,13 +117,107 @@ EventTable_T Event_Table[] = {
 };
 
 
+/* Event state names for the structured log, indexed by State_Type */
+static const char *statenames[] = {"succeeded", "failed", "changed", "changed not", "init"};
+
+
+/* The events of a service are posted under the service's lock stripe, so the scheduler workers post the events of different services in
+ * parallel. The locks are recursive as the event actions may post new events. The queue lock is taken after the service lock, never before */
+#define EVENT_LOCKS 64
+static pthread_once_t event_once = PTHREAD_ONCE_INIT;
+static Mutex_T event_mutex[EVENT_LOCKS];
+static Mutex_T queue_mutex;
+static Mutex_T latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Event queue journal, guarded by the queue lock */
+static Journal_T queue = NULL;
+
+/* The event state of the last cycles, a ring of bits (1 = failed or changed) as long as the longest cycles window of the event actions. The
+ * number of failed cycles within the window of the succeeded and failed action is updated on each shift, so the state check doesn't count bits */
+struct mystatemap {
+        int size;                                        /**< Ring size in bits */
+        int head;                                   /**< Bit of the last cycle */
+        int window[2];  /**< Cycles window of the succeeded [0] and failed [1] action */
+        int failed[2];            /**< Failed cycles within the succeeded and failed window */
+        unsigned long long bits[];                                    /**< The ring */
+};
+
+/* Queued event kept in memory */
+typedef struct mybuffered {
+        Event_T event;                     /**< Event copy without action reference */
+        Action_Type action;                                /**< The event action */
+} Buffered_T;
+
+/* The events buffer in front of the journal (set eventqueue ... buffer), guarded by the queue lock */
+static struct {
+        int count;                                    /**< Number of buffered events */
+        int size;                                      /**< Allocated buffer slots */
+        Buffered_T *event;                   /**< Buffered events, the oldest first */
+} buffer;
+
+/* The failed delivery is retried DELIVERY_ATTEMPTS times DELIVERY_RETRY seconds apart, then the event is moved to the event queue */
+#define DELIVERY_ATTEMPTS 3
+#define DELIVERY_RETRY    5
+
+/* Maximum number of events waiting for the delivery thread, the overflowing events go to the event queue directly */
+#define DELIVERY_QUEUE    1024
+
+/* Event waiting for the alert and M/Monit delivery */
+typedef struct mydelivery {
+        Event_T event;        /**< Event copy, the action refers to the copy below */
+        struct myaction action;                 /**< Copy of the handled action */
+        struct myeventaction eventaction;      /**< The event action of the copy */
+        unsigned long long queued;                 /**< Queued (Latency_now() time) */
+        unsigned long long due;       /**< Next attempt (Latency_now() time) or 0 */
+        int attempts;                               /**< Failed delivery attempts */
+        struct mydelivery *next;                        /**< Next event in the list */
+} *Delivery_T;
+
+/* Standalone event copy, the event must be the first member, see Event_copy() */
+typedef struct myeventcopy {
+        struct myevent event;                                  /**< Event copy */
+        struct myaction action;                 /**< Copy of the resolved action */
+        struct myeventaction eventaction;      /**< The event action of the copy */
+} *EventCopy_T;
+
+/* The delivery thread queue: the new events are delivered first, the failed ones are retried when due */
+static struct {
+        Delivery_T pending;                        /**< New events, the oldest first */
+        Delivery_T pending_tail;                      /**< Last event in the pending */
+        Delivery_T retry;              /**< Failed events, sorted by the due time */
+        Delivery_T retry_tail;                          /**< Last event in the retry */
+        volatile boolean_t running;            /**< true if the delivery thread runs */
+        Thread_T thread;
+        Mutex_T mutex;
+        Sem_T wakeup;
+} delivery = {.mutex = PTHREAD_MUTEX_INITIALIZER, .wakeup = PTHREAD_COND_INITIALIZER};
+
+
 /* -------------------------------------------------------------- Prototypes */
 
 
+static void _initMutex(void);
+static Mutex_T *_eventMutex(Service_T);
+static StateMap_T _statemap_new(EventAction_T);
+static void _statemap_shift(StateMap_T, int);
+static void _statemap_fill(StateMap_T, int);
+static int _statemap_last(StateMap_T);
+static Event_T _findEvent(Service_T, long, EventAction_T);
+static void _indexEvent(Service_T, Event_T);
+static void _post(Service_T, Event_T, long, State_Type, EventAction_T, char *);
 static void handle_event(Service_T, Event_T);
 static void handle_action(Event_T, Action_T);
+static Journal_T _queue_open();
+static Event_T _queue_decode(const unsigned char *, size_t, Action_Type *, const char *);
+static boolean_t _queue_append(Journal_T, Event_T, Action_Type);
 static void Event_queue_add(Event_T);
-static void Event_queue_update(Event_T, const char *);
+static boolean_t _queue_blocked();
+static void _queue_count(Event_T, int);
+static void _queue_deliver(Event_T *, Action_Type *, int, Action_T, EventAction_T);
+static void _buffer_free(Buffered_T *);
+static void _buffer_flush(Journal_T);
+static boolean_t _delivery_add(Event_T, Action_T);
+static void *_deliverer(void *);
 
 
 /* ------------------------------------------------------------------ Public */
@@ -137,91 +237,42 @@ void Event_post(Service_T service, long id, State_Type state, EventAction_T acti
         ASSERT(s);
         ASSERT(state == State_Failed || state == State_Succeeded || state == State_Changed || state == State_ChangedNot);
 
-        va_list ap;
-        va_start(ap, s);
-        char *message = Str_vcat(s, ap);
-        va_end(ap);
-
-        Event_T e = service->eventlist;
-        if (! e) {
-                /* Only first failed/changed event can initialize the queue for given event type, thus succeeded events are ignored until first error. */
-                if (state == State_Succeeded || state == State_ChangedNot) {
-                        DEBUG("'%s' %s\n", service->name, message);
-                        FREE(message);
-                        return;
-                }
-
-                /* Initialize event list and add first event. The manadatory informations
-                 * are cloned so the event is as standalone as possible and may be saved
-                 * to the queue without the dependency on the original service, thus
-                 * persistent and managable across monit restarts */
-                NEW(e);
-                e->id = id;
-                gettimeofday(&e->collected, NULL);
-                e->source = Str_dup(service->name);
-                e->mode = service->mode;
-                e->type = service->type;
-                e->state = State_Init;
-                e->state_map = 1;
-                e->action = action;
-                e->message = message;
-                service->eventlist = e;
-        } else {
-                /* Try to find the event with the same origin and type identification. Each service and each test have its own custom actions object, so we share actions object address to identify event source. */
-                do {
-                        if (e->action == action && e->id == id) {
+        pthread_once(&event_once, _initMutex);
+        unsigned long long started = Latency_now();
+        LOCK(*_eventMutex(service))
+        {
+                Event_T e = _findEvent(service, id, action);
+                if ((state == State_Succeeded || state == State_ChangedNot) && (! e || (e->state == state && e->id != Event_Instance && e->id != Event_Action))) {
+                        /* Fast path: a succeeded event without a prior error, or a recurrent succeeded event, is neither logged nor handled, so its message is formatted for debug only */
+                        if (e) {
+                                /* Same as _post() would do: such an event cannot change the state */
                                 gettimeofday(&e->collected, NULL);
-
-                                /* Shift the existing event flags to the left and set the first bit based on actual state */
-                                e->state_map <<= 1;
-                                e->state_map |= ((state == State_Succeeded || state == State_ChangedNot) ? 0 : 1);
-
-                                /* Update the message */
-                                FREE(e->message);
-                                e->message = message;
-                                break;
+                                _statemap_shift(e->state_map, 0);
+                                e->state_changed = false;
+                                e->count++;
                         }
-                        e = e->next;
-                } while (e);
-
-                if (! e) {
-                        /* Only first failed/changed event can initialize the queue for given event type, thus succeeded events are ignored until first error. */
-                        if (state == State_Succeeded || state == State_ChangedNot) {
+                        if (Run.debug) {
+                                va_list ap;
+                                va_start(ap, s);
+                                char *message = Str_vcat(s, ap);
+                                va_end(ap);
                                 DEBUG("'%s' %s\n", service->name, message);
                                 FREE(message);
-                                return;
                         }
-
-                        /* Event was not found in the pending events list, we will add it.
-                         * The manadatory informations are cloned so the event is as standalone
-                         * as possible and may be saved to the queue without the dependency on
-                         * the original service, thus persistent and managable across monit
-                         * restarts */
-                        NEW(e);
-                        e->id = id;
-                        gettimeofday(&e->collected, NULL);
-                        e->source = Str_dup(service->name);
-                        e->mode = service->mode;
-                        e->type = service->type;
-                        e->state = State_Init;
-                        e->state_map = 1;
-                        e->action = action;
-                        e->message = message;
-                        e->next = service->eventlist;
-                        service->eventlist = e;
+                } else {
+                        va_list ap;
+                        va_start(ap, s);
+                        char *message = Str_vcat(s, ap);
+                        va_end(ap);
+                        _post(service, e, id, state, action, message);
                 }
         }
-
-        e->state_changed = Event_check_state(e, state);
-
-        /* In the case that the state changed, update it and reset the counter */
-        if (e->state_changed) {
-                e->state = state;
-                e->count = 1;
-        } else
-                e->count++;
-
-        handle_event(service, e);
+        END_LOCK;
+        LOCK(latency_mutex)
+        {
+                Latency_record(&Run.latency.event, started);
+        }
+        END_LOCK;
 }
 
 
@@ -238,7 +289,7 @@ Service_T Event_get_source(Event_T E) {
 
         ASSERT(E);
 
-        if (! (s = Util_getService(E->source)))
+        if (! (s = Util_getService(E->source)) && ! (s = Instance_get(E->source)))
                 LogError("Service %s not found in monit configuration\n", E->source);
 
         return s;
@@ -250,7 +301,7 @@ Service_T Event_get_source(Event_T E) {
  * @param E An event object
  * @return The Service name where the event orginated
  */
-char *Event_get_source_name(Event_T E) {
+const char *Event_get_source_name(Event_T E) {
         ASSERT(E);
         return (E->source);
 }
@@ -297,11 +348,10 @@ State_Type Event_get_state(Event_T E) {
  * @return The event state
  */
 boolean_t Event_check_state(Event_T E, State_Type S) {
-        int        count = 0;
+        int        count;
         State_Type state = (S == State_Succeeded || S == State_ChangedNot) ? State_Succeeded : State_Failed; /* translate to 0/1 class */
         Action_T   action;
         Service_T  service;
-        long long  flag;
 
         ASSERT(E);
 
@@ -314,19 +364,12 @@ boolean_t Event_check_state(Event_T E, State_Type S) {
 
         action = ! state ? E->action->succeeded : E->action->failed;
 
-        /* Compare as many bits as cycles able to trigger the action */
-        for (int i = 0; i < action->cycles; i++) {
-                /* Check the state of the particular cycle given by the bit position */
-                flag = (E->state_map >> i) & 0x1;
-
-                /* Count occurences of the posted state */
-                if (flag == state)
-                        count++;
-        }
+        /* Occurences of the posted state within as many cycles as able to trigger the action, the map keeps the running count */
+        count = state ? E->state_map->failed[1] : E->state_map->window[0] - E->state_map->failed[0];
 
         /* the internal instance and action events are handled as changed any time since we need to deliver alert whenever it occurs */
         if (E->id == Event_Instance || E->id == Event_Action || (count >= action->count && (S != E->state || S == State_Changed))) {
-                memset(&(E->state_map), state, sizeof(E->state_map)); // Restart state map on state change, so we'll not flicker on multiple-failures condition (next state change requires full number of cycles to pass)
+                _statemap_fill(E->state_map, state); // Restart state map on state change, so we'll not flicker on multiple-failures condition (next state change requires full number of cycles to pass)
                 return true;
         }
 
@@ -439,173 +482,418 @@ const char *Event_get_action_description(Event_T E) {
 
 
 /**
- * Reprocess the partially handled event queue
+ * Get a copy of the event which doesn't refer to the configuration, so it
+ * can outlive the event and the reload. The action is resolved, the state
+ * map isn't copied
+ * @param E An event object
+ * @return The event copy, free it using Event_copy_free()
+ */
+Event_T Event_copy(Event_T E) {
+        ASSERT(E);
+        EventCopy_T c;
+        NEW(c);
+        c->event = *E;
+        c->event.source = Intern_copy(E->source);
+        c->event.message = E->message ? Str_dup(E->message) : NULL;
+        c->event.state_map = NULL;
+        c->event.next = NULL;
+        c->action.id = Event_get_action(E);
+        c->eventaction.failed = c->eventaction.succeeded = &c->action;
+        c->event.action = &c->eventaction;
+        return &c->event;
+}
+
+
+/**
+ * Free the event copy
+ * @param E The event copy returned by Event_copy()
+ */
+void Event_copy_free(Event_T *E) {
+        ASSERT(E && *E);
+        FREE((*E)->message);
+        Intern_release(&(*E)->source);
+        FREE(*E);
+}
+
+
+/**
+ * Reprocess the partially handled event queue. The events are replayed in
+ * the order of arrival, in batches of Run.eventlist_batch events, and at
+ * most Run.eventlist_replay events per cycle, so a long queue left after
+ * an outage doesn't delay the checks and the new events
  */
 void Event_queue_process() {
         /* return in the case that the eventqueue is not enabled or empty */
         if (! Run.eventlist_dir || (! Run.handler_init && ! Run.handler_queue[Handler_Alert] && ! Run.handler_queue[Handler_Mmonit]))
                 return;
 
-        DIR *dir = opendir(Run.eventlist_dir);
-        if (! dir) {
-                if (errno != ENOENT)
-                        LogError("Cannot open the directory %s -- %s\n", Run.eventlist_dir, STRERROR);
+        pthread_once(&event_once, _initMutex);
+        unsigned long long cpu = Latency_cpu();
+        LOCK(queue_mutex)
+        {
+                Journal_T journal = _queue_open();
+                if (journal && (Journal_count(journal) || buffer.count)) {
+                        DEBUG("Processing postponed events queue\n");
+
+                        /* The first pass counts all queued events for the handlers, the replay may not reach all of them in this cycle */
+                        if (Run.handler_init) {
+                                size_t size;
+                                unsigned char *data;
+                                Run.handler_init = false;
+                                Journal_begin(journal);
+                                while ((data = Journal_next(journal, &size))) {
+                                        Action_Type action;
+                                        Event_T e = _queue_decode(data, size, &action, "journal");
+                                        if (e) {
+                                                _queue_count(e, 1);
+                                                FREE(e->message);
+                                                Intern_release(&e->source);
+                                                FREE(e);
+                                        }
+                                        FREE(data);
+                                }
+                                for (int i = 0; i < buffer.count; i++)
+                                        _queue_count(buffer.event[i].event, 1);
+                        }
+
+                        int batch = Run.eventlist_batch;
+                        int replayed = 0;
+                        Event_T *events = CALLOC(batch, sizeof(Event_T));
+                        Action_Type *actions = CALLOC(batch, sizeof(Action_Type));
+                        Action_T a = CALLOC(batch, sizeof(struct myaction));
+                        EventAction_T ea = CALLOC(batch, sizeof(struct myeventaction));
+
+                        /* The journal holds the older events, process it first */
+                        Journal_begin(journal);
+                        while (! _queue_blocked() && replayed < Run.eventlist_replay) {
+                                int count = 0;
+                                while (count < batch && replayed + count < Run.eventlist_replay) {
+                                        size_t size;
+                                        unsigned char *data = Journal_next(journal, &size);
+                                        if (! data)
+                                                break;
+                                        if ((events[count] = _queue_decode(data, size, &actions[count], "journal")))
+                                                count++;
+                                        FREE(data);
+                                }
+                                if (! count)
+                                        break;
+                                _queue_deliver(events, actions, count, a, ea);
+                                for (int i = 0; i < count; i++) {
+                                        Event_T e = events[i];
+                                        /* The record is consumed, the event is appended to the tail again if some handler is still pending */
+                                        if (e->flag != Handler_Succeeded) {
+                                                DEBUG("Requeueing event for %s\n", e->source);
+                                                if (! _queue_append(journal, e, actions[i]))
+                                                        LogError("Aborting queued event for %s - unable to save event information\n", e->source);
+                                        }
+                                        FREE(e->message);
+                                        Intern_release(&e->source);
+                                        FREE(e);
+                                }
+                                replayed += count;
+                        }
+                        /* Move the head past the processed records, the records which were not reached stay in the queue */
+                        Journal_sync(journal);
+                        Journal_commit(journal);
+
+                        /* The events buffered in memory, the pending ones are kept in order */
+                        int kept = 0;
+                        for (int i = 0; i < buffer.count;) {
+                                int count = 0;
+                                while (! _queue_blocked() && i + count < buffer.count && count < batch && replayed < Run.eventlist_replay) {
+                                        events[count] = buffer.event[i + count].event;
+                                        actions[count] = buffer.event[i + count].action;
+                                        count++;
+                                        replayed++;
+                                }
+                                if (count)
+                                        _queue_deliver(events, actions, count, a, ea);
+                                else
+                                        count = buffer.count - i; // Not replayed in this cycle
+                                for (int j = i; j < i + count; j++) {
+                                        if (buffer.event[j].event->flag != Handler_Succeeded) {
+                                                buffer.event[j].event->action = NULL;
+                                                buffer.event[kept++] = buffer.event[j];
+                                        } else {
+                                                _buffer_free(&buffer.event[j]);
+                                        }
+                                }
+                                i += count;
+                        }
+                        buffer.count = kept;
+                        if (Journal_count(journal) || buffer.count)
+                                DEBUG("%d queued events replayed, %d events left in the queue\n", replayed, Journal_count(journal) + buffer.count);
+
+                        FREE(events);
+                        FREE(actions);
+                        FREE(a);
+                        FREE(ea);
+                }
+                Run.handler_init = false;
+        }
+        END_LOCK;
+        Latency_cost(Cost_Event, cpu);
+}
+
+
+/**
+ * Flush the events queued in this cycle to disk
+ */
+void Event_queue_sync() {
+        pthread_once(&event_once, _initMutex);
+        LOCK(queue_mutex)
+        {
+                if (queue)
+                        Journal_sync(queue);
+        }
+        END_LOCK;
+}
+
+
+/**
+ * Get the number of the queued events and the journal size
+ */
+void Event_queue_usage(int *count, unsigned long long *size) {
+        ASSERT(count);
+        ASSERT(size);
+        pthread_once(&event_once, _initMutex);
+        LOCK(queue_mutex)
+        {
+                *count = buffer.count + (queue ? Journal_count(queue) : 0);
+                *size = queue ? Journal_size(queue) : 0;
+        }
+        END_LOCK;
+}
+
+
+/**
+ * Close the event queue, it is reopened on demand
+ */
+void Event_queue_close() {
+        pthread_once(&event_once, _initMutex);
+        LOCK(queue_mutex)
+        {
+                /* Spill the buffered events, so they survive the restart */
+                if (buffer.count && Run.eventlist_dir && _queue_open())
+                        _buffer_flush(queue);
+                for (int i = 0; i < buffer.count; i++) {
+                        LogError("Aborting queued event for %s - unable to save event information\n", buffer.event[i].event->source);
+                        _buffer_free(&buffer.event[i]);
+                }
+                buffer.count = 0;
+                FREE(buffer.event);
+                buffer.size = 0;
+                if (queue)
+                        Journal_close(&queue);
+        }
+        END_LOCK;
+}
+
+
+/**
+ * Start the delivery thread. The alert and M/Monit notifications of the
+ * events posted meanwhile are sent by the thread, so the slow mail server
+ * or M/Monit don't delay the checks. The events are delivered directly by
+ * Event_post() if the thread doesn't run
+ */
+void Event_delivery_start() {
+        if (delivery.running)
+                return;
+        delivery.running = true;
+        Thread_create(delivery.thread, _deliverer, NULL);
+}
+
+
+/**
+ * Stop the delivery thread. The pending events are delivered once more,
+ * the undelivered events are moved to the event queue
+ */
+void Event_delivery_stop() {
+        if (! delivery.running)
                 return;
+        LOCK(delivery.mutex)
+        {
+                delivery.running = false;
+                Sem_signal(delivery.wakeup);
         }
+        END_LOCK;
+        Thread_join(delivery.thread);
+}
 
-        struct dirent *de = readdir(dir);
-        if (de)
-                DEBUG("Processing postponed events queue\n");
 
-        Action_T a;
-        NEW(a);
+/* ----------------------------------------------------------------- Private */
 
-        EventAction_T ea;
-        NEW(ea);
 
-        while (de) {
-                int handlers_passed = 0;
+static void _initMutex(void) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        for (int i = 0; i < EVENT_LOCKS; i++)
+                pthread_mutex_init(&event_mutex[i], &attr);
+        pthread_mutex_init(&queue_mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+}
 
-                /* In the case that all handlers failed, skip the further processing in this cycle. Alert handler is currently defined anytime (either explicitly or localhost by default) */
-                if ( (Run.mmonits && FLAG(Run.handler_flag, Handler_Mmonit) && FLAG(Run.handler_flag, Handler_Alert)) || FLAG(Run.handler_flag, Handler_Alert))
-                        break;
 
-                char file_name[PATH_MAX];
-                snprintf(file_name, sizeof(file_name), "%s/%s", Run.eventlist_dir, de->d_name);
+/*
+ * Returns the lock of the service's event list and index, the services are spread over the lock stripes by the object address
+ */
+static Mutex_T *_eventMutex(Service_T service) {
+        unsigned long long hash = (unsigned long long)(unsigned long)service * 0x9E3779B97F4A7C15ULL;
+        return &event_mutex[(hash >> 32) % EVENT_LOCKS];
+}
 
-                if (File_isFile(file_name)) {
-                        LogInfo("Processing queued event %s\n", file_name);
 
-                        FILE *file = fopen(file_name, "r");
-                        if (! file) {
-                                LogError("Queued event processing failed - cannot open the file %s -- %s\n", file_name, STRERROR);
-                                goto error1;
-                        }
+/*
+ * Create the state map of the event, the ring is as long as the longest cycles window of the event actions and all cycles are succeeded
+ */
+static StateMap_T _statemap_new(EventAction_T action) {
+        int size = action->failed->cycles > action->succeeded->cycles ? action->failed->cycles : action->succeeded->cycles;
+        if (size < 1)
+                size = 1;
+        StateMap_T M = CALLOC(1, sizeof(struct mystatemap) + (size + 63) / 64 * sizeof(unsigned long long));
+        M->size = size;
+        M->window[0] = action->succeeded->cycles;
+        M->window[1] = action->failed->cycles;
+        return M;
+}
 
-                        size_t size;
 
-                        /* read event structure version */
-                        int *version = file_readQueue(file, &size);
-                        if (! version) {
-                                LogError("skipping queued event %s - unknown data format\n", file_name);
-                                goto error2;
-                        }
-                        if (size != sizeof(int)) {
-                                LogError("Aborting queued event %s - invalid size %lu\n", file_name, (unsigned long)size);
-                                goto error3;
-                        }
-                        if (*version != EVENT_VERSION) {
-                                LogError("Aborting queued event %s - incompatible data format version %d\n", file_name, *version);
-                                goto error3;
-                        }
+/*
+ * Add the cycle state (1 = failed) to the map. The bit which leaves each window is read before the new bit is written, as with the window
+ * as long as the ring it is the same bit
+ */
+static void _statemap_shift(StateMap_T M, int bit) {
+        M->head = M->head + 1 < M->size ? M->head + 1 : 0;
+        for (int i = 0; i < 2; i++) {
+                if (M->window[i] > 0) {
+                        int leaving = M->head - M->window[i];
+                        if (leaving < 0)
+                                leaving += M->size;
+                        M->failed[i] += bit - (int)((M->bits[leaving / 64] >> (leaving % 64)) & 0x1);
+                }
+        }
+        if (bit)
+                M->bits[M->head / 64] |= 1ULL << (M->head % 64);
+        else
+                M->bits[M->head / 64] &= ~(1ULL << (M->head % 64));
+}
 
-                        /* read event structure */
-                        Event_T e = file_readQueue(file, &size);
-                        if (! e)
-                                goto error3;
-                        if (size != sizeof(*e))
-                                goto error4;
-
-                        /* read source */
-                        if (! (e->source = file_readQueue(file, &size)))
-                                goto error4;
-
-                        /* read message */
-                        if (! (e->message = file_readQueue(file, &size)))
-                                goto error5;
-
-                        /* read event action */
-                        Action_Type *action = file_readQueue(file, &size);
-                        if (! action)
-                                goto error6;
-                        if (size != sizeof(Action_Type))
-                                goto error7;
-                        a->id = *action;
-                        switch (e->state) {
-                                case State_Succeeded:
-                                case State_ChangedNot:
-                                        ea->succeeded = a;
-                                        break;
-                                case State_Failed:
-                                case State_Changed:
-                                case State_Init:
-                                        ea->failed = a;
-                                        break;
-                                default:
-                                        LogError("Aborting queue event %s -- invalid state: %d\n", file_name, e->state);
-                                        goto error7;
-                        }
-                        e->action = ea;
-
-                        /* Retry all remaining handlers */
-
-                        /* alert */
-                        if (e->flag & Handler_Alert) {
-                                if (Run.handler_init)
-                                        Run.handler_queue[Handler_Alert]++;
-                                if ((Run.handler_flag & Handler_Alert) != Handler_Alert) {
-                                        if ( handle_alert(e) != Handler_Alert ) {
-                                                e->flag &= ~Handler_Alert;
-                                                Run.handler_queue[Handler_Alert]--;
-                                                handlers_passed++;
-                                        } else {
-                                                LogError("Alert handler failed, retry scheduled for next cycle\n");
-                                                Run.handler_flag |= Handler_Alert;
-                                        }
-                                }
-                        }
 
-                        /* mmonit */
-                        if (e->flag & Handler_Mmonit) {
-                                if (Run.handler_init)
-                                        Run.handler_queue[Handler_Mmonit]++;
-                                if ((Run.handler_flag & Handler_Mmonit) != Handler_Mmonit) {
-                                        if ( handle_mmonit(e) != Handler_Mmonit ) {
-                                                e->flag &= ~Handler_Mmonit;
-                                                Run.handler_queue[Handler_Mmonit]--;
-                                                handlers_passed++;
-                                        } else {
-                                                LogError("M/Monit handler failed, retry scheduled for next cycle\n");
-                                                Run.handler_flag |= Handler_Mmonit;
-                                        }
-                                }
-                        }
+/*
+ * Set all cycles of the map to the given state
+ */
+static void _statemap_fill(StateMap_T M, int bit) {
+        memset(M->bits, bit ? 0xff : 0, (M->size + 63) / 64 * sizeof(unsigned long long));
+        for (int i = 0; i < 2; i++)
+                M->failed[i] = bit ? M->window[i] : 0;
+}
 
-                        /* If no error persists, remove it from the queue */
-                        if (e->flag == Handler_Succeeded) {
-                                DEBUG("Removing queued event %s\n", file_name);
-                                if (unlink(file_name) < 0)
-                                        LogError("Failed to remove queued event file '%s' -- %s\n", file_name, STRERROR);
-                        } else if (handlers_passed > 0) {
-                                DEBUG("Updating queued event %s (some handlers passed)\n", file_name);
-                                Event_queue_update(e, file_name);
-                        }
 
-                error7:
-                        FREE(action);
-                error6:
-                        FREE(e->message);
-                error5:
-                        FREE(e->source);
-                error4:
-                        FREE(e);
-                error3:
-                        FREE(version);
-                error2:
-                        fclose(file);
+/*
+ * Returns the state of the last cycle (1 = failed)
+ */
+static int _statemap_last(StateMap_T M) {
+        return (int)((M->bits[M->head / 64] >> (M->head % 64)) & 0x1);
+}
+
+
+/*
+ * Get the hash table slot of the event with the given id and action
+ */
+static unsigned int _eventSlot(Service_T service, long id, EventAction_T action) {
+        unsigned long long hash = ((unsigned long long)(unsigned long)action >> 3) * 0x9E3779B97F4A7C15ULL ^ (unsigned long long)id;
+        unsigned int mask = service->eventindex.size - 1;
+        unsigned int slot = (unsigned int)(hash ^ (hash >> 32)) & mask;
+        for (Event_T e; (e = service->eventindex.table[slot]); slot = (slot + 1) & mask)
+                if (e->action == action && e->id == id)
+                        break;
+        return slot;
+}
+
+
+/*
+ * Find the pending event of the service with the same origin and type identification. Each service and each test have its own custom actions object, so we share actions object address to identify event source.
+ */
+static Event_T _findEvent(Service_T service, long id, EventAction_T action) {
+        if (! service->eventindex.count)
+                return NULL;
+        return service->eventindex.table[_eventSlot(service, id, action)];
+}
+
+
+/*
+ * Add the event to the service's events index, the table is kept at most half full
+ */
+static void _indexEvent(Service_T service, Event_T e) {
+        if (2 * (service->eventindex.count + 1) > service->eventindex.size) {
+                /* Grow the table and reindex the events list (the new event is already part of it) */
+                FREE(service->eventindex.table);
+                service->eventindex.size = service->eventindex.size ? 2 * service->eventindex.size : 16;
+                service->eventindex.table = CALLOC(service->eventindex.size, sizeof(Event_T));
+                service->eventindex.count = 0;
+                for (Event_T l = service->eventlist; l; l = l->next) {
+                        service->eventindex.table[_eventSlot(service, l->id, l->action)] = l;
+                        service->eventindex.count++;
                 }
-        error1:
-                de = readdir(dir);
+        } else {
+                service->eventindex.table[_eventSlot(service, e->id, e->action)] = e;
+                service->eventindex.count++;
         }
-        Run.handler_init = false;
-        closedir(dir);
-        FREE(a);
-        FREE(ea);
-        return;
 }
 
 
-/* ----------------------------------------------------------------- Private */
+/*
+ * Update the service's event list and handle the event. The event e is the pending event with the same id and action or NULL. Called with the service's event lock held
+ */
+static void _post(Service_T service, Event_T e, long id, State_Type state, EventAction_T action, char *message) {
+        if (e) {
+                gettimeofday(&e->collected, NULL);
+
+                /* Shift the existing event flags and set the last cycle bit based on actual state */
+                _statemap_shift(e->state_map, (state == State_Succeeded || state == State_ChangedNot) ? 0 : 1);
+
+                /* Update the message */
+                FREE(e->message);
+                e->message = message;
+        } else {
+                /* Only first failed/changed event can initialize the queue for given event type, thus succeeded events are ignored until first error (see Event_post()). */
+                ASSERT(state == State_Failed || state == State_Changed);
+
+                /* Event was not found in the pending events list, we will add it.
+                 * The manadatory informations are cloned so the event is as standalone
+                 * as possible and may be saved to the queue without the dependency on
+                 * the original service, thus persistent and managable across monit
+                 * restarts */
+                NEW(e);
+                e->id = id;
+                gettimeofday(&e->collected, NULL);
+                e->source = Intern_get(service->name);
+                e->mode = service->mode;
+                e->type = service->type;
+                e->state = State_Init;
+                e->state_map = _statemap_new(action);
+                _statemap_shift(e->state_map, 1);
+                e->action = action;
+                e->message = message;
+                e->next = service->eventlist;
+                service->eventlist = e;
+                _indexEvent(service, e);
+        }
+
+        e->state_changed = Event_check_state(e, state);
+
+        /* In the case that the state changed, update it and reset the counter */
+        if (e->state_changed) {
+                e->state = state;
+                e->count = 1;
+                PROBE4(event__state, service->name, id, state, message);
+        } else
+                e->count++;
+
+        handle_event(service, e);
+}
 
 
 /*
@@ -621,7 +909,7 @@ static void handle_event(Service_T S, Event_T E) {
         /* We will handle only first succeeded event, recurrent succeeded events
          * or insufficient succeeded events during failed service state are
          * ignored. Failed events are handled each time. */
-        if (! E->state_changed && (E->state == State_Succeeded || E->state == State_ChangedNot || ((E->state_map & 0x1) ^ 0x1))) {
+        if (! E->state_changed && (E->state == State_Succeeded || E->state == State_ChangedNot || ! _statemap_last(E->state_map))) {
                 DEBUG("'%s' %s\n", S->name, E->message);
                 return;
         }
@@ -631,11 +919,9 @@ static void handle_event(Service_T S, Event_T E) {
                  * occured, log it and exit. Succeeded events in init state are not
                  * logged. Instance and action events are logged always with priority
                  * info. */
-                if (E->state != State_Init || E->state_map & 0x1) {
-                        if (E->state == State_Succeeded || E->state == State_ChangedNot || E->id == Event_Instance || E->id == Event_Action)
-                                LogInfo("'%s' %s\n", S->name, E->message);
-                        else
-                                LogError("'%s' %s\n", S->name, E->message);
+                if (E->state != State_Init || _statemap_last(E->state_map)) {
+                        int priority = (E->state == State_Succeeded || E->state == State_ChangedNot || E->id == Event_Instance || E->id == Event_Action) ? LOG_INFO : LOG_ERR;
+                        LogEvent(priority, S->name, Event_get_description(E), statenames[E->state], "'%s' %s\n", S->name, E->message);
                 }
                 if (E->state == State_Init)
                         return;
@@ -672,17 +958,24 @@ static void handle_action(Event_T E, Action_T A) {
         if (A->id == Action_Ignored)
                 return;
 
-        /* Alert and mmonit event notification are common actions */
-        E->flag |= handle_mmonit(E);
-        E->flag |= handle_alert(E);
-
-        /* In the case that some subhandler failed, enqueue the event for
-         * partial reprocessing */
-        if (E->flag != Handler_Succeeded) {
-                if (Run.eventlist_dir)
-                        Event_queue_add(E);
-                else
-                        LogError("Aborting event\n");
+        /* Alert and mmonit event notification are common actions, they're sent by the delivery thread if it runs. The direct delivery shares
+         * the M/Monit connection and the mail session, it is serialized by the queue lock */
+        if (! _delivery_add(E, A)) {
+                LOCK(queue_mutex)
+                {
+                        E->flag |= handle_mmonit(E);
+                        E->flag |= handle_alert(E);
+
+                        /* In the case that some subhandler failed, enqueue the event for
+                         * partial reprocessing */
+                        if (E->flag != Handler_Succeeded) {
+                                if (Run.eventlist_dir)
+                                        Event_queue_add(E);
+                                else
+                                        LogError("Aborting event\n");
+                        }
+                }
+                END_LOCK;
         }
 
         if (! (s = Event_get_source(E))) {
@@ -699,6 +992,9 @@ static void handle_action(Event_T E, Action_T A) {
                 LogInfo("'%s' exec: %s\n", s->name, A->exec->arg[0]);
                 spawn(s, A->exec, E);
                 return;
+        } else if (s->instance.owner) {
+                /* The process instance is not in the service list and cannot be controlled */
+                LogWarning("'%s' %s action is not supported for the process instance, use alert or exec\n", s->name, actionnames[A->id]);
         } else {
                 if (s->actionratelist && (A->id == Action_Start || A->id == Action_Restart))
                         s->nstart++;
@@ -706,136 +1002,555 @@ static void handle_action(Event_T E, Action_T A) {
                 if (s->mode == Monitor_Passive && (A->id == Action_Start || A->id == Action_Stop  || A->id == Action_Restart))
                         return;
 
-                control_service(s->name, A->id);
+                /* The action is done at the end of the cycle, so the restarts don't block the checks and the event handling */
+                control_queue(s, A->id);
         }
 }
 
 
-/**
- * Add the partialy handled event to the global queue
- * @param E An event object
+/*
+ * Serialize the event. The record keeps the layout of the former event
+ * queue files: version, event structure, source, message and action, each
+ * prefixed by its size
  */
-static void Event_queue_add(Event_T E) {
-        ASSERT(E);
-        ASSERT(E->flag != Handler_Succeeded);
-
-        if (! file_checkQueueDirectory(Run.eventlist_dir)) {
-                LogError("Aborting event - cannot access the directory %s\n", Run.eventlist_dir);
-                return;
+static unsigned char *_queue_encode(Event_T E, Action_Type action, size_t *size) {
+        int version = EVENT_VERSION;
+        struct {
+                const void *data;
+                size_t size;
+        } field[] = {
+                {&version, sizeof(int)},
+                {E, sizeof(*E)},
+                {E->source, E->source ? strlen(E->source) + 1 : 0},
+                {E->message, E->message ? strlen(E->message) + 1 : 0},
+                {&action, sizeof(Action_Type)}
+        };
+        *size = 0;
+        for (int i = 0; i < 5; i++)
+                *size += sizeof(size_t) + field[i].size;
+        unsigned char *data = ALLOC(*size), *p = data;
+        for (int i = 0; i < 5; i++) {
+                memcpy(p, &field[i].size, sizeof(size_t));
+                p += sizeof(size_t);
+                if (field[i].size) {
+                        memcpy(p, field[i].data, field[i].size);
+                        p += field[i].size;
+                }
         }
+        return data;
+}
 
-        if (! file_checkQueueLimit(Run.eventlist_dir, Run.eventlist_slots)) {
-                LogError("Aborting event - queue over quota\n");
-                return;
-        }
 
-        /* compose the file name of actual timestamp and service name */
-        char file_name[PATH_MAX];
-        snprintf(file_name, PATH_MAX, "%s/%lld_%lx", Run.eventlist_dir, (long long)Time_now(), (long unsigned)E->source);
+/*
+ * Returns the next field of the serialized event or NULL if the data is truncated or the field is empty
+ */
+static const unsigned char *_queue_field(const unsigned char **p, const unsigned char *end, size_t *size) {
+        if ((size_t)(end - *p) < sizeof(size_t))
+                return NULL;
+        memcpy(size, *p, sizeof(size_t));
+        *p += sizeof(size_t);
+        if (! *size || *size > (size_t)(end - *p))
+                return NULL;
+        const unsigned char *field = *p;
+        *p += *size;
+        return field;
+}
 
-        LogInfo("Adding event to the queue file %s for later delivery\n", file_name);
 
-        FILE *file = fopen(file_name, "w");
-        if (! file) {
-                LogError("Aborting event - cannot open the event file %s -- %s\n", file_name, STRERROR);
-                return;
+/*
+ * Deserialize the event. The message is allocated and the source is interned, the caller must free and release them and the event, the action is not set
+ */
+static Event_T _queue_decode(const unsigned char *data, size_t length, Action_Type *action, const char *name) {
+        size_t size;
+        const unsigned char *p = data, *end = data + length, *field;
+
+        /* event structure version */
+        if (! (field = _queue_field(&p, end, &size))) {
+                LogError("Aborting queued event %s - unknown data format\n", name);
+                return NULL;
+        }
+        if (size != sizeof(int)) {
+                LogError("Aborting queued event %s - invalid size %lu\n", name, (unsigned long)size);
+                return NULL;
+        }
+        int version;
+        memcpy(&version, field, sizeof(int));
+        if (version != EVENT_VERSION) {
+                LogError("Aborting queued event %s - incompatible data format version %d\n", name, version);
+                return NULL;
         }
 
-        boolean_t  rv;
+        /* event structure */
+        if (! (field = _queue_field(&p, end, &size)) || size != sizeof(struct myevent)) {
+                LogError("Aborting queued event %s - invalid event data\n", name);
+                return NULL;
+        }
+        Event_T e;
+        NEW(e);
+        memcpy(e, field, sizeof(*e));
+        e->source = e->message = NULL;
+        e->state_map = NULL;
+        e->action = NULL;
+        e->next = NULL;
+        switch (e->state) {
+                case State_Succeeded:
+                case State_ChangedNot:
+                case State_Failed:
+                case State_Changed:
+                case State_Init:
+                        break;
+                default:
+                        LogError("Aborting queued event %s - invalid state: %d\n", name, e->state);
+                        goto error;
+        }
 
-        /* write event structure version */
-        int version = EVENT_VERSION;
-        if (! (rv = file_writeQueue(file, &version, sizeof(int))))
+        /* source */
+        if (! (field = _queue_field(&p, end, &size)))
                 goto error;
+        if (size && ! field[size - 1]) {
+                e->source = Intern_get((const char *)field);
+        } else if (size) {
+                char *source = Str_ndup((const char *)field, (int)size);
+                e->source = Intern_get(source);
+                FREE(source);
+        }
 
-        /* write event structure */
-        if (! (rv = file_writeQueue(file, E, sizeof(*E))))
+        /* message */
+        if (! (field = _queue_field(&p, end, &size)))
                 goto error;
+        e->message = Str_ndup((const char *)field, (int)size);
 
-        /* write source */
-        if (! (rv = file_writeQueue(file, E->source, E->source ? strlen(E->source) + 1 : 0)))
+        /* event action */
+        if (! (field = _queue_field(&p, end, &size)) || size != sizeof(Action_Type))
                 goto error;
+        memcpy(action, field, sizeof(Action_Type));
+        return e;
 
-        /* write message */
-        if (! (rv = file_writeQueue(file, E->message, E->message ? strlen(E->message) + 1 : 0)))
-                goto error;
+error:
+        LogError("Aborting queued event %s - invalid event data\n", name);
+        FREE(e->message);
+        Intern_release(&e->source);
+        FREE(e);
+        return NULL;
+}
 
-        /* write event action */
-        Action_Type action = Event_get_action(E);
-        if (! (rv = file_writeQueue(file, &action, sizeof(Action_Type))))
-                goto error;
 
-error:
-        fclose(file);
-        if (! rv) {
-                LogError("Aborting event - unable to save event information to %s\n",  file_name);
+static boolean_t _queue_append(Journal_T journal, Event_T E, Action_Type action) {
+        size_t size;
+        unsigned char *data = _queue_encode(E, action, &size);
+        boolean_t rv = Journal_append(journal, data, size);
+        FREE(data);
+        return rv;
+}
+
+
+/*
+ * Move the events stored in one file per event by the previous monit versions to the journal. The file names start with
+ * the event time, so the sorted names keep the events in time order
+ */
+static void _queue_migrate(Journal_T journal) {
+        struct dirent **list;
+        int count = scandir(Run.eventlist_dir, &list, NULL, alphasort);
+        if (count < 0) {
+                LogError("Cannot open the directory %s -- %s\n", Run.eventlist_dir, STRERROR);
+                return;
+        }
+        for (int i = 0; i < count; i++) {
+                struct dirent *de = list[i];
+                char file_name[PATH_MAX];
+                snprintf(file_name, sizeof(file_name), "%s/%s", Run.eventlist_dir, de->d_name);
+                boolean_t skip = Str_startsWith(de->d_name, "journal.") || ! File_isFile(file_name);
+                FREE(list[i]);
+                if (skip)
+                        continue;
+                LogInfo("Moving queued event %s to the event queue journal\n", file_name);
+                FILE *file = fopen(file_name, "r");
+                if (! file) {
+                        LogError("Queued event processing failed - cannot open the file %s -- %s\n", file_name, STRERROR);
+                        continue;
+                }
+                unsigned char buf[8192];
+                size_t size = fread(buf, 1, sizeof(buf), file);
+                boolean_t complete = feof(file);
+                fclose(file);
+                Action_Type action;
+                Event_T e = complete ? _queue_decode(buf, size, &action, file_name) : NULL;
+                if (e) {
+                        /* The handler counters are updated by the first queue processing pass (Run.handler_init) */
+                        if (! _queue_append(journal, e, action))
+                                LogError("Aborting queued event %s - unable to save event information\n", file_name);
+                        FREE(e->message);
+                        Intern_release(&e->source);
+                        FREE(e);
+                } else if (! complete) {
+                        LogError("Aborting queued event %s - invalid size\n", file_name);
+                }
                 if (unlink(file_name) < 0)
-                        LogError("Failed to remove event file '%s' -- %s\n", file_name, STRERROR);
-        } else {
-                if (! Run.handler_init && E->flag & Handler_Alert)
-                        Run.handler_queue[Handler_Alert]++;
-                if (! Run.handler_init && E->flag & Handler_Mmonit)
-                        Run.handler_queue[Handler_Mmonit]++;
+                        LogError("Failed to remove queued event file '%s' -- %s\n", file_name, STRERROR);
+        }
+        FREE(list);
+        Journal_sync(journal);
+}
+
+
+/*
+ * Returns the event queue journal, it is opened on first use and reopened if the queue directory changed. Called with the queue lock held
+ */
+static Journal_T _queue_open() {
+        if (queue && ! IS(Journal_getDirectory(queue), Run.eventlist_dir))
+                Journal_close(&queue);
+        if (! queue) {
+                if (! file_checkQueueDirectory(Run.eventlist_dir)) {
+                        LogError("Aborting event - cannot access the directory %s\n", Run.eventlist_dir);
+                        return NULL;
+                }
+                if ((queue = Journal_open(Run.eventlist_dir)))
+                        _queue_migrate(queue);
+        }
+        return queue;
+}
+
+
+/*
+ * Returns true if all handlers failed in this cycle and the further queue processing should be skipped. Alert handler is currently defined anytime (either explicitly or localhost by default)
+ */
+static boolean_t _queue_blocked() {
+        return (Run.mmonits && FLAG(Run.handler_flag, Handler_Mmonit) && FLAG(Run.handler_flag, Handler_Alert)) || FLAG(Run.handler_flag, Handler_Alert);
+}
+
+
+/*
+ * Retry all remaining handlers of the queued events, the events are given in the order of arrival. The M/Monit messages
+ * of the events are sent as one batch (see handle_mmonit_replay()). The flag of each event is set to the handlers which
+ * still failed. The a and ea arrays hold the actions of the events, count entries each
+ */
+static void _queue_deliver(Event_T *events, Action_Type *actions, int count, Action_T a, EventAction_T ea) {
+        int pending = 0;
+        Event_T *mmonit = CALLOC(count, sizeof(Event_T));
+        for (int i = 0; i < count; i++) {
+                Event_T e = events[i];
+                LogInfo("Processing queued event for %s\n", e->source);
+                a[i].id = actions[i];
+                ea[i].succeeded = ea[i].failed = NULL;
+                if (e->state == State_Succeeded || e->state == State_ChangedNot)
+                        ea[i].succeeded = &a[i];
+                else
+                        ea[i].failed = &a[i];
+                e->action = &ea[i];
+
+                /* alert */
+                if (e->flag & Handler_Alert) {
+                        if ((Run.handler_flag & Handler_Alert) != Handler_Alert) {
+                                if ( handle_alert(e) != Handler_Alert ) {
+                                        e->flag &= ~Handler_Alert;
+                                        Run.handler_queue[Handler_Alert]--;
+                                } else {
+                                        LogError("Alert handler failed, retry scheduled for next cycle\n");
+                                        Run.handler_flag |= Handler_Alert;
+                                }
+                        }
+                }
+
+                /* mmonit */
+                if (e->flag & Handler_Mmonit)
+                        mmonit[pending++] = e;
+        }
+        if (pending && (Run.handler_flag & Handler_Mmonit) != Handler_Mmonit) {
+                boolean_t failed = false;
+                boolean_t *sent = CALLOC(pending, sizeof(boolean_t));
+                handle_mmonit_replay(mmonit, pending, sent);
+                for (int i = 0; i < pending; i++) {
+                        if (sent[i]) {
+                                mmonit[i]->flag &= ~Handler_Mmonit;
+                                Run.handler_queue[Handler_Mmonit]--;
+                        } else {
+                                failed = true;
+                        }
+                }
+                if (failed) {
+                        LogError("M/Monit handler failed, retry scheduled for next cycle\n");
+                        Run.handler_flag |= Handler_Mmonit;
+                }
+                FREE(sent);
+        }
+        FREE(mmonit);
+}
+
+
+static void _buffer_free(Buffered_T *b) {
+        FREE(b->event->message);
+        Intern_release(&b->event->source);
+        FREE(b->event);
+}
+
+
+/*
+ * Move all buffered events to the journal with one sync
+ */
+static void _buffer_flush(Journal_T journal) {
+        DEBUG("Moving %d buffered event(s) to the event queue journal\n", buffer.count);
+        for (int i = 0; i < buffer.count; i++) {
+                if (! _queue_append(journal, buffer.event[i].event, buffer.event[i].action))
+                        LogError("Aborting queued event for %s - unable to save event information\n", buffer.event[i].event->source);
+                _buffer_free(&buffer.event[i]);
+        }
+        buffer.count = 0;
+        Journal_sync(journal);
+}
+
+
+/*
+ * Update the handlers queue counters for the event added to (+1) or removed from (-1) the queue
+ */
+static void _queue_count(Event_T E, int delta) {
+        if (! Run.handler_init && E->flag & Handler_Alert)
+                Run.handler_queue[Handler_Alert] += delta;
+        if (! Run.handler_init && E->flag & Handler_Mmonit)
+                Run.handler_queue[Handler_Mmonit] += delta;
+}
+
+
+static Buffered_T _buffer_copy(Event_T E, Action_Type action) {
+        Buffered_T b = {.action = action};
+        NEW(b.event);
+        *b.event = *E;
+        b.event->source = Intern_copy(E->source);
+        b.event->message = E->message ? Str_dup(E->message) : NULL;
+        b.event->state_map = NULL;
+        b.event->action = NULL;
+        b.event->next = NULL;
+        return b;
+}
+
+
+/*
+ * Coalescing: replace the buffered event with the same source, id, state and action. The sources are interned, so they are compared by the address. A recovery doesn't replace the pending failure, both are delivered. Returns false if no such event is pending
+ */
+static boolean_t _buffer_replace(Event_T E, Action_Type action) {
+        for (int i = 0; i < buffer.count; i++) {
+                Event_T e = buffer.event[i].event;
+                if (e->id == E->id && e->state == E->state && buffer.event[i].action == action && e->source == E->source) {
+                        DEBUG("Replacing the queued event for %s\n", E->source);
+                        _queue_count(e, -1);
+                        _buffer_free(&buffer.event[i]);
+                        buffer.event[i] = _buffer_copy(E, action);
+                        _queue_count(E, 1);
+                        return true;
+                }
         }
+        return false;
+}
 
-        return;
+
+/*
+ * Keep the event in the memory buffer, the buffer is moved to the journal when full
+ */
+static void _buffer_add(Journal_T journal, Event_T E, Action_Type action) {
+        if (buffer.count >= Run.eventlist_buffer)
+                _buffer_flush(journal);
+        if (buffer.count >= buffer.size) {
+                buffer.size = Run.eventlist_buffer;
+                RESIZE(buffer.event, buffer.size * sizeof(Buffered_T));
+        }
+        buffer.event[buffer.count++] = _buffer_copy(E, action);
+        _queue_count(E, 1);
 }
 
 
 /**
- * Update the partialy handled event in the global queue
+ * Add the partialy handled event to the global queue
  * @param E An event object
- * @param file_name File name
  */
-static void Event_queue_update(Event_T E, const char *file_name) {
-        int version = EVENT_VERSION;
-        Action_Type action = Event_get_action(E);
-        boolean_t rv;
-
+static void Event_queue_add(Event_T E) {
         ASSERT(E);
         ASSERT(E->flag != Handler_Succeeded);
 
-        if (! file_checkQueueDirectory(Run.eventlist_dir)) {
-                LogError("Aborting event - cannot access the directory %s\n", Run.eventlist_dir);
+        Journal_T journal = _queue_open();
+        if (! journal)
+                return;
+
+        Action_Type action = Event_get_action(E);
+        if (Run.eventlist_buffer > 0 && _buffer_replace(E, action))
+                return;
+
+        if (Run.eventlist_slots >= 0 && Journal_count(journal) + buffer.count >= Run.eventlist_slots) {
+                LogError("Event queue is full\n");
+                LogError("Aborting event - queue over quota\n");
+                return;
+        }
+
+        if (Run.eventlist_buffer > 0) {
+                _buffer_add(journal, E, action);
                 return;
         }
 
-        DEBUG("Updating event in the queue file %s for later delivery\n", file_name);
+        LogInfo("Adding event to the queue for later delivery\n");
 
-        FILE *file = fopen(file_name, "w");
-        if (! file) {
-                LogError("Aborting event - cannot open the event file %s -- %s\n", file_name, STRERROR);
+        if (! _queue_append(journal, E, action)) {
+                LogError("Aborting event - unable to save event information to %s\n", Run.eventlist_dir);
                 return;
         }
+        _queue_count(E, 1);
+}
 
-        /* write event structure version */
-        if (! (rv = file_writeQueue(file, &version, sizeof(int))))
-                goto error;
 
-        /* write event structure */
-        if (! (rv = file_writeQueue(file, E, sizeof(*E))))
-                goto error;
+/*
+ * Move the undelivered event to the event queue, its flag holds the failed handlers
+ */
+static void _delivery_fail(Event_T E) {
+        if (Run.eventlist_dir) {
+                pthread_once(&event_once, _initMutex);
+                LOCK(queue_mutex)
+                {
+                        Event_queue_add(E);
+                }
+                END_LOCK;
+        } else {
+                LogError("Aborting event\n");
+        }
+}
 
-        /* write source */
-        if (! (rv = file_writeQueue(file, E->source, E->source ? strlen(E->source) + 1 : 0)))
-                goto error;
 
-        /* write message */
-        if (! (rv = file_writeQueue(file, E->message, E->message ? strlen(E->message) + 1 : 0)))
-                goto error;
+static void _delivery_free(Delivery_T *d) {
+        FREE((*d)->event->message);
+        Intern_release(&(*d)->event->source);
+        FREE((*d)->event);
+        FREE(*d);
+}
 
-        /* write event action */
-        if (! (rv = file_writeQueue(file, &action, sizeof(Action_Type))))
-                goto error;
 
-error:
-        fclose(file);
-        if (! rv) {
-                LogError("Aborting event - unable to update event information to %s\n", file_name);
-                if (unlink(file_name) < 0)
-                        LogError("Failed to remove event file '%s' -- %s\n", file_name, STRERROR);
+/*
+ * Queue a copy of the event for the delivery thread. Returns false if the thread doesn't run and the event should be delivered directly
+ */
+static boolean_t _delivery_add(Event_T E, Action_T A) {
+        if (! delivery.running)
+                return false;
+        /* Skip the events without any recipient, like the handlers would do */
+        Handler_Type flag = Handler_Succeeded;
+        if (Run.mmonits && E->state_changed)
+                flag |= Handler_Mmonit;
+        if (Run.maillist) {
+                flag |= Handler_Alert;
+        } else {
+                Service_T s = Util_getService(E->source);
+                if (! s)
+                        s = Instance_get(E->source);
+                if (s && s->maillist)
+                        flag |= Handler_Alert;
+        }
+        if (flag == Handler_Succeeded)
+                return true;
+        Delivery_T d;
+        NEW(d);
+        d->event = _buffer_copy(E, A->id).event;
+        d->event->flag = flag;
+        d->action.id = A->id;
+        d->eventaction.failed = d->eventaction.succeeded = &d->action;
+        d->event->action = &d->eventaction;
+        d->queued = Latency_now();
+        boolean_t full = false;
+        LOCK(delivery.mutex)
+        {
+                if (Run.latency.deliveries >= DELIVERY_QUEUE) {
+                        full = true;
+                } else {
+                        if (delivery.pending_tail)
+                                delivery.pending_tail->next = d;
+                        else
+                                delivery.pending = d;
+                        delivery.pending_tail = d;
+                        if (++Run.latency.deliveries > Run.latency.deliveries_peak)
+                                Run.latency.deliveries_peak = Run.latency.deliveries;
+                        Sem_signal(delivery.wakeup);
+                }
+        }
+        END_LOCK;
+        if (full) {
+                LogError("Event delivery queue is full\n");
+                _delivery_fail(d->event);
+                _delivery_free(&d);
         }
+        return true;
+}
+
 
-        return;
+/*
+ * Try the handlers which didn't succeed yet. Returns true if the event was delivered
+ */
+static boolean_t _deliver(Delivery_T d) {
+        Event_T E = d->event;
+        if (E->flag & Handler_Mmonit && handle_mmonit(E) != Handler_Mmonit)
+                E->flag &= ~Handler_Mmonit;
+        if (E->flag & Handler_Alert && handle_alert(E) != Handler_Alert)
+                E->flag &= ~Handler_Alert;
+        return E->flag == Handler_Succeeded;
 }
 
+
+/*
+ * The delivery thread: send the new events first, retry the failed ones
+ * when due. When stopped, the pending events are tried once and the failed
+ * ones are moved to the event queue
+ */
+static void *_deliverer(void *args) {
+        LogInfo("Event delivery started\n");
+        LOCK(delivery.mutex)
+        {
+                while (true) {
+                        Delivery_T d = NULL;
+                        unsigned long long now = Latency_now();
+                        if (delivery.pending) {
+                                d = delivery.pending;
+                                if (! (delivery.pending = d->next))
+                                        delivery.pending_tail = NULL;
+                        } else if (delivery.retry && (! delivery.running || delivery.retry->due <= now)) {
+                                d = delivery.retry;
+                                if (! (delivery.retry = d->next))
+                                        delivery.retry_tail = NULL;
+                        } else if (! delivery.running) {
+                                break;
+                        } else if (delivery.retry) {
+                                struct timeval tv;
+                                gettimeofday(&tv, NULL);
+                                long long wakeup = (long long)tv.tv_sec * 1000000LL + tv.tv_usec + (long long)(delivery.retry->due - now);
+                                struct timespec wait = {.tv_sec = wakeup / 1000000LL, .tv_nsec = (wakeup % 1000000LL) * 1000LL};
+                                Sem_timeWait(delivery.wakeup, delivery.mutex, wait);
+                                continue;
+                        } else {
+                                Sem_wait(delivery.wakeup, delivery.mutex);
+                                continue;
+                        }
+                        d->next = NULL;
+                        boolean_t running = delivery.running;
+                        Mutex_unlock(delivery.mutex);
+                        unsigned long long cpu = Latency_cpu();
+                        boolean_t delivered = (d->due && ! running) ? false : _deliver(d);
+                        Latency_cost(Cost_Event, cpu);
+                        if (! delivered && running && ++d->attempts < DELIVERY_ATTEMPTS) {
+                                DEBUG("Event delivery for %s failed, retry in %ds\n", d->event->source, DELIVERY_RETRY);
+                                d->due = Latency_now() + DELIVERY_RETRY * 1000000ULL;
+                        } else {
+                                if (! delivered)
+                                        _delivery_fail(d->event);
+                                Latency_record(&Run.latency.delivery, d->queued);
+                                _delivery_free(&d);
+                        }
+                        Mutex_lock(delivery.mutex);
+                        if (d) {
+                                if (delivery.retry_tail)
+                                        delivery.retry_tail->next = d;
+                                else
+                                        delivery.retry = d;
+                                delivery.retry_tail = d;
+                        } else {
+                                Run.latency.deliveries--;
+                        }
+                }
+        }
+        END_LOCK;
+#ifdef HAVE_OPENSSL
+        Ssl_threadCleanup();
+#endif
+        LogInfo("Event delivery stopped\n");
+        return NULL;
+}
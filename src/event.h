@@ -115,7 +115,7 @@ Service_T Event_get_source(Event_T E);
  * @param E An event object
  * @return The Service name where the event orginated
  */
-char *Event_get_source_name(Event_T E);
+const char *Event_get_source_name(Event_T E);
 
 
 /**
@@ -202,10 +202,61 @@ Action_Type Event_get_action(Event_T E);
 const char *Event_get_action_description(Event_T E);
 
 
+/**
+ * Get a copy of the event which doesn't refer to the configuration, so it
+ * can outlive the event and the reload
+ * @param E An event object
+ * @return The event copy, free it using Event_copy_free()
+ */
+Event_T Event_copy(Event_T E);
+
+
+/**
+ * Free the event copy
+ * @param E The event copy returned by Event_copy()
+ */
+void Event_copy_free(Event_T *E);
+
+
 /**
  * Reprocess the partialy handled event queue
  */
 void Event_queue_process();
 
 
+/**
+ * Flush the events queued in this cycle to disk
+ */
+void Event_queue_sync();
+
+
+/**
+ * Get the events waiting in the event queue, both in the memory buffer
+ * and in the journal
+ * @param count Set to the number of the queued events
+ * @param size Set to the disk space used by the journal in bytes
+ */
+void Event_queue_usage(int *count, unsigned long long *size);
+
+
+/**
+ * Close the event queue, it is reopened on demand
+ */
+void Event_queue_close();
+
+
+/**
+ * Start the delivery thread, which sends the alert and M/Monit
+ * notifications of the posted events
+ */
+void Event_delivery_start();
+
+
+/**
+ * Stop the delivery thread, the undelivered events are moved to the
+ * event queue
+ */
+void Event_delivery_stop();
+
+
 #endif
@@ -64,8 +64,13 @@
 #include <dirent.h>
 #endif
 
+#ifdef HAVE_GLOB_H
+#include <glob.h>
+#endif
+
 #include "monit.h"
 #include "engine.h"
+#include "md5.h"
 
 // libmonit
 #include "io/File.h"
@@ -77,6 +82,59 @@
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+/* The files read by the control file parser in the last parse */
+typedef struct mycontrolfile {
+        char *path;                         /**< The file path or include pattern */
+        boolean_t pattern;               /**< true if path is an include pattern */
+        off_t size;                                            /**< The file size */
+        MD_T digest;       /**< MD5 of the file content or of the pattern matches */
+        struct mycontrolfile *next;
+} *ControlFile_T;
+
+
+static ControlFile_T controlfiles = NULL;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/*
+ * Compute the MD5 of the include pattern matches, the list of files
+ * changes if some file was added or removed
+ */
+static void _digestPattern(const char *pattern, MD_T digest) {
+        md5_context_t ctx;
+        unsigned char md5[16];
+        md5_init(&ctx);
+#ifdef HAVE_GLOB_H
+        glob_t globbuf;
+        if (glob(pattern, GLOB_MARK, NULL, &globbuf) == 0) {
+                for (int i = 0; i < globbuf.gl_pathc; i++)
+                        md5_append(&ctx, (const md5_byte_t *)globbuf.gl_pathv[i], (int)strlen(globbuf.gl_pathv[i]) + 1);
+                globfree(&globbuf);
+        }
+#endif
+        md5_finish(&ctx, md5);
+        Util_digest2Bytes(md5, 16, digest);
+}
+
+
+/*
+ * Compute the MD5 of the file content
+ * @return false if the file cannot be read
+ */
+static boolean_t _digestFile(const char *path, off_t *size, MD_T digest) {
+        struct stat buf;
+        if (stat(path, &buf) < 0)
+                return false;
+        *size = buf.st_size;
+        return Util_getChecksum((char *)path, Hash_Md5, digest, sizeof(MD_T));
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
@@ -170,6 +228,52 @@ char *file_findControlFile() {
 }
 
 
+void file_addControlFile(const char *path, boolean_t pattern) {
+        ASSERT(path);
+        ControlFile_T f;
+        NEW(f);
+        f->path = Str_dup(path);
+        f->pattern = pattern;
+        if (pattern)
+                _digestPattern(path, f->digest);
+        else if (! _digestFile(path, &f->size, f->digest))
+                *f->digest = 0;
+        f->next = controlfiles;
+        controlfiles = f;
+}
+
+
+void file_resetControlFiles() {
+        while (controlfiles) {
+                ControlFile_T f = controlfiles;
+                controlfiles = f->next;
+                FREE(f->path);
+                FREE(f);
+        }
+}
+
+
+boolean_t file_isControlFileChanged() {
+        if (! controlfiles)
+                return true;
+        for (ControlFile_T f = controlfiles; f; f = f->next) {
+                MD_T digest;
+                if (f->pattern) {
+                        _digestPattern(f->path, digest);
+                } else {
+                        off_t size;
+                        if (! *f->digest || ! _digestFile(f->path, &size, digest) || size != f->size)
+                                return true;
+                }
+                if (! IS(digest, f->digest)) {
+                        DEBUG("Control file '%s' changed\n", f->path);
+                        return true;
+                }
+        }
+        return false;
+}
+
+
 boolean_t file_createPidFile(char *pidfile) {
         ASSERT(pidfile);
 
@@ -266,87 +370,3 @@ boolean_t file_checkQueueDirectory(char *path) {
         return true;
 }
 
-
-boolean_t file_checkQueueLimit(char *path, int limit) {
-        if (limit < 0)
-                return true;
-        DIR *dir = opendir(path);
-        if (! dir) {
-                LogError("Cannot open the event queue directory %s -- %s\n", path, STRERROR);
-                return false;
-        }
-        int used = 0;
-        struct dirent *de = NULL;
-        while ((de = readdir(dir)) ) {
-                char buf[PATH_MAX];
-                snprintf(buf, sizeof(buf), "%s/%s", path, de->d_name);
-                if (File_isFile(buf) && ++used > limit) {
-                        LogError("Event queue is full\n");
-                        closedir(dir);
-                        return false;
-                }
-        }
-        closedir(dir);
-        return true;
-}
-
-
-boolean_t file_writeQueue(FILE *file, void *data, size_t size) {
-        size_t rv;
-
-        ASSERT(file);
-
-        /* write size */
-        if ((rv = fwrite(&size, 1, sizeof(size_t), file)) != sizeof(size_t)) {
-                if (feof(file) || ferror(file))
-                        LogError("Queued event file: unable to write event size -- %s\n", feof(file) ? "end of file" : "stream error");
-                else
-                        LogError("Queued event file: unable to write event size -- read returned %lu bytes\n", (unsigned long)rv);
-                return false;
-        }
-
-        /* write data if any */
-        if (size > 0) {
-                if ((rv = fwrite(data, 1, size, file)) != size) {
-                        if (feof(file) || ferror(file))
-                                LogError("Queued event file: unable to write event size -- %s\n", feof(file) ? "end of file" : "stream error");
-                        else
-                                LogError("Queued event file: unable to write event size -- read returned %lu bytes\n", (unsigned long)rv);
-                        return false;
-                }
-        }
-
-        return true;
-}
-
-
-void *file_readQueue(FILE *file, size_t *size) {
-        size_t rv;
-        void *data = NULL;
-
-        ASSERT(file);
-
-        /* read size */
-        if ((rv = fread(size, 1, sizeof(size_t), file)) != sizeof(size_t)) {
-                if (feof(file) || ferror(file))
-                        LogError("Queued event file: unable to read event size -- %s\n", feof(file) ? "end of file" : "stream error");
-                else
-                        LogError("Queued event file: unable to read event size -- read returned %lu bytes\n", (unsigned long)rv);
-                return NULL;
-        }
-
-        /* read data if any (allow 1MB at maximum to prevent enormous memory allocation) */
-        if (*size > 0 && *size < 1048576) {
-                data = CALLOC(1, *size);
-                if ((rv = fread(data, 1, *size, file)) != *size) {
-                        FREE(data);
-                        if (feof(file) || ferror(file))
-                                LogError("Queued event file: unable to read event data -- %s\n", feof(file) ? "end of file" : "stream error");
-                        else
-                                LogError("Queued event file: unable to read event data -- read returned %lu bytes\n", (unsigned long)rv);
-                        return NULL;
-                }
-        }
-        return data;
-}
-
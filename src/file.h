@@ -66,6 +66,30 @@ time_t file_getTimestamp(char *object, mode_t type);
 char *file_findControlFile();
 
 
+/**
+ * Remember the file read by the control file parser, so the reload can
+ * skip parsing the configuration if none of the files changed
+ * @param path The file path or include pattern
+ * @param pattern true if path is an include pattern, the matched files
+ * list is remembered then
+ */
+void file_addControlFile(const char *path, boolean_t pattern);
+
+
+/**
+ * Forget the files read by the control file parser
+ */
+void file_resetControlFiles();
+
+
+/**
+ * Check whether some file read by the last parse of the control file was
+ * modified, or some file matching an include pattern was added or removed
+ * @return true if the configuration has to be parsed again, otherwise false
+ */
+boolean_t file_isControlFileChanged();
+
+
 /**
  * Create a program's pidfile - Such a file is created when in daemon
  * mode.
@@ -97,33 +121,4 @@ boolean_t file_checkStat(char *filename, char *description, int permmask);
 boolean_t file_checkQueueDirectory(char *path);
 
 
-/**
- * Check the queue size limit.
- * @param path The fully qualified path to the directory
- * @param mode The queue limit
- * @return true if the succeeded otherwise false
- */
-boolean_t file_checkQueueLimit(char *path, int limit);
-
-
-/**
- * Write data to the queue file
- * @param file Filedescriptor to write to
- * @param data Data to be written
- * @param size Size of the data to be written
- * @return true if the succeeded otherwise false
- */
-boolean_t file_writeQueue(FILE *file, void *data, size_t size);
-
-
-/**
- * Read the data from the queue file's actual position
- * @param file Filedescriptor to read from
- * @param size Size of the data read
- * @return The data read if any or NULL. The size parameter is set
- * appropriately.
- */
-void *file_readQueue(FILE *file, size_t *size);
-
-
 #endif
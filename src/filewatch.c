@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+#include <signal.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_SYS_VFS_H
+#include <sys/vfs.h>
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "monit.h"
+#include "filewatch.h"
+
+/**
+ *  File events watcher - Linux inotify client.
+ *
+ *  @file
+ */
+
+
+#if defined LINUX && defined HAVE_SYS_INOTIFY_H && defined HAVE_SYS_VFS_H
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define FILEWATCH_POLL 1000 // ms, interval to check the stop request
+
+#define FILEWATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+#define FILEWATCH_DIRECTORY_EVENTS (FILEWATCH_EVENTS | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+#define FILEWATCH_WAKEUP_EVENTS (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)
+
+
+static int fd = -1;
+static Thread_T thread;
+static pthread_t mainThread;
+static volatile boolean_t running = false;
+static boolean_t active = false; // The watcher thread is processing the events
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Returns true if inotify reports all changes of the given path. The
+ * changes made on other hosts of network filesystems and the changes of
+ * pseudo filesystems are not reported.
+ */
+static boolean_t _isWatchable(const char *path) {
+        struct stat sb;
+        if (lstat(path, &sb) != 0 || S_ISLNK(sb.st_mode))
+                return false;
+        struct statfs fs;
+        if (statfs(path, &fs) != 0)
+                return false;
+        switch ((unsigned long)fs.f_type) {
+                case 0x6969:     // NFS
+                case 0x517b:     // SMB
+                case 0xfe534d42: // SMB2
+                case 0xff534d42: // CIFS
+                case 0x65735546: // FUSE
+                case 0x00c36400: // CEPH
+                case 0x01021997: // 9P
+                case 0x5346414f: // AFS
+                case 0x01161970: // GFS2
+                case 0x7461636f: // OCFS2
+                case 0x9fa0:     // PROC
+                case 0x62656572: // SYSFS
+                        return false;
+                default:
+                        return true;
+        }
+}
+
+
+/**
+ * Register the watch for the given service. The wildcard path of the file
+ * instances template is watched through its directory, which reports the
+ * new files as well as the changes of the matching files. The wildcards
+ * in the directory part cannot be watched. Must be called with the mutex
+ * locked
+ */
+static void _addWatch(Service_T s) {
+        char path[PATH_MAX];
+        uint32_t events = s->type == Service_Directory ? FILEWATCH_DIRECTORY_EVENTS : FILEWATCH_EVENTS;
+        snprintf(path, sizeof(path), "%s", s->path);
+        if (s->instance.max) {
+                char *slash = strrchr(path, '/');
+                if (! slash || slash == path)
+                        return;
+                *slash = 0;
+                if (strpbrk(path, "*?["))
+                        return;
+                events = FILEWATCH_DIRECTORY_EVENTS;
+        }
+        if (_isWatchable(path)) {
+                int wd = inotify_add_watch(fd, path, events);
+                if (wd < 0) {
+                        DEBUG("'%s' file events -- cannot watch %s -- %s\n", s->name, path, STRERROR);
+                        return;
+                }
+                s->watch = wd;
+                // The check after registering the watch must be complete
+                s->watch_changed = true;
+        }
+}
+
+
+static void _handle(struct inotify_event *event) {
+        boolean_t wakeup = false;
+        LOCK(mutex)
+        {
+                if (event->mask & IN_Q_OVERFLOW) {
+                        /* Events were lost, we cannot tell which paths changed => check all */
+                        DEBUG("File events -- events queue overflow\n");
+                        for (Service_T s = servicelist; s; s = s->next)
+                                if (s->watch)
+                                        s->watch_changed = true;
+                        wakeup = true;
+                } else {
+                        for (Service_T s = servicelist; s; s = s->next) {
+                                if (s->watch == event->wd) {
+                                        s->watch_changed = true;
+                                        if (event->mask & IN_IGNORED)
+                                                s->watch = 0; // The kernel removed the watch (path deleted or unmounted)
+                                        if (event->mask & FILEWATCH_WAKEUP_EVENTS) {
+                                                DEBUG("'%s' %s changed -- waking up\n", s->name, s->path);
+                                                wakeup = true;
+                                        }
+                                }
+                        }
+                }
+        }
+        END_LOCK;
+        if (wakeup)
+                pthread_kill(mainThread, SIGUSR1);
+}
+
+
+static void *_watcher(void *args) {
+        char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+        while (running && ! Run.stopped) {
+                struct pollfd fds = {.fd = fd, .events = POLLIN};
+                int rv = poll(&fds, 1, FILEWATCH_POLL);
+                if (rv < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        LogError("File events -- poll failed -- %s\n", STRERROR);
+                        break;
+                } else if (rv == 0) {
+                        continue;
+                }
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if (n < 0) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                continue;
+                        LogError("File events -- read failed -- %s\n", STRERROR);
+                        break;
+                }
+                for (char *p = buf; p < buf + n; ) {
+                        struct inotify_event *event = (struct inotify_event *)p;
+                        _handle(event);
+                        p += sizeof(struct inotify_event) + event->len;
+                }
+        }
+        // The watcher stopped: no path can be trusted as unchanged anymore
+        LOCK(mutex)
+        {
+                active = false;
+        }
+        END_LOCK;
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+boolean_t FileWatch_start() {
+        if (running)
+                return true;
+        if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+                LogError("File events -- cannot initialize inotify -- %s\n", STRERROR);
+                return false;
+        }
+        int count = 0;
+        LOCK(mutex)
+        {
+                for (Service_T s = servicelist; s; s = s->next) {
+                        s->watch = 0;
+                        if (s->type == Service_File || s->type == Service_Directory || s->type == Service_Fifo) {
+                                _addWatch(s);
+                                if (s->watch)
+                                        count++;
+                        }
+                }
+        }
+        END_LOCK;
+        mainThread = pthread_self();
+        running = active = true;
+        Thread_create(thread, _watcher, NULL);
+        LogInfo("File events watcher started -- watching %d path%s\n", count, count == 1 ? "" : "s");
+        return true;
+}
+
+
+void FileWatch_stop() {
+        if (! running)
+                return;
+        running = false;
+        Thread_join(thread);
+        close(fd); // Removes the watches as well
+        fd = -1;
+        LogInfo("File events watcher stopped\n");
+}
+
+
+boolean_t FileWatch_isUnchanged(Service_T s) {
+        boolean_t unchanged = false;
+        LOCK(mutex)
+        {
+                if (active) {
+                        if (! s->watch)
+                                _addWatch(s);
+                        if (s->watch) {
+                                unchanged = ! s->watch_changed;
+                                s->watch_changed = false;
+                        }
+                }
+        }
+        END_LOCK;
+        return unchanged;
+}
+
+
+#else
+
+
+boolean_t FileWatch_start() {
+        LogError("File events are not supported on this platform\n");
+        return false;
+}
+
+
+void FileWatch_stop() {
+}
+
+
+boolean_t FileWatch_isUnchanged(Service_T s) {
+        return false;
+}
+
+
+#endif
+
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#ifndef MONIT_FILEWATCH_H
+#define MONIT_FILEWATCH_H
+
+
+/**
+ * File events watcher.
+ *
+ * On Linux, Monit can register inotify watches for the file, directory
+ * and fifo services. The watcher thread marks a service as changed when
+ * the kernel reports a modification, attribute change, move or delete of
+ * the watched path, so the check of an unchanged path can skip the stat,
+ * checksum and content match work. If the path is deleted, moved or its
+ * attributes change, the watcher wakes up the Monit daemon, so the check
+ * runs right away instead of at the next poll cycle. Paths which cannot
+ * be watched reliably (symbolic links, network and pseudo filesystems)
+ * are checked every cycle as usual. The watcher is enabled using the
+ * "set file events" statement, on other platforms it is not available.
+ *
+ *  @file
+ */
+
+
+/**
+ * Start the file events watcher thread. Must be called from the main
+ * thread as the watcher wakes it up using the SIGUSR1 signal
+ * @return true if succeeded, otherwise false
+ */
+boolean_t FileWatch_start();
+
+
+/**
+ * Stop the file events watcher thread
+ */
+void FileWatch_stop();
+
+
+/**
+ * Check if the path of the given service is watched and no change was
+ * reported since the last check. The change flag is cleared, so the
+ * caller must perform the full check if false is returned. If the path
+ * is not watched yet (e.g. it did not exist), a new watch is registered.
+ * @param s A file, directory or fifo service
+ * @return true if the path did not change since the last check,
+ * otherwise false
+ */
+boolean_t FileWatch_isUnchanged(Service_T s);
+
+
+#endif
@@ -36,6 +36,14 @@
 #include "protocol.h"
 #include "process.h"
 #include "engine.h"
+#include "history.h"
+#include "latency.h"
+#include "merkle.h"
+#include "sampler.h"
+#include "plugin.h"
+#include "instance.h"
+#include "intern.h"
+#include "procwatch.h"
 
 
 /* Private prototypes */
@@ -45,32 +53,11 @@ static void _gc_servicegroup(ServiceGroup_T *);
 static void _gc_servicegroup_member(ServiceGroupMember_T *);
 static void _gc_mail_server(MailServer_T *);
 static void _gcppl(Port_T *);
-static void _gcfilesystem(Filesystem_T *);
-static void _gcicmp(Icmp_T *);
-static void _gcpql(Resource_T *);
-static void _gcptl(Timestamp_T *);
-static void _gcparl(ActionRate_T *);
-static void _gc_action(Action_T *);
-static void _gc_eventaction(EventAction_T *);
-static void _gcpdl(Dependant_T *);
-static void _gcso(Size_T *);
-static void _gclinkstatus(LinkStatus_T *);
-static void _gclinkspeed(LinkSpeed_T *);
-static void _gclinksaturation(LinkSaturation_T *);
-static void _gcbandwidth(Bandwidth_T *);
 static void _gcmatch(Match_T *);
-static void _gcchecksum(Checksum_T *);
-static void _gcperm(Perm_T *);
-static void _gcstatus(Status_T *);
-static void _gcuid(Uid_T *);
-static void _gcgid(Gid_T *);
-static void _gcpid(Pid_T *);
-static void _gcppid(Pid_T *);
-static void _gcfsflag(Fsflag_T *);
-static void _gcnonexist(Nonexist_T *);
 static void _gcgrc(Generic_T *);
 static void _gcath(Auth_T *);
 static void _gc_mmonit(Mmonit_T *);
+static void _gc_peer(Peer_T *);
 static void _gc_url(URL_T *);
 static void _gc_request(Request_T *);
 
@@ -91,8 +78,12 @@ void gc() {
                 delprocesstree(&oldptree, &oldptreesize);
                 delprocesstree(&ptree, &ptreesize);
         }
+        Util_resetServiceIndex();
+        /* The process events watcher reads the service list without a lock, it must be stopped first */
+        ASSERT(! ProcWatch_isRunning());
         if (servicelist)
                 _gc_service_list(&servicelist);
+        FREE(Run.infotable);
         if (servicegrouplist)
                 _gc_servicegroup(&servicegrouplist);
         if (Run.httpd.credentials)
@@ -103,15 +94,20 @@ void gc() {
                 _gc_mail_server(&Run.mailservers);
         if (Run.mmonits)
                 _gc_mmonit(&Run.mmonits);
+        if (Run.cluster.peers)
+                _gc_peer(&Run.cluster.peers);
         if (Run.eventlist)
                 gc_event(&Run.eventlist);
         FREE(Run.eventlist_dir);
+        FREE(Run.historyfile);
+        FREE(Run.statusfile);
         FREE(Run.mygroup);
         if (Run.httpd.flags & Httpd_Net) {
                 FREE(Run.httpd.socket.net.address);
                 FREE(Run.httpd.socket.net.ssl.pem);
                 FREE(Run.httpd.socket.net.ssl.clientpem);
-        } else if (Run.httpd.flags & Httpd_Unix) {
+        }
+        if (Run.httpd.flags & Httpd_Unix) {
                 FREE(Run.httpd.socket.unix.path);
         }
         FREE(Run.MailFormat.from);
@@ -121,6 +117,28 @@ void gc() {
 }
 
 
+void gc_service_list(Service_T *s) {
+        ASSERT(s);
+        ASSERT(! ProcWatch_isRunning());
+        if (*s)
+                _gc_service_list(s);
+}
+
+
+void gc_template(Template_T *t) {
+        ASSERT(t && *t);
+        if (--(*t)->references == 0) {
+                Service_T s = (*t)->rules;
+                // The holder keeps the arena allocated process rules only
+                Arena_free(&s->arena);
+                FREE(s);
+                FREE((*t)->name);
+                FREE(*t);
+        }
+        *t = NULL;
+}
+
+
 void gc_mail_list(Mail_T *m) {
         ASSERT(m);
         if ((*m)->next)
@@ -147,8 +165,9 @@ void gc_event(Event_T *e) {
         if ((*e)->next)
                 gc_event(&(*e)->next);
         (*e)->action = NULL;
-        FREE((*e)->source);
+        Intern_release(&(*e)->source);
         FREE((*e)->message);
+        FREE((*e)->state_map);
         FREE(*e);
 }
 
@@ -167,10 +186,14 @@ static void _gc_service_list(Service_T *s) {
 static void _gc_service(Service_T *s) {
         ASSERT(s&&*s);
         if ((*s)->program) {
-                if ((*s)->program->P)
+                if ((*s)->program->P) {
                         Process_free(&(*s)->program->P);
+                        spawn_release();
+                }
                 if ((*s)->program->C)
                         Command_free(&(*s)->program->C);
+                if ((*s)->program->plugin)
+                        Plugin_free(&(*s)->program->plugin);
                 if ((*s)->program->args)
                         gccmd(&(*s)->program->args);
                 StringBuffer_free(&((*s)->program->output));
@@ -180,87 +203,51 @@ static void _gc_service(Service_T *s) {
                 _gcppl(&(*s)->portlist);
         if ((*s)->socketlist)
                 _gcppl(&(*s)->socketlist);
-        if ((*s)->filesystemlist)
-                _gcfilesystem(&(*s)->filesystemlist);
-        if ((*s)->icmplist)
-                _gcicmp(&(*s)->icmplist);
         if ((*s)->maillist)
                 gc_mail_list(&(*s)->maillist);
-        if ((*s)->resourcelist)
-                _gcpql(&(*s)->resourcelist);
-        if ((*s)->timestamplist)
-                _gcptl(&(*s)->timestamplist);
-        if ((*s)->actionratelist)
-                _gcparl(&(*s)->actionratelist);
-        if ((*s)->sizelist)
-                _gcso(&(*s)->sizelist);
-        if ((*s)->linkstatuslist)
-                _gclinkstatus(&(*s)->linkstatuslist);
-        if ((*s)->linkspeedlist)
-                _gclinkspeed(&(*s)->linkspeedlist);
-        if ((*s)->linksaturationlist)
-                _gclinksaturation(&(*s)->linksaturationlist);
-        if ((*s)->uploadbyteslist)
-                _gcbandwidth(&(*s)->uploadbyteslist);
-        if ((*s)->uploadpacketslist)
-                _gcbandwidth(&(*s)->uploadpacketslist);
-        if ((*s)->downloadbyteslist)
-                _gcbandwidth(&(*s)->downloadbyteslist);
-        if ((*s)->downloadpacketslist)
-                _gcbandwidth(&(*s)->downloadpacketslist);
         if ((*s)->matchlist)
                 _gcmatch(&(*s)->matchlist);
         if ((*s)->matchignorelist)
                 _gcmatch(&(*s)->matchignorelist);
-        if ((*s)->checksum)
-                _gcchecksum(&(*s)->checksum);
-        if ((*s)->perm)
-                _gcperm(&(*s)->perm);
-        if ((*s)->statuslist)
-                _gcstatus(&(*s)->statuslist);
         if ((*s)->every.type == Every_Cron || (*s)->every.type == Every_NotInCron)
-                FREE((*s)->every.spec.cron);
-        if ((*s)->uid)
-                _gcuid(&(*s)->uid);
-        if ((*s)->euid)
-                _gcuid(&(*s)->euid);
-        if ((*s)->gid)
-                _gcgid(&(*s)->gid);
-        if ((*s)->pidlist)
-                _gcpid(&(*s)->pidlist);
-        if ((*s)->ppidlist)
-                _gcppid(&(*s)->ppidlist);
-        if ((*s)->fsflaglist)
-                _gcfsflag(&(*s)->fsflaglist);
-        if ((*s)->nonexistlist)
-                _gcnonexist(&(*s)->nonexistlist);
-        if ((*s)->dependantlist)
-                _gcpdl(&(*s)->dependantlist);
+                FREE((*s)->every.spec.cron.spec);
         if ((*s)->start)
                 gccmd(&(*s)->start);
         if ((*s)->stop)
                 gccmd(&(*s)->stop);
-        if ((*s)->action_DATA)
-                _gc_eventaction(&(*s)->action_DATA);
-        if ((*s)->action_EXEC)
-                _gc_eventaction(&(*s)->action_EXEC);
-        if ((*s)->action_INVALID)
-                _gc_eventaction(&(*s)->action_INVALID);
-        if ((*s)->action_MONIT_START)
-                _gc_eventaction(&(*s)->action_MONIT_START);
-        if ((*s)->action_MONIT_STOP)
-                _gc_eventaction(&(*s)->action_MONIT_STOP);
-        if ((*s)->action_MONIT_RELOAD)
-                _gc_eventaction(&(*s)->action_MONIT_RELOAD);
-        if ((*s)->action_ACTION)
-                _gc_eventaction(&(*s)->action_ACTION);
         if ((*s)->eventlist)
                 gc_event(&(*s)->eventlist);
-        if ((*s)->inf) {
-                if ((*s)->type == Service_Net)
-                        Link_free(&((*s)->inf->priv.net.stats));
-                FREE((*s)->inf);
+        FREE((*s)->eventindex.table);
+        if ((*s)->checksum)
+                Merkle_free(&(*s)->checksum->tree);
+        // The rule lists and event actions are allocated from the service arena
+        if ((*s)->arena)
+                Arena_free(&(*s)->arena);
+        // The Info_T object is a slot in Run.infotable
+        if ((*s)->inf && (*s)->type == Service_Net)
+                Link_free(&((*s)->inf->priv.net.stats));
+        // The cgroup path of the cgroup service is the service path
+        FREE((*s)->cgroup);
+        if ((*s)->processes) {
+                for (int i = 0; i < (*s)->processes->top; i++)
+                        FREE((*s)->processes->offender[i].cmdline);
+                FREE((*s)->processes);
         }
+        History_free(&(*s)->history);
+        Latency_free((*s)->latency);
+        Sampler_free(&(*s)->sampler);
+        if ((*s)->instance.max)
+                Instance_free(*s);
+        // The rule lists end with the template rules, which are shared
+        if ((*s)->template)
+                gc_template(&(*s)->template);
+        if ((*s)->instance.excluded) {
+                for (int i = 0; (*s)->instance.excluded[i]; i++)
+                        FREE((*s)->instance.excluded[i]);
+                FREE((*s)->instance.excluded);
+        }
+        if ((*s)->homerow.row)
+                StringBuffer_free(&(*s)->homerow.row);
         FREE((*s)->name);
         FREE((*s)->path);
         (*s)->next = NULL;
@@ -328,28 +315,12 @@ static void _gc_mail_server(MailServer_T *s) {
 }
 
 
-static void _gc_action(Action_T *a) {
-        ASSERT(a&&*a);
-        if ((*a)->exec)
-                gccmd(&(*a)->exec);
-        FREE(*a);
-}
-
-
-static void _gc_eventaction(EventAction_T *e) {
-        ASSERT(e&&*e);
-        _gc_action(&(*e)->failed);
-        _gc_action(&(*e)->succeeded);
-        FREE(*e);
-}
-
-
 static void _gcppl(Port_T *p) {
         ASSERT(p&&*p);
         if ((*p)->next)
                 _gcppl(&(*p)->next);
-        if ((*p)->action)
-                _gc_eventaction(&(*p)->action);
+        if ((*p)->session)
+                Socket_free(&(*p)->session);
         if ((*p)->generic)
                 _gcgrc(&(*p)->generic);
         if ((*p)->url_request)
@@ -361,6 +332,7 @@ static void _gcppl(Port_T *p) {
         FREE((*p)->SSL.clientpemfile);
         FREE((*p)->request_checksum);
         FREE((*p)->request_hostheader);
+        FREE((*p)->batch_error);
         if ((*p)->http_headers) {
                 List_T l = (*p)->http_headers;
                 while (List_length(l) > 0) {
@@ -371,113 +343,13 @@ static void _gcppl(Port_T *p) {
         FREE(*p);
 }
 
-
-static void _gcfilesystem(Filesystem_T *d) {
-        ASSERT(d&&*d);
-        if ((*d)->next)
-                _gcfilesystem(&(*d)->next);
-        if ((*d)->action)
-                _gc_eventaction(&(*d)->action);
-        FREE(*d);
-}
-
-
-static void _gcicmp(Icmp_T *i) {
-        ASSERT(i&&*i);
-        if ((*i)->next)
-                _gcicmp(&(*i)->next);
-        if ((*i)->action)
-                _gc_eventaction(&(*i)->action);
-        FREE(*i);
-}
-
-
-static void _gcpql(Resource_T *q) {
-        ASSERT(q);
-        if ((*q)->next)
-                _gcpql(&(*q)->next);
-        if ((*q)->action)
-                _gc_eventaction(&(*q)->action);
-        FREE(*q);
-}
-
-
-static void _gcptl(Timestamp_T *p) {
-        ASSERT(p);
-        if ((*p)->next)
-                _gcptl(&(*p)->next);
-        if ((*p)->action)
-                _gc_eventaction(&(*p)->action);
-        FREE(*p);
-}
-
-
-static void _gcparl(ActionRate_T *ar) {
-        ASSERT(ar);
-        if ((*ar)->next)
-                _gcparl(&(*ar)->next);
-        if ((*ar)->action)
-                _gc_eventaction(&(*ar)->action);
-        FREE(*ar);
-}
-
-
-static void _gcso(Size_T *s) {
-        ASSERT(s);
-        if ((*s)->next)
-                _gcso(&(*s)->next);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-static void _gclinkstatus(LinkStatus_T *l) {
-        ASSERT(l);
-        if ((*l)->next)
-                _gclinkstatus(&(*l)->next);
-        if ((*l)->action)
-                _gc_eventaction(&(*l)->action);
-        FREE(*l);
-}
-
-
-static void _gclinkspeed(LinkSpeed_T *l) {
-        ASSERT(l);
-        if ((*l)->next)
-                _gclinkspeed(&(*l)->next);
-        if ((*l)->action)
-                _gc_eventaction(&(*l)->action);
-        FREE(*l);
-}
-
-
-static void _gclinksaturation(LinkSaturation_T *l) {
-        ASSERT(l);
-        if ((*l)->next)
-                _gclinksaturation(&(*l)->next);
-        if ((*l)->action)
-                _gc_eventaction(&(*l)->action);
-        FREE(*l);
-}
-
-
-static void _gcbandwidth(Bandwidth_T *b) {
-        ASSERT(b);
-        if ((*b)->next)
-                _gcbandwidth(&(*b)->next);
-        if ((*b)->action)
-                _gc_eventaction(&(*b)->action);
-        FREE(*b);
-}
-
 static void _gcmatch(Match_T *s) {
         ASSERT(s);
         if ((*s)->next)
                 _gcmatch(&(*s)->next);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
         FREE((*s)->match_path);
         FREE((*s)->match_string);
+        FREE((*s)->literal);
 #ifdef HAVE_REGEX_H
         if ((*s)->regex_comp) {
                 regfree((*s)->regex_comp);
@@ -488,97 +360,6 @@ static void _gcmatch(Match_T *s) {
 }
 
 
-static void _gcchecksum(Checksum_T *s) {
-        ASSERT(s);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcperm(Perm_T *s) {
-        ASSERT(s);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcstatus(Status_T *s) {
-        ASSERT(s);
-        if ((*s)->next)
-                _gcstatus(&(*s)->next);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcuid(Uid_T *s) {
-        ASSERT(s);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcgid(Gid_T *s) {
-        ASSERT(s);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcpid(Pid_T *s) {
-        ASSERT(s);
-        if ((*s)->next)
-                _gcpid(&(*s)->next);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcppid(Pid_T *s) {
-        ASSERT(s);
-        if ((*s)->next)
-                _gcppid(&(*s)->next);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcfsflag(Fsflag_T *s) {
-        ASSERT(s);
-        if ((*s)->next)
-                _gcfsflag(&(*s)->next);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcnonexist(Nonexist_T *s) {
-        ASSERT(s);
-        if ((*s)->next)
-                _gcnonexist(&(*s)->next);
-        if ((*s)->action)
-                _gc_eventaction(&(*s)->action);
-        FREE(*s);
-}
-
-
-static void _gcpdl(Dependant_T *d) {
-        ASSERT(d);
-        if ((*d)->next)
-                _gcpdl(&(*d)->next);
-        FREE((*d)->dependant);
-        FREE(*d);
-}
-
-
 static void _gcgrc(Generic_T *g) {
         ASSERT(g);
         if ((*g)->next)
@@ -609,9 +390,20 @@ static void _gc_mmonit(Mmonit_T *recv) {
         ASSERT(recv);
         if ((*recv)->next)
                 _gc_mmonit(&(*recv)->next);
+        if ((*recv)->socket)
+                Socket_free(&(*recv)->socket);
         _gc_url(&(*recv)->url);
         FREE((*recv)->ssl.certmd5);
         FREE((*recv)->ssl.clientpemfile);
         FREE(*recv);
 }
 
+
+static void _gc_peer(Peer_T *p) {
+        ASSERT(p);
+        if ((*p)->next)
+                _gc_peer(&(*p)->next);
+        _gc_url(&(*p)->url);
+        FREE(*p);
+}
+
@@ -0,0 +1,659 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "monit.h"
+#include "history.h"
+
+// libmonit
+#include "system/Time.h"
+
+/**
+ *  Metric history - ring buffers of delta-encoded samples.
+ *
+ *  The rings are allocated in memory or, if the history file is set, they
+ *  are the slots of the memory mapped history file (see history.h for the
+ *  format). A metric ring is bound to a free slot, to the slot which has
+ *  the history of the same service and metric from the previous Monit run
+ *  or to the least recently updated slot which no service uses, in this
+ *  order. If no slot is available, the ring is kept in memory. The slots
+ *  are written in place, the kernel writes the dirty pages back to the
+ *  file, so there's nothing to save on exit.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+/* The history file header */
+typedef struct {
+        char magic[8];                                         /**< HISTORY_MAGIC */
+        uint32_t version;                                    /**< HISTORY_VERSION */
+        uint32_t samples;                           /**< Samples per ring (HISTORY_SIZE) */
+        uint32_t slots;                                       /**< Number of slots */
+        uint32_t slotsize;                               /**< Size of one slot in bytes */
+        char reserved[40];                                   /**< Zero, pads to 64 bytes */
+} Header_T;
+
+
+/* One metric ring. The newest sample is kept as the absolute value and time,
+ * the older samples are reconstructed backwards from the deltas. The layout
+ * is the history file slot, the name and type are set for the file slots only */
+typedef struct {
+        char service[STRLEN];                                 /**< The service name */
+        int32_t type;                                         /**< The service type */
+        int32_t id;                                      /**< The metric, 0 = free slot */
+        int32_t count;                            /**< Number of samples in the ring */
+        int32_t head;                               /**< Index of the newest sample */
+        int64_t value;                                       /**< The newest value */
+        int64_t time;                                  /**< The newest sample time */
+        int32_t delta[HISTORY_SIZE];       /**< Value change to the previous sample */
+        uint16_t interval[HISTORY_SIZE];  /**< Seconds since the previous sample */
+} Ring_T;
+
+
+typedef struct myseries {
+        Resource_Type id;                                         /**< The metric */
+        Ring_T *ring;                                               /**< The samples */
+        int slot;                               /**< The history file slot, -1 = memory */
+
+        /** For internal use */
+        struct myseries *next;                              /**< Next metric ring */
+} *Series_T;
+
+
+struct myhistory {
+        Series_T series;                                       /**< The metric rings */
+};
+
+
+/* The window walk state */
+typedef struct {
+        time_t start;                                       /**< The window start */
+        double sum;                                /**< Sum of the samples (average) */
+        int count;                              /**< Number of the samples (average) */
+        time_t time;                              /**< The oldest sample time (rate) */
+        long long value;                         /**< The oldest sample value (rate) */
+} Window_T;
+
+
+/* The default metrics of the service types */
+static const Resource_Type processmetrics[] = {Resource_CpuPercent, Resource_CpuPercentTotal, Resource_MemoryKbyte, Resource_MemoryPercent, Resource_MemoryKbyteTotal, Resource_MemoryPercentTotal, Resource_Children, Resource_Tasks, Resource_FileDescriptors, 0};
+static const Resource_Type systemmetrics[] = {Resource_LoadAverage1m, Resource_LoadAverage5m, Resource_LoadAverage15m, Resource_CpuUser, Resource_CpuSystem, Resource_CpuWait, Resource_MemoryKbyte, Resource_MemoryPercent, Resource_SwapKbyte, Resource_SwapPercent, 0};
+static const Resource_Type cgroupmetrics[] = {Resource_CpuPercent, Resource_MemoryKbyte, Resource_MemoryPercent, Resource_Tasks, 0};
+static const Resource_Type filemetrics[] = {Resource_Size, 0};
+
+
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* The memory mapped history file */
+static struct {
+        char *file;                                          /**< The mapped file */
+        int slots;                                            /**< Number of slots */
+        int fd;                                               /**< File descriptor */
+        void *data;                                                 /**< Mapped file */
+        size_t size;                                       /**< Mapped file size */
+        Series_T *attached;                /**< The rings bound to the slots, by slot */
+        boolean_t registered;                          /**< atexit handler is set */
+} map = {.fd = -1, .data = MAP_FAILED};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Get the current value of the metric, in the units of the resource rules.
+ * The system wide metrics are available for any service
+ */
+static boolean_t _value(Service_T s, Resource_Type id, long long *value) {
+        boolean_t system = s->type == Service_System;
+        switch (id) {
+                case Resource_CpuPercent:
+                        *value = s->inf->priv.process.cpu_percent;
+                        break;
+                case Resource_CpuPercentTotal:
+                        *value = s->inf->priv.process.total_cpu_percent;
+                        break;
+                case Resource_MemoryKbyte:
+                        *value = system ? systeminfo.total_mem_kbyte : s->inf->priv.process.mem_kbyte;
+                        break;
+                case Resource_MemoryPercent:
+                        *value = system ? systeminfo.total_mem_percent : s->inf->priv.process.mem_percent;
+                        break;
+                case Resource_MemoryKbyteTotal:
+                        *value = s->inf->priv.process.total_mem_kbyte;
+                        break;
+                case Resource_MemoryPercentTotal:
+                        *value = s->inf->priv.process.total_mem_percent;
+                        break;
+                case Resource_Children:
+                        *value = s->inf->priv.process.children;
+                        break;
+                case Resource_Tasks:
+                        *value = s->inf->priv.process.threads;
+                        break;
+                case Resource_FileDescriptors:
+                        *value = s->inf->priv.process.fds;
+                        break;
+                case Resource_ReadBytes:
+                        *value = s->inf->priv.process.read_rate;
+                        break;
+                case Resource_WriteBytes:
+                        *value = s->inf->priv.process.write_rate;
+                        break;
+                case Resource_LoadAverage1m:
+                        *value = (long long)(systeminfo.loadavg[0] * 10.);
+                        break;
+                case Resource_LoadAverage5m:
+                        *value = (long long)(systeminfo.loadavg[1] * 10.);
+                        break;
+                case Resource_LoadAverage15m:
+                        *value = (long long)(systeminfo.loadavg[2] * 10.);
+                        break;
+                case Resource_CpuUser:
+                        *value = systeminfo.total_cpu_user_percent;
+                        break;
+                case Resource_CpuSystem:
+                        *value = systeminfo.total_cpu_syst_percent;
+                        break;
+                case Resource_CpuWait:
+                        *value = systeminfo.total_cpu_wait_percent;
+                        break;
+                case Resource_CpuMax:
+                        *value = systeminfo.cpu_max_percent;
+                        break;
+                case Resource_CpuNodeMax:
+                        *value = systeminfo.node_max_percent;
+                        break;
+                case Resource_SwapKbyte:
+                        *value = systeminfo.total_swap_kbyte;
+                        break;
+                case Resource_SwapPercent:
+                        *value = systeminfo.total_swap_percent;
+                        break;
+                case Resource_Size:
+                        *value = s->inf->priv.file.size;
+                        break;
+                default:
+                        return false;
+        }
+        return *value >= 0; // The negative values mark the metrics which are not collected yet
+}
+
+
+static Series_T _series(History_T H, Resource_Type id) {
+        for (Series_T S = H->series; S; S = S->next)
+                if (S->id == id)
+                        return S;
+        return NULL;
+}
+
+
+static Ring_T *_slot(int i) {
+        return (Ring_T *)((char *)map.data + sizeof(Header_T) + i * sizeof(Ring_T));
+}
+
+
+/**
+ * Bind the ring to a history file slot. A new ring (without samples) takes
+ * over the history of the same service and metric saved in the file, an
+ * existing ring is copied to the slot
+ * @return true if the ring is in the file, otherwise false
+ */
+static boolean_t _attach(Service_T s, Series_T S, time_t now) {
+        if (map.data == MAP_FAILED)
+                return false;
+        int found = -1, unused = -1;
+        for (int i = 0; i < map.slots; i++) {
+                if (map.attached[i])
+                        continue;
+                Ring_T *R = _slot(i);
+                if (R->id == S->id && R->type == (int32_t)s->type && Str_isEqual(R->service, s->name)) {
+                        found = i;
+                        break;
+                }
+                if (! R->id) {
+                        if (unused == -1 || _slot(unused)->id)
+                                unused = i;
+                } else if (unused == -1 || (_slot(unused)->id && R->time < _slot(unused)->time)) {
+                        unused = i;
+                }
+        }
+        int i = found != -1 ? found : unused;
+        if (i == -1)
+                return false;
+        Ring_T *R = _slot(i);
+        if (S->ring) {
+                memcpy(R, S->ring, sizeof(Ring_T));
+                FREE(S->ring);
+        } else if (found == -1 || R->count < 1 || R->count > HISTORY_SIZE || R->head < 0 || R->head >= HISTORY_SIZE || R->time > now) {
+                /* A new or foreign slot, or the saved history is not usable (for example the clock went back) */
+                memset(R, 0, sizeof(Ring_T));
+        }
+        snprintf(R->service, sizeof(R->service), "%s", s->name);
+        R->type = s->type;
+        R->id = S->id;
+        S->ring = R;
+        S->slot = i;
+        map.attached[i] = S;
+        return true;
+}
+
+
+/**
+ * Move the ring from the history file to memory
+ */
+static void _detach(Series_T S) {
+        if (S->slot >= 0) {
+                Ring_T *R = S->ring;
+                S->ring = ALLOC(sizeof(Ring_T));
+                memcpy(S->ring, R, sizeof(Ring_T));
+                map.attached[S->slot] = NULL;
+                S->slot = -1;
+        }
+}
+
+
+static void _unmap() {
+        if (map.data != MAP_FAILED) {
+                for (int i = 0; i < map.slots; i++)
+                        if (map.attached[i])
+                                _detach(map.attached[i]);
+                munmap(map.data, map.size);
+                map.data = MAP_FAILED;
+                map.size = 0;
+        }
+        if (map.fd != -1) {
+                if (close(map.fd) == -1)
+                        LogError("History file '%s': close error -- %s\n", map.file, STRERROR);
+                map.fd = -1;
+        }
+        FREE(map.attached);
+        FREE(map.file);
+        map.slots = 0;
+}
+
+
+static boolean_t _map(const char *file, int slots) {
+        map.file = Str_dup(file);
+        map.slots = slots;
+        map.size = sizeof(Header_T) + slots * sizeof(Ring_T);
+        if ((map.fd = open(file, O_RDWR | O_CREAT, 0600)) == -1) {
+                LogError("History file '%s': cannot open -- %s\n", file, STRERROR);
+                return false;
+        }
+        struct stat st;
+        if (fstat(map.fd, &st) == -1) {
+                LogError("History file '%s': cannot stat -- %s\n", file, STRERROR);
+                return false;
+        }
+        boolean_t create = (size_t)st.st_size != map.size;
+        if (create && (ftruncate(map.fd, 0) == -1 || ftruncate(map.fd, map.size) == -1)) {
+                LogError("History file '%s': unable to resize -- %s\n", file, STRERROR);
+                return false;
+        }
+        if ((map.data = mmap(NULL, map.size, PROT_READ | PROT_WRITE, MAP_SHARED, map.fd, 0)) == MAP_FAILED) {
+                LogError("History file '%s': unable to map -- %s\n", file, STRERROR);
+                return false;
+        }
+        Header_T *header = map.data;
+        if (create || memcmp(header->magic, HISTORY_MAGIC, sizeof(header->magic)) || header->version != HISTORY_VERSION || header->samples != HISTORY_SIZE || header->slots != (uint32_t)slots || header->slotsize != sizeof(Ring_T)) {
+                if (! create)
+                        LogWarning("History file '%s': incompatible format or number of slots changed, the saved history was reset\n", file);
+                memset(map.data, 0, map.size);
+                memcpy(header->magic, HISTORY_MAGIC, sizeof(header->magic));
+                header->version = HISTORY_VERSION;
+                header->samples = HISTORY_SIZE;
+                header->slots = slots;
+                header->slotsize = sizeof(Ring_T);
+        }
+        map.attached = CALLOC(slots, sizeof(Series_T));
+        return true;
+}
+
+
+static void _record(Service_T s, Resource_Type id, long long value, time_t now) {
+        if (! s->history)
+                NEW(s->history);
+        Series_T S = _series(s->history, id);
+        if (! S) {
+                NEW(S);
+                S->id = id;
+                S->slot = -1;
+                if (! _attach(s, S, now))
+                        NEW(S->ring);
+                S->next = s->history->series;
+                s->history->series = S;
+        }
+        Ring_T *R = S->ring;
+        if (R->count) {
+                long long delta = value - R->value;
+                long long interval = now - R->time;
+                if (interval <= 0) {
+                        /* Another sample in the same second replaces the newest sample */
+                        if (R->count > 1) {
+                                delta += R->delta[R->head];
+                                if (delta < INT32_MIN || delta > INT32_MAX)
+                                        R->count = 0;
+                                else
+                                        R->delta[R->head] = (int32_t)delta;
+                        }
+                        R->value = value;
+                        if (R->count)
+                                return;
+                } else if (delta < INT32_MIN || delta > INT32_MAX || interval > UINT16_MAX) {
+                        /* The change doesn't fit the compact layout, the history starts again */
+                        R->count = 0;
+                } else {
+                        /* The value and time are updated last, so a reader of the history file sees a consistent ring once they changed */
+                        int head = (R->head + 1) % HISTORY_SIZE;
+                        R->delta[head] = (int32_t)delta;
+                        R->interval[head] = (uint16_t)interval;
+                        R->head = head;
+                        if (R->count < HISTORY_SIZE)
+                                R->count++;
+                        R->value = value;
+                        R->time = now;
+                        return;
+                }
+        }
+        R->head = 0;
+        R->count = 1;
+        R->delta[0] = 0;
+        R->interval[0] = 0;
+        R->value = value;
+        R->time = now;
+}
+
+
+/**
+ * Walk the samples backwards from the newest one to the first sample at or
+ * before the window start. The callback gets each sample
+ * @return true if the history covers the window (or the ring is full)
+ */
+static boolean_t _walk(Ring_T *R, int seconds, void (*callback)(time_t t, long long v, void *context), void *context) {
+        long long v = R->value;
+        time_t t = R->time;
+        time_t start = R->time - seconds;
+        for (int k = 0, i = R->head; k < R->count; k++) {
+                callback(t, v, context);
+                if (t <= start)
+                        return true;
+                v -= R->delta[i];
+                t -= R->interval[i];
+                i = i ? i - 1 : HISTORY_SIZE - 1;
+        }
+        return R->count == HISTORY_SIZE;
+}
+
+
+static void _average(time_t t, long long v, void *context) {
+        Window_T *W = context;
+        if (t > W->start) {
+                W->sum += v;
+                W->count++;
+        }
+}
+
+
+static void _oldest(time_t t, long long v, void *context) {
+        Window_T *W = context;
+        W->time = t;
+        W->value = v;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void History_update(Service_T s) {
+        ASSERT(s);
+        const Resource_Type *metrics;
+        switch (s->type) {
+                case Service_Process:
+                        metrics = processmetrics;
+                        break;
+                case Service_System:
+                        metrics = systemmetrics;
+                        break;
+                case Service_Cgroup:
+                        metrics = cgroupmetrics;
+                        break;
+                case Service_File:
+                        metrics = filemetrics;
+                        break;
+                default:
+                        metrics = NULL;
+                        break;
+        }
+        time_t now = Time_now();
+        long long value;
+        LOCK(mutex)
+        {
+                for (int i = 0; metrics && metrics[i]; i++)
+                        if (_value(s, metrics[i], &value))
+                                _record(s, metrics[i], value, now);
+                /* The average rules may use the metrics which are not in the default set (for example the load average in a process service) */
+                for (Resource_T r = s->resourcelist; r; r = r->next)
+                        if (r->window && _value(s, r->resource_id, &value))
+                                _record(s, r->resource_id, value, now);
+        }
+        END_LOCK;
+}
+
+
+void History_record(Service_T s, Resource_Type id, long long value) {
+        ASSERT(s);
+        LOCK(mutex)
+        {
+                _record(s, id, value, Time_now());
+        }
+        END_LOCK;
+}
+
+
+boolean_t History_average(Service_T s, Resource_Type id, int seconds, double *average) {
+        ASSERT(s);
+        ASSERT(average);
+        boolean_t rv = false;
+        LOCK(mutex)
+        {
+                Series_T S = s->history ? _series(s->history, id) : NULL;
+                if (S) {
+                        Window_T W = {.start = S->ring->time - seconds};
+                        if (_walk(S->ring, seconds, _average, &W) && W.count) {
+                                *average = W.sum / W.count;
+                                rv = true;
+                        }
+                }
+        }
+        END_LOCK;
+        return rv;
+}
+
+
+boolean_t History_rate(Service_T s, Resource_Type id, int seconds, double *rate) {
+        ASSERT(s);
+        ASSERT(rate);
+        boolean_t rv = false;
+        LOCK(mutex)
+        {
+                Series_T S = s->history ? _series(s->history, id) : NULL;
+                if (S) {
+                        Window_T W = {0};
+                        if (_walk(S->ring, seconds, _oldest, &W) && W.time < S->ring->time) {
+                                *rate = (double)(S->ring->value - W.value) / (double)(S->ring->time - W.time);
+                                rv = true;
+                        }
+                }
+        }
+        END_LOCK;
+        return rv;
+}
+
+
+int History_metrics(Service_T s, Resource_Type *ids, int size) {
+        ASSERT(s);
+        ASSERT(ids);
+        int count = 0;
+        LOCK(mutex)
+        {
+                if (s->history)
+                        for (Series_T S = s->history->series; S && count < size; S = S->next)
+                                ids[count++] = S->id;
+        }
+        END_LOCK;
+        return count;
+}
+
+
+int History_samples(Service_T s, Resource_Type id, time_t *times, long long *values, int size) {
+        ASSERT(s);
+        ASSERT(times);
+        ASSERT(values);
+        int count = 0;
+        LOCK(mutex)
+        {
+                Series_T S = s->history ? _series(s->history, id) : NULL;
+                if (S) {
+                        Ring_T *R = S->ring;
+                        count = R->count < size ? R->count : size;
+                        long long v = R->value;
+                        time_t t = R->time;
+                        for (int k = count - 1, i = R->head; k >= 0; k--) {
+                                times[k] = t;
+                                values[k] = v;
+                                v -= R->delta[i];
+                                t -= R->interval[i];
+                                i = i ? i - 1 : HISTORY_SIZE - 1;
+                        }
+                }
+        }
+        END_LOCK;
+        return count;
+}
+
+
+void History_open() {
+        LOCK(mutex)
+        {
+                if (! Run.historyfile || ! IS(map.file, Run.historyfile) || map.slots != Run.historyslots) {
+                        _unmap();
+                        if (Run.historyfile) {
+                                if (_map(Run.historyfile, Run.historyslots)) {
+                                        /* Move the history of the services kept from the previous configuration to the file */
+                                        time_t now = Time_now();
+                                        for (Service_T s = servicelist; s; s = s->next)
+                                                if (s->history)
+                                                        for (Series_T S = s->history->series; S; S = S->next)
+                                                                if (S->slot == -1)
+                                                                        _attach(s, S, now);
+                                        if (! map.registered) {
+                                                atexit(History_close);
+                                                map.registered = true;
+                                        }
+                                } else {
+                                        _unmap();
+                                }
+                        }
+                }
+        }
+        END_LOCK;
+}
+
+
+void History_close() {
+        LOCK(mutex)
+        {
+                _unmap();
+        }
+        END_LOCK;
+}
+
+
+void History_free(History_T *H) {
+        ASSERT(H);
+        if (*H) {
+                LOCK(mutex)
+                {
+                        Series_T next;
+                        for (Series_T S = (*H)->series; S; S = next) {
+                                next = S->next;
+                                if (S->slot >= 0)
+                                        map.attached[S->slot] = NULL; // The slot keeps the history for the next Monit run
+                                else
+                                        FREE(S->ring);
+                                FREE(S);
+                        }
+                }
+                END_LOCK;
+                FREE(*H);
+        }
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#ifndef MONIT_HISTORY_H
+#define MONIT_HISTORY_H
+
+
+/**
+ * Metric history.
+ *
+ * Monit keeps a short history of the service metrics (CPU, memory, load,
+ * children, file size, ...) in a fixed-size ring buffer per metric. The
+ * ring stores the newest value and the change of the value and of the
+ * time to the previous sample, so a sample costs six bytes. The history
+ * is used by the rules which test the average or the rate of a metric
+ * over a time window and it is served by the HTTP interface for graphs.
+ *
+ * The history is kept in memory and is lost when Monit is restarted,
+ * unless the "set historyfile" statement is used. The history file is
+ * memory mapped and the rings are updated in place, so the history
+ * continues after the restart and nothing is written on exit. The file
+ * uses the host byte order and is made of a 64 byte header followed by
+ * the slots:
+ *
+ *    header: char magic[8]         "MONITHIS"
+ *            uint32_t version      1
+ *            uint32_t samples      samples per ring (HISTORY_SIZE)
+ *            uint32_t slots        number of slots
+ *            uint32_t slotsize     size of one slot in bytes
+ *            char reserved[40]     zero
+ *
+ *    slot:   char service[256]     service name, NUL terminated
+ *            int32_t type          service type (Service_Type)
+ *            int32_t metric        metric (Resource_Type), 0 = free slot
+ *            int32_t count         number of samples in the ring
+ *            int32_t head          index of the newest sample
+ *            int64_t value         the newest value
+ *            int64_t time          the newest sample time (Unix time)
+ *            int32_t delta[samples]       value change to previous sample
+ *            uint16_t interval[samples]   seconds since previous sample
+ *
+ * The sample at index head has the value and time of the slot, the
+ * previous sample is at index head - 1 (modulo samples) with the value
+ * value - delta[head] and the time time - interval[head], and so on for
+ * count samples. Monit writes the delta and interval of a new sample
+ * first and then the head, value and time, so an external reader which
+ * reads the time before and after copying the slot and gets the same
+ * value has a consistent copy.
+ *
+ *  @file
+ */
+
+
+/**
+ * Number of samples kept per metric, one hour of 10 second cycles
+ */
+#define HISTORY_SIZE 360
+
+
+/**
+ * The history file magic and format version
+ */
+#define HISTORY_MAGIC "MONITHIS"
+#define HISTORY_VERSION 1
+
+
+/**
+ * Default number of slots in the history file (one slot per service metric)
+ */
+#define HISTORY_SLOTS 256
+
+
+/**
+ * Open the history file set by the "set historyfile" statement, or close
+ * it if the statement was removed. The rings of the current services are
+ * moved to the file. If the file can't be used, the history is kept in
+ * memory
+ */
+void History_open();
+
+
+/**
+ * Close the history file. The rings bound to the file are moved to memory
+ */
+void History_close();
+
+
+/**
+ * Record the current metrics of the service: the default metrics of the
+ * service type and the metrics used by its average rules
+ * @param s The service
+ */
+void History_update(Service_T s);
+
+
+/**
+ * Record one metric value
+ * @param s The service
+ * @param id The metric
+ * @param value The metric value (in the units used by the resource rules)
+ */
+void History_record(Service_T s, Resource_Type id, long long value);
+
+
+/**
+ * Get the average of the samples within the time window. The average is
+ * available only once the history covers the whole window
+ * @param s The service
+ * @param id The metric
+ * @param seconds The time window
+ * @param average Output of the average value
+ * @return true if the average is available, otherwise false
+ */
+boolean_t History_average(Service_T s, Resource_Type id, int seconds, double *average);
+
+
+/**
+ * Get the rate of change of the metric over the time window. The rate is
+ * available once the history covers the window or, for a window shorter
+ * than the cycle, once there are two samples
+ * @param s The service
+ * @param id The metric
+ * @param seconds The time window
+ * @param rate Output of the change per second
+ * @return true if the rate is available, otherwise false
+ */
+boolean_t History_rate(Service_T s, Resource_Type id, int seconds, double *rate);
+
+
+/**
+ * Get the metrics which have a history
+ * @param s The service
+ * @param ids Output array of the metrics
+ * @param size The size of the ids array
+ * @return The number of metrics
+ */
+int History_metrics(Service_T s, Resource_Type *ids, int size);
+
+
+/**
+ * Get the samples of the metric, the oldest sample first
+ * @param s The service
+ * @param id The metric
+ * @param times Output array of the sample times
+ * @param values Output array of the sample values
+ * @param size The size of the output arrays
+ * @return The number of samples
+ */
+int History_samples(Service_T s, Resource_Type id, time_t *times, long long *values, int size);
+
+
+/**
+ * Free the history of the service
+ * @param H The history object reference
+ */
+void History_free(History_T *H);
+
+
+#endif
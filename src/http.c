@@ -59,6 +59,7 @@
 #include "monit.h"
 #include "net.h"
 #include "engine.h"
+#include "processor.h"
 
 // libmonit
 #include "exceptions/AssertException.h"
@@ -114,18 +115,30 @@ void monit_http(Httpd_Action action) {
                         LogInfo("Shutting down Monit HTTP server\n");
                         Engine_stop();
                         Thread_join(thread);
+                        clear_auth_cache();
                         LogInfo("Monit HTTP server stopped\n");
                         running = false;
                         break;
                 case Httpd_Start:
                         if (Run.httpd.flags & Httpd_Net)
                                 LogInfo("Starting Monit HTTP server at [%s]:%d\n", Run.httpd.socket.net.address ? Run.httpd.socket.net.address : "*", Run.httpd.socket.net.port);
-                        else if (Run.httpd.flags & Httpd_Unix)
+                        if (Run.httpd.flags & Httpd_Unix)
                                 LogInfo("Starting Monit HTTP server at %s\n", Run.httpd.socket.unix.path);
                         Thread_create(thread, thread_wrapper, NULL);
                         LogInfo("Monit HTTP server started\n");
                         running = true;
                         break;
+                case Httpd_Suspend:
+                        if (running) {
+                                Engine_suspend();
+                                /* The credentials may change with the reloaded configuration */
+                                clear_auth_cache();
+                        }
+                        break;
+                case Httpd_Resume:
+                        if (running)
+                                Engine_resume();
+                        break;
                 default:
                         LogError("Monit: Unknown http server action\n");
                         break;
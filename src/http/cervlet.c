@@ -50,6 +50,7 @@
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
+#include <ctype.h>
 #endif
 
 #ifdef HAVE_UNISTD_H
@@ -64,6 +65,10 @@
 #include <sys/time.h>
 #endif
 
+#ifdef HAVE_PWD_H
+#include <pwd.h>
+#endif
+
 #include "monit.h"
 #include "cervlet.h"
 #include "engine.h"
@@ -73,30 +78,61 @@
 #include "alert.h"
 #include "process.h"
 #include "device.h"
+#include "resolver.h"
+#include "latency.h"
+#include "output.h"
+#include "relay.h"
+#include "instance.h"
+#include "plugin.h"
+#include "cluster.h"
 
 // libmonit
 #include "system/Time.h"
 
-#define ACTION(c) ! strncasecmp(req->url, c, sizeof(c))
-
 /* URL Commands supported */
 #define HOME        "/"
 #define TEST        "/_monit"
 #define ABOUT       "/_about"
 #define PING        "/_ping"
 #define GETID       "/_getid"
+#define CLUSTER     "/_cluster"
 #define STATUS      "/_status"
 #define STATUS2     "/_status2"
 #define RUN         "/_runtime"
 #define VIEWLOG     "/_viewlog"
 #define DOACTION    "/_doaction"
+#define METRICS     "/_metrics"
+#define HISTORY     "/_history"
+#define PROCESSES   "/_processes"
+#define WATCH       "/_watch"
+#define COLLECTOR   "/collector"
 #define FAVICON     "/favicon.ico"
 
+/* The size of the route hash table (power of 2, more than twice the number of routes) */
+#define ROUTE_TABLE_SIZE 64
+
+/* Seconds a long-poll status request waits for the status change by default and at most */
+#define LONGPOLL_TIMEOUT     30
+#define LONGPOLL_TIMEOUT_MAX 300
+
+/* Serialize the requests which change the service state, the request workers run in parallel */
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The handlers of the URL command. A request for other URL is a service page, see handle_action() */
+typedef struct myroute {
+        const char *path;
+        void (*doGet)(HttpRequest, HttpResponse);
+        void (*doPost)(HttpRequest, HttpResponse);
+        boolean_t serialized;                    /**< Handled with the mutex locked */
+} *Route_T;
+
 /* Private prototypes */
 static boolean_t is_readonly(HttpRequest);
+static boolean_t is_current(HttpRequest, HttpResponse, const char *);
 static void printFavicon(HttpResponse);
 static void doGet(HttpRequest, HttpResponse);
 static void doPost(HttpRequest, HttpResponse);
+static boolean_t doWatch(HttpResponse, HttpWatch, boolean_t);
 static void do_head(HttpResponse res, const char *path, const char *name, int refresh);
 static void do_foot(HttpResponse res);
 static void do_home(HttpRequest, HttpResponse);
@@ -106,16 +142,22 @@ static void do_home_directory(HttpRequest, HttpResponse);
 static void do_home_file(HttpRequest, HttpResponse);
 static void do_home_fifo(HttpRequest, HttpResponse);
 static void do_home_net(HttpRequest, HttpResponse);
+static void do_home_cgroup(HttpRequest, HttpResponse);
+static void do_home_processes(HttpRequest, HttpResponse);
 static void do_home_process(HttpRequest, HttpResponse);
 static void do_home_program(HttpRequest, HttpResponse);
 static void do_home_host(HttpRequest, HttpResponse);
+static void print_home_row(HttpResponse, Service_T, boolean_t, void (*)(StringBuffer_T, Service_T));
 static void do_about(HttpRequest, HttpResponse);
 static void do_ping(HttpRequest, HttpResponse);
 static void do_getid(HttpRequest, HttpResponse);
+static void do_cluster(HttpRequest, HttpResponse);
 static void do_runtime(HttpRequest, HttpResponse);
 static void do_viewlog(HttpRequest, HttpResponse);
+static void print_latency(HttpResponse, const char *, const char *, Latency_T);
 static void handle_action(HttpRequest, HttpResponse);
 static void handle_do_action(HttpRequest, HttpResponse);
+static void handle_relay(HttpRequest, HttpResponse);
 static void handle_run(HttpRequest, HttpResponse);
 static void is_monit_running(HttpRequest, HttpResponse);
 static void do_service(HttpRequest, HttpResponse, Service_T);
@@ -174,22 +216,65 @@ static void print_service_status_process_cpu(HttpResponse, Service_T);
 static void print_service_status_process_cputotal(HttpResponse, Service_T);
 static void print_service_status_process_memory(HttpResponse, Service_T);
 static void print_service_status_process_memorytotal(HttpResponse, Service_T);
+static void print_service_status_process_resources(HttpResponse, Service_T);
+static void print_service_status_cgroup(HttpResponse, Service_T);
+static void print_service_status_processes(HttpResponse, Service_T);
+static void print_service_status_instances(HttpResponse, Service_T);
 static void print_service_status_system_loadavg(HttpResponse, Service_T);
 static void print_service_status_system_cpu(HttpResponse, Service_T);
+static void print_service_status_system_cpumax(HttpResponse, Service_T);
 static void print_service_status_system_memory(HttpResponse, Service_T);
 static void print_service_status_system_swap(HttpResponse, Service_T);
 static void print_service_status_program_started(HttpResponse, Service_T);
 static void print_service_status_program_status(HttpResponse, Service_T);
 static void print_service_status_program_output(HttpResponse, Service_T);
+static void print_service_status_plugin_metrics(HttpResponse, Service_T);
 static void print_service_status_link(HttpResponse, Service_T);
 static void print_service_status_download(HttpResponse, Service_T);
 static void print_service_status_upload(HttpResponse, Service_T);
 static void print_status(HttpRequest, HttpResponse, int);
+static void print_metrics(HttpRequest, HttpResponse);
+static void print_history(HttpRequest, HttpResponse);
+static void print_processes(HttpRequest, HttpResponse);
+static unsigned int _routeHash(const char *);
+static void get_home(HttpRequest, HttpResponse);
+static void get_favicon(HttpRequest, HttpResponse);
+static void get_status(HttpRequest, HttpResponse);
+static void get_status2(HttpRequest, HttpResponse);
+static void get_watch(HttpRequest, HttpResponse);
+static void watch_status(HttpRequest, HttpResponse, Level_Type, boolean_t);
+static void post_collector(HttpRequest, HttpResponse);
 static void status_service_txt(Service_T, HttpResponse, Level_Type);
+static void status_flush(void *, StringBuffer_T);
 static char *get_monitoring_status(Service_T s, char *, int);
 static char *get_service_status(Service_T, char *, int);
 
 
+static struct myroute routes[] = {
+        {HOME,      get_home,          NULL,              false},
+        {TEST,      is_monit_running,  NULL,              false},
+        {ABOUT,     do_about,          NULL,              false},
+        {PING,      do_ping,           NULL,              false},
+        {GETID,     do_getid,          NULL,              false},
+        {CLUSTER,   do_cluster,        NULL,              false},
+        {STATUS,    get_status,        NULL,              false},
+        {STATUS2,   get_status2,       NULL,              false},
+        {RUN,       handle_run,        handle_run,        true},
+        {VIEWLOG,   do_viewlog,        NULL,              false},
+        {DOACTION,  handle_do_action,  handle_do_action,  true},
+        {METRICS,   print_metrics,     NULL,              false},
+        {HISTORY,   print_history,     NULL,              false},
+        {PROCESSES, print_processes,   NULL,              false},
+        {WATCH,     get_watch,         NULL,              false},
+        {COLLECTOR, NULL,              post_collector,    false},
+        {FAVICON,   get_favicon,       NULL,              false}
+};
+
+
+/* The open addressing hash table of the routes, built by init_service() */
+static Route_T routetable[ROUTE_TABLE_SIZE];
+
+
 /**
  *  Implementation of doGet and doPost routines used by the cervlet
  *  processor module. This particilary cervlet will provide
@@ -208,7 +293,14 @@ static char *get_service_status(Service_T, char *, int);
  * doGet and doPost methods.
  */
 void init_service() {
-        add_Impl(doGet, doPost);
+        memset(routetable, 0, sizeof(routetable));
+        for (int i = 0; i < sizeof(routes) / sizeof(routes[0]); i++) {
+                unsigned int j = _routeHash(routes[i].path);
+                while (routetable[j])
+                        j = (j + 1) % ROUTE_TABLE_SIZE;
+                routetable[j] = &routes[i];
+        }
+        add_Impl(doGet, doPost, doWatch);
 }
 
 
@@ -226,18 +318,55 @@ static void _printServiceStatus(StringBuffer_T sb, Service_T s) {
 }
 
 
+/*
+ * Case insensitive hash of the URL path
+ */
+static unsigned int _routeHash(const char *path) {
+        unsigned int h = 2166136261U;
+        while (*path)
+                h = (h ^ (unsigned char)tolower((unsigned char)*path++)) * 16777619U;
+        return h % ROUTE_TABLE_SIZE;
+}
+
+
+/*
+ * Returns the route of the URL command or NULL if the URL is not a command
+ */
+static Route_T _getRoute(const char *url) {
+        for (unsigned int i = _routeHash(url); routetable[i]; i = (i + 1) % ROUTE_TABLE_SIZE)
+                if (! strcasecmp(routetable[i]->path, url))
+                        return routetable[i];
+        return NULL;
+}
+
+
+/*
+ * Call the request handler, serialized with the other requests which change the service state if needed
+ */
+static void _dispatch(HttpRequest req, HttpResponse res, void (*handler)(HttpRequest, HttpResponse), boolean_t serialized) {
+        if (serialized) {
+                LOCK(mutex)
+                {
+                        handler(req, res);
+                }
+                END_LOCK;
+        } else {
+                handler(req, res);
+        }
+}
+
+
 /**
  * Called by the Processor (via the service method)
  * to handle a POST request.
  */
 static void doPost(HttpRequest req, HttpResponse res) {
         set_content_type(res, "text/html");
-        if (ACTION(RUN))
-                handle_run(req, res);
-        else if (ACTION(DOACTION))
-                handle_do_action(req, res);
+        Route_T route = _getRoute(req->url);
+        if (route && route->doPost)
+                _dispatch(req, res, route->doPost, route->serialized);
         else
-                handle_action(req, res);
+                _dispatch(req, res, handle_action, true);
 }
 
 
@@ -247,32 +376,99 @@ static void doPost(HttpRequest req, HttpResponse res) {
  */
 static void doGet(HttpRequest req, HttpResponse res) {
         set_content_type(res, "text/html");
-        if (ACTION(HOME)) {
+        Route_T route = _getRoute(req->url);
+        if (route && route->doGet)
+                _dispatch(req, res, route->doGet, route->serialized);
+        else
+                _dispatch(req, res, handle_action, true);
+}
+
+
+/**
+ * Called by the Processor to check a parked status request (see
+ * watch_status()). Renders the status of the services which changed
+ * since the client's generation, or of all services for a new client.
+ * If nothing changed, the client's generation is moved to the current
+ * one and false is returned, unless the response is forced (the
+ * long-poll deadline passed).
+ */
+static boolean_t doWatch(HttpResponse res, HttpWatch W, boolean_t force) {
+        unsigned long long generation = status_xml_watch();
+        /* The generation of a previous monit process is unknown, the client gets all services */
+        if (W->since > generation)
+                W->since = 0;
+        boolean_t changed = ! W->since;
+        for (Service_T s = servicelist_conf; s && ! changed; s = s->next_conf)
+                changed = status_xml_changed(s, W->since);
+        if (! changed && ! force) {
+                W->since = generation;
+                return false;
+        }
+        char buf[STRLEN];
+        const char *myip = Socket_getLocalHost(res->S, buf, sizeof(buf));
+        if (IS(W->format, "xml")) {
+                status_xml_delta(res->outputbuffer, W->since, myip);
+        } else if (IS(W->format, "json")) {
+                status_json(res->outputbuffer, NULL, W->level, W->since, myip, NULL, NULL);
+        } else {
+                for (Service_T s = servicelist_conf; s; s = s->next_conf)
+                        if (! W->since || status_xml_changed(s, W->since))
+                                status_service_txt(s, res, W->level);
+        }
+        if (! W->websocket) {
+                char value[32];
+                snprintf(value, sizeof(value), "%llu", generation);
+                set_header(res, "X-Monit-Generation", value);
+                set_content_type(res, IS(W->format, "xml") ? "text/xml" : IS(W->format, "json") ? "application/json" : "text/plain");
+        }
+        W->since = generation;
+        return true;
+}
+
+
+static void get_home(HttpRequest req, HttpResponse res) {
+        if (! is_current(req, res, "home")) {
                 LOCK(Run.mutex)
                 do_home(req, res);
                 END_LOCK;
-        } else if (ACTION(RUN)) {
-                handle_run(req, res);
-        } else if (ACTION(TEST)) {
-                is_monit_running(req, res);
-        } else if (ACTION(VIEWLOG)) {
-                do_viewlog(req, res);
-        } else if (ACTION(ABOUT)) {
-                do_about(req, res);
-        } else if (ACTION(FAVICON)) {
-                printFavicon(res);
-        } else if (ACTION(PING)) {
-                do_ping(req, res);
-        } else if (ACTION(GETID)) {
-                do_getid(req, res);
-        } else if (ACTION(STATUS)) {
-                print_status(req, res, 1);
-        } else if (ACTION(STATUS2)) {
-                print_status(req, res, 2);
-        } else if (ACTION(DOACTION)) {
-                handle_do_action(req, res);
+        }
+}
+
+
+static void get_favicon(HttpRequest req, HttpResponse res) {
+        printFavicon(res);
+}
+
+
+static void get_status(HttpRequest req, HttpResponse res) {
+        print_status(req, res, 1);
+}
+
+
+static void get_status2(HttpRequest req, HttpResponse res) {
+        print_status(req, res, 2);
+}
+
+
+/**
+ * The WebSocket status stream: the client gets the status of all services
+ * (or the services changed since the given generation) and then a message
+ * with the changed services after each cycle which changed something
+ */
+static void get_watch(HttpRequest req, HttpResponse res) {
+        if (upgrade_websocket(req, res)) {
+                const char *stringLevel = get_parameter(req, "level");
+                watch_status(req, res, stringLevel && Str_startsWith(stringLevel, LEVEL_NAME_SUMMARY) ? Level_Summary : Level_Full, true);
+        }
+}
+
+
+static void post_collector(HttpRequest req, HttpResponse res) {
+        if (Run.relay) {
+                /* The relayed messages don't change the services state, they're not serialized with the actions */
+                handle_relay(req, res);
         } else {
-                handle_action(req, res);
+                _dispatch(req, res, handle_action, true);
         }
 }
 
@@ -280,6 +476,26 @@ static void doGet(HttpRequest req, HttpResponse res) {
 /* ----------------------------------------------------------------- Helpers */
 
 
+/**
+ * Park the status request until the status changes, see doWatch(). The
+ * "since" parameter is the status generation the client has (the
+ * "X-Monit-Generation" header and the document generation), the long-poll
+ * request is answered after "timeout" seconds even if nothing changed
+ */
+static void watch_status(HttpRequest req, HttpResponse res, Level_Type level, boolean_t websocket) {
+        const char *stringSince = get_parameter(req, "since");
+        const char *stringTimeout = get_parameter(req, "timeout");
+        const char *stringFormat = get_parameter(req, "format");
+        int timeout = stringTimeout ? Str_parseInt(stringTimeout) : LONGPOLL_TIMEOUT;
+        HttpWatch W = watch_response(res);
+        W->websocket = websocket;
+        W->since = stringSince ? strtoull(stringSince, NULL, 10) : 0;
+        W->deadline = Time_now() + (timeout < 0 ? 0 : timeout > LONGPOLL_TIMEOUT_MAX ? LONGPOLL_TIMEOUT_MAX : timeout);
+        W->format = stringFormat && Str_startsWith(stringFormat, "xml") ? "xml" : stringFormat && Str_startsWith(stringFormat, "json") ? "json" : "text";
+        W->level = level;
+}
+
+
 static void is_monit_running(HttpRequest req, HttpResponse res) {
         set_status(res, exist_daemon() ? SC_OK : SC_GONE);
 }
@@ -290,10 +506,14 @@ static void printFavicon(HttpResponse res) {
         Socket_T S = res->S;
         static unsigned char *favicon = NULL;
 
-        if (! favicon) {
-                favicon = CALLOC(sizeof(unsigned char), strlen(FAVICON_ICO));
-                l = decode_base64(favicon, FAVICON_ICO);
+        LOCK(mutex)
+        {
+                if (! favicon) {
+                        favicon = CALLOC(sizeof(unsigned char), strlen(FAVICON_ICO));
+                        l = decode_base64(favicon, FAVICON_ICO);
+                }
         }
+        END_LOCK;
         if (l) {
                 res->is_committed = true;
                 Socket_print(S, "HTTP/1.0 200 OK\r\n");
@@ -401,6 +621,8 @@ static void do_home(HttpRequest req, HttpResponse res) {
         do_home_fifo(req, res);
         do_home_directory(req, res);
         do_home_net(req, res);
+        do_home_cgroup(req, res);
+        do_home_processes(req, res);
         do_home_host(req, res);
 
         do_foot(res);
@@ -440,6 +662,12 @@ static void do_getid(HttpRequest req, HttpResponse res) {
         StringBuffer_append(res->outputbuffer, "%s", Run.id);
 }
 
+
+static void do_cluster(HttpRequest req, HttpResponse res) {
+        set_content_type(res, "text/plain");
+        Cluster_status(res->outputbuffer);
+}
+
 static void do_runtime(HttpRequest req, HttpResponse res) {
         int pid =  exist_daemon();
 
@@ -500,6 +728,13 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
                 }
                 printf("\n");
         }
+        if (Run.dnscache > 0) {
+                ResolverStats_T stats = Resolver_stats();
+                StringBuffer_append(res->outputbuffer,
+                                    "<tr><td>DNS cache</td>"
+                                    "<td>max age %d seconds, %d entries, %llu hits, %llu negative hits, %llu misses</td></tr>",
+                                    Run.dnscache, stats.entries, stats.hits, stats.negative, stats.misses);
+        }
         if (Run.mailservers) {
                 StringBuffer_append(res->outputbuffer, "<tr><td>Mail server(s)</td><td>");
                 for (MailServer_T mta = Run.mailservers; mta; mta = mta->next)
@@ -528,7 +763,8 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
                                     Run.httpd.socket.net.address ? Run.httpd.socket.net.address : "Any/All");
                 StringBuffer_append(res->outputbuffer,
                                     "<tr><td>httpd portnumber</td><td>%d</td></tr>", Run.httpd.socket.net.port);
-        } else if (Run.httpd.flags & Httpd_Unix) {
+        }
+        if (Run.httpd.flags & Httpd_Unix) {
                 StringBuffer_append(res->outputbuffer,
                                     "<tr><td>httpd unix socket</td><td>%s</td></tr>",
                                     Run.httpd.socket.unix.path);
@@ -563,6 +799,46 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
                             "<tr><td>httpd auth. style</td><td>%s</td></tr>",
                             Run.httpd.credentials && Engine_hasHostsAllow() ? "Basic Authentication and Host/Net allow list" : Run.httpd.credentials ? "Basic Authentication" : Engine_hasHostsAllow() ? "Host/Net allow list" : "No authentication");
         print_alerts(res, Run.maillist);
+        StringBuffer_append(res->outputbuffer,
+                            "<tr><td>Check cycle overruns</td><td>%llu</td></tr>", Run.latency.overruns);
+        StringBuffer_append(res->outputbuffer,
+                            "<tr><td>Event delivery queue</td><td>%d waiting, %d peak</td></tr>", Run.latency.deliveries, Run.latency.deliveries_peak);
+        StringBuffer_append(res->outputbuffer,
+                            "<tr><td>Last cycle resource usage</td><td>%.3fs user, %.3fs system, %ld kB max RSS, %ld page faults, %ld context switches, %ld block I/O operations</td></tr>",
+                            Run.latency.usage.cpuuser / 1000000., Run.latency.usage.cpusystem / 1000000., Run.latency.usage.maxrss, Run.latency.usage.faults, Run.latency.usage.switches, Run.latency.usage.blockio);
+        StringBuffer_append(res->outputbuffer,
+                            "<tr><td>Monit footprint</td><td>%.1f%% CPU, %ld kB RSS, %d file descriptors, %.2f requests/s",
+                            Run.latency.usage.cpupercent / 10., Run.latency.usage.rss, Run.latency.usage.fds, Run.latency.usage.requestrate);
+        if (Run.latency.usage.heap >= 0)
+                StringBuffer_append(res->outputbuffer, ", %lld B heap (%+lld B in the last cycle)", Run.latency.usage.heap, Run.latency.usage.heapgrowth);
+        StringBuffer_append(res->outputbuffer, "</td></tr>");
+        StringBuffer_append(res->outputbuffer, "<tr><td>Last cycle CPU by subsystem</td><td>");
+        for (int i = 0; i < Cost_Types; i++)
+                StringBuffer_append(res->outputbuffer, "%s%s %.3fs", i ? ", " : "", Latency_costName(i), Run.latency.usage.cost[i] / 1000000.);
+        StringBuffer_append(res->outputbuffer, "</td></tr>");
+        StringBuffer_append(res->outputbuffer,
+                            "<tr><td>Event queue</td><td>%d events, %llu B on disk</td></tr>", Run.latency.usage.queue, Run.latency.usage.queuesize);
+        StringBuffer_append(res->outputbuffer, "</table>");
+        StringBuffer_append(res->outputbuffer,
+                            "<h2>Check latency</h2>"
+                            "<table id='status-table'><tr>"
+                            "<th width='30%%'>Service</th>"
+                            "<th width='20%%'>Test</th>"
+                            "<th width='10%%'>Count</th>"
+                            "<th width='10%%'>Min</th>"
+                            "<th width='10%%'>Avg</th>"
+                            "<th width='10%%'>P99</th>"
+                            "<th width='10%%'>Max</th></tr>");
+        print_latency(res, "Monit", "cycle", &Run.latency.cycle);
+        print_latency(res, "Monit", "process tree", &Run.latency.processtree);
+        print_latency(res, "Monit", "event", &Run.latency.event);
+        print_latency(res, "Monit", "http request", &Run.latency.request);
+        print_latency(res, "Monit", "M/Monit report", &Run.latency.report);
+        print_latency(res, "Monit", "event delivery", &Run.latency.delivery);
+        for (Service_T s = servicelist_conf; s; s = s->next_conf)
+                for (int i = 0; i < Latency_Types; i++)
+                        if (s->latency[i] && s->latency[i]->count)
+                                print_latency(res, s->name, Latency_name(i), s->latency[i]);
         StringBuffer_append(res->outputbuffer, "</table>");
         if (! is_readonly(req)) {
                 StringBuffer_append(res->outputbuffer,
@@ -585,6 +861,15 @@ static void do_runtime(HttpRequest req, HttpResponse res) {
 }
 
 
+static void print_latency(HttpResponse res, const char *name, const char *test, Latency_T L) {
+        StringBuffer_append(res->outputbuffer,
+                            "<tr><td>%s</td><td>%s</td><td>%llu</td>"
+                            "<td>%.3f&nbsp;ms</td><td>%.3f&nbsp;ms</td><td>%.3f&nbsp;ms</td><td>%.3f&nbsp;ms</td></tr>",
+                            name, test, L->count,
+                            L->min / 1000., Latency_average(L) / 1000., Latency_percentile(L, 99) / 1000., L->max / 1000.);
+}
+
+
 static void do_viewlog(HttpRequest req, HttpResponse res) {
         if (is_readonly(req)) {
                 send_error(res, SC_FORBIDDEN, "You do not have sufficent privileges to access this page");
@@ -599,10 +884,26 @@ static void do_viewlog(HttpRequest req, HttpResponse res) {
 #define BUFSIZE 512
                                 size_t n;
                                 char buf[BUFSIZE+1];
+                                /* Optionally show only the log starting at the given offset or the last tail bytes */
+                                const char *offset = get_parameter(req, "offset");
+                                const char *tail = get_parameter(req, "tail");
+                                long long start = 0;
+                                if (tail && strtoll(tail, NULL, 10) > 0)
+                                        start = (long long)sb.st_size - strtoll(tail, NULL, 10);
+                                else if (offset)
+                                        start = strtoll(offset, NULL, 10);
+                                if (start > 0 && start < (long long)sb.st_size && fseek(f, (long)start, SEEK_SET) == 0 && tail) {
+                                        /* Skip the partial first line */
+                                        int c;
+                                        while ((c = fgetc(f)) != EOF && c != '\n')
+                                                ;
+                                }
                                 StringBuffer_append(res->outputbuffer, "<br><p><form><textarea cols=120 rows=30 readonly>");
+                                stream_response(res);
                                 while ((n = fread(buf, sizeof(char), BUFSIZE, f)) > 0) {
                                         buf[n] = 0;
                                         StringBuffer_append(res->outputbuffer, "%s", buf);
+                                        flush_response(res);
                                 }
                                 fclose(f);
                                 StringBuffer_append(res->outputbuffer, "</textarea></form>");
@@ -654,17 +955,41 @@ static void handle_action(HttpRequest req, HttpResponse res) {
                 }
                 LogInfo("'%s' %s on user request\n", s->name, action);
                 Run.doaction = true; /* set the global flag */
+                /* The pending action is part of the status */
+                status_xml_reset();
                 do_wakeupcall();
+        } else if (is_current(req, res, "service")) {
+                return;
         }
         do_service(req, res, s);
 }
 
 
+/**
+ * Add the service to the action batch. All services are checked before
+ * any action is set, so the batch is either queued as a whole or refused
+ * @return true if succeeded, otherwise false (the error was sent)
+ */
+static boolean_t _batchService(HttpResponse res, Service_T *batch, int *count, int size, Service_T s) {
+        if (s->doaction != Action_Ignored) {
+                send_error(res, SC_SERVICE_UNAVAILABLE, "Other action already in progress -- please try again later");
+                return false;
+        }
+        for (int i = 0; i < *count; i++)
+                if (batch[i] == s)
+                        return true;
+        if (*count < size)
+                batch[(*count)++] = s;
+        return true;
+}
+
+
 static void handle_do_action(HttpRequest req, HttpResponse res) {
         Service_T s;
         Action_Type doaction = Action_Ignored;
         const char *action = get_parameter(req, "action");
         const char *token = get_parameter(req, "token");
+        const char *group = get_parameter(req, "group");
 
         if (action) {
                 if (is_readonly(req)) {
@@ -675,23 +1000,43 @@ static void handle_do_action(HttpRequest req, HttpResponse res) {
                         send_error(res, SC_BAD_REQUEST, "Invalid action \"%s\"", action);
                         return;
                 }
+                /* The services are given by name, by the group name or all services at once */
+                int count = 0, size = Util_getNumberOfServices();
+                Service_T *batch = CALLOC(size ? size : 1, sizeof(Service_T));
+                if (get_parameter(req, "all")) {
+                        for (s = servicelist; s; s = s->next)
+                                if (! _batchService(res, batch, &count, size, s))
+                                        goto error;
+                } else if (group) {
+                        ServiceGroup_T sg;
+                        for (sg = servicegrouplist; sg; sg = sg->next)
+                                if (IS(sg->name, group))
+                                        break;
+                        if (! sg) {
+                                send_error(res, SC_BAD_REQUEST, "There is no group named \"%s\"", group);
+                                goto error;
+                        }
+                        for (ServiceGroupMember_T sgm = sg->members; sgm; sgm = sgm->next)
+                                if ((s = Util_getService(sgm->name)) && ! _batchService(res, batch, &count, size, s))
+                                        goto error;
+                }
                 for (HttpParameter p = req->params; p; p = p->next) {
                         if (IS(p->name, "service")) {
                                 s  = Util_getService(p->value);
                                 if (! s) {
                                         send_error(res, SC_BAD_REQUEST, "There is no service named \"%s\"", p->value ? p->value : "");
-                                        return;
-                                }
-                                if (s->doaction != Action_Ignored) {
-                                        send_error(res, SC_SERVICE_UNAVAILABLE, "Other action already in progress -- please try again later");
-                                        return;
+                                        goto error;
                                 }
-                                s->doaction = doaction;
-                                LogInfo("'%s' %s on user request\n", s->name, action);
+                                if (! _batchService(res, batch, &count, size, s))
+                                        goto error;
                         }
                 }
+                for (int i = 0; i < count; i++) {
+                        batch[i]->doaction = doaction;
+                        LogInfo("'%s' %s on user request\n", batch[i]->name, action);
+                }
                 /* Set token for last service only so we'll get it back after all services were handled */
-                if (token) {
+                if (token && count) {
                         Service_T q = NULL;
                         for (s = servicelist; s; s = s->next)
                                 if (s->doaction == doaction)
@@ -701,12 +1046,45 @@ static void handle_do_action(HttpRequest req, HttpResponse res) {
                                 q->token = Str_dup(token);
                         }
                 }
-                Run.doaction = true;
-                do_wakeupcall();
+                /* The scheduler is notified once for the whole batch */
+                if (count) {
+                        Run.doaction = true;
+                        status_xml_reset();
+                        do_wakeupcall();
+                }
+        error:
+                FREE(batch);
         }
 }
 
 
+/**
+ * Receive the M/Monit message of another Monit instance (see relay.h). The
+ * agent is asked to send the full status report, so its next status can
+ * replace the pending one. The compressed messages are refused, the agent
+ * sends them again uncompressed
+ */
+static void handle_relay(HttpRequest req, HttpResponse res) {
+        const char *encoding = get_header(req, "Content-Encoding");
+        if (encoding && ! IS(encoding, "identity")) {
+                send_error(res, SC_UNSUPPORTED_MEDIA_TYPE, "The relay accepts uncompressed messages only");
+                return;
+        }
+        if (req->body > RELAY_MESSAGE_MAX) {
+                send_error(res, SC_REQUEST_ENTITY_TOO_LARGE, "The message is too large");
+                return;
+        }
+        int length;
+        char *data = get_body(req, RELAY_MESSAGE_MAX, &length);
+        if (! data) {
+                send_error(res, SC_BAD_REQUEST, "Cannot read the message");
+                return;
+        }
+        Relay_receive(get_header(req, "Content-Type"), data, length, Socket_getRemoteHost(req->S));
+        set_header(res, "X-Monit-Report", "full");
+}
+
+
 static void handle_run(HttpRequest req, HttpResponse res) {
         const char *action = get_parameter(req, "action");
         if (action) {
@@ -749,12 +1127,14 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
                             "</tr>",
                             servicetypes[s->type],
                             s->name);
-        if (s->type == Service_Process)
+        if (s->type == Service_Process || s->type == Service_Processes)
                 StringBuffer_append(res->outputbuffer, "<tr><td>%s</td><td>%s</td></tr>", s->matchlist ? "Match" : "Pid file", s->path);
         else if (s->type == Service_Host)
                 StringBuffer_append(res->outputbuffer, "<tr><td>Address</td><td>%s</td></tr>", s->path);
         else if (s->type == Service_Net)
                 StringBuffer_append(res->outputbuffer, "<tr><td>Interface</td><td>%s</td></tr>", s->path);
+        else if (s->type == Service_Cgroup)
+                StringBuffer_append(res->outputbuffer, "<tr><td>Cgroup</td><td>%s</td></tr>", s->path);
         else if (s->type != Service_System)
                 StringBuffer_append(res->outputbuffer, "<tr><td>Path</td><td>%s</td></tr>", s->path);
         StringBuffer_append(res->outputbuffer, "<tr><td>Status</td><td>");
@@ -826,10 +1206,12 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
                 StringBuffer_append(res->outputbuffer, "<tr><td>Check service</td><td>");
                 if (s->every.type == Every_SkipCycles)
                         StringBuffer_append(res->outputbuffer, "every %d cycle", s->every.spec.cycle.number);
+                else if (s->every.type == Every_Interval)
+                        StringBuffer_append(res->outputbuffer, "every %d seconds", s->every.spec.interval.seconds);
                 else if (s->every.type == Every_Cron)
-                        StringBuffer_append(res->outputbuffer, "every <code>\"%s\"</code>", s->every.spec.cron);
+                        StringBuffer_append(res->outputbuffer, "every <code>\"%s\"</code>", s->every.spec.cron.spec);
                 else if (s->every.type == Every_NotInCron)
-                        StringBuffer_append(res->outputbuffer, "not every <code>\"%s\"</code>", s->every.spec.cron);
+                        StringBuffer_append(res->outputbuffer, "not every <code>\"%s\"</code>", s->every.spec.cron.spec);
                 StringBuffer_append(res->outputbuffer, "</td></tr>");
         }
         // Status
@@ -845,21 +1227,26 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
                         print_service_status_filesystem_blocksize(res, s);
                         print_service_status_filesystem_inodestotal(res, s);
                         print_service_status_filesystem_inodesfree(res, s);
+                        print_service_status_instances(res, s);
                         break;
                 case Service_Directory:
                         print_service_status_perm(res, s, s->inf->priv.directory.mode);
                         print_service_status_uid(res, s, s->inf->priv.directory.uid);
                         print_service_status_gid(res, s, s->inf->priv.directory.gid);
                         print_service_status_timestamp(res, s, s->inf->priv.directory.timestamp);
+                        print_service_status_file_checksum(res, s);
                         break;
                 case Service_File:
-                        print_service_status_perm(res, s, s->inf->priv.file.mode);
-                        print_service_status_uid(res, s, s->inf->priv.file.uid);
-                        print_service_status_gid(res, s, s->inf->priv.file.gid);
-                        print_service_status_timestamp(res, s, s->inf->priv.file.timestamp);
-                        print_service_status_file_size(res, s);
+                        if (! s->instance.max) {
+                                print_service_status_perm(res, s, s->inf->priv.file.mode);
+                                print_service_status_uid(res, s, s->inf->priv.file.uid);
+                                print_service_status_gid(res, s, s->inf->priv.file.gid);
+                                print_service_status_timestamp(res, s, s->inf->priv.file.timestamp);
+                                print_service_status_file_size(res, s);
+                        }
                         print_service_status_file_match(res, s);
                         print_service_status_file_checksum(res, s);
+                        print_service_status_instances(res, s);
                         break;
                 case Service_Process:
                         print_service_status_process_pid(res, s);
@@ -873,6 +1260,9 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
                         print_service_status_process_cputotal(res, s);
                         print_service_status_process_memory(res, s);
                         print_service_status_process_memorytotal(res, s);
+                        print_service_status_process_resources(res, s);
+                        print_service_status_cgroup(res, s);
+                        print_service_status_instances(res, s);
                         print_service_status_port(res, s);
                         print_service_status_socket(res, s);
                         break;
@@ -883,6 +1273,7 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
                 case Service_System:
                         print_service_status_system_loadavg(res, s);
                         print_service_status_system_cpu(res, s);
+                        print_service_status_system_cpumax(res, s);
                         print_service_status_system_memory(res, s);
                         print_service_status_system_swap(res, s);
                         break;
@@ -896,12 +1287,21 @@ static void do_service(HttpRequest req, HttpResponse res, Service_T s) {
                         print_service_status_program_started(res, s);
                         print_service_status_program_status(res, s);
                         print_service_status_program_output(res, s);
+                        print_service_status_plugin_metrics(res, s);
                         break;
                 case Service_Net:
                         print_service_status_link(res, s);
                         print_service_status_download(res, s);
                         print_service_status_upload(res, s);
                         break;
+                case Service_Cgroup:
+                        print_service_status_process_cpu(res, s);
+                        print_service_status_process_memory(res, s);
+                        print_service_status_cgroup(res, s);
+                        break;
+                case Service_Processes:
+                        print_service_status_processes(res, s);
+                        break;
                 default:
                         break;
         }
@@ -996,8 +1396,45 @@ static void do_home_system(HttpRequest req, HttpResponse res) {
 }
 
 
+static void do_home_process_row(StringBuffer_T B, Service_T s) {
+        char buf[STRLEN];
+
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B,
+                                    "<td align='right'>-</td>");
+                if (Run.doprocess) {
+                        StringBuffer_append(B,
+                                            "<td align='right'>-</td>"
+                                            "<td align='right'>-</td>");
+                }
+        } else {
+                char *uptime = Util_getUptime(s->inf->priv.process.uptime, "&nbsp;");
+                StringBuffer_append(B,
+                                    "<td align='right'>%s</td>", uptime);
+                FREE(uptime);
+                if (Run.doprocess) {
+                        StringBuffer_append(B,
+                                            "<td align='right' class='%s'>%.1f%%</td>",
+                                            (s->error & Event_Resource) ? "red-text" : "",
+                                            s->inf->priv.process.total_cpu_percent/10.0);
+                        StringBuffer_append(B,
+                                            "<td align='right' class='%s'>%.1f%% [%s]</td>",
+                                            (s->error & Event_Resource) ? "red-text" : "",
+                                            s->inf->priv.process.total_mem_percent/10.0, Str_bytesToSize(s->inf->priv.process.total_mem_kbyte * 1024., buf));
+                }
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
 static void do_home_process(HttpRequest req, HttpResponse res) {
-        char      buf[STRLEN];
         boolean_t on = true;
         boolean_t header = true;
 
@@ -1019,40 +1456,7 @@ static void do_home_process(HttpRequest req, HttpResponse res) {
                         StringBuffer_append(res->outputbuffer, "</tr>");
                         header = false;
                 }
-                StringBuffer_append(res->outputbuffer,
-                                    "<tr %s>"
-                                    "<td align='left'><a href='%s'>%s</a></td>"
-                                    "<td align='left'>",
-                                    on ? "class='stripe'" : "",
-                                    s->name, s->name);
-                _printServiceStatus(res->outputbuffer, s);
-                StringBuffer_append(res->outputbuffer,
-                                    "</td>");
-                if (! Util_hasServiceStatus(s)) {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>-</td>");
-                        if (Run.doprocess) {
-                                StringBuffer_append(res->outputbuffer,
-                                                    "<td align='right'>-</td>"
-                                                    "<td align='right'>-</td>");
-                        }
-                } else {
-                        char *uptime = Util_getUptime(s->inf->priv.process.uptime, "&nbsp;");
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>%s</td>", uptime);
-                        FREE(uptime);
-                        if (Run.doprocess) {
-                                StringBuffer_append(res->outputbuffer,
-                                                    "<td align='right' class='%s'>%.1f%%</td>",
-                                                    (s->error & Event_Resource) ? "red-text" : "",
-                                                    s->inf->priv.process.total_cpu_percent/10.0);
-                                StringBuffer_append(res->outputbuffer,
-                                                    "<td align='right' class='%s'>%.1f%% [%s]</td>",
-                                                    (s->error & Event_Resource) ? "red-text" : "",
-                                                    s->inf->priv.process.total_mem_percent/10.0, Str_bytesToSize(s->inf->priv.process.total_mem_kbyte * 1024., buf));
-                        }
-                }
-                StringBuffer_append(res->outputbuffer, "</tr>");
+                print_home_row(res, s, on, do_home_process_row);
                 on = ! on;
         }
         if (! header)
@@ -1060,6 +1464,43 @@ static void do_home_process(HttpRequest req, HttpResponse res) {
 }
 
 
+static void do_home_program_row(StringBuffer_T B, Service_T s) {
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B, "<td align='left'>-</td>");
+                StringBuffer_append(B, "<td align='right'>-</td>");
+                StringBuffer_append(B, "<td align='right'>-</td>");
+        } else {
+                if (s->program->started) {
+                        StringBuffer_append(B, "<td align='left' class='short'>");
+                        if (StringBuffer_length(s->program->output)) {
+                                // Print first line only (escape HTML characters if any)
+                                const char *output = StringBuffer_toString(s->program->output);
+                                char *line = Str_ndup(output, (int)strcspn(output, "\r\n"));
+                                Output_escape(B, line, Output_Html);
+                                FREE(line);
+                        } else {
+                                StringBuffer_append(B, "no output");
+                        }
+                        StringBuffer_append(B, "</td>");
+                        StringBuffer_append(B, "<td align='right'>%s</td>", Time_fmt((char[32]){}, 32, "%d %b %Y %H:%M:%S", s->program->started));
+                        StringBuffer_append(B, "<td align='right'>%d</td>", s->program->exitStatus);
+                } else {
+                        StringBuffer_append(B, "<td align='right'>N/A</td>");
+                        StringBuffer_append(B, "<td align='right'>Not yet started</td>");
+                        StringBuffer_append(B, "<td align='right'>N/A</td>");
+                }
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
 static void do_home_program(HttpRequest req, HttpResponse res) {
         boolean_t on = true;
         boolean_t header = true;
@@ -1079,50 +1520,7 @@ static void do_home_program(HttpRequest req, HttpResponse res) {
                                             "</tr>");
                         header = false;
                 }
-                StringBuffer_append(res->outputbuffer,
-                                    "<tr %s>"
-                                    "<td align='left'><a href='%s'>%s</a></td>"
-                                    "<td align='left'>",
-                                    on ? "class='stripe'" : "",
-                                    s->name, s->name);
-                _printServiceStatus(res->outputbuffer, s);
-                StringBuffer_append(res->outputbuffer,
-                                    "</td>");
-                if (! Util_hasServiceStatus(s)) {
-                        StringBuffer_append(res->outputbuffer, "<td align='left'>-</td>");
-                        StringBuffer_append(res->outputbuffer, "<td align='right'>-</td>");
-                        StringBuffer_append(res->outputbuffer, "<td align='right'>-</td>");
-                } else {
-                        if (s->program->started) {
-                                StringBuffer_append(res->outputbuffer, "<td align='left' class='short'>");
-                                if (StringBuffer_length(s->program->output)) {
-                                        // Print first line only (escape HTML characters if any)
-                                        const char *output = StringBuffer_toString(s->program->output);
-                                        for (int i = 0; output[i]; i++) {
-                                                if (output[i] == '<')
-                                                        StringBuffer_append(res->outputbuffer, "&lt;");
-                                                else if (output[i] == '>')
-                                                        StringBuffer_append(res->outputbuffer, "&gt;");
-                                                else if (output[i] == '&')
-                                                        StringBuffer_append(res->outputbuffer, "&amp;");
-                                                else if (output[i] == '\r' || output[i] == '\n')
-                                                        break;
-                                                else
-                                                        StringBuffer_append(res->outputbuffer, "%c", output[i]);
-                                        }
-                                } else {
-                                        StringBuffer_append(res->outputbuffer, "no output");
-                                }
-                                StringBuffer_append(res->outputbuffer, "</td>");
-                                StringBuffer_append(res->outputbuffer, "<td align='right'>%s</td>", Time_fmt((char[32]){}, 32, "%d %b %Y %H:%M:%S", s->program->started));
-                                StringBuffer_append(res->outputbuffer, "<td align='right'>%d</td>", s->program->exitStatus);
-                        } else {
-                                StringBuffer_append(res->outputbuffer, "<td align='right'>N/A</td>");
-                                StringBuffer_append(res->outputbuffer, "<td align='right'>Not yet started</td>");
-                                StringBuffer_append(res->outputbuffer, "<td align='right'>N/A</td>");
-                        }
-                }
-                StringBuffer_append(res->outputbuffer, "</tr>");
+                print_home_row(res, s, on, do_home_program_row);
                 on = ! on;
         }
         if (! header)
@@ -1131,8 +1529,29 @@ static void do_home_program(HttpRequest req, HttpResponse res) {
 }
 
 
-static void do_home_net(HttpRequest req, HttpResponse res) {
+static void do_home_net_row(StringBuffer_T B, Service_T s) {
         char buf[STRLEN];
+
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+
+        if (! Util_hasServiceStatus(s) || Link_getState(s->inf->priv.net.stats) != 1) {
+                StringBuffer_append(B, "<td align='right'>-</td>");
+                StringBuffer_append(B, "<td align='right'>-</td>");
+        } else {
+                StringBuffer_append(B, "<td align='right'>%s&#47;s</td>", Str_bytesToSize(Link_getBytesOutPerSecond(s->inf->priv.net.stats), buf));
+                StringBuffer_append(B, "<td align='right'>%s&#47;s</td>", Str_bytesToSize(Link_getBytesInPerSecond(s->inf->priv.net.stats), buf));
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
+static void do_home_net(HttpRequest req, HttpResponse res) {
         boolean_t on = true;
         boolean_t header = true;
 
@@ -1150,24 +1569,57 @@ static void do_home_net(HttpRequest req, HttpResponse res) {
                                             "</tr>");
                         header = false;
                 }
-                StringBuffer_append(res->outputbuffer,
-                                    "<tr %s>"
-                                    "<td align='left'><a href='%s'>%s</a></td>"
-                                    "<td align='left'>",
-                                    on ? "class='stripe'" : "",
-                                    s->name, s->name);
-                _printServiceStatus(res->outputbuffer, s);
-                StringBuffer_append(res->outputbuffer,
-                                    "</td>");
+                print_home_row(res, s, on, do_home_net_row);
+                on = ! on;
+        }
+        if (! header)
+                StringBuffer_append(res->outputbuffer, "</table>");
+}
 
-                if (! Util_hasServiceStatus(s) || Link_getState(s->inf->priv.net.stats) != 1) {
-                        StringBuffer_append(res->outputbuffer, "<td align='right'>-</td>");
-                        StringBuffer_append(res->outputbuffer, "<td align='right'>-</td>");
-                } else {
-                        StringBuffer_append(res->outputbuffer, "<td align='right'>%s&#47;s</td>", Str_bytesToSize(Link_getBytesOutPerSecond(s->inf->priv.net.stats), buf));
-                        StringBuffer_append(res->outputbuffer, "<td align='right'>%s&#47;s</td>", Str_bytesToSize(Link_getBytesInPerSecond(s->inf->priv.net.stats), buf));
+
+static void do_home_cgroup_row(StringBuffer_T B, Service_T s) {
+        char buf[STRLEN];
+
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B, "<td align='right'>-</td>");
+                StringBuffer_append(B, "<td align='right'>-</td>");
+                StringBuffer_append(B, "<td align='right'>-</td>");
+        } else {
+                StringBuffer_append(B, "<td align='right'>%d</td>", s->cgroup->tasks > 0 ? s->cgroup->tasks : 0);
+                StringBuffer_append(B, "<td align='right' class='%s'>%.1f%%</td>", (s->error & Event_Resource) ? "red-text" : "", s->cgroup->cpu_percent > 0 ? s->cgroup->cpu_percent/10.0 : 0.);
+                StringBuffer_append(B, "<td align='right' class='%s'>%.1f%% [%s]</td>", (s->error & Event_Resource) ? "red-text" : "", s->cgroup->mem_percent/10.0, Str_bytesToSize(s->cgroup->mem_kbyte * 1024., buf));
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
+static void do_home_cgroup(HttpRequest req, HttpResponse res) {
+        boolean_t on = true;
+        boolean_t header = true;
+
+        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+                if (s->type != Service_Cgroup)
+                        continue;
+                if (header) {
+                        StringBuffer_append(res->outputbuffer,
+                                            "<table id='header-row'>"
+                                            "<tr>"
+                                            "<th align='left' class='first'>Cgroup</th>"
+                                            "<th align='left'>Status</th>"
+                                            "<th align='right'>Tasks</th>"
+                                            "<th align='right'>CPU</th>"
+                                            "<th align='right'>Memory</th>"
+                                            "</tr>");
+                        header = false;
                 }
-                StringBuffer_append(res->outputbuffer, "</tr>");
+                print_home_row(res, s, on, do_home_cgroup_row);
                 on = ! on;
         }
         if (! header)
@@ -1175,8 +1627,85 @@ static void do_home_net(HttpRequest req, HttpResponse res) {
 }
 
 
-static void do_home_filesystem(HttpRequest req, HttpResponse res) {
+static void do_home_processes_row(StringBuffer_T B, Service_T s) {
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B, "<td align='right'>-</td>");
+                StringBuffer_append(B, "<td align='right'>-</td>");
+        } else {
+                StringBuffer_append(B, "<td align='right'>%d</td>", s->processes->matched);
+                StringBuffer_append(B, "<td align='right' class='%s'>%d</td>", s->processes->offenders ? "red-text" : "", s->processes->offenders);
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
+static void do_home_processes(HttpRequest req, HttpResponse res) {
+        boolean_t on = true;
+        boolean_t header = true;
+
+        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+                if (s->type != Service_Processes)
+                        continue;
+                if (header) {
+                        StringBuffer_append(res->outputbuffer,
+                                            "<table id='header-row'>"
+                                            "<tr>"
+                                            "<th align='left' class='first'>Processes</th>"
+                                            "<th align='left'>Status</th>"
+                                            "<th align='right'>Matching</th>"
+                                            "<th align='right'>Above limit</th>"
+                                            "</tr>");
+                        header = false;
+                }
+                print_home_row(res, s, on, do_home_processes_row);
+                on = ! on;
+        }
+        if (! header)
+                StringBuffer_append(res->outputbuffer, "</table>");
+}
+
+
+static void do_home_filesystem_row(StringBuffer_T B, Service_T s) {
         char buf[STRLEN];
+
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B,
+                                    "<td align='right'>- [-]</td>"
+                                    "<td align='right'>- [-]</td>");
+        } else {
+                StringBuffer_append(B,
+                                    "<td align='right'>%.1f%% [%s]</td>",
+                                    s->inf->priv.filesystem.space_percent/10.,
+                                    s->inf->priv.filesystem.f_bsize > 0 ? Str_bytesToSize(s->inf->priv.filesystem.space_total * s->inf->priv.filesystem.f_bsize, buf) : "0 MB");
+                if (s->inf->priv.filesystem.f_files > 0) {
+                        StringBuffer_append(B,
+                                            "<td align='right'>%.1f%% [%lld objects]</td>",
+                                            s->inf->priv.filesystem.inode_percent/10.,
+                                            s->inf->priv.filesystem.inode_total);
+                } else {
+                        StringBuffer_append(B,
+                                            "<td align='right'>not supported by filesystem</td>");
+                }
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
+static void do_home_filesystem(HttpRequest req, HttpResponse res) {
         boolean_t on = true;
         boolean_t header = true;
 
@@ -1194,35 +1723,7 @@ static void do_home_filesystem(HttpRequest req, HttpResponse res) {
                                             "</tr>");
                         header = false;
                 }
-                StringBuffer_append(res->outputbuffer,
-                                    "<tr %s>"
-                                    "<td align='left'><a href='%s'>%s</a></td>"
-                                    "<td align='left'>",
-                                    on ? "class='stripe'" : "",
-                                    s->name, s->name);
-                _printServiceStatus(res->outputbuffer, s);
-                StringBuffer_append(res->outputbuffer,
-                                    "</td>");
-                if (! Util_hasServiceStatus(s)) {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>- [-]</td>"
-                                            "<td align='right'>- [-]</td>");
-                } else {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>%.1f%% [%s]</td>",
-                                            s->inf->priv.filesystem.space_percent/10.,
-                                            s->inf->priv.filesystem.f_bsize > 0 ? Str_bytesToSize(s->inf->priv.filesystem.space_total * s->inf->priv.filesystem.f_bsize, buf) : "0 MB");
-                        if (s->inf->priv.filesystem.f_files > 0) {
-                                StringBuffer_append(res->outputbuffer,
-                                                    "<td align='right'>%.1f%% [%lld objects]</td>",
-                                                    s->inf->priv.filesystem.inode_percent/10.,
-                                                    s->inf->priv.filesystem.inode_total);
-                        } else {
-                                StringBuffer_append(res->outputbuffer,
-                                                    "<td align='right'>not supported by filesystem</td>");
-                        }
-                }
-                StringBuffer_append(res->outputbuffer, "</tr>");
+                print_home_row(res, s, on, do_home_filesystem_row);
                 on = ! on;
         }
         if (! header)
@@ -1230,6 +1731,36 @@ static void do_home_filesystem(HttpRequest req, HttpResponse res) {
 }
 
 
+static void do_home_file_row(StringBuffer_T B, Service_T s) {
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B,
+                                    "<td align='right'>-</td>"
+                                    "<td align='right'>-</td>"
+                                    "<td align='right'>-</td>"
+                                    "<td align='right'>-</td>");
+        } else {
+                char buf[STRLEN];
+                StringBuffer_append(B,
+                                    "<td align='right'>%s</td>"
+                                    "<td align='right'>%04o</td>"
+                                    "<td align='right'>%d</td>"
+                                    "<td align='right'>%d</td>",
+                                    Str_bytesToSize(s->inf->priv.file.size, buf),
+                                    s->inf->priv.file.mode & 07777,
+                                    s->inf->priv.file.uid,
+                                    s->inf->priv.file.gid);
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
 static void do_home_file(HttpRequest req, HttpResponse res) {
         boolean_t on = true;
         boolean_t header = true;
@@ -1251,34 +1782,7 @@ static void do_home_file(HttpRequest req, HttpResponse res) {
 
                         header = false;
                 }
-                StringBuffer_append(res->outputbuffer,
-                                    "<tr %s>"
-                                    "<td align='left'><a href='%s'>%s</a></td>"
-                                    "<td align='left'>",
-                                    on ? "class='stripe'" : "",
-                                    s->name, s->name);
-                _printServiceStatus(res->outputbuffer, s);
-                StringBuffer_append(res->outputbuffer,
-                                    "</td>");
-                if (! Util_hasServiceStatus(s)) {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>-</td>"
-                                            "<td align='right'>-</td>"
-                                            "<td align='right'>-</td>"
-                                            "<td align='right'>-</td>");
-                } else {
-                        char buf[STRLEN];
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>%s</td>"
-                                            "<td align='right'>%04o</td>"
-                                            "<td align='right'>%d</td>"
-                                            "<td align='right'>%d</td>",
-                                            Str_bytesToSize(s->inf->priv.file.size, buf),
-                                            s->inf->priv.file.mode & 07777,
-                                            s->inf->priv.file.uid,
-                                            s->inf->priv.file.gid);
-                }
-                StringBuffer_append(res->outputbuffer, "</tr>");
+                print_home_row(res, s, on, do_home_file_row);
                 on = ! on;
         }
         if (! header)
@@ -1286,6 +1790,32 @@ static void do_home_file(HttpRequest req, HttpResponse res) {
 }
 
 
+static void do_home_fifo_row(StringBuffer_T B, Service_T s) {
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B,
+                                    "<td align='right'>-</td>"
+                                    "<td align='right'>-</td>"
+                                    "<td align='right'>-</td>");
+        } else {
+                StringBuffer_append(B,
+                                    "<td align='right'>%o</td>"
+                                    "<td align='right'>%d</td>"
+                                    "<td align='right'>%d</td>",
+                                    s->inf->priv.fifo.mode & 07777,
+                                    s->inf->priv.fifo.uid,
+                                    s->inf->priv.fifo.gid);
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
 static void do_home_fifo(HttpRequest req, HttpResponse res) {
         boolean_t on = true;
         boolean_t header = true;
@@ -1305,30 +1835,7 @@ static void do_home_fifo(HttpRequest req, HttpResponse res) {
                                             "</tr>");
                         header = false;
                 }
-                StringBuffer_append(res->outputbuffer,
-                                    "<tr %s>"
-                                    "<td align='left'><a href='%s'>%s</a></td>"
-                                    "<td align='left'>",
-                                    on ? "class='stripe'" : "",
-                                    s->name, s->name);
-                _printServiceStatus(res->outputbuffer, s);
-                StringBuffer_append(res->outputbuffer,
-                                    "</td>");
-                if (! Util_hasServiceStatus(s)) {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>-</td>"
-                                            "<td align='right'>-</td>"
-                                            "<td align='right'>-</td>");
-                } else {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>%o</td>"
-                                            "<td align='right'>%d</td>"
-                                            "<td align='right'>%d</td>",
-                                            s->inf->priv.fifo.mode & 07777,
-                                            s->inf->priv.fifo.uid,
-                                            s->inf->priv.fifo.gid);
-                }
-                StringBuffer_append(res->outputbuffer, "</tr>");
+                print_home_row(res, s, on, do_home_fifo_row);
                 on = ! on;
         }
         if (! header)
@@ -1336,6 +1843,32 @@ static void do_home_fifo(HttpRequest req, HttpResponse res) {
 }
 
 
+static void do_home_directory_row(StringBuffer_T B, Service_T s) {
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B,
+                                    "<td align='right'>-</td>"
+                                    "<td align='right'>-</td>"
+                                    "<td align='right'>-</td>");
+        } else {
+                StringBuffer_append(B,
+                                    "<td align='right'>%o</td>"
+                                    "<td align='right'>%d</td>"
+                                    "<td align='right'>%d</td>",
+                                    s->inf->priv.directory.mode & 07777,
+                                    s->inf->priv.directory.uid,
+                                    s->inf->priv.directory.gid);
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
 static void do_home_directory(HttpRequest req, HttpResponse res) {
         boolean_t on = true;
         boolean_t header = true;
@@ -1346,39 +1879,16 @@ static void do_home_directory(HttpRequest req, HttpResponse res) {
                 if (header) {
                         StringBuffer_append(res->outputbuffer,
                                             "<table id='header-row'>"
-                                            "<tr>"
-                                            "<th align='left' class='first'>Directory</th>"
-                                            "<th align='left'>Status</th>"
-                                            "<th align='right'>Permission</th>"
-                                            "<th align='right'>UID</th>"
-                                            "<th align='right'>GID</th>"
-                                            "</tr>");
-                        header = false;
-                }
-                StringBuffer_append(res->outputbuffer,
-                                    "<tr %s>"
-                                    "<td align='left'><a href='%s'>%s</a></td>"
-                                    "<td align='left'>",
-                                    on ? "class='stripe'" : "",
-                                    s->name, s->name);
-                _printServiceStatus(res->outputbuffer, s);
-                StringBuffer_append(res->outputbuffer,
-                                    "</td>");
-                if (! Util_hasServiceStatus(s)) {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>-</td>"
-                                            "<td align='right'>-</td>"
-                                            "<td align='right'>-</td>");
-                } else {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>%o</td>"
-                                            "<td align='right'>%d</td>"
-                                            "<td align='right'>%d</td>",
-                                            s->inf->priv.directory.mode & 07777,
-                                            s->inf->priv.directory.uid,
-                                            s->inf->priv.directory.gid);
+                                            "<tr>"
+                                            "<th align='left' class='first'>Directory</th>"
+                                            "<th align='left'>Status</th>"
+                                            "<th align='right'>Permission</th>"
+                                            "<th align='right'>UID</th>"
+                                            "<th align='right'>GID</th>"
+                                            "</tr>");
+                        header = false;
                 }
-                StringBuffer_append(res->outputbuffer, "</tr>");
+                print_home_row(res, s, on, do_home_directory_row);
                 on = ! on;
         }
         if (! header)
@@ -1386,6 +1896,41 @@ static void do_home_directory(HttpRequest req, HttpResponse res) {
 }
 
 
+static void do_home_host_row(StringBuffer_T B, Service_T s) {
+        StringBuffer_append(B,
+                            "<td align='left'><a href='%s'>%s</a></td>"
+                            "<td align='left'>",
+                            s->name, s->name);
+        _printServiceStatus(B, s);
+        StringBuffer_append(B,
+                            "</td>");
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(B,
+                                    "<td align='right'>-</td>");
+        } else {
+                StringBuffer_append(B,
+                                    "<td align='right'>");
+                for (Icmp_T icmp = s->icmplist; icmp; icmp = icmp->next) {
+                        if (icmp != s->icmplist)
+                                StringBuffer_append(B, "&nbsp;&nbsp;<b>|</b>&nbsp;&nbsp;");
+                        StringBuffer_append(B, "<span class='%s'>[Ping]</span>",
+                                            (icmp->is_available) ? "" : "red-text");
+                }
+                if (s->icmplist && s->portlist)
+                        StringBuffer_append(B, "&nbsp;&nbsp;<b>|</b>&nbsp;&nbsp;");
+                for (Port_T port = s->portlist; port; port = port->next) {
+                        if (port != s->portlist)
+                                StringBuffer_append(B, "&nbsp;&nbsp;<b>|</b>&nbsp;&nbsp;");
+                        StringBuffer_append(B, "<span class='%s'>[%s] at port %d</span>",
+                                            (port->is_available) ? "" : "red-text",
+                                            port->protocol->name, port->port);
+                }
+                StringBuffer_append(B, "</td>");
+        }
+        StringBuffer_append(B, "</tr>");
+}
+
+
 static void do_home_host(HttpRequest req, HttpResponse res) {
         boolean_t on = true;
         boolean_t header = true;
@@ -1403,39 +1948,7 @@ static void do_home_host(HttpRequest req, HttpResponse res) {
                                             "</tr>");
                         header = false;
                 }
-                StringBuffer_append(res->outputbuffer,
-                                    "<tr %s>"
-                                    "<td align='left'><a href='%s'>%s</a></td>"
-                                    "<td align='left'>",
-                                    on ? "class='stripe'" : "",
-                                    s->name, s->name);
-                _printServiceStatus(res->outputbuffer, s);
-                StringBuffer_append(res->outputbuffer,
-                                    "</td>");
-                if (! Util_hasServiceStatus(s)) {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>-</td>");
-                } else {
-                        StringBuffer_append(res->outputbuffer,
-                                            "<td align='right'>");
-                        for (Icmp_T icmp = s->icmplist; icmp; icmp = icmp->next) {
-                                if (icmp != s->icmplist)
-                                        StringBuffer_append(res->outputbuffer, "&nbsp;&nbsp;<b>|</b>&nbsp;&nbsp;");
-                                StringBuffer_append(res->outputbuffer, "<span class='%s'>[Ping]</span>",
-                                                    (icmp->is_available) ? "" : "red-text");
-                        }
-                        if (s->icmplist && s->portlist)
-                                StringBuffer_append(res->outputbuffer, "&nbsp;&nbsp;<b>|</b>&nbsp;&nbsp;");
-                        for (Port_T port = s->portlist; port; port = port->next) {
-                                if (port != s->portlist)
-                                        StringBuffer_append(res->outputbuffer, "&nbsp;&nbsp;<b>|</b>&nbsp;&nbsp;");
-                                StringBuffer_append(res->outputbuffer, "<span class='%s'>[%s] at port %d</span>",
-                                                    (port->is_available) ? "" : "red-text",
-                                                    port->protocol->name, port->port);
-                        }
-                        StringBuffer_append(res->outputbuffer, "</td>");
-                }
-                StringBuffer_append(res->outputbuffer, "</tr>");
+                print_home_row(res, s, on, do_home_host_row);
                 on = ! on;
         }
         if (! header)
@@ -1443,6 +1956,30 @@ static void do_home_host(HttpRequest req, HttpResponse res) {
 }
 
 
+/**
+ * Print the home page row of the service. The row cells are cached and
+ * formatted again only if the service data were collected or its status
+ * changed since, so the home page with many services is assembled from
+ * the cached rows. The row opening tag is not cached as the stripe class
+ * depends on the row position
+ */
+static void print_home_row(HttpResponse res, Service_T s, boolean_t stripe, void (*row)(StringBuffer_T, Service_T)) {
+        if (! s->homerow.row || s->homerow.collected.tv_sec != s->collected.tv_sec || s->homerow.collected.tv_usec != s->collected.tv_usec || s->homerow.monitor != s->monitor || s->homerow.error != s->error || s->homerow.error_hint != s->error_hint || s->homerow.doaction != s->doaction) {
+                if (s->homerow.row)
+                        StringBuffer_clear(s->homerow.row);
+                else
+                        s->homerow.row = StringBuffer_create(256);
+                row(s->homerow.row, s);
+                s->homerow.collected = s->collected;
+                s->homerow.monitor = s->monitor;
+                s->homerow.error = s->error;
+                s->homerow.error_hint = s->error_hint;
+                s->homerow.doaction = s->doaction;
+        }
+        StringBuffer_append(res->outputbuffer, "<tr %s>%s", stripe ? "class='stripe'" : "", StringBuffer_toString(s->homerow.row));
+}
+
+
 /* ------------------------------------------------------------------------- */
 
 
@@ -1589,6 +2126,8 @@ static void print_service_rules_port(HttpResponse res, Service_T s) {
                 StringBuffer_append(res->outputbuffer, "</td></tr>");
                 if (p->SSL.certmd5 != NULL)
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Server certificate md5 sum</td><td>%s</td></tr>", p->SSL.certmd5);
+                if (p->certificate.days)
+                        StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Server certificate</td><td>If not valid more than %d days</td></tr>", p->certificate.days);
         }
 }
 
@@ -1736,6 +2275,8 @@ static void print_service_rules_size(HttpResponse res, Service_T s) {
                 StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Size</td><td>");
                 if (sl->test_changes)
                         Util_printRule(res->outputbuffer, sl->action, "If changed");
+                else if (sl->rate)
+                        Util_printRule(res->outputbuffer, sl->action, "If rate %s %llu byte(s) per %d second(s)", operatornames[sl->operator], sl->size, sl->rate);
                 else
                         Util_printRule(res->outputbuffer, sl->action, "If %s %llu byte(s)", operatornames[sl->operator], sl->size);
                 StringBuffer_append(res->outputbuffer, "</td></tr>");
@@ -1774,8 +2315,11 @@ static void print_service_rules_uploadbytes(HttpResponse res, Service_T s) {
         char buf[STRLEN];
         for (Bandwidth_T bl = s->uploadbyteslist; bl; bl = bl->next) {
                 if (bl->range == Time_Second) {
+                        char peak[STRLEN] = "";
+                        if (bl->sampled)
+                                snprintf(peak, sizeof(peak), "peak sampled every %d seconds ", bl->sampled);
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Upload bytes</td><td>");
-                        Util_printRule(res->outputbuffer, bl->action, "If %s %s/s", operatornames[bl->operator], Str_bytesToSize(bl->limit, buf));
+                        Util_printRule(res->outputbuffer, bl->action, "If %s%s %s/s", peak, operatornames[bl->operator], Str_bytesToSize(bl->limit, buf));
                 } else {
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Total upload bytes</td><td>");
                         Util_printRule(res->outputbuffer, bl->action, "If %s %s in last %d %s(s)", operatornames[bl->operator], Str_bytesToSize(bl->limit, buf), bl->rangecount, Util_timestr(bl->range));
@@ -1788,8 +2332,11 @@ static void print_service_rules_uploadbytes(HttpResponse res, Service_T s) {
 static void print_service_rules_uploadpackets(HttpResponse res, Service_T s) {
         for (Bandwidth_T bl = s->uploadpacketslist; bl; bl = bl->next) {
                 if (bl->range == Time_Second) {
+                        char peak[STRLEN] = "";
+                        if (bl->sampled)
+                                snprintf(peak, sizeof(peak), "peak sampled every %d seconds ", bl->sampled);
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Upload packets</td><td>");
-                        Util_printRule(res->outputbuffer, bl->action, "If %s %lld packets/s", operatornames[bl->operator], bl->limit);
+                        Util_printRule(res->outputbuffer, bl->action, "If %s%s %lld packets/s", peak, operatornames[bl->operator], bl->limit);
                 } else {
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Total upload packets</td><td>");
                         Util_printRule(res->outputbuffer, bl->action, "If %s %lld packets in last %d %s(s)", operatornames[bl->operator], bl->limit, bl->rangecount, Util_timestr(bl->range));
@@ -1803,8 +2350,11 @@ static void print_service_rules_downloadbytes(HttpResponse res, Service_T s) {
         char buf[STRLEN];
         for (Bandwidth_T bl = s->downloadbyteslist; bl; bl = bl->next) {
                 if (bl->range == Time_Second) {
+                        char peak[STRLEN] = "";
+                        if (bl->sampled)
+                                snprintf(peak, sizeof(peak), "peak sampled every %d seconds ", bl->sampled);
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Download bytes</td><td>");
-                        Util_printRule(res->outputbuffer, bl->action, "If %s %s/s", operatornames[bl->operator], Str_bytesToSize(bl->limit, buf));
+                        Util_printRule(res->outputbuffer, bl->action, "If %s%s %s/s", peak, operatornames[bl->operator], Str_bytesToSize(bl->limit, buf));
                 } else {
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Total download bytes</td><td>");
                         Util_printRule(res->outputbuffer, bl->action, "If %s %s in last %d %s(s)", operatornames[bl->operator], Str_bytesToSize(bl->limit, buf), bl->rangecount, Util_timestr(bl->range));
@@ -1817,8 +2367,11 @@ static void print_service_rules_downloadbytes(HttpResponse res, Service_T s) {
 static void print_service_rules_downloadpackets(HttpResponse res, Service_T s) {
         for (Bandwidth_T bl = s->downloadpacketslist; bl; bl = bl->next) {
                 if (bl->range == Time_Second) {
+                        char peak[STRLEN] = "";
+                        if (bl->sampled)
+                                snprintf(peak, sizeof(peak), "peak sampled every %d seconds ", bl->sampled);
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Download packets</td><td>");
-                        Util_printRule(res->outputbuffer, bl->action, "If %s %lld packets/s", operatornames[bl->operator], bl->limit);
+                        Util_printRule(res->outputbuffer, bl->action, "If %s%s %lld packets/s", peak, operatornames[bl->operator], bl->limit);
                 } else {
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Total download packets</td><td>");
                         Util_printRule(res->outputbuffer, bl->action, "If %s %lld packets in last %d %s(s)", operatornames[bl->operator], bl->limit, bl->rangecount, Util_timestr(bl->range));
@@ -1837,7 +2390,7 @@ static void print_service_rules_uptime(HttpResponse res, Service_T s) {
 }
 
 static void print_service_rules_match(HttpResponse res, Service_T s) {
-        if (s->type != Service_Process) {
+        if (s->type != Service_Process && s->type != Service_Processes) {
                 for (Match_T ml = s->matchignorelist; ml; ml = ml->next) {
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Ignore pattern</td><td>");
                         Util_printRule(res->outputbuffer, ml->action, "If %smatch \"%s\"", ml->not ? "not " : "", ml->match_string);
@@ -1854,7 +2407,7 @@ static void print_service_rules_match(HttpResponse res, Service_T s) {
 
 static void print_service_rules_checksum(HttpResponse res, Service_T s) {
         if (s->checksum) {
-                StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Checksum</td><td>");
+                StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>%s</td><td>", s->checksum->tree ? "Checksum tree" : "Checksum");
                 if (s->checksum->test_changes)
                         Util_printRule(res->outputbuffer, s->checksum->action, "If changed %s", checksumnames[s->checksum->type]);
                 else
@@ -1884,7 +2437,10 @@ static void print_service_rules_ppid(HttpResponse res, Service_T s) {
 
 static void print_service_rules_program(HttpResponse res, Service_T s) {
         if (s->type == Service_Program) {
-                StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Program timeout</td><td>Terminate the program if not finished within %d seconds</td></tr>", s->program->timeout);
+                if (s->program->plugin)
+                        StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Plugin timeout</td><td>Fail the check if not finished within %d seconds</td></tr>", s->program->timeout);
+                else
+                        StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Program timeout</td><td>Terminate the program if not finished within %d seconds</td></tr>", s->program->timeout);
                 for (Status_T status = s->statuslist; status; status = status->next) {
                         StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>Test Exit value</td><td>");
                         if (status->operator == Operator_Changed)
@@ -1900,6 +2456,11 @@ static void print_service_rules_program(HttpResponse res, Service_T s) {
 static void print_service_rules_resource(HttpResponse res, Service_T s) {
         char buf[STRLEN];
         for (Resource_T q = s->resourcelist; q; q = q->next) {
+                char average[STRLEN] = "";
+                if (q->window)
+                        snprintf(average, sizeof(average), "average over %d seconds ", q->window);
+                else if (q->sampled)
+                        snprintf(average, sizeof(average), "peak sampled every %d seconds ", q->sampled);
                 StringBuffer_append(res->outputbuffer, "<tr class='rule'><td>");
                 switch (q->resource_id) {
                         case Resource_CpuPercent:
@@ -1922,6 +2483,14 @@ static void print_service_rules_resource(HttpResponse res, Service_T s) {
                                 StringBuffer_append(res->outputbuffer, "CPU wait limit");
                                 break;
 
+                        case Resource_CpuMax:
+                                StringBuffer_append(res->outputbuffer, "Max CPU usage limit");
+                                break;
+
+                        case Resource_CpuNodeMax:
+                                StringBuffer_append(res->outputbuffer, "Max node CPU usage limit");
+                                break;
+
                         case Resource_MemoryPercent:
                                 StringBuffer_append(res->outputbuffer, "Memory usage limit");
                                 break;
@@ -1961,6 +2530,34 @@ static void print_service_rules_resource(HttpResponse res, Service_T s) {
                         case Resource_MemoryPercentTotal:
                                 StringBuffer_append(res->outputbuffer, "Memory usage limit (incl. children)");
                                 break;
+
+                        case Resource_Tasks:
+                                StringBuffer_append(res->outputbuffer, "Tasks");
+                                break;
+
+                        case Resource_FileDescriptors:
+                                StringBuffer_append(res->outputbuffer, "File descriptors");
+                                break;
+
+                        case Resource_ReadBytes:
+                                StringBuffer_append(res->outputbuffer, "Read rate limit");
+                                break;
+
+                        case Resource_WriteBytes:
+                                StringBuffer_append(res->outputbuffer, "Write rate limit");
+                                break;
+
+                        case Resource_MonitCpu:
+                                StringBuffer_append(res->outputbuffer, "Monit CPU usage limit");
+                                break;
+
+                        case Resource_MonitMemory:
+                                StringBuffer_append(res->outputbuffer, "Monit memory limit");
+                                break;
+
+                        case Resource_MonitFileDescriptors:
+                                StringBuffer_append(res->outputbuffer, "Monit file descriptors");
+                                break;
                         default:
                                 break;
                 }
@@ -1972,25 +2569,37 @@ static void print_service_rules_resource(HttpResponse res, Service_T s) {
                         case Resource_CpuUser:
                         case Resource_CpuSystem:
                         case Resource_CpuWait:
+                        case Resource_CpuMax:
+                        case Resource_CpuNodeMax:
                         case Resource_MemoryPercent:
                         case Resource_SwapPercent:
-                                Util_printRule(res->outputbuffer, q->action, "If %s %.1f%%", operatornames[q->operator], q->limit / 10.);
+                        case Resource_MonitCpu:
+                                Util_printRule(res->outputbuffer, q->action, "If %s%s %.1f%%", average, operatornames[q->operator], q->limit / 10.);
                                 break;
 
                         case Resource_MemoryKbyte:
                         case Resource_SwapKbyte:
                         case Resource_MemoryKbyteTotal:
-                                Util_printRule(res->outputbuffer, q->action, "If %s %s", operatornames[q->operator], Str_bytesToSize(q->limit * 1024., buf));
+                        case Resource_MonitMemory:
+                                Util_printRule(res->outputbuffer, q->action, "If %s%s %s", average, operatornames[q->operator], Str_bytesToSize(q->limit * 1024., buf));
                                 break;
 
                         case Resource_LoadAverage1m:
                         case Resource_LoadAverage5m:
                         case Resource_LoadAverage15m:
-                                Util_printRule(res->outputbuffer, q->action, "If %s %.1f", operatornames[q->operator], q->limit / 10.);
+                                Util_printRule(res->outputbuffer, q->action, "If %s%s %.1f", average, operatornames[q->operator], q->limit / 10.);
                                 break;
 
                         case Resource_Children:
-                                Util_printRule(res->outputbuffer, q->action, "If %s %ld", operatornames[q->operator], q->limit);
+                        case Resource_Tasks:
+                        case Resource_FileDescriptors:
+                        case Resource_MonitFileDescriptors:
+                                Util_printRule(res->outputbuffer, q->action, "If %s%s %ld", average, operatornames[q->operator], q->limit);
+                                break;
+
+                        case Resource_ReadBytes:
+                        case Resource_WriteBytes:
+                                Util_printRule(res->outputbuffer, q->action, "If %s%s %s/s", average, operatornames[q->operator], Str_bytesToSize(q->limit, buf));
                                 break;
                         default:
                                 break;
@@ -2011,6 +2620,12 @@ static void print_service_status_port(HttpResponse res, Service_T s) {
                 else
                         StringBuffer_append(res->outputbuffer, "<td>%.3fs to %s:%d%s type %s/%s protocol %s</td>", p->response, p->hostname, p->port, p->request ? p->request : "", Util_portTypeDescription(p), Util_portIpDescription(p), p->protocol->name);
                 StringBuffer_append(res->outputbuffer, "</tr>");
+                if (status && p->is_available && p->handshake >= 0)
+                        StringBuffer_append(res->outputbuffer, "<tr><td>Port SSL handshake time</td><td>%.3fs to %s:%d</td></tr>", p->handshake, p->hostname, p->port);
+                if (status && p->is_available && p->rtt >= 0)
+                        StringBuffer_append(res->outputbuffer, "<tr><td>Port TCP round trip time</td><td>%.3fs to %s:%d</td></tr>", p->rtt, p->hostname, p->port);
+                if (status && p->certificate.expiry)
+                        StringBuffer_append(res->outputbuffer, "<tr><td>Port certificate valid</td><td%s>%lld days (%s)</td></tr>", (p->certificate.expiry - Time_now()) / 86400 <= p->certificate.days ? " class='red-text'" : "", (long long)(p->certificate.expiry - Time_now()) / 86400, p->certificate.subject);
         }
 }
 
@@ -2262,9 +2877,11 @@ static void print_service_status_file_match(HttpResponse res, Service_T s) {
 
 static void print_service_status_file_checksum(HttpResponse res, Service_T s) {
         if (s->checksum) {
-                StringBuffer_append(res->outputbuffer, "<tr><td>Checksum</td>");
+                StringBuffer_append(res->outputbuffer, "<tr><td>%s</td>", s->checksum->tree ? "Checksum tree" : "Checksum");
                 if (! Util_hasServiceStatus(s))
                         StringBuffer_append(res->outputbuffer, "<td>-</td>");
+                else if (s->checksum->tree)
+                        StringBuffer_append(res->outputbuffer, "<td class='%s'>%s(%s) [%d files]</td>", (s->error & Event_Checksum) ? "red-text" : "", s->inf->priv.directory.cs_sum, checksumnames[s->checksum->type], s->inf->priv.directory.cs_files);
                 else
                         StringBuffer_append(res->outputbuffer, "<td class='%s'>%s(%s)</td>", (s->error & Event_Checksum) ? "red-text" : "", s->inf->priv.file.cs_sum, checksumnames[s->checksum->type]);
                 StringBuffer_append(res->outputbuffer, "</tr>");
@@ -2379,6 +2996,96 @@ static void print_service_status_process_memorytotal(HttpResponse res, Service_T
 }
 
 
+static void print_service_status_process_resources(HttpResponse res, Service_T s) {
+        // The threads, descriptors and I/O are read only if some rule uses them
+        if (Util_hasServiceStatus(s)) {
+                char buf[STRLEN];
+                if (s->inf->priv.process.threads >= 0)
+                        StringBuffer_append(res->outputbuffer, "<tr><td>Threads</td><td class='%s'>%d</td></tr>", (s->error & Event_Resource) ? "red-text" : "", s->inf->priv.process.threads);
+                if (s->inf->priv.process.fds >= 0)
+                        StringBuffer_append(res->outputbuffer, "<tr><td>File descriptors</td><td class='%s'>%d</td></tr>", (s->error & Event_Resource) ? "red-text" : "", s->inf->priv.process.fds);
+                if (s->inf->priv.process.read_rate >= 0) {
+                        StringBuffer_append(res->outputbuffer, "<tr><td>Disk read</td><td class='%s'>%s&#47;s</td></tr>", (s->error & Event_Resource) ? "red-text" : "", Str_bytesToSize(s->inf->priv.process.read_rate, buf));
+                        StringBuffer_append(res->outputbuffer, "<tr><td>Disk write</td><td class='%s'>%s&#47;s</td></tr>", (s->error & Event_Resource) ? "red-text" : "", Str_bytesToSize(s->inf->priv.process.write_rate, buf));
+                }
+        }
+}
+
+
+static void print_service_status_cgroup(HttpResponse res, Service_T s) {
+        if (s->cgroup) {
+                if (! Util_hasServiceStatus(s)) {
+                        StringBuffer_append(res->outputbuffer,
+                                            "<tr><td>Cgroup processes</td><td>-</td></tr>"
+                                            "<tr><td>Cgroup tasks</td><td>-</td></tr>"
+                                            "<tr><td>Cgroup disk read</td><td>-</td></tr>"
+                                            "<tr><td>Cgroup disk write</td><td>-</td></tr>");
+                } else {
+                        char buf[STRLEN];
+                        StringBuffer_append(res->outputbuffer, "<tr><td>Cgroup processes</td><td>%d</td></tr>", s->cgroup->processes);
+                        if (s->cgroup->tasks < 0)
+                                StringBuffer_append(res->outputbuffer, "<tr><td>Cgroup tasks</td><td>N/A</td></tr>");
+                        else
+                                StringBuffer_append(res->outputbuffer, "<tr><td>Cgroup tasks</td><td class='%s'>%d</td></tr>", (s->error & Event_Resource) ? "red-text" : "", s->cgroup->tasks);
+                        if (s->cgroup->read_rate < 0)
+                                StringBuffer_append(res->outputbuffer, "<tr><td>Cgroup disk read</td><td>N/A</td></tr>");
+                        else
+                                StringBuffer_append(res->outputbuffer, "<tr><td>Cgroup disk read</td><td class='%s'>%s&#47;s</td></tr>", (s->error & Event_Resource) ? "red-text" : "", Str_bytesToSize(s->cgroup->read_rate, buf));
+                        if (s->cgroup->write_rate < 0)
+                                StringBuffer_append(res->outputbuffer, "<tr><td>Cgroup disk write</td><td>N/A</td></tr>");
+                        else
+                                StringBuffer_append(res->outputbuffer, "<tr><td>Cgroup disk write</td><td class='%s'>%s&#47;s</td></tr>", (s->error & Event_Resource) ? "red-text" : "", Str_bytesToSize(s->cgroup->write_rate, buf));
+                }
+        }
+}
+
+
+static void print_service_status_processes(HttpResponse res, Service_T s) {
+        if (! Util_hasServiceStatus(s)) {
+                StringBuffer_append(res->outputbuffer,
+                                    "<tr><td>Matching processes</td><td>-</td></tr>"
+                                    "<tr><td>Above limit</td><td>-</td></tr>");
+        } else {
+                char buf[STRLEN];
+                StringBuffer_append(res->outputbuffer, "<tr><td>Matching processes</td><td>%d</td></tr>", s->processes->matched);
+                StringBuffer_append(res->outputbuffer, "<tr><td>Above limit</td><td class='%s'>%d</td></tr>", s->processes->offenders ? "red-text" : "", s->processes->offenders);
+                for (int i = 0; i < s->processes->top; i++) {
+                        Offender_T *o = &s->processes->offender[i];
+                        StringBuffer_append(res->outputbuffer, "<tr><td>%s</td><td class='red-text'>pid %d, cpu %.1f%%, memory %.1f%% [%s] ", i ? "" : "Top offenders", (int)o->pid, o->cpu_percent / 10., o->mem_percent / 10., Str_bytesToSize(o->mem_kbyte * 1024., buf));
+                        escapeHTML(res->outputbuffer, o->cmdline);
+                        StringBuffer_append(res->outputbuffer, "</td></tr>");
+                }
+        }
+}
+
+
+static void print_service_status_instances(HttpResponse res, Service_T s) {
+        if (s->instance.max) {
+                const char *kind = s->type == Service_Filesystem ? "Filesystem" : s->type == Service_File ? "File" : "Process";
+                if (! Util_hasServiceStatus(s)) {
+                        StringBuffer_append(res->outputbuffer, "<tr><td>%s instances</td><td>-</td></tr>", kind);
+                } else {
+                        char buf[STRLEN];
+                        Instance_lock();
+                        StringBuffer_append(res->outputbuffer, "<tr><td>%s instances</td><td class='%s'>%d</td></tr>", kind, s->instance.skipped ? "red-text" : "", s->instance.count);
+                        for (Service_T i = s->instance.list; i; i = i->next) {
+                                StringBuffer_append(res->outputbuffer, "<tr><td>");
+                                escapeHTML(res->outputbuffer, i->name);
+                                StringBuffer_append(res->outputbuffer, "</td><td>");
+                                _printServiceStatus(res->outputbuffer, i);
+                                if (i->type == Service_File)
+                                        StringBuffer_append(res->outputbuffer, " size %s, read %.1f%%</td></tr>", Str_bytesToSize(i->inf->priv.file.size, buf), i->inf->priv.file.size > 0 ? 100. * i->inf->priv.file.readpos / i->inf->priv.file.size : 100.);
+                                else if (i->type == Service_Filesystem)
+                                        StringBuffer_append(res->outputbuffer, " space %.1f%% [%s], inodes %.1f%%</td></tr>", i->inf->priv.filesystem.space_percent / 10., Str_bytesToSize(i->inf->priv.filesystem.space_total * i->inf->priv.filesystem.f_bsize, buf), i->inf->priv.filesystem.inode_percent / 10.);
+                                else
+                                        StringBuffer_append(res->outputbuffer, " cpu %.1f%%, memory %.1f%% [%s]</td></tr>", i->inf->priv.process.cpu_percent / 10., i->inf->priv.process.mem_percent / 10., Str_bytesToSize(i->inf->priv.process.mem_kbyte * 1024., buf));
+                        }
+                        Instance_unlock();
+                }
+        }
+}
+
+
 static void print_service_status_system_loadavg(HttpResponse res, Service_T s) {
         StringBuffer_append(res->outputbuffer, "<tr><td>Load average</td>");
         if (! Util_hasServiceStatus(s))
@@ -2412,6 +3119,26 @@ static void print_service_status_system_cpu(HttpResponse res, Service_T s) {
 }
 
 
+static void print_service_status_system_cpumax(HttpResponse res, Service_T s) {
+        if (! systeminfo.percpu)
+                return;
+        StringBuffer_append(res->outputbuffer, "<tr><td>Busiest CPU</td>");
+        if (! Util_hasServiceStatus(s) || systeminfo.cpu_max_percent < 0)
+                StringBuffer_append(res->outputbuffer, "<td>-</td>");
+        else
+                StringBuffer_append(res->outputbuffer, "<td class='%s'>%.1f%% [cpu %d]</td>", (s->error & Event_Resource) ? "red-text" : "", systeminfo.cpu_max_percent / 10., systeminfo.cpu_max);
+        StringBuffer_append(res->outputbuffer, "</tr>");
+        if (systeminfo.nodes) {
+                StringBuffer_append(res->outputbuffer, "<tr><td>Busiest NUMA node</td>");
+                if (! Util_hasServiceStatus(s) || systeminfo.node_max_percent < 0)
+                        StringBuffer_append(res->outputbuffer, "<td>-</td>");
+                else
+                        StringBuffer_append(res->outputbuffer, "<td class='%s'>%.1f%% [node %d]</td>", (s->error & Event_Resource) ? "red-text" : "", systeminfo.node_max_percent / 10., systeminfo.node_max);
+                StringBuffer_append(res->outputbuffer, "</tr>");
+        }
+}
+
+
 static void print_service_status_system_memory(HttpResponse res, Service_T s) {
         StringBuffer_append(res->outputbuffer, "<tr><td>Memory usage</td>");
         if (! Util_hasServiceStatus(s)) {
@@ -2493,6 +3220,19 @@ static void print_service_status_program_output(HttpResponse res, Service_T s) {
 }
 
 
+static void print_service_status_plugin_metrics(HttpResponse res, Service_T s) {
+        if (s->program->plugin && Util_hasServiceStatus(s)) {
+                monit_plugin_metric_t metric[MONIT_PLUGIN_METRICS];
+                int count = Plugin_getMetrics(s->program->plugin, metric);
+                for (int i = 0; i < count; i++) {
+                        StringBuffer_append(res->outputbuffer, "<tr><td>Metric ");
+                        escapeHTML(res->outputbuffer, metric[i].name);
+                        StringBuffer_append(res->outputbuffer, "</td><td>%g</td></tr>", metric[i].value);
+                }
+        }
+}
+
+
 static boolean_t is_readonly(HttpRequest req) {
         if (req->remote_user) {
                 Auth_T user_creds = Util_getUserCredentials(req->remote_user);
@@ -2502,9 +3242,472 @@ static boolean_t is_readonly(HttpRequest req) {
 }
 
 
+/*
+ * Tag the status page with the status generation, which changes after each cycle, and answer 304 if the client has the current copy.
+ * The pages of the read-only users have no action buttons, so they get their own tag
+ */
+static boolean_t is_current(HttpRequest req, HttpResponse res, const char *page) {
+        char etag[STRLEN];
+        snprintf(etag, sizeof(etag), "\"%llx-%llx-%s%s\"", (unsigned long long)Run.incarnation, status_xml_generation(), page, is_readonly(req) ? "-ro" : "");
+        return is_not_modified(req, res, etag);
+}
+
+
+/* ---------------------------------------------------------- Metrics output */
+
+
+/* The service type label values, the check statement keywords */
+static const char *metrictypes[] = {"filesystem", "directory", "file", "process", "host", "system", "fifo", "program", "network", "cgroup"};
+
+
+/* Per-service gauges in the Prometheus text exposition format */
+static double _metricStatus(Service_T s) { return s->error; }
+static double _metricMonitor(Service_T s) { return s->monitor; }
+static double _metricCollected(Service_T s) { return s->collected.tv_sec + s->collected.tv_usec / 1000000.; }
+static double _metricCpu(Service_T s) { return s->inf->priv.process.cpu_percent / 10.; }
+static double _metricCpuTotal(Service_T s) { return s->inf->priv.process.total_cpu_percent / 10.; }
+static double _metricMemory(Service_T s) { return s->inf->priv.process.mem_kbyte * 1024.; }
+static double _metricMemoryTotal(Service_T s) { return s->inf->priv.process.total_mem_kbyte * 1024.; }
+static double _metricMemoryPercent(Service_T s) { return s->inf->priv.process.mem_percent / 10.; }
+static double _metricChildren(Service_T s) { return s->inf->priv.process.children; }
+static double _metricUptime(Service_T s) { return s->inf->priv.process.uptime; }
+static double _metricSpacePercent(Service_T s) { return s->inf->priv.filesystem.space_percent / 10.; }
+static double _metricSpaceUsed(Service_T s) { return (double)s->inf->priv.filesystem.space_total * s->inf->priv.filesystem.f_bsize; }
+static double _metricSpaceSize(Service_T s) { return (double)s->inf->priv.filesystem.f_blocks * s->inf->priv.filesystem.f_bsize; }
+static double _metricInodePercent(Service_T s) { return s->inf->priv.filesystem.inode_percent / 10.; }
+static double _metricInodeUsed(Service_T s) { return s->inf->priv.filesystem.inode_total; }
+static double _metricLinkBytesIn(Service_T s) { return Link_getBytesInTotal(s->inf->priv.net.stats); }
+static double _metricLinkBytesOut(Service_T s) { return Link_getBytesOutTotal(s->inf->priv.net.stats); }
+static double _metricLinkPacketsIn(Service_T s) { return Link_getPacketsInTotal(s->inf->priv.net.stats); }
+static double _metricLinkPacketsOut(Service_T s) { return Link_getPacketsOutTotal(s->inf->priv.net.stats); }
+static double _metricLinkErrorsIn(Service_T s) { return Link_getErrorsInTotal(s->inf->priv.net.stats); }
+static double _metricLinkErrorsOut(Service_T s) { return Link_getErrorsOutTotal(s->inf->priv.net.stats); }
+static double _metricCgroupCpu(Service_T s) { return s->cgroup->cpu_percent / 10.; }
+static double _metricCgroupMemory(Service_T s) { return s->cgroup->mem_kbyte * 1024.; }
+static double _metricCgroupTasks(Service_T s) { return s->cgroup->tasks; }
+static double _metricCgroupProcesses(Service_T s) { return s->cgroup->processes; }
+static double _metricCgroupRead(Service_T s) { return s->cgroup->read_bytes; }
+static double _metricCgroupWrite(Service_T s) { return s->cgroup->write_bytes; }
+
+
+static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+        int service;                   /**< The service type or -1 for all services */
+        double (*value)(Service_T);
+} servicemetrics[] = {
+        {"monit_service_status", "gauge", "Service error flags bitmap, 0 if the service is ok", -1, _metricStatus},
+        {"monit_service_monitor", "gauge", "Service monitoring state (0 = no, 1 = yes, 2 = initializing, 4 = waiting)", -1, _metricMonitor},
+        {"monit_service_collected_timestamp_seconds", "gauge", "Time of the last service check", -1, _metricCollected},
+        {"monit_process_cpu_percent", "gauge", "Process CPU usage", Service_Process, _metricCpu},
+        {"monit_process_cpu_total_percent", "gauge", "Process and its children CPU usage", Service_Process, _metricCpuTotal},
+        {"monit_process_memory_bytes", "gauge", "Process memory usage", Service_Process, _metricMemory},
+        {"monit_process_memory_total_bytes", "gauge", "Process and its children memory usage", Service_Process, _metricMemoryTotal},
+        {"monit_process_memory_percent", "gauge", "Process memory usage in percent of the system memory", Service_Process, _metricMemoryPercent},
+        {"monit_process_children", "gauge", "Number of the process children", Service_Process, _metricChildren},
+        {"monit_process_uptime_seconds", "gauge", "Process uptime", Service_Process, _metricUptime},
+        {"monit_filesystem_space_percent", "gauge", "Filesystem space usage", Service_Filesystem, _metricSpacePercent},
+        {"monit_filesystem_space_used_bytes", "gauge", "Filesystem space used", Service_Filesystem, _metricSpaceUsed},
+        {"monit_filesystem_space_size_bytes", "gauge", "Filesystem size", Service_Filesystem, _metricSpaceSize},
+        {"monit_filesystem_inode_percent", "gauge", "Filesystem inodes usage", Service_Filesystem, _metricInodePercent},
+        {"monit_filesystem_inode_used", "gauge", "Filesystem inodes used", Service_Filesystem, _metricInodeUsed},
+        {"monit_link_receive_bytes_total", "counter", "Network link bytes received", Service_Net, _metricLinkBytesIn},
+        {"monit_link_transmit_bytes_total", "counter", "Network link bytes transmitted", Service_Net, _metricLinkBytesOut},
+        {"monit_link_receive_packets_total", "counter", "Network link packets received", Service_Net, _metricLinkPacketsIn},
+        {"monit_link_transmit_packets_total", "counter", "Network link packets transmitted", Service_Net, _metricLinkPacketsOut},
+        {"monit_link_receive_errors_total", "counter", "Network link receive errors", Service_Net, _metricLinkErrorsIn},
+        {"monit_link_transmit_errors_total", "counter", "Network link transmit errors", Service_Net, _metricLinkErrorsOut},
+        {"monit_cgroup_cpu_percent", "gauge", "Cgroup CPU usage", Service_Cgroup, _metricCgroupCpu},
+        {"monit_cgroup_memory_bytes", "gauge", "Cgroup memory usage", Service_Cgroup, _metricCgroupMemory},
+        {"monit_cgroup_tasks", "gauge", "Number of the cgroup tasks", Service_Cgroup, _metricCgroupTasks},
+        {"monit_cgroup_processes", "gauge", "Number of the cgroup processes", Service_Cgroup, _metricCgroupProcesses},
+        {"monit_cgroup_read_bytes_total", "counter", "Cgroup block I/O bytes read", Service_Cgroup, _metricCgroupRead},
+        {"monit_cgroup_write_bytes_total", "counter", "Cgroup block I/O bytes written", Service_Cgroup, _metricCgroupWrite}
+};
+
+
+static void _metricFamily(HttpResponse res, const char *name, const char *type, const char *help) {
+        StringBuffer_append(res->outputbuffer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+/* Append the label value, the backslash, double-quote and line feed are escaped */
+static void _metricLabel(HttpResponse res, const char *value) {
+        Output_escape(res->outputbuffer, value, Output_Label);
+}
+
+
+static void _metricService(HttpResponse res, const char *name, Service_T s) {
+        StringBuffer_append(res->outputbuffer, "%s{service=\"", name);
+        _metricLabel(res, s->name);
+        StringBuffer_append(res->outputbuffer, "\",type=\"%s\"}", metrictypes[s->type]);
+}
+
+
+/* Append the summary series name with the service and test labels if the service is not NULL */
+static void _metricLatencySeries(HttpResponse res, const char *name, const char *suffix, Service_T s, const char *test, const char *quantile) {
+        StringBuffer_append(res->outputbuffer, "%s%s", name, suffix);
+        if (s || quantile) {
+                StringBuffer_append(res->outputbuffer, "{");
+                if (s) {
+                        StringBuffer_append(res->outputbuffer, "service=\"");
+                        _metricLabel(res, s->name);
+                        StringBuffer_append(res->outputbuffer, "\",test=\"%s\"%s", test, quantile ? "," : "");
+                }
+                if (quantile)
+                        StringBuffer_append(res->outputbuffer, "quantile=\"%s\"", quantile);
+                StringBuffer_append(res->outputbuffer, "}");
+        }
+}
+
+
+/* Append the latency histogram as a summary */
+static void _metricLatency(HttpResponse res, const char *name, Service_T s, const char *test, Latency_T L) {
+        _metricLatencySeries(res, name, "", s, test, "0.99");
+        StringBuffer_append(res->outputbuffer, " %.6f\n", Latency_percentile(L, 99) / 1000000.);
+        _metricLatencySeries(res, name, "_sum", s, test, NULL);
+        StringBuffer_append(res->outputbuffer, " %.6f\n", L->total / 1000000.);
+        _metricLatencySeries(res, name, "_count", s, test, NULL);
+        StringBuffer_append(res->outputbuffer, " %llu\n", L->count);
+}
+
+
+/* Print the metric history of the service given by the "service" parameter
+ * as JSON, for example for the sparkline graphs */
+static void print_history(HttpRequest req, HttpResponse res) {
+        const char *name = get_parameter(req, "service");
+        Service_T s = name ? Util_getService(name) : NULL;
+        if (! s) {
+                send_error(res, SC_NOT_FOUND, "There is no service named \"%s\"", name ? name : "");
+                return;
+        }
+        set_content_type(res, "application/json");
+        status_history(res->outputbuffer, s);
+}
+
+
+/* The sort keys of the process list */
+typedef enum {
+        ProcessSort_Pid = 0,
+        ProcessSort_Cpu,
+        ProcessSort_Memory,
+        ProcessSort_Uptime
+} ProcessSort_Type;
+
+
+/* Return true if the process a is ranked before the process b */
+static boolean_t _processBefore(ProcessTree_T *pt, int a, int b, ProcessSort_Type sort) {
+        switch (sort) {
+                case ProcessSort_Cpu:
+                        if (pt[a].cpu_percent != pt[b].cpu_percent)
+                                return pt[a].cpu_percent > pt[b].cpu_percent;
+                        break;
+                case ProcessSort_Memory:
+                        if (pt[a].mem_kbyte != pt[b].mem_kbyte)
+                                return pt[a].mem_kbyte > pt[b].mem_kbyte;
+                        break;
+                case ProcessSort_Uptime:
+                        if (pt[a].starttime != pt[b].starttime)
+                                return pt[a].starttime < pt[b].starttime;
+                        break;
+                default:
+                        break;
+        }
+        return pt[a].pid < pt[b].pid;
+}
+
+
+/* Restore the heap order from the node down, the root of the heap is the lowest ranked process */
+static void _processHeapDown(ProcessTree_T *pt, int *heap, int count, int node, ProcessSort_Type sort) {
+        while (true) {
+                int last = node, left = 2 * node + 1, right = left + 1;
+                if (left < count && _processBefore(pt, heap[last], heap[left], sort))
+                        last = left;
+                if (right < count && _processBefore(pt, heap[last], heap[right], sort))
+                        last = right;
+                if (last == node)
+                        return;
+                int swap = heap[node];
+                heap[node] = heap[last];
+                heap[last] = swap;
+                node = last;
+        }
+}
+
+
+/* Return true if the process is the root process or its descendant */
+static boolean_t _processInSubtree(ProcessTree_T *pt, int treesize, int index, int root) {
+        // The depth is bounded by the tree size, so a parent link loop can't hold us
+        for (int depth = 0; index >= 0 && depth < treesize; depth++) {
+                if (index == root)
+                        return true;
+                if (pt[index].parent == index)
+                        break;
+                index = pt[index].parent;
+        }
+        return false;
+}
+
+
+/* Print the processes of the process tree as JSON. The filter parameters
+ * are "user" (name or uid), "match" (regular expression of the command
+ * line), "cpu" (minimum cpu usage [%]), "memory" (minimum memory usage
+ * [kB]) and "pid" (the process and its descendants), the "sort" parameter
+ * ranks the processes by "pid" (default), "cpu", "memory" or "uptime" and
+ * the "limit" parameter selects the top processes only. The processes are
+ * selected and printed from the current process tree under its read lock,
+ * the tree is not copied */
+static void print_processes(HttpRequest req, HttpResponse res) {
+        if (is_readonly(req)) {
+                // The command lines may contain credentials
+                send_error(res, SC_FORBIDDEN, "You do not have sufficent privileges to access this page");
+                return;
+        }
+        const char *user = get_parameter(req, "user");
+        const char *match = get_parameter(req, "match");
+        const char *cpu = get_parameter(req, "cpu");
+        const char *memory = get_parameter(req, "memory");
+        const char *pid = get_parameter(req, "pid");
+        const char *sort = get_parameter(req, "sort");
+        const char *limit = get_parameter(req, "limit");
+        int uid = -1;
+        if (user) {
+                char *end;
+                long n = strtol(user, &end, 10);
+                if (*user && ! *end) {
+                        uid = (int)n;
+                } else {
+                        char buf[4096];
+                        struct passwd pwd, *result = NULL;
+                        if (getpwnam_r(user, &pwd, buf, sizeof(buf), &result) || ! result) {
+                                send_error(res, SC_BAD_REQUEST, "Unknown user %s", user);
+                                return;
+                        }
+                        uid = (int)result->pw_uid;
+                }
+        }
+        ProcessSort_Type key = ProcessSort_Pid;
+        if (sort) {
+                if (IS(sort, "cpu")) {
+                        key = ProcessSort_Cpu;
+                } else if (IS(sort, "memory")) {
+                        key = ProcessSort_Memory;
+                } else if (IS(sort, "uptime")) {
+                        key = ProcessSort_Uptime;
+                } else if (! IS(sort, "pid")) {
+                        send_error(res, SC_BAD_REQUEST, "Invalid sort key %s -- use pid, cpu, memory or uptime", sort);
+                        return;
+                }
+        }
+        int mincpu = cpu ? (int)(strtod(cpu, NULL) * 10.) : 0;
+        unsigned long minmemory = memory ? strtoul(memory, NULL, 10) : 0;
+        pid_t root = pid ? (pid_t)strtol(pid, NULL, 10) : -1;
+        int top = limit ? (int)strtol(limit, NULL, 10) : 0;
+#ifdef HAVE_REGEX_H
+        regex_t regex;
+        if (match) {
+                int rv = regcomp(&regex, match, REG_NOSUB|REG_EXTENDED);
+                if (rv) {
+                        char error[STRLEN];
+                        regerror(rv, &regex, error, sizeof(error));
+                        send_error(res, SC_BAD_REQUEST, "Invalid match pattern -- %s", error);
+                        return;
+                }
+        }
+#endif
+        lockprocesstree(false);
+        if (! ptree) {
+                unlockprocesstree();
+                send_error(res, SC_SERVICE_UNAVAILABLE, "The process tree is not collected, no rule needs it");
+        } else {
+                int rootindex = root >= 0 ? findprocess(root, ptree, ptreesize) : -1;
+                if (top <= 0 || top > ptreesize)
+                        top = ptreesize;
+                // The heap of the top processes, the lowest ranked is replaced by a better one
+                int *heap = CALLOC(top > 0 ? top : 1, sizeof(int));
+                int count = 0, matched = 0;
+                for (int i = 0; i < ptreesize; i++) {
+                        ProcessTree_T *p = &ptree[i];
+                        if ((uid >= 0 && p->uid != uid) || p->cpu_percent < mincpu || p->mem_kbyte < minmemory)
+                                continue;
+                        if (root >= 0 && (rootindex < 0 || ! _processInSubtree(ptree, ptreesize, i, rootindex)))
+                                continue;
+                        if (match) {
+                                if (! p->cmdline)
+                                        continue;
+#ifdef HAVE_REGEX_H
+                                if (regexec(&regex, p->cmdline, 0, NULL, 0))
+                                        continue;
+#else
+                                if (! strstr(p->cmdline, match))
+                                        continue;
+#endif
+                        }
+                        matched++;
+                        if (count < top) {
+                                // Sift the new process up
+                                int node = count++;
+                                heap[node] = i;
+                                while (node > 0 && _processBefore(ptree, heap[(node - 1) / 2], heap[node], key)) {
+                                        int swap = heap[node];
+                                        heap[node] = heap[(node - 1) / 2];
+                                        heap[(node - 1) / 2] = swap;
+                                        node = (node - 1) / 2;
+                                }
+                        } else if (_processBefore(ptree, i, heap[0], key)) {
+                                heap[0] = i;
+                                _processHeapDown(ptree, heap, count, 0, key);
+                        }
+                }
+                // Move the lowest ranked process to the end repeatedly, the heap becomes the ranked list
+                for (int n = count - 1; n > 0; n--) {
+                        int swap = heap[0];
+                        heap[0] = heap[n];
+                        heap[n] = swap;
+                        _processHeapDown(ptree, heap, n, 0, key);
+                }
+                set_content_type(res, "application/json");
+                status_processes(res->outputbuffer, ptree, ptreesize, heap, count, matched);
+                unlockprocesstree();
+                FREE(heap);
+        }
+#ifdef HAVE_REGEX_H
+        if (match)
+                regfree(&regex);
+#endif
+}
+
+
+/* Print the metrics in the Prometheus text exposition format. The metrics
+ * are read directly from the services and streamed in chunks, one metric
+ * family at a time */
+static void print_metrics(HttpRequest req, HttpResponse res) {
+        set_content_type(res, "text/plain; version=0.0.4; charset=utf-8");
+        stream_response(res);
+        _metricFamily(res, "monit_info", "gauge", "Monit instance information");
+        StringBuffer_append(res->outputbuffer, "monit_info{version=\"%s\",id=\"%s\"} 1\n", VERSION, Run.id);
+        _metricFamily(res, "monit_uptime_seconds", "gauge", "Monit daemon uptime");
+        StringBuffer_append(res->outputbuffer, "monit_uptime_seconds %lld\n", (long long)getProcessUptime(getpid(), ptree, ptreesize));
+        _metricFamily(res, "monit_cycle_duration_seconds", "summary", "Duration of the check cycle");
+        _metricLatency(res, "monit_cycle_duration_seconds", NULL, NULL, &Run.latency.cycle);
+        _metricFamily(res, "monit_process_tree_duration_seconds", "summary", "Duration of the process table scan");
+        _metricLatency(res, "monit_process_tree_duration_seconds", NULL, NULL, &Run.latency.processtree);
+        _metricFamily(res, "monit_event_duration_seconds", "summary", "Duration of the event processing");
+        _metricLatency(res, "monit_event_duration_seconds", NULL, NULL, &Run.latency.event);
+        _metricFamily(res, "monit_http_request_duration_seconds", "summary", "Duration of the HTTP request processing");
+        _metricLatency(res, "monit_http_request_duration_seconds", NULL, NULL, &Run.latency.request);
+        _metricFamily(res, "monit_mmonit_report_duration_seconds", "summary", "Duration of the M/Monit message rendering and sending");
+        _metricLatency(res, "monit_mmonit_report_duration_seconds", NULL, NULL, &Run.latency.report);
+        _metricFamily(res, "monit_event_delivery_duration_seconds", "summary", "Time from the event until its alert and M/Monit notification were delivered");
+        _metricLatency(res, "monit_event_delivery_duration_seconds", NULL, NULL, &Run.latency.delivery);
+        _metricFamily(res, "monit_event_delivery_queue", "gauge", "Events waiting for the alert and M/Monit delivery");
+        StringBuffer_append(res->outputbuffer, "monit_event_delivery_queue %d\n", Run.latency.deliveries);
+        _metricFamily(res, "monit_cycle_overruns_total", "counter", "Number of check cycles longer than the poll time");
+        StringBuffer_append(res->outputbuffer, "monit_cycle_overruns_total %llu\n", Run.latency.overruns);
+        _metricFamily(res, "monit_cycle_cpu_seconds", "gauge", "CPU time used by Monit during the last check cycle");
+        StringBuffer_append(res->outputbuffer,
+                            "monit_cycle_cpu_seconds{mode=\"user\"} %.6f\n"
+                            "monit_cycle_cpu_seconds{mode=\"system\"} %.6f\n",
+                            Run.latency.usage.cpuuser / 1000000., Run.latency.usage.cpusystem / 1000000.);
+        _metricFamily(res, "monit_max_resident_memory_bytes", "gauge", "Peak resident set size of Monit");
+        StringBuffer_append(res->outputbuffer, "monit_max_resident_memory_bytes %lld\n", (long long)Run.latency.usage.maxrss * 1024LL);
+        _metricFamily(res, "monit_cycle_page_faults", "gauge", "Page faults during the last check cycle");
+        StringBuffer_append(res->outputbuffer, "monit_cycle_page_faults %ld\n", Run.latency.usage.faults);
+        _metricFamily(res, "monit_cycle_context_switches", "gauge", "Context switches during the last check cycle");
+        StringBuffer_append(res->outputbuffer, "monit_cycle_context_switches %ld\n", Run.latency.usage.switches);
+        _metricFamily(res, "monit_cycle_block_operations", "gauge", "Block input and output operations during the last check cycle");
+        StringBuffer_append(res->outputbuffer, "monit_cycle_block_operations %ld\n", Run.latency.usage.blockio);
+        _metricFamily(res, "monit_cpu_percent", "gauge", "CPU usage of Monit since the previous check cycle");
+        StringBuffer_append(res->outputbuffer, "monit_cpu_percent %.1f\n", Run.latency.usage.cpupercent / 10.);
+        _metricFamily(res, "monit_cycle_subsystem_cpu_seconds", "gauge", "CPU time used by the Monit subsystems during the last check cycle");
+        for (int i = 0; i < Cost_Types; i++)
+                StringBuffer_append(res->outputbuffer, "monit_cycle_subsystem_cpu_seconds{subsystem=\"%s\"} %.6f\n", Latency_costName(i), Run.latency.usage.cost[i] / 1000000.);
+        _metricFamily(res, "monit_resident_memory_bytes", "gauge", "Resident set size of Monit");
+        StringBuffer_append(res->outputbuffer, "monit_resident_memory_bytes %lld\n", (long long)Run.latency.usage.rss * 1024LL);
+        if (Run.latency.usage.heap >= 0) {
+                _metricFamily(res, "monit_heap_bytes", "gauge", "Heap memory in use by Monit");
+                StringBuffer_append(res->outputbuffer, "monit_heap_bytes %lld\n", Run.latency.usage.heap);
+                _metricFamily(res, "monit_cycle_heap_growth_bytes", "gauge", "Heap growth during the last check cycle");
+                StringBuffer_append(res->outputbuffer, "monit_cycle_heap_growth_bytes %lld\n", Run.latency.usage.heapgrowth);
+        }
+        _metricFamily(res, "monit_open_file_descriptors", "gauge", "File descriptors open by Monit");
+        StringBuffer_append(res->outputbuffer, "monit_open_file_descriptors %d\n", Run.latency.usage.fds);
+        _metricFamily(res, "monit_event_queue_events", "gauge", "Events in the event queue");
+        StringBuffer_append(res->outputbuffer, "monit_event_queue_events %d\n", Run.latency.usage.queue);
+        _metricFamily(res, "monit_event_queue_bytes", "gauge", "Disk space used by the event queue");
+        StringBuffer_append(res->outputbuffer, "monit_event_queue_bytes %llu\n", Run.latency.usage.queuesize);
+        _metricFamily(res, "monit_http_requests_per_second", "gauge", "HTTP request rate since the previous check cycle");
+        StringBuffer_append(res->outputbuffer, "monit_http_requests_per_second %.2f\n", Run.latency.usage.requestrate);
+        _metricFamily(res, "monit_system_load_average", "gauge", "System load average");
+        StringBuffer_append(res->outputbuffer,
+                            "monit_system_load_average{period=\"1m\"} %.2f\n"
+                            "monit_system_load_average{period=\"5m\"} %.2f\n"
+                            "monit_system_load_average{period=\"15m\"} %.2f\n",
+                            systeminfo.loadavg[0], systeminfo.loadavg[1], systeminfo.loadavg[2]);
+        _metricFamily(res, "monit_system_cpu_percent", "gauge", "System CPU usage");
+        StringBuffer_append(res->outputbuffer,
+                            "monit_system_cpu_percent{mode=\"user\"} %.1f\n"
+                            "monit_system_cpu_percent{mode=\"system\"} %.1f\n",
+                            systeminfo.total_cpu_user_percent > 0 ? systeminfo.total_cpu_user_percent / 10. : 0,
+                            systeminfo.total_cpu_syst_percent > 0 ? systeminfo.total_cpu_syst_percent / 10. : 0);
+#ifdef HAVE_CPU_WAIT
+        StringBuffer_append(res->outputbuffer, "monit_system_cpu_percent{mode=\"wait\"} %.1f\n", systeminfo.total_cpu_wait_percent > 0 ? systeminfo.total_cpu_wait_percent / 10. : 0);
+#endif
+        if (systeminfo.percpu && systeminfo.cpu_max_percent >= 0) {
+                _metricFamily(res, "monit_system_cpu_max_percent", "gauge", "Usage of the busiest CPU");
+                StringBuffer_append(res->outputbuffer, "monit_system_cpu_max_percent{cpu=\"%d\"} %.1f\n", systeminfo.cpu_max, systeminfo.cpu_max_percent / 10.);
+        }
+        if (systeminfo.percpu && systeminfo.node_max_percent >= 0) {
+                _metricFamily(res, "monit_system_node_cpu_max_percent", "gauge", "CPU usage of the busiest NUMA node");
+                StringBuffer_append(res->outputbuffer, "monit_system_node_cpu_max_percent{node=\"%d\"} %.1f\n", systeminfo.node_max, systeminfo.node_max_percent / 10.);
+        }
+        _metricFamily(res, "monit_system_memory_used_bytes", "gauge", "System memory usage");
+        StringBuffer_append(res->outputbuffer, "monit_system_memory_used_bytes %.0f\n", systeminfo.total_mem_kbyte * 1024.);
+        _metricFamily(res, "monit_system_memory_size_bytes", "gauge", "System memory size");
+        StringBuffer_append(res->outputbuffer, "monit_system_memory_size_bytes %.0f\n", systeminfo.mem_kbyte_max * 1024.);
+        _metricFamily(res, "monit_system_swap_used_bytes", "gauge", "System swap usage");
+        StringBuffer_append(res->outputbuffer, "monit_system_swap_used_bytes %.0f\n", systeminfo.total_swap_kbyte * 1024.);
+        _metricFamily(res, "monit_system_swap_size_bytes", "gauge", "System swap size");
+        StringBuffer_append(res->outputbuffer, "monit_system_swap_size_bytes %.0f\n", systeminfo.swap_kbyte_max * 1024.);
+        flush_response(res);
+        for (int i = 0; i < (int)(sizeof(servicemetrics) / sizeof(servicemetrics[0])); i++) {
+                boolean_t family = false;
+                for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+                        if (servicemetrics[i].service >= 0) {
+                                if (s->type != servicemetrics[i].service || ! Util_hasServiceStatus(s))
+                                        continue;
+                                if (s->type == Service_Net && Link_getState(s->inf->priv.net.stats) != 1)
+                                        continue;
+                        }
+                        if (! family) {
+                                _metricFamily(res, servicemetrics[i].name, servicemetrics[i].type, servicemetrics[i].help);
+                                family = true;
+                        }
+                        _metricService(res, servicemetrics[i].name, s);
+                        StringBuffer_append(res->outputbuffer, " %.15g\n", servicemetrics[i].value(s));
+                        flush_response(res);
+                }
+        }
+        _metricFamily(res, "monit_check_duration_seconds", "summary", "Duration of the service checks and their tests");
+        for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+                for (int i = 0; i < Latency_Types; i++)
+                        if (s->latency[i] && s->latency[i]->count)
+                                _metricLatency(res, "monit_check_duration_seconds", s, Latency_name(i), s->latency[i]);
+                flush_response(res);
+        }
+}
+
+
 /* ----------------------------------------------------------- Status output */
 
 
+/* The status_json() flush callback, the response is sent in chunks */
+static void status_flush(void *res, StringBuffer_T B) {
+        flush_response(res);
+}
+
+
 /* Print status in the given format. Text status is default. */
 static void print_status(HttpRequest req, HttpResponse res, int version) {
         Level_Type level = Level_Full;
@@ -2514,21 +3717,38 @@ static void print_status(HttpRequest req, HttpResponse res, int version) {
         if (stringLevel && Str_startsWith(stringLevel, LEVEL_NAME_SUMMARY))
                 level = Level_Summary;
 
+        /* The long-poll request waits for the status change */
+        if (get_parameter(req, "since")) {
+                watch_status(req, res, level, false);
+                return;
+        }
+
+        /* The status is rendered from the last cycle results, the client's copy is current until the next cycle */
+        char page[STRLEN];
+        snprintf(page, sizeof(page), "status%d-%s-%s", version, stringFormat && Str_startsWith(stringFormat, "xml") ? "xml" : stringFormat && Str_startsWith(stringFormat, "json") ? "json" : "text", level == Level_Summary ? "summary" : "full");
+        if (is_current(req, res, page))
+                return;
+
         if (stringFormat && Str_startsWith(stringFormat, "xml")) {
                 char buf[STRLEN];
-                StringBuffer_T sb = StringBuffer_create(256);
-                status_xml(sb, NULL, level, version, Socket_getLocalHost(req->S, buf, sizeof(buf)));
-                StringBuffer_append(res->outputbuffer, "%s", StringBuffer_toString(sb));
-                StringBuffer_free(&sb);
+                status_xml_snapshot(res->outputbuffer, level, version, Socket_getLocalHost(req->S, buf, sizeof(buf)));
                 set_content_type(res, "text/xml");
+        } else if (stringFormat && Str_startsWith(stringFormat, "json")) {
+                char buf[STRLEN];
+                set_content_type(res, "application/json");
+                stream_response(res);
+                status_json(res->outputbuffer, NULL, level, 0, Socket_getLocalHost(req->S, buf, sizeof(buf)), status_flush, res);
         } else {
                 char *uptime = Util_getUptime(getProcessUptime(getpid(), ptree, ptreesize), " ");
                 StringBuffer_append(res->outputbuffer, "The Monit daemon %s uptime: %s\n\n", VERSION, uptime);
                 FREE(uptime);
 
-                for (Service_T s = servicelist_conf; s; s = s->next_conf)
-                        status_service_txt(s, res, level);
                 set_content_type(res, "text/plain");
+                stream_response(res);
+                for (Service_T s = servicelist_conf; s; s = s->next_conf) {
+                        status_service_txt(s, res, level);
+                        flush_response(res);
+                }
         }
 }
 
@@ -2582,6 +3802,12 @@ static void status_service_txt(Service_T s, HttpResponse res, Level_Type level)
                                                     "uid", (int)s->inf->priv.directory.uid,
                                                     "gid", (int)s->inf->priv.directory.gid,
                                                     "timestamp", Time_string(s->inf->priv.directory.timestamp, buf));
+                                        if (s->checksum) {
+                                                StringBuffer_append(res->outputbuffer,
+                                                                    "  %-33s %s (%s)\n",
+                                                                    "checksum tree", s->inf->priv.directory.cs_sum,
+                                                                    checksumnames[s->checksum->type]);
+                                        }
                                         break;
 
                                 case Service_Fifo:
@@ -2630,6 +3856,20 @@ static void status_service_txt(Service_T s, HttpResponse res, Level_Type level)
                                         }
                                         break;
 
+                                case Service_Processes:
+                                        StringBuffer_append(res->outputbuffer,
+                                                    "  %-33s %d\n"
+                                                    "  %-33s %d\n",
+                                                    "matching processes", s->processes->matched,
+                                                    "above limit", s->processes->offenders);
+                                        for (int i = 0; i < s->processes->top; i++) {
+                                                Offender_T *o = &s->processes->offender[i];
+                                                StringBuffer_append(res->outputbuffer,
+                                                                    "  %-33s %d cpu %.1f%% memory %.1f%% [%s] %s\n",
+                                                                    i ? "" : "top offenders", (int)o->pid, o->cpu_percent / 10., o->mem_percent / 10., Str_bytesToSize(o->mem_kbyte * 1024., buf), o->cmdline);
+                                        }
+                                        break;
+
                                 case Service_Filesystem:
                                         StringBuffer_append(res->outputbuffer,
                                                     "  %-33s %o\n"
@@ -2707,12 +3947,46 @@ static void status_service_txt(Service_T s, HttpResponse res, Level_Type level)
                                                                     "memory percent total", s->inf->priv.process.total_mem_percent/10.0,
                                                                     "cpu percent", s->inf->priv.process.cpu_percent/10.0,
                                                                     "cpu percent total", s->inf->priv.process.total_cpu_percent/10.0);
+                                                if (s->inf->priv.process.threads >= 0)
+                                                        StringBuffer_append(res->outputbuffer,
+                                                                            "  %-33s %d\n",
+                                                                            "threads", s->inf->priv.process.threads);
+                                                if (s->inf->priv.process.fds >= 0)
+                                                        StringBuffer_append(res->outputbuffer,
+                                                                            "  %-33s %d\n",
+                                                                            "file descriptors", s->inf->priv.process.fds);
+                                                if (s->inf->priv.process.read_rate >= 0) {
+                                                        StringBuffer_append(res->outputbuffer,
+                                                                            "  %-33s %s/s\n",
+                                                                            "disk read", Str_bytesToSize(s->inf->priv.process.read_rate, buf));
+                                                        StringBuffer_append(res->outputbuffer,
+                                                                            "  %-33s %s/s\n",
+                                                                            "disk write", Str_bytesToSize(s->inf->priv.process.write_rate, buf));
+                                                }
                                         }
                                         break;
 
                                 default:
                                         break;
                         }
+                        if (s->cgroup) {
+                                StringBuffer_append(res->outputbuffer,
+                                                    "  %-33s %d\n"
+                                                    "  %-33s %d\n"
+                                                    "  %-33s %.1f%%\n",
+                                                    "cgroup processes", s->cgroup->processes,
+                                                    "cgroup tasks", s->cgroup->tasks,
+                                                    "cgroup cpu percent", s->cgroup->cpu_percent/10.0);
+                                StringBuffer_append(res->outputbuffer,
+                                                    "  %-33s %s [%.1f%%]\n",
+                                                    "cgroup memory", Str_bytesToSize(s->cgroup->mem_kbyte * 1024., buf), s->cgroup->mem_percent/10.0);
+                                StringBuffer_append(res->outputbuffer,
+                                                    "  %-33s %s%s\n",
+                                                    "cgroup disk read", s->cgroup->read_rate < 0 ? "N/A" : Str_bytesToSize(s->cgroup->read_rate, buf), s->cgroup->read_rate < 0 ? "" : "/s");
+                                StringBuffer_append(res->outputbuffer,
+                                                    "  %-33s %s%s\n",
+                                                    "cgroup disk write", s->cgroup->write_rate < 0 ? "N/A" : Str_bytesToSize(s->cgroup->write_rate, buf), s->cgroup->write_rate < 0 ? "" : "/s");
+                        }
                         for (Icmp_T i = s->icmplist; i; i = i->next) {
                                 if (! i->is_available)
                                         StringBuffer_append(res->outputbuffer,
@@ -2728,14 +4002,27 @@ static void status_service_txt(Service_T s, HttpResponse res, Level_Type level)
                                                             "ping response time", i->response);
                         }
                         for (Port_T p = s->portlist; p; p = p->next) {
-                                if (p->is_available)
+                                if (p->is_available) {
                                         StringBuffer_append(res->outputbuffer,
                                                     "  %-33s %.3fs to [%s]:%d%s type %s/%s protocol %s\n",
                                                     "port response time", p->response, p->hostname, p->port, p->request ? p->request : "", Util_portTypeDescription(p), Util_portIpDescription(p), p->protocol->name);
-                                else
+                                        if (p->handshake >= 0)
+                                                StringBuffer_append(res->outputbuffer,
+                                                            "  %-33s %.3fs to [%s]:%d\n",
+                                                            "port ssl handshake time", p->handshake, p->hostname, p->port);
+                                        if (p->rtt >= 0)
+                                                StringBuffer_append(res->outputbuffer,
+                                                            "  %-33s %.3fs to [%s]:%d\n",
+                                                            "port tcp round trip time", p->rtt, p->hostname, p->port);
+                                        if (p->certificate.expiry)
+                                                StringBuffer_append(res->outputbuffer,
+                                                            "  %-33s %lld days to [%s]:%d\n",
+                                                            "port certificate valid", (long long)(p->certificate.expiry - Time_now()) / 86400, p->hostname, p->port);
+                                } else {
                                         StringBuffer_append(res->outputbuffer,
                                                     "  %-33s FAILED to [%s]:%d%s type %s/%s protocol %s\n",
                                                     "port response time", p->hostname, p->port, p->request ? p->request : "", Util_portTypeDescription(p), Util_portIpDescription(p), p->protocol->name);
+                                }
                         }
                         for (Port_T p = s->socketlist; p; p = p->next) {
                                 if (p->is_available)
@@ -2761,6 +4048,10 @@ static void status_service_txt(Service_T s, HttpResponse res, Level_Type level)
                                                     , systeminfo.total_cpu_wait_percent > 0 ? systeminfo.total_cpu_wait_percent/10. : 0
 #endif
                                                     );
+                                if (systeminfo.percpu && systeminfo.cpu_max_percent >= 0)
+                                        StringBuffer_append(res->outputbuffer, "  %-33s %.1f%% [cpu %d]\n", "busiest cpu", systeminfo.cpu_max_percent / 10., systeminfo.cpu_max);
+                                if (systeminfo.percpu && systeminfo.node_max_percent >= 0)
+                                        StringBuffer_append(res->outputbuffer, "  %-33s %.1f%% [node %d]\n", "busiest numa node", systeminfo.node_max_percent / 10., systeminfo.node_max);
                                 StringBuffer_append(res->outputbuffer,
                                                     "  %-33s %s [%.1f%%]\n",
                                                     "memory usage", Str_bytesToSize(systeminfo.total_mem_kbyte * 1024., buf), systeminfo.total_mem_percent/10.);
@@ -2776,6 +4067,12 @@ static void status_service_txt(Service_T s, HttpResponse res, Level_Type level)
                                                             "  %-33s %d\n",
                                                             "last started", Time_string(s->program->started, t),
                                                             "last exit value", s->program->exitStatus);
+                                        if (s->program->plugin) {
+                                                monit_plugin_metric_t metric[MONIT_PLUGIN_METRICS];
+                                                int count = Plugin_getMetrics(s->program->plugin, metric);
+                                                for (int i = 0; i < count; i++)
+                                                        StringBuffer_append(res->outputbuffer, "  %-33s %g\n", metric[i].name, metric[i].value);
+                                        }
                                 } else
                                         StringBuffer_append(res->outputbuffer,
                                                             "  %-33s\n",
@@ -2794,6 +4091,8 @@ static char *get_monitoring_status(Service_T s, char *buf, int buflen) {
                 snprintf(buf, buflen, "Not monitored");
         else if (s->monitor & Monitor_Waiting)
                 snprintf(buf, buflen, "Waiting");
+        else if (s->monitor & Monitor_Suppressed)
+                snprintf(buf, buflen, "Suppressed");
         else if (s->monitor & Monitor_Init)
                 snprintf(buf, buflen, "Initializing");
         else if (s->monitor & Monitor_Yes)
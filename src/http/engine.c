@@ -80,6 +80,10 @@
 #include <arpa/inet.h>
 #endif
 
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
 #include "monit.h"
 #include "engine.h"
 #include "net.h"
@@ -90,17 +94,32 @@
 
 // libmonit
 #include "system/Net.h"
+#include "system/Time.h"
 #include "exceptions/AssertException.h"
 
 
 /**
- *  A naive http 1.0 server. The server delegates handling of a HTTP
+ *  A small http 1.1 server. The server delegates handling of a HTTP
  *  request and response to the processor module.
  *
  *  NOTE
- *    This server does not use threads or forks; Requests are
- *    serialized and pending requests will be popped from the
- *    connection queue when the current request finish.
+ *    The server thread polls the listening sockets (IP and unix socket
+ *    may be active at the same time) and all idle client connections.
+ *    A connection with a pending request is passed to a small pool of
+ *    request workers, which handle the request and hand keep-alive
+ *    connections back to the server thread through a wakeup pipe. The
+ *    number of open connections is limited; the listening sockets are
+ *    not polled while the limit is reached. The server thread has no
+ *    periodic wakeup, the poll times out only to close the keep-alive
+ *    connections which were idle for too long and to answer the
+ *    long-poll requests at their deadline.
+ *
+ *    A request which waits for the status change (long-poll or
+ *    WebSocket) doesn't hold a worker: the response is parked and the
+ *    server thread polls its connection with the idle ones. The parked
+ *    connection is handed to a worker when the status generation
+ *    changed (see Engine_notify()), the client sent data or the
+ *    long-poll deadline passed.
  *
  *    Since this server is written for monit, low traffic is expected.
  *    Connect from not-authenicated clients will be closed down
@@ -124,13 +143,50 @@ typedef struct HostsAllow_T {
 } *HostsAllow_T;
 
 
+/* Seconds an idle keep-alive connection is kept open */
+#define KEEPALIVE_TIMEOUT 15
+
+/* Maximum number of requests served on one connection */
+#define KEEPALIVE_REQUESTS 100
+
+
+typedef struct Connection_T {
+        int socket;
+        Socket_T S;                   /**< Created by the worker on first request */
+        Arena_T arena;                /**< The requests, reset after each one */
+        boolean_t net;                       /**< Accepted on the IP server socket */
+        int requests;                           /**< Requests served so far */
+        time_t idle;                               /**< Idle since timestamp */
+        HttpWatch watch;                          /**< The parked response */
+        boolean_t readable;          /**< The parked connection has client data */
+        socklen_t addrlen;
+        struct sockaddr_storage addr;
+        /* For internal use */
+        struct Connection_T *next;
+} *Connection_T;
+
+
 static volatile boolean_t stopped = false;
-static int myServerSocket = 0;
+static int myServerSocket = -1;
+static int myUnixServerSocket = -1;
+static char *myUnixServerPath = NULL;
 #ifdef HAVE_OPENSSL
 SslServer_T mySSLServerConnection = NULL;
 #endif
 static HostsAllow_T hostlist = NULL;
 static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+        int count;                                  /**< Open client connections */
+        int wakeup[2];                      /**< Workers return connections here */
+        Connection_T idle;                  /**< Polled by the server thread */
+        Connection_T watching;    /**< Parked responses, polled by the server */
+        Connection_T ready;             /**< Connections waiting for a worker */
+        Connection_T returned;         /**< Handed back by workers after use */
+        int busy;                     /**< Connections handled by the workers */
+        boolean_t suspended;      /**< The requests are held back during reload */
+        Mutex_T mutex;
+        Sem_T available;
+} connections = {.wakeup = {-1, -1}, .mutex = PTHREAD_MUTEX_INITIALIZER, .available = PTHREAD_COND_INITIALIZER};
 
 
 /* ----------------------------------------------------------------- Private */
@@ -265,49 +321,326 @@ static boolean_t _authenticateHost(struct sockaddr *addr) {
 }
 
 
+static void _wakeup() {
+        if (connections.wakeup[1] >= 0 && write(connections.wakeup[1], "", 1) < 0 && errno != EAGAIN)
+                DEBUG("HTTP server: wakeup failed -- %s\n", STRERROR);
+}
+
+
+static void _closeConnection(Connection_T C) {
+        http_release(&C->watch);
+        if (C->S)
+                Socket_free(&C->S);
+        else
+                Net_abort(C->socket);
+        if (C->arena)
+                Arena_free(&C->arena);
+        FREE(C);
+        LOCK(connections.mutex)
+        {
+                connections.count--;
+        }
+        END_LOCK;
+        _wakeup();
+}
+
+
+static void _closeConnections(Connection_T list) {
+        for (Connection_T C = list, next; C; C = next) {
+                next = C->next;
+                _closeConnection(C);
+        }
+}
+
+
 /**
- * Accept connections from Clients and create a Socket_T object for each successful accept. If accept fails, return a NULL object
+ * Accept pending connections from clients on the given server socket.
+ * Connections from hosts which are not allowed are closed immediately,
+ * the others are polled for a request.
  */
-static Socket_T _socketProducer(int server, Httpd_Flags flags) {
-        int client;
-        struct sockaddr_storage addr_in;
-        struct sockaddr_un addr_un;
-        struct sockaddr *addr = NULL;
-        socklen_t addrlen;
-        if (Net_canRead(server, 1000)) {
-                if (flags & Httpd_Net) {
-                        addr = (struct sockaddr *)&addr_in;
-                        addrlen = sizeof(struct sockaddr_storage);
-                } else {
-                        addr = (struct sockaddr *)&addr_un;
-                        addrlen = sizeof(struct sockaddr_un);
+static void _accept(int server, boolean_t net) {
+        while (! stopped) {
+                boolean_t full = false;
+                LOCK(connections.mutex)
+                {
+                        full = connections.count >= Run.httpd.maxconnections;
+                }
+                END_LOCK;
+                if (full)
+                        return;
+                Connection_T C;
+                NEW(C);
+                C->net = net;
+                C->addrlen = sizeof(C->addr);
+                if ((C->socket = accept(server, (struct sockaddr *)&C->addr, &C->addrlen)) < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                                LogError("HTTP server: cannot accept connection -- %s\n", STRERROR);
+                        FREE(C);
+                        return;
+                }
+                if (! Net_setNonBlocking(C->socket) || fcntl(C->socket, F_SETFD, FD_CLOEXEC) == -1 || ! _authenticateHost((struct sockaddr *)&C->addr)) {
+                        Net_abort(C->socket);
+                        FREE(C);
+                        continue;
                 }
-                if ((client = accept(server, addr, &addrlen)) < 0) {
-                        LogError("HTTP server: cannot accept connection -- %s\n", stopped ? "service stopped" : STRERROR);
-                        return NULL;
+                C->idle = Time_now();
+                C->next = connections.idle;
+                connections.idle = C;
+                LOCK(connections.mutex)
+                {
+                        connections.count++;
                 }
-                if (Net_setNonBlocking(client) < 0 || ! Net_canRead(client, 500) || ! Net_canWrite(client, 500) || ! _authenticateHost(addr)) {
-                        Net_abort(client);
-                        return NULL;
+                END_LOCK;
+        }
+}
+
+
+/**
+ * Request worker: handle requests on connections with pending data and
+ * return connections which are kept alive to the server thread
+ */
+static void *_worker(void *args) {
+        while (true) {
+                Connection_T C = NULL;
+                LOCK(connections.mutex)
+                {
+                        while ((! connections.ready || connections.suspended) && ! stopped)
+                                Sem_wait(connections.available, connections.mutex);
+                        if ((C = connections.ready)) {
+                                connections.ready = C->next;
+                                connections.busy++;
+                        }
                 }
+                END_LOCK;
+                if (! C)
+                        break;
+                if (! C->S) {
 #ifdef HAVE_OPENSSL
-                return Socket_createAccepted(client, addr, addrlen, mySSLServerConnection);
+                        C->S = Socket_createAccepted(C->socket, (struct sockaddr *)&C->addr, C->addrlen, C->net ? mySSLServerConnection : NULL);
 #else
-                return Socket_createAccepted(client, addr, addrlen, NULL);
+                        C->S = Socket_createAccepted(C->socket, (struct sockaddr *)&C->addr, C->addrlen, NULL);
 #endif
+                        if (! C->S) {
+                                // Socket_createAccepted closed the socket already
+                                FREE(C);
+                                LOCK(connections.mutex)
+                                {
+                                        connections.count--;
+                                        connections.busy--;
+                                        Sem_broadcast(connections.available);
+                                }
+                                END_LOCK;
+                                _wakeup();
+                                continue;
+                        }
+                        C->arena = Arena_new();
+                }
+                Http_Result result;
+                if (C->watch) {
+                        result = http_resume(&C->watch, C->readable);
+                } else {
+                        do {
+                                result = http_processor(C->S, C->arena, ! stopped && ++C->requests < KEEPALIVE_REQUESTS, &C->watch);
+                        } while (result == Http_KeepAlive && Socket_hasData(C->S));
+                }
+                LOCK(connections.mutex)
+                {
+                        // Engine_suspend() waits for the requests in progress
+                        connections.busy--;
+                        Sem_broadcast(connections.available);
+                }
+                END_LOCK;
+                if (result != Http_Close) {
+                        C->idle = Time_now();
+                        LOCK(connections.mutex)
+                        {
+                                C->next = connections.returned;
+                                connections.returned = C;
+                        }
+                        END_LOCK;
+                        _wakeup();
+                } else {
+                        _closeConnection(C);
+                }
         }
         return NULL;
 }
 
 
+static boolean_t _createWakeup() {
+        if (pipe(connections.wakeup) < 0) {
+                LogError("HTTP server: cannot create wakeup pipe -- %s\n", STRERROR);
+                return false;
+        }
+        for (int i = 0; i < 2; i++)
+                if (! Net_setNonBlocking(connections.wakeup[i]) || fcntl(connections.wakeup[i], F_SETFD, FD_CLOEXEC) == -1)
+                        LogError("HTTP server: cannot set wakeup pipe options -- %s\n", STRERROR);
+        return true;
+}
+
+
+static void _closeWakeup() {
+        for (int i = 0; i < 2; i++) {
+                if (connections.wakeup[i] >= 0) {
+                        close(connections.wakeup[i]);
+                        connections.wakeup[i] = -1;
+                }
+        }
+}
+
+
+/**
+ * Returns true if the parked response should be resumed: the status
+ * changed or the long-poll deadline passed
+ */
+static boolean_t _due(Connection_T C, unsigned long long generation, time_t now) {
+        return generation > C->watch->since || (! C->watch->websocket && now >= C->watch->deadline);
+}
+
+
+/**
+ * The server thread: poll the server sockets and the idle connections
+ * and dispatch connections with a pending request to the workers
+ */
+static void _serve() {
+        int size = Run.httpd.maxconnections + 3; // Idle connections never exceed the connection limit
+        struct pollfd *fds = CALLOC(size, sizeof(struct pollfd));
+        Connection_T *polled = CALLOC(size, sizeof(Connection_T));
+        while (! stopped) {
+                int n = 0, count = 0;
+                boolean_t suspended = false;
+                LOCK(connections.mutex)
+                {
+                        for (Connection_T C = connections.returned, next; C; C = next) {
+                                next = C->next;
+                                if (C->watch) {
+                                        C->next = connections.watching;
+                                        connections.watching = C;
+                                } else {
+                                        C->next = connections.idle;
+                                        connections.idle = C;
+                                }
+                        }
+                        connections.returned = NULL;
+                        count = connections.count;
+                        suspended = connections.suspended;
+                }
+                END_LOCK;
+                fds[n].fd = connections.wakeup[0];
+                fds[n++].events = POLLIN;
+                int net = -1, local = -1;
+                // New connections wait in the listen queue while the requests are suspended
+                if (count < Run.httpd.maxconnections && ! suspended) {
+                        if (myServerSocket >= 0) {
+                                net = n;
+                                fds[n].fd = myServerSocket;
+                                fds[n++].events = POLLIN;
+                        }
+                        if (myUnixServerSocket >= 0) {
+                                local = n;
+                                fds[n].fd = myUnixServerSocket;
+                                fds[n++].events = POLLIN;
+                        }
+                }
+                int first = n;
+                // Without an idle connection to expire, the server sleeps until a connection or a wakeup arrives
+                int timeout = -1;
+                time_t now = Time_now();
+                for (Connection_T C = connections.idle; C; C = C->next) {
+                        polled[n] = C;
+                        fds[n].fd = C->socket;
+                        fds[n++].events = POLLIN;
+                        int expire = C->idle + KEEPALIVE_TIMEOUT + 1 > now ? (int)(C->idle + KEEPALIVE_TIMEOUT + 1 - now) * 1000 : 0;
+                        if (timeout < 0 || expire < timeout)
+                                timeout = expire;
+                }
+                // The parked responses don't expire, a long-poll response is sent at its deadline
+                int watching = n;
+                unsigned long long generation = connections.watching ? status_xml_generation() : 0;
+                for (Connection_T C = connections.watching; C; C = C->next) {
+                        polled[n] = C;
+                        fds[n].fd = C->socket;
+                        fds[n++].events = POLLIN;
+                        int expire = _due(C, generation, now) ? 0 : C->watch->websocket ? -1 : (int)(C->watch->deadline - now) * 1000;
+                        if (expire >= 0 && (timeout < 0 || expire < timeout))
+                                timeout = expire;
+                }
+                for (int i = 0; i < n; i++)
+                        fds[i].revents = 0;
+                if (poll(fds, n, timeout) < 0) {
+                        if (errno != EINTR) {
+                                LogError("HTTP server: poll failed -- %s\n", STRERROR);
+                                break;
+                        }
+                        continue;
+                }
+                if (fds[0].revents & POLLIN) {
+                        char buf[64];
+                        while (read(connections.wakeup[0], buf, sizeof(buf)) > 0)
+                                ;
+                }
+                // Dispatch the idle connections which became readable and expire the ones idle for too long
+                now = Time_now();
+                Connection_T idle = NULL, ready = NULL;
+                for (int i = first; i < watching; i++) {
+                        Connection_T C = polled[i];
+                        if (fds[i].revents) {
+                                C->next = ready;
+                                ready = C;
+                        } else if (now - C->idle > KEEPALIVE_TIMEOUT) {
+                                _closeConnection(C);
+                        } else {
+                                C->next = idle;
+                                idle = C;
+                        }
+                }
+                connections.idle = idle;
+                // Resume the parked responses whose status changed, whose client sent data or whose deadline passed
+                Connection_T watched = NULL;
+                generation = watching < n ? status_xml_generation() : 0;
+                for (int i = watching; i < n; i++) {
+                        Connection_T C = polled[i];
+                        C->readable = fds[i].revents != 0;
+                        if (C->readable || _due(C, generation, now)) {
+                                C->next = ready;
+                                ready = C;
+                        } else {
+                                C->next = watched;
+                                watched = C;
+                        }
+                }
+                connections.watching = watched;
+                if (ready) {
+                        LOCK(connections.mutex)
+                        {
+                                Connection_T tail = ready;
+                                while (tail->next)
+                                        tail = tail->next;
+                                tail->next = connections.ready;
+                                connections.ready = ready;
+                                Sem_broadcast(connections.available);
+                        }
+                        END_LOCK;
+                }
+                if (net >= 0 && fds[net].revents)
+                        _accept(myServerSocket, true);
+                if (local >= 0 && fds[local].revents)
+                        _accept(myUnixServerSocket, false);
+        }
+        FREE(polled);
+        FREE(fds);
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
 void Engine_start() {
         Engine_cleanup();
         stopped = Run.stopped;
+        connections.suspended = false;
         init_service();
-        //FIXME: we listen currently only on one server socket: either on IP or unix socket ... should support listening on multiple sockets (IPv4, IPv6, unix)
+        //FIXME: IPv6 is not supported yet, the host allow list supports IPv4 only
         if (Run.httpd.flags & Httpd_Net) {
                 if ((myServerSocket = create_server_socket(Run.httpd.socket.net.address, Run.httpd.socket.net.port, 1024)) >= 0) {
 #ifdef HAVE_OPENSSL
@@ -315,34 +648,65 @@ void Engine_start() {
                                 if (! (mySSLServerConnection = SslServer_new(Run.httpd.socket.net.ssl.pem, Run.httpd.socket.net.ssl.clientpem, myServerSocket))) {
                                         LogError("HTTP server: not available -- could not initialize SSL engine\n");
                                         Net_close(myServerSocket);
-                                        return;
+                                        myServerSocket = -1;
                                 }
                         }
 #endif
-                        while (! stopped) {
-                                Socket_T S = _socketProducer(myServerSocket, Run.httpd.flags);
-                                if (S)
-                                        http_processor(S);
-                        }
-#ifdef HAVE_OPENSSL
-                        if (Run.httpd.flags & Httpd_Ssl)
-                                SslServer_free(&mySSLServerConnection);
-#endif
-                        Net_close(myServerSocket);
                 } else {
                         LogError("HTTP server: not available -- could not create a server socket at port %d -- %s\n", Run.httpd.socket.net.port, STRERROR);
                 }
-        } else if (Run.httpd.flags & Httpd_Unix) {
-                if ((myServerSocket = create_server_socket_unix(Run.httpd.socket.unix.path, 1024)) >= 0) {
-                        while (! stopped) {
-                                Socket_T S = _socketProducer(myServerSocket, Run.httpd.flags);
-                                if (S)
-                                        http_processor(S);
-                        }
-                        Net_close(myServerSocket);
-                } else {
+        }
+        if (Run.httpd.flags & Httpd_Unix) {
+                if ((myUnixServerSocket = create_server_socket_unix(Run.httpd.socket.unix.path, 1024)) < 0)
                         LogError("HTTP server: not available -- could not create a server socket at %s -- %s\n", Run.httpd.socket.unix.path, STRERROR);
+                else
+                        myUnixServerPath = Str_dup(Run.httpd.socket.unix.path); // The configuration may change before the server stops
+
+        }
+        if ((myServerSocket >= 0 || myUnixServerSocket >= 0) && _createWakeup()) {
+                Thread_T *threads = CALLOC(Run.httpd.workers, sizeof(Thread_T));
+                volatile int started = 0;
+                TRY
+                {
+                        for (; started < Run.httpd.workers; started++)
+                                Thread_create(threads[started], _worker, NULL);
+                }
+                ELSE
+                {
+                        LogError("HTTP server: cannot create worker thread -- %s\n", Exception_frame.message);
                 }
+                END_TRY;
+                if (started)
+                        _serve();
+                else
+                        LogError("HTTP server: not available -- no request workers\n");
+                stopped = true;
+                LOCK(connections.mutex)
+                {
+                        Sem_broadcast(connections.available);
+                }
+                END_LOCK;
+                for (int i = 0; i < started; i++)
+                        Thread_join(threads[i]);
+                FREE(threads);
+                _closeConnections(connections.idle);
+                _closeConnections(connections.watching);
+                _closeConnections(connections.ready);
+                _closeConnections(connections.returned);
+                connections.idle = connections.watching = connections.ready = connections.returned = NULL;
+                _closeWakeup();
+        }
+#ifdef HAVE_OPENSSL
+        if (mySSLServerConnection)
+                SslServer_free(&mySSLServerConnection);
+#endif
+        if (myServerSocket >= 0) {
+                Net_close(myServerSocket);
+                myServerSocket = -1;
+        }
+        if (myUnixServerSocket >= 0) {
+                Net_close(myUnixServerSocket);
+                myUnixServerSocket = -1;
         }
         Engine_cleanup();
 }
@@ -350,12 +714,45 @@ void Engine_start() {
 
 void Engine_stop() {
         stopped = true;
+        _wakeup();
+}
+
+
+void Engine_suspend() {
+        LOCK(connections.mutex)
+        {
+                connections.suspended = true;
+                _wakeup();
+                while (connections.busy && ! stopped)
+                        Sem_wait(connections.available, connections.mutex);
+        }
+        END_LOCK;
+}
+
+
+void Engine_resume() {
+        LOCK(connections.mutex)
+        {
+                connections.suspended = false;
+                Sem_broadcast(connections.available);
+        }
+        END_LOCK;
+        _wakeup();
+}
+
+
+void Engine_notify() {
+        _wakeup();
 }
 
 
 void Engine_cleanup() {
-        if (Run.httpd.flags & Httpd_Unix)
+        if (myUnixServerPath) {
+                unlink(myUnixServerPath);
+                FREE(myUnixServerPath);
+        } else if (Run.httpd.flags & Httpd_Unix) {
                 unlink(Run.httpd.socket.unix.path);
+        }
 }
 
 
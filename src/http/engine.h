@@ -39,6 +39,28 @@ void Engine_start();
 void Engine_stop();
 
 
+/**
+ * Hold back the requests of the HTTPD server: wait for the requests in
+ * progress, new requests wait until Engine_resume() is called. Used to
+ * rebuild the configuration without restarting the server.
+ */
+void Engine_suspend();
+
+
+/**
+ * Resume the requests held back by Engine_suspend().
+ */
+void Engine_resume();
+
+
+/**
+ * Wake up the HTTPD server to answer the clients which wait for the
+ * status changes (long-poll and WebSocket status requests). Called when
+ * the status generation changed.
+ */
+void Engine_notify();
+
+
 /**
  * Cleanup the HTTPD server resources (remove unix socket).
  */
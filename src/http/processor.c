@@ -48,6 +48,10 @@
 #include <sys/socket.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #ifdef HAVE_SETJMP_H
 #include <setjmp.h>
 #endif
@@ -68,12 +72,21 @@
 #include <limits.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
 #include "processor.h"
 #include "base64.h"
+#include "sha1.h"
+#include "latency.h"
+#include "output.h"
+#include "probe.h"
 
 // libmonit
 #include "util/Str.h"
 #include "system/Net.h"
+#include "system/Time.h"
 
 
 /**
@@ -99,38 +112,73 @@
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+/* The HTTP workers share the request latency histogram */
+static Mutex_T latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Successful Basic Authentication is remembered for AUTH_CACHE_TTL seconds, so the polling clients don't run crypt or PAM on each request */
+#define AUTH_CACHE_TTL  30
+#define AUTH_CACHE_SIZE 32
+
+/* The verified credentials cache, the entries are keyed by the HMAC of the Authorization header with a random per-process key */
+static struct {
+        struct {
+                unsigned char digest[16];          /**< HMAC-MD5 of the credentials */
+                char *uname;                        /**< Authenticated user or NULL */
+                time_t expires;                      /**< End of the entry validity */
+        } entry[AUTH_CACHE_SIZE];
+        unsigned char key[16];                                    /**< The HMAC key */
+        boolean_t keyed;                         /**< true if the key was generated */
+        Mutex_T mutex;
+} authcache = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
 /* -------------------------------------------------------------- Prototypes */
 
 
-static void do_service(Socket_T);
+static Http_Result do_service(Socket_T, Arena_T, boolean_t, HttpWatch *);
+static Http_Result do_watch(HttpWatch *, boolean_t);
+static boolean_t websocket_send(Socket_T, int, const void *, size_t);
+static int websocket_close(Socket_T, int);
+static int websocket_frame(HttpWatch);
+static boolean_t websocket_receive(HttpWatch);
 static void destroy_entry(void *);
 static char *get_date(char *, int);
 static char *get_server(char *, int);
 static void create_headers(HttpRequest);
 static void send_response(HttpResponse);
+static void send_headers(HttpResponse, int, boolean_t, void *);
+static void send_chunk(HttpResponse, boolean_t);
 static boolean_t basic_authenticate(HttpRequest);
-static void done(HttpRequest, HttpResponse);
-static void destroy_HttpRequest(HttpRequest);
+static boolean_t auth_cache_get(HttpRequest, const char *);
+static void auth_cache_put(const char *, const char *);
 static void reset_response(HttpResponse res);
-static HttpParameter parse_parameters(char *);
+static HttpParameter parse_parameters(Arena_T, char *);
 static boolean_t create_parameters(HttpRequest req);
 static void destroy_HttpResponse(HttpResponse);
-static HttpRequest create_HttpRequest(Socket_T);
+static HttpRequest create_HttpRequest(Socket_T, Arena_T);
 static void internal_error(Socket_T, int, char *);
 static HttpResponse create_HttpResponse(Socket_T);
 static boolean_t is_authenticated(HttpRequest, HttpResponse);
-static int get_next_token(char *s, int *cursor, char **r);
+static char *read_line(Socket_T, Arena_T);
+static char *next_word(char **);
 
 
 /*
- * An object for implementors of the service functions; doGet and
- * doPost. Implementing modules i.e. CERVLETS, must implement the
+ * An object for implementors of the service functions; doGet, doPost
+ * and doWatch. Implementing modules i.e. CERVLETS, must implement the
  * doGet and doPost functions and the engine will call the add_Impl
- * function to setup the callback to these functions.
+ * function to setup the callback to these functions. The doWatch
+ * function renders the status changes for a parked response (see
+ * watch_response()), it returns false if nothing changed and the
+ * response is not forced.
  */
 struct  ServiceImpl {
         void(*doGet)(HttpRequest, HttpResponse);
         void(*doPost)(HttpRequest, HttpResponse);
+        boolean_t(*doWatch)(HttpResponse, HttpWatch, boolean_t);
 } Impl;
 
 
@@ -139,16 +187,53 @@ struct  ServiceImpl {
 
 /**
  * Process a HTTP request. This is done by dispatching to the service
- * function.
+ * function. The caller owns the socket and must close it if Http_Close
+ * is returned.
  * @param s A Socket_T representing the client connection
+ * @param arena The connection's arena for the request objects, it's
+ * reset when the request was handled
+ * @param keepalive true if the connection may be kept open after the
+ * response
+ * @param watch Set to the parked response if Http_Watch is returned
+ * @return Http_KeepAlive if the client and the server agreed to keep
+ * the connection open for another request, Http_Watch if the response
+ * waits for the status change (see http_resume()), otherwise Http_Close
  */
-void *http_processor(Socket_T s) {
-        if (! Net_canRead(Socket_getSocket(s), REQUEST_TIMEOUT * 1000))
+Http_Result http_processor(Socket_T s, Arena_T arena, boolean_t keepalive, HttpWatch *watch) {
+        if (! Socket_hasData(s) && ! Net_canRead(Socket_getSocket(s), REQUEST_TIMEOUT * 1000)) {
                 internal_error(s, SC_REQUEST_TIMEOUT, "Time out when handling the Request");
-        else
-                do_service(s);
-        Socket_free(&s);
-        return NULL;
+                return Http_Close;
+        }
+        return do_service(s, arena, keepalive, watch);
+}
+
+
+/**
+ * Resume the parked response. Called by the server when the status
+ * generation changed, the client sent data or the long-poll deadline
+ * passed. The watch is released unless Http_Watch is returned.
+ * @param watch The parked response
+ * @param readable true if the client sent data
+ * @return Http_Watch if the response waits for the next change,
+ * Http_KeepAlive if the long-poll response was sent and the connection
+ * is kept open, otherwise Http_Close
+ */
+Http_Result http_resume(HttpWatch *watch, boolean_t readable) {
+        ASSERT(watch && *watch);
+        return do_watch(watch, readable);
+}
+
+
+/**
+ * Release the parked response. The caller closes the connection.
+ * @param watch The parked response, set to NULL
+ */
+void http_release(HttpWatch *watch) {
+        ASSERT(watch);
+        if (*watch) {
+                destroy_HttpResponse((*watch)->res);
+                FREE(*watch);
+        }
 }
 
 
@@ -156,24 +241,17 @@ void *http_processor(Socket_T s) {
  * Callback for implementors of cervlet functions.
  * @param doGetFunc doGet function
  * @param doPostFunc doPost function
+ * @param doWatchFunc doWatch function
  */
-void add_Impl(void(*doGet)(HttpRequest, HttpResponse), void(*doPost)(HttpRequest, HttpResponse)) {
+void add_Impl(void(*doGet)(HttpRequest, HttpResponse), void(*doPost)(HttpRequest, HttpResponse), boolean_t(*doWatch)(HttpResponse, HttpWatch, boolean_t)) {
         Impl.doGet = doGet;
         Impl.doPost = doPost;
+        Impl.doWatch = doWatch;
 }
 
 
 void escapeHTML(StringBuffer_T sb, const char *s) {
-        for (int i = 0; s[i]; i++) {
-                if (s[i] == '<')
-                        StringBuffer_append(sb, "&lt;");
-                else if (s[i] == '>')
-                        StringBuffer_append(sb, "&gt;");
-                else if (s[i] == '&')
-                        StringBuffer_append(sb, "&amp;");
-                else
-                        StringBuffer_append(sb, "%c", s[i]);
-        }
+        Output_escape(sb, s, Output_Html);
 }
 
 
@@ -217,6 +295,146 @@ void send_error(HttpResponse res, int code, const char *msg, ...) {
 }
 
 
+/**
+ * Start a streamed response: the status line and headers are sent now
+ * and the output buffer is sent in chunks by flush_response() while
+ * the cervlet produces the body. A HTTP/1.1 client gets a chunked
+ * response, a HTTP/1.0 client gets the body until the connection is
+ * closed. Headers and status cannot be changed after this call.
+ * @param res HttpResponse object
+ */
+void stream_response(HttpResponse res) {
+        if (! res->is_committed) {
+                res->is_streamed = true;
+                res->is_chunked = IS(res->protocol, SERVER_PROTOCOL11);
+                if (! res->is_chunked)
+                        res->keepalive = false;
+                send_headers(res, -1, false, NULL);
+        }
+}
+
+
+/**
+ * Send the buffered output of a streamed response if it reached
+ * STREAM_BUFFER bytes, so the memory used by a large body is bounded.
+ * Does nothing if the response is not streamed.
+ * @param res HttpResponse object
+ */
+void flush_response(HttpResponse res) {
+        if (res->is_streamed && StringBuffer_length(res->outputbuffer) >= STREAM_BUFFER)
+                send_chunk(res, false);
+}
+
+
+/**
+ * Park the response until the status changes: the response is not sent
+ * when the cervlet returns, the connection is handed to the server which
+ * resumes it when the status generation changed (see http_resume()).
+ * The response is checked once before the connection is parked, so the
+ * client which is behind gets the changes at once. The cervlet sets the
+ * status document parameters of the returned watch.
+ * @param res HttpResponse object
+ * @return The watch object owned by the response
+ */
+HttpWatch watch_response(HttpResponse res) {
+        ASSERT(! res->watch);
+        NEW(res->watch);
+        res->watch->res = res;
+        return res->watch;
+}
+
+
+/**
+ * Answer the WebSocket opening handshake (RFC 6455). The cervlet parks
+ * the response using watch_response() and the status changes are sent
+ * as WebSocket text messages. If the request is not a valid handshake,
+ * the "400 Bad Request" error is set.
+ * @param req HttpRequest object
+ * @param res HttpResponse object
+ * @return true if the connection was upgraded to the WebSocket protocol
+ */
+boolean_t upgrade_websocket(HttpRequest req, HttpResponse res) {
+        const char *upgrade = get_header(req, "Upgrade");
+        const char *key = get_header(req, "Sec-WebSocket-Key");
+        if (! upgrade || strcasecmp(upgrade, "websocket") != 0 || ! key || ! IS(get_header(req, "Sec-WebSocket-Version"), "13")) {
+                send_error(res, SC_BAD_REQUEST, "WebSocket handshake expected");
+                return false;
+        }
+        unsigned char digest[SHA1_DIGEST_SIZE];
+        sha1_context_t ctx;
+        sha1_init(&ctx);
+        sha1_append(&ctx, (const unsigned char *)key, strlen(key));
+        sha1_append(&ctx, (const unsigned char *)"258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36);
+        sha1_finish(&ctx, digest);
+        char *accept = encode_base64(sizeof(digest), digest);
+        if (! accept) {
+                send_error(res, SC_INTERNAL_SERVER_ERROR, "Cannot compute the WebSocket handshake");
+                return false;
+        }
+        res->is_committed = true;
+        res->keepalive = false;
+        if (Socket_print(res->S, "%s %d %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", SERVER_PROTOCOL11, SC_SWITCHING_PROTOCOLS, get_status_string(SC_SWITCHING_PROTOCOLS), accept) < 0) {
+                FREE(accept);
+                return false;
+        }
+        FREE(accept);
+        return true;
+}
+
+
+/**
+ * Set the ETag of the response and check whether the client's cached
+ * copy is current. If the If-None-Match header of a GET request matches
+ * the tag, the response status is set to 304 and the response is sent
+ * without a body
+ * @param req HttpRequest object
+ * @param res HttpResponse object
+ * @param etag The entity tag, including the quotes
+ * @return true if the client's copy is current and the body must not be
+ * rendered, otherwise false
+ */
+boolean_t is_not_modified(HttpRequest req, HttpResponse res, const char *etag) {
+        set_header(res, "ETag", etag);
+        /* The client must revalidate the copy each time, the status may change with the next cycle */
+        set_header(res, "Cache-Control", "no-cache");
+        const char *match = get_header(req, "If-None-Match");
+        if (! match || ! IS(req->method, METHOD_GET))
+                return false;
+        size_t length = strlen(etag);
+        for (const char *p = match; *p;) {
+                while (*p == ' ' || *p == '\t' || *p == ',')
+                        p++;
+                if (Str_startsWith(p, "W/"))
+                        p += 2;
+                const char *end = p;
+                while (*end && *end != ',' && *end != ' ' && *end != '\t')
+                        end++;
+                if ((end - p == 1 && *p == '*') || ((size_t)(end - p) == length && ! strncmp(p, etag, length))) {
+                        set_status(res, SC_NOT_MODIFIED);
+                        return true;
+                }
+                p = end;
+        }
+        return false;
+}
+
+
+/**
+ * Forget the cached Basic Authentication results, the credentials are
+ * verified again by the next requests (for example after the reload)
+ */
+void clear_auth_cache() {
+        LOCK(authcache.mutex)
+        {
+                for (int i = 0; i < AUTH_CACHE_SIZE; i++) {
+                        FREE(authcache.entry[i].uname);
+                        authcache.entry[i].expires = 0;
+                }
+        }
+        END_LOCK;
+}
+
+
 /* -------------------------------------------------------------- Properties */
 
 
@@ -303,6 +521,66 @@ const char *get_parameter(HttpRequest req, const char *name) {
 }
 
 
+/**
+ * Read the message body of a POST request which is not a form (see
+ * create_parameters()). Both the Content-Length and the chunked body
+ * are supported
+ * @param req HttpRequest object
+ * @param limit The maximum body size
+ * @param length Set to the body length
+ * @return The NUL terminated body (the caller must free it) or NULL if
+ * the request has no body, it's larger than the limit or it cannot be
+ * read. The connection cannot be reused if the body was not read
+ */
+char *get_body(HttpRequest req, int limit, int *length) {
+        ASSERT(length);
+        *length = 0;
+        if (! req->body || req->body > limit)
+                return NULL;
+        char *body = NULL;
+        if (req->body > 0) {
+                body = ALLOC(req->body + 1);
+                while (*length < req->body) {
+                        int n = Socket_read(req->S, body + *length, req->body - *length);
+                        if (n <= 0)
+                                goto error;
+                        *length += n;
+                }
+        } else {
+                char line[STRLEN];
+                int size;
+                body = ALLOC(1);
+                while (Socket_readLine(req->S, line, sizeof(line)) && sscanf(line, "%x", &size) == 1 && size >= 0) {
+                        if (size == 0) {
+                                /* Skip the trailer */
+                                while (Socket_readLine(req->S, line, sizeof(line)))
+                                        if (*line == '\r' || *line == '\n')
+                                                goto done;
+                                goto error;
+                        }
+                        if (size > limit - *length)
+                                goto error;
+                        RESIZE(body, *length + size + 1);
+                        for (int n, read = 0; read < size; read += n)
+                                if ((n = Socket_read(req->S, body + *length + read, size - read)) <= 0)
+                                        goto error;
+                        *length += size;
+                        if (! Socket_readLine(req->S, line, sizeof(line)))
+                                goto error;
+                }
+                goto error;
+        }
+done:
+        body[*length] = 0;
+        req->body = 0;
+        return body;
+error:
+        FREE(body);
+        *length = 0;
+        return NULL;
+}
+
+
 /**
  * Returns a string containing all (extra) headers found in the
  * response.  The headers are newline separated in the returned
@@ -419,12 +697,27 @@ const char *get_status_string(int status) {
 
 /**
  * Receives standard HTTP requests from a client socket and dispatches
- * them to the doXXX methods defined in a cervlet module.
+ * them to the doXXX methods defined in a cervlet module. Returns true
+ * if the connection should be kept alive. A HTTP/1.1 client keeps the
+ * connection unless it sends "Connection: close", a HTTP/1.0 client
+ * must ask for "Connection: keep-alive".
  */
-static void do_service(Socket_T s) {
+static Http_Result do_service(Socket_T s, Arena_T arena, boolean_t keepalive, HttpWatch *watch) {
+        Http_Result result = Http_Close;
+        unsigned long long started = Latency_now(), cpu = Latency_cpu();
         volatile HttpResponse res = create_HttpResponse(s);
-        volatile HttpRequest req = create_HttpRequest(s);
+        volatile HttpRequest req = create_HttpRequest(s, arena);
         if (res && req) {
+                PROBE2(httpd__request__start, req->method, req->url);
+                const char *encoding = get_header(req, "Accept-Encoding");
+                const char *connection = get_header(req, "Connection");
+                res->accept_gzip = encoding && Str_sub(encoding, "gzip");
+                if (IS(req->protocol, "1.1")) {
+                        res->protocol = SERVER_PROTOCOL11;
+                        res->keepalive = keepalive && ! (connection && Str_sub(connection, "close"));
+                } else {
+                        res->keepalive = keepalive && connection && Str_sub(connection, "keep-alive");
+                }
                 if (is_authenticated(req, res)) {
                         if (IS(req->method, METHOD_GET))
                                 Impl.doGet(req, res);
@@ -433,9 +726,195 @@ static void do_service(Socket_T s) {
                         else
                                 send_error(res, SC_NOT_IMPLEMENTED, "Method not implemented");
                 }
+                PROBE4(httpd__request__end, req->method, req->url, res->status, Latency_now() - started);
+                if (res->watch) {
+                        /* The parked response is owned by the watch, it outlives the request */
+                        *watch = res->watch;
+                        res = NULL;
+                        result = do_watch(watch, false);
+                } else {
+                        /* A cervlet which wrote the response itself closes the connection, as well as if the message body was not read */
+                        if ((res->is_committed && ! res->is_streamed) || req->body)
+                                res->keepalive = false;
+                        send_response(res);
+                        result = res->keepalive ? Http_KeepAlive : Http_Close;
+                }
+        }
+        /* The request lives in the arena */
+        destroy_HttpResponse(res);
+        Arena_reset(arena);
+        LOCK(latency_mutex)
+        {
+                Latency_record(&Run.latency.request, started);
+        }
+        END_LOCK;
+        Latency_cost(Cost_Httpd, cpu);
+        return result;
+}
+
+
+/**
+ * Check the parked response. A WebSocket client gets a message with the
+ * status changes, the messages sent by the client are answered (ping) or
+ * ignored, except the close message. A long-poll client gets the response
+ * when the status changed or the deadline passed, if it sent something
+ * while waiting, it closed the connection.
+ */
+static Http_Result do_watch(HttpWatch *watch, boolean_t readable) {
+        HttpWatch W = *watch;
+        HttpResponse res = W->res;
+        Http_Result result = Http_Watch;
+        if (W->websocket) {
+                if (readable && ! websocket_receive(W))
+                        result = Http_Close;
+                if (result == Http_Watch && Impl.doWatch(res, W, false)) {
+                        if (! websocket_send(res->S, 0x1, StringBuffer_toString(res->outputbuffer), StringBuffer_length(res->outputbuffer)))
+                                result = Http_Close;
+                        StringBuffer_clear(res->outputbuffer);
+                }
+        } else if (readable) {
+                result = Http_Close;
+        } else if (Impl.doWatch(res, W, Time_now() >= W->deadline)) {
                 send_response(res);
+                result = res->keepalive ? Http_KeepAlive : Http_Close;
         }
-        done(req, res);
+        if (result != Http_Watch)
+                http_release(watch);
+        return result;
+}
+
+
+/**
+ * Send a WebSocket message in one unmasked frame (server to client)
+ */
+static boolean_t websocket_send(Socket_T S, int opcode, const void *data, size_t length) {
+        unsigned char head[10];
+        int n = 0;
+        head[n++] = 0x80 | opcode; // FIN
+        if (length < 126) {
+                head[n++] = (unsigned char)length;
+        } else if (length <= 0xffff) {
+                head[n++] = 126;
+                head[n++] = (unsigned char)(length >> 8);
+                head[n++] = (unsigned char)length;
+        } else {
+                head[n++] = 127;
+                for (int i = 7; i >= 0; i--)
+                        head[n++] = (unsigned char)((unsigned long long)length >> (i * 8));
+        }
+        struct iovec iov[2] = {{.iov_base = head, .iov_len = n}, {.iov_base = (void *)data, .iov_len = length}};
+        return Socket_writev(S, iov, 2) >= 0;
+}
+
+
+/**
+ * Close the WebSocket connection with the given status code (RFC 6455
+ * section 7.4), the client is not waited for to echo it. Returns -1, the
+ * result of websocket_frame() for a closed connection.
+ */
+static int websocket_close(Socket_T S, int status) {
+        unsigned char code[2] = {(unsigned char)(status >> 8), (unsigned char)status};
+        websocket_send(S, 0x8, code, 2);
+        return -1;
+}
+
+
+/**
+ * Handle the complete WebSocket frame at the start of the watch's frame
+ * buffer. The client frames are masked, a message may be fragmented in
+ * continuation frames which are reassembled, up to WEBSOCKET_MAX bytes.
+ * The ping is answered by pong and the close message is echoed, the
+ * client messages and pong are ignored.
+ * @return The frame size, 0 if the frame is not complete yet or -1 if
+ * the connection should be closed
+ */
+static int websocket_frame(HttpWatch W) {
+        Socket_T S = W->res->S;
+        unsigned char *frame = W->frame;
+        if (W->framelength < 2)
+                return 0;
+        // The reserved bits are not negotiated and the client must mask its frames
+        if ((frame[0] & 0x70) || ! (frame[1] & 0x80))
+                return websocket_close(S, 1002);
+        int head = 2;
+        unsigned long long length = frame[1] & 0x7f;
+        if (length >= 126) {
+                int size = length == 126 ? 2 : 8;
+                if (W->framelength < head + size)
+                        return 0;
+                length = 0;
+                for (int i = 0; i < size; i++)
+                        length = (length << 8) | frame[head++];
+        }
+        if (length > WEBSOCKET_MAX)
+                return websocket_close(S, 1009);
+        unsigned char *mask = frame + head, *data = mask + 4;
+        int size = head + 4 + (int)length;
+        if (W->framelength < size)
+                return 0;
+        for (int i = 0; i < (int)length; i++)
+                data[i] ^= mask[i % 4];
+        boolean_t fin = (frame[0] & 0x80) ? true : false;
+        int opcode = frame[0] & 0x0f;
+        switch (opcode) {
+                case 0x0: // continuation
+                case 0x1: // text
+                case 0x2: // binary
+                        // A continuation frame continues a fragmented message, the other data frames start a new one
+                        if ((opcode == 0x0) != (W->opcode != 0))
+                                return websocket_close(S, 1002);
+                        if (W->messagelength + (int)length > WEBSOCKET_MAX)
+                                return websocket_close(S, 1009);
+                        memcpy(W->message + W->messagelength, data, length);
+                        W->messagelength += (int)length;
+                        if (fin) {
+                                // The message is complete, the client messages are ignored
+                                W->opcode = 0;
+                                W->messagelength = 0;
+                        } else if (opcode) {
+                                W->opcode = opcode;
+                        }
+                        return size;
+                case 0x8: // close
+                case 0x9: // ping
+                case 0xA: // pong
+                        // The control frames are not fragmented and may be sent in the middle of a fragmented message
+                        if (! fin || length > 125)
+                                return websocket_close(S, 1002);
+                        if (opcode == 0x8) {
+                                websocket_send(S, 0x8, data, length >= 2 ? 2 : 0);
+                                return -1;
+                        }
+                        if (opcode == 0x9 && ! websocket_send(S, 0xA, data, length))
+                                return -1;
+                        return size;
+                default:
+                        return websocket_close(S, 1002);
+        }
+}
+
+
+/**
+ * Read the WebSocket frames sent by the client. Only the data which is
+ * available is read, so a client which stalls in the middle of a frame
+ * doesn't hold the worker. The partial frame is kept in the watch until
+ * the rest arrives. Returns false if the connection should be closed.
+ */
+static boolean_t websocket_receive(HttpWatch W) {
+        Socket_T S = W->res->S;
+        while (Socket_hasData(S) || Net_canRead(Socket_getSocket(S), 0)) {
+                int n = Socket_read(S, W->frame + W->framelength, WEBSOCKET_FRAME - W->framelength);
+                if (n <= 0)
+                        return false;
+                W->framelength += n;
+                while ((n = websocket_frame(W)) > 0) {
+                        W->framelength -= n;
+                        memmove(W->frame, W->frame + n, W->framelength);
+                }
+                if (n < 0)
+                        return false;
+        }
+        return true;
 }
 
 
@@ -461,33 +940,99 @@ static char *get_server(char *result, int size) {
 
 
 /**
- * Send the response to the client. If the response has already been
- * commited, this function does nothing.
+ * Send the status line, headers and the body. The headers and the body
+ * are sent with one gather write. A negative length means the body is
+ * streamed, see stream_response().
  */
-static void send_response(HttpResponse res) {
+static void send_headers(HttpResponse res, int length, boolean_t compressed, void *body) {
         Socket_T S = res->S;
+        char date[STRLEN];
+        char server[STRLEN];
+        char size[STRLEN] = {0};
+        char *headers = get_headers(res);
+        res->is_committed = true;
+        get_date(date, STRLEN);
+        get_server(server, STRLEN);
+        if (length >= 0)
+                snprintf(size, sizeof(size), "Content-Length: %d\r\n", length);
+        else if (res->is_chunked)
+                snprintf(size, sizeof(size), "Transfer-Encoding: chunked\r\n");
+        char *head = Str_cat("%s %d %s\r\n"
+                             "Date: %s\r\n"
+                             "Server: %s\r\n"
+                             "%s"
+                             "%s"
+                             "Connection: %s\r\n"
+                             "%s"
+                             "\r\n",
+                             res->protocol, res->status, res->status_msg,
+                             date,
+                             server,
+                             size,
+                             compressed ? "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n" : "",
+                             res->keepalive ? "keep-alive" : "close",
+                             headers ? headers : "");
+        struct iovec iov[2] = {{.iov_base = head, .iov_len = strlen(head)}, {.iov_base = body, .iov_len = body && length > 0 ? length : 0}};
+        if (Socket_writev(S, iov, 2) < 0)
+                res->keepalive = false;
+        FREE(head);
+        FREE(headers);
+}
 
-        if (! res->is_committed) {
-                char date[STRLEN];
-                char server[STRLEN];
-                char *headers = get_headers(res);
-                int length = StringBuffer_length(res->outputbuffer);
 
-                res->is_committed = true;
-                get_date(date, STRLEN);
-                get_server(server, STRLEN);
-                Socket_print(S, "%s %d %s\r\n", res->protocol, res->status,
-                             res->status_msg);
-                Socket_print(S, "Date: %s\r\n", date);
-                Socket_print(S, "Server: %s\r\n", server);
-                Socket_print(S, "Content-Length: %d\r\n", length);
-                Socket_print(S, "Connection: close\r\n");
-                if (headers)
-                        Socket_print(S, "%s", headers);
-                Socket_print(S, "\r\n");
+/**
+ * Send the output buffer of a streamed response and clear it. The last
+ * chunk of a chunked response is followed by the terminating empty
+ * chunk in the same write. If the write fails, the connection is not
+ * kept alive.
+ */
+static void send_chunk(HttpResponse res, boolean_t last) {
+        Socket_T S = res->S;
+        int length = StringBuffer_length(res->outputbuffer);
+        void *body = (void *)StringBuffer_toString(res->outputbuffer);
+        if (res->is_chunked) {
+                char size[16] = {0};
+                const char *trailer = last ? "\r\n0\r\n\r\n" : "\r\n";
                 if (length)
-                        Socket_write(S, (unsigned char *)StringBuffer_toString(res->outputbuffer), length);
-                FREE(headers);
+                        snprintf(size, sizeof(size), "%x\r\n", length);
+                else
+                        trailer = last ? "0\r\n\r\n" : "";
+                struct iovec iov[3] = {{.iov_base = size, .iov_len = strlen(size)}, {.iov_base = body, .iov_len = length}, {.iov_base = (void *)trailer, .iov_len = strlen(trailer)}};
+                if ((length || last) && Socket_writev(S, iov, 3) < 0)
+                        res->keepalive = false;
+        } else if (length && Socket_write(S, body, length) < 0) {
+                res->keepalive = false;
+        }
+        StringBuffer_clear(res->outputbuffer);
+}
+
+
+/**
+ * Send the response to the client. If the response has already been
+ * commited, this function does nothing. The response body is gzip
+ * compressed if the client accepts it and the body is not too small.
+ * A streamed response is finished by sending the remaining output.
+ */
+static void send_response(HttpResponse res) {
+        if (res->is_streamed) {
+                send_chunk(res, true);
+        } else if (res->status == SC_NOT_MODIFIED) {
+                /* The client has the current copy, the response has no body */
+                if (! res->is_committed)
+                        send_headers(res, -1, false, NULL);
+        } else if (! res->is_committed) {
+                int length = StringBuffer_length(res->outputbuffer);
+                unsigned char *body = (unsigned char *)StringBuffer_toString(res->outputbuffer);
+                unsigned char *compressed = NULL;
+                if (res->accept_gzip && length >= COMPRESS_MIN) {
+                        size_t size;
+                        if ((compressed = Util_gzip(body, length, &size))) {
+                                body = compressed;
+                                length = (int)size;
+                        }
+                }
+                send_headers(res, length, compressed != NULL, body);
+                FREE(compressed);
         }
 }
 
@@ -496,37 +1041,45 @@ static void send_response(HttpResponse res) {
 
 
 /**
- * Returns a new HttpRequest object wrapping the client request
+ * Returns a new HttpRequest object wrapping the client request. The
+ * request is parsed in place: the lines are read into the arena and
+ * the method, URL, headers and parameters point into them
  */
-static HttpRequest create_HttpRequest(Socket_T S) {
+static HttpRequest create_HttpRequest(Socket_T S, Arena_T A) {
         HttpRequest req = NULL;
-        char url[REQ_STRLEN];
-        char line[REQ_STRLEN];
-        char protocol[STRLEN];
-        char method[REQ_STRLEN];
-
-        if (Socket_readLine(S, line, REQ_STRLEN) == NULL) {
+        char *line = read_line(S, A);
+        if (! line) {
                 internal_error(S, SC_BAD_REQUEST, "No request found");
                 return NULL;
         }
         Str_chomp(line);
-        if (sscanf(line, "%1023s %1023s HTTP/%3[1.0]", method, url, protocol) != 3) {
+        char *method = next_word(&line);
+        char *url = next_word(&line);
+        char *protocol = next_word(&line);
+        if (! protocol || ! Str_startsWith(protocol, "HTTP/")) {
                 internal_error(S, SC_BAD_REQUEST, "Cannot parse request");
                 return NULL;
         }
+        protocol += 5;
+        size_t n = strspn(protocol, "1.0");
+        if (n == 0) {
+                internal_error(S, SC_BAD_REQUEST, "Cannot parse request");
+                return NULL;
+        }
+        protocol[n > 3 ? 3 : n] = 0;
         if (strlen(url) >= MAX_URL_LENGTH) {
                 internal_error(S, SC_BAD_REQUEST, "[error] URL too long");
                 return NULL;
         }
-        NEW(req);
+        ARENA_NEW(A, req);
         req->S = S;
+        req->arena = A;
         Util_urlDecode(url);
-        req->url = Str_dup(url);
-        req->method = Str_dup(method);
-        req->protocol = Str_dup(protocol);
+        req->url = url;
+        req->method = method;
+        req->protocol = protocol;
         create_headers(req);
         if (! create_parameters(req)) {
-                destroy_HttpRequest(req);
                 internal_error(S, SC_BAD_REQUEST, "Cannot parse Request parameters");
                 return NULL;
         }
@@ -545,6 +1098,7 @@ static HttpResponse create_HttpResponse(Socket_T S) {
         res->status = SC_OK;
         res->outputbuffer = StringBuffer_create(256);
         res->is_committed = false;
+        res->keepalive = false;
         res->protocol = SERVER_PROTOCOL;
         res->status_msg = get_status_string(SC_OK);
         return res;
@@ -555,25 +1109,20 @@ static HttpResponse create_HttpResponse(Socket_T S) {
  * Create HTTP headers for the given request
  */
 static void create_headers(HttpRequest req) {
-        Socket_T S;
-        char *value;
-        HttpHeader header = NULL;
-        char line[REQ_STRLEN];
-
-        S = req->S;
-        while (true) {
-                if (! Socket_readLine(S, line, sizeof(line)))
-                        break;
+        char *line;
+        while ((line = read_line(req->S, req->arena))) {
                 if (Str_isEqual(line, "\r\n") || Str_isEqual(line, "\n"))
                         break;
-                if (NULL != (value = strchr(line, ':'))) {
-                        NEW(header);
+                char *value = strchr(line, ':');
+                if (value) {
+                        HttpHeader header;
+                        ARENA_NEW(req->arena, header);
                         *value++ = 0;
                         Str_trim(line);
                         Str_trim(value);
                         Str_chomp(value);
-                        header->name = Str_dup(line);
-                        header->value = Str_dup(value);
+                        header->name = line;
+                        header->value = value;
                         header->next = req->headers;
                         req->headers = header;
                 }
@@ -586,9 +1135,18 @@ static void create_headers(HttpRequest req) {
  * occurs.
  */
 static boolean_t create_parameters(HttpRequest req) {
-        char query_string[REQ_STRLEN] = {0};
+        char *query_string = NULL;
+        const char *type = get_header(req, "Content-Type");
 
-        if (IS(req->method, METHOD_POST) && get_header(req, "Content-Length")) {
+        if (IS(req->method, METHOD_POST) && type && (Str_startsWith(type, "text/xml") || Str_startsWith(type, "application/json"))) {
+                /* The message body is not a form, it's read by the cervlet (see get_body()) */
+                const char *te = get_header(req, "Transfer-Encoding");
+                const char *cl = get_header(req, "Content-Length");
+                if (te && Str_sub(te, "chunked"))
+                        req->body = -1;
+                else if (! cl || sscanf(cl, "%d", &req->body) != 1 || req->body < 0)
+                        return false;
+        } else if (IS(req->method, METHOD_POST) && get_header(req, "Content-Length")) {
                 int n;
                 int len;
                 Socket_T S = req->S;
@@ -599,24 +1157,20 @@ static boolean_t create_parameters(HttpRequest req) {
                         return false;
                 if (len == 0)
                         return true;
+                query_string = Arena_alloc(req->arena, len + 1);
                 if (((n = Socket_read(S, query_string, len)) <= 0) || (n != len))
                         return false;
-                query_string[n] = 0;
         } else if (IS(req->method, METHOD_GET)) {
-                char *p;
-                if (NULL != (p = strchr(req->url, '?'))) {
-                        *p++ = 0;
-                        strncpy(query_string, p, sizeof(query_string) - 1);
-                        query_string[sizeof(query_string) - 1] = 0;
-                }
+                if ((query_string = strchr(req->url, '?')))
+                        *query_string++ = 0;
         }
-        if (*query_string) {
+        if (query_string && *query_string) {
                 char *p;
                 if (NULL != (p = strchr(query_string, '/'))) {
                         *p++ = 0;
-                        req->pathinfo = Str_dup(p);
+                        req->pathinfo = p;
                 }
-                req->params = parse_parameters(query_string);
+                req->params = parse_parameters(req->arena, query_string);
         }
         return true;
 }
@@ -637,34 +1191,6 @@ static void reset_response(HttpResponse res) {
 }
 
 
-/**
- * Finalize the request and response object.
- */
-static void done(HttpRequest req, HttpResponse res) {
-        destroy_HttpRequest(req);
-        destroy_HttpResponse(res);
-}
-
-
-/**
- * Free a HttpRequest object
- */
-static void destroy_HttpRequest(HttpRequest req) {
-        if (req) {
-                FREE(req->method);
-                FREE(req->url);
-                FREE(req->pathinfo);
-                FREE(req->protocol);
-                FREE(req->remote_user);
-                if (req->headers)
-                        destroy_entry(req->headers);
-                if (req->params)
-                        destroy_entry(req->params);
-                FREE(req);
-        }
-}
-
-
 /**
  * Free a HttpResponse object
  */
@@ -679,8 +1205,8 @@ static void destroy_HttpResponse(HttpResponse res) {
 
 
 /**
- * Free a (linked list of) http entry object(s). Both HttpHeader and
- * HttpParameter are of this type.
+ * Free a (linked list of) response header object(s). The request
+ * headers and parameters are allocated from the connection's arena.
  */
 static void destroy_entry(void *p) {
         struct entry *h = p;
@@ -723,6 +1249,8 @@ static boolean_t basic_authenticate(HttpRequest req) {
 
         if (! (credentials && Str_startsWith(credentials, "Basic ")))
                 return false;
+        if (auth_cache_get(req, credentials))
+                return true;
         strncpy(buf, &credentials[6], sizeof(buf) - 1);
         buf[sizeof(buf) - 1] = 0;
         if ((n = decode_base64((unsigned char*)uname, buf)) <= 0)
@@ -744,11 +1272,81 @@ static boolean_t basic_authenticate(HttpRequest req) {
                 LogError("Warning: Client '%s' supplied wrong password for user '%s' accessing monit httpd\n", Socket_getRemoteHost(req->S), uname);
                 return false;
         }
-        req->remote_user = Str_dup(uname);
+        req->remote_user = Arena_dup(req->arena, uname);
+        auth_cache_put(credentials, uname);
         return true;
 }
 
 
+/*
+ * Compute the cache key of the Authorization header. Called with the cache lock held
+ */
+static void auth_cache_digest(const char *credentials, unsigned char digest[16]) {
+        if (! authcache.keyed) {
+                int fd = open("/dev/urandom", O_RDONLY);
+                if (fd < 0 || read(fd, authcache.key, sizeof(authcache.key)) != sizeof(authcache.key)) {
+                        /* Fallback, the key doesn't have to be strong as the cache lives in the memory only */
+                        char buf[STRLEN];
+                        snprintf(buf, sizeof(buf), "%lu%d%lu%p", (unsigned long)Time_now(), getpid(), random(), (void *)&buf);
+                        Util_hmacMD5((unsigned char *)buf, (int)strlen(buf), (unsigned char *)Run.id, (int)strlen(Run.id), authcache.key);
+                }
+                if (fd >= 0)
+                        close(fd);
+                authcache.keyed = true;
+        }
+        Util_hmacMD5((const unsigned char *)credentials, (int)strlen(credentials), authcache.key, sizeof(authcache.key), digest);
+}
+
+
+/*
+ * Lookup the verified credentials and set the request's remote user. Returns true if found
+ */
+static boolean_t auth_cache_get(HttpRequest req, const char *credentials) {
+        boolean_t found = false;
+        unsigned char digest[16];
+        time_t now = Time_now();
+        LOCK(authcache.mutex)
+        {
+                auth_cache_digest(credentials, digest);
+                for (int i = 0; i < AUTH_CACHE_SIZE; i++) {
+                        // The entry is invalid also if the clock was moved back
+                        if (authcache.entry[i].uname && now < authcache.entry[i].expires && authcache.entry[i].expires - now <= AUTH_CACHE_TTL && ! memcmp(authcache.entry[i].digest, digest, sizeof(digest))) {
+                                req->remote_user = Arena_dup(req->arena, authcache.entry[i].uname);
+                                found = true;
+                                break;
+                        }
+                }
+        }
+        END_LOCK;
+        return found;
+}
+
+
+/*
+ * Remember the verified credentials, the expired or the oldest entry is replaced
+ */
+static void auth_cache_put(const char *credentials, const char *uname) {
+        time_t now = Time_now();
+        LOCK(authcache.mutex)
+        {
+                int slot = 0;
+                for (int i = 0; i < AUTH_CACHE_SIZE; i++) {
+                        if (! authcache.entry[i].uname || authcache.entry[i].expires <= now) {
+                                slot = i;
+                                break;
+                        }
+                        if (authcache.entry[i].expires < authcache.entry[slot].expires)
+                                slot = i;
+                }
+                auth_cache_digest(credentials, authcache.entry[slot].digest);
+                FREE(authcache.entry[slot].uname);
+                authcache.entry[slot].uname = Str_dup(uname);
+                authcache.entry[slot].expires = now + AUTH_CACHE_TTL;
+        }
+        END_LOCK;
+}
+
+
 /* --------------------------------------------------------------- Utilities */
 
 
@@ -782,67 +1380,59 @@ static void internal_error(Socket_T S, int status, char *msg) {
 
 
 /**
- * Parse request parameters from the given query string and return a
- * linked list of HttpParameters
+ * Parse request parameters from the given query string in place and
+ * return a linked list of HttpParameters. Pairs without a key are
+ * skipped
  */
-static HttpParameter parse_parameters(char *query_string) {
-#define KEY 1
-#define VALUE 2
-        int token;
-        int cursor = 0;
-        char *key = NULL;
-        char *value = NULL;
+static HttpParameter parse_parameters(Arena_T A, char *query_string) {
         HttpParameter head = NULL;
-
-        while ((token = get_next_token(query_string, &cursor, &value))) {
-                if (token == KEY)
-                        key = value;
-                else if (token == VALUE) {
-                        HttpParameter p = NULL;
-                        if (! key)
-                                goto error;
-                        NEW(p);
-                        p->name = key;
-                        p->value = value;
-                        p->next = head;
-                        head = p;
-                        key = NULL;
-                }
+        for (char *pair = query_string, *next; pair; pair = next) {
+                if ((next = strchr(pair, '&')))
+                        *next++ = 0;
+                char *value = strchr(pair, '=');
+                if (! value || value == pair)
+                        continue;
+                *value++ = 0;
+                HttpParameter p;
+                ARENA_NEW(A, p);
+                p->name = pair;
+                p->value = value;
+                p->next = head;
+                head = p;
         }
         return head;
-error:
-        FREE(key);
-        FREE(value);
-        if ( head != NULL )
-                destroy_entry(head);
-        return NULL;
 }
 
 
 /**
- * A mini-scanner for tokenizing a query string
+ * Read the line from the socket directly into the arena, the unused
+ * part of the line buffer is returned to the arena
+ * @return The NUL terminated line or NULL if no data could be read
  */
-static int get_next_token(char *s, int *cursor, char **r) {
-        int i = *cursor;
-
-        while (s[*cursor]) {
-                if (s[*cursor+1] == '=') {
-                        *cursor += 1;
-                        *r = Str_ndup(&s[i], (*cursor-i));
-                        return KEY;
-                }
-                if (s[*cursor] == '=') {
-                        while (s[*cursor] && s[*cursor] != '&') *cursor += 1;
-                        if (s[*cursor] == '&') {
-                                *r = Str_ndup(&s[i+1], (*cursor-i)-1);
-                                *cursor += 1;
-                        }  else {
-                                *r = Str_ndup(&s[i+1], (*cursor-i));
-                        }
-                        return VALUE;
-                }
-                *cursor += 1;
+static char *read_line(Socket_T S, Arena_T A) {
+        char *line = Arena_alloc(A, REQ_STRLEN);
+        if (! Socket_readLine(S, line, REQ_STRLEN)) {
+                Arena_trim(A, line, 0);
+                return NULL;
         }
-        return 0;
+        Arena_trim(A, line, strlen(line) + 1);
+        return line;
+}
+
+
+/**
+ * Return the next whitespace separated word of the string and advance
+ * the string behind it. The word is NUL terminated in place
+ * @return The word or NULL if there is no more word
+ */
+static char *next_word(char **s) {
+        char *word = *s + strspn(*s, " \t");
+        if (! *word)
+                return NULL;
+        char *end = word + strcspn(word, " \t");
+        if (*end)
+                *end++ = 0;
+        *s = end;
+        return word;
 }
 
@@ -39,6 +39,7 @@
 #define SERVER_VERSION     VERSION
 #define SERVER_URL         "http://mmonit.com/monit/"
 #define SERVER_PROTOCOL    "HTTP/1.0"
+#define SERVER_PROTOCOL11  "HTTP/1.1"
 #define DATEFMT             "%a, %d %b %Y %H:%M:%S GMT"
 
 /* Protocol methods supported */
@@ -55,6 +56,18 @@
 /* Request timeout in seconds */
 #define REQUEST_TIMEOUT    30
 
+/* Minimum response body size in bytes to compress */
+#define COMPRESS_MIN       1024
+
+/* Buffered output size in bytes sent as one chunk of a streamed response */
+#define STREAM_BUFFER      8192
+
+/* Maximum WebSocket message size in bytes accepted from a client */
+#define WEBSOCKET_MAX      1024
+
+/* Maximum WebSocket frame size in bytes, the message and the longest head */
+#define WEBSOCKET_FRAME    (WEBSOCKET_MAX + 14)
+
 struct entry {
         char *name;
         char *value;
@@ -78,6 +91,8 @@ typedef struct request {
         HttpHeader headers;
         HttpParameter params;
         Ssl_T ssl;
+        int body;            /**< Message body not read yet: length, -1 = chunked */
+        Arena_T arena;       /**< The connection's arena which holds the request */
 } *HttpRequest;
 
 
@@ -86,24 +101,68 @@ typedef struct response {
         Socket_T S;
         const char *protocol;
         boolean_t is_committed;
+        boolean_t accept_gzip;
+        boolean_t keepalive;
+        boolean_t is_streamed;
+        boolean_t is_chunked;
         HttpHeader headers;
         const char *status_msg;
         StringBuffer_T outputbuffer;
         Ssl_T ssl;
+        struct watch *watch;  /**< Set if the response waits for the status change */
 } *HttpResponse;
 
 
+/**
+ * A response which waits for the status change (see watch_response()). The
+ * connection is parked in the server thread, which resumes it when the
+ * status generation changed, the client sent data or the deadline passed
+ */
+typedef struct watch {
+        HttpResponse res;                                 /**< The parked response */
+        boolean_t websocket;       /**< true if the changes are WebSocket messages */
+        unsigned long long since;        /**< The status generation the client has */
+        time_t deadline;                 /**< Long-poll: the time to answer anyway */
+        /* The status document parameters */
+        const char *format;            /**< The document format: xml, json or text */
+        Level_Type level;                                  /**< The document level */
+        /* WebSocket: the data received from the client, kept until complete */
+        int framelength;                    /**< The bytes of the partial frame */
+        int messagelength;       /**< The bytes of the fragmented message so far */
+        int opcode;         /**< The opcode of the fragmented message, 0 if none */
+        unsigned char frame[WEBSOCKET_FRAME];                /**< The partial frame */
+        unsigned char message[WEBSOCKET_MAX];      /**< The reassembled message */
+} *HttpWatch;
+
+
+/** The connection state after a request */
+typedef enum {
+        Http_Close = 0,                                  /**< Close the connection */
+        Http_KeepAlive,                             /**< Wait for the next request */
+        Http_Watch                  /**< Wait for the status change, see HttpWatch */
+} __attribute__((__packed__)) Http_Result;
+
+
 /* Public prototypes */
-void *http_processor(Socket_T);
+Http_Result http_processor(Socket_T S, Arena_T arena, boolean_t keepalive, HttpWatch *watch);
+Http_Result http_resume(HttpWatch *watch, boolean_t readable);
+void http_release(HttpWatch *watch);
 char *get_headers(HttpResponse res);
 void set_status(HttpResponse res, int status);
 const char *get_status_string(int status_code);
-void add_Impl(void(*doGet)(HttpRequest, HttpResponse), void(*doPost)(HttpRequest, HttpResponse));
+void add_Impl(void(*doGet)(HttpRequest, HttpResponse), void(*doPost)(HttpRequest, HttpResponse), boolean_t(*doWatch)(HttpResponse, HttpWatch, boolean_t));
 void set_content_type(HttpResponse res, const char *mime);
 const char *get_header(HttpRequest req, const char *header_name);
 void escapeHTML(StringBuffer_T sb, const char *s);
 void send_error(HttpResponse, int status, const char *message, ...);
+void stream_response(HttpResponse res);
+HttpWatch watch_response(HttpResponse res);
+boolean_t upgrade_websocket(HttpRequest req, HttpResponse res);
+void flush_response(HttpResponse res);
 const char *get_parameter(HttpRequest req, const char *parameter_name);
+char *get_body(HttpRequest req, int limit, int *length);
 void set_header(HttpResponse res, const char *name, const char *value);
+boolean_t is_not_modified(HttpRequest req, HttpResponse res, const char *etag);
+void clear_auth_cache();
 
 #endif
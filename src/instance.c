@@ -0,0 +1,538 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#ifdef HAVE_GLOB_H
+#include <glob.h>
+#endif
+
+#include "monit.h"
+#include "process.h"
+#include "device.h"
+#include "latency.h"
+#include "instance.h"
+
+// libmonit
+#include "system/Time.h"
+
+/**
+ *  Process, filesystem and file instances of the template services.
+ *
+ *  @file
+ */
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/* A mounted filesystem collected from the mount table */
+typedef struct Mounted_T {
+        char *mountpoint;
+        dev_t dev;
+} Mounted_T;
+
+
+typedef struct Mounts_T {
+        Service_T template;
+        int count;
+        int size;
+        Mounted_T *mount;
+} Mounts_T;
+
+
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* The pseudo filesystems without the usage statistics are always excluded */
+static const char *pseudo[] = {
+        "autofs", "binfmt_misc", "bpf", "cgroup", "cgroup2", "configfs", "debugfs", "devpts", "efivarfs", "fusectl", "hugetlbfs",
+        "mqueue", "nsfs", "proc", "pstore", "ramfs", "rpc_pipefs", "securityfs", "selinuxfs", "sysfs", "tracefs", NULL
+};
+
+
+static boolean_t _matches(Match_T m, const char *cmdline) {
+        if (! cmdline || (m->literal && ! strstr(cmdline, m->literal)))
+                return false;
+#ifdef HAVE_REGEX_H
+        return regexec(m->regex_comp, cmdline, 0, NULL, 0) == 0;
+#else
+        return strstr(cmdline, m->match_string) != NULL;
+#endif
+}
+
+
+/**
+ * Create the instance of the template. The instance shares the immutable
+ * rules and alerts of the template, the events and the data are its own
+ */
+static Service_T _create(Service_T t, const char *key) {
+        Service_T s;
+        NEW(s);
+        s->name = Str_cat("%s[%s]", t->name, key);
+        s->type = t->type;
+        s->monitor = Monitor_Init;
+        s->mode = t->mode;
+        s->maillist = t->maillist;
+        s->uid = t->uid;
+        s->gid = t->gid;
+        s->action_DATA = t->action_DATA;
+        s->action_EXEC = t->action_EXEC;
+        s->action_INVALID = t->action_INVALID;
+        s->action_ACTION = t->action_ACTION;
+        s->instance.owner = t;
+        NEW(s->inf);
+        Util_resetInfo(s);
+        gettimeofday(&s->collected, NULL);
+        return s;
+}
+
+
+static Service_T _createProcess(Service_T t, ProcessTree_T *p) {
+        char pid[STRLEN];
+        snprintf(pid, sizeof(pid), "%d", (int)p->pid);
+        Service_T s = _create(t, pid);
+        s->resourcelist = t->resourcelist;
+        s->ruletable = t->ruletable;
+        s->uptimelist = t->uptimelist;
+        s->euid = t->euid;
+        s->instance.pid = p->pid;
+        s->instance.starttime = p->starttime;
+        return s;
+}
+
+
+static Service_T _createFilesystem(Service_T t, const char *mountpoint) {
+        Service_T s = _create(t, mountpoint);
+        s->path = Str_dup(mountpoint);
+        s->perm = t->perm;
+        s->filesystemlist = t->filesystemlist;
+        s->ruletable = t->ruletable;
+        s->fsflaglist = t->fsflaglist;
+        return s;
+}
+
+
+static Service_T _createFile(Service_T t, const char *path) {
+        Service_T s = _create(t, path);
+        s->path = Str_dup(path);
+        /* The instances feed the template's patterns, the matches of all files are reported by the template */
+        s->matchlist = t->matchlist;
+        s->matchignorelist = t->matchignorelist;
+        s->matchbudget = t->matchbudget;
+        return s;
+}
+
+
+static void _free(Service_T *s) {
+        if ((*s)->eventlist)
+                gc_event(&(*s)->eventlist);
+        FREE((*s)->eventindex.table);
+        FREE((*s)->inf);
+        Latency_free((*s)->latency);
+        FREE((*s)->path);
+        FREE((*s)->name);
+        FREE(*s);
+}
+
+
+static void _retire(Service_T t, Service_T s, time_t now, const char *reason) {
+        LogInfo("'%s' %s instance retired -- %s\n", s->name, s->type == Service_Filesystem ? "filesystem" : s->type == Service_File ? "file" : "process", reason);
+        s->instance.retired = now;
+        s->next = t->instance.retiredlist;
+        t->instance.retiredlist = s;
+}
+
+
+/* The retired instances are freed after the grace period, the event delivery may still use them */
+static void _reap(Service_T t, time_t now) {
+        for (Service_T *r = &t->instance.retiredlist; *r;) {
+                if (now - (*r)->instance.retired >= INSTANCES_GRACE || now < (*r)->instance.retired) {
+                        Service_T s = *r;
+                        *r = s->next;
+                        _free(&s);
+                } else {
+                        r = &(*r)->next;
+                }
+        }
+}
+
+
+static boolean_t _isListed(const char **list, const char *fstype) {
+        for (int i = 0; list && list[i]; i++)
+                if (IS(list[i], fstype))
+                        return true;
+        return false;
+}
+
+
+/**
+ * Collect the mounts of the template, the pseudo and excluded filesystem types
+ * are skipped, as well as the other mounts of the same filesystem (bind mounts)
+ */
+static void _collectMount(const char *mountpoint, const char *fstype, dev_t dev, void *ap) {
+        Mounts_T *M = ap;
+        if (_isListed(pseudo, fstype) || _isListed((const char **)M->template->instance.excluded, fstype))
+                return;
+        for (int i = 0; i < M->count; i++)
+                if (M->mount[i].dev == dev)
+                        return;
+        if (M->count == M->size) {
+                M->size = M->size ? 2 * M->size : 64;
+                RESIZE(M->mount, M->size * sizeof(Mounted_T));
+        }
+        M->mount[M->count].mountpoint = Str_dup(mountpoint);
+        M->mount[M->count].dev = dev;
+        M->count++;
+}
+
+
+static int _comparePaths(const void *a, const void *b) {
+        return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/**
+ * Get the template of the instance name. The instance name is the template
+ * name followed by the bracketed key, the key (e.g. a mountpoint or a file
+ * path) may contain brackets too
+ */
+static Service_T _template(const char *name) {
+        for (const char *bracket = strchr(name, '['); bracket; bracket = strchr(bracket + 1, '[')) {
+                if (bracket == name)
+                        continue;
+                char *template = Str_ndup(name, (int)(bracket - name));
+                Service_T t = Util_getService(template);
+                FREE(template);
+                if (t && t->instance.max)
+                        return t;
+        }
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void Instance_update(Service_T t) {
+        ASSERT(t);
+        ASSERT(t->matchlist);
+        time_t now = Time_now();
+        LOCK(mutex)
+        {
+                lockprocesstree(false);
+                if (Run.doprocess && ptree) {
+                        int count = 0, skipped = 0;
+                        Service_T old = t->instance.list, list = NULL, *tail = &list;
+                        for (int i = 0; i < ptreesize; i++) {
+                                ProcessTree_T *p = &ptree[i];
+                                /* The instances are sorted by pid like the process table, so the instances passed over lost their process */
+                                while (old && old->instance.pid < p->pid) {
+                                        Service_T next = old->next;
+                                        _retire(t, old, now, "the process exited");
+                                        old = next;
+                                }
+                                Service_T s = NULL;
+                                if (old && old->instance.pid == p->pid) {
+                                        s = old;
+                                        old = old->next;
+                                        if (s->instance.starttime != p->starttime) {
+                                                _retire(t, s, now, "the pid was reused");
+                                                s = NULL;
+                                        }
+                                }
+                                if (! _matches(t->matchlist, p->cmdline)) {
+                                        if (s)
+                                                _retire(t, s, now, "the process doesn't match anymore");
+                                        continue;
+                                }
+                                if (! s) {
+                                        if (count >= t->instance.max) {
+                                                skipped++;
+                                                continue;
+                                        }
+                                        s = _createProcess(t, p);
+                                        LogInfo("'%s' process instance created\n", s->name);
+                                }
+                                update_process_data(s, ptree, ptreesize, p->pid);
+                                *tail = s;
+                                tail = &s->next;
+                                count++;
+                        }
+                        *tail = NULL;
+                        while (old) {
+                                Service_T next = old->next;
+                                _retire(t, old, now, "the process exited");
+                                old = next;
+                        }
+                        t->instance.list = list;
+                        t->instance.count = count;
+                        if (skipped && ! t->instance.skipped)
+                                LogWarning("'%s' %d matching processes have no instance -- the maximum of %d instances was reached\n", t->name, skipped, t->instance.max);
+                        t->instance.skipped = skipped;
+                } else {
+                        DEBUG("'%s' process information not available -- skipping the instances update for this cycle\n", t->name);
+                }
+                unlockprocesstree();
+                _reap(t, now);
+        }
+        END_LOCK;
+}
+
+
+boolean_t Instance_updateFilesystems(Service_T t) {
+        ASSERT(t);
+        time_t now = Time_now();
+        Mounts_T M = {.template = t};
+        unsigned int generation = t->instance.generation;
+        /* The mount table is read outside of the instances lock, the callback is called only if the table changed */
+        if (! filesystem_mounts(&t->instance.generation, _collectMount, &M))
+                return false;
+        LOCK(mutex)
+        {
+                if (generation != t->instance.generation) {
+                        int count = 0, skipped = 0;
+                        Service_T old = t->instance.list, list = NULL, *tail = &list;
+                        for (int i = 0; i < M.count; i++) {
+                                Service_T s = NULL;
+                                for (Service_T *o = &old; *o; o = &(*o)->next) {
+                                        if (IS((*o)->path, M.mount[i].mountpoint)) {
+                                                s = *o;
+                                                *o = s->next;
+                                                break;
+                                        }
+                                }
+                                if (! s) {
+                                        if (count >= t->instance.max) {
+                                                skipped++;
+                                                continue;
+                                        }
+                                        s = _createFilesystem(t, M.mount[i].mountpoint);
+                                        LogInfo("'%s' filesystem instance created\n", s->name);
+                                }
+                                *tail = s;
+                                tail = &s->next;
+                                count++;
+                        }
+                        *tail = NULL;
+                        while (old) {
+                                Service_T next = old->next;
+                                _retire(t, old, now, "the filesystem was unmounted");
+                                old = next;
+                        }
+                        t->instance.list = list;
+                        t->instance.count = count;
+                        if (skipped && ! t->instance.skipped)
+                                LogWarning("'%s' %d mounted filesystems have no instance -- the maximum of %d instances was reached\n", t->name, skipped, t->instance.max);
+                        t->instance.skipped = skipped;
+                }
+                _reap(t, now);
+        }
+        END_LOCK;
+        for (int i = 0; i < M.count; i++)
+                FREE(M.mount[i].mountpoint);
+        FREE(M.mount);
+        return true;
+}
+
+
+#ifdef HAVE_GLOB_H
+
+
+boolean_t Instance_updateFiles(Service_T t) {
+        ASSERT(t);
+        ASSERT(t->type == Service_File);
+        glob_t g;
+        int rv = glob(t->path, GLOB_NOSORT, NULL, &g);
+        if (rv != 0 && rv != GLOB_NOMATCH) {
+                globfree(&g);
+                return false;
+        }
+        /* Sort the paths like the instances, so the instances can be merged with the matching files in one pass */
+        if (rv == 0)
+                qsort(g.gl_pathv, g.gl_pathc, sizeof(char *), _comparePaths);
+        time_t now = Time_now();
+        LOCK(mutex)
+        {
+                int count = 0, skipped = 0;
+                Service_T old = t->instance.list, list = NULL, *tail = &list;
+                for (size_t i = 0; rv == 0 && i < g.gl_pathc; i++) {
+                        const char *path = g.gl_pathv[i];
+                        while (old && strcmp(old->path, path) < 0) {
+                                Service_T next = old->next;
+                                _retire(t, old, now, "the file was removed");
+                                old = next;
+                        }
+                        Service_T s = NULL;
+                        if (old && IS(old->path, path)) {
+                                s = old;
+                                old = old->next;
+                        } else {
+                                if (count >= t->instance.max) {
+                                        skipped++;
+                                        continue;
+                                }
+                                s = _createFile(t, path);
+                                LogInfo("'%s' file instance created\n", s->name);
+                        }
+                        *tail = s;
+                        tail = &s->next;
+                        count++;
+                }
+                *tail = NULL;
+                while (old) {
+                        Service_T next = old->next;
+                        _retire(t, old, now, "the file was removed");
+                        old = next;
+                }
+                t->instance.list = list;
+                t->instance.count = count;
+                if (skipped && ! t->instance.skipped)
+                        LogWarning("'%s' %d matching files have no instance -- the maximum of %d instances was reached\n", t->name, skipped, t->instance.max);
+                t->instance.skipped = skipped;
+                _reap(t, now);
+        }
+        END_LOCK;
+        globfree(&g);
+        return true;
+}
+
+
+#else
+
+
+boolean_t Instance_updateFiles(Service_T t) {
+        LogError("'%s' the file path pattern is not supported on this platform\n", t->name);
+        return false;
+}
+
+
+#endif
+
+
+void Instance_restoreFile(const char *name, unsigned long long inode, unsigned long long readpos) {
+        ASSERT(name);
+        Service_T t = _template(name);
+        size_t length = strlen(name);
+        if (! t || t->type != Service_File || name[length - 1] != ']')
+                return;
+        char *path = Str_ndup(name + strlen(t->name) + 1, (int)(length - strlen(t->name) - 2));
+        LOCK(mutex)
+        {
+                /* Keep the instances sorted by path, the instance is retired by the first update if the file is gone */
+                Service_T *s = &t->instance.list;
+                while (*s && strcmp((*s)->path, path) < 0)
+                        s = &(*s)->next;
+                if ((! *s || ! IS((*s)->path, path)) && t->instance.count < t->instance.max) {
+                        Service_T i = _createFile(t, path);
+                        i->next = *s;
+                        *s = i;
+                        t->instance.count++;
+                }
+                if (*s && IS((*s)->path, path)) {
+                        (*s)->inf->priv.file.inode = inode;
+                        (*s)->inf->priv.file.readpos = readpos;
+                }
+        }
+        END_LOCK;
+        FREE(path);
+}
+
+
+Service_T Instance_get(const char *name) {
+        ASSERT(name);
+        Service_T s = NULL;
+        Service_T t = _template(name);
+        if (t) {
+                LOCK(mutex)
+                {
+                        for (Service_T i = t->instance.list; i && ! s; i = i->next)
+                                if (IS(i->name, name))
+                                        s = i;
+                        for (Service_T i = t->instance.retiredlist; i && ! s; i = i->next)
+                                if (IS(i->name, name))
+                                        s = i;
+                }
+                END_LOCK;
+        }
+        return s;
+}
+
+
+void Instance_free(Service_T t) {
+        ASSERT(t);
+        LOCK(mutex)
+        {
+                while (t->instance.list) {
+                        Service_T s = t->instance.list;
+                        t->instance.list = s->next;
+                        _free(&s);
+                }
+                while (t->instance.retiredlist) {
+                        Service_T s = t->instance.retiredlist;
+                        t->instance.retiredlist = s->next;
+                        _free(&s);
+                }
+                t->instance.count = t->instance.skipped = 0;
+                t->instance.generation = 0;
+        }
+        END_LOCK;
+}
+
+
+void Instance_adopt(Service_T t) {
+        ASSERT(t);
+        LOCK(mutex)
+        {
+                for (Service_T s = t->instance.list; s; s = s->next)
+                        s->instance.owner = t;
+                for (Service_T s = t->instance.retiredlist; s; s = s->next)
+                        s->instance.owner = t;
+        }
+        END_LOCK;
+}
+
+
+void Instance_lock() {
+        Mutex_lock(mutex);
+}
+
+
+void Instance_unlock() {
+        Mutex_unlock(mutex);
+}
+
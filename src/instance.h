@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_INSTANCE_H
+#define MONIT_INSTANCE_H
+
+
+/**
+ * Process, filesystem and file instances.
+ *
+ * A process service with the "matching" pattern and the "instances" option
+ * is a template: each process which matches the pattern gets its own
+ * lightweight instance service, named after the template and the pid, for
+ * example "php-fpm[1234]". The instances are created and retired in the
+ * process table pass of the template check, so no reload is needed.
+ * Similarly the "check filesystem all" service is a template of the
+ * mounted filesystems, for example "all[/var]", which is synchronized with
+ * the mount table when the table changes, and the file service with a
+ * wildcard path is a template of the matching files, for example
+ * "applogs[/var/log/app/a.log]", which keep their own read position while
+ * their lines are matched by the template's content patterns. The
+ * instances share the template's rules and alerts, which are immutable,
+ * and are not part of the service list: they cannot be controlled, the
+ * only actions they support are alert and exec. A retired instance is
+ * kept for INSTANCES_GRACE seconds, so the events which are still being
+ * delivered can find it.
+ *
+ *  @file
+ */
+
+
+/**
+ * Synchronize the instances of the template with the process table: the
+ * instances of the processes which exited or don't match anymore are
+ * retired, the new matching processes get an instance up to the maximum.
+ * The process data of the live instances are updated. Must be called from
+ * the template check, which is the only writer of the instance lists
+ * @param s The template service
+ */
+void Instance_update(Service_T s);
+
+
+/**
+ * Synchronize the filesystem instances of the template with the mount
+ * table. The instances are created and retired only if the mount table
+ * changed since the last update. Must be called from the template check
+ * @param s The template service
+ * @return true if succeeded, false if the mount table is not available
+ */
+boolean_t Instance_updateFilesystems(Service_T s);
+
+
+/**
+ * Synchronize the file instances of the template with the files matching
+ * its path pattern: the instances of the removed files are retired, the
+ * new matching files get an instance up to the maximum. Must be called
+ * from the template check
+ * @param s The template service
+ * @return true if succeeded, false if the pattern cannot be expanded
+ */
+boolean_t Instance_updateFiles(Service_T s);
+
+
+/**
+ * Restore the file instance saved in the state file, so the content match
+ * resumes at the saved read position. The saved instances of the removed
+ * templates are ignored
+ * @param name The instance name
+ * @param inode The inode number of the file
+ * @param readpos The read position in the file
+ */
+void Instance_restoreFile(const char *name, unsigned long long inode, unsigned long long readpos);
+
+
+/**
+ * Get the live or recently retired instance by name
+ * @param name The instance name
+ * @return The instance service or NULL if not found
+ */
+Service_T Instance_get(const char *name);
+
+
+/**
+ * Free all instances of the template
+ * @param s The template service
+ */
+void Instance_free(Service_T s);
+
+
+/**
+ * Point the instances to their template. Must be called when the template
+ * data, including the instance lists, were moved to another service
+ * object, as on reload for the unchanged services
+ * @param s The template service
+ */
+void Instance_adopt(Service_T s);
+
+
+/**
+ * Lock the instance lists for reading from another thread than the
+ * template check
+ */
+void Instance_lock(void);
+
+
+/**
+ * Unlock the instance lists
+ */
+void Instance_unlock(void);
+
+
+#endif
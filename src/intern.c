@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDDEF_H
+#include <stddef.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "intern.h"
+
+/**
+ *  Interned strings.
+ *
+ *  The strings are kept in a chained hash table, the entry holds the
+ *  reference count and the string. The interned string is the string of
+ *  the entry, so the entry is found from the string without a lookup. The
+ *  table grows when it is twice as full as its size and shrinks never.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define INTERN_SIZE 64 // initial number of buckets, a power of two
+
+
+typedef struct myintern {
+        struct myintern *next;
+        unsigned int hash;
+        int references;
+        char string[];
+} *Intern_T;
+
+
+static struct {
+        Mutex_T mutex;
+        Intern_T *table;
+        unsigned int size;
+        int count;
+} intern = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/* FNV-1a */
+static unsigned int _hash(const char *s) {
+        unsigned int h = 2166136261U;
+        for (; *s; s++)
+                h = (h ^ (unsigned char)*s) * 16777619U;
+        return h;
+}
+
+
+static inline Intern_T _entry(const char *s) {
+        return (Intern_T)(s - offsetof(struct myintern, string));
+}
+
+
+static void _grow() {
+        unsigned int size = intern.size ? intern.size * 2 : INTERN_SIZE;
+        Intern_T *table = CALLOC(size, sizeof(Intern_T));
+        for (unsigned int i = 0; i < intern.size; i++) {
+                for (Intern_T e = intern.table[i], next; e; e = next) {
+                        next = e->next;
+                        e->next = table[e->hash & (size - 1)];
+                        table[e->hash & (size - 1)] = e;
+                }
+        }
+        FREE(intern.table);
+        intern.table = table;
+        intern.size = size;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+const char *Intern_get(const char *s) {
+        if (! s)
+                return NULL;
+        Intern_T e;
+        unsigned int hash = _hash(s);
+        LOCK(intern.mutex)
+        {
+                if (intern.count >= (int)intern.size * 2)
+                        _grow();
+                Intern_T *bucket = &intern.table[hash & (intern.size - 1)];
+                for (e = *bucket; e; e = e->next)
+                        if (e->hash == hash && IS(e->string, s))
+                                break;
+                if (e) {
+                        e->references++;
+                } else {
+                        size_t length = strlen(s);
+                        e = ALLOC(sizeof(struct myintern) + length + 1);
+                        memcpy(e->string, s, length + 1);
+                        e->hash = hash;
+                        e->references = 1;
+                        e->next = *bucket;
+                        *bucket = e;
+                        intern.count++;
+                }
+        }
+        END_LOCK;
+        return e->string;
+}
+
+
+const char *Intern_copy(const char *s) {
+        if (s)
+                __sync_fetch_and_add(&_entry(s)->references, 1);
+        return s;
+}
+
+
+void Intern_release(const char **s) {
+        ASSERT(s);
+        if (! *s)
+                return;
+        Intern_T e = _entry(*s);
+        *s = NULL;
+        LOCK(intern.mutex)
+        {
+                if (__sync_sub_and_fetch(&e->references, 1) == 0) {
+                        for (Intern_T *p = &intern.table[e->hash & (intern.size - 1)]; *p; p = &(*p)->next) {
+                                if (*p == e) {
+                                        *p = e->next;
+                                        break;
+                                }
+                        }
+                        intern.count--;
+                        FREE(e);
+                }
+        }
+        END_LOCK;
+}
+
+
+int Intern_count() {
+        int count;
+        LOCK(intern.mutex)
+        {
+                count = intern.count;
+        }
+        END_LOCK;
+        return count;
+}
+
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_INTERN_H
+#define MONIT_INTERN_H
+
+
+/**
+ * Interned strings.
+ *
+ * The events refer to their service by name and the name is copied to
+ * each posted event, to the queue replay batches, to the event buffer
+ * and to the delivery copies. The intern table keeps one reference
+ * counted copy of each name, so the copies share it and the source of
+ * two events can be compared by the address. The table is protected by
+ * a mutex and can be used from the event delivery thread.
+ *
+ *  @file
+ */
+
+
+/**
+ * Get the interned copy of the string. The string reference count is
+ * incremented, release it using Intern_release()
+ * @param s The string
+ * @return The interned string or NULL if s is NULL
+ */
+const char *Intern_get(const char *s);
+
+
+/**
+ * Get a new reference of the interned string
+ * @param s The string returned by Intern_get() or NULL
+ * @return The string s
+ */
+const char *Intern_copy(const char *s);
+
+
+/**
+ * Release the interned string. The string is freed when the last
+ * reference was released
+ * @param s The interned string reference, set to NULL
+ */
+void Intern_release(const char **s);
+
+
+/**
+ * Get the number of the interned strings
+ * @return The number of strings in the table
+ */
+int Intern_count();
+
+
+#endif
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDDEF_H
+#include <stddef.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_CTYPE_H
+#include <ctype.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#include "monit.h"
+#include "journal.h"
+
+// libmonit
+#include "util/Str.h"
+
+
+/**
+ *  Segmented append-only journal.
+ *
+ *  Segment files are named journal.NNNNNNNNNN, each record in the segment
+ *  is stored as [magic][length][crc32][data]. The head cursor file stores
+ *  [segment][offset][crc32] of the first pending record.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define T Journal_T
+
+#define JOURNAL_MAGIC       0x4d4a524eU // "MJRN"
+#define JOURNAL_SEGMENT     1048576     // Segment size which triggers a switch to a new segment
+#define JOURNAL_RECORD_MAX  1048576     // Maximum record size
+#define JOURNAL_PREFIX      "journal."
+#define JOURNAL_HEAD        "journal.head"
+
+
+typedef struct myheader {
+        uint32_t magic;                                          /**< Record magic */
+        uint32_t length;                                  /**< Record data length */
+        uint32_t crc;                                   /**< CRC-32 of record data */
+} Header_T;
+
+
+typedef struct mycursor {
+        uint32_t segment;                                      /**< Segment number */
+        uint32_t offset;                                /**< Offset in the segment */
+        uint32_t crc;                     /**< CRC-32 of the segment and offset */
+} Cursor_T;
+
+
+struct T {
+        char *dir;                                          /**< Journal directory */
+        int fd;                         /**< Tail segment descriptor (for writing) */
+        uint32_t tail;                                    /**< Tail segment number */
+        off_t tailsize;                                     /**< Tail segment size */
+        uint32_t head;                                    /**< Head segment number */
+        off_t headoffset;                        /**< First pending record offset */
+        int rfd;                             /**< Read segment descriptor or -1 */
+        uint32_t read;                                    /**< Read segment number */
+        off_t readoffset;                             /**< Next record to be read */
+        uint32_t limit;                         /**< Read pass end segment number */
+        off_t limitoffset;                             /**< Read pass end offset */
+        int count;                                   /**< Pending records count */
+        int consumed;                      /**< Records read in this pass count */
+        boolean_t dirty;                     /**< Records appended since last sync */
+};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static uint32_t _crc32(const void *data, size_t size) {
+        const unsigned char *p = data;
+        uint32_t crc = 0xFFFFFFFFU;
+        while (size--) {
+                crc ^= *p++;
+                for (int i = 0; i < 8; i++)
+                        crc = (crc >> 1) ^ (0xEDB88320U & -(crc & 1));
+        }
+        return ~crc;
+}
+
+
+static char *_path(T J, uint32_t segment, char *path, int size) {
+        snprintf(path, size, "%s/%s%010u", J->dir, JOURNAL_PREFIX, segment);
+        return path;
+}
+
+
+static int _openSegment(T J, uint32_t segment, int flags) {
+        char path[PATH_MAX];
+        int fd = open(_path(J, segment, path, sizeof(path)), flags | O_CLOEXEC, 0600);
+        if (fd < 0 && ! (errno == ENOENT && ! (flags & O_CREAT)))
+                LogError("Event queue journal: cannot open %s -- %s\n", path, STRERROR);
+        return fd;
+}
+
+
+static void _removeSegment(T J, uint32_t segment) {
+        char path[PATH_MAX];
+        if (unlink(_path(J, segment, path, sizeof(path))) && errno != ENOENT)
+                LogError("Event queue journal: cannot remove %s -- %s\n", path, STRERROR);
+}
+
+
+/**
+ * Read the record at the given offset. Returns 1 if the record was read
+ * (the data may be NULL if not requested), 0 at the end of the segment and
+ * -1 if the record is incomplete or corrupted
+ */
+static int _readRecord(int fd, off_t offset, void **data, size_t *size) {
+        Header_T h;
+        ssize_t n = pread(fd, &h, sizeof(h), offset);
+        if (n == 0)
+                return 0;
+        if (n != sizeof(h) || h.magic != JOURNAL_MAGIC || h.length > JOURNAL_RECORD_MAX)
+                return -1;
+        void *buf = ALLOC(h.length ? h.length : 1);
+        if (pread(fd, buf, h.length, offset + sizeof(h)) != (ssize_t)h.length || _crc32(buf, h.length) != h.crc) {
+                FREE(buf);
+                return -1;
+        }
+        *size = h.length;
+        if (data)
+                *data = buf;
+        else
+                FREE(buf);
+        return 1;
+}
+
+
+static void _readCursor(T J, uint32_t first, uint32_t last) {
+        char path[PATH_MAX];
+        J->head = first;
+        J->headoffset = 0;
+        snprintf(path, sizeof(path), "%s/%s", J->dir, JOURNAL_HEAD);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+                Cursor_T c;
+                if (read(fd, &c, sizeof(c)) == sizeof(c) && c.crc == _crc32(&c, offsetof(Cursor_T, crc)) && c.segment >= first && c.segment <= last) {
+                        J->head = c.segment;
+                        J->headoffset = c.offset;
+                }
+                close(fd);
+        }
+}
+
+
+static void _writeCursor(T J) {
+        char path[PATH_MAX], tmp[PATH_MAX];
+        Cursor_T c = {.segment = J->head, .offset = (uint32_t)J->headoffset};
+        c.crc = _crc32(&c, offsetof(Cursor_T, crc));
+        snprintf(path, sizeof(path), "%s/%s", J->dir, JOURNAL_HEAD);
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+                LogError("Event queue journal: cannot write %s -- %s\n", tmp, STRERROR);
+                return;
+        }
+        boolean_t written = write(fd, &c, sizeof(c)) == sizeof(c);
+        close(fd);
+        if (! written || rename(tmp, path)) {
+                LogError("Event queue journal: cannot write %s -- %s\n", path, STRERROR);
+                unlink(tmp);
+        }
+}
+
+
+/**
+ * Count the pending records from the head cursor. The incomplete record at
+ * the end of the tail segment is the result of an interrupted write and is
+ * truncated, a corrupted record in older segments drops the rest of the
+ * segment
+ */
+static void _scan(T J) {
+        size_t size;
+        for (uint32_t segment = J->head; segment <= J->tail; segment++) {
+                int fd = _openSegment(J, segment, segment == J->tail ? O_RDWR : O_RDONLY);
+                if (fd < 0)
+                        continue;
+                off_t offset = segment == J->head ? J->headoffset : 0;
+                int rv;
+                while ((rv = _readRecord(fd, offset, NULL, &size)) > 0) {
+                        offset += sizeof(Header_T) + size;
+                        J->count++;
+                }
+                if (rv < 0) {
+                        if (segment == J->tail) {
+                                LogError("Event queue journal: truncating incomplete record at segment %u offset %lld\n", segment, (long long)offset);
+                                if (ftruncate(fd, offset))
+                                        LogError("Event queue journal: cannot truncate segment %u -- %s\n", segment, STRERROR);
+                        } else {
+                                LogError("Event queue journal: corrupted record at segment %u offset %lld, the rest of the segment is dropped\n", segment, (long long)offset);
+                        }
+                }
+                close(fd);
+        }
+}
+
+
+static boolean_t _openTail(T J) {
+        if ((J->fd = _openSegment(J, J->tail, O_WRONLY | O_APPEND | O_CREAT)) < 0)
+                return false;
+        struct stat st;
+        J->tailsize = fstat(J->fd, &st) ? 0 : st.st_size;
+        return true;
+}
+
+
+static void _closeRead(T J) {
+        if (J->rfd >= 0) {
+                close(J->rfd);
+                J->rfd = -1;
+        }
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+T Journal_open(const char *dir) {
+        ASSERT(dir);
+        DIR *d = opendir(dir);
+        if (! d) {
+                LogError("Event queue journal: cannot open directory %s -- %s\n", dir, STRERROR);
+                return NULL;
+        }
+        uint32_t first = 0, last = 0;
+        struct dirent *de;
+        while ((de = readdir(d))) {
+                char *end;
+                if (Str_startsWith(de->d_name, JOURNAL_PREFIX) && isdigit((unsigned char)de->d_name[strlen(JOURNAL_PREFIX)])) {
+                        unsigned long segment = strtoul(de->d_name + strlen(JOURNAL_PREFIX), &end, 10);
+                        if (*end == 0 && segment > 0 && segment <= UINT32_MAX) {
+                                if (! first || segment < first)
+                                        first = (uint32_t)segment;
+                                if (segment > last)
+                                        last = (uint32_t)segment;
+                        }
+                }
+        }
+        closedir(d);
+        T J;
+        NEW(J);
+        J->dir = Str_dup(dir);
+        J->rfd = -1;
+        if (! first) {
+                J->head = J->tail = 1;
+        } else {
+                J->tail = last;
+                _readCursor(J, first, last);
+                for (uint32_t segment = first; segment < J->head; segment++)
+                        _removeSegment(J, segment);
+                _scan(J);
+        }
+        if (! _openTail(J)) {
+                FREE(J->dir);
+                FREE(J);
+                return NULL;
+        }
+        J->read = J->head;
+        J->readoffset = J->headoffset;
+        DEBUG("Event queue journal %s opened with %d record(s) pending\n", dir, J->count);
+        return J;
+}
+
+
+void Journal_close(T *J) {
+        ASSERT(J && *J);
+        Journal_sync(*J);
+        _closeRead(*J);
+        if ((*J)->fd >= 0)
+                close((*J)->fd);
+        FREE((*J)->dir);
+        FREE(*J);
+}
+
+
+const char *Journal_getDirectory(T J) {
+        ASSERT(J);
+        return J->dir;
+}
+
+
+boolean_t Journal_append(T J, const void *data, size_t size) {
+        ASSERT(J);
+        ASSERT(data);
+        if (size > JOURNAL_RECORD_MAX) {
+                LogError("Event queue journal: record too large (%zu bytes)\n", size);
+                return false;
+        }
+        if (J->fd < 0 && ! _openTail(J))
+                return false;
+        if (J->tailsize >= JOURNAL_SEGMENT && J->tail < UINT32_MAX) {
+                // Switch to a new segment, the previous one stays until read
+                Journal_sync(J);
+                close(J->fd);
+                J->tail++;
+                if (! _openTail(J))
+                        return false;
+        }
+        Header_T h = {.magic = JOURNAL_MAGIC, .length = (uint32_t)size, .crc = _crc32(data, size)};
+        struct iovec iov[2] = {{.iov_base = &h, .iov_len = sizeof(h)}, {.iov_base = (void *)data, .iov_len = size}};
+        ssize_t n = writev(J->fd, iov, 2);
+        if (n != (ssize_t)(sizeof(h) + size)) {
+                LogError("Event queue journal: cannot append record -- %s\n", n < 0 ? STRERROR : "short write");
+                // Drop the partial record so the following appends stay readable
+                if (n > 0 && ftruncate(J->fd, J->tailsize))
+                        LogError("Event queue journal: cannot truncate segment %u -- %s\n", J->tail, STRERROR);
+                return false;
+        }
+        J->tailsize += n;
+        J->count++;
+        J->dirty = true;
+        return true;
+}
+
+
+void Journal_sync(T J) {
+        ASSERT(J);
+        if (J->dirty && J->fd >= 0) {
+                if (fsync(J->fd))
+                        LogError("Event queue journal: fsync failed -- %s\n", STRERROR);
+                J->dirty = false;
+        }
+}
+
+
+int Journal_count(T J) {
+        ASSERT(J);
+        return J->count;
+}
+
+
+unsigned long long Journal_size(T J) {
+        ASSERT(J);
+        if (J->head == J->tail)
+                return J->tailsize > J->headoffset ? J->tailsize - J->headoffset : 0;
+        unsigned long long size = J->tailsize;
+        for (uint32_t segment = J->head; segment != J->tail; segment++) {
+                char path[PATH_MAX];
+                struct stat sb;
+                if (stat(_path(J, segment, path, sizeof(path)), &sb) == 0)
+                        size += segment == J->head ? (sb.st_size > J->headoffset ? sb.st_size - J->headoffset : 0) : sb.st_size;
+        }
+        return size;
+}
+
+
+void Journal_begin(T J) {
+        ASSERT(J);
+        _closeRead(J);
+        J->read = J->head;
+        J->readoffset = J->headoffset;
+        J->limit = J->tail;
+        J->limitoffset = J->tailsize;
+        J->consumed = 0;
+}
+
+
+void *Journal_next(T J, size_t *size) {
+        ASSERT(J);
+        ASSERT(size);
+        while (J->read < J->limit || (J->read == J->limit && J->readoffset < J->limitoffset)) {
+                if (J->rfd < 0 && (J->rfd = _openSegment(J, J->read, O_RDONLY)) < 0) {
+                        if (J->read == J->limit)
+                                break;
+                        J->read++;
+                        J->readoffset = 0;
+                        continue;
+                }
+                void *data = NULL;
+                if (_readRecord(J->rfd, J->readoffset, &data, size) > 0) {
+                        J->readoffset += sizeof(Header_T) + *size;
+                        J->consumed++;
+                        return data;
+                }
+                // End of segment or corruption (skipped when scanned on open): continue with the next segment
+                _closeRead(J);
+                if (J->read == J->limit)
+                        break;
+                J->read++;
+                J->readoffset = 0;
+        }
+        return NULL;
+}
+
+
+void Journal_commit(T J) {
+        ASSERT(J);
+        _closeRead(J);
+        uint32_t head = J->head;
+        J->head = J->read;
+        J->headoffset = J->readoffset;
+        J->count = J->consumed > J->count ? 0 : J->count - J->consumed;
+        J->consumed = 0;
+        if (J->head == J->tail && J->headoffset >= J->tailsize && J->tail < UINT32_MAX) {
+                // Everything was read: start a new segment so the consumed tail can be removed
+                Journal_sync(J);
+                close(J->fd);
+                J->tail++;
+                J->head = J->tail;
+                J->headoffset = 0;
+                if (! _openTail(J))
+                        J->fd = -1;
+        }
+        _writeCursor(J);
+        for (uint32_t segment = head; segment < J->head; segment++)
+                _removeSegment(J, segment);
+        J->read = J->head;
+        J->readoffset = J->headoffset;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_JOURNAL_H
+#define MONIT_JOURNAL_H
+
+
+/**
+ * Segmented append-only journal of records, used for the event queue.
+ *
+ * The records are appended to the tail segment file of the journal
+ * directory, each record carries its length and CRC-32 checksum, so a torn
+ * write at the tail (crash) is detected and truncated on open. The records
+ * are read in FIFO order from the head cursor which is persisted in the
+ * journal.head file, segments which were read completely are removed. The
+ * number of pending records is kept in memory, so the quota check is O(1).
+ * Appends are not synchronized to disk one by one, Journal_sync() flushes
+ * all appends since the previous sync at once (group fsync).
+ *
+ * The journal is not thread safe, the caller must serialize the access.
+ *
+ * @file
+ */
+
+
+#define T Journal_T
+typedef struct T *T;
+
+
+/**
+ * Open the journal in the given directory. The directory must exist
+ * @param dir The journal directory
+ * @return The journal or NULL if it cannot be opened
+ */
+T Journal_open(const char *dir);
+
+
+/**
+ * Synchronize and close the journal
+ * @param J A Journal object reference
+ */
+void Journal_close(T *J);
+
+
+/**
+ * Returns the journal directory
+ * @param J A Journal object
+ * @return The directory
+ */
+const char *Journal_getDirectory(T J);
+
+
+/**
+ * Append the record to the journal tail
+ * @param J A Journal object
+ * @param data The record data
+ * @param size The record size
+ * @return true if succeeded, otherwise false
+ */
+boolean_t Journal_append(T J, const void *data, size_t size);
+
+
+/**
+ * Flush the appended records to disk
+ * @param J A Journal object
+ */
+void Journal_sync(T J);
+
+
+/**
+ * Returns the number of records pending in the journal
+ * @param J A Journal object
+ * @return The number of records
+ */
+int Journal_count(T J);
+
+
+/**
+ * Returns the disk space used by the pending records. The segments
+ * between the head and the tail are stat'ed, so the call is not free
+ * @param J A Journal object
+ * @return The size of the pending records in bytes
+ */
+unsigned long long Journal_size(T J);
+
+
+/**
+ * Start reading the journal from the head. The records appended while
+ * reading are not returned in this pass
+ * @param J A Journal object
+ */
+void Journal_begin(T J);
+
+
+/**
+ * Read the next record
+ * @param J A Journal object
+ * @param size Set to the record size
+ * @return The record data which the caller must free or NULL if no more
+ * records are available in this pass
+ */
+void *Journal_next(T J, size_t *size);
+
+
+/**
+ * Move the head cursor past the records read in this pass and remove the
+ * segments which were read completely
+ * @param J A Journal object
+ */
+void Journal_commit(T J);
+
+
+#undef T
+#endif
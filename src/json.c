@@ -0,0 +1,765 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include "monit.h"
+#include "event.h"
+#include "process.h"
+#include "latency.h"
+#include "history.h"
+#include "output.h"
+
+// libmonit
+#include "system/Time.h"
+
+
+/**
+ *  JSON routines for the status and event notification messages. The
+ *  document is written service by service and the caller can send and
+ *  clear the buffer between the services, so the whole document is
+ *  never held in memory.
+ *
+ *  @file
+ */
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Append the quoted and escaped JSON string. The runs of characters which
+ * don't need the escape are copied at once
+ * @param B Output StringBuffer object
+ * @param s String to escape, NULL is printed as an empty string
+ */
+static void _string(StringBuffer_T B, const char *s) {
+        StringBuffer_append(B, "\"");
+        Output_escape(B, s, Output_Json);
+        StringBuffer_append(B, "\"");
+}
+
+
+/**
+ * Append the member name and the JSON string value
+ * @param B Output StringBuffer object
+ * @param name The member name
+ * @param value The string value
+ */
+static void _member(StringBuffer_T B, const char *name, const char *value) {
+        StringBuffer_append(B, ",\"%s\":", name);
+        _string(B, value);
+}
+
+
+/**
+ * Prints a latency histogram summary, the durations are in microseconds
+ * @param B StringBuffer object
+ * @param name The member name
+ * @param L Latency histogram
+ */
+static void _latency(StringBuffer_T B, const char *name, Latency_T L) {
+        StringBuffer_append(B,
+                            "\"%s\":{"
+                            "\"count\":%llu,"
+                            "\"min\":%llu,"
+                            "\"avg\":%llu,"
+                            "\"p99\":%llu,"
+                            "\"max\":%llu"
+                            "}",
+                            name,
+                            L->count,
+                            L->min,
+                            Latency_average(L),
+                            Latency_percentile(L, 99),
+                            L->max);
+}
+
+
+/**
+ * Prints a document header into the given buffer.
+ * @param B StringBuffer object
+ * @param myip The client-side IP address
+ * @param delta true if the document contains only the changed services
+ */
+/**
+ * The metric name in the history document and the scale of the value to
+ * the natural unit (percent, bytes, load, count)
+ */
+static const char *_historyMetric(Resource_Type id, double *scale) {
+        *scale = 0.1;
+        switch (id) {
+                case Resource_CpuPercent:          return "cpu";
+                case Resource_CpuPercentTotal:     return "cpu_total";
+                case Resource_CpuUser:             return "cpu_user";
+                case Resource_CpuSystem:           return "cpu_system";
+                case Resource_CpuWait:             return "cpu_wait";
+                case Resource_CpuMax:              return "cpu_max";
+                case Resource_CpuNodeMax:          return "cpu_node_max";
+                case Resource_MemoryPercent:       return "memory_percent";
+                case Resource_MemoryPercentTotal:  return "memory_total_percent";
+                case Resource_SwapPercent:         return "swap_percent";
+                case Resource_LoadAverage1m:       return "load1";
+                case Resource_LoadAverage5m:       return "load5";
+                case Resource_LoadAverage15m:      return "load15";
+                default:                           break;
+        }
+        *scale = 1024.;
+        switch (id) {
+                case Resource_MemoryKbyte:         return "memory";
+                case Resource_MemoryKbyteTotal:    return "memory_total";
+                case Resource_SwapKbyte:           return "swap";
+                default:                           break;
+        }
+        *scale = 1.;
+        switch (id) {
+                case Resource_Children:            return "children";
+                case Resource_Tasks:               return "tasks";
+                case Resource_FileDescriptors:     return "filedescriptors";
+                case Resource_ReadBytes:           return "read";
+                case Resource_WriteBytes:          return "write";
+                case Resource_Size:                return "size";
+                default:                           return "unknown";
+        }
+}
+
+
+static void document_head(StringBuffer_T B, const char *myip, boolean_t delta, unsigned long long generation) {
+        StringBuffer_append(B, "{\"id\":");
+        _string(B, Run.id);
+        StringBuffer_append(B, ",\"incarnation\":%lld,\"generation\":%llu", (long long)Run.incarnation, generation);
+        _member(B, "version", VERSION);
+        StringBuffer_append(B,
+                            ",\"delta\":%s"
+                            ",\"server\":{"
+                            "\"uptime\":%lld,"
+                            "\"poll\":%d,"
+                            "\"startdelay\":%d",
+                            delta ? "true" : "false",
+                            (long long)getProcessUptime(getpid(), ptree, ptreesize),
+                            Run.polltime,
+                            Run.startdelay);
+        _member(B, "localhostname", Run.system->name);
+        _member(B, "controlfile", Run.controlfile);
+        StringBuffer_append(B, ",\"latency\":{");
+        _latency(B, "cycle", &Run.latency.cycle);
+        StringBuffer_append(B, ",");
+        _latency(B, "processtree", &Run.latency.processtree);
+        StringBuffer_append(B, ",");
+        _latency(B, "event", &Run.latency.event);
+        StringBuffer_append(B, ",");
+        _latency(B, "request", &Run.latency.request);
+        StringBuffer_append(B, ",");
+        _latency(B, "report", &Run.latency.report);
+        StringBuffer_append(B, ",");
+        _latency(B, "delivery", &Run.latency.delivery);
+        StringBuffer_append(B,
+                            ",\"deliveries\":%d"
+                            ",\"deliveriespeak\":%d"
+                            ",\"overruns\":%llu"
+                            ",\"usage\":{"
+                            "\"cpuuser\":%llu,"
+                            "\"cpusystem\":%llu,"
+                            "\"maxrss\":%ld,"
+                            "\"faults\":%ld,"
+                            "\"switches\":%ld,"
+                            "\"blockio\":%ld,"
+                            "\"cpupercent\":%.1f,"
+                            "\"rss\":%ld,"
+                            "\"heap\":%lld,"
+                            "\"heapgrowth\":%lld,"
+                            "\"fds\":%d,"
+                            "\"queue\":%d,"
+                            "\"queuesize\":%llu,"
+                            "\"requestrate\":%.2f,"
+                            "\"cost\":{",
+                            Run.latency.deliveries,
+                            Run.latency.deliveries_peak,
+                            Run.latency.overruns,
+                            Run.latency.usage.cpuuser,
+                            Run.latency.usage.cpusystem,
+                            Run.latency.usage.maxrss,
+                            Run.latency.usage.faults,
+                            Run.latency.usage.switches,
+                            Run.latency.usage.blockio,
+                            Run.latency.usage.cpupercent / 10.,
+                            Run.latency.usage.rss,
+                            Run.latency.usage.heap,
+                            Run.latency.usage.heapgrowth,
+                            Run.latency.usage.fds,
+                            Run.latency.usage.queue,
+                            Run.latency.usage.queuesize,
+                            Run.latency.usage.requestrate);
+        for (int i = 0; i < Cost_Types; i++)
+                StringBuffer_append(B, "%s\"%s\":%llu", i ? "," : "", Latency_costName(i), Run.latency.usage.cost[i]);
+        StringBuffer_append(B, "}}}");
+
+        if (Run.httpd.flags & Httpd_Net || Run.httpd.flags & Httpd_Unix) {
+                if (Run.httpd.flags & Httpd_Net) {
+                        StringBuffer_append(B, ",\"httpd\":{\"address\":");
+                        _string(B, Run.httpd.socket.net.address ? Run.httpd.socket.net.address : myip);
+                        StringBuffer_append(B, ",\"port\":%d,\"ssl\":%s}", Run.httpd.socket.net.port, Run.httpd.flags & Httpd_Ssl ? "true" : "false");
+                } else if (Run.httpd.flags & Httpd_Unix) {
+                        StringBuffer_append(B, ",\"httpd\":{\"unixsocket\":");
+                        _string(B, Run.httpd.socket.unix.path);
+                        StringBuffer_append(B, "}");
+                }
+
+                if (Run.mmonitcredentials) {
+                        StringBuffer_append(B, ",\"credentials\":{\"username\":");
+                        _string(B, Run.mmonitcredentials->uname);
+                        _member(B, "password", Run.mmonitcredentials->passwd);
+                        StringBuffer_append(B, "}");
+                }
+        }
+
+        StringBuffer_append(B, "},\"platform\":{\"name\":");
+        _string(B, systeminfo.uname.sysname);
+        _member(B, "release", systeminfo.uname.release);
+        _member(B, "version", systeminfo.uname.version);
+        _member(B, "machine", systeminfo.uname.machine);
+        StringBuffer_append(B,
+                            ",\"cpu\":%d"
+                            ",\"memory\":%lu"
+                            ",\"swap\":%lu"
+                            "}",
+                            systeminfo.cpus,
+                            systeminfo.mem_kbyte_max,
+                            systeminfo.swap_kbyte_max);
+}
+
+
+/**
+ * Prints the file, directory, fifo or filesystem permission and owner
+ * @param B StringBuffer object
+ * @param mode The permission
+ * @param uid The owner
+ * @param gid The group
+ */
+static void status_owner(StringBuffer_T B, int mode, int uid, int gid) {
+        StringBuffer_append(B, ",\"mode\":\"%04o\",\"uid\":%d,\"gid\":%d", mode & 07777, uid, gid);
+}
+
+
+/**
+ * Prints the network link statistics of one direction
+ * @param B StringBuffer object
+ * @param name The member name
+ * @param packets Packets per second and total
+ * @param bytes Bytes per second and total
+ * @param errors Errors per second and total
+ */
+static void status_link(StringBuffer_T B, const char *name, long long packets[2], long long bytes[2], long long errors[2]) {
+        StringBuffer_append(B,
+                            ",\"%s\":{"
+                            "\"packets\":{\"now\":%lld,\"total\":%lld},"
+                            "\"bytes\":{\"now\":%lld,\"total\":%lld},"
+                            "\"errors\":{\"now\":%lld,\"total\":%lld}"
+                            "}",
+                            name,
+                            packets[0], packets[1],
+                            bytes[0], bytes[1],
+                            errors[0], errors[1]);
+}
+
+
+/**
+ * Prints a service status into the given buffer.
+ * @param S Service object
+ * @param B StringBuffer object
+ * @param L Status information level
+ */
+static void status_service(Service_T S, StringBuffer_T B, Level_Type L) {
+        StringBuffer_append(B, "{\"name\":");
+        _string(B, S->name);
+        StringBuffer_append(B,
+                            ",\"type\":%d"
+                            ",\"collected_sec\":%lld"
+                            ",\"collected_usec\":%ld"
+                            ",\"status\":%d"
+                            ",\"status_hint\":%d"
+                            ",\"monitor\":%d"
+                            ",\"monitormode\":%d"
+                            ",\"pendingaction\":%d",
+                            S->type,
+                            (long long)S->collected.tv_sec,
+                            (long)S->collected.tv_usec,
+                            S->error,
+                            S->error_hint,
+                            S->monitor,
+                            S->mode,
+                            S->doaction);
+        if (L == Level_Full) {
+                StringBuffer_append(B, ",\"latency\":{");
+                for (int i = 0, first = true; i < Latency_Types; i++) {
+                        if (S->latency[i] && S->latency[i]->count) {
+                                if (! first)
+                                        StringBuffer_append(B, ",");
+                                _latency(B, Latency_name(i), S->latency[i]);
+                                first = false;
+                        }
+                }
+                StringBuffer_append(B, "}");
+        }
+        if (S->every.type != Every_Cycle) {
+                StringBuffer_append(B, ",\"every\":{\"type\":%d", S->every.type);
+                if (S->every.type == 1)
+                        StringBuffer_append(B, ",\"counter\":%d,\"number\":%d", S->every.spec.cycle.counter, S->every.spec.cycle.number);
+                else if (S->every.type == Every_Interval)
+                        StringBuffer_append(B, ",\"interval\":%d", S->every.spec.interval.seconds);
+                else
+                        _member(B, "cron", S->every.spec.cron.spec);
+                StringBuffer_append(B, "}");
+        }
+
+        /* if the service is in error state, display first active error message to provide more details */
+        for (Event_T E = S->eventlist; E; E = E->next) {
+                if ((E->state == State_Failed || E->state == State_Changed) && (S->error & E->id) && E->message) {
+                        _member(B, "status_message", E->message);
+                        break;
+                }
+        }
+        if (L == Level_Full && Util_hasServiceStatus(S)) {
+                switch (S->type) {
+                        case Service_File:
+                                status_owner(B, S->inf->priv.file.mode, (int)S->inf->priv.file.uid, (int)S->inf->priv.file.gid);
+                                StringBuffer_append(B,
+                                                    ",\"timestamp\":%lld"
+                                                    ",\"size\":%llu",
+                                                    (long long)S->inf->priv.file.timestamp,
+                                                    (unsigned long long)S->inf->priv.file.size);
+                                if (S->checksum) {
+                                        StringBuffer_append(B, ",\"checksum\":{\"type\":\"%s\",\"sum\":", checksumnames[S->checksum->type]);
+                                        _string(B, S->inf->priv.file.cs_sum);
+                                        StringBuffer_append(B, "}");
+                                }
+                                break;
+
+                        case Service_Directory:
+                                status_owner(B, S->inf->priv.directory.mode, (int)S->inf->priv.directory.uid, (int)S->inf->priv.directory.gid);
+                                StringBuffer_append(B, ",\"timestamp\":%lld", (long long)S->inf->priv.directory.timestamp);
+                                if (S->checksum) {
+                                        StringBuffer_append(B, ",\"checksum\":{\"type\":\"%s\",\"files\":%d,\"sum\":", checksumnames[S->checksum->type], S->inf->priv.directory.cs_files);
+                                        _string(B, S->inf->priv.directory.cs_sum);
+                                        StringBuffer_append(B, "}");
+                                }
+                                break;
+
+                        case Service_Fifo:
+                                status_owner(B, S->inf->priv.fifo.mode, (int)S->inf->priv.fifo.uid, (int)S->inf->priv.fifo.gid);
+                                StringBuffer_append(B, ",\"timestamp\":%lld", (long long)S->inf->priv.fifo.timestamp);
+                                break;
+
+                        case Service_Filesystem:
+                                status_owner(B, S->inf->priv.filesystem.mode, (int)S->inf->priv.filesystem.uid, (int)S->inf->priv.filesystem.gid);
+                                StringBuffer_append(B,
+                                                    ",\"flags\":%d"
+                                                    ",\"block\":{"
+                                                    "\"percent\":%.1f,"
+                                                    "\"usage\":%.1f,"
+                                                    "\"total\":%.1f"
+                                                    "}",
+                                                    S->inf->priv.filesystem.flags,
+                                                    S->inf->priv.filesystem.space_percent/10.,
+                                                    S->inf->priv.filesystem.f_bsize > 0 ? (double)S->inf->priv.filesystem.space_total / 1048576. * (double)S->inf->priv.filesystem.f_bsize : 0.,
+                                                    S->inf->priv.filesystem.f_bsize > 0 ? (double)S->inf->priv.filesystem.f_blocks / 1048576. * (double)S->inf->priv.filesystem.f_bsize : 0.);
+                                if (S->inf->priv.filesystem.f_files > 0) {
+                                        StringBuffer_append(B,
+                                                            ",\"inode\":{"
+                                                            "\"percent\":%.1f,"
+                                                            "\"usage\":%lld,"
+                                                            "\"total\":%lld"
+                                                            "}",
+                                                            S->inf->priv.filesystem.inode_percent/10.,
+                                                            S->inf->priv.filesystem.inode_total,
+                                                            S->inf->priv.filesystem.f_files);
+                                }
+                                break;
+
+                        case Service_Net:
+                                {
+                                        Link_T link = S->inf->priv.net.stats;
+                                        StringBuffer_append(B,
+                                                            ",\"link\":{"
+                                                            "\"state\":%d,"
+                                                            "\"speed\":%lld,"
+                                                            "\"duplex\":%d",
+                                                            Link_getState(link),
+                                                            Link_getSpeed(link),
+                                                            Link_getDuplex(link));
+                                        status_link(B, "download",
+                                                    (long long[2]){Link_getPacketsInPerSecond(link), Link_getPacketsInTotal(link)},
+                                                    (long long[2]){Link_getBytesInPerSecond(link), Link_getBytesInTotal(link)},
+                                                    (long long[2]){Link_getErrorsInPerSecond(link), Link_getErrorsInTotal(link)});
+                                        status_link(B, "upload",
+                                                    (long long[2]){Link_getPacketsOutPerSecond(link), Link_getPacketsOutTotal(link)},
+                                                    (long long[2]){Link_getBytesOutPerSecond(link), Link_getBytesOutTotal(link)},
+                                                    (long long[2]){Link_getErrorsOutPerSecond(link), Link_getErrorsOutTotal(link)});
+                                        StringBuffer_append(B, "}");
+                                }
+                                break;
+
+                        case Service_Process:
+                                StringBuffer_append(B,
+                                                    ",\"pid\":%d"
+                                                    ",\"ppid\":%d"
+                                                    ",\"uid\":%d"
+                                                    ",\"euid\":%d"
+                                                    ",\"gid\":%d"
+                                                    ",\"uptime\":%lld",
+                                                    S->inf->priv.process.pid,
+                                                    S->inf->priv.process.ppid,
+                                                    S->inf->priv.process.uid,
+                                                    S->inf->priv.process.euid,
+                                                    S->inf->priv.process.gid,
+                                                    (long long)S->inf->priv.process.uptime);
+                                if (Run.doprocess) {
+                                        StringBuffer_append(B,
+                                                            ",\"children\":%d"
+                                                            ",\"memory\":{"
+                                                            "\"percent\":%.1f,"
+                                                            "\"percenttotal\":%.1f,"
+                                                            "\"kilobyte\":%ld,"
+                                                            "\"kilobytetotal\":%ld"
+                                                            "}"
+                                                            ",\"cpu\":{"
+                                                            "\"percent\":%.1f,"
+                                                            "\"percenttotal\":%.1f"
+                                                            "}",
+                                                            S->inf->priv.process.children,
+                                                            S->inf->priv.process.mem_percent/10.0,
+                                                            S->inf->priv.process.total_mem_percent/10.0,
+                                                            S->inf->priv.process.mem_kbyte,
+                                                            S->inf->priv.process.total_mem_kbyte,
+                                                            S->inf->priv.process.cpu_percent/10.0,
+                                                            S->inf->priv.process.total_cpu_percent/10.0);
+                                        if (S->inf->priv.process.threads >= 0)
+                                                StringBuffer_append(B, ",\"threads\":%d", S->inf->priv.process.threads);
+                                        if (S->inf->priv.process.fds >= 0)
+                                                StringBuffer_append(B, ",\"filedescriptors\":%d", S->inf->priv.process.fds);
+                                        if (S->inf->priv.process.read_rate >= 0)
+                                                StringBuffer_append(B, ",\"read\":%lld,\"write\":%lld", S->inf->priv.process.read_rate, S->inf->priv.process.write_rate);
+                                }
+                                break;
+
+                        default:
+                                break;
+                }
+                if (S->cgroup) {
+                        StringBuffer_append(B,
+                                            ",\"cgroup\":{"
+                                            "\"version\":%d,"
+                                            "\"processes\":%d,"
+                                            "\"tasks\":%d,"
+                                            "\"memory\":{\"percent\":%.1f,\"kilobyte\":%lld},"
+                                            "\"cpu\":{\"percent\":%.1f},"
+                                            "\"read\":%lld,"
+                                            "\"write\":%lld"
+                                            "}",
+                                            S->cgroup->version,
+                                            S->cgroup->processes,
+                                            S->cgroup->tasks,
+                                            S->cgroup->mem_percent/10.0,
+                                            S->cgroup->mem_kbyte,
+                                            S->cgroup->cpu_percent/10.0,
+                                            S->cgroup->read_rate,
+                                            S->cgroup->write_rate);
+                }
+                if (S->processes) {
+                        StringBuffer_append(B,
+                                            ",\"processes\":{"
+                                            "\"matched\":%d,"
+                                            "\"offenders\":%d,"
+                                            "\"top\":[",
+                                            S->processes->matched,
+                                            S->processes->offenders);
+                        for (int i = 0; i < S->processes->top; i++) {
+                                Offender_T *o = &S->processes->offender[i];
+                                StringBuffer_append(B,
+                                                    "%s{\"pid\":%d,\"cpu\":{\"percent\":%.1f},\"memory\":{\"percent\":%.1f,\"kilobyte\":%lld},\"cmdline\":",
+                                                    i ? "," : "",
+                                                    (int)o->pid,
+                                                    o->cpu_percent/10.0,
+                                                    o->mem_percent/10.0,
+                                                    o->mem_kbyte);
+                                _string(B, o->cmdline);
+                                StringBuffer_append(B, "}");
+                        }
+                        StringBuffer_append(B, "]}");
+                }
+                if (S->icmplist) {
+                        StringBuffer_append(B, ",\"icmp\":[");
+                        for (Icmp_T i = S->icmplist; i; i = i->next)
+                                StringBuffer_append(B, "%s{\"type\":\"%s\",\"responsetime\":%.3f}", i == S->icmplist ? "" : ",", icmpnames[i->type], i->is_available ? i->response : -1.);
+                        StringBuffer_append(B, "]");
+                }
+                if (S->portlist) {
+                        StringBuffer_append(B, ",\"port\":[");
+                        for (Port_T p = S->portlist; p; p = p->next) {
+                                StringBuffer_append(B, "%s{\"hostname\":", p == S->portlist ? "" : ",");
+                                _string(B, p->hostname);
+                                StringBuffer_append(B, ",\"portnumber\":%d", p->port);
+                                _member(B, "request", p->request);
+                                _member(B, "protocol", p->protocol->name);
+                                _member(B, "type", Util_portTypeDescription(p));
+                                StringBuffer_append(B, ",\"responsetime\":%.3f}", p->is_available ? p->response : -1.);
+                        }
+                        StringBuffer_append(B, "]");
+                }
+                if (S->socketlist) {
+                        StringBuffer_append(B, ",\"unix\":[");
+                        for (Port_T p = S->socketlist; p; p = p->next) {
+                                StringBuffer_append(B, "%s{\"path\":", p == S->socketlist ? "" : ",");
+                                _string(B, p->pathname);
+                                _member(B, "protocol", p->protocol->name);
+                                StringBuffer_append(B, ",\"responsetime\":%.3f}", p->is_available ? p->response : -1.);
+                        }
+                        StringBuffer_append(B, "]");
+                }
+                if (S->type == Service_System && Run.doprocess) {
+                        StringBuffer_append(B,
+                                            ",\"system\":{"
+                                            "\"load\":{"
+                                            "\"avg01\":%.2f,"
+                                            "\"avg05\":%.2f,"
+                                            "\"avg15\":%.2f"
+                                            "},"
+                                            "\"cpu\":{"
+                                            "\"user\":%.1f,"
+                                            "\"system\":%.1f"
+#ifdef HAVE_CPU_WAIT
+                                            ",\"wait\":%.1f"
+#endif
+                                            "},"
+                                            "\"memory\":{"
+                                            "\"percent\":%.1f,"
+                                            "\"kilobyte\":%ld"
+                                            "},"
+                                            "\"swap\":{"
+                                            "\"percent\":%.1f,"
+                                            "\"kilobyte\":%ld"
+                                            "}"
+                                            "}",
+                                            systeminfo.loadavg[0],
+                                            systeminfo.loadavg[1],
+                                            systeminfo.loadavg[2],
+                                            systeminfo.total_cpu_user_percent > 0 ? systeminfo.total_cpu_user_percent/10. : 0,
+                                            systeminfo.total_cpu_syst_percent > 0 ? systeminfo.total_cpu_syst_percent/10. : 0,
+#ifdef HAVE_CPU_WAIT
+                                            systeminfo.total_cpu_wait_percent > 0 ? systeminfo.total_cpu_wait_percent/10. : 0,
+#endif
+                                            systeminfo.total_mem_percent/10.,
+                                            systeminfo.total_mem_kbyte,
+                                            systeminfo.total_swap_percent/10.,
+                                            systeminfo.total_swap_kbyte);
+                }
+                if (S->type == Service_Program && S->program->started) {
+                        StringBuffer_append(B,
+                                            ",\"program\":{"
+                                            "\"started\":%lld,"
+                                            "\"status\":%d",
+                                            (long long)S->program->started,
+                                            S->program->exitStatus);
+                        _member(B, "output", StringBuffer_toString(S->program->output));
+                        StringBuffer_append(B, "}");
+                }
+        }
+        StringBuffer_append(B, "}");
+}
+
+
+/**
+ * Prints a servicegroup into the given buffer.
+ * @param SG ServiceGroup object
+ * @param B StringBuffer object
+ */
+static void status_servicegroup(ServiceGroup_T SG, StringBuffer_T B) {
+        StringBuffer_append(B, "{\"name\":");
+        _string(B, SG->name);
+        StringBuffer_append(B, ",\"services\":[");
+        for (ServiceGroupMember_T SGM = SG->members; SGM; SGM = SGM->next) {
+                if (SGM != SG->members)
+                        StringBuffer_append(B, ",");
+                _string(B, SGM->name);
+        }
+        StringBuffer_append(B, "]}");
+}
+
+
+/**
+ * Prints a event description into the given buffer.
+ * @param E Event object
+ * @param B StringBuffer object
+ */
+static void status_event(Event_T E, StringBuffer_T B) {
+        struct timeval *tv = Event_get_collected(E);
+        StringBuffer_append(B,
+                            ",\"event\":{"
+                            "\"collected_sec\":%lld,"
+                            "\"collected_usec\":%ld",
+                            (long long)tv->tv_sec,
+                            (long)tv->tv_usec);
+        _member(B, "service", Event_get_id(E) == Event_Instance ? "Monit" : Event_get_source_name(E));
+        StringBuffer_append(B,
+                            ",\"type\":%d"
+                            ",\"id\":%ld"
+                            ",\"state\":%d"
+                            ",\"action\":%d",
+                            Event_get_source_type(E),
+                            Event_get_id(E),
+                            Event_get_state(E),
+                            Event_get_action(E));
+        _member(B, "message", Event_get_message(E));
+        Service_T s = Event_get_source(E);
+        if (s && s->token)
+                _member(B, "token", s->token);
+        StringBuffer_append(B, "}");
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+/**
+ * Get a JSON formated message for event notification or general status
+ * of monitored services and resources. The document has the same content
+ * as the XML message, see status_xml(). If the flush callback is set, it
+ * is called after each service with the buffer, it can send the buffered
+ * part of the document and clear the buffer.
+ * @param B StringBuffer object
+ * @param E An event object or NULL for general status
+ * @param L Status information level
+ * @param since Print only the services which changed since the given
+ * status generation (delta status report) or 0 for all services
+ * @param myip The client-side IP address
+ * @param flush Optional callback called with the context and the buffer
+ * @param context The flush callback context
+ * @return The status generation of the report
+ */
+unsigned long long status_json(StringBuffer_T B, Event_T E, Level_Type L, unsigned long long since, const char *myip, void (*flush)(void *context, StringBuffer_T B), void *context) {
+        unsigned long long generation = status_xml_generation();
+        boolean_t first = true;
+        document_head(B, myip, since > 0, generation);
+        StringBuffer_append(B, ",\"services\":[");
+        for (Service_T S = servicelist_conf; S; S = S->next_conf) {
+                if (! since || status_xml_changed(S, since)) {
+                        if (! first)
+                                StringBuffer_append(B, ",");
+                        status_service(S, B, since ? Level_Full : L);
+                        first = false;
+                        if (flush)
+                                flush(context, B);
+                }
+        }
+        StringBuffer_append(B, "],\"servicegroups\":[");
+        for (ServiceGroup_T SG = servicegrouplist; SG; SG = SG->next) {
+                if (SG != servicegrouplist)
+                        StringBuffer_append(B, ",");
+                status_servicegroup(SG, B);
+        }
+        StringBuffer_append(B, "]");
+        if (E)
+                status_event(E, B);
+        StringBuffer_append(B, "}");
+        if (flush)
+                flush(context, B);
+        return generation;
+}
+
+
+/**
+ * Print the metric history of the service (see history.h) as a JSON
+ * document: the samples of each metric as [time, value] pairs, the oldest
+ * sample first and the values in the natural units
+ * @param B Output StringBuffer object
+ * @param S The service
+ */
+void status_history(StringBuffer_T B, Service_T S) {
+        Resource_Type ids[32];
+        int count = History_metrics(S, ids, sizeof(ids) / sizeof(ids[0]));
+        time_t *times = CALLOC(HISTORY_SIZE, sizeof(time_t));
+        long long *values = CALLOC(HISTORY_SIZE, sizeof(long long));
+        StringBuffer_append(B, "{\"service\":");
+        _string(B, S->name);
+        StringBuffer_append(B, ",\"history\":[");
+        for (int i = 0; i < count; i++) {
+                double scale;
+                const char *metric = _historyMetric(ids[i], &scale);
+                StringBuffer_append(B, "%s{\"metric\":\"%s\",\"samples\":[", i ? "," : "", metric);
+                int samples = History_samples(S, ids[i], times, values, HISTORY_SIZE);
+                for (int k = 0; k < samples; k++) {
+                        char t[OUTPUT_INTEGER_SIZE], v[OUTPUT_INTEGER_SIZE];
+                        if (scale < 1.)
+                                StringBuffer_append(B, "%s[%s,%.1f]", k ? "," : "", Output_integer(times[k], t), values[k] * scale);
+                        else
+                                StringBuffer_append(B, "%s[%s,%s]", k ? "," : "", Output_integer(times[k], t), Output_integer(values[k] * scale, v));
+                }
+                StringBuffer_append(B, "]}");
+        }
+        StringBuffer_append(B, "]}");
+        FREE(times);
+        FREE(values);
+}
+
+
+/**
+ * Print the selected processes of the process tree as a JSON document.
+ * Must be called with the process tree lock held
+ * @param B Output StringBuffer object
+ * @param pt The process tree
+ * @param treesize The number of processes in the tree
+ * @param selected The indexes of the processes to print in the tree, in
+ * the print order
+ * @param count The number of the selected processes
+ * @param matched The number of the processes which matched the filter
+ */
+void status_processes(StringBuffer_T B, ProcessTree_T *pt, int treesize, int *selected, int count, int matched) {
+        time_t now = Time_now();
+        StringBuffer_append(B, "{\"total\":%d,\"matched\":%d,\"processes\":[", treesize, matched);
+        for (int i = 0; i < count; i++) {
+                ProcessTree_T *p = &pt[selected[i]];
+                StringBuffer_append(B,
+                        "%s{\"pid\":%d,\"ppid\":%d,\"uid\":%d,\"euid\":%d,\"gid\":%d,\"zombie\":%s,\"uptime\":%lld,"
+                        "\"children\":%d,\"cpu\":%.1f,\"totalcpu\":%.1f,\"memory\":%lu,\"totalmemory\":%lu,\"cmdline\":",
+                        i ? "," : "",
+                        (int)p->pid, (int)p->ppid, p->uid, p->euid, p->gid, p->zombie ? "true" : "false", (long long)(p->starttime ? now - p->starttime : 0),
+                        p->children_sum, p->cpu_percent / 10., p->cpu_percent_sum / 10., p->mem_kbyte, p->mem_kbyte_sum);
+                _string(B, p->cmdline);
+                StringBuffer_append(B, "}");
+        }
+        StringBuffer_append(B, "]}");
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "monit.h"
+#include "latency.h"
+
+/**
+ *  Check latency histograms.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+static const char *latencynames[] = {"check", "port", "match", "checksum", "filesystem"};
+static const char *costnames[] = {"processtree", "check", "event", "httpd", "heartbeat"};
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+unsigned long long Latency_now() {
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+        struct timespec t;
+        if (clock_gettime(CLOCK_MONOTONIC, &t) == 0)
+                return (unsigned long long)t.tv_sec * 1000000ULL + (unsigned long long)t.tv_nsec / 1000ULL;
+#endif
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (unsigned long long)tv.tv_sec * 1000000ULL + (unsigned long long)tv.tv_usec;
+}
+
+
+unsigned long long Latency_cpu() {
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_THREAD_CPUTIME_ID
+        struct timespec t;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) == 0)
+                return (unsigned long long)t.tv_sec * 1000000ULL + (unsigned long long)t.tv_nsec / 1000ULL;
+#endif
+        return 0;
+}
+
+
+void Latency_cost(Cost_Type type, unsigned long long started) {
+        ASSERT(type < Cost_Types);
+        unsigned long long now = Latency_cpu();
+        if (now > started)
+                __sync_fetch_and_add(&Run.latency.cost[type], now - started);
+}
+
+
+Latency_T Latency_get(Latency_T *L) {
+        ASSERT(L);
+        if (! *L) {
+                Latency_T l = CALLOC(1, sizeof(struct mylatency));
+                // The reports read the slot without locking, publish the zeroed histogram atomically
+                if (! __sync_bool_compare_and_swap(L, NULL, l))
+                        FREE(l);
+        }
+        return *L;
+}
+
+
+void Latency_free(Latency_T L[Latency_Types]) {
+        ASSERT(L);
+        for (int i = 0; i < Latency_Types; i++)
+                FREE(L[i]);
+}
+
+
+void Latency_record(Latency_T L, unsigned long long started) {
+        unsigned long long now = Latency_now();
+        Latency_add(L, now > started ? now - started : 0);
+}
+
+
+void Latency_add(Latency_T L, unsigned long long duration) {
+        ASSERT(L);
+        int bucket = 0;
+        for (unsigned long long d = duration >> 1; d && bucket < LATENCY_BUCKETS - 1; d >>= 1)
+                bucket++;
+        L->bucket[bucket]++;
+        if (! L->count || duration < L->min)
+                L->min = duration;
+        if (duration > L->max)
+                L->max = duration;
+        L->total += duration;
+        L->count++;
+}
+
+
+unsigned long long Latency_average(Latency_T L) {
+        ASSERT(L);
+        return L->count ? L->total / L->count : 0;
+}
+
+
+unsigned long long Latency_percentile(Latency_T L, int percent) {
+        ASSERT(L);
+        ASSERT(percent > 0 && percent <= 100);
+        if (! L->count)
+                return 0;
+        unsigned long long rank = (L->count * percent + 99) / 100, seen = 0;
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+                seen += L->bucket[i];
+                if (seen >= rank) {
+                        unsigned long long upper = (2ULL << i) - 1;
+                        return upper < L->min ? L->min : upper > L->max ? L->max : upper;
+                }
+        }
+        return L->max;
+}
+
+
+const char *Latency_name(Latency_Type type) {
+        return type < Latency_Types ? latencynames[type] : "unknown";
+}
+
+
+const char *Latency_costName(Cost_Type type) {
+        return type < Cost_Types ? costnames[type] : "unknown";
+}
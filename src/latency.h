@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_LATENCY_H
+#define MONIT_LATENCY_H
+
+
+/**
+ * Check latency instrumentation. The service checks and their costly
+ * tests are timed with the monotonic clock and the durations are
+ * collected in log2 histograms (struct mylatency), which give the
+ * minimum, average, maximum and an approximation of the percentiles
+ * without keeping the samples. The histograms are updated by the
+ * thread which checks the service and read without locking by the
+ * reports, which can see a slightly inconsistent snapshot.
+ *
+ * @file
+ */
+
+
+/**
+ * Get the monotonic clock time
+ * @return Microseconds since some unspecified starting point
+ */
+unsigned long long Latency_now();
+
+
+/**
+ * Get the CPU time used by the calling thread. Used to split the CPU
+ * time of the daemon by subsystem, see Latency_cost()
+ * @return Microseconds of CPU time or 0 if the platform cannot measure
+ * the thread CPU time
+ */
+unsigned long long Latency_cpu();
+
+
+/**
+ * Add the CPU time which the calling thread used since the given start
+ * to the subsystem's counter in Run.latency.cost. The counters are
+ * updated atomically, several threads can measure the same subsystem
+ * @param type The subsystem
+ * @param started The start CPU time as returned by Latency_cpu()
+ */
+void Latency_cost(Cost_Type type, unsigned long long started);
+
+
+/**
+ * Get the histogram of the service test. The histograms are allocated on
+ * first use, so a service carries only the histograms of its tests
+ * @param L The histogram slot of the service test (for example
+ * &s->latency[Latency_Port])
+ * @return The histogram
+ */
+Latency_T Latency_get(Latency_T *L);
+
+
+/**
+ * Release the histograms of the service
+ * @param L The histogram slots of the service (Latency_Types elements)
+ */
+void Latency_free(Latency_T L[Latency_Types]);
+
+
+/**
+ * Add the duration since the given start time to the histogram
+ * @param L A latency histogram
+ * @param started The start time as returned by Latency_now()
+ */
+void Latency_record(Latency_T L, unsigned long long started);
+
+
+/**
+ * Add the duration to the histogram
+ * @param L A latency histogram
+ * @param duration The duration in microseconds
+ */
+void Latency_add(Latency_T L, unsigned long long duration);
+
+
+/**
+ * Get the average duration
+ * @param L A latency histogram
+ * @return The average in microseconds or 0 if the histogram is empty
+ */
+unsigned long long Latency_average(Latency_T L);
+
+
+/**
+ * Get the percentile of the durations. The value is the upper bound of
+ * the histogram bucket which contains the percentile, limited by the
+ * longest duration
+ * @param L A latency histogram
+ * @param percent The percentile (1-100)
+ * @return The percentile in microseconds or 0 if the histogram is empty
+ */
+unsigned long long Latency_percentile(Latency_T L, int percent);
+
+
+/**
+ * Get the name of the measured test
+ * @param type The latency type
+ * @return The name of the test (for example "port")
+ */
+const char *Latency_name(Latency_Type type);
+
+
+/**
+ * Get the name of the measured subsystem
+ * @param type The subsystem
+ * @return The name of the subsystem (for example "httpd")
+ */
+const char *Latency_costName(Cost_Type type);
+
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+#include <signal.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_NET_IF_H
+#include <net/if.h>
+#endif
+
+#ifdef HAVE_LINUX_NETLINK_H
+#include <linux/netlink.h>
+#endif
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <linux/rtnetlink.h>
+#endif
+
+#include "monit.h"
+#include "linkwatch.h"
+
+/**
+ *  Network interface watcher - Linux rtnetlink client.
+ *
+ *  The interfaces table is rebuilt from the RTM_GETLINK dump at the
+ *  beginning of each cycle and updated by the RTM_NEWLINK and RTM_DELLINK
+ *  notifications in between.
+ *
+ *  @file
+ */
+
+
+#if defined LINUX && defined HAVE_LINUX_NETLINK_H && defined HAVE_LINUX_RTNETLINK_H && defined HAVE_NET_IF_H
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define LINKWATCH_POLL 1000 // ms, interval to check the stop request
+#define LINKWATCH_BUFFER 32768 // The kernel sends the dump in messages up to 32kB
+
+
+typedef struct {
+        int index;                                       /**< The interface index */
+        boolean_t up;                               /**< true if the link is running */
+        char name[IFNAMSIZ];                              /**< The interface name */
+} Link_Info;
+
+
+static int sock = -1;    /* The multicast socket (watcher thread) */
+static int dumpsock = -1; /* The dump request socket (main thread) */
+static unsigned int seq = 0;
+static Thread_T thread;
+static pthread_t mainThread;
+static volatile boolean_t running = false;
+
+
+/* The interfaces table */
+static struct {
+        Mutex_T mutex;
+        Link_Info *link;
+        int count;
+        int size;
+} links = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Parse the RTM_NEWLINK message into the link info
+ * @return true if the message has the interface name, otherwise false
+ */
+static boolean_t _parse(struct nlmsghdr *hdr, Link_Info *info) {
+        struct ifinfomsg *ifi = NLMSG_DATA(hdr);
+        info->index = ifi->ifi_index;
+        info->up = (ifi->ifi_flags & IFF_UP) && (ifi->ifi_flags & IFF_RUNNING);
+        *info->name = 0;
+        int len = NLMSG_PAYLOAD(hdr, sizeof(struct ifinfomsg));
+        for (struct rtattr *a = (struct rtattr *)((char *)ifi + NLMSG_ALIGN(sizeof(struct ifinfomsg))); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+                if (a->rta_type == IFLA_IFNAME) {
+                        snprintf(info->name, sizeof(info->name), "%s", (char *)RTA_DATA(a));
+                        return true;
+                }
+        }
+        return false;
+}
+
+
+static Link_Info *_find(int index) {
+        for (int i = 0; i < links.count; i++)
+                if (links.link[i].index == index)
+                        return &links.link[i];
+        return NULL;
+}
+
+
+static void _add(Link_Info *info) {
+        if (links.count == links.size) {
+                links.size = links.size ? links.size * 2 : 64;
+                RESIZE(links.link, links.size * sizeof(Link_Info));
+        }
+        links.link[links.count++] = *info;
+}
+
+
+/**
+ * Returns the monitored network service of the interface or NULL
+ */
+static Service_T _getService(const char *interface) {
+        for (Service_T s = servicelist; s; s = s->next)
+                if (s->type == Service_Net && s->monitor != Monitor_Not && s->inf->priv.net.interface && Str_isEqual(s->path, interface))
+                        return s;
+        return NULL;
+}
+
+
+/**
+ * Apply the link notification to the interfaces table and wake up the
+ * main thread if the state of a monitored link changed
+ */
+static void _handle(struct nlmsghdr *hdr) {
+        Link_Info info;
+        if (! _parse(hdr, &info))
+                return;
+        if (hdr->nlmsg_type == RTM_DELLINK)
+                info.up = false;
+        boolean_t changed = false;
+        LOCK(links.mutex)
+        {
+                Link_Info *link = _find(info.index);
+                if (link) {
+                        changed = link->up != info.up;
+                        *link = info;
+                } else {
+                        changed = info.up;
+                        _add(&info);
+                }
+        }
+        END_LOCK;
+        Service_T s;
+        if (changed && (s = _getService(info.name))) {
+                LogInfo("'%s' link %s went %s -- waking up\n", s->name, info.name, info.up ? "up" : "down");
+                pthread_kill(mainThread, SIGUSR1);
+        }
+}
+
+
+static void *_watcher(void *args) {
+        char buf[LINKWATCH_BUFFER] __attribute__((aligned(NLMSG_ALIGNTO)));
+        while (running && ! Run.stopped) {
+                struct pollfd fds = {.fd = sock, .events = POLLIN};
+                int rv = poll(&fds, 1, LINKWATCH_POLL);
+                if (rv < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        LogError("Network events -- poll failed -- %s\n", STRERROR);
+                        break;
+                } else if (rv == 0) {
+                        continue;
+                }
+                ssize_t n = recv(sock, buf, sizeof(buf), 0);
+                if (n < 0) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                continue;
+                        if (errno == ENOBUFS) {
+                                /* Notifications were lost => wake up, the next cycle dump refreshes the table */
+                                DEBUG("Network events -- events queue overflow, waking up\n");
+                                pthread_kill(mainThread, SIGUSR1);
+                                continue;
+                        }
+                        LogError("Network events -- receive failed -- %s\n", STRERROR);
+                        break;
+                }
+                for (struct nlmsghdr *hdr = (struct nlmsghdr *)buf; NLMSG_OK(hdr, n); hdr = NLMSG_NEXT(hdr, n))
+                        if (hdr->nlmsg_type == RTM_NEWLINK || hdr->nlmsg_type == RTM_DELLINK)
+                                _handle(hdr);
+        }
+        return NULL;
+}
+
+
+static int _socket(unsigned int groups) {
+        int s = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+        if (s < 0) {
+                LogError("Network events -- cannot create netlink socket -- %s\n", STRERROR);
+                return -1;
+        }
+        struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = groups, .nl_pid = 0};
+        if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                LogError("Network events -- cannot bind netlink socket -- %s\n", STRERROR);
+                close(s);
+                return -1;
+        }
+        return s;
+}
+
+
+/**
+ * Send the RTM_GETLINK dump request and read the reply into the table
+ * @return true if succeeded, otherwise false
+ */
+static boolean_t _dump(Link_Info **table, int *count, int *size) {
+        struct {
+                struct nlmsghdr hdr;
+                struct ifinfomsg ifi;
+        } request = {
+                .hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+                .hdr.nlmsg_type = RTM_GETLINK,
+                .hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+                .hdr.nlmsg_seq = ++seq,
+                .ifi.ifi_family = AF_UNSPEC
+        };
+        if (send(dumpsock, &request, request.hdr.nlmsg_len, 0) < 0) {
+                LogError("Network events -- cannot request the links dump -- %s\n", STRERROR);
+                return false;
+        }
+        char buf[LINKWATCH_BUFFER] __attribute__((aligned(NLMSG_ALIGNTO)));
+        while (true) {
+                ssize_t n = recv(dumpsock, buf, sizeof(buf), 0);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        LogError("Network events -- cannot read the links dump -- %s\n", STRERROR);
+                        return false;
+                }
+                for (struct nlmsghdr *hdr = (struct nlmsghdr *)buf; NLMSG_OK(hdr, n); hdr = NLMSG_NEXT(hdr, n)) {
+                        if (hdr->nlmsg_seq != seq)
+                                continue; // Reply to an earlier request which timed out
+                        if (hdr->nlmsg_type == NLMSG_DONE)
+                                return true;
+                        if (hdr->nlmsg_type == NLMSG_ERROR) {
+                                LogError("Network events -- links dump failed -- %s\n", strerror(-((struct nlmsgerr *)NLMSG_DATA(hdr))->error));
+                                return false;
+                        }
+                        Link_Info info;
+                        if (hdr->nlmsg_type == RTM_NEWLINK && _parse(hdr, &info)) {
+                                if (*count == *size) {
+                                        *size = *size ? *size * 2 : 64;
+                                        RESIZE(*table, *size * sizeof(Link_Info));
+                                }
+                                (*table)[(*count)++] = info;
+                        }
+                }
+        }
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+boolean_t LinkWatch_start() {
+        if (running)
+                return true;
+        if ((sock = _socket(RTMGRP_LINK)) < 0)
+                return false;
+        if ((dumpsock = _socket(0)) < 0) {
+                close(sock);
+                sock = -1;
+                return false;
+        }
+        mainThread = pthread_self();
+        running = true;
+        LinkWatch_update();
+        Thread_create(thread, _watcher, NULL);
+        LogInfo("Network events watcher started\n");
+        return true;
+}
+
+
+void LinkWatch_stop() {
+        if (! running)
+                return;
+        running = false;
+        Thread_join(thread);
+        close(sock);
+        sock = -1;
+        close(dumpsock);
+        dumpsock = -1;
+        LOCK(links.mutex)
+        {
+                FREE(links.link);
+                links.count = links.size = 0;
+        }
+        END_LOCK;
+        LogInfo("Network events watcher stopped\n");
+}
+
+
+boolean_t LinkWatch_isRunning() {
+        return running;
+}
+
+
+void LinkWatch_update() {
+        if (! running)
+                return;
+        Link_Info *table = NULL;
+        int count = 0, size = 0;
+        if (_dump(&table, &count, &size)) {
+                LOCK(links.mutex)
+                {
+                        FREE(links.link);
+                        links.link = table;
+                        links.count = count;
+                        links.size = size;
+                }
+                END_LOCK;
+        } else {
+                /* Keep the table from the notifications, the link tests fall back to libmonit for the unknown interfaces */
+                FREE(table);
+        }
+}
+
+
+int LinkWatch_getState(const char *interface) {
+        ASSERT(interface);
+        int state = -1;
+        if (running) {
+                LOCK(links.mutex)
+                {
+                        for (int i = 0; i < links.count; i++) {
+                                if (Str_isEqual(links.link[i].name, interface)) {
+                                        state = links.link[i].up ? 1 : 0;
+                                        break;
+                                }
+                        }
+                }
+                END_LOCK;
+        }
+        return state;
+}
+
+
+#else
+
+
+boolean_t LinkWatch_start() {
+        LogError("Network events are not supported on this platform\n");
+        return false;
+}
+
+
+void LinkWatch_stop() {
+}
+
+
+boolean_t LinkWatch_isRunning() {
+        return false;
+}
+
+
+void LinkWatch_update() {
+}
+
+
+int LinkWatch_getState(const char *interface) {
+        return -1;
+}
+
+
+#endif
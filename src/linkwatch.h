@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_LINKWATCH_H
+#define MONIT_LINKWATCH_H
+
+
+/**
+ * Network interface watcher.
+ *
+ * On Linux, Monit can read the state of all network interfaces using
+ * one rtnetlink RTM_GETLINK dump per cycle instead of reading the proc
+ * and sys files of each monitored interface, and subscribe to the link
+ * multicast group to get notified immediately when a monitored link goes
+ * up or down. The watcher thread then wakes up the Monit daemon, so the
+ * link test runs right away instead of at the next poll cycle. The link
+ * down test of the network services monitored by the interface name is
+ * answered from the dump, the traffic statistics of the links which are
+ * up are still read by libmonit. The watcher is enabled using the "set
+ * network events" statement. On other platforms the watcher is not
+ * available.
+ *
+ *  @file
+ */
+
+
+/**
+ * Start the network interface watcher thread. Must be called from the
+ * main thread as the watcher wakes it up using the SIGUSR1 signal
+ * @return true if succeeded, otherwise false
+ */
+boolean_t LinkWatch_start();
+
+
+/**
+ * Stop the network interface watcher thread
+ */
+void LinkWatch_stop();
+
+
+/**
+ * Check if the network interface watcher is running
+ * @return true if running, otherwise false
+ */
+boolean_t LinkWatch_isRunning();
+
+
+/**
+ * Refresh the state of all network interfaces using one netlink dump.
+ * Called once at the beginning of the cycle
+ */
+void LinkWatch_update();
+
+
+/**
+ * Get the state of the network interface from the last dump or link
+ * notification
+ * @param interface The interface name
+ * @return 1 if the link is up, 0 if it is down and -1 if the state is
+ * not known (the watcher is not running or the interface was not found)
+ */
+int LinkWatch_getState(const char *interface);
+
+
+#endif
@@ -68,14 +68,27 @@
 #include <sys/stat.h>
 #endif
 
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
 #include "monit.h"
 
+// libmonit
+#include "system/Time.h"
+
 
 /**
  *  Implementation of a logger that appends log messages to a file
  *  with a preceding timestamp. Methods support both syslog or own
  *  logfile.
  *
+ *  When the daemon runs, the messages are passed through a lock-free
+ *  queue to a writer thread, which writes them in batches, so the
+ *  checks and the http threads don't wait for the disk or syslog.
+ *  Messages of the critical and higher priority are written
+ *  synchronously.
+ *
  *  @file
  */
 
@@ -83,10 +96,50 @@
 /* ------------------------------------------------------------- Definitions */
 
 
+#define LOG_QUEUE_SIZE    1024          /* Number of queued messages, must be a power of 2 */
+#define LOG_POLL          100                      /* Writer thread wakeup interval [ms] */
+#define LOG_SYNC_INTERVAL 5                        /* Log file synchronization interval [s] */
+
+
 static FILE *LOG = NULL;
 static Mutex_T log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
+/* Optional event attributes of a message, written as separate fields in the JSON log format */
+typedef struct mylogfields {
+        const char *service;                                     /**< Service name */
+        const char *event;                                  /**< Event description */
+        const char *state;                                           /**< Event state */
+} *LogFields_T;
+
+
+typedef struct mylogentry {
+        volatile unsigned long sequence;             /**< Position owning this entry */
+        int priority;                                        /**< Message priority */
+        time_t time;                                             /**< Message time */
+        char *message;                                      /**< Formatted message */
+        char *service;                               /**< Service name copy or NULL */
+        const char *event;                     /**< Event description (static) or NULL */
+        const char *state;                            /**< Event state (static) or NULL */
+} *LogEntry_T;
+
+
+/* The multiple producers, single consumer bounded queue (the consumer must hold the log_mutex) */
+static struct {
+        struct mylogentry entries[LOG_QUEUE_SIZE];
+        volatile unsigned long head;                   /**< Next position to fill */
+        unsigned long tail;                            /**< Next position to write */
+        volatile unsigned long dropped;    /**< Messages dropped as the queue was full */
+        volatile boolean_t running;                  /**< true if the writer runs */
+        pid_t pid;                        /**< The process which owns the writer thread */
+        time_t synced;                                 /**< Last log file fsync time */
+        boolean_t written;        /**< true if the log was written since the last fsync */
+        Thread_T thread;
+        Mutex_T mutex;
+        Sem_T wakeup;
+} queue = {.mutex = PTHREAD_MUTEX_INITIALIZER, .wakeup = PTHREAD_COND_INITIALIZER};
+
+
 static struct mylogpriority {
         int  priority;
         char *description;
@@ -107,9 +160,12 @@ static struct mylogpriority {
 
 
 static boolean_t open_log();
-static char *timefmt(char *t, int size);
+static char *timefmt(time_t now, const char *format, char *t, int size);
 static const char *logPriorityDescription(int p);
-static void log_log(int priority, const char *s, va_list ap);
+static void log_write(int priority, time_t now, LogFields_T fields, const char *s, va_list ap);
+static void log_drain();
+static void *log_writer(void *args);
+static void log_log(int priority, LogFields_T fields, const char *s, va_list ap);
 static void log_backtrace();
 
 
@@ -131,6 +187,44 @@ boolean_t log_init() {
 }
 
 
+/**
+ * Start the log writer thread. The messages logged by this process are
+ * written asynchronously until log_stop() is called.
+ */
+void log_start() {
+        if (queue.running)
+                return;
+        for (unsigned long i = 0; i < LOG_QUEUE_SIZE; i++)
+                queue.entries[i].sequence = i;
+        queue.head = queue.tail = queue.dropped = 0;
+        queue.pid = getpid();
+        queue.synced = Time_now();
+        queue.running = true;
+        Thread_create(queue.thread, log_writer, NULL);
+}
+
+
+/**
+ * Stop the log writer thread and write the queued messages
+ */
+void log_stop() {
+        if (! queue.running || queue.pid != getpid())
+                return;
+        LOCK(queue.mutex)
+        {
+                queue.running = false;
+                Sem_signal(queue.wakeup);
+        }
+        END_LOCK;
+        Thread_join(queue.thread);
+        LOCK(log_mutex)
+        {
+                log_drain();
+        }
+        END_LOCK;
+}
+
+
 /**
  * Logging interface with priority support
  * @param s A formated (printf-style) string to log
@@ -141,7 +235,7 @@ void LogEmergency(const char *s, ...) {
         ASSERT(s);
 
         va_start(ap, s);
-        log_log(LOG_EMERG, s, ap);
+        log_log(LOG_EMERG, NULL, s, ap);
         va_end(ap);
         log_backtrace();
 }
@@ -157,7 +251,7 @@ void LogAlert(const char *s, ...) {
         ASSERT(s);
 
         va_start(ap, s);
-        log_log(LOG_ALERT, s, ap);
+        log_log(LOG_ALERT, NULL, s, ap);
         va_end(ap);
         log_backtrace();
 }
@@ -173,7 +267,7 @@ void LogCritical(const char *s, ...) {
         ASSERT(s);
 
         va_start(ap, s);
-        log_log(LOG_CRIT, s, ap);
+        log_log(LOG_CRIT, NULL, s, ap);
         va_end(ap);
         log_backtrace();
 }
@@ -186,7 +280,7 @@ void vLogAbortHandler(const char *s, va_list ap) {
         va_list ap_copy;
         ASSERT(s);
         va_copy(ap_copy, ap);
-        log_log(LOG_CRIT, s, ap);
+        log_log(LOG_CRIT, NULL, s, ap);
         va_end(ap_copy);
         if (Run.debug)
                 abort();
@@ -204,7 +298,7 @@ void LogError(const char *s, ...) {
         ASSERT(s);
 
         va_start(ap, s);
-        log_log(LOG_ERR, s, ap);
+        log_log(LOG_ERR, NULL, s, ap);
         va_end(ap);
         log_backtrace();
 }
@@ -218,7 +312,7 @@ void vLogError(const char *s, va_list ap) {
         va_list ap_copy;
         ASSERT(s);
         va_copy(ap_copy, ap);
-        log_log(LOG_ERR, s, ap);
+        log_log(LOG_ERR, NULL, s, ap);
         va_end(ap_copy);
         log_backtrace();
 }
@@ -234,7 +328,7 @@ void LogWarning(const char *s, ...) {
         ASSERT(s);
 
         va_start(ap, s);
-        log_log(LOG_WARNING, s, ap);
+        log_log(LOG_WARNING, NULL, s, ap);
         va_end(ap);
 }
 
@@ -249,7 +343,7 @@ void LogNotice(const char *s, ...) {
         ASSERT(s);
 
         va_start(ap, s);
-        log_log(LOG_NOTICE, s, ap);
+        log_log(LOG_NOTICE, NULL, s, ap);
         va_end(ap);
 }
 
@@ -264,7 +358,7 @@ void LogInfo(const char *s, ...) {
         ASSERT(s);
 
         va_start(ap, s);
-        log_log(LOG_INFO, s, ap);
+        log_log(LOG_INFO, NULL, s, ap);
         va_end(ap);
 }
 
@@ -278,27 +372,59 @@ void LogDebug(const char *s, ...) {
         if (Run.debug) {
                 va_list ap;
                 va_start(ap, s);
-                log_log(LOG_DEBUG, s, ap);
+                log_log(LOG_DEBUG, NULL, s, ap);
                 va_end(ap);
         }
 }
 
 
+/**
+ * Logging interface for the event messages. The service name, event
+ * description and state are written as separate fields if the log
+ * file uses the JSON format, the text log gets the message only.
+ * @param priority The message priority
+ * @param service The service name
+ * @param event The event description
+ * @param state The event state
+ * @param s A formated (printf-style) string to log
+ */
+void LogEvent(int priority, const char *service, const char *event, const char *state, const char *s, ...) {
+        va_list ap;
+
+        ASSERT(s);
+
+        va_start(ap, s);
+        log_log(priority, &(struct mylogfields){.service = service, .event = event, .state = state}, s, ap);
+        va_end(ap);
+}
+
+
 /**
  * Close the log file or syslog
  */
 void log_close() {
+        int rv = 0;
 
-        if (Run.use_syslog) {
-                closelog();
+        LOCK(log_mutex)
+        {
+                /* Write the queued messages before the log is closed */
+                log_drain();
+
+                if (Run.use_syslog) {
+                        closelog();
+                }
+
+                if (LOG)
+                        rv = fclose(LOG);
+
+                LOG = NULL;
         }
+        END_LOCK;
 
-        if (LOG  && (0 != fclose(LOG))) {
+        if (rv != 0) {
                 LogError("Error closing the log file -- %s\n", STRERROR);
         }
 
-        LOG = NULL;
-
 }
 
 
@@ -330,8 +456,8 @@ static boolean_t open_log() {
                         LogError("Error opening the log file '%s' for writing -- %s\n", Run.logfile, STRERROR);
                         return false;
                 }
-                /* Set logger in unbuffered mode */
-                setvbuf(LOG, NULL, _IONBF, 0);
+                /* The log is flushed after every message or batch of queued messages */
+                setvbuf(LOG, NULL, _IOFBF, 65536);
         }
 
         return true;
@@ -340,16 +466,14 @@ static boolean_t open_log() {
 
 
 /**
- * Returns the current time as a formated string, see the TIMEFORMAT
- * macro in monit.h
+ * Returns the given time as a string formated by strftime(3), see the
+ * TIMEFORMAT macro in monit.h
  */
-static char *timefmt(char *t, int size) {
-        time_t now;
+static char *timefmt(time_t now, const char *format, char *t, int size) {
         struct tm tm;
 
-        time(&now);
         localtime_r(&now, &tm);
-        if ( ! strftime(t, size, TIMEFORMAT, &tm))
+        if ( ! strftime(t, size, format, &tm))
                 *t = 0;
         return t;
 }
@@ -380,42 +504,99 @@ static const char *logPriorityDescription(int p) {
 
 
 /**
- * Log a message to monits logfile or syslog.
+ * Write the JSON string member to the log file
+ */
+static void log_jsonmember(const char *name, const char *value, size_t length) {
+        fprintf(LOG, ",\"%s\":\"", name);
+        for (size_t i = 0; i < length; i++) {
+                unsigned char c = value[i];
+                if (c == '"' || c == '\\')
+                        fprintf(LOG, "\\%c", c);
+                else if (c == '\n')
+                        fputs("\\n", LOG);
+                else if (c == '\t')
+                        fputs("\\t", LOG);
+                else if (c < 0x20)
+                        fprintf(LOG, "\\u%04x", c);
+                else
+                        fputc(c, LOG);
+        }
+        fputc('"', LOG);
+}
+
+
+/**
+ * Write the message to the log file as a JSON object on one line
+ */
+static void log_json(int priority, time_t now, LogFields_T fields, const char *message) {
+        char datetime[STRLEN];
+        fprintf(LOG, "{\"time\":\"%s\",\"priority\":\"%s\"", timefmt(now, "%Y-%m-%dT%H:%M:%S%z", datetime, STRLEN), logPriorityDescription(priority));
+        if (fields) {
+                if (fields->service)
+                        log_jsonmember("service", fields->service, strlen(fields->service));
+                if (fields->event)
+                        log_jsonmember("event", fields->event, strlen(fields->event));
+                if (fields->state)
+                        log_jsonmember("state", fields->state, strlen(fields->state));
+        }
+        /* The message newline terminator is not part of the message */
+        size_t length = strlen(message);
+        if (length && message[length - 1] == '\n')
+                length--;
+        log_jsonmember("message", message, length);
+        fputs("}\n", LOG);
+}
+
+
+/**
+ * Write a message to the console and monits logfile or syslog. The
+ * caller must hold the log_mutex.
  * @param priority A message priority
+ * @param now The message time
+ * @param fields Optional event attributes of the message or NULL
  * @param s A formated (printf-style) string to log
  */
-static void log_log(int priority, const char *s, va_list ap) {
+static void log_write(int priority, time_t now, LogFields_T fields, const char *s, va_list ap) {
 #ifdef HAVE_VA_COPY
         va_list ap_copy;
 #endif
 
         ASSERT(s);
 
-        LOCK(log_mutex)
-        {
-
-                FILE *output = priority < LOG_INFO ? stderr : stdout;
+        FILE *output = priority < LOG_INFO ? stderr : stdout;
 #ifdef HAVE_VA_COPY
-                va_copy(ap_copy, ap);
-                vfprintf(output, s, ap_copy);
-                va_end(ap_copy);
+        va_copy(ap_copy, ap);
+        vfprintf(output, s, ap_copy);
+        va_end(ap_copy);
 #else
-                vfprintf(output, s, ap);
+        vfprintf(output, s, ap);
 #endif
-                fflush(output);
+        fflush(output);
 
-                if (Run.dolog) {
-                        if (Run.use_syslog) {
+        if (Run.dolog) {
+                if (Run.use_syslog) {
+#ifdef HAVE_VA_COPY
+                        va_copy(ap_copy, ap);
+                        vsyslog(priority, s, ap_copy);
+                        va_end(ap_copy);
+#else
+                        vsyslog(priority, s, ap);
+#endif
+                } else if (LOG) {
+                        if (Run.jsonlog) {
+                                char *message;
 #ifdef HAVE_VA_COPY
                                 va_copy(ap_copy, ap);
-                                vsyslog(priority, s, ap_copy);
+                                message = Str_vcat(s, ap_copy);
                                 va_end(ap_copy);
 #else
-                                vsyslog(priority, s, ap);
+                                message = Str_vcat(s, ap);
 #endif
-                        } else if (LOG) {
+                                log_json(priority, now, fields, message);
+                                FREE(message);
+                        } else {
                                 char datetime[STRLEN];
-                                fprintf(LOG, "[%s] %-8s : ", timefmt(datetime, STRLEN), logPriorityDescription(priority));
+                                fprintf(LOG, "[%s] %-8s : ", timefmt(now, TIMEFORMAT, datetime, STRLEN), logPriorityDescription(priority));
 #ifdef HAVE_VA_COPY
                                 va_copy(ap_copy, ap);
                                 vfprintf(LOG, s, ap_copy);
@@ -423,11 +604,149 @@ static void log_log(int priority, const char *s, va_list ap) {
 #else
                                 vfprintf(LOG, s, ap);
 #endif
+                        }
+                        queue.written = true;
+                }
+        }
+}
+
+
+/**
+ * Write a message, see log_write()
+ */
+static void log_writef(int priority, time_t now, LogFields_T fields, const char *s, ...) {
+        va_list ap;
+        va_start(ap, s);
+        log_write(priority, now, fields, s, ap);
+        va_end(ap);
+}
 
+
+/**
+ * Write the queued messages and flush the log file. The caller must
+ * hold the log_mutex.
+ */
+static void log_drain() {
+        /* The queue is owned by the process which started the writer (not by a forked child) */
+        if (queue.pid != getpid())
+                return;
+        while (true) {
+                unsigned long position = queue.tail;
+                LogEntry_T entry = &queue.entries[position & (LOG_QUEUE_SIZE - 1)];
+                __sync_synchronize();
+                if (entry->sequence != position + 1)
+                        break;
+                log_writef(entry->priority, entry->time, entry->service || entry->event ? &(struct mylogfields){.service = entry->service, .event = entry->event, .state = entry->state} : NULL, "%s", entry->message);
+                FREE(entry->message);
+                FREE(entry->service);
+                __sync_synchronize();
+                /* Return the entry to the producers for the next round */
+                entry->sequence = position + LOG_QUEUE_SIZE;
+                queue.tail = position + 1;
+        }
+        unsigned long dropped = __sync_fetch_and_and(&queue.dropped, 0);
+        if (dropped)
+                log_writef(LOG_WARNING, Time_now(), NULL, "Log queue overflow -- %lu messages dropped\n", dropped);
+        if (LOG)
+                fflush(LOG);
+}
+
+
+/**
+ * The writer thread: write the queued messages in batches and
+ * synchronize the log file periodically
+ */
+static void *log_writer(void *args) {
+        LOCK(queue.mutex)
+        {
+                while (queue.running) {
+                        struct timeval now;
+                        gettimeofday(&now, NULL);
+                        long long wakeup = (long long)now.tv_sec * 1000000LL + now.tv_usec + LOG_POLL * 1000LL;
+                        struct timespec wait = {.tv_sec = wakeup / 1000000LL, .tv_nsec = (wakeup % 1000000LL) * 1000LL};
+                        Sem_timeWait(queue.wakeup, queue.mutex, wait);
+                        LOCK(log_mutex)
+                        {
+                                log_drain();
+                                if (queue.written && LOG && Time_now() - queue.synced >= LOG_SYNC_INTERVAL) {
+                                        fsync(fileno(LOG));
+                                        queue.synced = Time_now();
+                                        queue.written = false;
+                                }
                         }
+                        END_LOCK;
                 }
         }
         END_LOCK;
+        return NULL;
+}
+
+
+/**
+ * Queue the message for the writer thread
+ * @return true if the message was queued, false if the queue is full
+ */
+static boolean_t log_enqueue(int priority, LogFields_T fields, char *message) {
+        unsigned long position = queue.head;
+        while (true) {
+                LogEntry_T entry = &queue.entries[position & (LOG_QUEUE_SIZE - 1)];
+                __sync_synchronize();
+                long delta = (long)(entry->sequence - position);
+                if (delta == 0) {
+                        /* The entry is free: claim it */
+                        if (__sync_bool_compare_and_swap(&queue.head, position, position + 1)) {
+                                entry->priority = priority;
+                                entry->time = Time_now();
+                                entry->message = message;
+                                entry->service = fields && fields->service ? Str_dup(fields->service) : NULL;
+                                entry->event = fields ? fields->event : NULL;
+                                entry->state = fields ? fields->state : NULL;
+                                __sync_synchronize();
+                                /* Publish the entry to the writer and wake it up early if the queue is filling up */
+                                entry->sequence = position + 1;
+                                if (position - queue.tail >= LOG_QUEUE_SIZE / 2)
+                                        Sem_signal(queue.wakeup);
+                                return true;
+                        }
+                } else if (delta < 0) {
+                        /* The writer did not consume this entry yet: the queue is full */
+                        return false;
+                }
+                position = queue.head;
+        }
+}
+
+
+/**
+ * Log a message to monits logfile or syslog.
+ * @param priority A message priority
+ * @param fields Optional event attributes of the message or NULL
+ * @param s A formated (printf-style) string to log
+ */
+static void log_log(int priority, LogFields_T fields, const char *s, va_list ap) {
+        ASSERT(s);
+
+        if (priority >= LOG_ERR && queue.running && queue.pid == getpid()) {
+                va_list ap_copy;
+                va_copy(ap_copy, ap);
+                char *message = Str_vcat(s, ap_copy);
+                va_end(ap_copy);
+                if (! log_enqueue(priority, fields, message)) {
+                        FREE(message);
+                        __sync_fetch_and_add(&queue.dropped, 1);
+                }
+                return;
+        }
+
+        LOCK(log_mutex)
+        {
+                /* Keep the order of the messages: write the queued ones first */
+                log_drain();
+                log_write(priority, Time_now(), fields, s, ap);
+                if (LOG)
+                        fflush(LOG);
+        }
+        END_LOCK;
 }
 
 
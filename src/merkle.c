@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#include "monit.h"
+#include "md5.h"
+#include "sha1.h"
+#include "merkle.h"
+
+// libmonit
+#include "system/Time.h"
+#include "exceptions/AssertException.h"
+
+/**
+ *  Directory tree checksum - an incrementally updated Merkle tree.
+ *
+ *  The tree nodes are read and written by the worker thread only, the
+ *  mutex protects the result of the last pass and the worker state.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#if defined HAVE_STRUCT_STAT_ST_MTIM
+#define STAT_MTIME_NSEC(sb) ((sb)->st_mtim.tv_nsec)
+#define STAT_CTIME_NSEC(sb) ((sb)->st_ctim.tv_nsec)
+#elif defined HAVE_STRUCT_STAT_ST_MTIMESPEC
+#define STAT_MTIME_NSEC(sb) ((sb)->st_mtimespec.tv_nsec)
+#define STAT_CTIME_NSEC(sb) ((sb)->st_ctimespec.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(sb) 0L
+#define STAT_CTIME_NSEC(sb) 0L
+#endif
+
+
+/* A file or directory of the tree, the children are sorted by name */
+typedef struct Node_T {
+        char *name;
+        mode_t mode;
+        dev_t dev;
+        ino_t inode;
+        off_t size;
+        time_t mtime;
+        long mtime_nsec;
+        time_t ctime;
+        long ctime_nsec;
+        unsigned char digest[SHA1_DIGEST_SIZE];
+        int count;
+        struct Node_T *children;
+} Node_T;
+
+
+struct mymerkle {
+        char *path;
+        Hash_Type type;
+        Mutex_T mutex;
+        boolean_t running;                          /**< A pass is running */
+        boolean_t freed;        /**< Freed while running, the worker frees it */
+        boolean_t verify;             /**< The pass rehashes all files */
+        Merkle_Status status;                /**< The state of the last pass */
+        MD_T sum;                         /**< The root checksum of the last pass */
+        int files;                       /**< Files in the tree of the last pass */
+        char error[STRLEN];                    /**< The error of the last pass */
+        Node_T root;
+        /* The current pass */
+        struct {
+                int files;
+                int rehashed;
+                char error[STRLEN];
+        } pass;
+};
+
+
+/* The hash context of the tree type */
+typedef struct Digest_T {
+        Hash_Type type;
+        union {
+                md5_context_t md5;
+                sha1_context_t sha1;
+        } context;
+} Digest_T;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static int _digestLength(Hash_Type type) {
+        return type == Hash_Sha1 ? SHA1_DIGEST_SIZE : 16;
+}
+
+
+static void _digestInit(Digest_T *D, Hash_Type type) {
+        D->type = type;
+        if (type == Hash_Sha1)
+                sha1_init(&D->context.sha1);
+        else
+                md5_init(&D->context.md5);
+}
+
+
+static void _digestAppend(Digest_T *D, const void *data, size_t length) {
+        if (D->type == Hash_Sha1)
+                sha1_append(&D->context.sha1, data, length);
+        else
+                md5_append(&D->context.md5, data, (int)length);
+}
+
+
+static void _digestFinish(Digest_T *D, unsigned char *digest) {
+        if (D->type == Hash_Sha1)
+                sha1_finish(&D->context.sha1, digest);
+        else
+                md5_finish(&D->context.md5, digest);
+}
+
+
+static void _freeNode(Node_T *n) {
+        for (int i = 0; i < n->count; i++)
+                _freeNode(&n->children[i]);
+        FREE(n->children);
+        FREE(n->name);
+        n->count = 0;
+}
+
+
+static void _free(Merkle_T *M) {
+        _freeNode(&(*M)->root);
+        Mutex_destroy((*M)->mutex);
+        FREE((*M)->path);
+        FREE(*M);
+}
+
+
+/* Record the first error of the pass */
+static void _error(Merkle_T M, const char *path, const char *reason) {
+        if (! *M->pass.error)
+                snprintf(M->pass.error, sizeof(M->pass.error), "cannot read %s -- %s", path, reason);
+}
+
+
+/* Returns true if the file status is the same as when the node was hashed */
+static boolean_t _isUnchanged(Node_T *n, struct stat *sb) {
+        return n->dev == sb->st_dev &&
+               n->inode == sb->st_ino &&
+               n->size == sb->st_size &&
+               n->mtime == sb->st_mtime &&
+               n->mtime_nsec == STAT_MTIME_NSEC(sb) &&
+               n->ctime == sb->st_ctime &&
+               n->ctime_nsec == STAT_CTIME_NSEC(sb);
+}
+
+
+static void _setStatus(Node_T *n, struct stat *sb) {
+        n->mode = sb->st_mode;
+        n->dev = sb->st_dev;
+        n->inode = sb->st_ino;
+        n->size = sb->st_size;
+        n->mtime = sb->st_mtime;
+        n->mtime_nsec = STAT_MTIME_NSEC(sb);
+        n->ctime = sb->st_ctime;
+        n->ctime_nsec = STAT_CTIME_NSEC(sb);
+}
+
+
+/* Hash the content of the regular file or the target of the symbolic link */
+static void _hashLeaf(Merkle_T M, const char *path, Node_T *n) {
+        M->pass.rehashed++;
+        memset(n->digest, 0, sizeof(n->digest));
+        if (S_ISLNK(n->mode)) {
+                char target[PATH_MAX];
+                ssize_t length = readlink(path, target, sizeof(target));
+                if (length < 0) {
+                        _error(M, path, STRERROR);
+                        n->mtime = 0; // Retry in the next pass
+                        return;
+                }
+                Digest_T D;
+                _digestInit(&D, M->type);
+                _digestAppend(&D, target, length);
+                _digestFinish(&D, n->digest);
+        } else {
+                int fd = open(path, O_RDONLY | O_NOFOLLOW);
+                if (fd == -1) {
+                        _error(M, path, STRERROR);
+                        n->mtime = 0;
+                        return;
+                }
+                if (! Util_getDigests(fd, M->type == Hash_Sha1 ? n->digest : NULL, M->type == Hash_Sha1 ? NULL : n->digest)) {
+                        _error(M, path, STRERROR);
+                        n->mtime = 0;
+                }
+                close(fd);
+        }
+}
+
+
+static int _compareNames(const void *a, const void *b) {
+        return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/**
+ * Update the directory node: the entries are merged with the cached children
+ * by name, the unchanged files keep their hash. The directory hash is
+ * recomputed only if some child was added, removed or its hash or permission
+ * changed. Returns true if the directory hash changed. The path buffer holds
+ * the directory path of the given length and is used for the child paths
+ */
+static boolean_t _hashDirectory(Merkle_T M, char *path, size_t length, Node_T *n, boolean_t created) {
+        DIR *d = opendir(path);
+        if (! d) {
+                _error(M, path, STRERROR);
+                return false;
+        }
+        int count = 0, size = 0;
+        char **names = NULL;
+        struct dirent *de;
+        while ((de = readdir(d))) {
+                if (IS(de->d_name, ".") || IS(de->d_name, ".."))
+                        continue;
+                if (count == size) {
+                        size = size ? 2 * size : 16;
+                        RESIZE(names, size * sizeof(char *));
+                }
+                names[count++] = Str_dup(de->d_name);
+        }
+        closedir(d);
+        qsort(names, count, sizeof(char *), _compareNames);
+        boolean_t changed = created;
+        Node_T *children = count ? CALLOC(count, sizeof(Node_T)) : NULL;
+        int i = 0, j = 0, k = 0;
+        for (; i < count; i++) {
+                size_t l = strlen(names[i]);
+                if (length + 1 + l >= PATH_MAX) {
+                        _error(M, path, "path too long");
+                        FREE(names[i]);
+                        continue;
+                }
+                path[length] = '/';
+                memcpy(path + length + 1, names[i], l + 1);
+                struct stat sb;
+                if (lstat(path, &sb) != 0) {
+                        /* Removed meanwhile */
+                        FREE(names[i]);
+                        continue;
+                }
+                /* The cached children passed over were removed */
+                while (j < n->count && strcmp(n->children[j].name, names[i]) < 0) {
+                        _freeNode(&n->children[j++]);
+                        changed = true;
+                }
+                Node_T *c = &children[k++];
+                boolean_t cached = j < n->count && IS(n->children[j].name, names[i]) && (n->children[j].mode & S_IFMT) == (sb.st_mode & S_IFMT);
+                if (cached) {
+                        *c = n->children[j++];
+                        FREE(names[i]);
+                } else {
+                        if (j < n->count && IS(n->children[j].name, names[i])) {
+                                /* The type changed */
+                                _freeNode(&n->children[j++]);
+                        }
+                        c->name = names[i];
+                        changed = true;
+                }
+                names[i] = NULL;
+                mode_t mode = c->mode;
+                if (S_ISDIR(sb.st_mode)) {
+                        _setStatus(c, &sb);
+                        if (_hashDirectory(M, path, length + 1 + l, c, ! cached))
+                                changed = true;
+                } else if (S_ISREG(sb.st_mode) || S_ISLNK(sb.st_mode)) {
+                        M->pass.files++;
+                        if (! cached || M->verify || ! _isUnchanged(c, &sb)) {
+                                unsigned char digest[SHA1_DIGEST_SIZE];
+                                memcpy(digest, c->digest, sizeof(digest));
+                                _setStatus(c, &sb);
+                                _hashLeaf(M, path, c);
+                                if (memcmp(digest, c->digest, sizeof(digest)))
+                                        changed = true;
+                        }
+                } else {
+                        /* Devices, sockets and fifos are listed by name and type only */
+                        _setStatus(c, &sb);
+                }
+                if ((mode & 07777) != (c->mode & 07777))
+                        changed = true;
+        }
+        path[length] = 0;
+        while (j < n->count) {
+                _freeNode(&n->children[j++]);
+                changed = true;
+        }
+        FREE(names);
+        FREE(n->children);
+        n->children = children;
+        n->count = k;
+        if (changed) {
+                Digest_T D;
+                _digestInit(&D, M->type);
+                for (i = 0; i < n->count; i++) {
+                        Node_T *c = &n->children[i];
+                        /* The mode is hashed in the network byte order, so the root checksum doesn't depend on the host */
+                        unsigned char mode[4] = {(c->mode >> 24) & 0xff, (c->mode >> 16) & 0xff, (c->mode >> 8) & 0xff, c->mode & 0xff};
+                        _digestAppend(&D, c->name, strlen(c->name) + 1);
+                        _digestAppend(&D, mode, sizeof(mode));
+                        _digestAppend(&D, c->digest, _digestLength(M->type));
+                }
+                _digestFinish(&D, n->digest);
+        }
+        return changed;
+}
+
+
+static void *_worker(void *args) {
+        Merkle_T M = args;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s", M->path);
+        M->pass.files = M->pass.rehashed = 0;
+        *M->pass.error = 0;
+        unsigned long long started = Time_milli();
+        struct stat sb;
+        if (stat(path, &sb) != 0) {
+                _error(M, path, STRERROR);
+        } else if (! S_ISDIR(sb.st_mode)) {
+                _error(M, path, "not a directory");
+        } else {
+                boolean_t created = M->root.mode == 0;
+                _setStatus(&M->root, &sb);
+                _hashDirectory(M, path, strlen(path), &M->root, created);
+        }
+        DEBUG("'%s' tree checksum: %d files, %d rehashed in %llu ms\n", M->path, M->pass.files, M->pass.rehashed, Time_milli() - started);
+        boolean_t freed = false;
+        LOCK(M->mutex)
+        {
+                if (*M->pass.error) {
+                        M->status = Merkle_Failed;
+                        snprintf(M->error, sizeof(M->error), "%s", M->pass.error);
+                } else {
+                        M->status = Merkle_Done;
+                        Util_digest2Bytes(M->root.digest, _digestLength(M->type), M->sum);
+                        M->files = M->pass.files;
+                }
+                M->running = false;
+                freed = M->freed;
+        }
+        END_LOCK;
+        if (freed)
+                _free(&M);
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+Merkle_T Merkle_new(const char *path, Hash_Type type) {
+        ASSERT(path);
+        Merkle_T M;
+        NEW(M);
+        M->path = Str_dup(path);
+        M->type = type;
+        Mutex_init(M->mutex);
+        return M;
+}
+
+
+void Merkle_free(Merkle_T *M) {
+        ASSERT(M);
+        if (*M) {
+                boolean_t running = false;
+                LOCK((*M)->mutex)
+                {
+                        running = (*M)->running;
+                        (*M)->freed = true;
+                }
+                END_LOCK;
+                if (! running)
+                        _free(M);
+                *M = NULL;
+        }
+}
+
+
+Merkle_Status Merkle_update(Merkle_T M, boolean_t verify, MD_T sum, int *files, char *error, int errorsize) {
+        ASSERT(M);
+        boolean_t start = false;
+        Merkle_Status status;
+        LOCK(M->mutex)
+        {
+                status = M->status;
+                if (status == Merkle_Done) {
+                        snprintf(sum, sizeof(MD_T), "%s", M->sum);
+                        *files = M->files;
+                } else if (status == Merkle_Failed) {
+                        snprintf(error, errorsize, "%s", M->error);
+                }
+                if (! M->running) {
+                        M->running = start = true;
+                        M->verify = verify;
+                }
+        }
+        END_LOCK;
+        if (start) {
+                boolean_t started = false;
+                TRY
+                {
+                        Thread_T thread;
+                        Thread_create(thread, _worker, M);
+                        Thread_detach(thread);
+                        started = true;
+                }
+                ELSE
+                {
+                        LogError("'%s' tree checksum cannot create thread -- %s\n", M->path, Exception_frame.message);
+                }
+                END_TRY;
+                if (! started) // Fallback to the synchronous pass
+                        _worker(M);
+        }
+        return status;
+}
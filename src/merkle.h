@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_MERKLE_H
+#define MONIT_MERKLE_H
+
+
+/**
+ * Directory tree checksum.
+ *
+ * The "checksum tree" test of the directory service computes a Merkle
+ * hash of the whole directory tree: the hash of a regular file is the
+ * checksum of its content, the hash of a symbolic link is the checksum of
+ * its target and the hash of a directory is the checksum of the sorted
+ * list of its entries names, permissions and hashes. The root hash thus
+ * changes if any file in the tree was added, removed, renamed, modified
+ * or its permission changed.
+ *
+ * The tree is cached in memory with the status (inode, size, modification
+ * and change time) of each file at the time it was hashed, so each pass
+ * only rehashes the files whose status changed and the directories on
+ * their path up to the root. The passes run in a background worker thread,
+ * the check uses the result of the last completed pass and starts the
+ * next one, so a large tree never blocks the validation cycle.
+ *
+ *  @file
+ */
+
+
+/**
+ * The state of the tree checksum
+ */
+typedef enum {
+        Merkle_Pending = 0,                 /**< The first pass is still running */
+        Merkle_Done,                        /**< The last pass completed */
+        Merkle_Failed                       /**< The last pass failed */
+} Merkle_Status;
+
+
+/**
+ * Create the tree checksum cache. No file is read until the first update
+ * @param path The root directory of the tree
+ * @param type The hash type
+ * @return The tree checksum cache
+ */
+Merkle_T Merkle_new(const char *path, Hash_Type type);
+
+
+/**
+ * Free the tree checksum cache. If a pass is running, the cache is freed
+ * by the worker when the pass completes
+ * @param M The tree checksum cache
+ */
+void Merkle_free(Merkle_T *M);
+
+
+/**
+ * Get the result of the last completed pass and start the next pass in
+ * the background if no pass is running
+ * @param M The tree checksum cache
+ * @param verify If true, the next pass rehashes all files regardless of
+ * their cached status
+ * @param sum The root checksum of the last completed pass
+ * @param files The number of files in the tree
+ * @param error The error description if the last pass failed
+ * @param errorsize The size of the error buffer
+ * @return The state of the tree checksum
+ */
+Merkle_Status Merkle_update(Merkle_T M, boolean_t verify, MD_T sum, int *files, char *error, int errorsize);
+
+
+#endif
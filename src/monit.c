@@ -70,12 +70,35 @@
 #include <sys/wait.h>
 #endif
 
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
 #include "monit.h"
 #include "net.h"
 #include "process.h"
 #include "state.h"
+#include "history.h"
+#include "snapshot.h"
+#include "relay.h"
 #include "event.h"
 #include "engine.h"
+#include "procwatch.h"
+#include "linkwatch.h"
+#include "sampler.h"
+#include "filewatch.h"
+#include "programwatch.h"
+#include "resolver.h"
+#include "latency.h"
+#include "instance.h"
 
 // libmonit
 #include "Bootstrap.h"
@@ -112,6 +135,12 @@ static RETSIGTYPE do_reload(int);       /* Signalhandler for a daemon reload */
 static RETSIGTYPE do_destroy(int);   /* Signalhandler for monit finalization */
 static RETSIGTYPE do_wakeup(int);  /* Signalhandler for a daemon wakeup call */
 static void waitforchildren(void); /* Wait for any child process not running */
+static void stop_heartbeat();             /* Stop the M/Monit heartbeat thread */
+static int  merge_services(Service_T);  /* Keep the unchanged services on reload */
+static boolean_t wait_cycle(unsigned long long);  /* Sleep until next cycle */
+static void init_wakeup();                /* Create the main loop wakeup pipe */
+static void post_wakeup();                           /* Wake up the main loop */
+static void clear_wakeup();                     /* Consume the pending wakeups */
 
 
 
@@ -125,6 +154,8 @@ Service_T servicelist_conf;   /**< The service list in conf file (c. in p.y) */
 ServiceGroup_T servicegrouplist;/**< The service group list (created in p.y) */
 SystemInfo_T systeminfo;                              /**< System infomation */
 
+static int wakeup[2] = {-1, -1};     /* The main loop wakeup pipe (read, write) */
+
 Thread_T heartbeatThread;
 Sem_T    heartbeatCond;
 Mutex_T  heartbeatMutex;
@@ -140,8 +171,8 @@ char *modenames[] = {"active", "passive", "manual"};
 char *checksumnames[] = {"UNKNOWN", "MD5", "SHA1"};
 char *operatornames[] = {"greater than", "less than", "equal to", "not equal to", "changed"};
 char *operatorshortnames[] = {">", "<", "=", "!=", "<>"};
-char *statusnames[] = {"Accessible", "Accessible", "Accessible", "Running", "Online with all services", "Running", "Accessible", "Status ok", "UP"};
-char *servicetypes[] = {"Filesystem", "Directory", "File", "Process", "Remote Host", "System", "Fifo", "Program", "Network"};
+char *statusnames[] = {"Accessible", "Accessible", "Accessible", "Running", "Online with all services", "Running", "Accessible", "Status ok", "UP", "Accessible", "Status ok"};
+char *servicetypes[] = {"Filesystem", "Directory", "File", "Process", "Remote Host", "System", "Fifo", "Program", "Network", "Cgroup", "Processes"};
 char *pathnames[] = {"Path", "Path", "Path", "Pid file", "Path", "", "Path"};
 char *icmpnames[] = {"Reply", "", "", "Destination Unreachable", "Source Quench", "Redirect", "", "", "Ping", "", "", "Time Exceeded", "Parameter Problem", "Timestamp Request", "Timestamp Reply", "Information Request", "Information Reply", "Address Mask Request", "Address Mask Reply"};
 char *sslnames[] = {"auto", "v2", "v3", "tlsv1", "tlsv1.1", "tlsv1.2", "none"};
@@ -313,30 +344,69 @@ static void do_reinit() {
                 "Reinitializing Monit - Control file '%s'\n",
                 Run.controlfile);
 
-        /* Wait non-blocking for any children that has exited. Since we
-         reinitialize any information about children we have setup to wait
-         for will be lost. This may create zombie processes until Monit
-         itself exit. However, Monit will wait on all children that has exited
-         before it ifself exit. TODO: Later refactored versions will use a
-         globale process table which a sigchld handler can check */
+        /* The running configuration is up to date if no file read by the parser changed, just reopen the log (for example after the log rotation) */
+        if (! file_isControlFileChanged()) {
+                LogInfo("Control file unchanged -- keeping the current configuration\n");
+                Run.doreload = false;
+                log_stop();
+                log_close();
+                if (! log_init())
+                        exit(1);
+                log_start();
+                return;
+        }
+
+        /* Wait non-blocking for any children that has exited. The exec action
+         programs are tracked and reaped by spawn_reap(), the program checks are
+         waited for by check_program() or the program watcher, this reaps any
+         other stray children before the service list is rebuilt */
+        spawn_reap();
         waitforchildren();
 
-        if (Run.mmonits && heartbeatRunning) {
-                Sem_signal(heartbeatCond);
-                Thread_join(heartbeatThread);
-                heartbeatRunning = false;
-        }
+        /* Hold the heartbeat and the http requests while the configuration is rebuilt, they're restarted only if their settings changed */
+        boolean_t paused = Run.mmonits && heartbeatRunning;
+        if (paused)
+                Mutex_lock(heartbeatMutex);
+        monit_http(Httpd_Suspend);
 
-        Run.doreload = false;
+        ProcWatch_stop();
+        FileWatch_stop();
+        ProgramWatch_stop();
+        LinkWatch_stop();
+        Sampler_stop();
+        log_stop();
 
-        /* Stop http interface */
-        if (Run.httpd.flags & Httpd_Net || Run.httpd.flags & Httpd_Unix)
-                monit_http(Httpd_Stop);
+        Resolver_flush();
+
+        status_xml_reset();
+
+        Run.doreload = false;
 
-        /* Save the current state (no changes are possible now since the http thread is stopped) */
+        /* Save the current state (no changes are possible now since the http requests are suspended) */
         State_save();
         State_close();
 
+        /* Deliver the pending events while the current configuration is valid */
+        Event_delivery_stop();
+        Event_queue_close();
+
+        sendmail_close();
+
+        /* The M/Monit messages still sent in the background use the current configuration */
+        handle_mmonit_wait();
+
+        /* Keep the current services, the unchanged ones are moved to the new service list with their runtime data */
+        Service_T previous = servicelist;
+        servicelist = NULL;
+        struct {
+                MD_T global;
+                MD_T httpd;
+                MD_T mmonit;
+        } digest;
+        memcpy(&digest, &Run.digest, sizeof(digest));
+        void *infotable = Run.infotable;
+        Run.infotable = NULL;
+
         /* Run the garbage collector */
         gc();
 
@@ -345,12 +415,22 @@ static void do_reinit() {
                 exit(1);
         }
 
+        if (IS(digest.global, Run.digest.global)) {
+                int kept = merge_services(previous);
+                LogInfo("Reinitializing Monit - %d services unchanged, the other services were reloaded\n", kept);
+        } else {
+                LogInfo("Reinitializing Monit - global settings changed, all services were reloaded\n");
+        }
+        gc_service_list(&previous);
+        FREE(infotable);
+
         /* Close the current log */
         log_close();
 
         /* Reinstall the log system */
         if (! log_init())
                 exit(1);
+        log_start();
 
         /* Did we find any services ?  */
         if (! servicelist) {
@@ -370,18 +450,49 @@ static void do_reinit() {
         if (! State_open())
                 exit(1);
         State_update();
+        History_open();
+        Snapshot_open();
+
+        /* Resume or restart the http interface */
+        if (IS(digest.httpd, Run.digest.httpd) && can_http()) {
+                monit_http(Httpd_Resume);
+        } else {
+                monit_http(Httpd_Stop);
+                if (can_http())
+                        monit_http(Httpd_Start);
+        }
 
-        /* Start http interface */
-        if (can_http())
-                monit_http(Httpd_Start);
+        Event_delivery_start();
 
         /* send the monit startup notification */
         Event_post(Run.system, Event_Instance, State_Changed, Run.system->action_MONIT_RELOAD, "Monit reloaded");
 
-        if (Run.mmonits) {
-                Thread_create(heartbeatThread, heartbeat, NULL);
+        /* Resume or restart the heartbeat */
+        if (paused) {
+                Mutex_unlock(heartbeatMutex);
+                if (! Run.mmonits || ! IS(digest.mmonit, Run.digest.mmonit))
+                        stop_heartbeat();
+        }
+        if (Run.mmonits && ! heartbeatRunning) {
                 heartbeatRunning = true;
+                Thread_create(heartbeatThread, heartbeat, NULL);
         }
+        if (! Run.relay)
+                Relay_clear();
+
+        if (Run.processevents)
+                ProcWatch_start();
+
+        if (Run.fileevents)
+                FileWatch_start();
+
+        if (Run.programevents)
+                ProgramWatch_start();
+
+        if (Run.networkevents)
+                LinkWatch_start();
+
+        Sampler_start();
 }
 
 
@@ -401,30 +512,40 @@ static void do_action(char **args) {
                    IS(action, "monitor")   ||
                    IS(action, "unmonitor") ||
                    IS(action, "restart")) {
-                if (Run.mygroup || service) {
-                        int errors = 0;
-                        boolean_t (*_control_service)(const char *, const char *) = exist_daemon() ? control_service_daemon : control_service_string;
-
+                if ((Run.mygroup || IS(service, "all")) && exist_daemon()) {
+                        /* The daemon resolves the group and queues the actions of all its services at once */
+                        if (! control_group_daemon(Run.mygroup, action))
+                                exit(1);
+                } else if (Run.mygroup || IS(service, "all")) {
+                        /* The group and all actions are passed in one batch, so independent services are started/stopped in parallel */
+                        int count = 0, size = 0;
+                        for (Service_T s = servicelist; s; s = s->next)
+                                size++;
+                        Service_T *services = CALLOC(size ? size : 1, sizeof(Service_T));
                         if (Run.mygroup) {
                                 for (ServiceGroup_T sg = servicegrouplist; sg; sg = sg->next) {
                                         if (IS(Run.mygroup, sg->name)) {
-                                                for (ServiceGroupMember_T sgm = sg->members; sgm; sgm = sgm->next)
-                                                        if (! _control_service(sgm->name, action))
-                                                                errors++;
+                                                for (ServiceGroupMember_T sgm = sg->members; sgm; sgm = sgm->next) {
+                                                        Service_T s = Util_getService(sgm->name);
+                                                        if (s && count < size)
+                                                                services[count++] = s;
+                                                }
                                                 break;
                                         }
                                 }
-                        } else if (IS(service, "all")) {
-                                for (Service_T s = servicelist; s; s = s->next) {
-                                        if (s->visited)
-                                                continue;
-                                        if (! _control_service(s->name, action))
-                                                errors++;
-                                }
                         } else {
-                                errors = _control_service(service, action) ? 0 : 1;
+                                for (Service_T s = servicelist; s; s = s->next)
+                                        services[count++] = s;
                         }
-                        if (errors)
+                        boolean_t rv = true;
+                        if (count)
+                                rv = control_services(services, count, Util_getAction(action));
+                        FREE(services);
+                        if (! rv)
+                                exit(1);
+                } else if (service) {
+                        boolean_t (*_control_service)(const char *, const char *) = exist_daemon() ? control_service_daemon : control_service_string;
+                        if (! _control_service(service, action))
                                 exit(1);
                 } else {
                         LogError("Please specify a service name or 'all' after %s\n", action);
@@ -466,17 +587,27 @@ static void do_exit() {
                 if (can_http())
                         monit_http(Httpd_Stop);
 
-                if (Run.mmonits && heartbeatRunning) {
-                        Sem_signal(heartbeatCond);
-                        Thread_join(heartbeatThread);
-                        heartbeatRunning = false;
-                }
+                stop_heartbeat();
+
+                ProcWatch_stop();
+                FileWatch_stop();
+                ProgramWatch_stop();
+                LinkWatch_stop();
+                Sampler_stop();
+
+                Snapshot_close();
 
                 LogInfo("Monit daemon with pid [%d] stopped\n", (int)getpid());
 
                 /* send the monit stop notification */
                 Event_post(Run.system, Event_Instance, State_Changed, Run.system->action_MONIT_STOP, "Monit stopped");
+
+                Event_delivery_stop();
         }
+        log_stop();
+        Event_queue_close();
+        sendmail_close();
+        handle_mmonit_wait();
         gc();
 #ifdef HAVE_OPENSSL
         Ssl_stop();
@@ -499,7 +630,7 @@ static void do_default() {
                 if (can_http()) {
                         if (Run.httpd.flags & Httpd_Net)
                                 LogInfo("Starting Monit %s daemon with http interface at [%s]:%d\n", VERSION, Run.httpd.socket.net.address ? Run.httpd.socket.net.address : "*", Run.httpd.socket.net.port);
-                        else if (Run.httpd.flags & Httpd_Unix)
+                        if (Run.httpd.flags & Httpd_Unix)
                                 LogInfo("Starting Monit %s daemon with http interface at %s\n", VERSION, Run.httpd.socket.unix.path);
                 } else {
                         LogInfo("Starting Monit %s daemon\n", VERSION);
@@ -518,9 +649,13 @@ static void do_default() {
                         exit(1);
                 }
 
+                log_start();
+
                 if (! State_open())
                         exit(1);
                 State_update();
+                History_open();
+                Snapshot_open();
 
                 atexit(file_finalize);
 
@@ -540,21 +675,41 @@ static void do_default() {
                 if (can_http())
                         monit_http(Httpd_Start);
 
+                Event_delivery_start();
+
                 /* send the monit startup notification */
                 Event_post(Run.system, Event_Instance, State_Changed, Run.system->action_MONIT_START, "Monit started");
 
                 if (Run.mmonits) {
-                        Thread_create(heartbeatThread, heartbeat, NULL);
                         heartbeatRunning = true;
+                        Thread_create(heartbeatThread, heartbeat, NULL);
                 }
 
+                if (Run.processevents)
+                        ProcWatch_start();
+
+                if (Run.fileevents)
+                        FileWatch_start();
+
+                if (Run.programevents)
+                        ProgramWatch_start();
+
+                if (Run.networkevents)
+                        LinkWatch_start();
+
+                Sampler_start();
+
+                init_wakeup();
+                unsigned long long started = Latency_now();
                 while (true) {
+                        clear_wakeup();
                         validate();
                         State_save();
 
-                        /* In the case that there is no pending action then sleep */
-                        if (! Run.doaction)
-                                sleep(Run.polltime);
+                        /* In the case that there is no pending action or wakeup request (it may come during validation from the process events watcher) then sleep, the failure rechecks due before the next cycle run meanwhile */
+                        if (! Run.doaction && ! Run.dowakeup)
+                                while (wait_cycle(started) && ! Run.stopped && ! Run.doreload && ! Run.doaction && ! Run.dowakeup)
+                                        validate_recheck();
 
                         if (Run.dowakeup) {
                                 Run.dowakeup = false;
@@ -820,9 +975,18 @@ static void *heartbeat(void *args) {
         LogInfo("M/Monit heartbeat started\n");
         LOCK(heartbeatMutex)
         {
-                while (! Run.stopped && ! Run.doreload) {
+                /* The random delays spread the reports of many Monit instances which were started at the same time */
+                if (Run.mmonitjitter > 0) {
+                        struct timespec wait = {.tv_sec = Time_now() + random() % (Run.mmonitjitter + 1), .tv_nsec = 0};
+                        Sem_timeWait(heartbeatCond, heartbeatMutex, wait);
+                }
+                while (! Run.stopped && heartbeatRunning) {
+                        unsigned long long cpu = Latency_cpu();
                         handle_mmonit(NULL);
-                        struct timespec wait = {.tv_sec = Time_now() + Run.polltime, .tv_nsec = 0};
+                        if (Run.relay)
+                                Relay_forward();
+                        Latency_cost(Cost_Heartbeat, cpu);
+                        struct timespec wait = {.tv_sec = Time_now() + Run.polltime + (Run.mmonitjitter > 0 ? random() % (Run.mmonitjitter + 1) : 0), .tv_nsec = 0};
                         Sem_timeWait(heartbeatCond, heartbeatMutex, wait);
                 }
         }
@@ -840,6 +1004,7 @@ static void *heartbeat(void *args) {
  */
 static RETSIGTYPE do_reload(int sig) {
         Run.doreload = true;
+        post_wakeup();
 }
 
 
@@ -848,6 +1013,7 @@ static RETSIGTYPE do_reload(int sig) {
  */
 static RETSIGTYPE do_destroy(int sig) {
         Run.stopped = true;
+        post_wakeup();
 }
 
 
@@ -856,6 +1022,7 @@ static RETSIGTYPE do_destroy(int sig) {
  */
 static RETSIGTYPE do_wakeup(int sig) {
         Run.dowakeup = true;
+        post_wakeup();
 }
 
 
@@ -864,3 +1031,156 @@ static RETSIGTYPE do_wakeup(int sig) {
 static void waitforchildren(void) {
         while (waitpid(-1, NULL, WNOHANG) > 0) ;
 }
+
+
+/**
+ * Stop the M/Monit heartbeat thread if it is running
+ */
+static void stop_heartbeat() {
+        if (! heartbeatRunning)
+                return;
+        LOCK(heartbeatMutex)
+        {
+                heartbeatRunning = false;
+                Sem_signal(heartbeatCond);
+        }
+        END_LOCK;
+        Thread_join(heartbeatThread);
+}
+
+
+/**
+ * Sleep until the next cycle. The cycles start at fixed rate, every poll
+ * time from the given start, so the duration of the cycle doesn't delay
+ * the next one and the sampling times don't drift. If the cycle overran,
+ * the missed starts are skipped. The sleep ends as soon as some wakeup was
+ * posted since the cycle started, see post_wakeup(), so a signal which
+ * arrived before the sleep is not lost. If some failure recheck is due
+ * before the next cycle, the sleep ends at the recheck deadline. In the
+ * power save mode, the cycles in which no check is due are skipped, the
+ * sleep lasts until the cycle nearest to the earliest check deadline
+ * @param started The start of the first cycle (Latency_now() time)
+ * @return true if the sleep ended for the failure recheck, false if the
+ * next cycle should start
+ */
+static boolean_t wait_cycle(unsigned long long started) {
+        unsigned long long period = Run.polltime * 1000000ULL;
+        unsigned long long now = Latency_now();
+        if (! period || now < started)
+                return false;
+        unsigned long long delay = period - (now - started) % period;
+        if (Run.powersave && Run.handler_flag == Handler_Succeeded) {
+                /* The due check runs in the cycle nearest to its deadline (see check_skip()), the queued events wait for a cycle with a check */
+                unsigned long long due = validate_nextDue();
+                if (due > now + delay + period / 2)
+                        delay += (due - (now + delay) - period / 2 + period - 1) / period * period;
+        }
+        unsigned long long recheck = validate_nextRecheck();
+        boolean_t rechecking = recheck && recheck < now + delay;
+        if (rechecking)
+                delay = recheck > now ? recheck - now : 0;
+        if (wakeup[0] >= 0) {
+                struct pollfd fds = {.fd = wakeup[0], .events = POLLIN};
+                if (poll(&fds, 1, (int)((delay + 999) / 1000)) != 0)
+                        return false;
+        } else {
+                struct timespec t = {.tv_sec = delay / 1000000, .tv_nsec = (delay % 1000000) * 1000};
+                if (nanosleep(&t, NULL) != 0)
+                        return false;
+        }
+        return rechecking;
+}
+
+
+/**
+ * Create the self-pipe which wakes up the main loop. The signal handlers
+ * write to the pipe, so the wakeup (the reload, stop and wakeup signals,
+ * the HTTP actions and the watchers events, which all signal the main
+ * thread) is kept until the loop consumes it. If the pipe cannot be
+ * created, the loop sleeps and relies on the signal interruption only
+ */
+static void init_wakeup() {
+        if (wakeup[0] >= 0)
+                return;
+        if (pipe(wakeup) < 0) {
+                LogError("Cannot create the wakeup pipe -- %s\n", STRERROR);
+                wakeup[0] = wakeup[1] = -1;
+                return;
+        }
+        for (int i = 0; i < 2; i++) {
+                fcntl(wakeup[i], F_SETFL, fcntl(wakeup[i], F_GETFL) | O_NONBLOCK);
+                fcntl(wakeup[i], F_SETFD, FD_CLOEXEC);
+        }
+}
+
+
+/**
+ * Post a wakeup to the main loop. Async-signal-safe, called from the
+ * signal handlers
+ */
+static void post_wakeup() {
+        if (wakeup[1] >= 0) {
+                int saved = errno;
+                if (write(wakeup[1], "", 1) < 0) {
+                        // The pipe is full, the loop will wake up anyway
+                }
+                errno = saved;
+        }
+}
+
+
+/**
+ * Consume the pending wakeups. Called before the cycle starts, the cycle
+ * handles all requests posted so far
+ */
+static void clear_wakeup() {
+        if (wakeup[0] >= 0) {
+                char buf[64];
+                while (read(wakeup[0], buf, sizeof(buf)) > 0)
+                        ;
+        }
+}
+
+
+/**
+ * Move the runtime data of the services which didn't change from the
+ * previous service list to the new one. The service objects in the new
+ * list keep their place, the content is exchanged, so the previous list
+ * holds the new copies of the unchanged services and can be removed
+ * @param previous The service list before reload
+ * @return The number of unchanged services
+ */
+static int merge_services(Service_T previous) {
+        int kept = 0;
+        for (Service_T o = previous; o; o = o->next) {
+                // The new services are indexed by name, only the definition of the new service with the same name is compared
+                Service_T s = Util_getService(o->name);
+                if (s && *s->definition && s->type == o->type && IS(s->definition, o->definition)) {
+                        struct myservice t = *s;
+                        Service_T next = o->next;
+                        *s = *o;
+                        s->next = t.next;
+                        s->next_conf = t.next_conf;
+                        s->next_depend = t.next_depend;
+                        *o = t;
+                        o->next = next;
+                        // The new service keeps its position and check results table slot, exchange the slots content
+                        s->ordinal = t.ordinal;
+                        struct myinfo inf;
+                        size_t size = Util_getInfoSize(s->type);
+                        memcpy(&inf, s->inf, size);
+                        memcpy(s->inf, o->inf, size);
+                        memcpy(o->inf, &inf, size);
+                        Info_T slot = s->inf;
+                        s->inf = o->inf;
+                        o->inf = slot;
+                        // The dependencies of the previous copy point to the previous service list, resolve them in the new one
+                        for (Dependant_T d = s->dependantlist; d; d = d->next)
+                                d->service = Util_getService(d->dependant);
+                        // The instances of a template point to the previous object, which is freed with the previous list
+                        Instance_adopt(s);
+                        kept++;
+                }
+        }
+        return kept;
+}
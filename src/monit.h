@@ -152,11 +152,14 @@ typedef enum {
 #define START_DELAY        0
 #define EXEC_TIMEOUT       30
 #define PROGRAM_TIMEOUT    300
+#define PLUGIN_TIMEOUT     30
 
 
 typedef enum {
         Httpd_Start = 1,
-        Httpd_Stop
+        Httpd_Stop,
+        Httpd_Suspend,
+        Httpd_Resume
 } __attribute__((__packed__)) Httpd_Action;
 
 
@@ -164,7 +167,8 @@ typedef enum {
         Every_Cycle = 0,
         Every_SkipCycles,
         Every_Cron,
-        Every_NotInCron
+        Every_NotInCron,
+        Every_Interval
 } __attribute__((__packed__)) Every_Type;
 
 
@@ -192,7 +196,8 @@ typedef enum {
         Httpd_Unix                        = 0x2,  // Unix socket
         Httpd_Ssl                         = 0x4,  // SSL enabled
         Httpd_Signature                   = 0x8,  // Server Signature enabled
-        Httpd_AllowSelfSignedCertificates = 0x10  // Server Signature enabled
+        Httpd_AllowSelfSignedCertificates = 0x10, // Server Signature enabled
+        Httpd_SessionTickets              = 0x20  // SSL session tickets enabled
 } __attribute__((__packed__)) Httpd_Flags;
 
 
@@ -225,10 +230,11 @@ typedef enum {
 
 
 typedef enum {
-        Monitor_Not     = 0x0,
-        Monitor_Yes     = 0x1,
-        Monitor_Init    = 0x2,
-        Monitor_Waiting = 0x4
+        Monitor_Not        = 0x0,
+        Monitor_Yes        = 0x1,
+        Monitor_Init       = 0x2,
+        Monitor_Waiting    = 0x4,
+        Monitor_Suppressed = 0x8
 } __attribute__((__packed__)) Monitor_State;
 
 
@@ -241,7 +247,9 @@ typedef enum {
         Service_System,
         Service_Fifo,
         Service_Program,
-        Service_Net
+        Service_Net,
+        Service_Cgroup,
+        Service_Processes
 } __attribute__((__packed__)) Service_Type;
 
 
@@ -264,7 +272,18 @@ typedef enum {
         Resource_CpuWait,
         Resource_CpuPercentTotal,
         Resource_SwapPercent,
-        Resource_SwapKbyte
+        Resource_SwapKbyte,
+        Resource_CpuMax,
+        Resource_CpuNodeMax,
+        Resource_Tasks,
+        Resource_ReadBytes,
+        Resource_WriteBytes,
+        Resource_FileDescriptors,
+        Resource_Size,
+        Resource_MonitCpu,
+        Resource_MonitMemory,
+        Resource_MonitFileDescriptors,
+        Resource_Types                       /**< Number of the resource types + 1 */
 } __attribute__((__packed__)) Resource_Type;
 
 
@@ -307,6 +326,13 @@ typedef enum {
 } __attribute__((__packed__)) Handler_Type;
 
 
+typedef enum {
+        Mmonit_Sequential = 0,
+        Mmonit_FirstSuccess,
+        Mmonit_AllSuccess
+} __attribute__((__packed__)) Mmonit_Parallel_Type;
+
+
 /* Length of the longest message digest in bytes */
 #define MD_SIZE 65
 
@@ -316,12 +342,45 @@ typedef enum {
 
 #define EXPECT_BUFFER_MAX (Unit_Kilobyte * 100 + 1)
 
+#define SOCKET_BUFFER (Unit_Kilobyte * 16) // Default socket receive buffer initial size
+
+#define SOCKET_BUFFER_MAX Unit_Megabyte // Socket receive buffer growth limit
+
+#define SCHEDULER_WORKERS_MAX 256
+
+#define PROCESSES_TOP 10 // Number of the top offenders reported by the processes service
+
+#define INSTANCES_DEFAULT 100 // Default maximum number of the process instances of a template
+#define INSTANCES_MAX 10000   // Upper limit of the process instances of a template
+#define INSTANCES_GRACE 300   // Seconds a retired process instance is kept for the pending events
+
+#define DNSCACHE_MAXAGE 300 // Default DNS cache max age in seconds
+
+#define MMONIT_DELTA_FULL 10 // Default number of delta status reports between full status reports
+
+#define EVENTQUEUE_BATCH 100 // Default number of queued events replayed at once
+
+#define EVENTQUEUE_REPLAY 1000 // Default max. number of queued events replayed per cycle
+
+#define MMONIT_BACKOFF_MIN 10 // The first M/Monit backoff after the server asked to slow down, in seconds
+
+#define MMONIT_BACKOFF_MAX 600 // Maximum M/Monit backoff in seconds
+
+#define HTTPD_WORKERS 4 // Default number of HTTP request worker threads
+
+#define HTTPD_MAXCONNECTIONS 64 // Default maximum number of HTTP client connections
+
+#define HTTPD_SESSIONCACHE 1024 // Default number of SSL sessions cached by the HTTP server
+
+#define HTTPD_SESSIONTIMEOUT 300 // Default SSL session cache timeout in seconds
+
 
 #define LEVEL_NAME_FULL    "full"
 #define LEVEL_NAME_SUMMARY "summary"
 
 
 #include "socket.h"
+#include "arena.h"
 
 
 /** ------------------------------------------------- Special purpose macros */
@@ -344,7 +403,8 @@ Sigfunc *signal(int signo, Sigfunc * func);
 #undef MIN
 #define MIN(x,y) ((x) < (y) ? (x) : (y))
 #define IS(a,b)  ((a && b) ? Str_isEqual(a, b) : false)
-#define DEBUG LogDebug
+/* Check the debug level before the message arguments are evaluated and formatted */
+#define DEBUG(...) do { if (Run.debug) LogDebug(__VA_ARGS__); } while (0)
 #define FLAG(x, y) (x & y) == y
 #define NVLSTR(x) (x ? x : "")
 
@@ -384,8 +444,8 @@ typedef struct mycommand {
 /** Defines an event action object */
 typedef struct myaction {
         Action_Type id;                                   /**< Action to be done */
-        unsigned char count;       /**< Event count needed to trigger the action */
-        unsigned char cycles;/**< Cycles during which count limit can be reached */
+        unsigned short count;      /**< Event count needed to trigger the action */
+        unsigned short cycles;/**< Cycles during which count limit can be reached */
         command_t exec;                     /**< Optional command to be executed */
 } *Action_T;
 
@@ -427,12 +487,31 @@ typedef struct mymmonit {
         URL_T url;                                             /**< URL definition */
         SslOptions_T ssl;                                      /**< SSL definition */
         int timeout;                /**< The timeout to wait for connection or i/o */
+        boolean_t json;              /**< true if the messages use the JSON format */
 
         /** For internal use */
+        Socket_T socket;                     /**< Persistent connection or NULL */
+        boolean_t compress;   /**< true if the server accepts gzip compressed data */
+        unsigned long long generation; /**< Status generation sent, 0 = send full */
+        int deltas;                /**< Delta reports sent since the last full one */
+        int backoffs;              /**< Consecutive responses asking to slow down */
+        time_t retry;          /**< No status report is sent before this time, 0 = none */
+        boolean_t busy;      /**< true if a parallel sender uses the connection */
         struct mymmonit *next;                         /**< next receiver in chain */
 } *Mmonit_T;
 
 
+/** Defines a monit cluster peer */
+typedef struct mypeer {
+        URL_T url;                                  /**< The peer's http interface */
+
+        /** For internal use */
+        boolean_t up;                 /**< true if the peer answered in this cycle */
+        MD_T id;                                   /**< The peer's unique monit id */
+        struct mypeer *next;                               /**< next peer in chain */
+} *Peer_T;
+
+
 /** Defines a mailinglist object */
 typedef struct mymail {
         char *to;                         /**< Mail address for alert notification */
@@ -495,6 +574,7 @@ typedef struct myprocesstree {
         double        time_prev;                                 /**< 1/10 seconds */
         long          cputime;                                   /**< 1/10 seconds */
         long          cputime_prev;                              /**< 1/10 seconds */
+        boolean_t     cmdline_shared;  /**< cmdline is owned by another entry's buffer */
 
         int          *children;
 } ProcessTree_T;
@@ -508,6 +588,12 @@ typedef struct mysysteminfo {
         short total_cpu_user_percent;    /**< Total CPU in use in user space (pct.)*/
         short total_cpu_syst_percent;  /**< Total CPU in use in kernel space (pct.)*/
         short total_cpu_wait_percent;       /**< Total CPU in use in waiting (pct.)*/
+        boolean_t percpu;         /**< true if the per-CPU statistics are gathered */
+        int nodes;                                       /**< Number of NUMA nodes */
+        int cpu_max;                                          /**< The busiest CPU */
+        short cpu_max_percent;                /**< Usage of the busiest CPU (pct.) */
+        int node_max;                                   /**< The busiest NUMA node */
+        short node_max_percent;         /**< Usage of the busiest NUMA node (pct.) */
         unsigned long mem_kbyte_max;               /**< Maximal system real memory */
         unsigned long swap_kbyte_max;                               /**< Swap size */
         unsigned long total_mem_kbyte; /**< Total real memory in use in the system */
@@ -518,10 +604,19 @@ typedef struct mysysteminfo {
 } SystemInfo_T;
 
 
+/** Defines the datagram functions of a UDP protocol, used by udp_probe_batch() */
+typedef struct Datagram_T {
+        int (*request)(void *port, unsigned char *request, int size, unsigned id); /**< Build the request, returns its length */
+        boolean_t (*match)(const unsigned char *request, int requestlength, const unsigned char *response, int length); /**< true if the response answers the request */
+        void (*verify)(void *port, const unsigned char *request, int requestlength, unsigned char *response, int length); /**< Verify the response, throws IOException */
+} *Datagram_T;
+
+
 /** Defines a protocol object with protocol functions */
 typedef struct Protocol_T {
         const char *name;                                       /**< Protocol name */
         void (*check)(Socket_T);          /**< Protocol verification function */
+        Datagram_T datagram;               /**< UDP batch functions or NULL if none */
 } *Protocol_T;
 
 
@@ -537,6 +632,14 @@ typedef struct mygenericproto {
         struct mygenericproto *next;
 } *Generic_T;
 
+
+/** Defines the probing backoff of a failing remote test */
+typedef struct mybackoff {
+        int failures;                                /**< Consecutive failed tests */
+        int skip;                        /**< Cycles to skip before the next probe */
+} Backoff_T;
+
+
 /** Defines a port object */
 //FIXME: use unions for protocol-specific and sockettype-specific data
 typedef struct myport {
@@ -554,12 +657,18 @@ typedef struct myport {
         Hash_Type request_hashtype; /**< The optional type of hash for a req. document */
         Operator_Type operator;                           /**< Comparison operator */
         boolean_t is_available;          /**< true if the server/port is available */
+        boolean_t keepalive;  /**< true if the connection is kept open between cycles */
+        boolean_t reset;   /**< true if the connect-only test closes the connection by RST */
         int maxforward;            /**< Optional max forward for protocol checking */
         int timeout; /**< The timeout in millseconds to wait for connect or read i/o */
         int retry;       /**< Number of connection retry before reporting an error */
+        int fullevery;          /**< Full protocol test every N cycles, else probe */
+        int recheck;               /**< Seconds to the unconfirmed failure recheck */
         int version;                                         /**< Protocol version */
         int status;                                           /**< Protocol status */
         double response;                      /**< Socket connection response time */
+        double handshake;          /**< SSL handshake part of the response time */
+        double rtt;                      /**< TCP round trip time from the kernel or -1 */
         EventAction_T action;  /**< Description of the action upon event occurence */
         /** Apache-status specific parameters */
         struct apache_status {
@@ -586,10 +695,22 @@ typedef struct myport {
         } ApacheStatus;
 
         SslOptions_T SSL;                                      /**< SSL definition */
+        struct {
+                int days;   /**< The certificate must be valid more days than this or 0 */
+                time_t expiry;/**< notAfter of the first expiring peer certificate or 0 */
+                char subject[STRLEN];  /**< Subject of the first expiring certificate */
+        } certificate;
         Protocol_T protocol;     /**< Protocol object for testing a port's service */
         Request_T url_request;             /**< Optional url client request object */
 
         /** For internal use */
+        Backoff_T backoff;                        /**< Backoff of the failing test */
+        Socket_T session;                         /**< Keepalive connection or NULL */
+        boolean_t batched;     /**< true if the response was collected by the batch */
+        char *batch_error;          /**< The batch test error or NULL if succeeded */
+        int fullcycle;               /**< Cycles since the last full protocol test */
+        int failures;                                /**< Consecutive failed tests */
+        unsigned long long recheck_due; /**< Recheck deadline (Latency_now()) or 0 */
         struct myport *next;                               /**< next port in chain */
 } *Port_T;
 
@@ -605,6 +726,8 @@ typedef struct myicmp {
         EventAction_T action;  /**< Description of the action upon event occurence */
 
         /** For internal use */
+        boolean_t batched;     /**< true if the response was collected by the batch */
+        Backoff_T backoff;                        /**< Backoff of the failing test */
         struct myicmp *next;                               /**< next icmp in chain */
 } *Icmp_T;
 
@@ -628,6 +751,7 @@ typedef struct myservicegroup {
 
 typedef struct mydependant {
         char *dependant;                            /**< name of dependant service */
+        struct myservice *service;  /**< The dependant service, resolved on load */
 
         /** For internal use */
         struct mydependant *next;             /**< next dependant service in chain */
@@ -639,6 +763,8 @@ typedef struct myresource {
         Resource_Type resource_id;                     /**< Which value is checked */
         Operator_Type operator;                           /**< Comparison operator */
         long limit;                                     /**< Limit of the resource */
+        int window;               /**< Average over the seconds, 0 = current value */
+        int sampled;             /**< Sampling interval [s], 0 = sampled per cycle */
         EventAction_T action;  /**< Description of the action upon event occurence */
 
         /** For internal use */
@@ -670,17 +796,37 @@ typedef struct myactionrate {
 } *ActionRate_T;
 
 
+/** Compiled cron specification, see cron.h */
+typedef struct mycron {
+        unsigned long long minute;               /**< Bit mask of the minutes 0-59 */
+        unsigned int hour;                         /**< Bit mask of the hours 0-23 */
+        unsigned int day;                     /**< Bit mask of the month days 1-31 */
+        unsigned short month;                     /**< Bit mask of the months 1-12 */
+        unsigned char weekday;      /**< Bit mask of the week days 0-6, 0 = sunday */
+        boolean_t skip;            /**< Not every: the check is skipped until next */
+        time_t next;               /**< The next schedule change, 0 = not computed */
+        time_t checked;       /**< The last schedule update, detects clock changes */
+} *Cron_T;
+
+
 /** Defines when to run a check for a service. This type suports both the old
  cycle based every statement and the new cron-format version */
 typedef struct myevery {
-        Every_Type type; /**< 0 = not set, 1 = cycle, 2 = cron, 3 = negated cron */
+        Every_Type type; /**< 0 = not set, 1 = cycle, 2 = cron, 3 = negated cron, 4 = interval */
         time_t last_run;
         union {
                 struct {
                         int number; /**< Check this program at a given cycles */
                         int counter; /**< Counter for number. When counter == number, check */
                 } cycle; /**< Old cycle based every check */
-                char *cron; /* A crontab format string */
+                struct {
+                        int seconds; /**< Check this service every given seconds */
+                        unsigned long long next; /**< The next deadline (Latency_now() time), 0 = not scheduled yet */
+                } interval; /**< Fixed-rate interval check */
+                struct {
+                        char *spec; /**< A crontab format string */
+                        Cron_T schedule; /**< The compiled spec, allocated from the service arena */
+                } cron;
         } spec;
 } Every_T;
 
@@ -696,9 +842,14 @@ typedef struct mystatus {
 } *Status_T;
 
 
+/** In-process check plugin, see plugin.h */
+typedef struct myplugin *Plugin_T;
+
+
 typedef struct myprogram {
         Process_T P;          /**< A Process_T object representing the sub-process */
         Command_T C;          /**< A Command_T object for creating the sub-process */
+        Plugin_T plugin;        /**< The check plugin used instead of the program */
         command_t args;                                     /**< Program arguments */
         int timeout;           /**< Seconds the program may run until it is killed */
         time_t started;                      /**< When the sub-process was started */
@@ -713,6 +864,7 @@ typedef struct mysize {
         boolean_t test_changes;       /**< true if we only should test for changes */
         Operator_Type operator;                           /**< Comparison operator */
         unsigned long long size;                               /**< Size watermark */
+        int rate;             /**< Size change over the seconds, 0 = absolute size */
         EventAction_T action;  /**< Description of the action upon event occurence */
 
         /** For internal use */
@@ -764,6 +916,7 @@ typedef struct mybandwidth {
         unsigned long long limit;                              /**< Data watermark */
         int rangecount;                            /**< Time range to watch: count */
         Time_Type range;                                  /**< Time range to watch: unit */
+        int sampled;             /**< Sampling interval [s], 0 = sampled per cycle */
         EventAction_T action;  /**< Description of the action upon event occurence */
 
         /** For internal use */
@@ -771,6 +924,10 @@ typedef struct mybandwidth {
 } *Bandwidth_T;
 
 
+/** Directory tree checksum cache, see merkle.h */
+typedef struct mymerkle *Merkle_T;
+
+
 /** Defines checksum object */
 typedef struct mychecksum {
         boolean_t initialized;               /**< true if checksum was initialized */
@@ -778,6 +935,9 @@ typedef struct mychecksum {
         Hash_Type type;                   /**< The type of hash (e.g. md5 or sha1) */
         MD_T  hash;                     /**< A checksum hash computed for the path */
         int   length;                                      /**< Length of the hash */
+        int   verify;  /**< Force the checksum computation every N cycles (0 = never) */
+        int   cycles;                 /**< Cycles since the last checksum computation */
+        Merkle_T tree;              /**< The directory tree checksum cache or NULL */
         EventAction_T action;  /**< Description of the action upon event occurence */
 } *Checksum_T;
 
@@ -802,6 +962,12 @@ typedef struct mymatch {
         EventAction_T action;  /**< Description of the action upon event occurence */
 
         /** For internal use */
+        char *literal;       /**< Substring required by the pattern (prefilter) */
+        boolean_t absent;      /**< The literal is not in the scanned content block */
+        pid_t pid;               /**< The matching process in the tree snapshot */
+        int generation;           /**< The process tree snapshot of the pid above */
+        time_t starttime;               /**< The start time of the matching process */
+        unsigned int cmdhash;       /**< Hash of the matching process command line */
         struct mymatch *next;                             /**< next match in chain */
 } *Match_T;
 
@@ -858,6 +1024,77 @@ typedef struct myfilesystem {
 } *Filesystem_T;
 
 
+/** Defines a resource or filesystem rule compiled for the evaluation */
+typedef struct myrule {
+        boolean_t (*matches)(long long, long long); /**< Test of the rule operator */
+        long long limit;                                       /**< The rule limit */
+        int metric;                                /**< Index of the tested metric */
+        union {
+                Resource_T resource;
+                Filesystem_T filesystem;
+        } source;                            /**< The parsed rule, for the reports */
+} Rule_T;
+
+
+/** Defines the flat evaluation table of the service's resource rules */
+typedef struct myruletable {
+        int count;                                        /**< Number of the rules */
+        Rule_T rule[];                                /**< The rules in list order */
+} *RuleTable_T;
+
+
+/** Defines the control group statistics */
+typedef struct mycgroup {
+        char *path;             /**< Cgroup path, NULL = the cgroup of the process */
+        int version;           /**< Cgroup hierarchy version (1 or 2), 0 = unknown */
+        short cpu_percent;           /**< CPU usage, percentage * 10, -1 = unknown */
+        short mem_percent;                      /**< Memory usage, percentage * 10 */
+        int tasks;                                  /**< Number of tasks (threads) */
+        int processes;                                    /**< Number of processes */
+        long long mem_kbyte;                                /**< Memory usage [kB] */
+        long long read_rate;              /**< Bytes read per second, -1 = unknown */
+        long long write_rate;          /**< Bytes written per second, -1 = unknown */
+
+        /** For internal use */
+        pid_t pid;             /**< The process of the cgroup, 0 = the cgroup path */
+        unsigned long long cpu_usage;                     /**< Total CPU time [us] */
+        unsigned long long read_bytes;                       /**< Total bytes read */
+        unsigned long long write_bytes;                   /**< Total bytes written */
+        unsigned long long sampled;          /**< When the counters were read [us] */
+} *Cgroup_T;
+
+
+/** Defines the process above the resource limit of the processes service */
+typedef struct myoffender {
+        pid_t pid;                                               /**< Process id */
+        short cpu_percent;                  /**< CPU usage, percentage * 10 */
+        short mem_percent;               /**< Memory usage, percentage * 10 */
+        long long mem_kbyte;                           /**< Memory usage [kB] */
+        char *cmdline;                               /**< Process command line */
+} Offender_T;
+
+
+/** Defines the processes service statistics (one pass over the process table) */
+typedef struct myprocesses {
+        int matched;                       /**< Number of the matching processes */
+        int offenders;  /**< Number of the processes above some resource limit */
+        int top;                          /**< Number of the top offenders below */
+        Offender_T offender[PROCESSES_TOP]; /**< The top offenders, worst first */
+} *Processes_T;
+
+
+/** Metric history ring buffers, see history.h */
+typedef struct myhistory *History_T;
+
+
+/** High frequency metric samples, see sampler.h */
+typedef struct mysampler *Sampler_T;
+
+
+/** Event state of the last cycles, see event.c */
+typedef struct mystatemap *StateMap_T;
+
+
 /** Defines service data */
 typedef struct myinfo {
         union {
@@ -889,6 +1126,15 @@ typedef struct myinfo {
                         ino_t inode;                                                /**< Inode */
                         ino_t inode_prev;               /**< Previous inode for regex matching */
                         MD_T  cs_sum;                                            /**< Checksum */
+                        struct {
+                                dev_t dev;                                   /**< Device */
+                                ino_t inode;                                  /**< Inode */
+                                off_t size;                                    /**< Size */
+                                time_t mtime;                     /**< Modification time */
+                                long mtime_nsec;   /**< Modification time nanoseconds */
+                                time_t ctime;                    /**< Status change time */
+                                long ctime_nsec;  /**< Status change time nanoseconds */
+                        } cs_stat;            /**< File status at the last checksum computation */
                 } file;
 
                 struct {
@@ -896,6 +1142,8 @@ typedef struct myinfo {
                         mode_t mode;                                           /**< Permission */
                         int uid;                                              /**< Owner's uid */
                         int gid;                                              /**< Owner's gid */
+                        int cs_files;                        /**< Files in the checksum tree */
+                        MD_T  cs_sum;                                       /**< Tree checksum */
                 } directory;
 
                 struct {
@@ -922,27 +1170,89 @@ typedef struct myinfo {
                         short cpu_percent;                                /**< percentage * 10 */
                         short total_cpu_percent;                          /**< percentage * 10 */
                         time_t uptime;                                     /**< Process uptime */
+                        int threads;                          /**< Threads, -1 = not collected */
+                        int fds;                     /**< Open descriptors, -1 = not collected */
+                        long long read_rate;               /**< Read [B/s], -1 = not collected */
+                        long long write_rate;           /**< Written [B/s], -1 = not collected */
+                        unsigned long long read_bytes;                   /**< Total bytes read */
+                        unsigned long long write_bytes;               /**< Total bytes written */
+                        unsigned long long io_sampled;         /**< When the I/O was read [us] */
+                        long cputime;                /**< CPU time of the last sample [1/10 s] */
+                        double cputime_time;       /**< When the CPU time was sampled [1/10 s] */
                 } process;
 
                 struct {
                         Link_T stats;
+                        boolean_t interface;  /**< true if the service path is the interface name */
                 } net;
         } priv;
 } *Info_T;
 
 
+/** Number of latency histogram buckets, the bucket n counts 2^n - 2^(n+1)-1 us */
+#define LATENCY_BUCKETS 32
+
+
+typedef enum {
+        Latency_Check = 0,                            /**< The whole service check */
+        Latency_Port,                               /**< Port and unix socket test */
+        Latency_Match,                                     /**< Content match scan */
+        Latency_Checksum,                                /**< Checksum computation */
+        Latency_Filesystem,                        /**< Filesystem usage (statvfs) */
+        Latency_Types                        /**< Number of the measured latencies */
+} __attribute__((__packed__)) Latency_Type;
+
+
+typedef enum {
+        Cost_ProcessTree = 0,                              /**< Process table scan */
+        Cost_Check,                        /**< Service checks, incl. their events */
+        Cost_Event,                                          /**< Event processing */
+        Cost_Httpd,                                   /**< HTTP request processing */
+        Cost_Heartbeat,                         /**< M/Monit heartbeat and reports */
+        Cost_Types                          /**< Number of the measured subsystems */
+} __attribute__((__packed__)) Cost_Type;
+
+
+/** Defines a latency histogram, see latency.h */
+typedef struct mylatency {
+        unsigned long long count;                      /**< Number of measurements */
+        unsigned long long total;                   /**< Sum of the durations [us] */
+        unsigned long long min;                        /**< Shortest duration [us] */
+        unsigned long long max;                         /**< Longest duration [us] */
+        unsigned int bucket[LATENCY_BUCKETS];         /**< Log2 duration histogram */
+} *Latency_T;
+
+
+/** Defines a rule template: the process rules shared by the services which
+ * use it. The rules are immutable, the holder service is not checked and
+ * is released with the last reference */
+typedef struct mytemplate {
+        char *name;                                             /**< Template name */
+        int references;          /**< Number of the services using it + the parser */
+        struct myservice *rules;       /**< The holder of the rule lists and arena */
+        struct mytemplate *next;                    /**< Next template in the list */
+} *Template_T;
+
+
 /** Defines service data */
 //FIXME: use union for type-specific rules
 typedef struct myservice {
 
         /** Common parameters */
         char *name;                                  /**< Service descriptive name */
+        MD_T definition;           /**< Fingerprint of the service statement tokens */
         boolean_t (*check)(struct myservice *); /**< Service verification function */
         boolean_t visited;      /**< Service visited flag, set if dependencies are used */
         boolean_t depend_visited;/**< Depend visited flag, set if dependencies are used */
         Service_Type type;                             /**< Monitored service type */
         Monitor_State monitor;                             /**< Monitor state flag */
         Monitor_Mode mode;                    /**< Monitoring mode for the service */
+        /** Frequently updated runtime parameters, kept in the first cache lines */
+        int error;                                         /**< Error flags bitmap */
+        int error_hint;                  /**< Failed/Changed hint for error bitmap */
+        struct timeval collected;                    /**< When were data collected */
+        Info_T inf;     /**< Service check result, slot in the Run.infotable array */
+        int ordinal;                             /**< Position in the service list */
         Action_Type doaction;                 /**< Action scheduled by http thread */
         int  ncycle;                          /**< The number of the current cycle */
         int  nstart;           /**< The number of current starts with this service */
@@ -956,6 +1266,8 @@ typedef struct myservice {
         Mail_T      maillist;                  /**< Alert notification mailinglist */
 
         /** Test rules and event handlers */
+        Arena_T     arena;         /**< Memory of the rule lists and event actions */
+        Template_T  template;        /**< Rule template the lists end with or NULL */
         ActionRate_T actionratelist;                    /**< ActionRate check list */
         Checksum_T  checksum;                                  /**< Checksum check */
         Filesystem_T filesystemlist;                    /**< Filesystem check list */
@@ -964,10 +1276,33 @@ typedef struct myservice {
         Port_T      portlist;                            /**< Portnumbers to check */
         Port_T      socketlist;                         /**< Unix sockets to check */
         Resource_T  resourcelist;                          /**< Resouce check list */
+        RuleTable_T ruletable;          /**< Compiled resource or filesystem rules */
+        Cgroup_T    cgroup;                         /**< Cgroup statistics or NULL */
+        Processes_T processes;                   /**< Processes statistics or NULL */
+        History_T   history;                           /**< Metric history or NULL */
+        Sampler_T   sampler;                   /**< High frequency samples or NULL */
+        struct {
+                int max;       /**< Maximum number of instances, 0 = not a template */
+                int count;                        /**< Number of the live instances */
+                int skipped;     /**< Matching processes over the maximum last cycle */
+                pid_t pid;                       /**< The process of the instance */
+                time_t starttime;   /**< The start time of the instance process */
+                time_t retired;        /**< When the instance was retired, 0 = live */
+                struct myservice *owner;     /**< The template of the instance or NULL */
+                struct myservice *list;  /**< The live instances of the template by pid */
+                struct myservice *retiredlist;  /**< The retired instances of the template */
+                unsigned int generation;   /**< The mount table generation of the instances */
+                char **excluded;   /**< Filesystem types without instance, NULL terminated */
+        } instance;          /**< Process or filesystem instances of a template service */
         Size_T      sizelist;                                 /**< Size check list */
         Uptime_T    uptimelist;                             /**< Uptime check list */
         Match_T     matchlist;                             /**< Content Match list */
         Match_T     matchignorelist;                /**< Content Match ignore list */
+        struct {
+                unsigned long long bytes;  /**< Content matched per cycle at maximum or 0 */
+                int timeout;           /**< Content matching time per cycle [s] or 0 */
+                unsigned long long behind;    /**< Skip to the end if behind by more or 0 */
+        } matchbudget;                         /**< Content match work budget per cycle */
         Timestamp_T timestamplist;                       /**< Timestamp check list */
         Pid_T       pidlist;                                   /**< Pid check list */
         Pid_T       ppidlist;                                 /**< PPid check list */
@@ -997,30 +1332,54 @@ typedef struct myservice {
         EventAction_T action_ACTION;           /**< Action requested by CLI or GUI */
 
         /** Runtime parameters */
-        int                error;                          /**< Error flags bitmap */
-        int                error_hint;   /**< Failed/Changed hint for error bitmap */
-        Info_T             inf;                          /**< Service check result */
-        struct timeval     collected;                /**< When were data collected */
         char              *token;                                /**< Action token */
+        unsigned long long status_fingerprint; /**< Hash of the last status report */
+        unsigned long long status_generation; /**< Status generation of last change */
+        struct {
+                StringBuffer_T row;              /**< The cached row or NULL */
+                struct timeval collected;        /**< The row data collected time */
+                Monitor_State monitor;                /**< The row monitor state */
+                int error;                                /**< The row error flags */
+                int error_hint;                   /**< The row error hint flags */
+                Action_Type doaction;               /**< The row pending action */
+        } homerow;                 /**< The home page row cache of the web UI */
+        struct mypidfile {
+                dev_t device;                           /**< The pidfile device */
+                ino_t inode;                             /**< The pidfile inode */
+                time_t mtime;                /**< The pidfile modification time */
+                time_t ctime;                      /**< The pidfile change time */
+                off_t size;                                /**< The pidfile size */
+                pid_t pid;                /**< The pid read from the pidfile, 0 = none */
+                time_t starttime;       /**< The process start time, 0 = unknown */
+                boolean_t stale;       /**< The pid was reused by another process */
+        } *pidfile;   /**< The parsed pidfile of a process service, allocated on use */
+        int                watch;      /**< File events watch descriptor, 0 = none */
+        Latency_T          latency[Latency_Types];  /**< Check durations or NULL */
+        boolean_t          watch_changed;   /**< File events: changed since last check */
 
         /** Events */
         struct myevent {
                 #define           EVENT_VERSION  4      /**< The event structure version */
                 long              id;                      /**< The event identification */
                 struct timeval    collected;                 /**< When the event occured */
-                char             *source;                 /**< Event source service name */
+                const char       *source;      /**< Event source service name (interned) */
                 Monitor_Mode      mode;             /**< Monitoring mode for the service */
                 Service_Type      type;                      /**< Monitored service type */
                 State_Type        state;                                 /**< Test state */
                 boolean_t         state_changed;              /**< true if state changed */
                 Handler_Type      flag;                     /**< The handlers state flag */
-                long long         state_map;           /**< Event bitmap for last cycles */
+                StateMap_T        state_map;           /**< Event bitmap for last cycles */
                 unsigned int      count;                             /**< The event rate */
                 char             *message;    /**< Optional message describing the event */
                 EventAction_T     action;           /**< Description of the event action */
                 /** For internal use */
                 struct myevent   *next;                         /**< next event in chain */
         } *eventlist;                                     /**< Pending events list */
+        struct {
+                int count;                                /**< Number of indexed events */
+                int size;                                        /**< Hash table size */
+                struct myevent **table;    /**< Open addressing table of (id, action) */
+        } eventindex;               /**< Pending events lookup by id and action */
 
         /** Context specific parameters */
         char *path;  /**< Path to the filesys, file, directory or process pid file */
@@ -1045,9 +1404,17 @@ struct myrun {
         boolean_t isdaemon;            /**< true if program should run as a daemon */
         boolean_t use_syslog;                     /**< If true write log to syslog */
         boolean_t dolog;  /**< true if program should log actions, otherwise false */
+        boolean_t jsonlog;     /**< true if the log file uses the JSON lines format */
         boolean_t fipsEnabled;          /** true if monit should use FIPS-140 mode */
         boolean_t handler_init;             /**< The handlers queue initialization */
         boolean_t doprocess;            /**< true if process status engine is used */
+        boolean_t processevents;   /**< true if the process events watcher is used */
+        boolean_t fileevents;         /**< true if the file events watcher is used */
+        boolean_t programevents;    /**< true if the program check watcher is used */
+        boolean_t networkevents;  /**< true if the network interface watcher is used */
+        boolean_t relay;         /**< true if the M/Monit messages of other instances are relayed */
+        boolean_t powersave;  /**< true if the idle cycles and wakeups are avoided */
+        boolean_t dependsuppress; /**< true if a down service's dependants are probed */
         boolean_t doaction;        /**< true if some service(s) has action pending */
         boolean_t dommonitcredentials; /**< true if M/Monit should receive credentials */
         volatile boolean_t stopped; /**< true if monit was stopped. Flag used by threads */
@@ -1060,13 +1427,66 @@ struct myrun {
         char *pidfile;                                  /**< This programs pidfile */
         char *idfile;                           /**< The file with unique monit id */
         char *statefile;                /**< The file with the saved runtime state */
+        char *historyfile;             /**< The memory mapped metric history file */
+        char *statusfile;          /**< The memory mapped service status snapshot */
         char *mygroup;                              /**< Group Name of the Service */
         MD_T id;                                              /**< Unique monit id */
+        struct {
+                MD_T global;          /**< Fingerprint of the global statements */
+                MD_T httpd;             /**< Fingerprint of the set httpd statement */
+                MD_T mmonit;           /**< Fingerprint of the set mmonit statements */
+        } digest;                             /**< The control file fingerprints */
+        void *infotable;         /**< Check results table, see Util_buildInfoTable */
+        struct {
+                struct mylatency cycle;                /**< Duration of validate() */
+                struct mylatency processtree;         /**< Process tree build time */
+                struct mylatency event;              /**< Duration of Event_post() */
+                struct mylatency request;             /**< HTTP request processing */
+                struct mylatency report;      /**< M/Monit message render and send */
+                struct mylatency delivery;       /**< Event queued until delivered */
+                int deliveries;                   /**< Events waiting for delivery */
+                int deliveries_peak;         /**< Most events waiting for delivery */
+                unsigned long long overruns;      /**< Cycles longer than polltime */
+                unsigned long long cost[Cost_Types];      /**< Subsystems CPU [us] */
+                struct {
+                        unsigned long long cpuuser;        /**< User CPU time [us] */
+                        unsigned long long cpusystem;    /**< System CPU time [us] */
+                        long maxrss;              /**< Peak resident set size [kB] */
+                        long faults;                              /**< Page faults */
+                        long switches;                       /**< Context switches */
+                        long blockio;       /**< Block input and output operations */
+                        unsigned long long cost[Cost_Types];   /**< Subsystem [us] */
+                        int cpupercent;               /**< Daemon CPU usage [%*10] */
+                        long rss;                      /**< Resident set size [kB] */
+                        long long heap;         /**< Heap in use [B], -1 = unknown */
+                        long long heapgrowth;    /**< Heap growth in the cycle [B] */
+                        int fds;               /**< Open descriptors, -1 = unknown */
+                        int queue;                  /**< Events in the event queue */
+                        unsigned long long queuesize;    /**< Event queue size [B] */
+                        double requestrate;          /**< HTTP requests per second */
+                } usage;                     /**< Resource usage of the last cycle */
+        } latency;                                    /**< The check cycle profile */
         int  polltime;        /**< In deamon mode, the sleeptime (sec) between run */
         int  startdelay;                    /**< the sleeptime (sec) after startup */
         int  facility;              /** The facility to use when running openlog() */
         int  eventlist_slots;          /**< The event queue size - number of slots */
+        int  eventlist_buffer; /**< Events kept in memory before the journal, 0 = off */
+        int  eventlist_batch;         /**< Number of queued events replayed at once */
+        int  eventlist_replay;  /**< Max. number of queued events replayed per cycle */
+        int  statesync;   /**< State file sync interval in seconds, 0 = every cycle */
+        int  historyslots;            /**< Number of metric slots in the history file */
         int  expectbuffer; /**< Generic protocol expect buffer - STRLEN by default */
+        int  socketbuffer;        /**< Socket receive buffer initial size in bytes */
+        int  scheduler_workers;  /**< Number of parallel check threads, 0 = serial */
+        int  control_workers; /**< Number of parallel start/stop threads, 0 = serial */
+        int  process_workers;   /**< Number of process table scan threads, 0 = serial */
+        int  dnscache;         /**< DNS cache max age in seconds, 0 = disabled */
+        int  spawnlimit;    /**< Max. number of running child programs, 0 = no limit */
+        int  restartlimit;  /**< Max. service starts/restarts per cycle, 0 = no limit */
+        int  programlimit;  /**< Max. number of running program checks, 0 = no limit */
+        int  mmonitdelta; /**< Send full M/Monit status every N reports, 0 = always */
+        int  mmonitjitter;   /**< Max. random delay of the M/Monit heartbeat in seconds */
+        Mmonit_Parallel_Type mmonitparallel;  /**< How the M/Monit servers are used */
         int mailserver_timeout; /**< Connect and read timeout ms for a SMTP server */
         time_t incarnation;              /**< Unique ID for running monit instance */
         int  handler_queue[Handler_Max + 1];       /**< The handlers queue counter */
@@ -1076,13 +1496,17 @@ struct myrun {
         /** An object holding Monit HTTP interface setup */
         struct {
                 Httpd_Flags flags;
-                union {
+                int workers;                        /**< Request worker threads */
+                int maxconnections;           /**< Maximum open client connections */
+                struct {
                         struct {
                                 int  port;
                                 char *address;
                                 struct {
                                         char *pem;
                                         char *clientpem;
+                                        int sessioncache;  /**< Cached SSL sessions, 0 = off */
+                                        int sessiontimeout; /**< SSL session timeout seconds */
                                 } ssl;
                         } net;
                         struct {
@@ -1103,6 +1527,10 @@ struct myrun {
         Mail_T maillist;                /**< Global alert notification mailinglist */
         MailServer_T mailservers;    /**< List of MTAs used for alert notification */
         Mmonit_T mmonits;        /**< Event notification and status receivers list */
+        struct {
+                Peer_T peers;          /**< The other members of the monit cluster */
+                int replicas; /**< The number of members checking each remote host */
+        } cluster;
         Auth_T mmonitcredentials;     /**< Pointer to selected credentials or NULL */
         Event_T eventlist;              /** A list holding partialy handled events */
         /** User selected standard mail format */
@@ -1154,13 +1582,22 @@ extern char *sslnames[];
 
 boolean_t parse(char *);
 boolean_t control_service(const char *, Action_Type);
+boolean_t control_services(Service_T *, int, Action_Type);
 boolean_t control_service_string(const char *, const char *);
 boolean_t control_service_daemon(const char *, const char *);
+boolean_t control_group_daemon(const char *, const char *);
+void  control_queue(Service_T, Action_Type);
+void  control_queue_process();
 void  setup_dependants();
 void  reset_depend();
 void  spawn(Service_T, command_t, Event_T);
+boolean_t spawn_acquire(int);
+void  spawn_release();
+void  spawn_reap();
 boolean_t status(char *);
 boolean_t log_init();
+void  log_start();
+void  log_stop();
 void  LogEmergency(const char *, ...) __attribute__((format (printf, 1, 2)));
 void  LogAlert(const char *, ...) __attribute__((format (printf, 1, 2)));
 void  LogCritical(const char *, ...) __attribute__((format (printf, 1, 2)));
@@ -1169,6 +1606,7 @@ void  LogWarning(const char *, ...) __attribute__((format (printf, 1, 2)));
 void  LogNotice(const char *, ...) __attribute__((format (printf, 1, 2)));
 void  LogInfo(const char *, ...) __attribute__((format (printf, 1, 2)));
 void  LogDebug(const char *, ...) __attribute__((format (printf, 1, 2)));
+void  LogEvent(int, const char *, const char *, const char *, const char *, ...) __attribute__((format (printf, 5, 6)));
 void  vLogError(const char *s, va_list ap);
 void  vLogAbortHandler(const char *s, va_list ap);
 void  log_close();
@@ -1178,14 +1616,21 @@ void vsyslog (int, const char *, va_list);
 #endif /* HAVE_SYSLOG */
 #endif /* HAVE_VSYSLOG */
 int   validate();
+unsigned long long validate_nextRecheck();
+unsigned long long validate_nextDue();
+void  validate_recheck();
+void  validate_compileRules(Service_T);
 void  daemonize();
 void  gc();
+void  gc_service_list(Service_T *);
+void  gc_template(Template_T *);
 void  gc_mail_list(Mail_T *);
 void  gccmd(command_t *);
 void  gc_event(Event_T *e);
 boolean_t kill_daemon(int);
 int   exist_daemon();
 boolean_t sendmail(Mail_T);
+void  sendmail_close();
 int   sock_msg(int, char *, ...) __attribute__((format (printf, 2, 3)));
 void  init_env();
 void  monit_http(Httpd_Action);
@@ -1203,14 +1648,30 @@ boolean_t check_remote_host(Service_T);
 boolean_t check_system(Service_T);
 boolean_t check_fifo(Service_T);
 boolean_t check_program(Service_T);
+void check_program_result(Service_T);
 boolean_t check_net(Service_T);
+boolean_t check_cgroup(Service_T);
+boolean_t check_processes(Service_T);
 int  check_URL(Service_T s);
 int  sha_md5_stream (FILE *, void *, void *);
 void reset_procinfo(Service_T);
 int  check_service_status(Service_T);
 void printhash(char *);
 void status_xml(StringBuffer_T, Event_T, Level_Type, int, const char *);
+void status_xml_snapshot(StringBuffer_T, Level_Type, int, const char *);
+void status_xml_event(StringBuffer_T, Event_T, Level_Type, int, const char *);
+unsigned long long status_xml_delta(StringBuffer_T, unsigned long long, const char *);
+unsigned long long status_xml_generation();
+boolean_t status_xml_changed(Service_T, unsigned long long);
+unsigned long long status_xml_watch();
+void status_xml_reset();
+unsigned long long status_json(StringBuffer_T, Event_T, Level_Type, unsigned long long, const char *, void (*)(void *, StringBuffer_T), void *);
+void status_history(StringBuffer_T, Service_T);
+void status_processes(StringBuffer_T, ProcessTree_T *, int, int *, int, int);
 Handler_Type handle_mmonit(Event_T);
+Handler_Type handle_mmonit_relay(const char *, const char *, int);
+void handle_mmonit_replay(Event_T *, int, boolean_t *);
+void handle_mmonit_wait();
 boolean_t  do_wakeupcall();
 
 #endif
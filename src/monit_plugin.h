@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#ifndef MONIT_PLUGIN_ABI_H
+#define MONIT_PLUGIN_ABI_H
+
+
+/**
+ * Check plugin ABI.
+ *
+ * A check plugin is a shared object which Monit loads with dlopen() and
+ * runs in-process, instead of forking a "check program" script every
+ * cycle. The plugin exports a constant monit_plugin_t object named
+ * "monit_plugin" and uses only this header, it doesn't link to Monit:
+ *
+ *    #include <stdio.h>
+ *    #include "monit_plugin.h"
+ *
+ *    static int check(void *context, int timeout, monit_plugin_result_t *result) {
+ *            int depth = queue_depth(); // The plugin's own probe
+ *            monit_plugin_metric(result, "depth", depth);
+ *            snprintf(result->message, sizeof(result->message), "queue depth is %d", depth);
+ *            return depth < 1000 ? 0 : 1;
+ *    }
+ *
+ *    const monit_plugin_t monit_plugin = {
+ *            .abi = MONIT_PLUGIN_ABI,
+ *            .check = check
+ *    };
+ *
+ * Build it with "cc -shared -fPIC -o queue.so queue.c" and use it as:
+ *
+ *    check program queue with plugin "/usr/lib/monit/queue.so arg1 arg2"
+ *          if status != 0 then alert
+ *
+ * The status returned by the check is tested by the status rules the
+ * same way as the exit status of a program and the message is the
+ * program output. The check runs in a helper thread: if it doesn't
+ * return within the timeout the test fails, and the next checks fail
+ * until it returns, as the thread can't be cancelled. The functions of
+ * one plugin instance are never called concurrently, but the instances
+ * of the same plugin in different services may run in parallel.
+ *
+ *  @file
+ */
+
+
+/**
+ * The ABI version, the plugin sets it in monit_plugin_t.abi
+ */
+#define MONIT_PLUGIN_ABI 1
+
+
+/**
+ * The name of the symbol exported by the plugin
+ */
+#define MONIT_PLUGIN_SYMBOL "monit_plugin"
+
+
+#define MONIT_PLUGIN_MESSAGE 1024
+#define MONIT_PLUGIN_METRICS 16
+#define MONIT_PLUGIN_METRIC_NAME 64
+
+
+/** A metric reported by the check */
+typedef struct monit_plugin_metric {
+        char name[MONIT_PLUGIN_METRIC_NAME];                  /**< Metric name */
+        double value;                                        /**< Metric value */
+} monit_plugin_metric_t;
+
+
+/** The result of the check, zeroed by Monit before each call */
+typedef struct monit_plugin_result {
+        char message[MONIT_PLUGIN_MESSAGE];   /**< Output, shown as the program output */
+        int metrics;                                      /**< Number of metrics */
+        monit_plugin_metric_t metric[MONIT_PLUGIN_METRICS];         /**< Metrics */
+} monit_plugin_result_t;
+
+
+/** The plugin interface */
+typedef struct monit_plugin {
+        int abi;                                           /**< MONIT_PLUGIN_ABI */
+        /**
+         * Optional: create the plugin instance of the service
+         * @param argc The number of arguments
+         * @param argv The arguments, argv[0] is the plugin path
+         * @return The instance context passed to check() or NULL on error
+         */
+        void *(*init)(int argc, char **argv);
+        /**
+         * Run the check
+         * @param context The instance context from init() or NULL
+         * @param timeout The timeout in seconds, the plugin should use it
+         * for its own I/O
+         * @param result The result object
+         * @return The check status, 0 if succeeded
+         */
+        int (*check)(void *context, int timeout, monit_plugin_result_t *result);
+        /**
+         * Optional: free the plugin instance
+         * @param context The instance context from init() or NULL
+         */
+        void (*done)(void *context);
+} monit_plugin_t;
+
+
+/**
+ * Add a metric to the result, the metrics over MONIT_PLUGIN_METRICS are
+ * ignored
+ * @param result The result object
+ * @param name The metric name
+ * @param value The metric value
+ */
+static inline void monit_plugin_metric(monit_plugin_result_t *result, const char *name, double value) {
+        if (result->metrics < MONIT_PLUGIN_METRICS) {
+                monit_plugin_metric_t *m = &result->metric[result->metrics++];
+                int i = 0;
+                for (; name[i] && i < MONIT_PLUGIN_METRIC_NAME - 1; i++)
+                        m->name[i] = name[i];
+                m->name[i] = 0;
+                m->value = value;
+        }
+}
+
+
+#endif
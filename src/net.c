@@ -136,8 +136,13 @@
 #include <arpa/inet.h>
 #endif
 
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
 #include "monit.h"
 #include "net.h"
+#include "resolver.h"
 
 // libmonit
 #include "system/Net.h"
@@ -157,6 +162,54 @@
 #define DATALEN 64
 
 
+/* Echo payload used by icmp_echo_batch() to demultiplex replies */
+typedef struct {
+        struct timeval sent;                           /**< Echo request timestamp */
+        uint32_t cookie;                    /**< Batch cookie, rejects stale replies */
+        uint32_t target;                             /**< Index of the batch target */
+        uint32_t echo;                       /**< Echo request number of the target */
+} Echo_T;
+
+
+/* Batch target state */
+typedef struct {
+        int socket;                           /**< Shared raw socket of the family */
+        struct sockaddr_storage addr;                         /**< Target address */
+        socklen_t addrlen;                             /**< Target address length */
+        int count;                          /**< Echo requests to send, see Icmp_T */
+        int sent;                                    /**< Echo requests sent so far */
+        int received;                               /**< Echo replies received so far */
+        boolean_t waiting;                 /**< true if an echo request is pending */
+        struct timeval deadline;          /**< Timeout of the pending echo request */
+} Target_T;
+
+
+/* Long-lived raw sockets shared by all batches, one per address family */
+static int icmp4 = -1;
+#ifdef HAVE_IPV6
+static int icmp6 = -1;
+#endif
+static uint32_t cookie = 0;
+
+
+#define UDP_REQUEST_MAX  64   // The maximum datagram request length, see Datagram_T
+#define UDP_RESPONSE_MAX 4096  // The maximum datagram response length
+#define UDP_RECEIVE_MAX  16    // The number of datagrams received by one call
+
+
+/* UDP batch target state */
+typedef struct {
+        int socket;                         /**< Shared UDP socket of the family */
+        struct sockaddr_storage addr;                         /**< Target address */
+        socklen_t addrlen;                             /**< Target address length */
+        unsigned char request[UDP_REQUEST_MAX];                /**< Request datagram */
+        int length;                                    /**< Request datagram length */
+        boolean_t waiting;                        /**< true if the response is pending */
+        struct timeval sent;                                 /**< Request timestamp */
+        struct timeval deadline;                         /**< Timeout of the request */
+} Probe_T;
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -181,6 +234,424 @@ static unsigned short _checksum(unsigned char *_addr, int count) {
 }
 
 
+/*
+ * Return the shared raw ICMP socket for the given family, the socket is
+ * created on first use and kept open. Returns -1 on error, -2 when monit
+ * has no permissions for raw socket
+ */
+static int _icmpsocket(int family) {
+        int *s = NULL;
+        int ttl = 255;
+        switch (family) {
+                case AF_INET:
+                        s = &icmp4;
+                        if (*s < 0 && (*s = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) >= 0)
+                                setsockopt(*s, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+                        break;
+#ifdef HAVE_IPV6
+                case AF_INET6:
+                        s = &icmp6;
+                        if (*s < 0 && (*s = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) >= 0) {
+                                struct icmp6_filter filter;
+                                ICMP6_FILTER_SETBLOCKALL(&filter);
+                                ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+                                setsockopt(*s, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+                                setsockopt(*s, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
+                                setsockopt(*s, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(struct icmp6_filter));
+                        }
+                        break;
+#endif
+                default:
+                        return -1;
+        }
+        if (*s < 0) {
+                if (errno == EACCES || errno == EPERM) {
+                        DEBUG("Ping -- cannot create socket: %s\n", STRERROR);
+                        return -2;
+                }
+                LogError("Ping -- cannot create socket: %s\n", STRERROR);
+                return -1;
+        }
+        if (! Net_setNonBlocking(*s) || fcntl(*s, F_SETFD, FD_CLOEXEC) == -1) {
+                LogError("Ping -- cannot set socket options: %s\n", STRERROR);
+                close(*s);
+                *s = -1;
+                return -1;
+        }
+        return *s;
+}
+
+
+/*
+ * Resolve the batch target address and bind it to the shared socket of
+ * its family. Sets icmp->response to -1 on error or -2 if monit has no
+ * permissions for raw socket and returns false in that case
+ */
+static boolean_t _icmptarget(const char *hostname, Icmp_T icmp, Target_T *t) {
+        struct addrinfo *result, hints = {
+#ifdef AI_ADDRCONFIG
+                .ai_flags = AI_ADDRCONFIG
+#endif
+        };
+        t->socket = -1;
+        t->count = icmp->backoff.failures ? 1 : icmp->count; // A failing target gets a single recovery probe
+        icmp->response = -1.;
+        switch (icmp->family) {
+                case Socket_Ip:
+                        hints.ai_family = AF_UNSPEC;
+                        break;
+                case Socket_Ip4:
+                        hints.ai_family = AF_INET;
+                        break;
+#ifdef HAVE_IPV6
+                case Socket_Ip6:
+                        hints.ai_family = AF_INET6;
+                        break;
+#endif
+                default:
+                        LogError("Invalid socket family %d\n", icmp->family);
+                        return false;
+        }
+        int status = Resolver_get(hostname, NULL, &hints, &result);
+        if (status) {
+                LogError("Ping for %s -- getaddrinfo failed: %s\n", hostname, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
+                return false;
+        }
+        for (struct addrinfo *r = result; r && t->socket < 0; r = r->ai_next) {
+                int s = _icmpsocket(r->ai_family);
+                if (s >= 0) {
+                        t->socket = s;
+                        t->addrlen = r->ai_addrlen;
+                        memcpy(&t->addr, r->ai_addr, r->ai_addrlen);
+                } else if (s == -2) {
+                        icmp->response = -2.;
+                }
+        }
+        Resolver_free(result);
+        return t->socket >= 0;
+}
+
+
+/*
+ * Send the next echo request to the batch target
+ */
+static void _icmpsend(const char *hostname, Icmp_T icmp, Target_T *t, int index, uint16_t id) {
+        char buf[STRLEN];
+        memset(buf, 0, sizeof(buf));
+        Echo_T echo = {.cookie = cookie, .target = index, .echo = t->sent};
+        gettimeofday(&echo.sent, NULL);
+        int len = 0;
+        switch (t->addr.ss_family) {
+                case AF_INET:
+                        {
+                                struct icmp *out = (struct icmp *)buf;
+                                out->icmp_type = ICMP_ECHO;
+                                out->icmp_id = htons(id);
+                                out->icmp_seq = htons(t->sent);
+                                memcpy(out->icmp_data, &echo, sizeof(echo));
+                                len = offsetof(struct icmp, icmp_data) + DATALEN;
+                                out->icmp_cksum = _checksum((unsigned char *)out, len);
+                        }
+                        break;
+#ifdef HAVE_IPV6
+                case AF_INET6:
+                        {
+                                struct icmp6_hdr *out = (struct icmp6_hdr *)buf;
+                                out->icmp6_type = ICMP6_ECHO_REQUEST;
+                                out->icmp6_id = htons(id);
+                                out->icmp6_seq = htons(t->sent);
+                                memcpy(out + 1, &echo, sizeof(echo));
+                                len = sizeof(struct icmp6_hdr) + DATALEN;
+                        }
+                        break;
+#endif
+                default:
+                        break;
+        }
+        t->sent++;
+        t->deadline.tv_sec = echo.sent.tv_sec + icmp->timeout / 1000;
+        t->deadline.tv_usec = echo.sent.tv_usec + (icmp->timeout % 1000) * 1000;
+        if (t->deadline.tv_usec >= 1000000) {
+                t->deadline.tv_sec++;
+                t->deadline.tv_usec -= 1000000;
+        }
+        ssize_t n;
+        do {
+                n = sendto(t->socket, buf, len, 0, (struct sockaddr *)&t->addr, t->addrlen);
+        } while (n == -1 && errno == EINTR);
+        if (n < 0)
+                LogError("Ping request for %s %d/%d failed -- %s\n", hostname, t->sent, t->count, STRERROR);
+        else
+                t->waiting = true;
+}
+
+
+/*
+ * Read all pending echo replies from the shared socket and match them against
+ * the batch targets by id, cookie, target index, echo number and source address
+ */
+static void _icmpreceive(int s, int count, const char *hostname[], Icmp_T icmp[], Target_T *target, uint16_t id) {
+        char buf[STRLEN];
+        struct sockaddr_storage addr;
+        socklen_t addrlen;
+        ssize_t n;
+        while (true) {
+                addrlen = sizeof(addr);
+                do {
+                        n = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addrlen);
+                } while (n == -1 && errno == EINTR);
+                if (n < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                LogError("Ping response failed -- %s\n", STRERROR);
+                        return;
+                }
+                struct timeval in_time;
+                gettimeofday(&in_time, NULL);
+                Echo_T echo;
+                uint16_t in_id;
+                switch (addr.ss_family) {
+                        case AF_INET:
+                                {
+                                        struct ip *iphdr = (struct ip *)buf;
+                                        if (n < (ssize_t)(sizeof(struct ip) + sizeof(struct icmp)) || n < iphdr->ip_hl * 4 + (ssize_t)(offsetof(struct icmp, icmp_data) + sizeof(Echo_T)))
+                                                continue;
+                                        struct icmp *in = (struct icmp *)(buf + iphdr->ip_hl * 4);
+                                        if (in->icmp_type != ICMP_ECHOREPLY)
+                                                continue;
+                                        in_id = ntohs(in->icmp_id);
+                                        memcpy(&echo, in->icmp_data, sizeof(echo));
+                                }
+                                break;
+#ifdef HAVE_IPV6
+                        case AF_INET6:
+                                {
+                                        if (n < (ssize_t)(sizeof(struct icmp6_hdr) + sizeof(Echo_T)))
+                                                continue;
+                                        struct icmp6_hdr *in = (struct icmp6_hdr *)buf;
+                                        if (in->icmp6_type != ICMP6_ECHO_REPLY)
+                                                continue;
+                                        in_id = ntohs(in->icmp6_id);
+                                        memcpy(&echo, in + 1, sizeof(echo));
+                                }
+                                break;
+#endif
+                        default:
+                                continue;
+                }
+                /* Raw sockets receive all ICMP replies, skip responses belonging to other conversations or previous batches */
+                if (in_id != id || echo.cookie != cookie || echo.target >= (uint32_t)count)
+                        continue;
+                Target_T *t = &target[echo.target];
+                if (! t->waiting || echo.echo != (uint32_t)(t->sent - 1) || addr.ss_family != t->addr.ss_family)
+                        continue;
+                if (addr.ss_family == AF_INET && memcmp(&((struct sockaddr_in *)&addr)->sin_addr, &((struct sockaddr_in *)&t->addr)->sin_addr, sizeof(struct in_addr)))
+                        continue;
+#ifdef HAVE_IPV6
+                if (addr.ss_family == AF_INET6 && memcmp(&((struct sockaddr_in6 *)&addr)->sin6_addr, &((struct sockaddr_in6 *)&t->addr)->sin6_addr, sizeof(struct in6_addr)))
+                        continue;
+#endif
+                t->waiting = false;
+                t->received++;
+                t->sent = t->count; // Wait for one response only
+                icmp[echo.target]->response = (double)(in_time.tv_sec - echo.sent.tv_sec) + (double)(in_time.tv_usec - echo.sent.tv_usec) / 1000000;
+                DEBUG("Ping response for %s %d/%d succeeded -- received id=%d sequence=%d response_time=%fs\n", hostname[echo.target], echo.echo + 1, t->count, in_id, echo.echo, icmp[echo.target]->response);
+        }
+}
+
+
+/*
+ * Resolve the target address, create the shared socket of the family if
+ * needed and build the request datagram
+ */
+static boolean_t _udptarget(Port_T p, Probe_T *t, int *udp4, int *udp6, unsigned id) {
+        char port[STRLEN];
+        struct addrinfo *result, hints = {
+#ifdef AI_ADDRCONFIG
+                .ai_flags = AI_ADDRCONFIG,
+#endif
+                .ai_socktype = SOCK_DGRAM,
+                .ai_protocol = IPPROTO_UDP
+        };
+        t->socket = -1;
+        switch (p->family) {
+                case Socket_Ip:
+                        hints.ai_family = AF_UNSPEC;
+                        break;
+                case Socket_Ip4:
+                        hints.ai_family = AF_INET;
+                        break;
+#ifdef HAVE_IPV6
+                case Socket_Ip6:
+                        hints.ai_family = AF_INET6;
+                        break;
+#endif
+                default:
+                        p->batch_error = Str_cat("Invalid socket family %d", p->family);
+                        return false;
+        }
+        snprintf(port, sizeof(port), "%d", p->port);
+        int status = Resolver_get(p->hostname, port, &hints, &result);
+        if (status) {
+                p->batch_error = Str_cat("Cannot resolve [%s]:%d -- %s", p->hostname, p->port, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
+                return false;
+        }
+        for (struct addrinfo *r = result; r && t->socket < 0; r = r->ai_next) {
+                int *s = r->ai_family == AF_INET ? udp4 : r->ai_family == AF_INET6 ? udp6 : NULL;
+                if (! s)
+                        continue;
+                if (*s < 0 && (*s = socket(r->ai_family, SOCK_DGRAM, IPPROTO_UDP)) >= 0) {
+                        fcntl(*s, F_SETFD, FD_CLOEXEC);
+                        fcntl(*s, F_SETFL, fcntl(*s, F_GETFL) | O_NONBLOCK);
+                }
+                if (*s >= 0) {
+                        t->socket = *s;
+                        t->addrlen = r->ai_addrlen;
+                        memcpy(&t->addr, r->ai_addr, r->ai_addrlen);
+                }
+        }
+        Resolver_free(result);
+        if (t->socket < 0) {
+                p->batch_error = Str_cat("Cannot create UDP socket for [%s]:%d -- %s", p->hostname, p->port, STRERROR);
+                return false;
+        }
+        t->length = p->protocol->datagram->request(p, t->request, UDP_REQUEST_MAX, id);
+        return true;
+}
+
+
+/*
+ * Send the requests of all targets using the socket
+ */
+static void _udpsend(int s, int count, Port_T port[], Probe_T *target) {
+        int *index = CALLOC(count, sizeof(int));
+        int n = 0;
+        for (int i = 0; i < count; i++)
+                if (target[i].socket == s && ! port[i]->batch_error)
+                        index[n++] = i;
+        for (int sent = 0; sent < n;) {
+                int rv;
+                struct timeval now;
+                gettimeofday(&now, NULL);
+#ifdef HAVE_SENDMMSG
+                struct iovec iov[n - sent];
+                struct mmsghdr msg[n - sent];
+                memset(msg, 0, sizeof(msg));
+                for (int i = 0; i < n - sent; i++) {
+                        Probe_T *t = &target[index[sent + i]];
+                        iov[i] = (struct iovec){.iov_base = t->request, .iov_len = t->length};
+                        msg[i].msg_hdr = (struct msghdr){.msg_name = &t->addr, .msg_namelen = t->addrlen, .msg_iov = &iov[i], .msg_iovlen = 1};
+                }
+                do {
+                        rv = sendmmsg(s, msg, n - sent, 0);
+                } while (rv < 0 && errno == EINTR);
+#else
+                Probe_T *t = &target[index[sent]];
+                do {
+                        rv = (int)sendto(s, t->request, t->length, 0, (struct sockaddr *)&t->addr, t->addrlen) < 0 ? -1 : 1;
+                } while (rv < 0 && errno == EINTR);
+#endif
+                if (rv <= 0) {
+                        // The first unsent request failed, skip it
+                        Port_T p = port[index[sent++]];
+                        p->batch_error = Str_cat("%s: error sending request -- %s", p->protocol->name, STRERROR);
+                        continue;
+                }
+                for (int i = 0; i < rv; i++, sent++) {
+                        Probe_T *t = &target[index[sent]];
+                        Port_T p = port[index[sent]];
+                        t->sent = now;
+                        t->deadline.tv_sec = now.tv_sec + p->timeout / 1000;
+                        t->deadline.tv_usec = now.tv_usec + (p->timeout % 1000) * 1000;
+                        if (t->deadline.tv_usec >= 1000000) {
+                                t->deadline.tv_sec++;
+                                t->deadline.tv_usec -= 1000000;
+                        }
+                        t->waiting = true;
+                }
+        }
+        FREE(index);
+}
+
+
+static boolean_t _udpaddress(const struct sockaddr *a, const struct sockaddr *b) {
+        if (a->sa_family != b->sa_family)
+                return false;
+        if (a->sa_family == AF_INET)
+                return ((struct sockaddr_in *)a)->sin_port == ((struct sockaddr_in *)b)->sin_port && ((struct sockaddr_in *)a)->sin_addr.s_addr == ((struct sockaddr_in *)b)->sin_addr.s_addr;
+#ifdef HAVE_IPV6
+        if (a->sa_family == AF_INET6)
+                return ((struct sockaddr_in6 *)a)->sin6_port == ((struct sockaddr_in6 *)b)->sin6_port && ! memcmp(&((struct sockaddr_in6 *)a)->sin6_addr, &((struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+#endif
+        return false;
+}
+
+
+/*
+ * Match the response to the pending request of the same address and verify it
+ */
+static void _udpresponse(int s, int count, Port_T port[], Probe_T *target, struct sockaddr *from, unsigned char *response, int length) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        for (int i = 0; i < count; i++) {
+                Probe_T *t = &target[i];
+                Port_T p = port[i];
+                if (t->waiting && t->socket == s && _udpaddress(from, (struct sockaddr *)&t->addr) && p->protocol->datagram->match(t->request, t->length, response, length)) {
+                        t->waiting = false;
+                        TRY
+                        {
+                                p->protocol->datagram->verify(p, t->request, t->length, response, length);
+                                p->is_available = true;
+                                p->response = (now.tv_sec - t->sent.tv_sec) + (now.tv_usec - t->sent.tv_usec) / 1000000.;
+                        }
+                        ELSE
+                        {
+                                p->batch_error = Str_dup(Exception_frame.message);
+                        }
+                        END_TRY;
+                        return;
+                }
+        }
+        // A late response of a previous batch or of a test which timed out
+}
+
+
+/*
+ * Receive all queued responses from the socket
+ */
+static void _udpreceive(int s, int count, Port_T port[], Probe_T *target) {
+        unsigned char (*buffer)[UDP_RESPONSE_MAX + 1] = CALLOC(UDP_RECEIVE_MAX, UDP_RESPONSE_MAX + 1);
+        struct sockaddr_storage from[UDP_RECEIVE_MAX];
+        while (true) {
+                int n = 0;
+#ifdef HAVE_RECVMMSG
+                struct iovec iov[UDP_RECEIVE_MAX];
+                struct mmsghdr msg[UDP_RECEIVE_MAX];
+                memset(msg, 0, sizeof(msg));
+                for (int i = 0; i < UDP_RECEIVE_MAX; i++) {
+                        iov[i] = (struct iovec){.iov_base = buffer[i], .iov_len = UDP_RESPONSE_MAX};
+                        msg[i].msg_hdr = (struct msghdr){.msg_name = &from[i], .msg_namelen = sizeof(from[i]), .msg_iov = &iov[i], .msg_iovlen = 1};
+                }
+                do {
+                        n = recvmmsg(s, msg, UDP_RECEIVE_MAX, MSG_DONTWAIT, NULL);
+                } while (n < 0 && errno == EINTR);
+                for (int i = 0; i < n; i++)
+                        _udpresponse(s, count, port, target, (struct sockaddr *)&from[i], buffer[i], msg[i].msg_len);
+#else
+                socklen_t fromlen = sizeof(from[0]);
+                ssize_t length;
+                do {
+                        length = recvfrom(s, buffer[0], UDP_RESPONSE_MAX, MSG_DONTWAIT, (struct sockaddr *)&from[0], &fromlen);
+                } while (length < 0 && errno == EINTR);
+                if (length >= 0) {
+                        n = 1;
+                        _udpresponse(s, count, port, target, (struct sockaddr *)&from[0], buffer[0], (int)length);
+                }
+#endif
+                if (n < UDP_RECEIVE_MAX) // The queue is drained or an error occured (ICMP errors of unconnected sockets are ignored)
+                        break;
+        }
+        FREE(buffer);
+}
 
 
 /* ------------------------------------------------------------------ Public */
@@ -326,7 +797,7 @@ double icmp_echo(const char *hostname, Socket_Family family, int timeout, int co
         ICMP6_FILTER_SETBLOCKALL(&filter);
         ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
 #endif
-        int status = getaddrinfo(hostname, NULL, &hints, &result);
+        int status = Resolver_get(hostname, NULL, &hints, &result);
         if (status) {
                 LogError("Ping for %s -- getaddrinfo failed: %s\n", hostname, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
                 return response;
@@ -494,7 +965,147 @@ error1:
         if (rv == -1)
                 LogError("Socket %d close failed -- %s\n", s, STRERROR);
 error2:
-        freeaddrinfo(result);
+        Resolver_free(result);
         return response;
 }
 
+
+
+/*
+ * Ping all targets concurrently using the shared raw sockets. Every target
+ * behaves as with icmp_echo(): the next echo request is sent as soon as the
+ * previous one was answered or timed out, but the conversations of all
+ * targets are interleaved, so the batch takes as long as the slowest target.
+ * Replies are demultiplexed by the echo id and the payload which carries the
+ * batch cookie, the target index and the echo request number.
+ * @param count The number of targets
+ * @param hostname The hosts to ping
+ * @param icmp The ICMP tests, the response is set as returned by icmp_echo()
+ */
+void icmp_echo_batch(int count, const char *hostname[], Icmp_T icmp[]) {
+        ASSERT(hostname);
+        ASSERT(icmp);
+        uint16_t id = ~getpid() & 0xFFFF; // differ from icmp_echo() which may run concurrently in a worker thread
+        Target_T *target = CALLOC(count, sizeof(Target_T));
+        cookie++;
+        int pending = 0;
+        for (int i = 0; i < count; i++) {
+                if (_icmptarget(hostname[i], icmp[i], &target[i]))
+                        pending++;
+                else
+                        target[i].sent = target[i].count;
+        }
+        while (pending) {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                long wait = -1;
+                pending = 0;
+                for (int i = 0; i < count; i++) {
+                        Target_T *t = &target[i];
+                        if (t->waiting && timercmp(&now, &t->deadline, >=)) {
+                                t->waiting = false;
+                                LogError("Ping response for %s %d/%d timed out -- no response within %d seconds\n", hostname[i], t->sent, t->count, icmp[i]->timeout / 1000);
+                        }
+                        if (! t->waiting && t->sent < t->count)
+                                _icmpsend(hostname[i], icmp[i], t, i, id);
+                        if (t->waiting) {
+                                long left = (t->deadline.tv_sec - now.tv_sec) * 1000 + (t->deadline.tv_usec - now.tv_usec) / 1000 + 1;
+                                if (wait < 0 || left < wait)
+                                        wait = left;
+                                pending++;
+                        }
+                }
+                if (! pending)
+                        break;
+                struct pollfd fds[2];
+                int nfds = 0;
+                if (icmp4 >= 0)
+                        fds[nfds++] = (struct pollfd){.fd = icmp4, .events = POLLIN};
+#ifdef HAVE_IPV6
+                if (icmp6 >= 0)
+                        fds[nfds++] = (struct pollfd){.fd = icmp6, .events = POLLIN};
+#endif
+                int n = poll(fds, nfds, (int)wait);
+                if (n < 0 && errno != EINTR) {
+                        LogError("Ping -- poll failed: %s\n", STRERROR);
+                        break;
+                }
+                for (int i = 0; i < nfds && n > 0; i++)
+                        if (fds[i].revents & POLLIN)
+                                _icmpreceive(fds[i].fd, count, hostname, icmp, target, id);
+        }
+        for (int i = 0; i < count; i++)
+                if (target[i].socket >= 0 && ! target[i].received)
+                        icmp[i]->response = -1.;
+        FREE(target);
+}
+
+
+/*
+ * Probe all UDP ports at once. The targets of one address family share one
+ * UDP socket, all requests are sent with one sendmmsg() call and the
+ * responses are received with recvmmsg() and matched to the requests by the
+ * source address and the protocol transaction id. Every target times out
+ * after its own timeout, so the batch takes as long as the slowest target.
+ * @param count The number of targets
+ * @param port The UDP port tests, the protocol must support the datagram
+ * functions. The result is stored in is_available, response and batch_error
+ */
+void udp_probe_batch(int count, Port_T port[]) {
+        ASSERT(port);
+        int udp4 = -1, udp6 = -1;
+        Probe_T *target = CALLOC(count, sizeof(Probe_T));
+        unsigned id = (unsigned)random();
+        for (int i = 0; i < count; i++) {
+                port[i]->is_available = false;
+                port[i]->response = -1.;
+                port[i]->handshake = -1.;
+                port[i]->rtt = -1.;
+                _udptarget(port[i], &target[i], &udp4, &udp6, id + i);
+        }
+        if (udp4 >= 0)
+                _udpsend(udp4, count, port, target);
+        if (udp6 >= 0)
+                _udpsend(udp6, count, port, target);
+        while (true) {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                long wait = -1;
+                for (int i = 0; i < count; i++) {
+                        Probe_T *t = &target[i];
+                        if (t->waiting && timercmp(&now, &t->deadline, >=)) {
+                                t->waiting = false;
+                                port[i]->batch_error = Str_cat("%s: no response within %.1f seconds", port[i]->protocol->name, port[i]->timeout / 1000.);
+                        }
+                        if (t->waiting) {
+                                long left = (t->deadline.tv_sec - now.tv_sec) * 1000 + (t->deadline.tv_usec - now.tv_usec) / 1000 + 1;
+                                if (wait < 0 || left < wait)
+                                        wait = left;
+                        }
+                }
+                if (wait < 0)
+                        break;
+                struct pollfd fds[2];
+                int nfds = 0;
+                if (udp4 >= 0)
+                        fds[nfds++] = (struct pollfd){.fd = udp4, .events = POLLIN};
+                if (udp6 >= 0)
+                        fds[nfds++] = (struct pollfd){.fd = udp6, .events = POLLIN};
+                int n = poll(fds, nfds, (int)wait);
+                if (n < 0 && errno != EINTR) {
+                        LogError("UDP probe -- poll failed: %s\n", STRERROR);
+                        break;
+                }
+                for (int i = 0; i < nfds && n > 0; i++)
+                        if (fds[i].revents & POLLIN)
+                                _udpreceive(fds[i].fd, count, port, target);
+        }
+        for (int i = 0; i < count; i++)
+                if (! port[i]->is_available && ! port[i]->batch_error)
+                        port[i]->batch_error = Str_cat("%s: no response", port[i]->protocol->name);
+        if (udp4 >= 0)
+                close(udp4);
+        if (udp6 >= 0)
+                close(udp6);
+        FREE(target);
+}
@@ -88,4 +88,31 @@ int create_server_socket_unix(const char *path, int backlog);
  */
 double icmp_echo(const char *hostname, Socket_Family family, int timeout, int count);
 
+
+/**
+ * Ping several hosts at once using long-lived raw sockets shared by all
+ * targets, one per address family. The echo requests of all targets are
+ * interleaved and the replies demultiplexed, so the batch takes as long as
+ * the slowest target instead of the sum of all targets.
+ * @param count The number of targets
+ * @param hostname The hosts to ping
+ * @param icmp The ICMP echo tests of the hosts. The family, timeout and count
+ * are used as in icmp_echo() and the response is set as icmp_echo() returns it
+ */
+void icmp_echo_batch(int count, const char *hostname[], Icmp_T icmp[]);
+
+
+/**
+ * Probe several UDP ports (DNS, NTP3 and RADIUS protocols) at once. The
+ * requests of all targets are sent in one batch over the sockets shared by
+ * all targets of the same address family and the responses are matched to
+ * the requests by the protocol transaction id, so the batch takes as long
+ * as the slowest target instead of the sum of all targets.
+ * @param count The number of targets
+ * @param port The UDP port tests, the protocol must provide the datagram
+ * functions. Each target uses its own timeout. The result is stored in the
+ * is_available and response fields and the error in batch_error
+ */
+void udp_probe_batch(int count, Port_T port[]);
+
 #endif
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "output.h"
+
+
+/**
+ *  Output writer shared by the status documents.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+/* The JSON string escape of the character, 'u' = \u00XX, 0 = no escape */
+static const char escapes[256] = {
+        'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+        'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+        ['"'] = '"', ['\\'] = '\\', [0x7f] = 'u'
+};
+
+
+/* The two digit pairs 00-99, so the integer is formatted two digits per division */
+static const char digits[201] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static void _run(StringBuffer_T B, const char *start, const char *end) {
+        if (end > start)
+                StringBuffer_append(B, "%.*s", (int)(end - start), start);
+}
+
+
+static void _html(StringBuffer_T B, const char *s) {
+        for (;;) {
+                size_t n = strcspn(s, "<>&");
+                _run(B, s, s + n);
+                switch (s[n]) {
+                        case '<':
+                                StringBuffer_append(B, "&lt;");
+                                break;
+                        case '>':
+                                StringBuffer_append(B, "&gt;");
+                                break;
+                        case '&':
+                                StringBuffer_append(B, "&amp;");
+                                break;
+                        default:
+                                return;
+                }
+                s += n + 1;
+        }
+}
+
+
+static void _cdata(StringBuffer_T B, const char *s) {
+        for (const char *end; (end = strstr(s, "]]>")); s = end + 3) {
+                _run(B, s, end);
+                StringBuffer_append(B, "]]&gt;");
+        }
+        if (*s)
+                StringBuffer_append(B, "%s", s);
+}
+
+
+static void _json(StringBuffer_T B, const char *s) {
+        const unsigned char *start = (const unsigned char *)s, *p;
+        for (p = start; *p; p++) {
+                char escape = escapes[*p];
+                if (escape) {
+                        _run(B, (const char *)start, (const char *)p);
+                        if (escape == 'u')
+                                StringBuffer_append(B, "\\u%04x", *p);
+                        else
+                                StringBuffer_append(B, "\\%c", escape);
+                        start = p + 1;
+                }
+        }
+        _run(B, (const char *)start, (const char *)p);
+}
+
+
+static void _label(StringBuffer_T B, const char *s) {
+        for (;;) {
+                size_t n = strcspn(s, "\\\"\n");
+                _run(B, s, s + n);
+                switch (s[n]) {
+                        case '\\':
+                                StringBuffer_append(B, "\\\\");
+                                break;
+                        case '"':
+                                StringBuffer_append(B, "\\\"");
+                                break;
+                        case '\n':
+                                StringBuffer_append(B, "\\n");
+                                break;
+                        default:
+                                return;
+                }
+                s += n + 1;
+        }
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void Output_escape(StringBuffer_T B, const char *s, Output_Type type) {
+        ASSERT(B);
+        if (! s)
+                return;
+        switch (type) {
+                case Output_Html:
+                        _html(B, s);
+                        break;
+                case Output_Cdata:
+                        _cdata(B, s);
+                        break;
+                case Output_Json:
+                        _json(B, s);
+                        break;
+                case Output_Label:
+                        _label(B, s);
+                        break;
+        }
+}
+
+
+char *Output_integer(long long n, char buf[OUTPUT_INTEGER_SIZE]) {
+        char *p = buf + OUTPUT_INTEGER_SIZE - 1;
+        /* The magnitude is computed unsigned, so LLONG_MIN doesn't overflow */
+        unsigned long long u = n < 0 ? -(unsigned long long)n : (unsigned long long)n;
+        *p = 0;
+        while (u >= 100) {
+                unsigned i = (unsigned)(u % 100) * 2;
+                u /= 100;
+                *--p = digits[i + 1];
+                *--p = digits[i];
+        }
+        if (u >= 10) {
+                *--p = digits[u * 2 + 1];
+                *--p = digits[u * 2];
+        } else {
+                *--p = '0' + (char)u;
+        }
+        if (n < 0)
+                *--p = '-';
+        return p;
+}
+
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_OUTPUT_H
+#define MONIT_OUTPUT_H
+
+
+/**
+ * The output writer shared by the XML, HTML, JSON and metrics text status
+ * documents.
+ *
+ * The escaping functions find the next character which needs the escape
+ * in bulk (using the libc string scanning routines or a lookup table) and
+ * append the clean runs between them at once, instead of appending the
+ * string character by character.
+ * Output_integer() formats the integers without printf for the loops
+ * which print many numbers.
+ *
+ *  @file
+ */
+
+
+/** The size of the buffer for Output_integer(): the sign, 19 digits and the terminating NUL */
+#define OUTPUT_INTEGER_SIZE 21
+
+
+typedef enum {
+        Output_Html = 0,                                    /**< Escape <, > and & */
+        Output_Cdata,              /**< Escape the CDATA section end ]]> as ]]&gt; */
+        Output_Json,                   /**< Escape the JSON string, without quotes */
+        Output_Label        /**< Escape the \, " and line feed of the metric label */
+} __attribute__((__packed__)) Output_Type;
+
+
+/**
+ * Append the escaped string
+ * @param B Output StringBuffer object
+ * @param s The string to escape, NULL is printed as an empty string
+ * @param type The escape type
+ */
+void Output_escape(StringBuffer_T B, const char *s, Output_Type type);
+
+
+/**
+ * Format the integer as a decimal number
+ * @param n The number
+ * @param buf The buffer of OUTPUT_INTEGER_SIZE bytes
+ * @return The number string, which is stored at the end of buf
+ */
+char *Output_integer(long long n, char buf[OUTPUT_INTEGER_SIZE]);
+
+
+#endif
+
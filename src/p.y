@@ -120,6 +120,13 @@
 #include "alert.h"
 #include "process.h"
 #include "device.h"
+#include "md5.h"
+#include "cgroup.h"
+#include "history.h"
+#include "merkle.h"
+#include "sampler.h"
+#include "plugin.h"
+#include "cron.h"
 
 // libmonit
 #include "io/File.h"
@@ -145,6 +152,8 @@ void  yyerror(const char *,...);
 void  yyerror2(const char *,...);
 void  yywarning(const char *,...);
 void  yywarning2(const char *,...);
+void  yydigest(const char *, int, boolean_t);
+void  yystatement(const char *, int, boolean_t);
 
 /* lexer interface */
 int yylex(void);
@@ -166,6 +175,7 @@ static command_t command = NULL;
 static command_t command1 = NULL;
 static command_t command2 = NULL;
 static Service_T depend_list = NULL;
+static Template_T templatelist = NULL;
 static struct myuid uidset;
 static struct mygid gidset;
 static struct mypid pidset;
@@ -187,6 +197,7 @@ static struct myport portset;
 static struct mymailserver mailserverset;
 static struct myfilesystem filesystemset;
 static struct myresource resourceset;
+static char **fstypeset = NULL;
 static struct mychecksum checksumset;
 static struct mytimestamp timestampset;
 static struct myactionrate actionrateset;
@@ -196,20 +207,44 @@ static struct myrate rate2 = {1, 1};
 static char * htpasswd_file = NULL;
 static Digest_Type digesttype = Digest_Cleartext;
 
-#define BITMAP_MAX (sizeof(long long) * 8)
+/* The control file fingerprints, see yydigest() */
+typedef enum {
+        Statement_Global = 0,
+        Statement_Httpd,
+        Statement_Mmonit,
+        Statement_Service
+} __attribute__((__packed__)) Statement_Type;
+
+static struct {
+        Statement_Type type;                   /**< The current statement type */
+        boolean_t set;                 /**< The last token was the set keyword */
+        md5_context_t statement;         /**< The current statement tokens */
+        md5_context_t previous; /**< The current statement before the last token */
+        md5_context_t section[Statement_Service]; /**< The global, httpd and mmonit statements */
+} digest;
+
+#define BITMAP_MAX 65535 // The event state map window limit (Action_T cycles)
+// Link the rules to the end of the rule list
+#define APPENDRULES(type, list, rules) do { type *_l = &(list); while (*_l) _l = &(*_l)->next; *_l = (rules); } while (0)
 
 
 /* -------------------------------------------------------------- Prototypes */
 
 static void  preparse();
 static void  postparse();
+static void  finishstatement(md5_context_t *);
 static void  addmail(char *, Mail_T, Mail_T *);
 static Service_T createservice(Service_Type, char *, char *, boolean_t (*)(Service_T));
 static void  addservice(Service_T);
+static void  createtemplate(char *);
+static void  usetemplate(char *);
+static boolean_t istemplate(Service_T);
+static void  releasetemplates();
 static void  adddependant(char *);
 static void  addservicegroup(char *);
 static void  addport(Port_T *, Port_T);
 static void  addresource(Resource_T);
+static void  setaverage(int, int, int, float, int);
 static void  addtimestamp(Timestamp_T, boolean_t);
 static void  addactionrate(ActionRate_T);
 static void  addsize(Size_T);
@@ -218,6 +253,10 @@ static void  addpid(Pid_T);
 static void  addppid(Pid_T);
 static void  addfsflag(Fsflag_T);
 static void  addnonexist(Nonexist_T);
+static void  addcgroup(char *);
+static void  addinstances(int);
+static void  addcron(char *);
+static void  addfstype(char *);
 static void  addlinkstatus(Service_T, LinkStatus_T);
 static void  addlinkspeed(Service_T, LinkSpeed_T);
 static void  addlinksaturation(Service_T, LinkSaturation_T);
@@ -227,7 +266,8 @@ static void  addicmp(Icmp_T);
 static void  addgeneric(Port_T, char*, char*);
 static void  addcommand(int, unsigned);
 static void  addargument(char *);
-static void  addmmonit(URL_T, int, Ssl_Version, char *);
+static void  addmmonit(URL_T, int, Ssl_Version, char *, boolean_t);
+static void  addpeer(URL_T);
 static void  addmailserver(MailServer_T);
 static boolean_t addcredentials(char *, char *, Digest_Type, boolean_t);
 #ifdef HAVE_LIBPAM
@@ -281,6 +321,7 @@ static int   cleanup_hash_string(char *);
 static void  check_depend();
 static void  setsyslog(char *);
 static command_t copycommand(command_t);
+static command_t arenacommand(command_t);
 static int verifyMaxForward(int);
 
 %}
@@ -297,27 +338,36 @@ static int verifyMaxForward(int);
 %token READONLY CLEARTEXT MD5HASH SHA1HASH CRYPT DELAY
 %token PEMFILE ENABLE DISABLE HTTPDSSL CLIENTPEMFILE ALLOWSELFCERTIFICATION
 %token INTERFACE LINK PACKET ERROR BYTEIN BYTEOUT PACKETIN PACKETOUT SPEED SATURATION UPLOAD DOWNLOAD TOTAL
-%token IDFILE STATEFILE SEND EXPECT EXPECTBUFFER CYCLE COUNT REMINDER
+%token IDFILE STATEFILE HISTORYFILE STATUSFILE SEND EXPECT EXPECTBUFFER SOCKETBUFFER CYCLE COUNT REMINDER
+%token SCHEDULER WORKERS PROCESSWORKERS PROCESSEVENTS FILEEVENTS NETWORKEVENTS RELAY POWERSAVE DEPENDSUPPRESS CLUSTER REPLICAS DNSCACHE MAXAGE DELTA JITTER PARALLEL REPLAY BATCH FIRSTSUCCESS ALLSUCCESS FULL BUFFER SYNC MAXCONNECTIONS
+%token CONTENTBUDGET SKIPBEHIND JSONFORMAT SESSIONCACHE SESSIONTICKETS SPAWNLIMIT
+%token PROGRAMEVENTS MAXRUNNING CONTROLWORKERS RESTARTLIMIT MAXCPU MAXNODECPU
 %token PIDFILE START STOP PATHTOK
 %token HOST HOSTNAME PORT IPV4 IPV6 TYPE UDP TCP TCPSSL PROTOCOL CONNECTION
 %token ALERT NOALERT MAILFORMAT UNIXSOCKET SIGNATURE
-%token TIMEOUT RETRY RESTART CHECKSUM EVERY NOTEVERY
+%token TIMEOUT RETRY RECHECK RESTART CHECKSUM TREE EVERY NOTEVERY
 %token DEFAULT HTTP HTTPS APACHESTATUS FTP SMTP SMTPS POP POPS IMAP IMAPS CLAMAV NNTP NTP3 MYSQL DNS WEBSOCKET
 %token SSH DWP LDAP2 LDAP3 RDATE RSYNC TNS PGSQL POSTFIXPOLICY SIP LMTP GPS RADIUS MEMCACHE REDIS MONGODB SIEVE
+%token GRPC GRPCS
+%token KEEPALIVE
 %token <string> STRING PATH MAILADDR MAILFROM MAILREPLYTO MAILSUBJECT
 %token <string> MAILBODY SERVICENAME STRINGNAME
 %token <number> NUMBER PERCENT LOGLIMIT CLOSELIMIT DNSLIMIT KEEPALIVELIMIT
 %token <number> REPLYLIMIT REQUESTLIMIT STARTLIMIT WAITLIMIT GRACEFULLIMIT
 %token <number> CLEANUPLIMIT
 %token <real> REAL
-%token CHECKPROC CHECKFILESYS CHECKFILE CHECKDIR CHECKHOST CHECKSYSTEM CHECKFIFO CHECKPROGRAM CHECKNET
+%token CHECKPROC CHECKFILESYS CHECKFILE CHECKDIR CHECKHOST CHECKSYSTEM CHECKFIFO CHECKPROGRAM CHECKNET CHECKCGROUP CHECKPROCESSES
+%token TEMPLATE USETEMPLATE
 %token CHILDREN SYSTEM STATUS ORIGIN VERSIONOPT
+%token TASKS READ WRITE CGROUPTOTAL FILEDESCRIPTORS
+%token MONITCPU MONITMEMORY MONITFILEDESCRIPTORS
+%token AVG RATE PERMINUTE PERHOUR PERDAY
 %token RESOURCE MEMORY TOTALMEMORY LOADAVG1 LOADAVG5 LOADAVG15 SWAP
 %token MODE ACTIVE PASSIVE MANUAL CPU TOTALCPU CPUUSER CPUSYSTEM CPUWAIT
 %token GROUP REQUEST DEPENDS BASEDIR SLOT EVENTQUEUE SECRET HOSTHEADER
-%token UID EUID GID MMONIT INSTANCE USERNAME PASSWORD
+%token UID EUID GID MMONIT INSTANCE INSTANCES EXCLUDING USERNAME PASSWORD
 %token TIMESTAMP CHANGED SECOND MINUTE HOUR DAY MONTH
-%token SSLAUTO SSLV2 SSLV3 TLSV1 TLSV11 TLSV12 CERTMD5
+%token SSLAUTO SSLV2 SSLV3 TLSV1 TLSV11 TLSV12 CERTMD5 CERTIFICATE VALID RESET SAMPLED PLUGIN
 %token BYTE KILOBYTE MEGABYTE GIGABYTE
 %token INODE SPACE TFREE PERMISSION SIZE MATCH NOT IGNORE ACTION UPTIME
 %token EXEC UNMONITOR PING PING4 PING6 ICMP ICMPECHO NONEXIST EXIST INVALID DATA RECOVERED PASSED SUCCEEDED
@@ -351,7 +401,23 @@ statement       : setalert
                 | setpid
                 | setidfile
                 | setstatefile
+                | sethistoryfile
+                | setstatusfile
                 | setexpectbuffer
+                | setsocketbuffer
+                | setscheduler
+                | setcontrol
+                | setspawnlimit
+                | setprocessworkers
+                | setprocessevents
+                | setprogramevents
+                | setfileevents
+                | setnetworkevents
+                | setrelay
+                | setpowersave
+                | setdependsuppress
+                | setcluster
+                | setdnscache
                 | setinit
                 | setfips
                 | checkproc optproclist
@@ -363,6 +429,9 @@ statement       : setalert
                 | checkfifo optfifolist
                 | checkprogram optstatuslist
                 | checknet optnetlist
+                | checkcgroup optcgrouplist
+                | checkprocesses optprocesseslist
+                | template opttemplatelist
                 ;
 
 optproclist     : /* EMPTY */
@@ -388,6 +457,24 @@ optproc         : start
                 | group
                 | depend
                 | resourceprocess
+                | cgrouptotal
+                | instances
+                | usetemplate
+                ;
+
+opttemplatelist : /* EMPTY */
+                | opttemplatelist opttemplate
+                ;
+
+opttemplate     : exist
+                | pid
+                | ppid
+                | uid
+                | euid
+                | gid
+                | uptime
+                | actionrate
+                | resourceprocess
                 ;
 
 optfilelist      : /* EMPTY */
@@ -408,6 +495,8 @@ optfile         : start
                 | checksum
                 | size
                 | match
+                | matchbudget
+                | instances
                 | mode
                 | group
                 | depend
@@ -432,6 +521,7 @@ optfilesys      : start
                 | inode
                 | space
                 | fsflag
+                | instances
                 ;
 
 optdirlist      : /* EMPTY */
@@ -449,6 +539,7 @@ optdir          : start
                 | permission
                 | uid
                 | gid
+                | treechecksum
                 | mode
                 | group
                 | depend
@@ -490,6 +581,33 @@ optnet          : start
                 | depend
                 ;
 
+optcgrouplist   : /* EMPTY */
+                | optcgrouplist optcgroup
+                ;
+
+optcgroup       : start
+                | stop
+                | restart
+                | actionrate
+                | alert
+                | every
+                | group
+                | depend
+                | resourcecgroup
+                ;
+
+optprocesseslist : /* EMPTY */
+                 | optprocesseslist optprocesses
+                 ;
+
+optprocesses    : actionrate
+                | alert
+                | every
+                | group
+                | depend
+                | resourceprocesses
+                ;
+
 optsystemlist   : /* EMPTY */
                 | optsystemlist optsystem
                 ;
@@ -574,6 +692,117 @@ setexpectbuffer : SET EXPECTBUFFER NUMBER unit {
                   }
                 ;
 
+setsocketbuffer : SET SOCKETBUFFER NUMBER unit {
+                    Run.socketbuffer = $3 * $<number>4;
+                    if (Run.socketbuffer < Unit_Kilobyte || Run.socketbuffer > SOCKET_BUFFER_MAX)
+                        yyerror("The socket buffer must be between 1 KB and 1 MB");
+                  }
+                ;
+
+setscheduler    : SET SCHEDULER WORKERS NUMBER {
+                    Run.scheduler_workers = $4;
+                    if (Run.scheduler_workers > SCHEDULER_WORKERS_MAX)
+                        yyerror("Maximum number of scheduler workers is %d", SCHEDULER_WORKERS_MAX);
+                  }
+                ;
+
+setcontrol      : SET CONTROLWORKERS NUMBER {
+                    Run.control_workers = $3;
+                    if (Run.control_workers > SCHEDULER_WORKERS_MAX)
+                        yyerror("Maximum number of control workers is %d", SCHEDULER_WORKERS_MAX);
+                  }
+                | SET RESTARTLIMIT NUMBER {
+                    if ($3 < 0)
+                        yyerror("The restart limit must not be negative");
+                    Run.restartlimit = $3;
+                  }
+                ;
+
+setspawnlimit   : SET SPAWNLIMIT NUMBER {
+                    if ($3 < 0)
+                        yyerror("The spawn limit must not be negative");
+                    Run.spawnlimit = $3;
+                  }
+                ;
+
+setprocessworkers : SET PROCESSWORKERS NUMBER {
+                    Run.process_workers = $3;
+                    if (Run.process_workers > SCHEDULER_WORKERS_MAX)
+                        yyerror("Maximum number of process workers is %d", SCHEDULER_WORKERS_MAX);
+                  }
+                ;
+
+setprocessevents : SET PROCESSEVENTS {
+                    Run.processevents = true;
+                  }
+                ;
+
+setprogramevents : SET PROGRAMEVENTS programlimit {
+                    Run.programevents = true;
+                  }
+                ;
+
+programlimit    : /* EMPTY */
+                | MAXRUNNING NUMBER {
+                    if ($2 < 0)
+                        yyerror("The maximum number of running programs must not be negative");
+                    Run.programlimit = $2;
+                  }
+                ;
+
+setfileevents   : SET FILEEVENTS {
+                    Run.fileevents = true;
+                  }
+                ;
+
+setnetworkevents : SET NETWORKEVENTS {
+                    Run.networkevents = true;
+                  }
+                ;
+
+setrelay        : SET RELAY {
+                    Run.relay = true;
+                  }
+                ;
+
+setpowersave    : SET POWERSAVE {
+                    Run.powersave = true;
+                  }
+                ;
+
+setdependsuppress : SET DEPENDSUPPRESS {
+                    Run.dependsuppress = true;
+                  }
+                ;
+
+setcluster      : SET CLUSTER peerlist clusterreplicas
+                ;
+
+peerlist        : peer
+                | peerlist peer
+                ;
+
+peer            : URLOBJECT {
+                    addpeer($<url>1);
+                  }
+                ;
+
+clusterreplicas : /* EMPTY */
+                | REPLICAS NUMBER {
+                    if ($2 < 1)
+                        yyerror2("The number of cluster replicas must be greater than 0");
+                    Run.cluster.replicas = $2;
+                  }
+                ;
+
+setdnscache     : SET DNSCACHE {
+                    Run.dnscache = DNSCACHE_MAXAGE;
+                  }
+                | SET DNSCACHE MAXAGE NUMBER SECOND {
+                    Run.dnscache = $4;
+                  }
+                ;
+
 setinit         : SET INIT {
                     Run.init = true;
                   }
@@ -584,12 +813,13 @@ setfips         : SET FIPS {
                   }
                 ;
 
-setlog          : SET LOGFILE PATH   {
+setlog          : SET LOGFILE PATH logformat {
                    if (! Run.logfile || ihp.logfile) {
                      ihp.logfile = true;
                      setlogfile($3);
                      Run.use_syslog = false;
                      Run.dolog = true;
+                     Run.jsonlog = $<number>4;
                    }
                   }
                 | SET LOGFILE SYSLOG {
@@ -600,19 +830,44 @@ setlog          : SET LOGFILE PATH   {
                   }
                 ;
 
-seteventqueue   : SET EVENTQUEUE BASEDIR PATH {
+logformat       : /* EMPTY */ { $<number>$ = false; }
+                | JSONFORMAT  { $<number>$ = true; }
+                ;
+
+seteventqueue   : SET EVENTQUEUE BASEDIR PATH eventbuffer {
                     Run.eventlist_dir = $4;
                   }
-                | SET EVENTQUEUE BASEDIR PATH SLOT NUMBER {
+                | SET EVENTQUEUE BASEDIR PATH SLOT NUMBER eventbuffer {
                     Run.eventlist_dir = $4;
                     Run.eventlist_slots = $6;
                   }
-                | SET EVENTQUEUE SLOT NUMBER {
+                | SET EVENTQUEUE SLOT NUMBER eventbuffer {
                     Run.eventlist_dir = Str_dup(MYEVENTLISTBASE);
                     Run.eventlist_slots = $4;
                   }
                 ;
 
+eventbuffer     : /* EMPTY */
+                | eventbuffer eventoption
+                ;
+
+eventoption     : BUFFER NUMBER {
+                    if ($2 < 1)
+                        yyerror("The event buffer size must be greater than zero");
+                    Run.eventlist_buffer = $2;
+                  }
+                | REPLAY NUMBER {
+                    if ($2 < 1)
+                        yyerror("The number of events replayed per cycle must be greater than zero");
+                    Run.eventlist_replay = $2;
+                  }
+                | BATCH NUMBER {
+                    if ($2 < 1)
+                        yyerror("The event replay batch size must be greater than zero");
+                    Run.eventlist_batch = $2;
+                  }
+                ;
+
 setidfile       : SET IDFILE PATH {
                     Run.idfile = $3;
                   }
@@ -621,6 +876,26 @@ setidfile       : SET IDFILE PATH {
 setstatefile    : SET STATEFILE PATH {
                     Run.statefile = $3;
                   }
+                | SET STATEFILE PATH SYNC EVERY NUMBER SECOND {
+                    Run.statefile = $3;
+                    Run.statesync = $6;
+                  }
+                ;
+
+sethistoryfile  : SET HISTORYFILE PATH {
+                    Run.historyfile = $3;
+                  }
+                | SET HISTORYFILE PATH SLOT NUMBER {
+                    if ($5 < 1)
+                      yyerror2("The number of history slots must be greater than 0");
+                    Run.historyfile = $3;
+                    Run.historyslots = $5;
+                  }
+                ;
+
+setstatusfile   : SET STATUSFILE PATH {
+                    Run.statusfile = $3;
+                  }
                 ;
 
 setpid          : SET PIDFILE PATH {
@@ -632,14 +907,34 @@ setpid          : SET PIDFILE PATH {
                 ;
 
 setmmonits      : SET MMONIT mmonitlist
+                | SET MMONIT DELTA {
+                    Run.mmonitdelta = MMONIT_DELTA_FULL;
+                  }
+                | SET MMONIT DELTA FULL EVERY NUMBER CYCLE {
+                    if ($6 < 1)
+                        yyerror("The full status report interval must be at least 1 cycle");
+                    Run.mmonitdelta = $6;
+                  }
+                | SET MMONIT JITTER NUMBER SECOND {
+                    Run.mmonitjitter = $4;
+                  }
+                | SET MMONIT PARALLEL {
+                    Run.mmonitparallel = Mmonit_FirstSuccess;
+                  }
+                | SET MMONIT PARALLEL FIRSTSUCCESS {
+                    Run.mmonitparallel = Mmonit_FirstSuccess;
+                  }
+                | SET MMONIT PARALLEL ALLSUCCESS {
+                    Run.mmonitparallel = Mmonit_AllSuccess;
+                  }
                 ;
 
 mmonitlist      : mmonit credentials
                 | mmonitlist mmonit credentials
                 ;
 
-mmonit          : URLOBJECT nettimeout sslversion certmd5 {
-                    addmmonit($<url>1, $<number>2, $<number>3, $<string>4);
+mmonit          : URLOBJECT nettimeout sslversion certmd5 logformat {
+                    addmmonit($<url>1, $<number>2, $<number>3, $<string>4, $<number>5);
                   }
                 ;
 
@@ -722,6 +1017,7 @@ httpdnetoption  : ssl
                 | signature
                 | bindaddress
                 | allow
+                | httpdlimit
                 ;
 
 httpdunixlist   : /* EMPTY */
@@ -730,6 +1026,19 @@ httpdunixlist   : /* EMPTY */
 
 httpdunixoption : signature
                 | allow
+                | httpdlimit
+                ;
+
+httpdlimit      : WORKERS NUMBER {
+                        if ($2 < 1 || $2 > SCHEDULER_WORKERS_MAX)
+                                yyerror2("The number of HTTP workers must be between 1 and %d", SCHEDULER_WORKERS_MAX);
+                        Run.httpd.workers = $2;
+                  }
+                | MAXCONNECTIONS NUMBER {
+                        if ($2 < 1)
+                                yyerror("The maximum number of HTTP connections must be greater than zero");
+                        Run.httpd.maxconnections = $2;
+                  }
                 ;
 
 ssl             : ssldisable optssllist {
@@ -755,6 +1064,8 @@ optssllist      : /* EMPTY */
 optssl          : pemfile
                 | clientpemfile
                 | allowselfcert
+                | sessioncache
+                | sessiontickets
                 ;
 
 sslenable       : HTTPDSSL ENABLE
@@ -803,6 +1114,26 @@ allowselfcert   : ALLOWSELFCERTIFICATION {
                   }
                 ;
 
+sessioncache    : SESSIONCACHE NUMBER {
+                        if ($2 < 0)
+                                yyerror("The SSL session cache size must not be negative");
+                        Run.httpd.socket.net.ssl.sessioncache = $2;
+                  }
+                | SESSIONCACHE NUMBER TIMEOUT NUMBER SECOND {
+                        if ($2 < 0)
+                                yyerror("The SSL session cache size must not be negative");
+                        if ($4 < 1)
+                                yyerror("The SSL session cache timeout must be greater than zero");
+                        Run.httpd.socket.net.ssl.sessioncache = $2;
+                        Run.httpd.socket.net.ssl.sessiontimeout = $4;
+                  }
+                ;
+
+sessiontickets  : SESSIONTICKETS {
+                        Run.httpd.flags |= Httpd_SessionTickets;
+                  }
+                ;
+
 allow           : ALLOW STRING':'STRING readonly {
                         addcredentials($2, $4, Digest_Cleartext, $<number>5);
                   }
@@ -881,9 +1212,11 @@ readonly        : /* EMPTY */ { $<number>$ = false; }
 
 checkproc       : CHECKPROC SERVICENAME PIDFILE PATH {
                     createservice(Service_Process, $<string>2, $4, check_process);
+                    ARENA_NEW(current->arena, current->pidfile);
                   }
                 | CHECKPROC SERVICENAME PATHTOK PATH {
                     createservice(Service_Process, $<string>2, $4, check_process);
+                    ARENA_NEW(current->arena, current->pidfile);
                   }
                 | CHECKPROC SERVICENAME MATCH STRING {
                     createservice(Service_Process, $<string>2, $4, check_process);
@@ -903,6 +1236,13 @@ checkproc       : CHECKPROC SERVICENAME PIDFILE PATH {
 
 checkfile       : CHECKFILE SERVICENAME PATHTOK PATH {
                     createservice(Service_File, $<string>2, $4, check_file);
+                    if (strpbrk($4, "*?["))
+                        current->instance.max = INSTANCES_DEFAULT;
+                  }
+                | CHECKFILE SERVICENAME PATHTOK STRING {
+                    createservice(Service_File, $<string>2, $4, check_file);
+                    if (strpbrk($4, "*?["))
+                        current->instance.max = INSTANCES_DEFAULT;
                   }
                 ;
 
@@ -912,6 +1252,26 @@ checkfilesys    : CHECKFILESYS SERVICENAME PATHTOK PATH {
                 | CHECKFILESYS SERVICENAME PATHTOK STRING {
                     createservice(Service_Filesystem, $<string>2, $4, check_filesystem);
                   }
+                | CHECKFILESYS SERVICENAME {
+                    if (! IS($<string>2, "all"))
+                        yyerror2("The filesystem path is missing, use 'check filesystem %s path <path>' or 'check filesystem all'", $<string>2);
+                    createservice(Service_Filesystem, $<string>2, Str_dup("all"), check_filesystem);
+                    current->instance.max = INSTANCES_DEFAULT;
+                  }
+                | CHECKFILESYS SERVICENAME EXCLUDING TYPE fstypelist {
+                    createservice(Service_Filesystem, $<string>2, Str_dup("all"), check_filesystem);
+                    current->instance.max = INSTANCES_DEFAULT;
+                    current->instance.excluded = fstypeset;
+                    fstypeset = NULL;
+                  }
+                ;
+
+fstypelist      : STRING {
+                    addfstype($1);
+                  }
+                | fstypelist STRING {
+                    addfstype($2);
+                  }
                 ;
 
 checkdir        : CHECKDIR SERVICENAME PATHTOK PATH {
@@ -935,6 +1295,40 @@ checknet        : CHECKNET SERVICENAME ADDRESS STRING {
                 | CHECKNET SERVICENAME INTERFACE STRING {
                     createservice(Service_Net, $<string>2, $4, check_net);
                     current->inf->priv.net.stats = Link_createForInterface($4);
+                    current->inf->priv.net.interface = true;
+                  }
+                ;
+
+checkcgroup     : CHECKCGROUP SERVICENAME PATHTOK PATH {
+                    createservice(Service_Cgroup, $<string>2, $4, check_cgroup);
+                    addcgroup(current->path);
+                  }
+                | CHECKCGROUP SERVICENAME PATHTOK STRING {
+                    createservice(Service_Cgroup, $<string>2, $4, check_cgroup);
+                    addcgroup(current->path);
+                  }
+                ;
+
+checkprocesses  : CHECKPROCESSES SERVICENAME MATCH STRING {
+                    createservice(Service_Processes, $<string>2, $4, check_processes);
+                    matchset.ignore = false;
+                    matchset.match_path = NULL;
+                    matchset.match_string = Str_dup($4);
+                    addmatch(&matchset, Action_Ignored, 0);
+                    NEW(current->processes);
+                  }
+                | CHECKPROCESSES SERVICENAME MATCH PATH {
+                    createservice(Service_Processes, $<string>2, $4, check_processes);
+                    matchset.ignore = false;
+                    matchset.match_path = NULL;
+                    matchset.match_string = Str_dup($4);
+                    addmatch(&matchset, Action_Ignored, 0);
+                    NEW(current->processes);
+                  }
+                ;
+
+template        : TEMPLATE SERVICENAME {
+                    createtemplate($<string>2);
                   }
                 ;
 
@@ -969,6 +1363,14 @@ checkprogram    : CHECKPROGRAM SERVICENAME PATHTOK argumentlist programtimeout {
                         current->program->timeout = $<number>5;
                         current->program->output = StringBuffer_create(64);
                  }
+                | CHECKPROGRAM SERVICENAME PLUGIN argumentlist plugintimeout {
+                        command_t c = command; // Current command
+                        createservice(Service_Program, $<string>2, Str_dup(c->arg[0]), check_program);
+                        current->program->timeout = $<number>5;
+                        current->program->output = StringBuffer_create(64);
+                        if (! (current->program->plugin = Plugin_new(current->path, current->program->args)))
+                                yyerror2("Cannot load the plugin '%s'", current->path);
+                 }
                 ;
 
 start           : START argumentlist exectimeout {
@@ -1027,28 +1429,28 @@ hostname        : /* EMPTY */     { $<string>$ = NULL; }
                 | HOSTNAME STRING { $<string>$ = $2; }
                 ;
 
-connection      : IF FAILED host port ip type protocol urloption nettimeout retry rate1 THEN action1 recovery {
+connection      : IF FAILED host port ip type protocol urloption nettimeout retry portprobe rate1 THEN action1 recovery {
                     portset.timeout = $<number>9;
                     portset.retry = $<number>10;
                     /* This is a workaround to support content match without having to create an URL object. 'urloption' creates the Request_T object we need minus the URL object, but with enough information to perform content test.
                      TODO: Parser is in need of refactoring */
                     portset.url_request = urlrequest;
-                    addeventaction(&(portset).action, $<number>13, $<number>14);
+                    addeventaction(&(portset).action, $<number>14, $<number>15);
                     addport(&(current->portlist), &portset);
                   }
-                | IF FAILED URL URLOBJECT urloption nettimeout retry rate1 THEN action1 recovery {
+                | IF FAILED URL URLOBJECT urloption nettimeout retry portprobe rate1 THEN action1 recovery {
                     prepare_urlrequest($<url>4);
                     portset.timeout = $<number>6;
                     portset.retry = $<number>7;
-                    addeventaction(&(portset).action, $<number>10, $<number>11);
+                    addeventaction(&(portset).action, $<number>11, $<number>12);
                     addport(&(current->portlist), &portset);
                   }
                 ;
 
-connectionunix  : IF FAILED unixsocket type protocol nettimeout retry rate1 THEN action1 recovery {
+connectionunix  : IF FAILED unixsocket type protocol nettimeout retry portprobe rate1 THEN action1 recovery {
                         portset.timeout = $<number>6;
                         portset.retry = $<number>7;
-                        addeventaction(&(portset).action, $<number>10, $<number>11);
+                        addeventaction(&(portset).action, $<number>11, $<number>12);
                         addport(&(current->socketlist), &portset);
                   }
                 ;
@@ -1192,6 +1594,19 @@ protocol        : /* EMPTY */  {
                         portset.SSL.version = SSL_Auto;
                         portset.protocol = Protocol_get(Protocol_HTTP);
                  }
+                | PROTOCOL GRPC grpclist {
+                        portset.SSL.alpn = "h2";
+                        portset.keepalive = true;
+                        portset.protocol = Protocol_get(Protocol_GRPC);
+                  }
+                | PROTOCOL GRPCS grpclist {
+                        portset.type = Socket_Tcp;
+                        portset.SSL.use_ssl = true;
+                        portset.SSL.version = SSL_Auto;
+                        portset.SSL.alpn = "h2";
+                        portset.keepalive = true;
+                        portset.protocol = Protocol_get(Protocol_GRPC);
+                  }
                 | PROTOCOL IMAP {
                         portset.protocol = Protocol_get(Protocol_IMAP);
                   }
@@ -1213,7 +1628,9 @@ protocol        : /* EMPTY */  {
                 | PROTOCOL MONGODB  {
                     portset.protocol = Protocol_get(Protocol_MONGODB);
                   }
-                | PROTOCOL MYSQL {
+                | PROTOCOL MYSQL keepalive {
+                    if (portset.keepalive)
+                        yyerror("The keepalive option is not supported by the MYSQL protocol test, it doesn't log in");
                     portset.protocol = Protocol_get(Protocol_MYSQL);
                   }
                 | PROTOCOL SIP target maxforward {
@@ -1256,7 +1673,7 @@ protocol        : /* EMPTY */  {
                 | PROTOCOL RDATE {
                     portset.protocol = Protocol_get(Protocol_RDATE);
                   }
-                | PROTOCOL REDIS  {
+                | PROTOCOL REDIS keepalive {
                     portset.protocol = Protocol_get(Protocol_REDIS);
                   }
                 | PROTOCOL RSYNC {
@@ -1265,7 +1682,7 @@ protocol        : /* EMPTY */  {
                 | PROTOCOL TNS {
                     portset.protocol = Protocol_get(Protocol_TNS);
                   }
-                | PROTOCOL PGSQL {
+                | PROTOCOL PGSQL keepalive {
                     portset.protocol = Protocol_get(Protocol_PGSQL);
                   }
                 | PROTOCOL LMTP {
@@ -1318,6 +1735,18 @@ websocket       : ORIGIN STRING {
                   }
                 ;
 
+grpclist        : /* EMPTY */
+                | grpclist grpc
+                ;
+
+grpc            : REQUEST STRING {
+                    portset.request = $2;
+                  }
+                | HOST STRING {
+                    portset.request_hostheader = $2;
+                  }
+                ;
+
 target          : /* EMPTY */
                 | TARGET MAILADDR {
                     portset.request = $2;
@@ -1327,6 +1756,12 @@ target          : /* EMPTY */
                   }
                 ;
 
+keepalive       : /* EMPTY */
+                | KEEPALIVE {
+                    portset.keepalive = true;
+                  }
+                ;
+
 maxforward      : /* EMPTY */
                 |  MAXFORWARD NUMBER {
                      portset.maxforward = verifyMaxForward($2);
@@ -1476,6 +1911,14 @@ programtimeout  : /* EMPTY */ {
                   }
                 ;
 
+plugintimeout   : /* EMPTY */ {
+                   $<number>$ = PLUGIN_TIMEOUT; // The plugin check blocks the service check, the default timeout is short
+                  }
+                | TIMEOUT NUMBER SECOND {
+                   $<number>$ = $2;
+                  }
+                ;
+
 nettimeout      : /* EMPTY */ {
                    $<number>$ = NET_TIMEOUT; // timeout is in milliseconds
                   }
@@ -1484,6 +1927,27 @@ nettimeout      : /* EMPTY */ {
                   }
                 ;
 
+portprobe       : /* EMPTY */
+                | portprobe FULL EVERY NUMBER CYCLE {
+                    if ($4 < 1)
+                        yyerror("The full protocol test interval must be at least 1 cycle");
+                    portset.fullevery = $4;
+                  }
+                | portprobe RECHECK NUMBER SECOND {
+                    if ($3 < 1)
+                        yyerror("The failure recheck delay must be at least 1 second");
+                    portset.recheck = $3;
+                  }
+                | portprobe CERTIFICATE VALID GREATER NUMBER DAY {
+                    if ($5 < 1)
+                        yyerror("The certificate validity must be at least 1 day");
+                    portset.certificate.days = $5;
+                  }
+                | portprobe RESET {
+                    portset.reset = true;
+                  }
+                ;
+
 retry           : /* EMPTY */ {
                    $<number>$ = 1;
                   }
@@ -1592,13 +2056,19 @@ every           : EVERY NUMBER CYCLE {
                    current->every.type = Every_SkipCycles;
                    current->every.spec.cycle.number = $2;
                  }
+                | EVERY NUMBER SECOND {
+                   if ($2 < 1)
+                        yyerror("The check interval must be at least 1 second");
+                   current->every.type = Every_Interval;
+                   current->every.spec.interval.seconds = $2;
+                 }
                 | EVERY TIMESPEC {
                    current->every.type = Every_Cron;
-                   current->every.spec.cron = $2;
+                   addcron($2);
                  }
                 | NOTEVERY TIMESPEC {
                    current->every.type = Every_NotInCron;
-                   current->every.spec.cron = $2;
+                   addcron($2);
                  }
                 ;
 
@@ -1658,8 +2128,62 @@ resourceprocessopt  : resourcecpuproc
                     | resourcemem
                     | resourcechild
                     | resourceload
+                    | resourcetasks
+                    | resourcefds
+                    | resourceio
+                    | resourceavg
                     ;
 
+resourcecgroup  : IF resourcecgrouplist rate1 THEN action1 recovery {
+                     addeventaction(&(resourceset).action, $<number>5, $<number>6);
+                     addresource(&resourceset);
+                   }
+                ;
+
+resourcecgrouplist : resourcecgroupopt
+                   | resourcecgrouplist resourcecgroupopt
+                   ;
+
+resourcecgroupopt  : resourcecpuproc
+                   | resourcemem
+                   | resourcetasks
+                   | resourceio
+                   | resourceavg
+                   | resourcemonit
+                   ;
+
+resourceprocesses : IF resourceprocesseslist rate1 THEN action1 recovery {
+                     addeventaction(&(resourceset).action, $<number>5, $<number>6);
+                     addresource(&resourceset);
+                   }
+                  ;
+
+resourceprocesseslist : resourceprocessesopt
+                      | resourceprocesseslist resourceprocessesopt
+                      ;
+
+resourceprocessesopt  : resourcecpuproc
+                      | resourcemem
+                      ;
+
+cgrouptotal     : CGROUPTOTAL {
+                    addcgroup(NULL);
+                  }
+                ;
+
+instances       : INSTANCES {
+                    addinstances(INSTANCES_DEFAULT);
+                  }
+                | INSTANCES NUMBER {
+                    addinstances($2);
+                  }
+                ;
+
+usetemplate     : USETEMPLATE SERVICENAME {
+                    usetemplate($<string>2);
+                  }
+                ;
+
 resourcesystem  : IF resourcesystemlist rate1 THEN action1 recovery {
                      addeventaction(&(resourceset).action, $<number>5, $<number>6);
                      addresource(&resourceset);
@@ -1674,12 +2198,31 @@ resourcesystemopt  : resourceload
                    | resourcemem
                    | resourceswap
                    | resourcecpu
+                   | resourceavg
                    ;
 
-resourcecpuproc : CPU operator NUMBER PERCENT {
+resourcemonit   : MONITCPU operator NUMBER PERCENT {
+                    resourceset.resource_id = Resource_MonitCpu;
+                    resourceset.operator = $<number>2;
+                    resourceset.limit = ($3 * 10);
+                  }
+                | MONITMEMORY operator value unit {
+                    resourceset.resource_id = Resource_MonitMemory;
+                    resourceset.operator = $<number>2;
+                    resourceset.limit = (int) ($<real>3 * ($<number>4 / 1024.0));
+                  }
+                | MONITFILEDESCRIPTORS operator NUMBER {
+                    resourceset.resource_id = Resource_MonitFileDescriptors;
+                    resourceset.operator = $<number>2;
+                    resourceset.limit = (int) $3;
+                  }
+                ;
+
+resourcecpuproc : CPU operator NUMBER PERCENT sampled {
                     resourceset.resource_id = Resource_CpuPercent;
                     resourceset.operator = $<number>2;
                     resourceset.limit = ($3 * 10);
+                    resourceset.sampled = $<number>5;
                   }
                 | TOTALCPU operator NUMBER PERCENT {
                     resourceset.resource_id = Resource_CpuPercentTotal;
@@ -1688,16 +2231,19 @@ resourcecpuproc : CPU operator NUMBER PERCENT {
                   }
                 ;
 
-resourcecpu     : resourcecpuid operator NUMBER PERCENT {
+resourcecpu     : resourcecpuid operator NUMBER PERCENT sampled {
                     resourceset.resource_id = $<number>1;
                     resourceset.operator = $<number>2;
                     resourceset.limit = ($3 * 10);
+                    resourceset.sampled = $<number>5;
                   }
                 ;
 
-resourcecpuid   : CPUUSER   { $<number>$ = Resource_CpuUser; }
-                | CPUSYSTEM { $<number>$ = Resource_CpuSystem; }
-                | CPUWAIT   { $<number>$ = Resource_CpuWait; }
+resourcecpuid   : CPUUSER    { $<number>$ = Resource_CpuUser; }
+                | CPUSYSTEM  { $<number>$ = Resource_CpuSystem; }
+                | CPUWAIT    { $<number>$ = Resource_CpuWait; }
+                | MAXCPU     { $<number>$ = Resource_CpuMax; }
+                | MAXNODECPU { $<number>$ = Resource_CpuNodeMax; }
                 ;
 
 resourcemem     : MEMORY operator value unit {
@@ -1741,6 +2287,32 @@ resourcechild   : CHILDREN operator NUMBER {
                   }
                 ;
 
+resourcetasks   : TASKS operator NUMBER {
+                    resourceset.resource_id = Resource_Tasks;
+                    resourceset.operator = $<number>2;
+                    resourceset.limit = (int) $3;
+                  }
+                ;
+
+resourcefds     : FILEDESCRIPTORS operator NUMBER {
+                    resourceset.resource_id = Resource_FileDescriptors;
+                    resourceset.operator = $<number>2;
+                    resourceset.limit = (int) $3;
+                  }
+                ;
+
+resourceio      : READ operator value unit currenttime {
+                    resourceset.resource_id = Resource_ReadBytes;
+                    resourceset.operator = $<number>2;
+                    resourceset.limit = (long) ($<real>3 * $<number>4);
+                  }
+                | WRITE operator value unit currenttime {
+                    resourceset.resource_id = Resource_WriteBytes;
+                    resourceset.operator = $<number>2;
+                    resourceset.limit = (long) ($<real>3 * $<number>4);
+                  }
+                ;
+
 resourceload    : resourceloadavg operator value {
                     resourceset.resource_id = $<number>1;
                     resourceset.operator = $<number>2;
@@ -1753,6 +2325,26 @@ resourceloadavg : LOADAVG1  { $<number>$ = Resource_LoadAverage1m; }
                 | LOADAVG15 { $<number>$ = Resource_LoadAverage15m; }
                 ;
 
+resourceavg     : AVG resourceavgid NUMBER time operator value PERCENT {
+                    setaverage($<number>2, $3 * $<number>4, $<number>5, $<real>6, 0);
+                  }
+                | AVG resourceavgid NUMBER time operator value unit {
+                    setaverage($<number>2, $3 * $<number>4, $<number>5, $<real>6, $<number>7);
+                  }
+                ;
+
+resourceavgid   : CPU             { $<number>$ = Resource_CpuPercent; }
+                | TOTALCPU        { $<number>$ = Resource_CpuPercentTotal; }
+                | MEMORY          { $<number>$ = Resource_MemoryPercent; }
+                | TOTALMEMORY     { $<number>$ = Resource_MemoryPercentTotal; }
+                | SWAP            { $<number>$ = Resource_SwapPercent; }
+                | CHILDREN        { $<number>$ = Resource_Children; }
+                | TASKS           { $<number>$ = Resource_Tasks; }
+                | FILEDESCRIPTORS { $<number>$ = Resource_FileDescriptors; }
+                | resourcecpuid   { $<number>$ = $<number>1; }
+                | resourceloadavg { $<number>$ = $<number>1; }
+                ;
+
 value           : REAL { $<real>$ = $1; }
                 | NUMBER { $<real>$ = (float) $1; }
                 ;
@@ -1793,6 +2385,14 @@ totaltime       : MINUTE      { $<number>$ = Time_Minute; }
 currenttime     : /* EMPTY */ { $<number>$ = Time_Second; }
                 | SECOND      { $<number>$ = Time_Second; }
 
+sampled         : /* EMPTY */                 { $<number>$ = 0; }
+                | SAMPLED EVERY NUMBER SECOND {
+                    if ($3 < 1 || $3 > 60)
+                        yyerror2("The sampling interval must be between 1 and 60 seconds");
+                    $<number>$ = $3;
+                  }
+                ;
+
 action          : ALERT                            { $<number>$ = Action_Alert; }
                 | EXEC argumentlist                { $<number>$ = Action_Exec; }
                 | EXEC argumentlist useroptionlist { $<number>$ = Action_Exec; }
@@ -1868,23 +2468,48 @@ recovery        : /* EMPTY */ {
                   }
                 ;
 
-checksum        : IF FAILED hashtype CHECKSUM rate1 THEN action1 recovery {
-                    addeventaction(&(checksumset).action, $<number>7, $<number>8);
+checksum        : IF FAILED hashtype CHECKSUM checksumverify rate1 THEN action1 recovery {
+                    addeventaction(&(checksumset).action, $<number>8, $<number>9);
                     addchecksum(&checksumset);
                   }
-                | IF FAILED hashtype CHECKSUM EXPECT STRING rate1 THEN action1
-                  recovery {
+                | IF FAILED hashtype CHECKSUM EXPECT STRING checksumverify rate1 THEN
+                  action1 recovery {
                     snprintf(checksumset.hash, sizeof(checksumset.hash), "%s", $6);
                     FREE($6);
+                    addeventaction(&(checksumset).action, $<number>10, $<number>11);
+                    addchecksum(&checksumset);
+                  }
+                | IF CHANGED hashtype CHECKSUM checksumverify rate1 THEN action1 {
+                    checksumset.test_changes = true;
+                    addeventaction(&(checksumset).action, $<number>8, Action_Ignored);
+                    addchecksum(&checksumset);
+                  }
+                ;
+treechecksum    : IF FAILED hashtype CHECKSUM TREE checksumverify rate1 THEN action1 recovery {
                     addeventaction(&(checksumset).action, $<number>9, $<number>10);
                     addchecksum(&checksumset);
                   }
-                | IF CHANGED hashtype CHECKSUM rate1 THEN action1 {
+                | IF FAILED hashtype CHECKSUM TREE EXPECT STRING checksumverify rate1 THEN
+                  action1 recovery {
+                    snprintf(checksumset.hash, sizeof(checksumset.hash), "%s", $7);
+                    FREE($7);
+                    addeventaction(&(checksumset).action, $<number>11, $<number>12);
+                    addchecksum(&checksumset);
+                  }
+                | IF CHANGED hashtype CHECKSUM TREE checksumverify rate1 THEN action1 {
                     checksumset.test_changes = true;
-                    addeventaction(&(checksumset).action, $<number>7, Action_Ignored);
+                    addeventaction(&(checksumset).action, $<number>9, Action_Ignored);
                     addchecksum(&checksumset);
                   }
                 ;
+
+checksumverify  : /* EMPTY */
+                | EVERY NUMBER CYCLE {
+                    if ($<number>2 < 1)
+                      yyerror2("The checksum verification interval must be at least 1 cycle");
+                    checksumset.verify = $<number>2;
+                  }
+                ;
 hashtype        : /* EMPTY */ { checksumset.type = Hash_Unknown; }
                 | MD5HASH     { checksumset.type = Hash_Md5; }
                 | SHA1HASH    { checksumset.type = Hash_Sha1; }
@@ -1921,7 +2546,9 @@ inode           : IF INODE operator NUMBER rate1 THEN action1 recovery {
                 ;
 
 space           : IF SPACE operator value unit rate1 THEN action1 recovery {
-                    if (! filesystem_usage(current))
+                    if (current->instance.max)
+                      yyerror2("The space limit of 'check filesystem %s' must be in percent, the block size differs per filesystem", current->name);
+                    else if (! filesystem_usage(current))
                       yyerror2("Cannot read usage of filesystem %s", current->path);
                     filesystemset.resource = Resource_Space;
                     filesystemset.operator = $<number>3;
@@ -1937,7 +2564,9 @@ space           : IF SPACE operator value unit rate1 THEN action1 recovery {
                     addfilesystem(&filesystemset);
                   }
                 | IF SPACE TFREE operator value unit rate1 THEN action1 recovery {
-                    if (! filesystem_usage(current))
+                    if (current->instance.max)
+                      yyerror2("The space limit of 'check filesystem %s' must be in percent, the block size differs per filesystem", current->name);
+                    else if (! filesystem_usage(current))
                       yyerror2("Cannot read usage of filesystem %s", current->path);
                     filesystemset.resource = Resource_SpaceFree;
                     filesystemset.operator = $<number>4;
@@ -1979,6 +2608,30 @@ permission      : IF FAILED PERMISSION NUMBER rate1 THEN action1 recovery {
                   }
                 ;
 
+matchbudget     : CONTENTBUDGET budgetoptlist
+                ;
+
+budgetoptlist   : budgetopt
+                | budgetoptlist budgetopt
+                ;
+
+budgetopt       : NUMBER unit {
+                    if ($1 < 1)
+                      yyerror2("The content budget must be greater than zero");
+                    current->matchbudget.bytes = (unsigned long long)$1 * $<number>2;
+                  }
+                | NUMBER SECOND {
+                    if ($1 < 1)
+                      yyerror2("The content budget timeout must be greater than zero");
+                    current->matchbudget.timeout = $1;
+                  }
+                | SKIPBEHIND NUMBER unit {
+                    if ($2 < 1)
+                      yyerror2("The content skip limit must be greater than zero");
+                    current->matchbudget.behind = (unsigned long long)$2 * $<number>3;
+                  }
+                ;
+
 match           : IF matchflagnot MATCH PATH rate1 THEN action1 {
                     matchset.ignore = false;
                     matchset.match_path = $4;
@@ -2027,6 +2680,19 @@ size            : IF SIZE operator NUMBER unit rate1 THEN action1 recovery {
                     addeventaction(&(sizeset).action, $<number>6, Action_Ignored);
                     addsize(&sizeset);
                   }
+                | IF RATE SIZE operator NUMBER unit pertime rate1 THEN action1 recovery {
+                    sizeset.rate = $<number>7;
+                    sizeset.operator = $<number>4;
+                    sizeset.size = ((unsigned long long)$5 * $<number>6);
+                    addeventaction(&(sizeset).action, $<number>10, $<number>11);
+                    addsize(&sizeset);
+                  }
+                ;
+
+pertime         : /* EMPTY */ { $<number>$ = Time_Second; }
+                | PERMINUTE   { $<number>$ = Time_Minute; }
+                | PERHOUR     { $<number>$ = Time_Hour; }
+                | PERDAY      { $<number>$ = Time_Day; }
                 ;
 
 uid             : IF FAILED UID STRING rate1 THEN action1 recovery {
@@ -2087,12 +2753,13 @@ linksaturation : IF SATURATION operator NUMBER PERCENT rate1 THEN action1 recove
                   }
                 ;
 
-upload          : IF UPLOAD operator NUMBER unit currenttime rate1 THEN action1 recovery {
+upload          : IF UPLOAD operator NUMBER unit currenttime sampled rate1 THEN action1 recovery {
                     bandwidthset.operator = $<number>3;
                     bandwidthset.limit = ((unsigned long long)$4 * $<number>5);
                     bandwidthset.rangecount = 1;
                     bandwidthset.range = $<number>6;
-                    addeventaction(&(bandwidthset).action, $<number>9, $<number>10);
+                    bandwidthset.sampled = $<number>7;
+                    addeventaction(&(bandwidthset).action, $<number>10, $<number>11);
                     addbandwidth(&(current->uploadbyteslist), &bandwidthset);
                   }
                 | IF TOTAL UPLOAD operator NUMBER unit totaltime rate1 THEN action1 recovery {
@@ -2111,12 +2778,13 @@ upload          : IF UPLOAD operator NUMBER unit currenttime rate1 THEN action1
                     addeventaction(&(bandwidthset).action, $<number>11, $<number>12);
                     addbandwidth(&(current->uploadbyteslist), &bandwidthset);
                   }
-                | IF UPLOAD operator NUMBER PACKET currenttime rate1 THEN action1 recovery {
+                | IF UPLOAD operator NUMBER PACKET currenttime sampled rate1 THEN action1 recovery {
                     bandwidthset.operator = $<number>3;
                     bandwidthset.limit = (unsigned long long)$4;
                     bandwidthset.rangecount = 1;
                     bandwidthset.range = $<number>6;
-                    addeventaction(&(bandwidthset).action, $<number>9, $<number>10);
+                    bandwidthset.sampled = $<number>7;
+                    addeventaction(&(bandwidthset).action, $<number>10, $<number>11);
                     addbandwidth(&(current->uploadpacketslist), &bandwidthset);
                   }
                 | IF TOTAL UPLOAD operator NUMBER PACKET totaltime rate1 THEN action1 recovery {
@@ -2137,12 +2805,13 @@ upload          : IF UPLOAD operator NUMBER unit currenttime rate1 THEN action1
                   }
                 ;
 
-download        : IF DOWNLOAD operator NUMBER unit currenttime rate1 THEN action1 recovery {
+download        : IF DOWNLOAD operator NUMBER unit currenttime sampled rate1 THEN action1 recovery {
                     bandwidthset.operator = $<number>3;
                     bandwidthset.limit = ((unsigned long long)$4 * $<number>5);
                     bandwidthset.rangecount = 1;
                     bandwidthset.range = $<number>6;
-                    addeventaction(&(bandwidthset).action, $<number>9, $<number>10);
+                    bandwidthset.sampled = $<number>7;
+                    addeventaction(&(bandwidthset).action, $<number>10, $<number>11);
                     addbandwidth(&(current->downloadbyteslist), &bandwidthset);
                   }
                 | IF TOTAL DOWNLOAD operator NUMBER unit totaltime rate1 THEN action1 recovery {
@@ -2161,12 +2830,13 @@ download        : IF DOWNLOAD operator NUMBER unit currenttime rate1 THEN action
                     addeventaction(&(bandwidthset).action, $<number>11, $<number>12);
                     addbandwidth(&(current->downloadbyteslist), &bandwidthset);
                   }
-                | IF DOWNLOAD operator NUMBER PACKET currenttime rate1 THEN action1 recovery {
+                | IF DOWNLOAD operator NUMBER PACKET currenttime sampled rate1 THEN action1 recovery {
                     bandwidthset.operator = $<number>3;
                     bandwidthset.limit = (unsigned long long)$4;
                     bandwidthset.rangecount = 1;
                     bandwidthset.range = $<number>6;
-                    addeventaction(&(bandwidthset).action, $<number>9, $<number>10);
+                    bandwidthset.sampled = $<number>7;
+                    addeventaction(&(bandwidthset).action, $<number>10, $<number>11);
                     addbandwidth(&(current->downloadpacketslist), &bandwidthset);
                   }
                 | IF TOTAL DOWNLOAD operator NUMBER PACKET totaltime rate1 THEN action1 recovery {
@@ -2290,11 +2960,14 @@ boolean_t parse(char *controlfile) {
         ASSERT(controlfile);
 
         servicelist = tail = current = NULL;
+        Util_resetServiceIndex();
+        file_resetControlFiles();
 
         if ((yyin = fopen(controlfile,"r")) == (FILE *)NULL) {
                 LogError("Cannot open the control file '%s' -- %s\n", controlfile, STRERROR);
                 return false;
         }
+        file_addControlFile(controlfile, false);
 
         currentfile = Str_dup(controlfile);
 
@@ -2307,6 +2980,7 @@ boolean_t parse(char *controlfile) {
                 yyparse();
                 fclose(yyin);
                 postparse();
+                releasetemplates();
         }
         END_LOCK;
 
@@ -2327,9 +3001,64 @@ boolean_t parse(char *controlfile) {
 }
 
 
+/*
+ * The lexer hook - called for every token to compute the fingerprint of
+ * the control file statements. The white space and comments are skipped,
+ * so reformatting the control file doesn't change the fingerprint
+ */
+void yydigest(const char *text, int length, boolean_t initial) {
+        if (! length || (initial && strchr(" \r\t\n;,()#\\", *text)))
+                return;
+        if (digest.set) {
+                /* The keyword after "set" qualifies the statement */
+                digest.set = false;
+                if (IS(text, "httpd"))
+                        digest.type = Statement_Httpd;
+                else if (IS(text, "mmonit"))
+                        digest.type = Statement_Mmonit;
+        }
+        digest.previous = digest.statement;
+        // Append the terminating zero too, so the token boundaries are part of the fingerprint
+        md5_append(&digest.statement, (const md5_byte_t *)text, length + 1);
+}
+
+
+/*
+ * The lexer hook - called after yydigest() for the keyword which starts
+ * a new statement ("set" or "check")
+ */
+void yystatement(const char *text, int length, boolean_t service) {
+        finishstatement(&digest.previous);
+        digest.type = service ? Statement_Service : Statement_Global;
+        digest.set = ! service;
+        md5_init(&digest.statement);
+        md5_append(&digest.statement, (const md5_byte_t *)text, length + 1);
+}
+
+
 /* ----------------------------------------------------------------- Private */
 
 
+/*
+ * Store the fingerprint of the finished statement: the service statement
+ * fingerprint is kept in the service, the other statements are summarized
+ * per section
+ */
+static void finishstatement(md5_context_t *ctx) {
+        unsigned char md5[16];
+        // The service is changed by the change of its template too
+        if (digest.type == Statement_Service && current && current->template)
+                md5_append(ctx, (const md5_byte_t *)current->template->rules->definition, sizeof(current->template->rules->definition));
+        md5_finish(ctx, md5);
+        if (digest.type == Statement_Service) {
+                if (current)
+                        Util_digest2Bytes(md5, 16, current->definition);
+        } else {
+                md5_append(&digest.section[digest.type], md5, 16);
+        }
+}
+
+
 /**
  * Initialize objects used by the parser.
  */
@@ -2344,21 +3073,58 @@ static void preparse() {
         arglineno                   = 1;
         argcurrentfile              = NULL;
         argyytext                   = NULL;
+        /* Reset the control file fingerprints */
+        memset(&digest, 0, sizeof(digest));
+        md5_init(&digest.statement);
+        for (int i = 0; i < Statement_Service; i++)
+                md5_init(&digest.section[i]);
         /* Reset parser */
         Run.stopped                 = false;
         Run.dolog                   = false;
+        Run.jsonlog                 = false;
         Run.doaction                = false;
         Run.dommonitcredentials     = true;
         Run.mmonitcredentials       = NULL;
         Run.httpd.flags             = Httpd_Disabled | Httpd_Signature;
+        Run.httpd.workers           = HTTPD_WORKERS;
+        Run.httpd.maxconnections    = HTTPD_MAXCONNECTIONS;
         Run.httpd.credentials       = NULL;
         memset(&(Run.httpd.socket), 0, sizeof(Run.httpd.socket));
+        Run.httpd.socket.net.ssl.sessioncache   = HTTPD_SESSIONCACHE;
+        Run.httpd.socket.net.ssl.sessiontimeout = HTTPD_SESSIONTIMEOUT;
         Run.mailserver_timeout      = SMTP_TIMEOUT;
         Run.eventlist               = NULL;
         Run.eventlist_dir           = NULL;
         Run.eventlist_slots         = -1;
+        Run.eventlist_buffer        = 0;
+        Run.eventlist_batch         = EVENTQUEUE_BATCH;
+        Run.eventlist_replay        = EVENTQUEUE_REPLAY;
+        Run.statesync               = 0;
+        Run.historyfile             = NULL;
+        Run.historyslots            = HISTORY_SLOTS;
+        Run.statusfile              = NULL;
         Run.system                  = NULL;
         Run.expectbuffer            = STRLEN;
+        Run.socketbuffer            = SOCKET_BUFFER;
+        Run.scheduler_workers       = 0;
+        Run.control_workers         = 0;
+        Run.process_workers         = 0;
+        Run.spawnlimit              = 0;
+        Run.restartlimit            = 0;
+        Run.dnscache                = 0;
+        Run.mmonitdelta             = 0;
+        Run.mmonitjitter            = 0;
+        Run.mmonitparallel          = Mmonit_Sequential;
+        Run.processevents           = false;
+        Run.programevents           = false;
+        Run.programlimit            = 0;
+        Run.fileevents              = false;
+        Run.networkevents           = false;
+        Run.relay                   = false;
+        Run.powersave               = false;
+        Run.dependsuppress          = false;
+        Run.cluster.peers           = NULL;
+        Run.cluster.replicas        = 1;
         Run.mmonits                 = NULL;
         Run.maillist                = NULL;
         Run.mailservers             = NULL;
@@ -2369,6 +3135,7 @@ static void preparse() {
         depend_list                 = NULL;
         Run.handler_init            = true;
         Run.fipsEnabled             = false;
+        systeminfo.percpu           = false;
         for (i = 0; i <= Handler_Max; i++)
                 Run.handler_queue[i] = 0;
         /*
@@ -2407,6 +3174,16 @@ static void postparse() {
         if (current)
                 addservice(current);
 
+        /* Complete the control file fingerprints */
+        finishstatement(&digest.statement);
+        unsigned char md5[16];
+        md5_finish(&digest.section[Statement_Global], md5);
+        Util_digest2Bytes(md5, 16, Run.digest.global);
+        md5_finish(&digest.section[Statement_Httpd], md5);
+        Util_digest2Bytes(md5, 16, Run.digest.httpd);
+        md5_finish(&digest.section[Statement_Mmonit], md5);
+        Util_digest2Bytes(md5, 16, Run.digest.mmonit);
+
         /* Check that we do not start monit in daemon mode without having a poll time */
         if (! Run.polltime && (Run.isdaemon || Run.init)) {
                 LogError("Poll time is invalid or not defined. Please define poll time in the control file\nas a number (> 0)  or use the -d option when starting monit\n");
@@ -2429,9 +3206,18 @@ static void postparse() {
                 } else {
                         Run.system = createservice(Service_System, Str_dup(hostname), Str_dup(""), check_system);
                         addservice(Run.system);
+                        /* The automatic system service is defined by its name */
+                        md5_context_t ctx;
+                        md5_init(&ctx);
+                        md5_append(&ctx, (const md5_byte_t *)hostname, (int)strlen(hostname));
+                        md5_finish(&ctx, md5);
+                        Util_digest2Bytes(md5, 16, Run.system->definition);
                 }
         }
 
+        /* Lay out the check results of all services in one table */
+        Util_buildInfoTable();
+
         if (Run.mmonits) {
                 if (Run.httpd.flags & Httpd_Net || Run.httpd.flags & Httpd_Unix) {
                         if (Run.dommonitcredentials) {
@@ -2450,6 +3236,18 @@ static void postparse() {
                 }
         }
 
+        /* The relay receives the messages using the http interface and forwards them to M/Monit */
+        if (Run.relay && (! Run.mmonits || ! (Run.httpd.flags & Httpd_Net || Run.httpd.flags & Httpd_Unix))) {
+                LogError("The M/Monit relay requires the 'set mmonit' and 'set httpd' statements\n");
+                cfg_errflag++;
+        }
+
+        /* The cluster peers agree on the membership using the http interface */
+        if (Run.cluster.peers && ! (Run.httpd.flags & Httpd_Net || Run.httpd.flags & Httpd_Unix)) {
+                LogError("The monit cluster requires the 'set httpd' statement\n");
+                cfg_errflag++;
+        }
+
         /* Check the sanity of any dependency graph */
         check_depend();
 
@@ -2473,6 +3271,7 @@ static Service_T createservice(Service_Type type, char *name, char *value, boole
                 addservice(current);
 
         NEW(current);
+        current->arena = Arena_new();
 
         current->type = type;
 
@@ -2516,6 +3315,10 @@ static Service_T createservice(Service_Type type, char *name, char *value, boole
 static void addservice(Service_T s) {
         ASSERT(s);
 
+        // The template rules holder is not a service
+        if (istemplate(s))
+                return;
+
         // Test sanity check
         switch (s->type) {
                 case Service_Host:
@@ -2531,6 +3334,8 @@ static void addservice(Service_T s) {
                                 LogError("'check program %s' is incomplete: Please add an 'if status != n' test\n", s->name);
                                 cfg_errflag++;
                         }
+                        if (s->program->plugin)
+                                break; // The plugin runs in-process, there is no command
                         // Create the Command object
                         s->program->C = Command_new(s->path, NULL);
                         // Append any arguments
@@ -2541,6 +3346,20 @@ static void addservice(Service_T s) {
                         if (s->program->args->has_gid)
                                 Command_setGid(s->program->C, s->program->args->gid);
                         break;
+                case Service_Processes:
+                        // Verify that a processes test has a resource test
+                        if (! s->resourcelist) {
+                                LogError("'check processes %s' is incomplete: Please add a cpu or memory test\n", s->name);
+                                cfg_errflag++;
+                        }
+                        for (Resource_T r = s->resourcelist; r; r = r->next) {
+                                if (r->window) {
+                                        LogError("'check processes %s': the average resource tests are not supported, the processes are tested individually\n", s->name);
+                                        cfg_errflag++;
+                                        break;
+                                }
+                        }
+                        break;
                 case Service_Net:
                         if (! s->linkstatuslist) {
                                 // Add link status test if not defined
@@ -2555,9 +3374,21 @@ static void addservice(Service_T s) {
                                 addfsflag(&fsflagset);
                         }
                         break;
+                case Service_File:
+                        // Verify that the file instances template tests the content only
+                        if (s->instance.max) {
+                                if (! s->matchlist) {
+                                        LogError("'check file %s' with the wildcard path is incomplete: Please add a content match test\n", s->name);
+                                        cfg_errflag++;
+                                }
+                                if (s->checksum || s->perm || s->uid || s->gid || s->sizelist || s->timestamplist) {
+                                        LogError("'check file %s': only the content match and existence tests are supported for the wildcard path\n", s->name);
+                                        cfg_errflag++;
+                                }
+                        }
+                        // Fall through
                 case Service_Directory:
                 case Service_Fifo:
-                case Service_File:
                 case Service_Process:
                         if (! s->nonexistlist) {
                                 // Add existence test if not defined
@@ -2569,6 +3400,9 @@ static void addservice(Service_T s) {
                         break;
         }
 
+        /* Compile the resource rules into the flat evaluation table */
+        validate_compileRules(s);
+
         /* Add the service to the end of the service list */
         if (tail != NULL) {
                 tail->next = s;
@@ -2578,6 +3412,98 @@ static void addservice(Service_T s) {
                 servicelist_conf = s;
         }
         tail = s;
+        Util_addServiceIndex(s);
+}
+
+
+/*
+ * Create a new rule template, the following process rules are added to
+ * its holder, which is current until the next statement
+ */
+static void createtemplate(char *name) {
+        ASSERT(name);
+
+        for (Template_T t = templatelist; t; t = t->next)
+                if (IS(t->name, name))
+                        yyerror2("Template name conflict, %s already defined", name);
+
+        if (current)
+                addservice(current);
+
+        Template_T t;
+        NEW(t);
+        t->name = name;
+        t->references = 1; // The parser's reference, see releasetemplates()
+        NEW(t->rules);
+        t->rules->arena = Arena_new();
+        t->rules->type = Service_Process;
+        t->rules->name = name;
+        t->next = templatelist;
+        templatelist = t;
+        current = t->rules;
+}
+
+
+/*
+ * Append the template rules to the current service rule lists. The rules
+ * are shared: the template lists become the tail of the service lists, so
+ * the service own rules are prepended to them as usual
+ */
+static void usetemplate(char *name) {
+        ASSERT(name);
+
+        Template_T t;
+        for (t = templatelist; t; t = t->next)
+                if (IS(t->name, name))
+                        break;
+        if (! t) {
+                yyerror2("Template %s is not defined, the template must be defined before it is used", name);
+        } else if (current->template) {
+                yyerror2("The service can use one template only");
+        } else {
+                Service_T r = t->rules;
+                APPENDRULES(Resource_T, current->resourcelist, r->resourcelist);
+                APPENDRULES(Uptime_T, current->uptimelist, r->uptimelist);
+                APPENDRULES(Pid_T, current->pidlist, r->pidlist);
+                APPENDRULES(Pid_T, current->ppidlist, r->ppidlist);
+                APPENDRULES(ActionRate_T, current->actionratelist, r->actionratelist);
+                APPENDRULES(Nonexist_T, current->nonexistlist, r->nonexistlist);
+                if (! current->uid)
+                        current->uid = r->uid;
+                if (! current->euid)
+                        current->euid = r->euid;
+                if (! current->gid)
+                        current->gid = r->gid;
+                // The samplers hold the service data, each service has its own
+                for (Resource_T q = r->resourcelist; q; q = q->next)
+                        if (q->sampled)
+                                Sampler_add(current, Sampler_getType(q->resource_id), q->sampled);
+                t->references++;
+                current->template = t;
+        }
+        FREE(name);
+}
+
+
+/*
+ * Return true if the service is the rules holder of the template being parsed
+ */
+static boolean_t istemplate(Service_T s) {
+        return templatelist && s == templatelist->rules;
+}
+
+
+/*
+ * Release the parser's references of the templates, the templates which
+ * are not used by any service are freed
+ */
+static void releasetemplates() {
+        while (templatelist) {
+                Template_T t = templatelist;
+                templatelist = t->next;
+                t->next = NULL;
+                gc_template(&t);
+        }
 }
 
 
@@ -2618,12 +3544,13 @@ static void adddependant(char *dependant) {
 
         ASSERT(dependant);
 
-        NEW(d);
+        ARENA_NEW(current->arena, d);
 
         if (current->dependantlist)
                 d->next = current->dependantlist;
 
-        d->dependant = dependant;
+        d->dependant = Arena_dup(current->arena, dependant);
+        FREE(dependant);
         current->dependantlist = d;
 
 }
@@ -2668,6 +3595,9 @@ static void addport(Port_T *list, Port_T port) {
         p->action             = port->action;
         p->timeout            = port->timeout;
         p->retry              = port->retry;
+        p->keepalive          = port->keepalive;
+        p->fullevery          = port->fullevery;
+        p->recheck            = port->recheck;
         p->request            = port->request;
         p->generic            = port->generic;
         p->protocol           = port->protocol;
@@ -2702,11 +3632,20 @@ static void addport(Port_T *list, Port_T port) {
                 }
                 p->SSL.use_ssl = true;
                 p->SSL.version = port->SSL.version;
+                p->SSL.alpn = port->SSL.alpn;
 #else
                 yyerror("SSL check cannot be activated -- SSL disabled");
 #endif
         }
+        p->reset = port->reset;
+        if (p->reset && (p->type != Socket_Tcp || (p->protocol != Protocol_get(Protocol_DEFAULT) && p->fullevery < 2)))
+                yyerror("The connection reset is supported by the TCP connection test without protocol or with the full protocol test interval only");
+        p->certificate.days = port->certificate.days;
+        if (p->certificate.days && ! p->SSL.use_ssl)
+                yyerror("The certificate validity test requires an SSL connection");
         p->maxforward = port->maxforward;
+        if (p->fullevery > 1 && (p->type == Socket_Udp || p->keepalive))
+                yyerror("The full protocol test interval is not supported by the UDP and keepalive port tests");
         p->next = *list;
         *list = p;
 
@@ -2723,20 +3662,83 @@ static void addresource(Resource_T rr) {
 
         ASSERT(rr);
 
-        NEW(r);
+        ARENA_NEW(current->arena, r);
         if (! Run.doprocess)
                 yyerror("Cannot activate service check. The process status engine was disabled. On certain systems you must run monit as root to utilize this feature)\n");
         r->resource_id = rr->resource_id;
         r->limit       = rr->limit;
         r->action      = rr->action;
         r->operator    = rr->operator;
+        r->window      = rr->window;
+        r->sampled     = rr->sampled;
         r->next        = current->resourcelist;
+        if (r->resource_id == Resource_CpuMax || r->resource_id == Resource_CpuNodeMax)
+                systeminfo.percpu = true;
+        if (r->sampled) {
+                Sample_Type type = Sampler_getType(r->resource_id);
+                if (type == Sample_Last || (type == Sample_Cpu && current->type != Service_Process))
+                        yyerror2("The resource cannot be sampled, only the process cpu usage and the system cpu user, system and wait usage can");
+                else if (! istemplate(current)) // The template users add their own samplers
+                        Sampler_add(current, type, r->sampled);
+        }
 
         current->resourcelist = r;
         reset_resourceset();
 }
 
 
+/*
+ * Set the average resource rule: the percent limit (unit 0) keeps the
+ * resource, a byte unit selects the memory/swap amount, the counts and
+ * the load average take the plain number
+ */
+static void setaverage(int id, int window, int operator, float value, int unit) {
+        if (window <= 0)
+                yyerror2("The average time window must be greater than zero");
+        resourceset.operator = operator;
+        resourceset.window = window;
+        switch (id) {
+                case Resource_MemoryPercent:
+                case Resource_MemoryPercentTotal:
+                case Resource_SwapPercent:
+                        if (unit) {
+                                resourceset.resource_id = id == Resource_MemoryPercent ? Resource_MemoryKbyte : id == Resource_MemoryPercentTotal ? Resource_MemoryKbyteTotal : Resource_SwapKbyte;
+                                resourceset.limit = (long)(value * (unit / 1024.0));
+                                return;
+                        }
+                        break;
+                case Resource_Children:
+                case Resource_Tasks:
+                case Resource_FileDescriptors:
+                        if (unit) {
+                                resourceset.resource_id = id;
+                                resourceset.limit = (long)value;
+                                return;
+                        }
+                        yyerror2("The average %s test doesn't take a percent limit", id == Resource_Children ? "children" : id == Resource_Tasks ? "tasks" : "file descriptors");
+                        return;
+                case Resource_LoadAverage1m:
+                case Resource_LoadAverage5m:
+                case Resource_LoadAverage15m:
+                        if (unit) {
+                                resourceset.resource_id = id;
+                                resourceset.limit = (long)(value * 10.0);
+                                return;
+                        }
+                        yyerror2("The average load test doesn't take a percent limit");
+                        return;
+                default:
+                        if (unit) {
+                                yyerror2("The average cpu test requires a percent limit");
+                                return;
+                        }
+                        break;
+        }
+        resourceset.resource_id = id;
+        resourceset.limit = (long)(value * 10.0);
+}
+
+
 /*
  * Add a new file object to the current service timestamp list
  */
@@ -2745,7 +3747,7 @@ static void addtimestamp(Timestamp_T ts, boolean_t notime) {
 
         ASSERT(ts);
 
-        NEW(t);
+        ARENA_NEW(current->arena, t);
         t->operator     = ts->operator;
         t->time         = ts->time;
         t->action       = ts->action;
@@ -2778,7 +3780,7 @@ static void addactionrate(ActionRate_T ar) {
         if (ar->count <= 0 || ar->cycle <= 0)
                 yyerror2("Zero or negative values not allowed in a action rate statement");
 
-        NEW(a);
+        ARENA_NEW(current->arena, a);
         a->count  = ar->count;
         a->cycle  = ar->cycle;
         a->action = ar->action;
@@ -2800,11 +3802,12 @@ static void addsize(Size_T ss) {
 
         ASSERT(ss);
 
-        NEW(s);
+        ARENA_NEW(current->arena, s);
         s->operator     = ss->operator;
         s->size         = ss->size;
         s->action       = ss->action;
         s->test_changes = ss->test_changes;
+        s->rate         = ss->rate;
         /* Get the initial size for future comparision, if the file exists */
         if (s->test_changes) {
                 s->initialized = ! stat(current->path, &buf);
@@ -2827,7 +3830,7 @@ static void adduptime(Uptime_T uu) {
 
         ASSERT(uu);
 
-        NEW(u);
+        ARENA_NEW(current->arena, u);
         u->operator = uu->operator;
         u->uptime = uu->uptime;
         u->action = uu->action;
@@ -2846,7 +3849,7 @@ static void addpid(Pid_T pp) {
         ASSERT(pp);
 
         Pid_T p;
-        NEW(p);
+        ARENA_NEW(current->arena, p);
         p->action = pp->action;
 
         p->next = current->pidlist;
@@ -2863,7 +3866,7 @@ static void addppid(Pid_T pp) {
         ASSERT(pp);
 
         Pid_T p;
-        NEW(p);
+        ARENA_NEW(current->arena, p);
         p->action = pp->action;
 
         p->next = current->ppidlist;
@@ -2880,7 +3883,7 @@ static void addfsflag(Fsflag_T ff) {
         ASSERT(ff);
 
         Fsflag_T f;
-        NEW(f);
+        ARENA_NEW(current->arena, f);
         f->action = ff->action;
 
         f->next = current->fsflaglist;
@@ -2897,7 +3900,7 @@ static void addnonexist(Nonexist_T ff) {
         ASSERT(ff);
 
         Nonexist_T f;
-        NEW(f);
+        ARENA_NEW(current->arena, f);
         f->action = ff->action;
 
         f->next = current->nonexistlist;
@@ -2915,7 +3918,15 @@ static void addchecksum(Checksum_T cs) {
 
         cs->initialized = true;
 
-        if (! *cs->hash) {
+        if (current->type == Service_Directory) {
+                /* The tree checksum is computed in the background, unless the expected checksum was set, the first result is expected */
+                if (! *cs->hash) {
+                        if (cs->type == Hash_Unknown)
+                                cs->type = Hash_Default;
+                        snprintf(cs->hash, sizeof(cs->hash), cs->type == Hash_Md5 ? "00000000000000000000000000000000" : "0000000000000000000000000000000000000000");
+                        cs->initialized = false;
+                }
+        } else if (! *cs->hash) {
                 if (cs->type == Hash_Unknown)
                         cs->type = Hash_Default;
                 if (! (Util_getChecksum(current->path, cs->type, cs->hash, sizeof(cs->hash)))) {
@@ -2945,12 +3956,15 @@ static void addchecksum(Checksum_T cs) {
         }
 
         Checksum_T c;
-        NEW(c);
+        ARENA_NEW(current->arena, c);
         c->type         = cs->type;
         c->test_changes = cs->test_changes;
         c->initialized  = cs->initialized;
+        c->verify       = cs->verify;
         c->action       = cs->action;
         snprintf(c->hash, sizeof(c->hash), "%s", cs->hash);
+        if (current->type == Service_Directory)
+                c->tree = Merkle_new(current->path, c->type);
 
         current->checksum = c;
 
@@ -2966,7 +3980,7 @@ static void addperm(Perm_T ps) {
         ASSERT(ps);
 
         Perm_T p;
-        NEW(p);
+        ARENA_NEW(current->arena, p);
         p->action = ps->action;
         p->test_changes = ps->test_changes;
         if (p->test_changes) {
@@ -2984,11 +3998,69 @@ static void addperm(Perm_T ps) {
 }
 
 
+/*
+ * Add the control group statistics to the current service. The path is
+ * NULL if the statistics are read from the cgroup of the process
+ */
+static void addcgroup(char *path) {
+        if (! Cgroup_isSupported()) {
+                yyerror("Control groups are not available on this system");
+                return;
+        }
+        if (! current->cgroup) {
+                NEW(current->cgroup);
+                Cgroup_reset(current->cgroup);
+        }
+        current->cgroup->path = path;
+}
+
+
+/*
+ * Set the maximum instances of the template: the process service with the
+ * matching pattern, the file service with a wildcard path or 'check filesystem all'
+ */
+static void addinstances(int max) {
+        if (current->type == Service_Process ? ! current->matchlist : ! current->instance.max)
+                yyerror2("The instances require the process 'matching' pattern, the file path wildcard or 'check filesystem all'");
+        else if (max < 1 || max > INSTANCES_MAX)
+                yyerror2("The number of instances must be between 1 and %d", INSTANCES_MAX);
+        else
+                current->instance.max = max;
+}
+
+
+/*
+ * Set the cron spec of the 'every' statement, the spec is compiled once here
+ */
+static void addcron(char *spec) {
+        current->every.spec.cron.spec = spec;
+        ARENA_NEW(current->arena, current->every.spec.cron.schedule);
+        if (! Cron_compile(spec, current->every.spec.cron.schedule))
+                yyerror2("Invalid cron specification '%s'", spec);
+}
+
+
+/*
+ * Add the filesystem type to the list of types excluded by 'check filesystem all'
+ */
+static void addfstype(char *type) {
+        int count = 0;
+        while (fstypeset && fstypeset[count])
+                count++;
+        if (fstypeset)
+                RESIZE(fstypeset, (count + 2) * sizeof(char *));
+        else
+                fstypeset = CALLOC(2, sizeof(char *));
+        fstypeset[count] = type;
+        fstypeset[count + 1] = NULL;
+}
+
+
 static void addlinkstatus(Service_T s, LinkStatus_T L) {
         ASSERT(L);
         
         LinkStatus_T l;
-        NEW(l);
+        ARENA_NEW(s->arena, l);
         l->action = L->action;
         
         l->next = s->linkstatuslist;
@@ -3002,7 +4074,7 @@ static void addlinkspeed(Service_T s, LinkSpeed_T L) {
         ASSERT(L);
         
         LinkSpeed_T l;
-        NEW(l);
+        ARENA_NEW(s->arena, l);
         l->action = L->action;
         
         l->next = s->linkspeedlist;
@@ -3016,7 +4088,7 @@ static void addlinksaturation(Service_T s, LinkSaturation_T L) {
         ASSERT(L);
         
         LinkSaturation_T l;
-        NEW(l);
+        ARENA_NEW(s->arena, l);
         l->operator = L->operator;
         l->limit = L->limit;
         l->action = L->action;
@@ -3050,12 +4122,23 @@ static void addbandwidth(Bandwidth_T *list, Bandwidth_T b) {
                         b->range = Time_Hour;
                 }
                 Bandwidth_T bandwidth;
-                NEW(bandwidth);
+                ARENA_NEW(current->arena, bandwidth);
                 bandwidth->operator = b->operator;
                 bandwidth->limit = b->limit;
                 bandwidth->rangecount = b->rangecount;
                 bandwidth->range = b->range;
+                bandwidth->sampled = b->sampled;
                 bandwidth->action = b->action;
+                if (b->sampled) {
+                        if (list == &current->uploadbyteslist)
+                                Sampler_add(current, Sample_BytesOut, b->sampled);
+                        else if (list == &current->uploadpacketslist)
+                                Sampler_add(current, Sample_PacketsOut, b->sampled);
+                        else if (list == &current->downloadbyteslist)
+                                Sampler_add(current, Sample_BytesIn, b->sampled);
+                        else
+                                Sampler_add(current, Sample_PacketsIn, b->sampled);
+                }
                 bandwidth->next = *list;
                 *list = bandwidth;
         }
@@ -3110,6 +4193,7 @@ static void addmatch(Match_T ms, int actionnumber, int linenumber) {
                 else
                         yyerror2("Regex parsing error: %s", errbuf);
         }
+        m->literal = Util_getRegexLiteral(m->match_string);
 #endif
         appendmatch(m->ignore ? &current->matchignorelist : &current->matchlist, m);
 }
@@ -3129,6 +4213,7 @@ static void addmatchpath(Match_T ms, Action_Type actionnumber) {
                 yyerror2("Cannot read regex match file (%s)", ms->match_path);
                 return;
         }
+        file_addControlFile(ms->match_path, false);
 
         while (! feof(handle)) {
                 size_t len;
@@ -3175,7 +4260,7 @@ static void addmatchpath(Match_T ms, Action_Type actionnumber) {
 static void addstatus(Status_T status) {
         Status_T s;
         ASSERT(status);
-        NEW(s);
+        ARENA_NEW(current->arena, s);
         s->initialized = status->initialized;
         s->return_value = status->return_value;
         s->operator = status->operator;
@@ -3194,7 +4279,7 @@ static Uid_T adduid(Uid_T u) {
         ASSERT(u);
 
         Uid_T uid;
-        NEW(uid);
+        ARENA_NEW(current->arena, uid);
         uid->uid = u->uid;
         uid->action = u->action;
         reset_uidset();
@@ -3209,7 +4294,7 @@ static Gid_T addgid(Gid_T g) {
         ASSERT(g);
 
         Gid_T gid;
-        NEW(gid);
+        ARENA_NEW(current->arena, gid);
         gid->gid = g->gid;
         gid->action = g->action;
         reset_gidset();
@@ -3225,7 +4310,7 @@ static void addfilesystem(Filesystem_T ds) {
 
         ASSERT(ds);
 
-        NEW(dev);
+        ARENA_NEW(current->arena, dev);
         dev->resource           = ds->resource;
         dev->operator           = ds->operator;
         dev->limit_absolute     = ds->limit_absolute;
@@ -3248,7 +4333,7 @@ static void addicmp(Icmp_T is) {
 
         ASSERT(is);
 
-        NEW(icmp);
+        ARENA_NEW(current->arena, icmp);
         icmp->family       = is->family;
         icmp->type         = is->type;
         icmp->count        = is->count;
@@ -3272,17 +4357,17 @@ static void addeventaction(EventAction_T *_ea, Action_Type failed, Action_Type s
 
         ASSERT(_ea);
 
-        NEW(ea);
-        NEW(ea->failed);
-        NEW(ea->succeeded);
+        ARENA_NEW(current->arena, ea);
+        ARENA_NEW(current->arena, ea->failed);
+        ARENA_NEW(current->arena, ea->succeeded);
 
         ea->failed->id     = failed;
         ea->failed->count  = rate1.count;
         ea->failed->cycles = rate1.cycles;
         if (failed == Action_Exec) {
                 ASSERT(command1);
-                ea->failed->exec = command1;
-                command1 = NULL;
+                ea->failed->exec = arenacommand(command1);
+                gccmd(&command1);
         }
 
         ea->succeeded->id     = succeeded;
@@ -3290,8 +4375,8 @@ static void addeventaction(EventAction_T *_ea, Action_Type failed, Action_Type s
         ea->succeeded->cycles = rate2.cycles;
         if (succeeded == Action_Exec) {
                 ASSERT(command2);
-                ea->succeeded->exec = command2;
-                command2 = NULL;
+                ea->succeeded->exec = arenacommand(command2);
+                gccmd(&command2);
         }
         *_ea = ea;
         reset_rateset();
@@ -3437,7 +4522,7 @@ static void  seturlrequest(int operator, char *regex) {
 /*
  * Add a new data recipient server to the mmonit server list
  */
-static void addmmonit(URL_T url, int timeout, Ssl_Version sslversion, char *certmd5) {
+static void addmmonit(URL_T url, int timeout, Ssl_Version sslversion, char *certmd5, boolean_t json) {
         Mmonit_T c;
 
         ASSERT(url);
@@ -3457,6 +4542,7 @@ static void addmmonit(URL_T url, int timeout, Ssl_Version sslversion, char *cert
 #endif
         }
         c->timeout = timeout;
+        c->json = json;
         c->next = NULL;
 
         if (Run.mmonits) {
@@ -3470,6 +4556,28 @@ static void addmmonit(URL_T url, int timeout, Ssl_Version sslversion, char *cert
 }
 
 
+/*
+ * Add a new peer to the cluster member list
+ */
+static void addpeer(URL_T url) {
+        Peer_T p, *last;
+
+        ASSERT(url);
+        if (IS(url->protocol, "https")) {
+#ifndef HAVE_OPENSSL
+                yyerror("SSL cluster peer cannot be used -- SSL disabled");
+#endif
+        } else if (! IS(url->protocol, "http")) {
+                yyerror2("Unsupported cluster peer protocol '%s' -- use http or https", url->protocol);
+        }
+        NEW(p);
+        p->url = url;
+        for (last = &Run.cluster.peers; *last; last = &(*last)->next)
+                /* Empty */ ;
+        *last = p;
+}
+
+
 /*
  * Add a new smtp server to the mail server list
  */
@@ -3633,6 +4741,7 @@ static void addhtpasswdentry(char *filename, char *username, Digest_Type dtype)
         ASSERT(filename);
 
         handle = fopen(filename, "r");
+        file_addControlFile(filename, false);
 
         if ( handle == NULL ) {
                 if (username != NULL)
@@ -3855,6 +4964,8 @@ static void reset_resourceset() {
         resourceset.limit = 0;
         resourceset.action = NULL;
         resourceset.operator = Operator_Equal;
+        resourceset.window = 0;
+        resourceset.sampled = 0;
 }
 
 
@@ -3886,6 +4997,7 @@ static void reset_sizeset() {
         sizeset.operator = Operator_Equal;
         sizeset.size = 0;
         sizeset.test_changes = false;
+        sizeset.rate = 0;
         sizeset.action = NULL;
 }
 
@@ -3923,6 +5035,7 @@ static void reset_linksaturationset() {
 static void reset_bandwidthset() {
         bandwidthset.operator = Operator_Equal;
         bandwidthset.limit = 0ULL;
+        bandwidthset.sampled = 0;
         bandwidthset.action = NULL;
 }
 
@@ -3965,6 +5078,7 @@ static void reset_nonexistset() {
 static void reset_checksumset() {
         checksumset.type         = Hash_Unknown;
         checksumset.test_changes = false;
+        checksumset.verify       = 0;
         checksumset.action       = NULL;
         *checksumset.hash        = 0;
 }
@@ -4107,6 +5221,7 @@ static void check_depend() {
                                         LogError("Depend service '%s' is not defined in the control file\n", d->dependant);
                                         exit(1);
                                 }
+                                d->service = dp;
                                 if (! dp->visited) {
                                         depends_on = dp;
                                 }
@@ -4184,6 +5299,25 @@ static int cleanup_hash_string(char *hashstring) {
 }
 
 
+/* Return deep copy of the command allocated from the current service arena */
+static command_t arenacommand(command_t source) {
+        command_t copy = NULL;
+
+        ARENA_NEW(current->arena, copy);
+        copy->length = source->length;
+        copy->has_uid = source->has_uid;
+        copy->uid = source->uid;
+        copy->has_gid = source->has_gid;
+        copy->gid = source->gid;
+        copy->timeout = source->timeout;
+        for (int i = 0; i < copy->length; i++)
+                copy->arg[i] = Arena_dup(current->arena, source->arg[i]);
+        copy->arg[copy->length] = NULL;
+
+        return copy;
+}
+
+
 /* Return deep copy of the command */
 static command_t copycommand(command_t source) {
         int i;
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
+#include "monit.h"
+#include "plugin.h"
+
+// libmonit
+#include "system/Time.h"
+
+/**
+ *  Check plugin loader.
+ *
+ *  The plugin object is referenced by the service and by the running
+ *  check thread, so a check which timed out may still return after the
+ *  service was freed by reload, the last reference unloads the plugin.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+struct myplugin {
+        char *path;                                         /**< The plugin path */
+        void *handle;                                    /**< The dlopen() handle */
+        const monit_plugin_t *plugin;                   /**< The plugin interface */
+        void *context;                                 /**< The instance context */
+        int refcount;                      /**< The service and the running check */
+        int timeout;                       /**< The timeout of the running check */
+        boolean_t pending;                     /**< true while the check is running */
+        int status;                                  /**< The status of the check */
+        monit_plugin_result_t result;    /**< The result written by the check thread */
+        int metrics;                    /**< Number of metrics of the last result */
+        monit_plugin_metric_t metric[MONIT_PLUGIN_METRICS]; /**< Metrics of the last result */
+};
+
+
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+static Sem_T finished = PTHREAD_COND_INITIALIZER;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static void _unload(Plugin_T P) {
+#ifdef HAVE_DLFCN_H
+        if (P->plugin && P->plugin->done)
+                P->plugin->done(P->context);
+        if (P->handle)
+                dlclose(P->handle);
+#endif
+        FREE(P->path);
+        FREE(P);
+}
+
+
+/* Must be called with the mutex locked, returns true if the caller should unload the plugin */
+static boolean_t _release(Plugin_T P) {
+        return --P->refcount == 0;
+}
+
+
+static void *_checkThread(void *args) {
+        Plugin_T P = args;
+        int status = P->plugin->check(P->context, P->timeout, &P->result);
+        boolean_t unload;
+        LOCK(mutex)
+        {
+                P->status = status;
+                P->pending = false;
+                unload = _release(P);
+                Sem_broadcast(finished);
+        }
+        END_LOCK;
+        if (unload)
+                _unload(P);
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+Plugin_T Plugin_new(const char *path, command_t args) {
+        ASSERT(path);
+        ASSERT(args);
+#ifdef HAVE_DLFCN_H
+        void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (! handle) {
+                LogError("Cannot load plugin '%s' -- %s\n", path, dlerror());
+                return NULL;
+        }
+        const monit_plugin_t *plugin = dlsym(handle, MONIT_PLUGIN_SYMBOL);
+        if (! plugin) {
+                LogError("Plugin '%s' doesn't export the '%s' symbol\n", path, MONIT_PLUGIN_SYMBOL);
+                dlclose(handle);
+                return NULL;
+        }
+        if (plugin->abi != MONIT_PLUGIN_ABI || ! plugin->check) {
+                LogError("Plugin '%s' uses an unsupported ABI version %d (expected %d) or has no check function\n", path, plugin->abi, MONIT_PLUGIN_ABI);
+                dlclose(handle);
+                return NULL;
+        }
+        void *context = NULL;
+        if (plugin->init && ! (context = plugin->init(args->length, args->arg))) {
+                LogError("Plugin '%s' initialization failed\n", path);
+                dlclose(handle);
+                return NULL;
+        }
+        Plugin_T P;
+        NEW(P);
+        P->path = Str_dup(path);
+        P->handle = handle;
+        P->plugin = plugin;
+        P->context = context;
+        P->refcount = 1;
+        return P;
+#else
+        LogError("Cannot load plugin '%s' -- plugins are not supported on this platform\n", path);
+        return NULL;
+#endif
+}
+
+
+boolean_t Plugin_check(Plugin_T P, int timeout, int *status, StringBuffer_T output) {
+        ASSERT(P);
+        ASSERT(status);
+        ASSERT(output);
+        boolean_t pending;
+        LOCK(mutex)
+        {
+                if (! (pending = P->pending)) {
+                        P->pending = true;
+                        P->refcount++;
+                        P->timeout = timeout;
+                        memset(&P->result, 0, sizeof(P->result));
+                }
+        }
+        END_LOCK;
+        if (pending) {
+                StringBuffer_append(output, "the previous check did not return yet");
+                return false;
+        }
+        volatile boolean_t started = false;
+        TRY
+        {
+                Thread_T thread;
+                Thread_create(thread, _checkThread, P);
+                Thread_detach(thread);
+                started = true;
+        }
+        ELSE
+        {
+                LogError("Plugin '%s' cannot create thread -- %s\n", P->path, Exception_frame.message);
+        }
+        END_TRY;
+        if (! started) // Fallback to the synchronous check
+                _checkThread(P);
+        boolean_t done = false;
+        LOCK(mutex)
+        {
+                struct timespec wait = {.tv_sec = Time_now() + timeout, .tv_nsec = 0};
+                while (P->pending && Time_now() < wait.tv_sec)
+                        Sem_timeWait(finished, mutex, wait);
+                if ((done = ! P->pending)) {
+                        *status = P->status;
+                        P->result.message[sizeof(P->result.message) - 1] = 0;
+                        StringBuffer_append(output, "%s", P->result.message);
+                        P->metrics = P->result.metrics < 0 ? 0 : P->result.metrics > MONIT_PLUGIN_METRICS ? MONIT_PLUGIN_METRICS : P->result.metrics;
+                        for (int i = 0; i < P->metrics; i++) {
+                                P->metric[i] = P->result.metric[i];
+                                P->metric[i].name[sizeof(P->metric[i].name) - 1] = 0;
+                        }
+                }
+        }
+        END_LOCK;
+        if (! done)
+                StringBuffer_append(output, "the check timed out after %d seconds", timeout);
+        return done;
+}
+
+
+int Plugin_getMetrics(Plugin_T P, monit_plugin_metric_t metrics[MONIT_PLUGIN_METRICS]) {
+        ASSERT(P);
+        ASSERT(metrics);
+        int count;
+        LOCK(mutex)
+        {
+                count = P->metrics;
+                memcpy(metrics, P->metric, count * sizeof(monit_plugin_metric_t));
+        }
+        END_LOCK;
+        return count;
+}
+
+
+void Plugin_free(Plugin_T *P) {
+        ASSERT(P && *P);
+        boolean_t unload;
+        LOCK(mutex)
+        {
+                if (! (unload = _release(*P)))
+                        LogWarning("Plugin '%s' check is still running, the plugin will be unloaded when it returns\n", (*P)->path);
+        }
+        END_LOCK;
+        if (unload)
+                _unload(*P);
+        *P = NULL;
+}
+
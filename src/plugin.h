@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#ifndef MONIT_PLUGIN_H
+#define MONIT_PLUGIN_H
+
+#include "monit_plugin.h"
+
+
+/**
+ * Check plugin loader.
+ *
+ * Loads the check plugins of the "check program" services which use the
+ * "with plugin" statement and runs their checks in a helper thread with
+ * a timeout guard, see monit_plugin.h for the plugin ABI.
+ *
+ *  @file
+ */
+
+
+/**
+ * Load the plugin and create its instance for the service
+ * @param path The plugin shared object path
+ * @param args The plugin arguments, args->arg[0] is the path
+ * @return The plugin object or NULL if the plugin cannot be loaded, the
+ * error is logged
+ */
+Plugin_T Plugin_new(const char *path, command_t args);
+
+
+/**
+ * Run the plugin check in a helper thread and wait up to the timeout. If
+ * the previous check did not return yet, the check is not started
+ * @param P The plugin object
+ * @param timeout The timeout in seconds
+ * @param status Output of the check status
+ * @param output Output of the check message, or the error if failed
+ * @return true if the check returned within the timeout, otherwise false
+ */
+boolean_t Plugin_check(Plugin_T P, int timeout, int *status, StringBuffer_T output);
+
+
+/**
+ * Get the metrics reported by the last check which returned in time
+ * @param P The plugin object
+ * @param metrics Output array of the metrics
+ * @return The number of metrics
+ */
+int Plugin_getMetrics(Plugin_T P, monit_plugin_metric_t metrics[MONIT_PLUGIN_METRICS]);
+
+
+/**
+ * Free the plugin instance. If a check is still running, the plugin is
+ * unloaded when it returns
+ * @param P The plugin object reference
+ */
+void Plugin_free(Plugin_T *P);
+
+
+#endif
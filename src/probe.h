@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef MONIT_PROBE_H
+#define MONIT_PROBE_H
+
+
+/**
+ * Static tracepoints (USDT) in the hot paths of the daemon. If Monit was
+ * built with the SystemTap SDT header (<sys/sdt.h>), each probe is a
+ * single nop instruction with a note describing the location of its
+ * arguments, which tools like bpftrace, perf or SystemTap can attach to
+ * at runtime. Without the header the probes compile to nothing, their
+ * arguments are referenced in dead code only and not evaluated.
+ *
+ * All probes are in the "monit" provider, the durations are in
+ * microseconds:
+ *
+ *  cycle__start()
+ *  cycle__end(int errors, duration)
+ *  check__start(char *service)
+ *  check__end(char *service, int succeeded, duration)
+ *  processtree__collect(int processes, duration)
+ *  processtree__link(int processes, duration)
+ *  processtree__end(int processes, duration)
+ *  socket__connect(char *host, int port, duration)
+ *  socket__handshake(char *host, int port, duration)
+ *  socket__protocol(char *host, int port, int reused, duration)
+ *  event__state(char *service, long id, int state, char *message)
+ *  alert__send(char *service, int succeeded, duration)
+ *  mmonit__send(char *service, int succeeded, duration)
+ *  httpd__request__start(char *method, char *url)
+ *  httpd__request__end(char *method, char *url, int status, duration)
+ *
+ * The unix socket tests pass the socket path as host and 0 as port, the
+ * socket__connect duration includes the TLS handshake. The mmonit__send
+ * service is NULL for the status message. Example:
+ *
+ *  bpftrace -e 'usdt:/usr/local/bin/monit:monit:check__end
+ *               { @[str(arg0)] = hist(arg2); }'
+ *
+ * @file
+ */
+
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define PROBE0(name)                   DTRACE_PROBE(monit, name)
+#define PROBE1(name, a)                DTRACE_PROBE1(monit, name, a)
+#define PROBE2(name, a, b)             DTRACE_PROBE2(monit, name, a, b)
+#define PROBE3(name, a, b, c)          DTRACE_PROBE3(monit, name, a, b, c)
+#define PROBE4(name, a, b, c, d)       DTRACE_PROBE4(monit, name, a, b, c, d)
+
+#else
+
+/* The arguments are referenced in dead code only, so the variables used just by the probes don't trigger unused warnings */
+#define PROBE0(name)                   do {} while (0)
+#define PROBE1(name, a)                do { if (0) { (void)(a); } } while (0)
+#define PROBE2(name, a, b)             do { if (0) { (void)(a); (void)(b); } } while (0)
+#define PROBE3(name, a, b, c)          do { if (0) { (void)(a); (void)(b); (void)(c); } } while (0)
+#define PROBE4(name, a, b, c, d)       do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); } } while (0)
+
+#endif
+
+
+#endif
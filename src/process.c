@@ -57,6 +57,9 @@
 #include "monit.h"
 #include "process.h"
 #include "process_sysdep.h"
+#include "latency.h"
+#include "probe.h"
+#include "sampler.h"
 
 // libmonit
 #include "system/Time.h"
@@ -68,6 +71,248 @@
  */
 
 
+/* ----------------------------------------------------------------- Private */
+
+
+/* Process state in the incremental tree update */
+typedef enum {
+        Dirty_No = 0,
+        Dirty_Changed,   /**< Process data or children changed, ancestors not marked yet */
+        Dirty_Chain                       /**< Process totals have to be recomputed */
+} __attribute__((__packed__)) Dirty_Type;
+
+
+static pthread_rwlock_t ptree_lock = PTHREAD_RWLOCK_INITIALIZER;
+static Mutex_T match_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int ptree_generation = 0;
+static boolean_t process_direct = false; // The platform can read one process without the process tree
+
+
+/**
+ * Read the process directly, the cpu usage is computed from the previous
+ * direct read of the same pid. The entry has no children, so the totals
+ * are the process own values
+ */
+static boolean_t _readprocess(Service_T s, pid_t pid, ProcessTree_T *p) {
+        if (! process_info_sysdep(pid, p))
+                return false;
+        if (s->inf->priv.process._pid == pid && s->inf->priv.process.cputime_time > 0 && p->cputime > s->inf->priv.process.cputime && p->time > s->inf->priv.process.cputime_time) {
+                p->cpu_percent = (int)((1000 * (double)(p->cputime - s->inf->priv.process.cputime) / (p->time - s->inf->priv.process.cputime_time)) / systeminfo.cpus);
+                if (p->cpu_percent > 1000)
+                        p->cpu_percent = 1000;
+        }
+        p->cpu_percent_sum = p->cpu_percent;
+        p->mem_kbyte_sum = p->mem_kbyte;
+        p->children_sum = 0;
+        return true;
+}
+
+
+static int _comparePid(const void *a, const void *b) {
+        pid_t x = ((const ProcessTree_T *)a)->pid;
+        pid_t y = ((const ProcessTree_T *)b)->pid;
+        return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+/* FNV-1a hash of the command line */
+static unsigned int _hashcmdline(const char *cmdline) {
+        unsigned int hash = 2166136261U;
+        for (const unsigned char *c = (const unsigned char *)cmdline; *c; c++)
+                hash = (hash ^ *c) * 16777619U;
+        return hash;
+}
+
+
+/**
+ * Find the matching processes of all process services with the "matching" pattern in
+ * one pass over the process tree. The process matched in the previous snapshot is kept
+ * if it still exists with the same start time and command line, the other services use
+ * the first matching process in the tree. The result is kept until the next tree
+ * snapshot. The regular expression is evaluated only if the command line contains the
+ * literal part of the pattern.
+ */
+static void _matchprocesstree() {
+        int count = 0;
+        for (Service_T s = servicelist; s; s = s->next)
+                if (s->type == Service_Process && s->matchlist)
+                        count++;
+        Match_T *pending = CALLOC(count > 0 ? count : 1, sizeof(Match_T));
+        count = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (s->type == Service_Process && s->matchlist) {
+                        Match_T m = s->matchlist;
+                        m->generation = ptree_generation;
+                        if (m->pid > 0) {
+                                /* Sticky match: the process found before is verified without the pattern scan */
+                                int leaf = findprocess(m->pid, ptree, ptreesize);
+                                if (leaf != -1 && ptree[leaf].cmdline && ptree[leaf].starttime == m->starttime && _hashcmdline(ptree[leaf].cmdline) == m->cmdhash)
+                                        continue;
+                        }
+                        m->pid = -1;
+                        pending[count++] = m;
+                }
+        }
+        int unmatched = count;
+        for (int i = 0; i < ptreesize && unmatched; i++) {
+                if (! ptree[i].cmdline)
+                        continue;
+                for (int j = 0; j < unmatched; j++) {
+                        Match_T m = pending[j];
+                        if (m->literal && ! strstr(ptree[i].cmdline, m->literal))
+                                continue;
+#ifdef HAVE_REGEX_H
+                        if (regexec(m->regex_comp, ptree[i].cmdline, 0, NULL, 0) == 0) {
+#else
+                        if (strstr(ptree[i].cmdline, m->match_string)) {
+#endif
+                                m->pid = ptree[i].pid;
+                                m->starttime = ptree[i].starttime;
+                                m->cmdhash = _hashcmdline(ptree[i].cmdline);
+                                pending[j--] = pending[--unmatched];
+                        }
+                }
+        }
+        FREE(pending);
+}
+
+
+/**
+ * Map the entries of the new and the previous snapshot. Both trees are sorted by pid
+ * @param oldindex the index in the previous snapshot for each new entry or -1
+ * @param newindex the index in the new snapshot for each previous entry or -1
+ */
+static void _mapprocesstree(ProcessTree_T *pt, int size, ProcessTree_T *oldpt, int oldsize, int *oldindex, int *newindex) {
+        int i = 0, j = 0;
+        while (i < size || j < oldsize) {
+                if (j == oldsize || (i < size && pt[i].pid < oldpt[j].pid)) {
+                        oldindex[i++] = -1;
+                } else if (i == size || pt[i].pid > oldpt[j].pid) {
+                        newindex[j++] = -1;
+                } else {
+                        oldindex[i] = j;
+                        newindex[j] = i;
+                        i++;
+                        j++;
+                }
+        }
+}
+
+
+/**
+ * Connect the processes to their parents. If the previous snapshot is available, the
+ * children arrays of the surviving processes are taken over from it and only the new
+ * and reparented processes are connected. The totals of unchanged processes are kept,
+ * the changed ones are marked in the dirty array
+ */
+static void _linkprocesstree(ProcessTree_T *pt, int size, ProcessTree_T *oldpt, int *oldindex, int *newindex, char *dirty) {
+        if (oldpt) {
+                for (int i = 0; i < size; i++) {
+                        if (oldindex[i] == -1) {
+                                dirty[i] = Dirty_Changed;
+                                continue;
+                        }
+                        ProcessTree_T *old = &oldpt[oldindex[i]];
+                        /* Drop the children which exited or moved to another parent */
+                        int n = 0;
+                        for (int j = 0; j < old->children_num; j++) {
+                                int child = newindex[old->children[j]];
+                                if (child != -1 && pt[child].ppid == pt[i].pid)
+                                        old->children[n++] = child;
+                        }
+                        if (n != old->children_num || pt[i].mem_kbyte != old->mem_kbyte || pt[i].cpu_percent != old->cpu_percent) {
+                                dirty[i] = Dirty_Changed;
+                        } else {
+                                pt[i].children_sum    = old->children_sum;
+                                pt[i].mem_kbyte_sum   = old->mem_kbyte_sum;
+                                pt[i].cpu_percent_sum = old->cpu_percent_sum;
+                        }
+                        pt[i].children     = old->children;
+                        pt[i].children_num = n;
+                        old->children      = NULL;
+                        old->children_num  = 0;
+                }
+        }
+        for (int i = 0; i < size; i++) {
+                if (pt[i].pid == pt[i].ppid) {
+                        pt[i].parent = i;
+                        continue;
+                }
+
+                /* The virtual entries for missing parents were added by _sortprocesstree() */
+                if ((pt[i].parent = findprocess(pt[i].ppid, pt, size)) != -1) {
+                        /* The surviving process with the same parent is in the taken over children array already */
+                        if (oldpt && oldindex[i] != -1 && oldpt[oldindex[i]].ppid == pt[i].ppid && oldpt[oldindex[i]].parent != -1)
+                                continue;
+                        if (connectchild(pt, pt[i].parent, i)) {
+                                if (dirty)
+                                        dirty[pt[i].parent] = Dirty_Changed;
+                                continue;
+                        }
+                }
+                /* connection to parent process has failed - detach the process, but keep its pid as the tree must stay sorted */
+                DEBUG("System statistic error -- cannot connect process id %d to its parent %d\n", pt[i].pid, pt[i].ppid);
+                pt[i].parent = -1;
+        }
+}
+
+
+/**
+ * Incremental version of fillprocesstree(): the totals are recomputed for the
+ * processes on changed ancestor chains only, the other subtrees are unchanged
+ */
+static void _rollupprocesstree(ProcessTree_T *pt, int index, char *dirty) {
+        if (pt[index].visited || ! dirty[index])
+                return;
+
+        pt[index].visited         = true;
+        pt[index].children_sum    = pt[index].children_num;
+        pt[index].mem_kbyte_sum   = pt[index].mem_kbyte;
+        pt[index].cpu_percent_sum = pt[index].cpu_percent;
+
+        for (int i = 0; i < pt[index].children_num; i++) {
+                ProcessTree_T *child = &pt[pt[index].children[i]];
+                _rollupprocesstree(pt, pt[index].children[i], dirty);
+                pt[index].children_sum    += child->children_sum;
+                pt[index].mem_kbyte_sum   += child->mem_kbyte_sum;
+                pt[index].cpu_percent_sum += child->cpu_percent_sum;
+                pt[index].cpu_percent_sum  = (child->cpu_percent_sum > 1000) ? 1000 : pt[index].cpu_percent_sum;
+        }
+}
+
+
+/**
+ * Sort the process tree by pid, so findprocess() can use binary search. The
+ * parent process may be missing in the table: on Linux this is normal, the main
+ * process with PID 0 is not listed, similarly in FreeBSD jail. We create virtual
+ * process entry for missing parent so we can have full tree-like structure with root.
+ */
+static void _sortprocesstree(ProcessTree_T **pt_r, int *size_r) {
+        int size = *size_r;
+        qsort(*pt_r, size, sizeof(ProcessTree_T), _comparePid);
+        for (int i = 0; i < size; i++) {
+                pid_t ppid = (*pt_r)[i].ppid;
+                if ((*pt_r)[i].pid == ppid || findprocess(ppid, *pt_r, size) != -1)
+                        continue;
+                boolean_t added = false;
+                for (int j = size; j < *size_r; j++) {
+                        if ((*pt_r)[j].pid == ppid) {
+                                added = true;
+                                break;
+                        }
+                }
+                if (! added) {
+                        int j = (*size_r)++;
+                        RESIZE(*pt_r, *size_r * sizeof(ProcessTree_T));
+                        memset(&(*pt_r)[j], 0, sizeof(ProcessTree_T));
+                        (*pt_r)[j].ppid = (*pt_r)[j].pid = ppid;
+                }
+        }
+        if (*size_r > size)
+                qsort(*pt_r, *size_r, sizeof(ProcessTree_T), _comparePid);
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
@@ -86,8 +331,14 @@ boolean_t init_process_info(void) {
         systeminfo.total_cpu_user_percent = -10;
         systeminfo.total_cpu_syst_percent = -10;
         systeminfo.total_cpu_wait_percent = -10;
+        systeminfo.cpu_max_percent = -10;
+        systeminfo.node_max_percent = -10;
 
-        return (init_process_info_sysdep());
+        if (! init_process_info_sysdep())
+                return false;
+        ProcessTree_T p;
+        process_direct = process_info_sysdep(getpid(), &p);
+        return true;
 }
 
 
@@ -95,6 +346,8 @@ boolean_t init_process_info(void) {
  * Get the proc infomation (CPU percentage, MEM in MByte and percent,
  * status), enduser version.
  * @param p A Service object
+ * @param pt The process tree or NULL to read the process directly (see
+ * processtree_needed())
  * @param pid The process id
  * @return true if succeeded otherwise false.
  */
@@ -106,27 +359,44 @@ boolean_t update_process_data(Service_T s, ProcessTree_T *pt, int treesize, pid_
         s->inf->priv.process._pid = s->inf->priv.process.pid;
         s->inf->priv.process.pid  = pid;
 
-        int leaf;
-        if ((leaf = findprocess(pid, pt, treesize)) != -1) {
+        ProcessTree_T process;
+        ProcessTree_T *p = NULL;
+        if (pt) {
+                int leaf = findprocess(pid, pt, treesize);
+                if (leaf != -1)
+                        p = &pt[leaf];
+        } else if (_readprocess(s, pid, &process)) {
+                p = &process;
+        }
+        if (p) {
                 /* save the previous ppid and set actual one */
                 s->inf->priv.process._ppid             = s->inf->priv.process.ppid;
-                s->inf->priv.process.ppid              = pt[leaf].ppid;
-                s->inf->priv.process.uid               = pt[leaf].uid;
-                s->inf->priv.process.euid              = pt[leaf].euid;
-                s->inf->priv.process.gid               = pt[leaf].gid;
-                s->inf->priv.process.uptime            = Time_now() - pt[leaf].starttime;
-                s->inf->priv.process.children          = pt[leaf].children_sum;
-                s->inf->priv.process.mem_kbyte         = pt[leaf].mem_kbyte;
-                s->inf->priv.process.zombie            = pt[leaf].zombie;
-                s->inf->priv.process.total_mem_kbyte   = pt[leaf].mem_kbyte_sum;
-                s->inf->priv.process.cpu_percent       = pt[leaf].cpu_percent;
-                s->inf->priv.process.total_cpu_percent = pt[leaf].cpu_percent_sum;
+                s->inf->priv.process.ppid              = p->ppid;
+                s->inf->priv.process.uid               = p->uid;
+                s->inf->priv.process.euid              = p->euid;
+                s->inf->priv.process.gid               = p->gid;
+                s->inf->priv.process.uptime            = Time_now() - p->starttime;
+                if (s->pidfile && pid == s->pidfile->pid && p->starttime > 0) {
+                        /* The start time of the pidfile's process is remembered, if it changes while the pidfile didn't, the pid was reused (the start time is rounded to seconds and the boot time may drift a second) */
+                        if (! s->pidfile->starttime)
+                                s->pidfile->starttime = p->starttime;
+                        else if (p->starttime - s->pidfile->starttime > 1 || s->pidfile->starttime - p->starttime > 1)
+                                s->pidfile->stale = true;
+                }
+                s->inf->priv.process.children          = p->children_sum;
+                s->inf->priv.process.mem_kbyte         = p->mem_kbyte;
+                s->inf->priv.process.zombie            = p->zombie;
+                s->inf->priv.process.total_mem_kbyte   = p->mem_kbyte_sum;
+                s->inf->priv.process.cpu_percent       = p->cpu_percent;
+                s->inf->priv.process.total_cpu_percent = p->cpu_percent_sum;
+                s->inf->priv.process.cputime           = p->cputime;
+                s->inf->priv.process.cputime_time      = p->time;
                 if (systeminfo.mem_kbyte_max == 0) {
                         s->inf->priv.process.total_mem_percent = 0;
                         s->inf->priv.process.mem_percent       = 0;
                 } else {
-                        s->inf->priv.process.total_mem_percent = (int)((double)pt[leaf].mem_kbyte_sum * 1000.0 / systeminfo.mem_kbyte_max);
-                        s->inf->priv.process.mem_percent       = (int)((double)pt[leaf].mem_kbyte * 1000.0 / systeminfo.mem_kbyte_max);
+                        s->inf->priv.process.total_mem_percent = (int)((double)p->mem_kbyte_sum * 1000.0 / systeminfo.mem_kbyte_max);
+                        s->inf->priv.process.mem_percent       = (int)((double)p->mem_kbyte * 1000.0 / systeminfo.mem_kbyte_max);
                 }
         } else {
                 s->inf->priv.process.ppid              = -1;
@@ -141,11 +411,62 @@ boolean_t update_process_data(Service_T s, ProcessTree_T *pt, int treesize, pid_
                 s->inf->priv.process.mem_percent       = 0;
                 s->inf->priv.process.cpu_percent       = 0;
                 s->inf->priv.process.total_cpu_percent = 0;
+                s->inf->priv.process.cputime           = 0;
+                s->inf->priv.process.cputime_time      = 0.;
         }
         return true;
 }
 
 
+/**
+ * Read the threads, open file descriptors and I/O rates of the process.
+ * They are not part of the process snapshot, so they are read only if
+ * some resource rule of the service needs them
+ * @param s A Service object
+ * @param pid The process id
+ */
+void update_process_resources(Service_T s, pid_t pid) {
+        ASSERT(s);
+        int flags = 0;
+        for (Resource_T r = s->resourcelist; r; r = r->next) {
+                switch (r->resource_id) {
+                        case Resource_Tasks:
+                                flags |= ProcessResource_Threads;
+                                break;
+                        case Resource_FileDescriptors:
+                                flags |= ProcessResource_Fds;
+                                break;
+                        case Resource_ReadBytes:
+                        case Resource_WriteBytes:
+                                flags |= ProcessResource_IO;
+                                break;
+                        default:
+                                break;
+                }
+        }
+        if (! flags)
+                return;
+        ProcessResources_T R = {.threads = -1, .fds = -1};
+        if (! process_resources_sysdep(pid, flags, &R))
+                DEBUG("'%s' cannot read some of the process resources\n", s->name);
+        s->inf->priv.process.threads = R.threads;
+        s->inf->priv.process.fds = R.fds;
+        unsigned long long now = Latency_now();
+        // The rates need two samples of the same process
+        if (R.io && s->inf->priv.process.io_sampled && s->inf->priv.process._pid == pid && now > s->inf->priv.process.io_sampled && R.read_bytes >= s->inf->priv.process.read_bytes && R.write_bytes >= s->inf->priv.process.write_bytes) {
+                double elapsed = (double)(now - s->inf->priv.process.io_sampled) / 1000000.;
+                s->inf->priv.process.read_rate = (long long)((double)(R.read_bytes - s->inf->priv.process.read_bytes) / elapsed);
+                s->inf->priv.process.write_rate = (long long)((double)(R.write_bytes - s->inf->priv.process.write_bytes) / elapsed);
+        } else {
+                s->inf->priv.process.read_rate = -1LL;
+                s->inf->priv.process.write_rate = -1LL;
+        }
+        s->inf->priv.process.read_bytes = R.read_bytes;
+        s->inf->priv.process.write_bytes = R.write_bytes;
+        s->inf->priv.process.io_sampled = R.io ? now : 0ULL;
+}
+
+
 /**
  * Updates the system wide statistic
  * @return true if successful, otherwise false
@@ -168,8 +489,8 @@ boolean_t update_system_load() {
                 systeminfo.total_mem_percent  = (int)(1000 * (double)systeminfo.total_mem_kbyte / (double)systeminfo.mem_kbyte_max);
                 systeminfo.total_swap_percent = systeminfo.swap_kbyte_max ? (int)(1000 * (double)systeminfo.total_swap_kbyte / (double)systeminfo.swap_kbyte_max) : 0;
 
-                /** Get CPU usage statistic */
-                if (! used_system_cpu_sysdep(&systeminfo)) {
+                /** Get CPU usage statistic (serialized with the high frequency sampler reads) */
+                if (! Sampler_updateSystemCpu(&systeminfo)) {
                         LogError("'%s' statistic error -- cpu usage gathering failed\n", Run.system->name);
                         goto error3;
                 }
@@ -188,6 +509,8 @@ error3:
         systeminfo.total_cpu_user_percent = 0;
         systeminfo.total_cpu_syst_percent = 0;
         systeminfo.total_cpu_wait_percent = 0;
+        systeminfo.cpu_max_percent = 0;
+        systeminfo.node_max_percent = 0;
 
         return false;
 }
@@ -203,6 +526,7 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
         ASSERT(oldpt_r);
         ASSERT(oldsize_r);
 
+        unsigned long long started = Latency_now();
         if (*pt_r) {
                 if (*oldpt_r)
                         delprocesstree(oldpt_r, oldsize_r);
@@ -223,11 +547,24 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
                 Run.doprocess = true;
         }
 
-        int oldentry;
+        _sortprocesstree(pt_r, size_r);
+        unsigned long long collected = Latency_now();
+        PROBE2(processtree__collect, *size_r, collected - started);
+
         ProcessTree_T *pt = *pt_r;
         ProcessTree_T *oldpt = *oldpt_r;
-        for (int i = 0; i < (volatile int)*size_r; i ++) {
-                if (oldpt && ((oldentry = findprocess(pt[i].pid, oldpt, *oldsize_r)) != -1)) {
+        int *oldindex = NULL;
+        int *newindex = NULL;
+        char *dirty = NULL;
+        if (oldpt) {
+                oldindex = CALLOC(*size_r, sizeof(int));
+                newindex = CALLOC(*oldsize_r, sizeof(int));
+                dirty = CALLOC(*size_r, sizeof(char));
+                _mapprocesstree(pt, *size_r, oldpt, *oldsize_r, oldindex, newindex);
+        }
+        for (int i = 0; i < *size_r; i ++) {
+                int oldentry = oldpt ? oldindex[i] : -1;
+                if (oldentry != -1) {
                         pt[i].cputime_prev = oldpt[oldentry].cputime;
                         pt[i].time_prev    = oldpt[oldentry].time;
 
@@ -242,31 +579,11 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
                         pt[i].time_prev    = 0.0;
                         pt[i].cpu_percent  = 0;
                 }
-
-                if (pt[i].pid == pt[i].ppid) {
-                        pt[i].parent = i;
-                        continue;
-                }
-
-                if ((pt[i].parent = findprocess(pt[i].ppid, pt, *size_r)) == -1) {
-                        /* Parent process wasn't found - on Linux this is normal: main process with PID 0 is not listed, similarly in FreeBSD jail.
-                         * We create virtual process entry for missing parent so we can have full tree-like structure with root. */
-                        int j = (*size_r)++;
-
-                        pt = RESIZE(*pt_r, *size_r * sizeof(ProcessTree_T));
-                        memset(&pt[j], 0, sizeof(ProcessTree_T));
-                        pt[j].ppid = pt[j].pid  = pt[i].ppid;
-                        pt[i].parent = j;
-                }
-
-                if (! connectchild(pt, pt[i].parent, i)) {
-                        /* connection to parent process has failed, this is usually caused in the part above */
-                        DEBUG("System statistic error -- cannot connect process id %d to its parent %d\n", pt[i].pid, pt[i].ppid);
-                        pt[i].pid = 0;
-                        continue;
-                }
         }
 
+        _linkprocesstree(pt, *size_r, oldpt, oldindex, newindex, dirty);
+        PROBE2(processtree__link, *size_r, Latency_now() - collected);
+
         /* The main process in Solaris zones and FreeBSD host doesn't have pid 1, so try to find process which is parent of itself */
         int root = -1;
         for (int i = 0; i < *size_r; i++) {
@@ -278,6 +595,9 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
 
         if (root == -1) {
                 DEBUG("System statistic error -- cannot find root process id\n");
+                FREE(oldindex);
+                FREE(newindex);
+                FREE(dirty);
                 if (*oldpt_r)
                         delprocesstree(oldpt_r, oldsize_r);
                 if (*pt_r)
@@ -285,14 +605,36 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
                 return -1;
         }
 
-        fillprocesstree(pt, root);
+        if (dirty) {
+                /* Recompute the totals only along the ancestor chains of the changed processes */
+                for (int i = 0; i < *size_r; i++) {
+                        if (dirty[i] == Dirty_Changed) {
+                                for (int j = i; dirty[j] != Dirty_Chain; j = pt[j].parent) {
+                                        dirty[j] = Dirty_Chain;
+                                        if (pt[j].parent == -1 || pt[j].parent == j)
+                                                break;
+                                }
+                        }
+                }
+                _rollupprocesstree(pt, root, dirty);
+        } else {
+                fillprocesstree(pt, root);
+        }
+
+        FREE(oldindex);
+        FREE(newindex);
+        FREE(dirty);
 
+        ptree_generation++;
+
+        PROBE2(processtree__end, *size_r, Latency_now() - started);
         return *size_r;
 }
 
 
 /**
- * Search a leaf in the processtree
+ * Search a leaf in the processtree. The tree is sorted by pid (see
+ * initprocesstree()), so we can use binary search
  * @param pid  pid of the process
  * @param pt  processtree
  * @param treesize  size of the processtree
@@ -301,12 +643,17 @@ int initprocesstree(ProcessTree_T **pt_r, int *size_r, ProcessTree_T **oldpt_r,
 int findprocess(int pid, ProcessTree_T *pt, int treesize) {
         ASSERT(pt);
 
-        if (treesize <= 0)
-                return -1;
-
-        for (int i = 0; i < treesize; i++)
-                if (pid == pt[i].pid)
-                        return i;
+        int low = 0;
+        int high = treesize - 1;
+        while (low <= high) {
+                int middle = low + (high - low) / 2;
+                if (pt[middle].pid < pid)
+                        low = middle + 1;
+                else if (pt[middle].pid > pid)
+                        high = middle - 1;
+                else
+                        return middle;
+        }
 
         return -1;
 }
@@ -315,10 +662,51 @@ int findprocess(int pid, ProcessTree_T *pt, int treesize) {
 time_t getProcessUptime(pid_t pid, ProcessTree_T *pt, int treesize) {
         if (pt) {
                 int leaf = findprocess(pid, pt, treesize);
-                return (time_t)((leaf >= 0 && leaf < treesize) ? Time_now() - pt[leaf].starttime : -1);
-        } else {
-                return 0;
+                if (leaf >= 0 && leaf < treesize)
+                        return Time_now() - pt[leaf].starttime;
         }
+        /* The tree is not collected if no rule needs it or the process is newer than the tree */
+        ProcessTree_T p;
+        if (process_direct && process_info_sysdep(pid, &p))
+                return Time_now() - p.starttime;
+        return pt ? -1 : 0;
+}
+
+
+/**
+ * Find out whether the checks need the process tree. The tree is needed
+ * for the "matching" pattern and for the children and total resource
+ * rules (unless the totals come from the cgroup). Other process services
+ * read their process directly, which costs a few files per process
+ * instead of the whole /proc walk
+ * @return true if the process tree has to be collected this cycle
+ */
+boolean_t processtree_needed() {
+        boolean_t process = false;
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (s->type == Service_Processes && s->monitor != Monitor_Not)
+                        return true;
+                if (s->type != Service_Process || s->monitor == Monitor_Not)
+                        continue;
+                if (s->matchlist)
+                        return true;
+                process = true;
+                if (! s->cgroup) {
+                        for (Resource_T r = s->resourcelist; r; r = r->next) {
+                                switch (r->resource_id) {
+                                        case Resource_Children:
+                                        case Resource_CpuPercentTotal:
+                                        case Resource_MemoryKbyteTotal:
+                                        case Resource_MemoryPercentTotal:
+                                                return true;
+                                        default:
+                                                break;
+                                }
+                        }
+                }
+        }
+        // Without the direct read, the process services use the tree
+        return process && ! process_direct;
 }
 
 
@@ -329,7 +717,8 @@ void delprocesstree(ProcessTree_T **reference, int *size) {
         ProcessTree_T *pt = *reference;
         if (pt) {
                 for (int i = 0; i < *size; i++) {
-                        FREE(pt[i].cmdline);
+                        if (! pt[i].cmdline_shared)
+                                FREE(pt[i].cmdline);
                         FREE(pt[i].children);
                 }
                 FREE(pt);
@@ -339,6 +728,48 @@ void delprocesstree(ProcessTree_T **reference, int *size) {
 }
 
 
+/**
+ * Lock the process tree. The tree rebuild requires exclusive access, the
+ * checks which only read the tree may share it (see the check scheduler)
+ * @param exclusive true for write access, false for shared read access
+ */
+void lockprocesstree(boolean_t exclusive) {
+        if (exclusive)
+                pthread_rwlock_wrlock(&ptree_lock);
+        else
+                pthread_rwlock_rdlock(&ptree_lock);
+}
+
+
+/**
+ * Find the process matching the "matching" pattern of the given process service
+ * in the global process tree. Must be called with the process tree lock held
+ * @param s A process service with the matchlist
+ * @return The process pid or -1 if no process matches
+ */
+pid_t findprocessmatch(Service_T s) {
+        ASSERT(s);
+        ASSERT(s->matchlist);
+        pid_t pid;
+        LOCK(match_mutex)
+        {
+                if (s->matchlist->generation != ptree_generation)
+                        _matchprocesstree();
+                pid = s->matchlist->pid;
+        }
+        END_LOCK;
+        return pid;
+}
+
+
+/**
+ * Release the process tree lock
+ */
+void unlockprocesstree() {
+        pthread_rwlock_unlock(&ptree_lock);
+}
+
+
 void process_testmatch(char *pattern) {
 #ifdef HAVE_REGEX_H
         regex_t *regex_comp;
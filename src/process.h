@@ -32,12 +32,17 @@
 #endif
 
 boolean_t update_process_data(Service_T s, ProcessTree_T *, int treesize, pid_t pid);
+void update_process_resources(Service_T s, pid_t pid);
 boolean_t init_process_info(void);
 boolean_t update_system_load();
 int  findprocess(int, ProcessTree_T *, int);
 time_t getProcessUptime(pid_t pid, ProcessTree_T *pt, int treesize);
+boolean_t processtree_needed(void);
 int  initprocesstree(ProcessTree_T **, int *, ProcessTree_T **, int *);
 void delprocesstree(ProcessTree_T **, int *);
+void lockprocesstree(boolean_t);
+pid_t findprocessmatch(Service_T);
+void unlockprocesstree(void);
 void process_testmatch(char *);
 
 #endif
@@ -25,6 +25,19 @@
 #ifndef MONIT_PROCESS_SYSDEP_H
 #define MONIT_PROCESS_SYSDEP_H
 
+/* The per-process resources, which are not part of the process snapshot */
+#define ProcessResource_Threads 0x1
+#define ProcessResource_Fds     0x2
+#define ProcessResource_IO      0x4
+
+typedef struct myprocessresources {
+        int threads;                                  /**< Number of threads or -1 */
+        int fds;                        /**< Number of open file descriptors or -1 */
+        boolean_t io;                      /**< Whether the I/O counters were read */
+        unsigned long long read_bytes;          /**< Total bytes read from storage */
+        unsigned long long write_bytes;        /**< Total bytes written to storage */
+} ProcessResources_T;
+
 boolean_t init_process_info_sysdep(void);
 int init_proc_info_sysdep(void);
 
@@ -36,6 +49,8 @@ boolean_t used_system_cpu_sysdep(SystemInfo_T *);
 double get_float_time(void);
 
 int    initprocesstree_sysdep(ProcessTree_T **);
+boolean_t process_resources_sysdep(pid_t, int, ProcessResources_T *);
+boolean_t process_info_sysdep(pid_t, ProcessTree_T *);
 void   fillprocesstree(ProcessTree_T *, int);
 
 boolean_t connectchild(ProcessTree_T *, int, int);
@@ -309,3 +309,22 @@ boolean_t used_system_cpu_sysdep(SystemInfo_T *si) {
         return true;
 }
 
+
+/**
+ * The per-process threads, descriptors and I/O statistics are not
+ * supported on this platform
+ * @return false
+ */
+boolean_t process_resources_sysdep(pid_t pid, int flags, ProcessResources_T *R) {
+        return false;
+}
+
+
+/**
+ * The direct read of one process is not supported on this platform, the
+ * process data come from the process tree
+ * @return false
+ */
+boolean_t process_info_sysdep(pid_t pid, ProcessTree_T *pt) {
+        return false;
+}
@@ -65,8 +65,17 @@
 #include <asm/param.h>
 #endif
 
-#ifdef HAVE_GLOB_H
-#include <glob.h>
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
 #endif
 
 #ifndef HZ
@@ -92,6 +101,9 @@
 
 #define UID             "Uid:"
 #define GID             "Gid:"
+#define THREADS         "Threads:"
+#define READBYTES       "read_bytes:"
+#define WRITEBYTES      "write_bytes:"
 #define MEMTOTAL        "MemTotal:"
 #define MEMFREE         "MemFree:"
 #define MEMBUF          "Buffers:"
@@ -102,12 +114,95 @@
 
 #define NSEC_PER_SEC    1000000000L
 
+#define NODEDIR         "/sys/devices/system/node"
+
+#define URING_BATCH     64    /* Processes read per io_uring batch */
+#define URING_FILES     3     /* The stat, status and cmdline files */
+#define URING_SLOTS     (URING_BATCH * URING_FILES)
+
+#define SCAN_MIN        1024  /* Minimum number of processes per scan worker */
+
 static unsigned long long old_cpu_user     = 0;
 static unsigned long long old_cpu_syst     = 0;
 static unsigned long long old_cpu_wait     = 0;
 static unsigned long long old_cpu_total    = 0;
 static int                page_shift_to_kb = 0;
 
+/* The process table read buffers, reused for all processes and snapshots */
+static char               dirents[32768] __attribute__((aligned(8)));
+static char               buf[4096];
+static int               *pids = NULL;
+static int                pids_size = 0;
+
+/* The command lines of the snapshot being built, the arena is owned by the snapshot when complete */
+typedef struct {
+        char *data;
+        int size;
+        int used;
+        int *offset;                  /* The command line offset of each entry */
+} CmdlineArena_T;
+
+static CmdlineArena_T     arena;
+
+/* The process table scan worker, reads the pids partition into its own entries and arena */
+typedef struct {
+        int procfd;
+        time_t starttime;
+        int first;                    /* The first pid index of the partition */
+        int count;                    /* The number of pids in the partition */
+        ProcessTree_T *pt;            /* The partition's entries (the snapshot's entries from first) */
+        int treesize;                 /* The number of entries read */
+        CmdlineArena_T arena;
+        char buffer[4096];
+} Scanner_T;
+
+/* The system statistic files, kept open and re-read from the start */
+static int                statfd = -1;
+static int                meminfofd = -1;
+static int                loadavgfd = -1;
+
+/* The per-CPU and per-NUMA node statistics, gathered only if some rule needs them (see SystemInfo_T.percpu) */
+static struct {
+        int count;                    /* Number of CPU entries (indexed by CPU id) */
+        unsigned long long *busy;              /* CPU busy time of the last sample */
+        unsigned long long *total;            /* CPU total time of the last sample */
+        int *node;                                   /* NUMA node of the CPU or -1 */
+        unsigned long long *node_busy;                /* NUMA node busy time delta */
+        unsigned long long *node_total;              /* NUMA node total time delta */
+        char *buffer;                           /* The complete /proc/stat content */
+        int buffer_size;                              /* The buffer allocated size */
+        boolean_t topology;                  /* true if the NUMA topology was read */
+} cpustat;
+
+#ifdef HAVE_IO_URING
+/* The io_uring used to read the process table in batches. If the kernel doesn't support it, the files are read synchronously */
+static struct {
+        int fd;
+        boolean_t disabled;               /* true if io_uring isn't usable */
+        unsigned *sq_tail;
+        unsigned *sq_mask;
+        unsigned *sq_array;
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned *cq_mask;
+        struct io_uring_sqe *sqes;
+        struct io_uring_cqe *cqes;
+        int result[URING_SLOTS];          /* The operation results by slot */
+        int fds[URING_SLOTS];             /* The file descriptors by slot or -1 */
+        char path[URING_SLOTS][32];       /* The PID/name paths by slot */
+        char *buffer;                     /* The read buffers, PROC_BUFFER bytes per slot */
+} uring = {.fd = -1};
+#endif
+
+/* The getdents64 entry, glibc doesn't export it */
+struct linux_dirent64 {
+        unsigned long long d_ino;
+        long long          d_off;
+        unsigned short     d_reclen;
+        unsigned char      d_type;
+        char               d_name[];
+};
+
 
 /**
  * Get system start time
@@ -131,27 +226,752 @@ static time_t get_starttime() {
 }
 
 
+/**
+ * Read the list of processes (numerical /proc entries) into the pids array
+ * @param fd The /proc directory descriptor
+ * @return number of processes or -1 on error
+ */
+static int _readPids(int fd) {
+        long n;
+        int count = 0;
+        while ((n = syscall(SYS_getdents64, fd, dirents, sizeof(dirents))) > 0) {
+                for (long offset = 0; offset < n;) {
+                        struct linux_dirent64 *d = (struct linux_dirent64 *)(dirents + offset);
+                        offset += d->d_reclen;
+                        if (d->d_type != DT_DIR && d->d_type != DT_UNKNOWN)
+                                continue;
+                        int pid = 0;
+                        char *name = d->d_name;
+                        for (; *name >= '0' && *name <= '9'; name++)
+                                pid = pid * 10 + (*name - '0');
+                        if (*name || ! pid)
+                                continue;
+                        if (count == pids_size) {
+                                pids_size = pids_size ? pids_size * 2 : 1024;
+                                RESIZE(pids, pids_size * sizeof(int));
+                        }
+                        pids[count++] = pid;
+                }
+        }
+        if (n < 0) {
+                LogError("system statistic error -- cannot read /proc: %s\n", STRERROR);
+                return -1;
+        }
+        return count;
+}
+
+
+/**
+ * Read the /proc/PID/name file into the buffer
+ * @return number of bytes read or -1 on error
+ */
+static int _readFile(int dirfd, int pid, const char *name, char *buffer, int size) {
+        char path[STRLEN];
+        snprintf(path, sizeof(path), "%d/%s", pid, name);
+        int fd = openat(dirfd, path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+        int bytes = (int)read(fd, buffer, size - 1);
+        close(fd);
+        if (bytes < 0)
+                return -1;
+        buffer[bytes] = 0;
+        return bytes;
+}
+
+
+/**
+ * Parse the (optionally negative) decimal number, leading blanks are skipped
+ * @return pointer to the first character after the number or NULL on error
+ */
+static char *_parseNumber(char *s, long long *value) {
+        while (*s == ' ' || *s == '\t')
+                s++;
+        boolean_t negative = *s == '-';
+        if (negative)
+                s++;
+        if (*s < '0' || *s > '9')
+                return NULL;
+        long long v = 0;
+        for (; *s >= '0' && *s <= '9'; s++)
+                v = v * 10 + (*s - '0');
+        *value = negative ? -v : v;
+        return s;
+}
+
+
+/**
+ * Skip the given number of space separated fields
+ */
+static char *_skipFields(char *s, int count) {
+        while (count-- > 0) {
+                while (*s == ' ')
+                        s++;
+                while (*s && *s != ' ')
+                        s++;
+        }
+        return s;
+}
+
+
+/**
+ * Read the system statistic file from the start. The file is opened on the
+ * first use and kept open, the kernel regenerates the content on each read
+ * from offset 0. If the read fails, the file is reopened once
+ * @param fd The cached file descriptor (-1 if not open yet)
+ * @param path The file path
+ * @return number of bytes read or -1 on error
+ */
+static int _readSystemFile(int *fd, const char *path, char *buffer, int size) {
+        for (int retry = 0; retry < 2; retry++) {
+                if (*fd < 0 && (*fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+                        DEBUG("Cannot open proc file %s -- %s\n", path, STRERROR);
+                        return -1;
+                }
+                int bytes = (int)pread(*fd, buffer, size - 1, 0);
+                if (bytes >= 0) {
+                        buffer[bytes] = 0;
+                        return bytes;
+                }
+                DEBUG("Cannot read proc file %s -- %s\n", path, STRERROR);
+                close(*fd);
+                *fd = -1;
+        }
+        return -1;
+}
+
+
+/**
+ * Parse the requested /proc/meminfo keys in one pass. Only the beginning of
+ * each line is compared and the scan stops when all keys were found
+ * @param buffer The meminfo content
+ * @param keys NULL terminated array of the keys (including the colon)
+ * @param values The values of the keys (kB), not found keys are kept unchanged
+ * @return number of keys found
+ */
+static int _parseMeminfo(char *buffer, const char **keys, long long *values) {
+        int count = 0, found = 0;
+        while (keys[count])
+                count++;
+        for (char *line = buffer; line && found < count; line = strchr(line, '\n')) {
+                if (*line == '\n')
+                        line++;
+                for (int i = 0; i < count; i++) {
+                        size_t length = strlen(keys[i]);
+                        if (! strncmp(line, keys[i], length)) {
+                                if (_parseNumber(line + length, &values[i]))
+                                        found++;
+                                break;
+                        }
+                }
+        }
+        return found;
+}
+
+
+/**
+ * Parse the cpu times (user, nice, system, idle, iowait, irq and softirq)
+ * of the /proc/stat cpu line
+ * @param s The line content after the cpu name
+ * @param value The times, not present values are kept unchanged
+ * @return number of times parsed
+ */
+static int _parseCpuTimes(char *s, long long value[7]) {
+        int count;
+        for (count = 0; count < 7 && (s = _parseNumber(s, &value[count])); count++)
+                ;
+        return count;
+}
+
+
+/**
+ * Grow the per-CPU statistics to hold the given number of CPUs
+ */
+static void _growCpus(int count) {
+        if (count <= cpustat.count)
+                return;
+        RESIZE(cpustat.busy, count * sizeof(unsigned long long));
+        RESIZE(cpustat.total, count * sizeof(unsigned long long));
+        RESIZE(cpustat.node, count * sizeof(int));
+        for (int i = cpustat.count; i < count; i++) {
+                cpustat.busy[i] = cpustat.total[i] = 0ULL;
+                cpustat.node[i] = -1;
+        }
+        cpustat.count = count;
+}
+
+
+/**
+ * Read the NUMA topology (the CPU lists of the /sys/devices/system/node/nodeN
+ * directories). The topology is read once, on the first per-CPU sample
+ */
+static void _readTopology() {
+        cpustat.topology = true;
+        _growCpus(systeminfo.cpus);
+        DIR *dir = opendir(NODEDIR);
+        if (! dir) {
+                DEBUG("system statistic -- NUMA topology not available: %s\n", STRERROR);
+                return;
+        }
+        int nodes = 0;
+        struct dirent *d;
+        while ((d = readdir(dir))) {
+                long long node;
+                char *tail;
+                if (strncmp(d->d_name, "node", 4) || ! (tail = _parseNumber(d->d_name + 4, &node)) || *tail || node < 0)
+                        continue;
+                int fd = -1;
+                char path[STRLEN], list[1024];
+                snprintf(path, sizeof(path), "%s/%s/cpulist", NODEDIR, d->d_name);
+                int bytes = _readSystemFile(&fd, path, list, sizeof(list));
+                if (fd >= 0)
+                        close(fd);
+                if (bytes < 0)
+                        continue;
+                /* The list of ranges, for example "0-7,16-23" */
+                for (char *range = list; range;) {
+                        long long first, last;
+                        if (! (range = _parseNumber(range, &first)) || first < 0)
+                                break;
+                        last = first;
+                        if (*range == '-' && ! (range = _parseNumber(range + 1, &last)))
+                                break;
+                        _growCpus((int)last + 1);
+                        for (long long cpu = first; cpu <= last; cpu++)
+                                cpustat.node[cpu] = (int)node;
+                        range = *range == ',' ? range + 1 : NULL;
+                }
+                if (node >= nodes)
+                        nodes = (int)node + 1;
+        }
+        closedir(dir);
+        if (nodes) {
+                cpustat.node_busy = CALLOC(nodes, sizeof(unsigned long long));
+                cpustat.node_total = CALLOC(nodes, sizeof(unsigned long long));
+        }
+        systeminfo.nodes = nodes;
+        DEBUG("system statistic -- %d NUMA node(s)\n", nodes);
+}
+
+
+/**
+ * Read the complete /proc/stat file into the growing per-CPU buffer
+ * @return The file content or NULL on error
+ */
+static char *_readStat() {
+        if (! cpustat.buffer) {
+                cpustat.buffer_size = 8192;
+                cpustat.buffer = ALLOC(cpustat.buffer_size);
+        }
+        int bytes;
+        while ((bytes = _readSystemFile(&statfd, "/proc/stat", cpustat.buffer, cpustat.buffer_size)) == cpustat.buffer_size - 1) {
+                cpustat.buffer_size *= 2;
+                RESIZE(cpustat.buffer, cpustat.buffer_size);
+        }
+        return bytes < 0 ? NULL : cpustat.buffer;
+}
+
+
+/**
+ * Update the busiest CPU and NUMA node usage from the per-CPU lines of /proc/stat.
+ * The CPU usage is the user, nice, system, irq and softirq time share
+ * @param si The system info
+ * @param stat The /proc/stat content (the aggregate cpu line first)
+ */
+static void _updateCpus(SystemInfo_T *si, char *stat) {
+        si->cpu_max = -1;
+        si->cpu_max_percent = -10;
+        si->node_max = -1;
+        si->node_max_percent = -10;
+        for (int i = 0; i < si->nodes; i++)
+                cpustat.node_busy[i] = cpustat.node_total[i] = 0ULL;
+        for (char *line = strchr(stat, '\n'); line && ! strncmp(line + 1, "cpu", 3); line = strchr(line + 1, '\n')) {
+                long long id, value[7] = {0LL};
+                char *tmp = _parseNumber(line + 4, &id);
+                if (! tmp || id < 0 || _parseCpuTimes(tmp, value) < 4)
+                        continue;
+                _growCpus((int)id + 1);
+                unsigned long long busy = value[0] + value[1] + value[2] + value[5] + value[6];
+                unsigned long long total = busy + value[3] + value[4];
+                if (cpustat.total[id] && total > cpustat.total[id] && busy >= cpustat.busy[id]) {
+                        unsigned long long delta_busy = busy - cpustat.busy[id], delta_total = total - cpustat.total[id];
+                        int percent = (int)(1000 * (double)delta_busy / delta_total);
+                        if (percent > si->cpu_max_percent) {
+                                si->cpu_max_percent = percent;
+                                si->cpu_max = (int)id;
+                        }
+                        int node = cpustat.node[id];
+                        if (node >= 0 && node < si->nodes) {
+                                cpustat.node_busy[node] += delta_busy;
+                                cpustat.node_total[node] += delta_total;
+                        }
+                }
+                cpustat.busy[id] = busy;
+                cpustat.total[id] = total;
+        }
+        for (int i = 0; i < si->nodes; i++) {
+                if (cpustat.node_total[i]) {
+                        int percent = (int)(1000 * (double)cpustat.node_busy[i] / cpustat.node_total[i]);
+                        if (percent > si->node_max_percent) {
+                                si->node_max_percent = percent;
+                                si->node_max = i;
+                        }
+                }
+        }
+}
+
+
+/**
+ * Parse the /proc/PID/stat content
+ * @param pid The process id
+ * @param starttime The system boot time
+ * @param pt The process entry to fill
+ * @param buffer The stat content (modified)
+ * @param procname The buffer for the process name (used if the cmdline is empty)
+ * @return true if succeeded otherwise false
+ */
+static boolean_t _parseStat(int pid, time_t starttime, ProcessTree_T *pt, char *buffer, char procname[STRLEN]) {
+        char      *tmp = NULL;
+        char      *name;
+        long long  stat_ppid = 0;
+        long long  stat_item_utime = 0;
+        long long  stat_item_stime = 0;
+        long long  stat_item_starttime = 0;
+        long long  stat_item_rss = 0;
+        char       stat_item_state;
+
+        if (! (name = strchr(buffer, '(')) || ! (tmp = strrchr(buffer, ')'))) {
+                DEBUG("system statistic error -- file /proc/%d/stat parse error\n", pid);
+                return false;
+        }
+        *tmp = 0;
+        name++;
+        name[strcspn(name, " \t")] = 0;
+        tmp += 2;
+        stat_item_state = *tmp++;
+        if (! (tmp = _parseNumber(tmp, &stat_ppid)) ||
+            ! (tmp = _parseNumber(_skipFields(tmp, 9), &stat_item_utime)) ||
+            ! (tmp = _parseNumber(tmp, &stat_item_stime)) ||
+            ! (tmp = _parseNumber(_skipFields(tmp, 6), &stat_item_starttime)) ||
+            ! (tmp = _parseNumber(_skipFields(tmp, 1), &stat_item_rss))) {
+                DEBUG("system statistic error -- file /proc/%d/stat parse error\n", pid);
+                return false;
+        }
+        /* Save the process name, the buffer may be reused for the next files */
+        snprintf(procname, STRLEN, "%s", name);
+
+        pt->time = get_float_time();
+        pt->pid = pid;
+        pt->ppid = (pid_t)stat_ppid;
+        pt->starttime = starttime + (time_t)(stat_item_starttime / HZ);
+        pt->cputime = ((float)(stat_item_utime + stat_item_stime) * 10.0) / HZ; // jiffies -> seconds = 1 / HZ. HZ is defined in "asm/param.h" and it is usually 1/100s but on alpha system it is 1/1024s
+        pt->cpu_percent = 0;
+        pt->mem_kbyte = (page_shift_to_kb < 0) ? (stat_item_rss >> abs(page_shift_to_kb)) : (stat_item_rss << abs(page_shift_to_kb));
+        pt->zombie = stat_item_state == 'Z'; // State is Zombie -> then we are a Zombie ... clear or? (-:
+        return true;
+}
+
+
+/**
+ * Parse the process credentials of the /proc/PID/status content
+ * @param pt The process entry to fill
+ * @param buffer The status content
+ * @return true if succeeded otherwise false
+ */
+static boolean_t _parseStatus(ProcessTree_T *pt, char *buffer) {
+        char      *tmp = NULL;
+        long long  stat_uid = 0;
+        long long  stat_euid = 0;
+        long long  stat_gid = 0;
+
+        if (! (tmp = strstr(buffer, UID))) {
+                DEBUG("system statistic error -- cannot find process uid\n");
+                return false;
+        }
+        if (! (tmp = _parseNumber(tmp + strlen(UID), &stat_uid)) || ! _parseNumber(tmp, &stat_euid)) {
+                DEBUG("system statistic error -- cannot read process uid\n");
+                return false;
+        }
+        if (! (tmp = strstr(tmp, GID))) {
+                DEBUG("system statistic error -- cannot find process gid\n");
+                return false;
+        }
+        if (! _parseNumber(tmp + strlen(GID), &stat_gid)) {
+                DEBUG("system statistic error -- cannot read process gid\n");
+                return false;
+        }
+        pt->uid = (int)stat_uid;
+        pt->euid = (int)stat_euid;
+        pt->gid = (int)stat_gid;
+        return true;
+}
+
+
+/**
+ * Read the /proc/PID/stat and /proc/PID/status of one process
+ * @param procfd The /proc directory descriptor
+ * @param pid The process id
+ * @param starttime The system boot time
+ * @param pt The process entry to fill (all fields except the cmdline)
+ * @param buffer The read buffer
+ * @param size The read buffer size
+ * @param procname The buffer for the process name (used if the cmdline is empty)
+ * @return true if succeeded otherwise false
+ */
+static boolean_t _readProcess(int procfd, int pid, time_t starttime, ProcessTree_T *pt, char *buffer, int size, char procname[STRLEN]) {
+        if (_readFile(procfd, pid, "stat", buffer, size) < 0) {
+                DEBUG("system statistic error -- cannot read /proc/%d/stat\n", pid);
+                return false;
+        }
+        if (! _parseStat(pid, starttime, pt, buffer, procname))
+                return false;
+        if (_readFile(procfd, pid, "status", buffer, size) < 0) {
+                DEBUG("system statistic error -- cannot read /proc/%d/status\n", pid);
+                return false;
+        }
+        return _parseStatus(pt, buffer);
+}
+
+
+/**
+ * Store the process command line in the arena. The cmdline file contains
+ * the argv strings separated by '\0', they are joined by spaces. The
+ * pointers are set when the arena is complete as it may move when growing
+ * @param a The arena
+ * @param index The process entry index
+ * @param cmdline The cmdline file content (modified)
+ * @param bytes The cmdline file length
+ * @param procname The process name used if the command line is empty (kernel threads)
+ */
+static void _storeCmdline(CmdlineArena_T *a, int index, char *cmdline, int bytes, const char *procname) {
+        for (int j = 0; j < (bytes - 1); j++)
+                if (cmdline[j] == 0)
+                        cmdline[j] = ' ';
+        const char *value = *cmdline ? cmdline : procname;
+        int length = (int)strlen(value) + 1;
+        if (a->used + length > a->size) {
+                a->size = (a->size + length) * 2;
+                RESIZE(a->data, a->size);
+        }
+        memcpy(a->data + a->used, value, length);
+        a->offset[index] = a->used;
+        a->used += length;
+}
+
+
+/**
+ * Read the processes of the scanner's partition synchronously. Only the
+ * complete entries count, a partial entry is overwritten by the next process
+ * @param scanner The Scanner_T
+ */
+static void *_scanner(void *scanner) {
+        Scanner_T *S = scanner;
+        S->arena.size = S->count * 64;
+        S->arena.data = ALLOC(S->arena.size);
+        S->arena.offset = ALLOC(S->count * sizeof(int));
+        for (int i = S->first; i < S->first + S->count; i++) {
+                char procname[STRLEN];
+                if (! _readProcess(S->procfd, pids[i], S->starttime, &S->pt[S->treesize], S->buffer, sizeof(S->buffer), procname))
+                        continue;
+                int bytes = _readFile(S->procfd, pids[i], "cmdline", S->buffer, sizeof(S->buffer));
+                if (bytes < 0) {
+                        DEBUG("system statistic error -- cannot read /proc/%d/cmdline\n", pids[i]);
+                        continue;
+                }
+                _storeCmdline(&S->arena, S->treesize++, S->buffer, bytes, procname);
+        }
+        return NULL;
+}
+
+
+/**
+ * Read the process table using the pool of Run.process_workers threads. The
+ * pids are partitioned, each worker reads its partition into its own entries
+ * and arena, which are merged into the snapshot when all workers finished.
+ * If a worker cannot be started, its partition is read in this thread
+ * @param procfd The /proc directory descriptor
+ * @param count The number of processes in the pids array
+ * @param starttime The system boot time
+ * @param pt The process tree to fill
+ * @param workers The number of workers
+ * @return the number of processes read
+ */
+static int _readProcessesParallel(int procfd, int count, time_t starttime, ProcessTree_T *pt, int workers) {
+        Scanner_T *scanners = CALLOC(workers, sizeof(Scanner_T));
+        Thread_T *threads = CALLOC(workers, sizeof(Thread_T));
+        for (int i = 0, first = 0; i < workers; i++) {
+                scanners[i].procfd = procfd;
+                scanners[i].starttime = starttime;
+                scanners[i].first = first;
+                scanners[i].count = count / workers + (i < count % workers);
+                scanners[i].pt = pt + first;
+                first += scanners[i].count;
+        }
+        volatile int started = 1; // The first partition is read in this thread
+        TRY
+        {
+                for (; started < workers; started++)
+                        Thread_create(threads[started], _scanner, &scanners[started]);
+        }
+        ELSE
+        {
+                LogError("Process table -- cannot create worker thread -- %s\n", Exception_frame.message);
+        }
+        END_TRY;
+        _scanner(&scanners[0]);
+        for (int i = started; i < workers; i++)
+                _scanner(&scanners[i]);
+        for (int i = 1; i < started; i++)
+                Thread_join(threads[i]);
+        /* Merge the partitions, the entries are moved to the front and the arenas are concatenated */
+        int treesize = 0;
+        for (int i = 0; i < workers; i++) {
+                Scanner_T *S = &scanners[i];
+                if (S->pt != pt + treesize)
+                        memmove(pt + treesize, S->pt, S->treesize * sizeof(ProcessTree_T));
+                if (arena.used + S->arena.used > arena.size) {
+                        arena.size = arena.used + S->arena.used;
+                        RESIZE(arena.data, arena.size);
+                }
+                memcpy(arena.data + arena.used, S->arena.data, S->arena.used);
+                for (int j = 0; j < S->treesize; j++)
+                        arena.offset[treesize + j] = arena.used + S->arena.offset[j];
+                arena.used += S->arena.used;
+                treesize += S->treesize;
+                FREE(S->arena.data);
+                FREE(S->arena.offset);
+        }
+        FREE(threads);
+        FREE(scanners);
+        return treesize;
+}
+
+
+#ifdef HAVE_IO_URING
+
+
+/**
+ * Disable io_uring, the process table is read synchronously from now on
+ */
+static void _uringDisable(const char *reason) {
+        DEBUG("system statistic -- io_uring not used, reading /proc synchronously: %s\n", reason);
+        if (uring.fd >= 0) {
+                close(uring.fd);
+                uring.fd = -1;
+        }
+        uring.disabled = true;
+}
+
+
+/**
+ * Setup the io_uring on the first use. The openat, read and close operations
+ * are needed (Linux 5.6+), older kernels or systems where io_uring is blocked
+ * (seccomp, io_uring_disabled sysctl) use the synchronous reads. The rings are
+ * kept mapped for the lifetime of monit, the descriptor is close-on-exec
+ * @return true if the io_uring is ready, otherwise false
+ */
+static boolean_t _uringOpen() {
+        if (uring.fd >= 0)
+                return true;
+        if (uring.disabled)
+                return false;
+        struct io_uring_params p = {};
+        if ((uring.fd = (int)syscall(__NR_io_uring_setup, URING_SLOTS, &p)) < 0) {
+                _uringDisable(STRERROR);
+                return false;
+        }
+        struct {
+                struct io_uring_probe probe;
+                struct io_uring_probe_op ops[256];
+        } probe = {};
+        if (syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_PROBE, &probe, 256) < 0) {
+                _uringDisable("probe not supported");
+                return false;
+        }
+        int ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE};
+        for (int i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+                if (ops[i] > probe.probe.last_op || ! (probe.ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                        _uringDisable("file operations not supported");
+                        return false;
+                }
+        }
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+                sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+        char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+        char *cq = sq == MAP_FAILED || (p.features & IORING_FEAT_SINGLE_MMAP) ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+        void *sqes = cq == MAP_FAILED ? MAP_FAILED : mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+                _uringDisable(STRERROR);
+                return false;
+        }
+        uring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+        uring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+        uring.sq_array = (unsigned *)(sq + p.sq_off.array);
+        uring.cq_head = (unsigned *)(cq + p.cq_off.head);
+        uring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+        uring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+        uring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+        uring.sqes = sqes;
+        uring.buffer = ALLOC(URING_SLOTS * sizeof(buf));
+        DEBUG("system statistic -- reading /proc using io_uring\n");
+        return true;
+}
+
+
+/**
+ * Prepare the operation in the submission queue entry of the slot
+ */
+static struct io_uring_sqe *_uringPrepare(int slot, int opcode, int fd) {
+        struct io_uring_sqe *sqe = &uring.sqes[slot];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = slot;
+        return sqe;
+}
+
+
+/**
+ * Submit the prepared operations and wait for all completions. The results
+ * are stored in uring.result by slot
+ * @param slots The slots of the prepared entries
+ * @param count The number of the prepared entries
+ * @return true if succeeded, false if io_uring failed (the results are undefined)
+ */
+static boolean_t _uringSubmit(int *slots, int count) {
+        if (! count)
+                return true;
+        unsigned tail = *uring.sq_tail;
+        for (int i = 0; i < count; i++)
+                uring.sq_array[(tail + i) & *uring.sq_mask] = slots[i];
+        __atomic_store_n(uring.sq_tail, tail + count, __ATOMIC_RELEASE);
+        int submit = count, completed = 0;
+        while (completed < count) {
+                if (syscall(__NR_io_uring_enter, uring.fd, submit, count - completed, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return false;
+                }
+                submit = 0;
+                unsigned head = *uring.cq_head;
+                for (unsigned ctail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE); head != ctail; head++, completed++) {
+                        struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+                        uring.result[cqe->user_data] = cqe->res;
+                }
+                __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+        }
+        return true;
+}
+
+
+/**
+ * Read the stat, status and cmdline files of the processes using io_uring.
+ * The processes are read in batches of URING_BATCH, each batch needs three
+ * io_uring_enter calls (open all, read all, close all) instead of 9 syscalls
+ * per process
+ * @param procfd The /proc directory descriptor
+ * @param count The number of processes in the pids array
+ * @param starttime The system boot time
+ * @param pt The process tree to fill
+ * @return the number of processes read or -1 if io_uring failed and the synchronous read must be used
+ */
+static int _readProcessesUring(int procfd, int count, time_t starttime, ProcessTree_T *pt) {
+        static const char *files[URING_FILES] = {"stat", "status", "cmdline"};
+        int treesize = 0;
+        int slots[URING_SLOTS];
+        int size = (int)sizeof(buf);
+        for (int first = 0; first < count; first += URING_BATCH) {
+                int batch = count - first < URING_BATCH ? count - first : URING_BATCH;
+                int n = 0;
+                /* Open the files of all processes in the batch */
+                for (int i = 0; i < batch; i++) {
+                        for (int f = 0; f < URING_FILES; f++) {
+                                int slot = i * URING_FILES + f;
+                                snprintf(uring.path[slot], sizeof(uring.path[slot]), "%d/%s", pids[first + i], files[f]);
+                                struct io_uring_sqe *sqe = _uringPrepare(slot, IORING_OP_OPENAT, procfd);
+                                sqe->addr = (unsigned long)uring.path[slot];
+                                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                                slots[n++] = slot;
+                        }
+                }
+                if (! _uringSubmit(slots, n))
+                        goto error;
+                /* Read the opened files */
+                n = 0;
+                for (int slot = 0; slot < batch * URING_FILES; slot++) {
+                        if ((uring.fds[slot] = uring.result[slot]) >= 0) {
+                                struct io_uring_sqe *sqe = _uringPrepare(slot, IORING_OP_READ, uring.fds[slot]);
+                                sqe->addr = (unsigned long)(uring.buffer + slot * size);
+                                sqe->len = size - 1;
+                                slots[n++] = slot;
+                        }
+                }
+                if (! _uringSubmit(slots, n))
+                        goto error;
+                /* Close the files, the read results are saved first as the slot results are reused */
+                int bytes[URING_SLOTS];
+                for (int slot = 0; slot < batch * URING_FILES; slot++)
+                        bytes[slot] = uring.fds[slot] >= 0 ? uring.result[slot] : -1;
+                n = 0;
+                for (int slot = 0; slot < batch * URING_FILES; slot++)
+                        if (uring.fds[slot] >= 0)
+                                _uringPrepare(slots[n++] = slot, IORING_OP_CLOSE, uring.fds[slot]);
+                if (! _uringSubmit(slots, n)) {
+                        for (int slot = 0; slot < batch * URING_FILES; slot++)
+                                if (uring.fds[slot] >= 0)
+                                        close(uring.fds[slot]);
+                        goto error;
+                }
+                /* Parse the processes, only complete entries count as in the synchronous read */
+                for (int i = 0; i < batch; i++) {
+                        int pid = pids[first + i];
+                        char procname[STRLEN];
+                        char *stat = uring.buffer + (i * URING_FILES) * size;
+                        char *status = stat + size;
+                        char *cmdline = status + size;
+                        int *length = bytes + i * URING_FILES;
+                        if (length[0] < 0 || length[1] < 0 || length[2] < 0) {
+                                DEBUG("system statistic error -- cannot read /proc/%d\n", pid);
+                                continue;
+                        }
+                        stat[length[0]] = status[length[1]] = cmdline[length[2]] = 0;
+                        if (! _parseStat(pid, starttime, &pt[treesize], stat, procname) || ! _parseStatus(&pt[treesize], status))
+                                continue;
+                        _storeCmdline(&arena, treesize, cmdline, length[2], procname);
+                        treesize++;
+                }
+        }
+        return treesize;
+error:
+        _uringDisable(STRERROR);
+        return -1;
+}
+
+
+#endif
+
+
 /* ------------------------------------------------------------------ Public */
 
 
 boolean_t init_process_info_sysdep(void) {
-        char *ptr;
-        char  buf[2048];
+        char  buf[4096];
         long  page_size;
         int   page_shift;
 
-        if (! read_proc_file(buf, sizeof(buf), "meminfo", -1, NULL)) {
+        if (_readSystemFile(&meminfofd, "/proc/meminfo", buf, sizeof(buf)) < 0) {
                 DEBUG("system statistic error -- cannot read /proc/meminfo\n");
                 return false;
         }
-        if (! (ptr = strstr(buf, MEMTOTAL))) {
-                DEBUG("system statistic error -- cannot get real memory amount\n");
-                return false;
-        }
-        if (sscanf(ptr+strlen(MEMTOTAL), "%ld", &systeminfo.mem_kbyte_max) != 1) {
+        const char *keys[] = {MEMTOTAL, NULL};
+        long long mem_total = 0LL;
+        if (_parseMeminfo(buf, keys, &mem_total) != 1) {
                 DEBUG("system statistic error -- cannot get real memory amount\n");
                 return false;
         }
+        systeminfo.mem_kbyte_max = (long)mem_total;
 
         if ((systeminfo.cpus = sysconf(_SC_NPROCESSORS_CONF)) < 0) {
                 DEBUG("system statistic error -- cannot get cpu count: %s\n", STRERROR);
@@ -182,128 +1002,183 @@ boolean_t init_process_info_sysdep(void) {
  * @return treesize>0 if succeeded otherwise =0.
  */
 int initprocesstree_sysdep(ProcessTree_T ** reference) {
-        int                 rv, bytes = 0;
+        int                 procfd;
+        int                 count;
         int                 treesize = 0;
-        int                 stat_pid = 0;
-        int                 stat_ppid = 0;
-        int                 stat_uid = 0;
-        int                 stat_euid = 0;
-        int                 stat_gid = 0;
-        char               *tmp = NULL;
-        char                procname[STRLEN];
-        char                buf[4096];
-        char                stat_item_state;
-        long                stat_item_cutime = 0;
-        long                stat_item_cstime = 0;
-        long                stat_item_rss = 0;
-        glob_t              globbuf;
-        unsigned long       stat_item_utime = 0;
-        unsigned long       stat_item_stime = 0;
-        unsigned long long  stat_item_starttime = 0ULL;
+        int                 bytes = 0;
         ProcessTree_T      *pt = NULL;
 
         ASSERT(reference);
 
+        if ((procfd = open("/proc", O_RDONLY | O_DIRECTORY)) < 0) {
+                LogError("system statistic error -- cannot open /proc: %s\n", STRERROR);
+                return 0;
+        }
+
         /* Find all processes in the /proc directory */
-        if ((rv = glob("/proc/[0-9]*", GLOB_ONLYDIR, NULL, &globbuf))) {
-                LogError("system statistic error -- glob failed: %d (%s)\n", rv, STRERROR);
+        if ((count = _readPids(procfd)) <= 0) {
+                close(procfd);
                 return 0;
         }
 
-        treesize = globbuf.gl_pathc;
+        pt = CALLOC(sizeof(ProcessTree_T), count);
+        RESIZE(arena.offset, count * sizeof(int));
+        arena.size = count * 64;
+        arena.used = 0;
+        arena.data = ALLOC(arena.size);
 
-        pt = CALLOC(sizeof(ProcessTree_T), treesize);
+        time_t starttime = get_starttime();
 
-        /* Insert data from /proc directory */
-        for (int i = 0; i < treesize; i++) {
-                stat_pid = atoi(globbuf.gl_pathv[i] + strlen("/proc/"));
+        /* On very large process tables the partitions are read in parallel, each worker needs SCAN_MIN processes at least */
+        int workers = Run.process_workers < count / SCAN_MIN ? Run.process_workers : count / SCAN_MIN;
+        if (workers > 1) {
+                treesize = _readProcessesParallel(procfd, count, starttime, pt, workers);
+                goto done;
+        }
 
-                /********** /proc/PID/stat **********/
-                if (! read_proc_file(buf, sizeof(buf), "stat", stat_pid, NULL)) {
-                        DEBUG("system statistic error -- cannot read /proc/%d/stat\n", stat_pid);
-                        continue;
-                }
-                if (! (tmp = strrchr(buf, ')'))) {
-                        DEBUG("system statistic error -- file /proc/%d/stat parse error\n", stat_pid);
-                        continue;
-                }
-                *tmp = 0;
-                if (sscanf(buf, "%*d (%256s", procname) != 1) {
-                        DEBUG("system statistic error -- file /proc/%d/stat process name parse error\n", stat_pid);
-                        continue;
-                }
-                tmp += 2;
-                if (sscanf(tmp,
-                           "%c %d %*d %*d %*d %*d %*u %*u"
-                           "%*u %*u %*u %lu %lu %ld %ld %*d %*d %*d "
-                           "%*u %llu %*u %ld %*u %*u %*u %*u %*u "
-                           "%*u %*u %*u %*u %*u %*u %*u %*u %*d %*d\n",
-                           &stat_item_state,
-                           &stat_ppid,
-                           &stat_item_utime,
-                           &stat_item_stime,
-                           &stat_item_cutime,
-                           &stat_item_cstime,
-                           &stat_item_starttime,
-                           &stat_item_rss) != 8) {
-                        DEBUG("system statistic error -- file /proc/%d/stat parse error\n", stat_pid);
-                        continue;
-                }
+#ifdef HAVE_IO_URING
+        /* Read the process table in batches, if io_uring fails, the whole table is re-read synchronously */
+        if (_uringOpen() && (treesize = _readProcessesUring(procfd, count, starttime, pt)) < 0) {
+                treesize = 0;
+                arena.used = 0;
+                memset(pt, 0, count * sizeof(ProcessTree_T));
+        }
+        if (uring.disabled)
+#endif
+        /* Insert data from /proc directory */
+        for (int i = 0; i < count; i++) {
+                int stat_pid = pids[i];
 
-                /********** /proc/PID/status **********/
-                if (! read_proc_file(buf, sizeof(buf), "status", stat_pid, NULL)) {
-                        DEBUG("system statistic error -- cannot read /proc/%d/status\n", stat_pid);
+                char procname[STRLEN];
+                if (! _readProcess(procfd, stat_pid, starttime, &pt[treesize], buf, sizeof(buf), procname))
                         continue;
-                }
-                if (! (tmp = strstr(buf, UID))) {
-                        DEBUG("system statistic error -- cannot find process uid\n");
-                        continue;
-                }
-                if (sscanf(tmp+strlen(UID), "\t%d\t%d", &stat_uid, &stat_euid) != 2) {
-                        DEBUG("system statistic error -- cannot read process uid\n");
-                        continue;
-                }
-                if (! (tmp = strstr(buf, GID))) {
-                        DEBUG("system statistic error -- cannot find process gid\n");
-                        continue;
-                }
-                if (sscanf(tmp+strlen(GID), "\t%d", &stat_gid) != 1) {
-                        DEBUG("system statistic error -- cannot read process gid\n");
-                        continue;
-                }
 
                 /********** /proc/PID/cmdline **********/
-                if (! read_proc_file(buf, sizeof(buf), "cmdline", stat_pid, &bytes)) {
+                if ((bytes = _readFile(procfd, stat_pid, "cmdline", buf, sizeof(buf))) < 0) {
                         DEBUG("system statistic error -- cannot read /proc/%d/cmdline\n", stat_pid);
                         continue;
                 }
-                for (int j = 0; j < (bytes - 1); j++) // The cmdline file contains argv elements/strings terminated separated by '\0' => join the string
-                        if (buf[j] == 0)
-                                buf[j] = ' ';
-
-                /* Set the data in ptree only if all process related reads succeeded (prevent partial data in the case that continue was called during data gathering) */
-                pt[i].time = get_float_time();
-                pt[i].pid = stat_pid;
-                pt[i].ppid = stat_ppid;
-                pt[i].uid = stat_uid;
-                pt[i].euid = stat_euid;
-                pt[i].gid = stat_gid;
-                pt[i].starttime = get_starttime() + (time_t)(stat_item_starttime / HZ);
-                pt[i].cmdline = Str_dup(*buf ? buf : procname);
-                pt[i].cputime = ((float)(stat_item_utime + stat_item_stime) * 10.0) / HZ; // jiffies -> seconds = 1 / HZ. HZ is defined in "asm/param.h" and it is usually 1/100s but on alpha system it is 1/1024s
-                pt[i].cpu_percent = 0;
-                pt[i].mem_kbyte = (page_shift_to_kb < 0) ? (stat_item_rss >> abs(page_shift_to_kb)) : (stat_item_rss << abs(page_shift_to_kb));
-                if (stat_item_state == 'Z') // State is Zombie -> then we are a Zombie ... clear or? (-:
-                        pt[i].zombie = true;
+                _storeCmdline(&arena, treesize, buf, bytes, procname);
+
+                /* The entry counts only if all process related reads succeeded (a partial entry is overwritten by the next process) */
+                treesize++;
+        }
+done:
+        close(procfd);
+
+        /* The first command line owns the arena, it is freed with the snapshot (see delprocesstree) */
+        if (treesize) {
+                for (int i = 0; i < treesize; i++) {
+                        pt[i].cmdline = arena.data + arena.offset[i];
+                        pt[i].cmdline_shared = i > 0;
+                }
+        } else {
+                FREE(arena.data);
+                FREE(pt);
         }
+        arena.data = NULL;
 
         *reference = pt;
-        globfree(&globbuf);
 
         return treesize;
 }
 
 
+/**
+ * Read one process directly, without the whole process tree. The entry
+ * has no cmdline and no children
+ * @param pid The process id
+ * @param pt The process entry to fill
+ * @return true if succeeded otherwise false
+ */
+boolean_t process_info_sysdep(pid_t pid, ProcessTree_T *pt) {
+        ASSERT(pt);
+        int procfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (procfd < 0) {
+                DEBUG("system statistic error -- cannot open /proc: %s\n", STRERROR);
+                return false;
+        }
+        char buffer[4096];
+        char procname[STRLEN];
+        memset(pt, 0, sizeof(ProcessTree_T));
+        boolean_t rv = _readProcess(procfd, (int)pid, get_starttime(), pt, buffer, sizeof(buffer), procname);
+        close(procfd);
+        return rv;
+}
+
+
+/**
+ * Read the per-process resources requested by the flags. The buffers are
+ * local as the service checks may run in parallel
+ * @param pid The process id
+ * @param flags The ProcessResource_* bitmap of the resources to read
+ * @param R The result, the resources not read are kept unchanged
+ * @return true if all requested resources were read, otherwise false
+ */
+boolean_t process_resources_sysdep(pid_t pid, int flags, ProcessResources_T *R) {
+        char path[STRLEN], buffer[4096];
+        long long value;
+        boolean_t rv = true;
+        ASSERT(R);
+        int procfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (procfd < 0) {
+                LogError("system statistic error -- cannot open /proc: %s\n", STRERROR);
+                return false;
+        }
+        if (flags & ProcessResource_Threads) {
+                char *tmp;
+                if (_readFile(procfd, pid, "status", buffer, sizeof(buffer)) < 0 || ! (tmp = strstr(buffer, THREADS)) || ! _parseNumber(tmp + strlen(THREADS), &value)) {
+                        DEBUG("system statistic error -- cannot read the number of threads of the process %d\n", (int)pid);
+                        rv = false;
+                } else {
+                        R->threads = (int)value;
+                }
+        }
+        if (flags & ProcessResource_Fds) {
+                snprintf(path, sizeof(path), "%d/fd", (int)pid);
+                int fd = openat(procfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (fd < 0) {
+                        DEBUG("system statistic error -- cannot open /proc/%s: %s\n", path, STRERROR);
+                        rv = false;
+                } else {
+                        char entries[4096] __attribute__((aligned(8)));
+                        int count = 0;
+                        long n;
+                        while ((n = syscall(SYS_getdents64, fd, entries, sizeof(entries))) > 0) {
+                                for (long offset = 0; offset < n;) {
+                                        struct linux_dirent64 *d = (struct linux_dirent64 *)(entries + offset);
+                                        offset += d->d_reclen;
+                                        if (*d->d_name != '.')
+                                                count++;
+                                }
+                        }
+                        close(fd);
+                        if (n < 0) {
+                                DEBUG("system statistic error -- cannot read /proc/%s: %s\n", path, STRERROR);
+                                rv = false;
+                        } else {
+                                // Don't count the two descriptors opened here when monit checks itself
+                                R->fds = pid == getpid() ? count - 2 : count;
+                        }
+                }
+        }
+        if (flags & ProcessResource_IO) {
+                char *r, *w;
+                long long written;
+                if (_readFile(procfd, pid, "io", buffer, sizeof(buffer)) < 0 || ! (r = strstr(buffer, READBYTES)) || ! (w = strstr(buffer, WRITEBYTES)) || ! _parseNumber(r + strlen(READBYTES), &value) || ! _parseNumber(w + strlen(WRITEBYTES), &written)) {
+                        DEBUG("system statistic error -- cannot read the I/O statistic of the process %d\n", (int)pid);
+                        rv = false;
+                } else {
+                        R->io = true;
+                        R->read_bytes = (unsigned long long)value;
+                        R->write_bytes = (unsigned long long)written;
+                }
+        }
+        close(procfd);
+        return rv;
+}
+
+
 /**
  * This routine returns 'nelem' double precision floats containing
  * the load averages in 'loadv'; at most 3 values will be returned.
@@ -312,21 +1187,22 @@ int initprocesstree_sysdep(ProcessTree_T ** reference) {
  * @return: 0 if successful, -1 if failed (and all load averages are 0).
  */
 int getloadavg_sysdep(double *loadv, int nelem) {
-#ifdef HAVE_GETLOADAVG
-        return getloadavg(loadv, nelem);
-#else
         char buf[STRLEN];
         double load[3];
-        if (! read_proc_file(buf, sizeof(buf), "loadavg", -1, NULL))
+        if (_readSystemFile(&loadavgfd, "/proc/loadavg", buf, sizeof(buf)) < 0) {
+#ifdef HAVE_GETLOADAVG
+                return getloadavg(loadv, nelem);
+#else
                 return -1;
+#endif
+        }
         if (sscanf(buf, "%lf %lf %lf", &load[0], &load[1], &load[2]) != 3) {
                 DEBUG("system statistic error -- cannot get load average\n");
                 return -1;
         }
-        for (int i = 0; i < nelem; i++)
+        for (int i = 0; i < nelem && i < 3; i++)
                 loadv[i] = load[i];
         return 0;
-#endif
 }
 
 
@@ -335,44 +1211,41 @@ int getloadavg_sysdep(double *loadv, int nelem) {
  * @return: true if successful, false if failed
  */
 boolean_t used_system_memory_sysdep(SystemInfo_T *si) {
-        char          *ptr;
-        char           buf[2048];
-        unsigned long  mem_free = 0UL;
-        unsigned long  buffers = 0UL;
-        unsigned long  cached = 0UL;
-        unsigned long  slabreclaimable = 0UL;
-        unsigned long  swap_total = 0UL;
-        unsigned long  swap_free = 0UL;
-
-        if (! read_proc_file(buf, sizeof(buf), "meminfo", -1, NULL)) {
+        char buf[4096];
+        /* The order of the keys matches the values indexes below */
+        const char *keys[] = {MEMFREE, MEMBUF, MEMCACHE, SLABRECLAIMABLE, SWAPTOTAL, SWAPFREE, NULL};
+        long long values[] = {-1LL, -1LL, -1LL, -1LL, -1LL, -1LL};
+
+        if (_readSystemFile(&meminfofd, "/proc/meminfo", buf, sizeof(buf)) < 0) {
                 LogError("system statistic error -- cannot get real memory free amount\n");
                 goto error;
         }
+        _parseMeminfo(buf, keys, values);
 
         /* Memory */
-        if (! (ptr = strstr(buf, MEMFREE)) || sscanf(ptr + strlen(MEMFREE), "%ld", &mem_free) != 1) {
+        if (values[0] < 0) {
                 LogError("system statistic error -- cannot get real memory free amount\n");
                 goto error;
         }
-        if (! (ptr = strstr(buf, MEMBUF)) || sscanf(ptr + strlen(MEMBUF), "%ld", &buffers) != 1)
-                DEBUG("system statistic error -- cannot get real memory buffers amount\n");
-        if (! (ptr = strstr(buf, MEMCACHE)) || sscanf(ptr + strlen(MEMCACHE), "%ld", &cached) != 1)
-                DEBUG("system statistic error -- cannot get real memory cache amount\n");
-        if (! (ptr = strstr(buf, SLABRECLAIMABLE)) || sscanf(ptr + strlen(SLABRECLAIMABLE), "%ld", &slabreclaimable) != 1)
-                DEBUG("system statistic error -- cannot get slab reclaimable memory amount\n");
-        si->total_mem_kbyte = systeminfo.mem_kbyte_max - mem_free - buffers - cached - slabreclaimable;
+        for (int i = 1; i < 4; i++) {
+                if (values[i] < 0) {
+                        DEBUG("system statistic error -- cannot get the %s memory amount\n", keys[i]);
+                        values[i] = 0LL;
+                }
+        }
+        si->total_mem_kbyte = systeminfo.mem_kbyte_max - (long)(values[0] + values[1] + values[2] + values[3]);
 
         /* Swap */
-        if (! (ptr = strstr(buf, SWAPTOTAL)) || sscanf(ptr + strlen(SWAPTOTAL), "%ld", &swap_total) != 1) {
+        if (values[4] < 0) {
                 LogError("system statistic error -- cannot get swap total amount\n");
                 goto error;
         }
-        if (! (ptr = strstr(buf, SWAPFREE)) || sscanf(ptr + strlen(SWAPFREE), "%ld", &swap_free) != 1) {
+        if (values[5] < 0) {
                 LogError("system statistic error -- cannot get swap free amount\n");
                 goto error;
         }
-        si->swap_kbyte_max   = swap_total;
-        si->total_swap_kbyte = swap_total - swap_free;
+        si->swap_kbyte_max   = (long)values[4];
+        si->total_swap_kbyte = (long)(values[4] - values[5]);
 
         return true;
 
@@ -388,7 +1261,7 @@ error:
  * @return: true if successful, false if failed (or not available)
  */
 boolean_t used_system_cpu_sysdep(SystemInfo_T *si) {
-        boolean_t rv;
+        int rv;
         unsigned long long cpu_total;
         unsigned long long cpu_user;
         unsigned long long cpu_nice;
@@ -398,29 +1271,39 @@ boolean_t used_system_cpu_sysdep(SystemInfo_T *si) {
         unsigned long long cpu_irq;
         unsigned long long cpu_softirq;
         char buf[STRLEN];
-
-        if (! read_proc_file(buf, sizeof(buf), "stat", -1, NULL)) {
+        char *stat = buf;
+
+        if (si->percpu) {
+                /* The per-CPU lines follow the aggregate line, the whole file is read */
+                if (! cpustat.topology)
+                        _readTopology();
+                stat = _readStat();
+        } else if (_readSystemFile(&statfd, "/proc/stat", buf, sizeof(buf)) < 0) {
+                /* Only the aggregate cpu line at the beginning of the file is needed, the per cpu lines are not read */
+                stat = NULL;
+        }
+        if (! stat) {
                 LogError("system statistic error -- cannot read /proc/stat\n");
                 goto error;
         }
 
-        rv = sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu",
-                    &cpu_user,
-                    &cpu_nice,
-                    &cpu_syst,
-                    &cpu_idle,
-                    &cpu_wait,
-                    &cpu_irq,
-                    &cpu_softirq);
-        if (rv < 4) {
+        long long value[7] = {0LL};
+        if (strncmp(stat, "cpu ", 4)) {
                 LogError("system statistic error -- cannot read cpu usage\n");
                 goto error;
-        } else if (rv == 4) {
-                /* linux 2.4.x doesn't support these values */
-                cpu_wait    = 0;
-                cpu_irq     = 0;
-                cpu_softirq = 0;
         }
+        if ((rv = _parseCpuTimes(stat + 4, value)) < 4) {
+                LogError("system statistic error -- cannot read cpu usage\n");
+                goto error;
+        }
+        /* linux 2.4.x doesn't support the wait, irq and softirq values, they are kept 0 */
+        cpu_user    = value[0];
+        cpu_nice    = value[1];
+        cpu_syst    = value[2];
+        cpu_idle    = value[3];
+        cpu_wait    = value[4];
+        cpu_irq     = value[5];
+        cpu_softirq = value[6];
 
         cpu_total = cpu_user + cpu_nice + cpu_syst + cpu_idle + cpu_wait + cpu_irq + cpu_softirq;
         cpu_user  = cpu_user + cpu_nice;
@@ -441,6 +1324,9 @@ boolean_t used_system_cpu_sysdep(SystemInfo_T *si) {
         old_cpu_syst  = cpu_syst;
         old_cpu_wait  = cpu_wait;
         old_cpu_total = cpu_total;
+
+        if (si->percpu)
+                _updateCpus(si, stat);
         return true;
 
 error:
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+#include <signal.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_LINUX_NETLINK_H
+#include <linux/netlink.h>
+#endif
+
+#ifdef HAVE_LINUX_CONNECTOR_H
+#include <linux/connector.h>
+#endif
+
+#ifdef HAVE_LINUX_CN_PROC_H
+#include <linux/cn_proc.h>
+#endif
+
+#include "monit.h"
+#include "procwatch.h"
+
+// libmonit
+#include "system/Time.h"
+
+/**
+ *  Process events watcher - Linux proc connector client.
+ *
+ *  @file
+ */
+
+
+#if defined LINUX && defined HAVE_LINUX_NETLINK_H && defined HAVE_LINUX_CONNECTOR_H && defined HAVE_LINUX_CN_PROC_H
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define PROCWATCH_POLL 1000 // ms, interval to check the stop request
+
+
+static int sock = -1;
+static Thread_T thread;
+static pthread_t mainThread;
+static volatile boolean_t running = false;
+
+
+/* Exec events counter, the start method waits on it for the matching process */
+static struct {
+        Mutex_T mutex;
+        Sem_T event;
+        unsigned long long count;
+} execs = {.mutex = PTHREAD_MUTEX_INITIALIZER, .event = PTHREAD_COND_INITIALIZER};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Enable or disable the process events multicast for our socket
+ */
+static boolean_t _subscribe(boolean_t enable) {
+        char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+        memset(buf, 0, sizeof(buf));
+        struct nlmsghdr *hdr = (struct nlmsghdr *)buf;
+        hdr->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+        hdr->nlmsg_type = NLMSG_DONE;
+        struct cn_msg *msg = (struct cn_msg *)NLMSG_DATA(hdr);
+        msg->id.idx = CN_IDX_PROC;
+        msg->id.val = CN_VAL_PROC;
+        msg->len = sizeof(enum proc_cn_mcast_op);
+        *(enum proc_cn_mcast_op *)msg->data = enable ? PROC_CN_MCAST_LISTEN : PROC_CN_MCAST_IGNORE;
+        if (send(sock, buf, hdr->nlmsg_len, 0) < 0) {
+                LogError("Process events -- cannot %s the process events connector -- %s\n", enable ? "subscribe to" : "unsubscribe from", STRERROR);
+                return false;
+        }
+        return true;
+}
+
+
+/**
+ * Returns the monitored process service with the given pid or NULL. The
+ * service list is read without a lock. This is safe because the list and
+ * the service objects are replaced and freed only on reload and exit, and
+ * both stop the watcher first: ProcWatch_stop() joins this thread before
+ * gc() and gc_service_list() run, which assert it. The validator changes
+ * only the pid and the monitoring state of a listed service in place, a
+ * stale value makes us miss or add one wakeup at most
+ */
+static Service_T _getService(pid_t pid) {
+        for (Service_T s = servicelist; s; s = s->next)
+                if (s->type == Service_Process && s->monitor != Monitor_Not && s->inf->priv.process.pid == pid)
+                        return s;
+        return NULL;
+}
+
+
+static void _handle(struct proc_event *event) {
+        Service_T s = NULL;
+        switch (event->what) {
+                case PROC_EVENT_EXIT:
+                        /* Ignore threads exit, we're interested in the process (thread group leader) only */
+                        if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid && (s = _getService(event->event_data.exit.process_tgid)))
+                                LogInfo("'%s' process with pid %d exited -- waking up\n", s->name, event->event_data.exit.process_tgid);
+                        break;
+                case PROC_EVENT_EXEC:
+                        LOCK(execs.mutex)
+                        {
+                                execs.count++;
+                                Sem_broadcast(execs.event);
+                        }
+                        END_LOCK;
+                        if ((s = _getService(event->event_data.exec.process_tgid)))
+                                LogInfo("'%s' process with pid %d executed a new program -- waking up\n", s->name, event->event_data.exec.process_tgid);
+                        break;
+                default:
+                        break;
+        }
+        if (s)
+                pthread_kill(mainThread, SIGUSR1);
+}
+
+
+static void *_watcher(void *args) {
+        char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+        while (running && ! Run.stopped) {
+                struct pollfd fds = {.fd = sock, .events = POLLIN};
+                int rv = poll(&fds, 1, PROCWATCH_POLL);
+                if (rv < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        LogError("Process events -- poll failed -- %s\n", STRERROR);
+                        break;
+                } else if (rv == 0) {
+                        continue;
+                }
+                ssize_t n = recv(sock, buf, sizeof(buf), 0);
+                if (n < 0) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                continue;
+                        if (errno == ENOBUFS) {
+                                /* Events were lost, we cannot tell which processes exited => wake up and let the checks find out */
+                                DEBUG("Process events -- events queue overflow, waking up\n");
+                                pthread_kill(mainThread, SIGUSR1);
+                                continue;
+                        }
+                        LogError("Process events -- receive failed -- %s\n", STRERROR);
+                        break;
+                }
+                for (struct nlmsghdr *hdr = (struct nlmsghdr *)buf; NLMSG_OK(hdr, n); hdr = NLMSG_NEXT(hdr, n)) {
+                        if (hdr->nlmsg_type == NLMSG_ERROR || hdr->nlmsg_type == NLMSG_NOOP)
+                                continue;
+                        struct cn_msg *msg = (struct cn_msg *)NLMSG_DATA(hdr);
+                        if (msg->id.idx == CN_IDX_PROC && msg->id.val == CN_VAL_PROC)
+                                _handle((struct proc_event *)msg->data);
+                }
+        }
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+boolean_t ProcWatch_start() {
+        if (running)
+                return true;
+        if ((sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR)) < 0) {
+                LogError("Process events -- cannot create netlink socket -- %s\n", STRERROR);
+                return false;
+        }
+        struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC, .nl_pid = 0};
+        if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                LogError("Process events -- cannot bind netlink socket -- %s\n", STRERROR);
+                goto error;
+        }
+        if (! _subscribe(true))
+                goto error;
+        mainThread = pthread_self();
+        running = true;
+        Thread_create(thread, _watcher, NULL);
+        LogInfo("Process events watcher started\n");
+        return true;
+error:
+        close(sock);
+        sock = -1;
+        return false;
+}
+
+
+void ProcWatch_stop() {
+        if (! running)
+                return;
+        running = false;
+        LOCK(execs.mutex)
+        {
+                Sem_broadcast(execs.event);
+        }
+        END_LOCK;
+        Thread_join(thread);
+        _subscribe(false);
+        close(sock);
+        sock = -1;
+        LogInfo("Process events watcher stopped\n");
+}
+
+
+boolean_t ProcWatch_isRunning() {
+        return running;
+}
+
+
+boolean_t ProcWatch_waitExec(unsigned long long *seen, int timeout) {
+        ASSERT(seen);
+        boolean_t rv = false;
+        LOCK(execs.mutex)
+        {
+                if (running && execs.count == *seen) {
+                        struct timespec wait;
+                        long long deadline = Time_milli() + timeout;
+                        wait.tv_sec = deadline / 1000;
+                        wait.tv_nsec = (deadline % 1000) * 1000000;
+                        Sem_timeWait(execs.event, execs.mutex, wait);
+                }
+                rv = execs.count != *seen;
+                *seen = execs.count;
+        }
+        END_LOCK;
+        return rv;
+}
+
+
+#else
+
+
+boolean_t ProcWatch_start() {
+        LogError("Process events are not supported on this platform\n");
+        return false;
+}
+
+
+void ProcWatch_stop() {
+}
+
+
+boolean_t ProcWatch_isRunning() {
+        return false;
+}
+
+
+boolean_t ProcWatch_waitExec(unsigned long long *seen, int timeout) {
+        return false;
+}
+
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_PROCWATCH_H
+#define MONIT_PROCWATCH_H
+
+
+/**
+ * Process events watcher.
+ *
+ * On Linux, Monit can subscribe to the kernel process events connector
+ * (netlink) and get notified immediately when a monitored process exits
+ * or executes a new program. The watcher thread then wakes up the Monit
+ * daemon, so the process check and the restart action run right away
+ * instead of at the next poll cycle. The watcher is enabled using the
+ * "set process events" statement, it requires root privileges (or the
+ * CAP_NET_ADMIN capability). On other platforms the watcher is not
+ * available.
+ *
+ *  @file
+ */
+
+
+/**
+ * Start the process events watcher thread. Must be called from the
+ * main thread as the watcher wakes it up using the SIGUSR1 signal
+ * @return true if succeeded, otherwise false
+ */
+boolean_t ProcWatch_start();
+
+
+/**
+ * Stop the process events watcher thread. The watcher reads the service
+ * list without a lock, so it must be stopped before the service list is
+ * freed or rebuilt
+ */
+void ProcWatch_stop();
+
+
+/**
+ * Check if the process events watcher is running
+ * @return true if running, otherwise false
+ */
+boolean_t ProcWatch_isRunning();
+
+
+/**
+ * Wait until some process on the system executed a new program. Used by
+ * the start method to check for the matching process only when a new
+ * program was executed instead of scanning the process table periodically
+ * @param seen The number of exec events seen by the caller, updated on
+ * return. The caller initializes it to 0
+ * @param timeout Milliseconds to wait
+ * @return true if an exec event occurred since the events seen, false if
+ * the wait timed out or the watcher is not running
+ */
+boolean_t ProcWatch_waitExec(unsigned long long *seen, int timeout);
+
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "monit.h"
+#include "programwatch.h"
+
+// libmonit
+#include "system/Net.h"
+#include "system/Time.h"
+
+
+/**
+ *  Program check watcher - collects the program check results as soon as
+ *  the programs exit.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define PROGRAMWATCH_POLL 1000 // ms, interval to check the program timeouts and the stop request
+
+#define PROGRAMWATCH_FALLBACK 100 // ms, interval to check the programs exit if the process descriptors are not available
+
+
+struct mywatch {
+        Service_T s;                                 /**< The program service */
+        int pidfd;                 /**< Process file descriptor or -1 if n/a */
+};
+
+
+static struct {
+        Mutex_T mutex;
+        int count;                              /**< Number of watched programs */
+        int size;                            /**< Allocated size of the table */
+        struct mywatch *table;                           /**< Watched programs */
+        int wakeup[2];                              /**< New programs wakeup pipe */
+        boolean_t pidfd;              /**< true if the process descriptors are used */
+        volatile boolean_t running;
+        Thread_T thread;
+} watch = {.mutex = PTHREAD_MUTEX_INITIALIZER, .wakeup = {-1, -1}};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static void _wakeup() {
+        if (watch.wakeup[1] >= 0 && write(watch.wakeup[1], "", 1) < 0 && errno != EAGAIN)
+                DEBUG("Program watcher: wakeup failed -- %s\n", STRERROR);
+}
+
+
+/**
+ * Remove the service from the table. Must be called with the table locked
+ */
+static void _remove(Service_T s) {
+        for (int i = 0; i < watch.count; i++) {
+                if (watch.table[i].s == s) {
+                        if (watch.table[i].pidfd >= 0)
+                                close(watch.table[i].pidfd);
+                        watch.table[i] = watch.table[--watch.count];
+                        return;
+                }
+        }
+}
+
+
+/**
+ * Post the result of the program if it exited or kill it if the timeout expired
+ */
+static void _collect(Service_T s, time_t now) {
+        Process_T P = s->program->P;
+        if (Process_exitStatus(P) < 0) {
+                time_t execution_time = now - s->program->started;
+                if (execution_time <= s->program->timeout)
+                        return;
+                LogError("'%s' program timed out after %lld seconds. Killing program with pid %ld\n", s->name, (long long)execution_time, (long)Process_getPid(P));
+                Process_kill(P);
+                Process_waitFor(P); // Wait for child to exit to get correct exit value
+        }
+        // The service stays in the table until the result was posted, so check_program() won't touch the program meanwhile
+        check_program_result(s);
+        gettimeofday(&s->collected, NULL);
+        LOCK(watch.mutex)
+        {
+                _remove(s);
+        }
+        END_LOCK;
+}
+
+
+static void *_watcher(void *args) {
+        int size = 0;
+        struct pollfd *fds = NULL;
+        Service_T *services = NULL;
+        while (watch.running && ! Run.stopped) {
+                int count = 0;
+                LOCK(watch.mutex)
+                {
+                        if (watch.count + 1 > size) {
+                                size = watch.size + 1;
+                                RESIZE(fds, size * sizeof(struct pollfd));
+                                RESIZE(services, size * sizeof(Service_T));
+                        }
+                        fds[0].fd = watch.wakeup[0];
+                        fds[0].events = POLLIN;
+                        for (count = 0; count < watch.count; count++) {
+                                services[count] = watch.table[count].s;
+                                fds[count + 1].fd = watch.table[count].pidfd; // Negative descriptor is ignored by poll
+                                fds[count + 1].events = POLLIN;
+                        }
+                }
+                END_LOCK;
+                int rv = poll(fds, count + 1, watch.pidfd ? PROGRAMWATCH_POLL : PROGRAMWATCH_FALLBACK);
+                if (rv < 0 && errno != EINTR) {
+                        LogError("Program watcher: poll failed -- %s\n", STRERROR);
+                        break;
+                }
+                if (rv > 0 && fds[0].revents) {
+                        char buf[64];
+                        while (read(watch.wakeup[0], buf, sizeof(buf)) > 0)
+                                ;
+                }
+                time_t now = Time_now();
+                for (int i = 0; i < count && watch.running; i++)
+                        _collect(services[i], now);
+        }
+        FREE(fds);
+        FREE(services);
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+boolean_t ProgramWatch_start() {
+        if (watch.running)
+                return true;
+        if (pipe(watch.wakeup) < 0) {
+                LogError("Program watcher: cannot create wakeup pipe -- %s\n", STRERROR);
+                return false;
+        }
+        for (int i = 0; i < 2; i++)
+                if (! Net_setNonBlocking(watch.wakeup[i]) || fcntl(watch.wakeup[i], F_SETFD, FD_CLOEXEC) == -1)
+                        LogError("Program watcher: cannot set wakeup pipe options -- %s\n", STRERROR);
+        // A SIGCHLD handler would interrupt the daemon sleep between the cycles, without process descriptors the watcher polls the programs instead
+        int fd = Util_openPidfd(getpid());
+        if ((watch.pidfd = fd >= 0))
+                close(fd);
+        watch.running = true;
+        Thread_create(watch.thread, _watcher, NULL);
+        LogInfo("Program watcher started (%s)\n", watch.pidfd ? "process descriptors" : "polling");
+        return true;
+}
+
+
+void ProgramWatch_stop() {
+        if (! watch.running)
+                return;
+        watch.running = false;
+        _wakeup();
+        Thread_join(watch.thread);
+        LOCK(watch.mutex)
+        {
+                while (watch.count)
+                        _remove(watch.table[0].s);
+                FREE(watch.table);
+                watch.size = 0;
+        }
+        END_LOCK;
+        for (int i = 0; i < 2; i++) {
+                close(watch.wakeup[i]);
+                watch.wakeup[i] = -1;
+        }
+        LogInfo("Program watcher stopped\n");
+}
+
+
+void ProgramWatch_add(Service_T s) {
+        ASSERT(s);
+        ASSERT(s->program);
+        if (! watch.running || ! s->program->P)
+                return;
+        int pidfd = -1;
+        if (watch.pidfd && (pidfd = Util_openPidfd(Process_getPid(s->program->P))) < 0)
+                DEBUG("Program watcher: cannot open the '%s' program process descriptor -- %s\n", s->name, STRERROR);
+        LOCK(watch.mutex)
+        {
+                if (watch.count == watch.size) {
+                        watch.size = watch.size ? watch.size * 2 : 16;
+                        RESIZE(watch.table, watch.size * sizeof(struct mywatch));
+                }
+                watch.table[watch.count].s = s;
+                watch.table[watch.count].pidfd = pidfd;
+                watch.count++;
+        }
+        END_LOCK;
+        _wakeup();
+}
+
+
+boolean_t ProgramWatch_isWatched(Service_T s) {
+        boolean_t watched = false;
+        if (watch.running) {
+                LOCK(watch.mutex)
+                {
+                        for (int i = 0; i < watch.count; i++) {
+                                if (watch.table[i].s == s) {
+                                        watched = true;
+                                        break;
+                                }
+                        }
+                }
+                END_LOCK;
+        }
+        return watched;
+}
+
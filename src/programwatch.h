@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#ifndef MONIT_PROGRAMWATCH_H
+#define MONIT_PROGRAMWATCH_H
+
+
+/**
+ * Program check watcher.
+ *
+ * By default the exit status of a program started by a "check program"
+ * service is collected at the next poll cycle. If the watcher is enabled
+ * using the "set program events" statement, a watcher thread waits for
+ * the started programs and evaluates the exit status and output as soon
+ * as the program exits (or kills it when the timeout expired), so the
+ * status event is posted right away. On Linux the watcher waits on the
+ * process file descriptors (pidfd), on other systems it polls the running
+ * programs every 100 milliseconds.
+ *
+ *  @file
+ */
+
+
+/**
+ * Start the program check watcher thread
+ * @return true if succeeded, otherwise false
+ */
+boolean_t ProgramWatch_start();
+
+
+/**
+ * Stop the program check watcher thread. The programs which are still
+ * running are handed back to check_program()
+ */
+void ProgramWatch_stop();
+
+
+/**
+ * Let the watcher wait for the program started by the given service. If
+ * the watcher is not running, the call is ignored
+ * @param s A program service with a running sub-process
+ */
+void ProgramWatch_add(Service_T s);
+
+
+/**
+ * Check if the program of the given service is waited for by the watcher
+ * @param s A program service
+ * @return true if the watcher owns the program sub-process, otherwise false
+ */
+boolean_t ProgramWatch_isWatched(Service_T s);
+
+
+#endif
+
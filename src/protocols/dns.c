@@ -48,16 +48,19 @@
  *
  *  @file
  */
-void check_dns(Socket_T socket) {
-        int            offset_request  = 0;
-        int            offset_response = 0;
-        int            rc;
-        unsigned char  buf[STRLEN];
-        unsigned char *response = NULL;
-        unsigned char  request[19] = {
-                0x00,          /** Request Length field for DNS via TCP */
-                0x11,
 
+
+/* ----------------------------------------------------------- Definitions */
+
+
+#define DNS_REQUEST_LENGTH 17
+
+
+/* --------------------------------------------------------------- Private */
+
+
+static int _request(void *port, unsigned char *request, int size, unsigned id) {
+        unsigned char query[DNS_REQUEST_LENGTH] = {
                 0x00,                                /** Transaction ID */
                 0x01,
 
@@ -86,35 +89,29 @@ void check_dns(Socket_T socket) {
                 0x00,                                     /** Class: IN */
                 0x01
         };
+        ASSERT(size >= DNS_REQUEST_LENGTH);
+        query[0] = (id >> 8) & 0xff;
+        query[1] = id & 0xff;
+        memcpy(request, query, DNS_REQUEST_LENGTH);
+        return DNS_REQUEST_LENGTH;
+}
 
-        ASSERT(socket);
 
-        switch (Socket_getType(socket)) {
-                case Socket_Udp:
-                        offset_request  = 2; /*  Skip Length field in request */
-                        offset_response = 0;
-                        break;
-                case Socket_Tcp:
-                        offset_request  = 0;
-                        offset_response = 2; /*  Skip Length field in response */
-                        break;
-                default:
-                        THROW(IOException, "DNS: unsupported socket type -- protocol test skipped");
-                        break;
-        }
+static boolean_t _match(const unsigned char *request, int requestlength, const unsigned char *response, int length) {
+        return length >= 2 && response[0] == request[0] && response[1] == request[1];
+}
 
-        if (Socket_write(socket, (unsigned char *)request + offset_request, sizeof(request) - offset_request) < 0)
-                THROW(IOException, "DNS: error sending query -- %s", STRERROR);
 
-        /* Response should have at least 14 bytes */
-        if (Socket_read(socket, (unsigned char *)buf, 15) <= 14)
-                THROW(IOException, "DNS: error receiving response -- %s", STRERROR);
+static void _verify(void *port, const unsigned char *request, int requestlength, unsigned char *response, int length) {
+        int rc;
 
-        response = buf + offset_response;
+        /* Response should have at least 14 bytes */
+        if (length <= 14)
+                THROW(IOException, "DNS: response is too short -- %d bytes", length);
 
         /* Compare transaction ID (it should be the same as in our request): */
-        if (response[0] != 0x00 && response[1] != 0x01)
-                THROW(IOException, "DNS: response transaction ID mismatch -- received 0x%x%x, expected 0x1", response[0], response[1]);
+        if (! _match(request, requestlength, response, length))
+                THROW(IOException, "DNS: response transaction ID mismatch -- received 0x%x%x, expected 0x%x%x", response[0], response[1], request[0], request[1]);
 
         /* Compare flags: */
 
@@ -136,3 +133,47 @@ void check_dns(Socket_T socket) {
                 THROW(IOException, "DNS: no answer or authority records returned");
 }
 
+
+/* ---------------------------------------------------------------- Public */
+
+
+struct Datagram_T dns_datagram = {_request, _match, _verify};
+
+
+void check_dns(Socket_T socket) {
+        int            length;
+        int            offset_request  = 0;
+        int            offset_response = 0;
+        unsigned char  buf[STRLEN];
+        unsigned char  request[DNS_REQUEST_LENGTH + 2] = {
+                0x00,          /** Request Length field for DNS via TCP */
+                DNS_REQUEST_LENGTH
+        };
+
+        ASSERT(socket);
+
+        switch (Socket_getType(socket)) {
+                case Socket_Udp:
+                        offset_request  = 2; /*  Skip Length field in request */
+                        offset_response = 0;
+                        break;
+                case Socket_Tcp:
+                        offset_request  = 0;
+                        offset_response = 2; /*  Skip Length field in response */
+                        break;
+                default:
+                        THROW(IOException, "DNS: unsupported socket type -- protocol test skipped");
+                        break;
+        }
+
+        _request(Socket_getPort(socket), request + 2, DNS_REQUEST_LENGTH, 1);
+
+        if (Socket_write(socket, (unsigned char *)request + offset_request, sizeof(request) - offset_request) < 0)
+                THROW(IOException, "DNS: error sending query -- %s", STRERROR);
+
+        /* Response should have at least 14 bytes */
+        if ((length = Socket_read(socket, (unsigned char *)buf, 15 + offset_response)) <= 14 + offset_response)
+                THROW(IOException, "DNS: error receiving response -- %s", STRERROR);
+
+        _verify(Socket_getPort(socket), request + 2, DNS_REQUEST_LENGTH, buf + offset_response, length - offset_response);
+}
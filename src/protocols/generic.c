@@ -37,28 +37,87 @@
 // libmonit
 #include "exceptions/IOException.h"
 
-/* Escape zero i.e. '\0' in expect buffer with "\0" so zero can be tested in expect strings as "\0". If there are no '\0' in the buffer it is returned as it is */
-static char *_escapeZeroInExpectBuffer(char *s, int n) {
-        assert(n < EXPECT_BUFFER_MAX);
-        int i, j;
-        char t[n]; // VLA
-        for (i = 0, j = 0; j < n; i++, j++) {
-                if ((t[j] = s[i]) == '\0') {
-                        if (j + 2 < n) {
-                                t[j] = '\\';
-                                t[j + 1] = '0';
-                                j++;
-                        }
+/* ----------------------------------------------------------- Definitions */
+
+
+#define EXPECT_IDLE_TIMEOUT 200 // The timeout to wait for more data if the expect pattern didn't match yet [ms]
+
+
+/* --------------------------------------------------------------- Private */
+
+
+/**
+ * Append the received data to the expect buffer. Zero i.e. '\0' is escaped
+ * as "\0" so zero can be tested in expect strings as "\0". The data are
+ * appended up to Run.expectbuffer bytes
+ * @return The number of data bytes appended
+ */
+static int _append(char *buf, int *length, const char *data, int n) {
+        int i;
+        for (i = 0; i < n && *length < Run.expectbuffer; i++) {
+                if (data[i] == '\0') {
+                        if (*length + 2 > Run.expectbuffer)
+                                break;
+                        buf[(*length)++] = '\\';
+                        buf[(*length)++] = '0';
+                } else {
+                        buf[(*length)++] = data[i];
                 }
         }
-        if (j > i) {
-                memcpy(s, t, n);
-                s[n] = 0;
+        buf[*length] = 0;
+        return i;
+}
+
+
+/**
+ * Match the expect pattern. If more data may follow, "$" doesn't match the
+ * end of the data received so far
+ */
+static boolean_t _match(Generic_T g, const char *buf, int length, boolean_t partial) {
+#ifdef HAVE_REGEX_H
+        return regexec(g->expect, buf, 0, NULL, partial ? REG_NOTEOL : 0) == 0;
+#else
+        int n = strlen(g->expect);
+        return length >= n && strncmp(buf, g->expect, n) == 0;
+#endif
+}
+
+
+/**
+ * Read the response and match the expect pattern incrementally as the data
+ * arrive. The first read waits up to the port timeout, the next reads wait
+ * EXPECT_IDLE_TIMEOUT for more data. The reading stops as soon as the
+ * pattern matches, the expect buffer is full, the server closed the
+ * connection or no more data arrived
+ * @return The length of the data read
+ */
+static int _expect(Socket_T socket, Generic_T g, char *buf, boolean_t *matched) {
+        int length = 0;
+        int timeout = Socket_getTimeout(socket);
+        *matched = false;
+        while (true) {
+                int n;
+                char *data = Socket_peek(socket, 1, &n);
+                if (! data)
+                        break;
+                int consumed = _append(buf, &length, data, n);
+                Socket_skip(socket, consumed);
+                if (consumed < n || length >= Run.expectbuffer) // The expect buffer is full
+                        break;
+                if ((*matched = _match(g, buf, length, true)))
+                        break;
+                Socket_setTimeout(socket, EXPECT_IDLE_TIMEOUT);
         }
-        return s;
+        Socket_setTimeout(socket, timeout); // Reset back original timeout for next send/expect
+        if (length > 0 && ! *matched)
+                *matched = _match(g, buf, length, false);
+        return length;
 }
 
 
+/* ---------------------------------------------------------------- Public */
+
+
 /**
  *  Generic service test.
  *
@@ -66,17 +125,14 @@ static char *_escapeZeroInExpectBuffer(char *s, int n) {
  */
 void check_generic(Socket_T socket) {
         Generic_T g = NULL;
-        char *buf;
-#ifdef HAVE_REGEX_H
-        int regex_return;
-#endif
 
         ASSERT(socket);
 
         if (Socket_getPort(socket))
                 g = ((Port_T)(Socket_getPort(socket)))->generic;
 
-        buf = CALLOC(sizeof(char), Run.expectbuffer + 1);
+        /* The expect buffer is shared by all expect steps of the test */
+        char *buf = NULL;
 
         while (g != NULL) {
 
@@ -94,45 +150,25 @@ void check_generic(Socket_T socket) {
                         }
                         FREE(X);
                 } else if (g->expect != NULL) {
-                        /* Since the protocol is unknown we need to wait on EOF. To avoid waiting
-                         timeout seconds on EOF we first read one byte to fill the socket's read
-                         buffer and then set a low timeout on next read which reads remaining bytes
-                         as well as wait on EOF */
-                        *buf = Socket_readByte(socket);
-                        if (*buf < 0) {
+                        if (! buf)
+                                buf = ALLOC(Run.expectbuffer + 1);
+                        boolean_t matched;
+                        if (_expect(socket, g, buf, &matched) == 0) {
                                 FREE(buf);
                                 THROW(IOException, "GENERIC: error receiving data -- %s", STRERROR);
                         }
-                        int timeout = Socket_getTimeout(socket);
-                        Socket_setTimeout(socket, 200);
-                        int n = Socket_read(socket, buf + 1, Run.expectbuffer - 1) + 1;
-                        buf[n] = 0;
-                        if (n > 0)
-                                _escapeZeroInExpectBuffer(buf, n);
-                        Socket_setTimeout(socket, timeout); // Reset back original timeout for next send/expect
+                        if (! matched) {
 #ifdef HAVE_REGEX_H
-                        regex_return = regexec(g->expect, buf, 0, NULL, 0);
-                        if (regex_return != 0) {
                                 char e[STRLEN];
-                                regerror(regex_return, g->expect, e, STRLEN);
+                                regerror(REG_NOMATCH, g->expect, e, STRLEN);
                                 FREE(buf);
                                 THROW(IOException, "GENERIC: received unexpected data -- %s", e);
-                        } else {
-                                DEBUG("GENERIC: successfully received: '%s'\n", Str_trunc(buf, STRLEN - 4));
-                        }
-
 #else
-                        /* w/o regex support */
-
-                        if (strncmp(buf, g->expect, strlen(g->expect)) != 0) {
                                 FREE(buf);
                                 THROW(IOException, "GENERIC: received unexpected data");
-                        } else {
-                                DEBUG("GENERIC: successfully received: '%s'\n", Str_trunc(buf, STRLEN - 4));
-                        }
-
 #endif
-
+                        }
+                        DEBUG("GENERIC: successfully received: '%s'\n", Str_trunc(buf, STRLEN - 4));
                 } else {
                         /* This should not happen */
                         FREE(buf);
@@ -0,0 +1,558 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "protocol.h"
+
+// libmonit
+#include "exceptions/IOException.h"
+
+
+/**
+ *  A gRPC health check test.
+ *
+ *  https://github.com/grpc/grpc/blob/master/doc/health-checking.md
+ *  http://tools.ietf.org/html/rfc7540 (HTTP/2)
+ *  http://tools.ietf.org/html/rfc7541 (HPACK)
+ *
+ *  Call the grpc.health.v1.Health/Check method over a HTTP/2 connection
+ *  and expect the SERVING status. The connection is kept open by the test
+ *  and each test over it uses the next client stream, so the checks of the
+ *  same server share one persistent connection.
+ *
+ *  The response header blocks are HPACK decoded to check the HTTP status
+ *  and the grpc-status trailer. The client disables the HPACK dynamic table
+ *  with SETTINGS_HEADER_TABLE_SIZE = 0, so the decoder needs the static table
+ *  and the literal representations only, a reference to the dynamic table is
+ *  a protocol error.
+ *
+ *  @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+#define GRPC_PATH "/grpc.health.v1.Health/Check"
+
+#define FRAME_HEADER     9
+#define FRAME_SIZE_MAX   16384 // The default SETTINGS_MAX_FRAME_SIZE, we don't advertise more
+#define MESSAGE_SIZE_MAX 256   // The health check response is a single enum field
+#define HEADER_BLOCK_MAX 4096  // The response headers and trailers are a few short fields
+
+#define FRAME_DATA          0x0
+#define FRAME_HEADERS       0x1
+#define FRAME_RST_STREAM    0x3
+#define FRAME_SETTINGS      0x4
+#define FRAME_PING          0x6
+#define FRAME_GOAWAY        0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION  0x9
+
+#define FLAG_ACK         0x1
+#define FLAG_END_STREAM  0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED      0x8
+#define FLAG_PRIORITY    0x20
+
+typedef struct {
+        int http;                    // The :status pseudo-header
+        int grpc;                    // The grpc-status trailer, -1 if missing
+        char message[STRLEN];        // The grpc-message trailer
+        int length;                  // The length of the header block collected so far
+        unsigned char block[HEADER_BLOCK_MAX];
+} Response_T;
+
+static const char *statusNames[] = {"UNKNOWN", "SERVING", "NOT_SERVING", "SERVICE_UNKNOWN"};
+
+/* The HPACK static table (RFC 7541 Appendix A) */
+static const struct {
+        const char *name;
+        const char *value;
+} staticTable[] = {
+        {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+        {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+        {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+        {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+        {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+        {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+        {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+        {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+        {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+        {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+        {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+        {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+        {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+        {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+        {"www-authenticate", ""}
+};
+
+/* The HPACK Huffman code (RFC 7541 Appendix B) is canonical: the number of codes of each bit length and the symbols ordered by the code */
+static const unsigned short huffmanCounts[31] = {0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 3};
+static const unsigned char huffmanSymbols[256] = {
+        48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+        52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+        110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+        77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+        119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+        43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+        195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+        179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+        163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+        233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+        158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+        144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+        200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+        212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+        2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+        21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22
+};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static unsigned char *_frame(unsigned char *b, int length, int type, int flags, int stream) {
+        *b++ = (length >> 16) & 0xff;
+        *b++ = (length >> 8) & 0xff;
+        *b++ = length & 0xff;
+        *b++ = type;
+        *b++ = flags;
+        *b++ = (stream >> 24) & 0x7f;
+        *b++ = (stream >> 16) & 0xff;
+        *b++ = (stream >> 8) & 0xff;
+        *b++ = stream & 0xff;
+        return b;
+}
+
+
+static unsigned int _uint32(unsigned char *b) {
+        return ((unsigned int)b[0] << 24) | ((unsigned int)b[1] << 16) | ((unsigned int)b[2] << 8) | (unsigned int)b[3];
+}
+
+
+/* HPACK integer with the given prefix size, the first byte carries the representation bits */
+static unsigned char *_integer(unsigned char *b, int prefix, unsigned char representation, int value) {
+        int limit = (1 << prefix) - 1;
+        if (value < limit) {
+                *b++ = representation | value;
+        } else {
+                *b++ = representation | limit;
+                for (value -= limit; value >= 128; value >>= 7)
+                        *b++ = (value & 0x7f) | 0x80;
+                *b++ = value;
+        }
+        return b;
+}
+
+
+/* HPACK string literal without Huffman encoding */
+static unsigned char *_string(unsigned char *b, const char *s) {
+        int length = (int)strlen(s);
+        b = _integer(b, 7, 0x00, length);
+        memcpy(b, s, length);
+        return b + length;
+}
+
+
+/* HPACK literal header field without indexing, the name is given by the static table index or as a literal if index is 0 */
+static unsigned char *_field(unsigned char *b, int index, const char *name, const char *value) {
+        b = _integer(b, 4, 0x00, index);
+        if (! index)
+                b = _string(b, name);
+        return _string(b, value);
+}
+
+
+static unsigned char *_varint(unsigned char *b, int value) {
+        for (; value >= 128; value >>= 7)
+                *b++ = (value & 0x7f) | 0x80;
+        *b++ = value;
+        return b;
+}
+
+
+/* Decode the HPACK integer with the given prefix size */
+static int _decodeInteger(unsigned char **p, unsigned char *end, int prefix) {
+        if (*p >= end)
+                THROW(IOException, "GRPC: invalid response header block");
+        int limit = (1 << prefix) - 1;
+        int value = *(*p)++ & limit;
+        if (value == limit) {
+                for (int shift = 0;; shift += 7) {
+                        if (*p >= end || shift > 21)
+                                THROW(IOException, "GRPC: invalid response header block");
+                        unsigned char c = *(*p)++;
+                        value += (c & 0x7f) << shift;
+                        if (! (c & 0x80))
+                                break;
+                }
+        }
+        return value;
+}
+
+
+/* Decode the Huffman encoded string, the padding must be the most significant bits of EOS (all ones) and shorter than 8 bits */
+static void _decodeHuffman(unsigned char *p, int length, char *s, int size) {
+        int n = 0, bits = 0, code = 0, first = 0, index = 0;
+        boolean_t ones = true;
+        for (int i = 0; i < length * 8; i++) {
+                int bit = (p[i >> 3] >> (7 - (i & 7))) & 1;
+                code |= bit;
+                ones = ones && bit;
+                int count = huffmanCounts[++bits];
+                if (code - count < first) {
+                        if (n < size - 1)
+                                s[n++] = huffmanSymbols[index + code - first];
+                        bits = code = first = index = 0;
+                        ones = true;
+                } else if (bits == 30) {
+                        THROW(IOException, "GRPC: invalid Huffman code in the response header block");
+                } else {
+                        index += count;
+                        first = (first + count) << 1;
+                        code <<= 1;
+                }
+        }
+        if (bits > 7 || ! ones)
+                THROW(IOException, "GRPC: invalid Huffman padding in the response header block");
+        s[n] = 0;
+}
+
+
+/* Decode the HPACK string literal, a string longer than the buffer is truncated */
+static void _decodeString(unsigned char **p, unsigned char *end, char *s, int size) {
+        boolean_t huffman = *p < end && (**p & 0x80);
+        int length = _decodeInteger(p, end, 7);
+        if (length > end - *p)
+                THROW(IOException, "GRPC: invalid response header block");
+        if (huffman) {
+                _decodeHuffman(*p, length, s, size);
+        } else {
+                int n = length < size - 1 ? length : size - 1;
+                memcpy(s, *p, n);
+                s[n] = 0;
+        }
+        *p += length;
+}
+
+
+static void _header(Response_T *R, const char *name, const char *value) {
+        if (IS(name, ":status"))
+                R->http = (int)strtol(value, NULL, 10);
+        else if (IS(name, "grpc-status"))
+                R->grpc = (int)strtol(value, NULL, 10);
+        else if (IS(name, "grpc-message"))
+                snprintf(R->message, sizeof(R->message), "%s", value);
+}
+
+
+/* Decode the header block and pick the status fields */
+static void _headers(Response_T *R) {
+        for (unsigned char *p = R->block, *end = p + R->length; p < end;) {
+                int index;
+                char name[STRLEN], value[STRLEN];
+                if (*p & 0x80) {
+                        // Indexed header field
+                        index = _decodeInteger(&p, end, 7);
+                        if (index < 1 || index > (int)(sizeof(staticTable) / sizeof(staticTable[0])))
+                                THROW(IOException, "GRPC: response header references the dynamic table (index %d)", index);
+                        _header(R, staticTable[index - 1].name, staticTable[index - 1].value);
+                        continue;
+                } else if ((*p & 0xe0) == 0x20) {
+                        // Dynamic table size update, the table stays empty as the entries above the size limit are evicted
+                        _decodeInteger(&p, end, 5);
+                        continue;
+                }
+                // Literal header field with incremental indexing (6 bit prefix), without indexing or never indexed (4 bit prefix)
+                index = _decodeInteger(&p, end, (*p & 0x40) ? 6 : 4);
+                if (index > (int)(sizeof(staticTable) / sizeof(staticTable[0])))
+                        THROW(IOException, "GRPC: response header references the dynamic table (index %d)", index);
+                if (index)
+                        snprintf(name, sizeof(name), "%s", staticTable[index - 1].name);
+                else
+                        _decodeString(&p, end, name, sizeof(name));
+                _decodeString(&p, end, value, sizeof(value));
+                _header(R, name, value);
+        }
+        R->length = 0;
+}
+
+
+static void _send(Socket_T socket, const char *what, unsigned char *buf, int length) {
+        if (Socket_write(socket, buf, length) != length)
+                THROW(IOException, "GRPC: error sending %s -- %s", what, STRERROR);
+}
+
+
+static void _request(Socket_T socket, Port_T P, int stream) {
+        char host[STRLEN];
+        const char *authority = P->request_hostheader ? P->request_hostheader : Util_getHTTPHostHeader(socket, host, sizeof(host));
+        const char *service = P->request ? P->request : "";
+        if (strlen(authority) >= STRLEN || strlen(service) >= STRLEN)
+                THROW(IOException, "GRPC: the host or the service name is too long");
+        unsigned char buf[4 * STRLEN];
+        unsigned char *b = buf;
+        if (Socket_getTests(socket) == 0) {
+                // A new connection starts with the connection preface, the client's SETTINGS frame disables the HPACK dynamic table and the server push
+                memcpy(b, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24);
+                unsigned char settings[12] = {
+                        0x00, 0x01, 0x00, 0x00, 0x00, 0x00, // SETTINGS_HEADER_TABLE_SIZE = 0
+                        0x00, 0x02, 0x00, 0x00, 0x00, 0x00  // SETTINGS_ENABLE_PUSH = 0
+                };
+                b = _frame(b + 24, sizeof(settings), FRAME_SETTINGS, 0, 0);
+                memcpy(b, settings, sizeof(settings));
+                b += sizeof(settings);
+        }
+        // HEADERS
+        unsigned char *headers = b + FRAME_HEADER, *h = headers;
+        *h++ = 0x83;                                            // :method POST
+        *h++ = Socket_isSecure(socket) ? 0x87 : 0x86;           // :scheme https or http
+        h = _field(h, 4, NULL, GRPC_PATH);                      // :path
+        h = _field(h, 1, NULL, authority);                      // :authority
+        h = _field(h, 31, NULL, "application/grpc");            // content-type
+        h = _field(h, 0, "te", "trailers");
+        h = _field(h, 58, NULL, "Monit/" VERSION);              // user-agent
+        _frame(b, (int)(h - headers), FRAME_HEADERS, FLAG_END_HEADERS, stream);
+        b = h;
+        // DATA: the length prefixed HealthCheckRequest message with the service name as the field 1
+        unsigned char message[STRLEN + 8], *m = message;
+        if (*service) {
+                *m++ = 0x0a;
+                m = _varint(m, (int)strlen(service));
+                memcpy(m, service, strlen(service));
+                m += strlen(service);
+        }
+        int length = (int)(m - message);
+        b = _frame(b, 5 + length, FRAME_DATA, FLAG_END_STREAM, stream);
+        *b++ = 0; // Not compressed
+        *b++ = (length >> 24) & 0xff;
+        *b++ = (length >> 16) & 0xff;
+        *b++ = (length >> 8) & 0xff;
+        *b++ = length & 0xff;
+        memcpy(b, message, length);
+        b += length;
+        _send(socket, "request", buf, (int)(b - buf));
+}
+
+
+/* Read the frame payload, store up to size bytes and discard the rest */
+static int _payload(Socket_T socket, int length, unsigned char *buf, int size) {
+        int stored = length < size ? length : size;
+        if (stored && Socket_read(socket, buf, stored) != stored)
+                THROW(IOException, "GRPC: error receiving data -- %s", STRERROR);
+        for (int n = length - stored; n > 0;) {
+                unsigned char discard[STRLEN];
+                int chunk = n < (int)sizeof(discard) ? n : (int)sizeof(discard);
+                if (Socket_read(socket, discard, chunk) != chunk)
+                        THROW(IOException, "GRPC: error receiving data -- %s", STRERROR);
+                n -= chunk;
+        }
+        return stored;
+}
+
+
+/* Read the frames up to the end of our stream, decode its header blocks and return the response message length */
+static int _response(Socket_T socket, int stream, unsigned char *message, Response_T *R) {
+        int received = 0;
+        boolean_t closed = false, continuation = false;
+        while (! closed || continuation) {
+                unsigned char header[FRAME_HEADER], payload[MESSAGE_SIZE_MAX + 1];
+                if (Socket_read(socket, header, sizeof(header)) != sizeof(header))
+                        THROW(IOException, "GRPC: error receiving data -- %s", STRERROR);
+                int length = (header[0] << 16) | (header[1] << 8) | header[2];
+                int type = header[3];
+                int flags = header[4];
+                int id = _uint32(header + 5) & 0x7fffffff;
+                if (length > FRAME_SIZE_MAX)
+                        THROW(IOException, "GRPC: frame size %d exceeds the maximum", length);
+                int stored;
+                if ((type == FRAME_HEADERS || type == FRAME_CONTINUATION) && id == stream) {
+                        // Collect the header block fragment of our stream
+                        stored = _payload(socket, length, R->block + R->length, HEADER_BLOCK_MAX - R->length);
+                        if (stored < length)
+                                THROW(IOException, "GRPC: response header block exceeds %d bytes", HEADER_BLOCK_MAX);
+                } else {
+                        stored = _payload(socket, length, payload, sizeof(payload));
+                }
+                switch (type) {
+                        case FRAME_SETTINGS:
+                                if (! (flags & FLAG_ACK)) {
+                                        unsigned char ack[FRAME_HEADER];
+                                        _frame(ack, 0, FRAME_SETTINGS, FLAG_ACK, 0);
+                                        _send(socket, "SETTINGS acknowledgement", ack, sizeof(ack));
+                                }
+                                break;
+                        case FRAME_PING:
+                                if (! (flags & FLAG_ACK) && stored == 8) {
+                                        unsigned char pong[FRAME_HEADER + 8];
+                                        memcpy(_frame(pong, 8, FRAME_PING, FLAG_ACK, 0), payload, 8);
+                                        _send(socket, "PING acknowledgement", pong, sizeof(pong));
+                                }
+                                break;
+                        case FRAME_GOAWAY:
+                                Socket_setReusable(socket, false);
+                                if (stored >= 8 && (int)(_uint32(payload) & 0x7fffffff) < stream)
+                                        THROW(IOException, "GRPC: connection closed by the server -- GOAWAY error code %u", _uint32(payload + 4));
+                                break;
+                        case FRAME_RST_STREAM:
+                                if (id == stream)
+                                        THROW(IOException, "GRPC: stream reset by the server -- error code %u", stored >= 4 ? _uint32(payload) : 0);
+                                break;
+                        case FRAME_HEADERS:
+                        case FRAME_CONTINUATION:
+                                if (id == stream) {
+                                        unsigned char *fragment = R->block + R->length;
+                                        int size = length;
+                                        if (type == FRAME_HEADERS) {
+                                                if (flags & FLAG_END_STREAM)
+                                                        closed = true;
+                                                // Strip the padding and the priority fields
+                                                int padding = 0;
+                                                if (flags & FLAG_PADDED) {
+                                                        if (size < 1)
+                                                                THROW(IOException, "GRPC: invalid HEADERS frame");
+                                                        padding = *fragment++;
+                                                        size--;
+                                                }
+                                                if (flags & FLAG_PRIORITY) {
+                                                        if (size < 5)
+                                                                THROW(IOException, "GRPC: invalid HEADERS frame");
+                                                        fragment += 5;
+                                                        size -= 5;
+                                                }
+                                                if (padding > size)
+                                                        THROW(IOException, "GRPC: invalid HEADERS frame padding");
+                                                size -= padding;
+                                        }
+                                        memmove(R->block + R->length, fragment, size);
+                                        R->length += size;
+                                        continuation = ! (flags & FLAG_END_HEADERS);
+                                        if (! continuation)
+                                                _headers(R);
+                                }
+                                break;
+                        case FRAME_DATA:
+                                if (length) {
+                                        // Return the received data to the connection flow control window
+                                        unsigned char update[FRAME_HEADER + 4];
+                                        unsigned char *u = _frame(update, 4, FRAME_WINDOW_UPDATE, 0, 0);
+                                        u[0] = (length >> 24) & 0x7f;
+                                        u[1] = (length >> 16) & 0xff;
+                                        u[2] = (length >> 8) & 0xff;
+                                        u[3] = length & 0xff;
+                                        _send(socket, "WINDOW_UPDATE", update, sizeof(update));
+                                }
+                                if (id == stream) {
+                                        unsigned char *data = payload;
+                                        int size = stored, padding = 0;
+                                        if ((flags & FLAG_PADDED) && stored > 0) {
+                                                padding = *data++;
+                                                size--;
+                                                length--;
+                                        }
+                                        size = size < length - padding ? size : length - padding;
+                                        if (size > 0) {
+                                                int n = size < MESSAGE_SIZE_MAX - received ? size : MESSAGE_SIZE_MAX - received;
+                                                memcpy(message + received, data, n);
+                                                received += n;
+                                        }
+                                        if (flags & FLAG_END_STREAM)
+                                                closed = true;
+                                }
+                                break;
+                        default:
+                                break;
+                }
+        }
+        return received;
+}
+
+
+static void _evaluate(Response_T *R, unsigned char *message, int received) {
+        if (R->http != 200)
+                THROW(IOException, "GRPC: server returned HTTP status %d", R->http);
+        // The gRPC call status is sent in the trailers, or in the headers for a response without a message ("Trailers-Only")
+        if (R->grpc < 0)
+                THROW(IOException, "GRPC: no grpc-status in the response");
+        if (R->grpc != 0)
+                THROW(IOException, "GRPC: call failed with grpc-status %d%s%s", R->grpc, *R->message ? " -- " : "", R->message);
+        if (received < 5)
+                THROW(IOException, "GRPC: no health check response");
+        if (message[0])
+                THROW(IOException, "GRPC: compressed response is not supported");
+        int length = (int)_uint32(message + 1);
+        if (length > received - 5)
+                THROW(IOException, "GRPC: invalid response message size -- %d bytes", length);
+        // HealthCheckResponse: the status enum is the field 1, the default UNKNOWN value may be omitted
+        unsigned int status = 0;
+        for (unsigned char *p = message + 5, *end = p + length; p < end;) {
+                unsigned char tag = *p++;
+                unsigned int value = 0;
+                for (int shift = 0; p < end && shift < 32; shift += 7) {
+                        unsigned char c = *p++;
+                        value |= (unsigned int)(c & 0x7f) << shift;
+                        if (! (c & 0x80))
+                                break;
+                }
+                if (tag == 0x08)
+                        status = value;
+                else if ((tag & 0x7) == 2)
+                        p += value;
+                else if ((tag & 0x7) != 0)
+                        THROW(IOException, "GRPC: invalid response message");
+        }
+        if (status != 1)
+                THROW(IOException, "GRPC: service status is %s", status < sizeof(statusNames) / sizeof(statusNames[0]) ? statusNames[status] : "invalid");
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void check_grpc(Socket_T socket) {
+        ASSERT(socket);
+
+        Port_T P = Socket_getPort(socket);
+        ASSERT(P);
+
+        Response_T response = {.http = 0, .grpc = -1};
+        unsigned char message[MESSAGE_SIZE_MAX];
+        int stream = 2 * Socket_getTests(socket) + 1; // The client streams have odd identifiers
+        if (stream >= 0x7fff0000)
+                Socket_setReusable(socket, false); // The stream identifiers cannot be reused, start a new connection next time
+        _request(socket, P, stream);
+        int received = _response(socket, stream, message, &response);
+        _evaluate(&response, message, received);
+}
@@ -24,6 +24,10 @@
 
 #include "config.h"
 
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -58,7 +62,29 @@
 /* ------------------------------------------------------------- Definitions */
 
 
-#define HTTP_CONTENT_MAX 1048576
+#define HTTP_CONTENT_MAX (Unit_Megabyte * 64) // The response body read limit
+
+#define HTTP_WINDOW (Unit_Kilobyte * 64)         // The content match window size
+
+#define HTTP_WINDOW_OVERLAP (Unit_Kilobyte * 16) // The window part kept for the matches spanning two windows
+
+
+/* The response body verification state, the body is streamed through the content matcher and the checksum */
+typedef struct mybody {
+        Request_T request;                            /* The content match or NULL */
+        char *window;                                  /* The content match window */
+        int length;                                   /* The window content length */
+        boolean_t pending;                /* true if the window has unmatched data */
+        boolean_t matched;                    /* true if the content regex matched */
+        boolean_t bol;                       /* true if the window starts the body */
+        char *checksum;                           /* The expected checksum or NULL */
+        Hash_Type hashtype;                                   /* The checksum type */
+        md5_context_t md5;
+        sha1_context_t sha1;
+        long long size;                                 /* The body bytes received */
+        boolean_t drain;    /* true if the whole body is read to reuse the connection */
+        boolean_t truncated;        /* true if the body was not read till its end */
+} *Body_T;
 
 
 /* ----------------------------------------------------------------- Private */
@@ -77,54 +103,137 @@ static const char *_findHostHeaderIn(List_T list) {
 }
 
 
-static void do_regex(Socket_T socket, int content_length, Request_T R) {
-        boolean_t rv = false;
+/**
+ * Match the content regex in the window. The part of the window kept
+ * from the previous window is not at the beginning of the body, so the
+ * "^" anchor doesn't match it
+ */
+static void _match(Body_T B) {
+        B->window[B->length] = 0;
+#ifdef HAVE_REGEX_H
+        B->matched = regexec(B->request->regex, B->window, 0, NULL, B->bol ? 0 : REG_NOTBOL) == 0;
+#else
+        B->matched = strstr(B->window, B->request->regex) != NULL;
+#endif
+        B->pending = false;
+}
 
-        if (content_length == 0)
-                THROW(IOException, "HTTP error: No content returned from server");
-        else if (content_length < 0 || content_length > HTTP_CONTENT_MAX) /* content_length < 0 if no Content-Length header was found */
-                content_length = HTTP_CONTENT_MAX;
 
-        char error[STRLEN];
-        int size = 0, length = content_length, buflen = content_length + 1;
-        char *buf = ALLOC(buflen);
-        do {
-                int n = Socket_read(socket, &buf[size], length);
-                if (n <= 0)
-                        break;
-                size += n;
+/**
+ * Pass the body data to the content matcher and the checksum
+ * @return true if more data are needed, false if the verification result is known
+ */
+static boolean_t _consume(Body_T B, const char *data, int length) {
+        B->size += length;
+        if (B->checksum) {
+                if (B->hashtype == Hash_Md5)
+                        md5_append(&B->md5, (const md5_byte_t *)data, length);
+                else
+                        sha1_append(&B->sha1, (const md5_byte_t *)data, length);
+        }
+        while (B->request && ! B->matched && length > 0) {
+                if (B->length == HTTP_WINDOW) {
+                        /* Keep the end of the full window, the match may span both windows */
+                        memmove(B->window, B->window + HTTP_WINDOW - HTTP_WINDOW_OVERLAP, HTTP_WINDOW_OVERLAP);
+                        B->length = HTTP_WINDOW_OVERLAP;
+                        B->bol = false;
+                }
+                int n = HTTP_WINDOW - B->length < length ? HTTP_WINDOW - B->length : length;
+                memcpy(B->window + B->length, data, n);
+                B->length += n;
+                B->pending = true;
+                data += n;
                 length -= n;
-        } while (length > 0);
+                if (B->length == HTTP_WINDOW)
+                        _match(B);
+        }
+        return B->drain || B->checksum || (B->request && ! B->matched);
+}
 
-        if (size == 0) {
-                snprintf(error, sizeof(error), "Receiving data -- %s", STRERROR);
-                goto error;
+
+/**
+ * Stream length bytes of the body (or until the end of the stream if
+ * length is negative) from the socket buffer
+ * @return true if more data are needed, false if the verification result is known
+ */
+static boolean_t _feed(Socket_T socket, long long length, Body_T B) {
+        while (length != 0) {
+                if (B->size >= HTTP_CONTENT_MAX) {
+                        DEBUG("HTTP: Response body exceeds %d MB, only the beginning is verified\n", HTTP_CONTENT_MAX / Unit_Megabyte);
+                        B->truncated = true;
+                        return false;
+                }
+                int n;
+                char *data = Socket_peek(socket, 1, &n);
+                if (! data) {
+                        if (length > 0)
+                                B->truncated = true;
+                        break;
+                }
+                if (length > 0 && n > length)
+                        n = (int)length;
+                boolean_t more = _consume(B, data, n);
+                Socket_skip(socket, n);
+                if (length > 0)
+                        length -= n;
+                if (! more)
+                        return false;
         }
-        buf[size] = 0;
+        return true;
+}
 
-#ifdef HAVE_REGEX_H
-        int regex_return = regexec(R->regex, buf, 0, NULL, 0);
-#else
-        int regex_return = strstr(buf, R->regex) ? 0 : 1;
-#endif
-        FREE(buf);
-        switch (R->operator) {
+
+/**
+ * Read the response body, either of the given length, chunked or until the
+ * server closes the connection. The reading stops as soon as the result is
+ * known (the content regex matched and no checksum is verified), unless the
+ * body is drained to reuse the connection
+ */
+static void _readBody(Socket_T socket, int content_length, boolean_t chunked, Body_T B) {
+        if (! chunked) {
+                _feed(socket, content_length, B);
+                return;
+        }
+        char buf[STRLEN];
+        while (Socket_readLine(socket, buf, sizeof(buf))) {
+                char *end;
+                long long size = strtoll(buf, &end, 16);
+                if (end == buf || size < 0)
+                        THROW(IOException, "HTTP error: Invalid chunk size '%s'", Str_chomp(buf));
+                if (size == 0) {
+                        /* The last chunk, skip the trailer */
+                        while (Socket_readLine(socket, buf, sizeof(buf)) && ! (buf[0] == '\r' || buf[0] == '\n'))
+                                ;
+                        return;
+                }
+                if (! _feed(socket, size, B))
+                        return;
+                if (! Socket_readLine(socket, buf, sizeof(buf))) // The chunk CRLF
+                        break;
+        }
+        B->truncated = true;
+}
+
+
+static void check_request_content(Body_T B) {
+        boolean_t rv = false;
+        char error[STRLEN];
+
+        if (B->size == 0)
+                THROW(IOException, "HTTP error: No content returned from server");
+        if (B->pending)
+                _match(B);
+        switch (B->request->operator) {
                 case Operator_Equal:
-                        if (regex_return == 0) {
+                        if (B->matched) {
                                 rv = true;
                                 DEBUG("HTTP: Regular expression matches\n");
                         } else {
-#ifdef HAVE_REGEX_H
-                                char errbuf[STRLEN];
-                                regerror(regex_return, NULL, errbuf, sizeof(errbuf));
-                                snprintf(error, sizeof(error), "Regular expression doesn't match: %s", errbuf);
-#else
                                 snprintf(error, sizeof(error), "Regular expression doesn't match");
-#endif
                         }
                         break;
                 case Operator_NotEqual:
-                        if (regex_return == 0) {
+                        if (B->matched) {
                                 snprintf(error, sizeof(error), "Regular expression matches");
                         } else {
                                 rv = true;
@@ -135,52 +244,28 @@ static void do_regex(Socket_T socket, int content_length, Request_T R) {
                         snprintf(error, sizeof(error), "Invalid content operator");
                         break;
         }
-
-error:
         if (! rv)
                 THROW(IOException, "HTTP error: %s", error);
 }
 
 
-static void check_request_checksum(Socket_T socket, int content_length, char *checksum, Hash_Type hashtype) {
-        int n, keylength = 0;
+static void check_request_checksum(Body_T B) {
+        int keylength = 0;
         MD_T result, hash;
-        md5_context_t ctx_md5;
-        sha1_context_t ctx_sha1;
-        char buf[8192];
-
-        if (content_length <= 0) {
-                DEBUG("HTTP warning: Response does not contain a valid Content-Length -- cannot compute checksum\n");
-                return;
-        }
 
-        switch (hashtype) {
+        switch (B->hashtype) {
                 case Hash_Md5:
-                        md5_init(&ctx_md5);
-                        while (content_length > 0) {
-                                if ((n = Socket_read(socket, buf, content_length > sizeof(buf) ? sizeof(buf) : content_length)) < 0)
-                                        break;
-                                md5_append(&ctx_md5, (const md5_byte_t *)buf, n);
-                                content_length -= n;
-                        }
-                        md5_finish(&ctx_md5, (md5_byte_t *)hash);
+                        md5_finish(&B->md5, (md5_byte_t *)hash);
                         keylength = 16; /* Raw key bytes not string chars! */
                         break;
                 case Hash_Sha1:
-                        sha1_init(&ctx_sha1);
-                        while (content_length > 0) {
-                                if ((n = Socket_read(socket, buf, content_length > sizeof(buf) ? sizeof(buf) : content_length)) < 0)
-                                        break;
-                                sha1_append(&ctx_sha1, (md5_byte_t *)buf, n);
-                                content_length -= n;
-                        }
-                        sha1_finish(&ctx_sha1, (md5_byte_t *)hash);
+                        sha1_finish(&B->sha1, (md5_byte_t *)hash);
                         keylength = 20; /* Raw key bytes not string chars! */
                         break;
                 default:
                         THROW(IOException, "HTTP checksum error: Unknown hash type");
         }
-        if (strncasecmp(Util_digest2Bytes((unsigned char *)hash, keylength, result), checksum, keylength * 2) != 0)
+        if (strncasecmp(Util_digest2Bytes((unsigned char *)hash, keylength, result), B->checksum, keylength * 2) != 0)
                 THROW(IOException, "HTTP checksum error: Document checksum mismatch");
         DEBUG("HTTP: Succeeded testing document checksum\n");
 }
@@ -193,6 +278,7 @@ static void check_request_checksum(Socket_T socket, int content_length, char *ch
  */
 static void check_request(Socket_T socket, Port_T P) {
         int status, content_length = -1;
+        boolean_t chunked = false;
         char buf[512];
         if (! Socket_readLine(socket, buf, sizeof(buf)))
                 THROW(IOException, "HTTP: Error receiving data -- %s", STRERROR);
@@ -201,6 +287,8 @@ static void check_request(Socket_T socket, Port_T P) {
                 THROW(IOException, "HTTP error: Cannot parse HTTP status in response: %s", buf);
         if (! Util_evalQExpression(P->operator, status, P->status))
                 THROW(IOException, "HTTP error: Server returned status %d", status);
+        /* HTTP/1.1 connections are persistent unless the server closes it, HTTP/1.0 connections only if the server keeps it alive explicitly */
+        boolean_t persistent = ! Str_startsWith(buf, "HTTP/1.0");
         /* Get Content-Length header value */
         while (Socket_readLine(socket, buf, sizeof(buf))) {
                 if ((buf[0] == '\r' && buf[1] == '\n') || (buf[0] == '\n'))
@@ -211,12 +299,53 @@ static void check_request(Socket_T socket, Port_T P) {
                                 THROW(IOException, "HTTP error: Parsing Content-Length response header '%s'", buf);
                         if (content_length < 0)
                                 THROW(IOException, "HTTP error: Illegal Content-Length response header '%s'", buf);
+                } else if (Str_startsWith(buf, "Transfer-Encoding") && Str_sub(buf, "chunked")) {
+                        chunked = true;
+                } else if (Str_startsWith(buf, "Connection")) {
+                        if (Str_sub(buf, "close"))
+                                persistent = false;
+                        else if (Str_sub(buf, "keep-alive"))
+                                persistent = true;
                 }
         }
+        if (Socket_isReusable(socket)) {
+                if ((status >= 100 && status < 200) || status == 204 || status == 304)
+                        content_length = 0; // No body
+                else if (content_length < 0 && ! chunked)
+                        persistent = false; // The body ends when the server closes the connection
+                if (! persistent)
+                        Socket_setReusable(socket, false);
+        }
+        /* The body is streamed once through both the content match and the checksum */
+        struct mybody body = {.bol = true};
         if (P->url_request && P->url_request->regex)
-                do_regex(socket, content_length, P->url_request);
-        if (P->request_checksum)
-                check_request_checksum(socket, content_length, P->request_checksum, P->request_hashtype);
+                body.request = P->url_request;
+        if (P->request_checksum) {
+                body.checksum = P->request_checksum;
+                body.hashtype = P->request_hashtype;
+                md5_init(&body.md5);
+                sha1_init(&body.sha1);
+        }
+        body.drain = Socket_isReusable(socket);
+        if (! body.request && ! body.checksum && ! body.drain)
+                return;
+        if (body.request)
+                body.window = ALLOC(HTTP_WINDOW + 1);
+        TRY
+        {
+                _readBody(socket, content_length, chunked, &body);
+                if (body.truncated)
+                        Socket_setReusable(socket, false);
+                if (body.request)
+                        check_request_content(&body);
+                if (body.checksum)
+                        check_request_checksum(&body);
+        }
+        FINALLY
+        {
+                FREE(body.window);
+        }
+        END_TRY;
 }
 
 
@@ -54,37 +54,41 @@
 #define NTP_MODE_SERVER   4 /** Mode:           Server                 */
 
 
-/* ------------------------------------------------------------------ Public */
+#define NTP_ORIGINATE    24 /** Originate Timestamp offset            */
+#define NTP_TRANSMIT     40 /** Transmit Timestamp offset             */
 
 
-void check_ntp3(Socket_T socket) {
-        int  br;
-        char ntpRequest[NTPLEN];
-        char ntpResponse[NTPLEN];
+/* ----------------------------------------------------------------- Private */
 
-        ASSERT(socket);
 
-        memset(ntpRequest, 0, NTPLEN);
-        memset(ntpResponse, 0, NTPLEN);
+/*
+ Prepare NTP request. The first octet consists of:
+ bits 0-1 ... Leap Indicator
+ bits 2-4 ... Version Number
+ bits 5-7 ... Mode
+ The transaction id is sent in the transmit timestamp, the server returns it
+ in the originate timestamp of the response
+ */
+static int _request(void *port, unsigned char *request, int size, unsigned id) {
+        ASSERT(size >= NTPLEN);
+        memset(request, 0, NTPLEN);
+        request[0] = (NTP_LEAP_NOTSYNC << 6) | (NTP_VERSION << 3) | (NTP_MODE_CLIENT);
+        request[NTP_TRANSMIT + 4] = (id >> 24) & 0xff;
+        request[NTP_TRANSMIT + 5] = (id >> 16) & 0xff;
+        request[NTP_TRANSMIT + 6] = (id >> 8) & 0xff;
+        request[NTP_TRANSMIT + 7] = id & 0xff;
+        return NTPLEN;
+}
 
-        /*
-         Prepare NTP request. The first octet consists of:
-         bits 0-1 ... Leap Indicator
-         bits 2-4 ... Version Number
-         bits 5-7 ... Mode
-         */
-        ntpRequest[0]= (NTP_LEAP_NOTSYNC << 6) | (NTP_VERSION << 3) | (NTP_MODE_CLIENT);
 
-        /* Send request to NTP server */
-        if (Socket_write(socket, ntpRequest, NTPLEN) <= 0)
-                THROW(IOException, "NTP: error sending NTP request -- %s", STRERROR);
+static boolean_t _match(const unsigned char *request, int requestlength, const unsigned char *response, int length) {
+        return length == NTPLEN && ! memcmp(response + NTP_ORIGINATE, request + NTP_TRANSMIT, 8);
+}
 
-        /* Receive and validate response */
-        if ((br = Socket_read(socket, ntpResponse, NTPLEN)) <= 0)
-                THROW(IOException, "NTP: did not receive answer from server -- %s", STRERROR);
 
-        if (br != NTPLEN)
-                THROW(IOException, "NTP: Received %d bytes from server, expected %d bytes", br, NTPLEN);
+static void _verify(void *port, const unsigned char *request, int requestlength, unsigned char *response, int length) {
+        if (length != NTPLEN)
+                THROW(IOException, "NTP: Received %d bytes from server, expected %d bytes", length, NTPLEN);
 
         /*
          Compare NTP response. The first octet consists of:
@@ -92,11 +96,39 @@ void check_ntp3(Socket_T socket) {
          bits 2-4 ... Version Number
          bits 5-7 ... Mode
          */
-        if ((ntpResponse[0] & 0x07) != NTP_MODE_SERVER)
+        if ((response[0] & 0x07) != NTP_MODE_SERVER)
                 THROW(IOException, "NTP: Server mode error");
-        if ((ntpResponse[0] & 0x38) != NTP_VERSION << 3)
+        if ((response[0] & 0x38) != NTP_VERSION << 3)
                 THROW(IOException, "NTP: Server protocol version error");
-        if ((ntpResponse[0] & 0xc0) == NTP_LEAP_NOTSYNC << 6)
+        if ((response[0] & 0xc0) == NTP_LEAP_NOTSYNC << 6)
                 THROW(IOException, "NTP: Server not synchronized");
 }
 
+
+/* ------------------------------------------------------------------ Public */
+
+
+struct Datagram_T ntp3_datagram = {_request, _match, _verify};
+
+
+void check_ntp3(Socket_T socket) {
+        int  br;
+        unsigned char ntpRequest[NTPLEN];
+        unsigned char ntpResponse[NTPLEN];
+
+        ASSERT(socket);
+
+        memset(ntpResponse, 0, NTPLEN);
+
+        _request(Socket_getPort(socket), ntpRequest, NTPLEN, 0);
+
+        /* Send request to NTP server */
+        if (Socket_write(socket, ntpRequest, NTPLEN) <= 0)
+                THROW(IOException, "NTP: error sending NTP request -- %s", STRERROR);
+
+        /* Receive and validate response */
+        if ((br = Socket_read(socket, ntpResponse, NTPLEN)) <= 0)
+                THROW(IOException, "NTP: did not receive answer from server -- %s", STRERROR);
+
+        _verify(Socket_getPort(socket), ntpRequest, NTPLEN, ntpResponse, br);
+}
@@ -34,8 +34,63 @@
 #include "exceptions/IOException.h"
 
 
+/* ----------------------------------------------------------- Definitions */
+
+
+#define PGSQL_STARTUP_MESSAGES 256 // The limit of the messages preceding ReadyForQuery
+
+
+/* --------------------------------------------------------------- Private */
+
+
+/**
+ * Read one backend message, the message content is skipped
+ * @return The message type
+ */
+static int _readMessage(Socket_T socket) {
+        unsigned char buf[STRLEN];
+        if (Socket_read(socket, buf, 5) != 5)
+                THROW(IOException, "PGSQL: error receiving data -- %s", STRERROR);
+        int type = buf[0];
+        int length = (int)(((unsigned)buf[1] << 24) | (buf[2] << 16) | (buf[3] << 8) | buf[4]) - 4;
+        if (length < 0)
+                THROW(IOException, "PGSQL: invalid message length");
+        while (length > 0) {
+                int n = Socket_read(socket, buf, length < (int)sizeof(buf) ? length : (int)sizeof(buf));
+                if (n <= 0)
+                        THROW(IOException, "PGSQL: error receiving data -- %s", STRERROR);
+                length -= n;
+        }
+        return type;
+}
+
+
+/**
+ * Wait for the ReadyForQuery message, the server is idle then
+ */
+static void _readyForQuery(Socket_T socket) {
+        for (int i = 0; i < PGSQL_STARTUP_MESSAGES; i++) {
+                switch (_readMessage(socket)) {
+                        case 'Z':
+                                return;
+                        case 'E':
+                                THROW(IOException, "PGSQL: server returned error");
+                        default:
+                                break;
+                }
+        }
+        THROW(IOException, "PGSQL: ReadyForQuery expected");
+}
+
+
+/* ---------------------------------------------------------------- Public */
+
+
 /**
- *  PostgreSQL test.
+ *  PostgreSQL test. If the connection is kept open for the next cycle
+ *  (keepalive) and the server accepted the login without a password, the
+ *  session is kept and the next cycle just sends the Sync message which the
+ *  idle server answers with ReadyForQuery.
  *
  *  @file
  */
@@ -104,8 +159,24 @@ void check_pgsql(Socket_T socket) {
                 0x00
         };
 
+        unsigned char requestSync[5] = {
+                0x53,                              /** Type S */
+
+                0x00,                              /** Length */
+                0x00,
+                0x00,
+                0x04
+        };
+
         ASSERT(socket);
 
+        if (Socket_isReused(socket)) {
+                if (Socket_write(socket, (unsigned char *)requestSync, sizeof(requestSync)) <= 0)
+                        THROW(IOException, "PGSQL: error sending data -- %s", STRERROR);
+                _readyForQuery(socket);
+                return;
+        }
+
         if (Socket_write(socket, (unsigned char *)requestLogin, sizeof(requestLogin)) <= 0)
                 THROW(IOException, "PGSQL: error sending data -- %s", STRERROR);
 
@@ -114,19 +185,28 @@ void check_pgsql(Socket_T socket) {
                 THROW(IOException, "PGSQL: error receiving data -- %s", STRERROR);
 
         /** If server insists on auth error it is working anyway */
-        if (*buf == 'E')
+        if (*buf == 'E') {
+                Socket_setReusable(socket, false);
                 return;
+        }
 
         /** Successful connection */
         if (! memcmp((unsigned char *)buf, (unsigned char *)responseAuthOk, 9)) {
+                /** Keep the session for the next cycle */
+                if (Socket_isReusable(socket)) {
+                        _readyForQuery(socket);
+                        return;
+                }
                 /** This is where suspicious people can do SELECT query that I dont */
                 Socket_write(socket, (unsigned char *)requestTerm, sizeof(requestTerm));
                 return;
         }
 
-        /** The last possibility must be that server is demanding password */
-        if (*buf == 'R')
+        /** The last possibility must be that server is demanding password, the session cannot be kept without it */
+        if (*buf == 'R') {
+                Socket_setReusable(socket, false);
                 return;
+        }
 
         THROW(IOException, "PGSQL: unknown error");
 }
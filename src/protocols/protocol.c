@@ -54,9 +54,9 @@ static Protocol_T protocols[] = {
         &(struct Protocol_T){"RSYNC",           check_rsync},
         &(struct Protocol_T){"generic",         check_generic},
         &(struct Protocol_T){"APACHESTATUS",    check_apache_status},
-        &(struct Protocol_T){"NTP3",            check_ntp3},
+        &(struct Protocol_T){"NTP3",            check_ntp3,             &ntp3_datagram},
         &(struct Protocol_T){"MYSQL",           check_mysql},
-        &(struct Protocol_T){"DNS",             check_dns},
+        &(struct Protocol_T){"DNS",             check_dns,              &dns_datagram},
         &(struct Protocol_T){"POSTFIX-POLICY",  check_postfix_policy},
         &(struct Protocol_T){"TNS",             check_tns},
         &(struct Protocol_T){"PGSQL",           check_pgsql},
@@ -64,12 +64,13 @@ static Protocol_T protocols[] = {
         &(struct Protocol_T){"SIP",             check_sip},
         &(struct Protocol_T){"LMTP",            check_lmtp},
         &(struct Protocol_T){"GPS",             check_gps},
-        &(struct Protocol_T){"RADIUS",          check_radius},
+        &(struct Protocol_T){"RADIUS",          check_radius,           &radius_datagram},
         &(struct Protocol_T){"MEMCACHE",        check_memcache},
         &(struct Protocol_T){"WEBSOCKET",       check_websocket},
         &(struct Protocol_T){"REDIS",           check_redis},
         &(struct Protocol_T){"MONGODB",         check_mongodb},
-        &(struct Protocol_T){"SIEVE",           check_sieve}
+        &(struct Protocol_T){"SIEVE",           check_sieve},
+        &(struct Protocol_T){"GRPC",            check_grpc}
 };
 
 
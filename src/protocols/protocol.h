@@ -63,7 +63,8 @@ typedef enum {
         Protocol_WEBSOCKET,
         Protocol_REDIS,
         Protocol_MONGODB,
-        Protocol_SIEVE
+        Protocol_SIEVE,
+        Protocol_GRPC
 } Protocol_Type;
 
 
@@ -98,6 +99,13 @@ void check_gps(Socket_T);
 void check_radius(Socket_T);
 void check_memcache(Socket_T);
 void check_websocket(Socket_T);
+void check_grpc(Socket_T);
+
+
+/* The datagram functions of the UDP protocols, see udp_probe_batch() */
+extern struct Datagram_T dns_datagram;
+extern struct Datagram_T ntp3_datagram;
+extern struct Datagram_T radius_datagram;
 
 
 /*
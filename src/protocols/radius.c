@@ -51,20 +51,33 @@
  *
  *
  */
-void check_radius(Socket_T socket) {
-        int i, length, left;
-        int secret_len;
-        Port_T P;
-        md5_context_t ctx;
-        char *secret;
-        unsigned char *attr;
-        unsigned char  digest[16];
-        unsigned char  response[STRLEN];
-        unsigned char  request[38] = {
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+#define RADIUS_REQUEST_LENGTH 38
+
+
+/* --------------------------------------------------------------- Private */
+
+
+static const char *_secret(Port_T P) {
+        return P && P->request ? P->request : "testing123";
+}
+
+
+/*
+ * Build the Status-Server request, the packet identifier is the transaction id
+ */
+static int _request(void *port, unsigned char *request, int size, unsigned id) {
+        int i;
+        const char *secret = _secret(port);
+        unsigned char  packet[RADIUS_REQUEST_LENGTH] = {
                 /* Status-Server */
                 0x0c,
 
-                /* Code, we always use zero */
+                /* Packet identifier */
                 0x00,
 
                 /* Packet length */
@@ -114,37 +127,43 @@ void check_radius(Socket_T socket) {
                 0x00
         };
 
-        ASSERT(socket);
-
-        if (Socket_getType(socket) != Socket_Udp)
-                THROW(IOException, "RADIUS: unsupported socket type -- protocol test skipped");
-
-        P = Socket_getPort(socket);
-        ASSERT(P);
+        ASSERT(size >= RADIUS_REQUEST_LENGTH);
 
-        secret = P->request ? P->request : "testing123";
-        secret_len = (int)strlen(secret);
+        packet[1] = id & 0xff;
 
         /* get 16 bytes of random data */
         for (i = 0; i < 16; i++)
-                request[i + 4] = ((unsigned int)random()) & 0xff;
+                packet[i + 4] = ((unsigned int)random()) & 0xff;
 
         /* sign the packet */
-        Util_hmacMD5(request, sizeof(request), (unsigned char *)secret, secret_len, request + 22);
+        Util_hmacMD5(packet, sizeof(packet), (unsigned char *)secret, (int)strlen(secret), packet + 22);
 
-        if (Socket_write(socket, (unsigned char *)request, sizeof(request)) < 0)
-                THROW(IOException, "RADIUS: error sending query -- %s", STRERROR);
+        memcpy(request, packet, RADIUS_REQUEST_LENGTH);
+        return RADIUS_REQUEST_LENGTH;
+}
+
+
+static boolean_t _match(const unsigned char *request, int requestlength, const unsigned char *response, int length) {
+        return length >= 20 && response[1] == request[1];
+}
+
+
+static void _verify(void *port, const unsigned char *request, int requestlength, unsigned char *response, int length) {
+        int left;
+        unsigned char *attr;
+        unsigned char  digest[16];
+        const char *secret = _secret(port);
 
         /* the response should have at least 20 bytes */
-        if ((length = Socket_read(socket, (unsigned char *)response, sizeof(response))) < 20)
-                THROW(IOException, "RADIUS: error receiving response -- %s", STRERROR);
+        if (length < 20)
+                THROW(IOException, "RADIUS: response is too short -- %d bytes", length);
 
         /* compare the response code (should be Access-Accept or Accounting-Response) */
         if ((response[0] != 2) && (response[0] != 5))
                 THROW(IOException, "RADIUS: Invalid reply code -- error occured");
 
         /* compare the packet ID (it should be the same as in our request) */
-        if (response[1] != 0x00)
+        if (response[1] != request[1])
                 THROW(IOException, "RADIUS: ID mismatch");
 
         /* check the length */
@@ -179,12 +198,41 @@ void check_radius(Socket_T socket) {
         memcpy(digest, response + 4, 16);
         memcpy(response + 4, request + 4, 16);
 
+        md5_context_t ctx;
         md5_init(&ctx);
         md5_append(&ctx, (const md5_byte_t *)response, length);
-        md5_append(&ctx, (const md5_byte_t *)secret, secret_len);
+        md5_append(&ctx, (const md5_byte_t *)secret, (int)strlen(secret));
         md5_finish(&ctx, response + 4);
 
         if (memcmp(digest, response + 4, 16) != 0)
                 LogInfo("RADIUS: message fails authentication");
 }
 
+
+/* ---------------------------------------------------------------- Public */
+
+
+struct Datagram_T radius_datagram = {_request, _match, _verify};
+
+
+void check_radius(Socket_T socket) {
+        int length;
+        unsigned char  request[RADIUS_REQUEST_LENGTH];
+        unsigned char  response[STRLEN];
+
+        ASSERT(socket);
+
+        if (Socket_getType(socket) != Socket_Udp)
+                THROW(IOException, "RADIUS: unsupported socket type -- protocol test skipped");
+
+        _request(Socket_getPort(socket), request, sizeof(request), 0);
+
+        if (Socket_write(socket, (unsigned char *)request, sizeof(request)) < 0)
+                THROW(IOException, "RADIUS: error sending query -- %s", STRERROR);
+
+        /* the response should have at least 20 bytes */
+        if ((length = Socket_read(socket, (unsigned char *)response, sizeof(response))) < 20)
+                THROW(IOException, "RADIUS: error receiving response -- %s", STRERROR);
+
+        _verify(Socket_getPort(socket), request, sizeof(request), response, length);
+}
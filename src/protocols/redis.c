@@ -38,7 +38,8 @@
  *
  *     1. send a PING command
  *     2. expect a PONG response
- *     3. send a QUIT command
+ *     3. send a QUIT command, unless the connection is kept open for the
+ *        next cycle (keepalive)
  *
  * @see http://redis.io/topics/protocol
  *
@@ -55,6 +56,8 @@ void check_redis(Socket_T socket) {
         Str_chomp(buf);
         if (! Str_isEqual(buf, "+PONG") && ! Str_startsWith(buf, "-NOAUTH")) // We accept authentication error (-NOAUTH Authentication required): redis responded to request, but requires authentication => we assume it works
                 THROW(IOException, "REDIS: PING error -- %s", buf);
+        if (Socket_isReusable(socket))
+                return;
         if (Socket_print(socket, "*1\r\n$4\r\nQUIT\r\n") < 0)
                 THROW(IOException, "REDIS: QUIT command error -- %s", STRERROR);
 }
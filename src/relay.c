@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "monit.h"
+#include "relay.h"
+
+
+/**
+ *  M/Monit relay - the messages of the downstream Monit instances are
+ *  collected by the HTTP interface (see cervlet.c) and forwarded to the
+ *  M/Monit servers by the heartbeat thread.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+typedef struct mymessage {
+        char *id;                                      /**< The agent Monit id */
+        char *type;                                 /**< The message content type */
+        char *data;                                              /**< The message */
+        int length;                                       /**< The message length */
+
+        /** For internal use */
+        struct mymessage *next;                               /**< Next message */
+} *Message_T;
+
+
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static struct {
+        Message_T statuses;                 /**< The latest status of each agent */
+        Message_T events;                         /**< The events, oldest first */
+        Message_T *tail;                             /**< The events list tail */
+        int queued;                                 /**< Number of queued events */
+        unsigned long long dropped;        /**< Events dropped as the queue was full */
+} relay = {.tail = &relay.events};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/**
+ * Get the Monit id of the message, the id is the first attribute of the
+ * XML message root element and the first member of the JSON message
+ */
+static char *_id(const char *data, const char *remote) {
+        const char *id = NULL;
+        if ((id = strstr(data, "<monit id=\"")))
+                id += 11;
+        else if ((id = strstr(data, "{\"id\":\"")))
+                id += 7;
+        if (id) {
+                const char *end = strchr(id, '"');
+                if (end && end - id < STRLEN)
+                        return Str_ndup(id, (int)(end - id));
+        }
+        return Str_dup(remote ? remote : "");
+}
+
+
+static void _free(Message_T *M) {
+        FREE((*M)->id);
+        FREE((*M)->type);
+        FREE((*M)->data);
+        FREE(*M);
+}
+
+
+static void _freeList(Message_T *list) {
+        Message_T next;
+        for (Message_T M = *list; M; M = next) {
+                next = M->next;
+                _free(&M);
+        }
+        *list = NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void Relay_receive(const char *type, char *data, int length, const char *remote) {
+        ASSERT(data);
+        Message_T M;
+        NEW(M);
+        M->id = _id(data, remote);
+        M->type = Str_dup(type && Str_startsWith(type, "application/json") ? "application/json" : "text/xml");
+        M->data = data;
+        M->length = length;
+        boolean_t event = strstr(data, "<event><collected_sec>") || strstr(data, "\"event\":{\"collected_sec\"");
+        DEBUG("M/Monit relay: %s message from %s queued\n", event ? "event" : "status", M->id);
+        LOCK(mutex)
+        {
+                if (event) {
+                        while (relay.queued >= RELAY_EVENTS) {
+                                Message_T oldest = relay.events;
+                                if (! (relay.events = oldest->next))
+                                        relay.tail = &relay.events;
+                                _free(&oldest);
+                                relay.queued--;
+                                if (relay.dropped++ == 0)
+                                        LogError("M/Monit relay: the event queue is full, dropping the oldest events\n");
+                        }
+                        *relay.tail = M;
+                        relay.tail = &M->next;
+                        relay.queued++;
+                } else {
+                        /* The newer status of the agent replaces the pending one */
+                        Message_T *P;
+                        for (P = &relay.statuses; *P; P = &(*P)->next) {
+                                if (IS((*P)->id, M->id)) {
+                                        Message_T old = *P;
+                                        M->next = old->next;
+                                        _free(&old);
+                                        break;
+                                }
+                        }
+                        *P = M;
+                }
+        }
+        END_LOCK;
+}
+
+
+void Relay_forward() {
+        Message_T events, statuses;
+        LOCK(mutex)
+        {
+                events = relay.events;
+                statuses = relay.statuses;
+                relay.events = relay.statuses = NULL;
+                relay.tail = &relay.events;
+                relay.queued = 0;
+                if (relay.dropped) {
+                        LogError("M/Monit relay: %llu events were dropped\n", relay.dropped);
+                        relay.dropped = 0;
+                }
+        }
+        END_LOCK;
+        int forwarded = 0;
+        boolean_t failed = false;
+        /* The events first, in the order of arrival. If the server is not available, the rest is kept for the next cycle */
+        while (events && ! failed) {
+                if (handle_mmonit_relay(events->type, events->data, events->length) == Handler_Succeeded) {
+                        Message_T M = events;
+                        events = events->next;
+                        _free(&M);
+                        forwarded++;
+                } else {
+                        failed = true;
+                }
+        }
+        while (statuses && ! failed) {
+                if (handle_mmonit_relay(statuses->type, statuses->data, statuses->length) == Handler_Succeeded) {
+                        Message_T M = statuses;
+                        statuses = statuses->next;
+                        _free(&M);
+                        forwarded++;
+                } else {
+                        failed = true;
+                }
+        }
+        if (events || statuses) {
+                LOCK(mutex)
+                {
+                        /* The events received meanwhile follow the unsent ones */
+                        if (events) {
+                                int count = 0;
+                                Message_T *tail = &events;
+                                for (; *tail; tail = &(*tail)->next)
+                                        count++;
+                                *tail = relay.events;
+                                if (! relay.events)
+                                        relay.tail = tail;
+                                relay.events = events;
+                                relay.queued += count;
+                        }
+                        /* The unsent status is dropped if the agent sent a newer one meanwhile */
+                        Message_T next;
+                        for (Message_T M = statuses; M; M = next) {
+                                next = M->next;
+                                Message_T N;
+                                for (N = relay.statuses; N && ! IS(N->id, M->id); N = N->next)
+                                        ;
+                                if (N) {
+                                        _free(&M);
+                                } else {
+                                        M->next = relay.statuses;
+                                        relay.statuses = M;
+                                }
+                        }
+                }
+                END_LOCK;
+        }
+        if (forwarded)
+                DEBUG("M/Monit relay: %d messages forwarded\n", forwarded);
+}
+
+
+void Relay_clear() {
+        LOCK(mutex)
+        {
+                _freeList(&relay.events);
+                _freeList(&relay.statuses);
+                relay.tail = &relay.events;
+                relay.queued = 0;
+        }
+        END_LOCK;
+}
+
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+
+#ifndef MONIT_RELAY_H
+#define MONIT_RELAY_H
+
+
+/**
+ * M/Monit relay.
+ *
+ * A Monit instance with the "set relay" statement accepts the event and
+ * status messages of other Monit instances at the /collector URL of its
+ * HTTP interface, so the downstream agents use the relay as their
+ * M/Monit server. The relay keeps only the latest status message of each
+ * agent (the agents are asked to send full status reports, so the newer
+ * message replaces the older one), the events are queued in the order
+ * of arrival. Once per cycle the relay forwards the pending messages to
+ * its own M/Monit servers over the persistent connection, compressed if
+ * the server supports it, the events first. The messages are forwarded
+ * unchanged, the upstream server can be M/Monit or another relay.
+ *
+ *  @file
+ */
+
+
+/**
+ * The maximum size of a relayed message
+ */
+#define RELAY_MESSAGE_MAX 1048576
+
+
+/**
+ * The maximum number of queued events, the oldest event is dropped when
+ * the queue is full
+ */
+#define RELAY_EVENTS 4096
+
+
+/**
+ * Queue the message received from a downstream Monit instance. The relay
+ * takes the ownership of the message data
+ * @param type The message content type (text/xml or application/json)
+ * @param data The message
+ * @param length The message length
+ * @param remote The agent address, used if the message has no Monit id
+ */
+void Relay_receive(const char *type, char *data, int length, const char *remote);
+
+
+/**
+ * Forward the pending messages to the M/Monit servers. The messages which
+ * could not be sent are kept for the next attempt. Called by the M/Monit
+ * heartbeat thread
+ */
+void Relay_forward();
+
+
+/**
+ * Drop all pending messages
+ */
+void Relay_clear();
+
+
+#endif
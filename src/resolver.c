@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+
+#include "monit.h"
+#include "resolver.h"
+
+// libmonit
+#include "util/Str.h"
+#include "system/Time.h"
+
+
+/**
+ *  Host name resolver cache.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define RESOLVER_BUCKETS 127
+#define RESOLVER_ENTRIES 1024 // Cache size limit, the expired entries are dropped when reached
+
+
+typedef struct myentry {
+        char *hostname;                                       /**< Resolved name */
+        char *service;                         /**< Resolved service or empty string */
+        int family;                                              /**< Hints family */
+        int socktype;                                          /**< Hints socktype */
+        int protocol;                                          /**< Hints protocol */
+        int flags;                                                /**< Hints flags */
+        int status;                                     /**< getaddrinfo() result */
+        time_t expire;                            /**< Time when the entry expires */
+        struct addrinfo *result;                       /**< Cached address list */
+        struct myentry *next;                                 /**< Next in bucket */
+} *Entry_T;
+
+
+static struct {
+        Mutex_T mutex;
+        int entries;
+        unsigned long long hits;
+        unsigned long long negative;
+        unsigned long long misses;
+        Entry_T bucket[RESOLVER_BUCKETS];
+} cache = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static unsigned _hash(const char *hostname, const char *service) {
+        unsigned h = 5381;
+        for (const char *s = hostname; *s; s++)
+                h = ((h << 5) + h) + *s;
+        for (const char *s = service; *s; s++)
+                h = ((h << 5) + h) + *s;
+        return h % RESOLVER_BUCKETS;
+}
+
+
+/**
+ * Returns true if the lookup failure is permanent and can be cached
+ */
+static boolean_t _isNegative(int status) {
+        switch (status) {
+                case EAI_NONAME:
+#if defined EAI_NODATA && EAI_NODATA != EAI_NONAME
+                case EAI_NODATA:
+#endif
+#ifdef EAI_ADDRFAMILY
+                case EAI_ADDRFAMILY:
+#endif
+                        return true;
+                default:
+                        return false;
+        }
+}
+
+
+/**
+ * Copy the address list, the address is allocated together with the list node
+ */
+static struct addrinfo *_copy(const struct addrinfo *source) {
+        struct addrinfo *result = NULL, **last = &result;
+        for (const struct addrinfo *a = source; a; a = a->ai_next) {
+                struct addrinfo *r = ALLOC(sizeof(struct addrinfo) + a->ai_addrlen);
+                memcpy(r, a, sizeof(struct addrinfo));
+                r->ai_addr = (struct sockaddr *)(r + 1);
+                memcpy(r->ai_addr, a->ai_addr, a->ai_addrlen);
+                r->ai_canonname = NULL;
+                r->ai_next = NULL;
+                *last = r;
+                last = &r->ai_next;
+        }
+        return result;
+}
+
+
+static boolean_t _match(Entry_T e, const char *hostname, const char *service, const struct addrinfo *hints) {
+        return e->family == hints->ai_family && e->socktype == hints->ai_socktype && e->protocol == hints->ai_protocol && e->flags == hints->ai_flags && IS(e->hostname, hostname) && IS(e->service, service);
+}
+
+
+static void _freeEntry(Entry_T *e) {
+        Resolver_free((*e)->result);
+        FREE((*e)->hostname);
+        FREE((*e)->service);
+        FREE(*e);
+}
+
+
+/**
+ * Drop the expired entries (or all entries if all is true). Must be called with the cache locked
+ */
+static void _purge(boolean_t all) {
+        time_t now = Time_now();
+        for (int i = 0; i < RESOLVER_BUCKETS; i++) {
+                for (Entry_T *e = &cache.bucket[i]; *e;) {
+                        if (all || (*e)->expire <= now) {
+                                Entry_T next = (*e)->next;
+                                _freeEntry(e);
+                                *e = next;
+                                cache.entries--;
+                        } else {
+                                e = &(*e)->next;
+                        }
+                }
+        }
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int Resolver_get(const char *hostname, const char *service, const struct addrinfo *hints, struct addrinfo **result) {
+        ASSERT(hostname);
+        ASSERT(hints);
+        ASSERT(result);
+        int status;
+        *result = NULL;
+        if (Run.dnscache <= 0) {
+                struct addrinfo *r;
+                if ((status = getaddrinfo(hostname, service, hints, &r)) == 0) {
+                        *result = _copy(r);
+                        freeaddrinfo(r);
+                }
+                return status;
+        }
+        if (! service)
+                service = "";
+        unsigned h = _hash(hostname, service);
+        boolean_t found = false;
+        LOCK(cache.mutex)
+        {
+                time_t now = Time_now();
+                for (Entry_T e = cache.bucket[h]; e; e = e->next) {
+                        if (_match(e, hostname, service, hints)) {
+                                if (e->expire > now) {
+                                        found = true;
+                                        status = e->status;
+                                        *result = _copy(e->result);
+                                        if (status)
+                                                cache.negative++;
+                                        else
+                                                cache.hits++;
+                                }
+                                break;
+                        }
+                }
+                if (! found)
+                        cache.misses++;
+        }
+        END_LOCK;
+        if (found)
+                return status;
+        struct addrinfo *r = NULL;
+        status = getaddrinfo(hostname, *service ? service : NULL, hints, &r);
+        if (status == 0 || _isNegative(status)) {
+                Entry_T entry;
+                NEW(entry);
+                entry->hostname = Str_dup(hostname);
+                entry->service = Str_dup(service);
+                entry->family = hints->ai_family;
+                entry->socktype = hints->ai_socktype;
+                entry->protocol = hints->ai_protocol;
+                entry->flags = hints->ai_flags;
+                entry->status = status;
+                entry->expire = Time_now() + Run.dnscache;
+                if (status == 0)
+                        entry->result = _copy(r);
+                LOCK(cache.mutex)
+                {
+                        /* Replace the expired entry or the entry added by a concurrent lookup */
+                        for (Entry_T *e = &cache.bucket[h]; *e; e = &(*e)->next) {
+                                if (_match(*e, hostname, service, hints)) {
+                                        Entry_T next = (*e)->next;
+                                        _freeEntry(e);
+                                        *e = next;
+                                        cache.entries--;
+                                        break;
+                                }
+                        }
+                        if (cache.entries >= RESOLVER_ENTRIES)
+                                _purge(false);
+                        if (cache.entries >= RESOLVER_ENTRIES)
+                                _purge(true);
+                        entry->next = cache.bucket[h];
+                        cache.bucket[h] = entry;
+                        cache.entries++;
+                }
+                END_LOCK;
+        }
+        if (status == 0) {
+                *result = _copy(r);
+                freeaddrinfo(r);
+        }
+        return status;
+}
+
+
+void Resolver_free(struct addrinfo *result) {
+        while (result) {
+                struct addrinfo *next = result->ai_next;
+                FREE(result);
+                result = next;
+        }
+}
+
+
+void Resolver_flush() {
+        LOCK(cache.mutex)
+        {
+                _purge(true);
+                cache.hits = cache.negative = cache.misses = 0;
+        }
+        END_LOCK;
+}
+
+
+ResolverStats_T Resolver_stats() {
+        ResolverStats_T stats;
+        LOCK(cache.mutex)
+        {
+                stats.entries = cache.entries;
+                stats.hits = cache.hits;
+                stats.negative = cache.negative;
+                stats.misses = cache.misses;
+        }
+        END_LOCK;
+        return stats;
+}
+
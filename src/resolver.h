@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#ifndef MONIT_RESOLVER_H
+#define MONIT_RESOLVER_H
+
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+
+
+/**
+ * Host name resolver cache.
+ *
+ * The socket, ping and M/Monit connections resolve the host names using
+ * this cache instead of calling getaddrinfo() for every connection in
+ * every cycle. Successful as well as failed (the host name does not
+ * exist) lookups are kept for the max age configured using the
+ * "set dns cache" statement, temporary resolver failures are not cached.
+ * If the cache is disabled, every lookup is passed to getaddrinfo().
+ * The cache is thread safe.
+ *
+ *  @file
+ */
+
+
+/**
+ * Resolver cache statistics
+ */
+typedef struct ResolverStats_T {
+        int entries;                                   /**< Number of cached names */
+        unsigned long long hits;                     /**< Lookups found in the cache */
+        unsigned long long negative;  /**< Lookups found in the cache as failed */
+        unsigned long long misses;               /**< Lookups passed to the resolver */
+} ResolverStats_T;
+
+
+/**
+ * Resolve the hostname and service using the cache. The arguments have
+ * the same meaning as for getaddrinfo()
+ * @param hostname The host to resolve
+ * @param service The service name or port number, may be NULL
+ * @param hints The lookup hints
+ * @param result The address list. Must be released using Resolver_free()
+ * @return 0 on success, otherwise the getaddrinfo() error code
+ */
+int Resolver_get(const char *hostname, const char *service, const struct addrinfo *hints, struct addrinfo **result);
+
+
+/**
+ * Release the address list returned by Resolver_get()
+ * @param result The address list
+ */
+void Resolver_free(struct addrinfo *result);
+
+
+/**
+ * Drop all cached entries, for example on reload
+ */
+void Resolver_flush();
+
+
+/**
+ * Get the cache statistics
+ * @return The statistics
+ */
+ResolverStats_T Resolver_stats();
+
+
+#endif
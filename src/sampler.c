@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "monit.h"
+#include "process_sysdep.h"
+#include "latency.h"
+#include "sampler.h"
+
+/**
+ *  High frequency sampler.
+ *
+ *  The sampler thread wakes up when the next service is due, reads its
+ *  sampled metrics and records them in the service slots. The slots are
+ *  updated and collected using the atomic builtins, the sampler mutex
+ *  only serializes the reads of the platform system CPU counters, which
+ *  keep the previous values in static variables.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+#define SAMPLER_IDLE 1000000ULL // us, the longest sleep, to pick up the services which are monitored again
+
+
+/* The samples of one metric since the last collect, updated by the sampler thread */
+typedef struct {
+        volatile long long min;
+        volatile long long max;
+        volatile long long sum;
+        volatile int count;
+} Slot_T;
+
+
+struct mysampler {
+        unsigned int types;                  /**< The sampled metrics (1 << Sample_Type) */
+        unsigned long long interval;                   /**< Sampling interval [us] */
+        unsigned long long due;              /**< The next sample [us, Latency_now()] */
+        Slot_T slot[Sample_Last];             /**< The samples since the last collect */
+        Sample_T sample[Sample_Last];          /**< The samples of the last collect */
+        /* The sampler thread state */
+        pid_t pid;                                      /**< The sampled process */
+        long cputime;                     /**< CPU time of the last sample [1/10 s] */
+        double time;                          /**< Time of the last sample [1/10 s] */
+        Link_T link;                         /**< The link statistics of the sampler */
+};
+
+
+static struct {
+        volatile boolean_t running;
+        Thread_T thread;
+        Mutex_T mutex;
+        Sem_T wakeup;
+        SystemInfo_T si;     /**< The system info used by the sampler CPU reads */
+        long long user;               /**< Sum of the system CPU user usage samples */
+        long long syst;             /**< Sum of the system CPU system usage samples */
+        long long wait;               /**< Sum of the system CPU wait usage samples */
+        int count;     /**< Number of the system CPU samples since the last update */
+} sampler = {.mutex = PTHREAD_MUTEX_INITIALIZER, .wakeup = PTHREAD_COND_INITIALIZER};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static inline boolean_t _isSampled(Sampler_T S, Sample_Type type) {
+        return S->types & (1U << type);
+}
+
+
+static void _record(Sampler_T S, Sample_Type type, long long value) {
+        if (! _isSampled(S, type) || value < 0)
+                return;
+        Slot_T *slot = &S->slot[type];
+        long long v;
+        while ((v = slot->max) < value && ! __sync_bool_compare_and_swap(&slot->max, v, value))
+                ;
+        while ((v = slot->min) > value && ! __sync_bool_compare_and_swap(&slot->min, v, value))
+                ;
+        __sync_fetch_and_add(&slot->sum, value);
+        __sync_fetch_and_add(&slot->count, 1);
+}
+
+
+/**
+ * Sample the process CPU usage, computed the same way as the cycle value
+ * from the CPU time change since the previous sample
+ */
+static void _sampleProcess(Service_T s) {
+        Sampler_T S = s->sampler;
+        ProcessTree_T pt;
+        pid_t pid = s->inf->priv.process.pid;
+        if (pid <= 0 || ! process_info_sysdep(pid, &pt)) {
+                S->pid = 0;
+                return;
+        }
+        if (S->pid == pid && pt.cputime >= S->cputime && pt.time > S->time) {
+                long long percent = (long long)((1000 * (double)(pt.cputime - S->cputime) / (pt.time - S->time)) / systeminfo.cpus);
+                _record(S, Sample_Cpu, percent > 1000 ? 1000 : percent);
+        }
+        S->pid = pid;
+        S->cputime = pt.cputime;
+        S->time = pt.time;
+}
+
+
+/**
+ * Sample the system CPU usage, called with the sampler mutex locked
+ */
+static void _sampleSystem(Service_T s) {
+        if (! used_system_cpu_sysdep(&sampler.si) || sampler.si.total_cpu_user_percent < 0)
+                return; // Failed or the first read, which initializes the counters
+        _record(s->sampler, Sample_CpuUser, sampler.si.total_cpu_user_percent);
+        _record(s->sampler, Sample_CpuSystem, sampler.si.total_cpu_syst_percent);
+        _record(s->sampler, Sample_CpuWait, sampler.si.total_cpu_wait_percent);
+        sampler.user += sampler.si.total_cpu_user_percent;
+        sampler.syst += sampler.si.total_cpu_syst_percent;
+        sampler.wait += sampler.si.total_cpu_wait_percent;
+        sampler.count++;
+}
+
+
+/**
+ * Sample the link traffic using the sampler's own link statistics, so the
+ * per second rates are computed over the sampling interval
+ */
+static void _sampleLink(Service_T s) {
+        Sampler_T S = s->sampler;
+        TRY
+        {
+                if (! S->link)
+                        S->link = s->inf->priv.net.interface ? Link_createForInterface(s->path) : Link_createForAddress(s->path);
+                Link_update(S->link);
+                _record(S, Sample_BytesIn, Link_getBytesInPerSecond(S->link));
+                _record(S, Sample_BytesOut, Link_getBytesOutPerSecond(S->link));
+                _record(S, Sample_PacketsIn, Link_getPacketsInPerSecond(S->link));
+                _record(S, Sample_PacketsOut, Link_getPacketsOutPerSecond(S->link));
+        }
+        ELSE
+        {
+                DEBUG("'%s' link sampling failed -- %s\n", s->name, Exception_frame.message);
+        }
+        END_TRY;
+}
+
+
+static void _sample(Service_T s) {
+        switch (s->type) {
+                case Service_Process:
+                        _sampleProcess(s);
+                        break;
+                case Service_System:
+                        _sampleSystem(s);
+                        break;
+                case Service_Net:
+                        _sampleLink(s);
+                        break;
+                default:
+                        break;
+        }
+}
+
+
+static void *_sampler(void *args) {
+        LOCK(sampler.mutex)
+        {
+                while (sampler.running && ! Run.stopped) {
+                        unsigned long long now = Latency_now();
+                        unsigned long long next = now + SAMPLER_IDLE;
+                        for (Service_T s = servicelist; s; s = s->next) {
+                                Sampler_T S = s->sampler;
+                                if (! S || s->monitor == Monitor_Not)
+                                        continue;
+                                if (S->due <= now) {
+                                        _sample(s);
+                                        // Keep the sampling cadence unless the sampler is late by more than one interval
+                                        S->due = S->due + S->interval > now ? S->due + S->interval : now + S->interval;
+                                }
+                                if (S->due < next)
+                                        next = S->due;
+                        }
+                        struct timeval tv;
+                        gettimeofday(&tv, NULL);
+                        long long wakeup = (long long)tv.tv_sec * 1000000LL + tv.tv_usec + (long long)(next - Latency_now());
+                        struct timespec wait = {.tv_sec = wakeup / 1000000LL, .tv_nsec = (wakeup % 1000000LL) * 1000LL};
+                        Sem_timeWait(sampler.wakeup, sampler.mutex, wait);
+                }
+        }
+        END_LOCK;
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+Sample_Type Sampler_getType(Resource_Type id) {
+        switch (id) {
+                case Resource_CpuPercent:
+                        return Sample_Cpu;
+                case Resource_CpuUser:
+                        return Sample_CpuUser;
+                case Resource_CpuSystem:
+                        return Sample_CpuSystem;
+                case Resource_CpuWait:
+                        return Sample_CpuWait;
+                default:
+                        return Sample_Last;
+        }
+}
+
+
+void Sampler_add(Service_T s, Sample_Type type, int interval) {
+        ASSERT(s);
+        ASSERT(type < Sample_Last);
+        ASSERT(interval > 0);
+        if (! s->sampler)
+                NEW(s->sampler);
+        Sampler_T S = s->sampler;
+        if (! _isSampled(S, type)) {
+                S->types |= 1U << type;
+                S->slot[type].min = LLONG_MAX;
+                S->slot[type].max = LLONG_MIN;
+        }
+        unsigned long long us = (unsigned long long)interval * 1000000ULL;
+        if (! S->interval || us < S->interval)
+                S->interval = us;
+}
+
+
+boolean_t Sampler_start() {
+        if (sampler.running)
+                return true;
+        boolean_t sampled = false;
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (s->sampler) {
+                        s->sampler->due = 0ULL;
+                        sampled = true;
+                }
+        }
+        if (! sampled)
+                return true;
+        LOCK(sampler.mutex)
+        {
+                // The sampler reads the aggregate CPU usage only, the per-CPU usage is read once per cycle
+                sampler.si = systeminfo;
+                sampler.si.percpu = false;
+                sampler.user = sampler.syst = sampler.wait = 0LL;
+                sampler.count = 0;
+                sampler.running = true;
+        }
+        END_LOCK;
+        Thread_create(sampler.thread, _sampler, NULL);
+        LogInfo("High frequency sampler started\n");
+        return true;
+}
+
+
+void Sampler_stop() {
+        if (! sampler.running)
+                return;
+        LOCK(sampler.mutex)
+        {
+                sampler.running = false;
+                Sem_signal(sampler.wakeup);
+        }
+        END_LOCK;
+        Thread_join(sampler.thread);
+        LogInfo("High frequency sampler stopped\n");
+}
+
+
+boolean_t Sampler_isRunning() {
+        return sampler.running;
+}
+
+
+void Sampler_collect(Service_T s) {
+        ASSERT(s);
+        Sampler_T S = s->sampler;
+        if (! S)
+                return;
+        for (int i = 0; i < Sample_Last; i++) {
+                if (_isSampled(S, i)) {
+                        // A sample recorded while the slot is collected may be split between two cycles, which doesn't change the peaks
+                        Slot_T *slot = &S->slot[i];
+                        Sample_T *sample = &S->sample[i];
+                        sample->count = __sync_fetch_and_and(&slot->count, 0);
+                        long long sum = __sync_fetch_and_and(&slot->sum, 0LL);
+                        sample->max = __sync_lock_test_and_set(&slot->max, LLONG_MIN);
+                        sample->min = __sync_lock_test_and_set(&slot->min, LLONG_MAX);
+                        sample->average = sample->count > 0 ? sum / sample->count : 0LL;
+                }
+        }
+}
+
+
+boolean_t Sampler_get(Service_T s, Sample_Type type, Sample_T *sample) {
+        ASSERT(s);
+        ASSERT(sample);
+        Sampler_T S = s->sampler;
+        if (! S || type >= Sample_Last || ! _isSampled(S, type) || S->sample[type].count <= 0)
+                return false;
+        *sample = S->sample[type];
+        return true;
+}
+
+
+boolean_t Sampler_updateSystemCpu(SystemInfo_T *si) {
+        ASSERT(si);
+        boolean_t rv;
+        LOCK(sampler.mutex)
+        {
+                rv = used_system_cpu_sysdep(si);
+                if (rv && sampler.count > 0) {
+                        // The read above covers only the time since the last sample, use the average of the cycle samples
+                        si->total_cpu_user_percent = (short)(sampler.user / sampler.count);
+                        si->total_cpu_syst_percent = (short)(sampler.syst / sampler.count);
+                        si->total_cpu_wait_percent = (short)(sampler.wait / sampler.count);
+                }
+                sampler.user = sampler.syst = sampler.wait = 0LL;
+                sampler.count = 0;
+        }
+        END_LOCK;
+        return rv;
+}
+
+
+void Sampler_free(Sampler_T *S) {
+        ASSERT(S);
+        if (*S) {
+                if ((*S)->link)
+                        Link_free(&(*S)->link);
+                FREE(*S);
+        }
+}
+
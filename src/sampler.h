@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+#ifndef MONIT_SAMPLER_H
+#define MONIT_SAMPLER_H
+
+
+/**
+ * High frequency sampler.
+ *
+ * The service metrics are read once per cycle, so with a long poll
+ * interval a short burst of the process or system CPU usage or of the
+ * network traffic is lost in the cycle value. The rules marked with
+ * "sampled every N seconds" are tested against the peak of the samples
+ * read by the sampler thread since the previous cycle instead. The
+ * sampler reads only the metrics used by such rules, so the other tests
+ * keep the cycle poll frequency.
+ *
+ * The sampler thread updates the minimum, maximum and sum of each metric
+ * in lock-free slots, the service check collects and resets the slots at
+ * the beginning of the test. While the system CPU usage is sampled, the
+ * sampler also provides the system CPU usage of the cycle as the average
+ * of the samples, as the platform CPU counters can be read by one reader
+ * only.
+ *
+ *  @file
+ */
+
+
+typedef enum {
+        Sample_Cpu = 0,
+        Sample_CpuUser,
+        Sample_CpuSystem,
+        Sample_CpuWait,
+        Sample_BytesIn,
+        Sample_BytesOut,
+        Sample_PacketsIn,
+        Sample_PacketsOut,
+        Sample_Last          /**< Number of metrics, also used as "not sampled" */
+} Sample_Type;
+
+
+/**
+ * The samples of one metric collected in the last cycle. The values are
+ * in the units of the rules (the CPU usage in percent * 10, the traffic
+ * per second)
+ */
+typedef struct mysample {
+        int count;                                  /**< The number of samples */
+        long long min;                                      /**< Minimum value */
+        long long max;                                      /**< Maximum value */
+        long long average;                                  /**< Average value */
+} Sample_T;
+
+
+/**
+ * Get the sampled metric of the resource rule
+ * @param id The resource
+ * @return The metric or Sample_Last if the resource can't be sampled
+ */
+Sample_Type Sampler_getType(Resource_Type id);
+
+
+/**
+ * Sample the metric of the service. The shortest interval of the service
+ * metrics is used for all metrics of the service
+ * @param s The service
+ * @param type The metric
+ * @param interval The sampling interval in seconds
+ */
+void Sampler_add(Service_T s, Sample_Type type, int interval);
+
+
+/**
+ * Start the sampler thread if any service has a sampled metric
+ * @return true if succeeded, otherwise false
+ */
+boolean_t Sampler_start();
+
+
+/**
+ * Stop the sampler thread
+ */
+void Sampler_stop();
+
+
+/**
+ * Check if the sampler is running
+ * @return true if running, otherwise false
+ */
+boolean_t Sampler_isRunning();
+
+
+/**
+ * Collect the samples of the service since the last call and reset the
+ * slots. Called once per cycle at the beginning of the service check
+ * @param s The service
+ */
+void Sampler_collect(Service_T s);
+
+
+/**
+ * Get the samples of the metric collected by the last Sampler_collect()
+ * @param s The service
+ * @param type The metric
+ * @param sample Output of the samples
+ * @return true if there are samples, otherwise false
+ */
+boolean_t Sampler_get(Service_T s, Sample_Type type, Sample_T *sample);
+
+
+/**
+ * Update the system CPU usage. If the sampler reads the system CPU usage,
+ * the usage of the cycle is the average of the samples, otherwise the
+ * platform counters are read directly
+ * @param si The system info
+ * @return true if succeeded, otherwise false
+ */
+boolean_t Sampler_updateSystemCpu(SystemInfo_T *si);
+
+
+/**
+ * Free the samples of the service
+ * @param S The sampler object reference
+ */
+void Sampler_free(Sampler_T *S);
+
+
+#endif
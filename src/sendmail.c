@@ -67,6 +67,7 @@
 #include "base64.h"
 
 // libmonit
+#include "system/Net.h"
 #include "system/Time.h"
 #include "exceptions/IOException.h"
 
@@ -74,6 +75,12 @@
 /**
  *  Connect to a SMTP server and send mail.
  *
+ *  The SMTP session is kept open after the mail was sent and reused by the
+ *  following sendmail() calls until sendmail_close() is called at the end of
+ *  the cycle, so the alerts of one cycle share one connect, TLS handshake and
+ *  authentication. If the server supports PIPELINING, the MAIL, RCPT and DATA
+ *  commands are sent in one round trip.
+ *
  *  @file
  */
 
@@ -91,10 +98,18 @@ typedef struct {
         const char *username;
         const char *password;
         SslOptions_T ssl;
+        boolean_t pipelining;
+        boolean_t ioerror;
+        int sent;
         char localhost[STRLEN];
 } SendMail_T;
 
 
+/* The SMTP session shared by the sendmail() calls */
+static SendMail_T session;
+static Mutex_T mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -105,26 +120,53 @@ void do_send(SendMail_T *S, const char *s, ...) {
         va_end(ap);
         int rv = Socket_write(S->socket, msg, strlen(msg));
         FREE(msg);
-        if (rv <= 0)
+        if (rv <= 0) {
+                S->ioerror = true;
                 THROW(IOException, "Error sending data to the server '%s' -- %s", S->server, STRERROR);
+        }
 }
 
 
-static void do_status(SendMail_T *S) {
+static int read_status(SendMail_T *S, char *buf, int size) {
         int status = 0;
         StringBuffer_clear(S->status_message);
-        char buf[STRLEN];
         do {
-                if (! Socket_readLine(S->socket, buf, sizeof(buf)))
+                if (! Socket_readLine(S->socket, buf, size)) {
+                        S->ioerror = true;
                         THROW(IOException, "Error receiving data from the mailserver '%s' -- %s", S->server, STRERROR);
+                }
                 StringBuffer_append(S->status_message, "%s", buf);
         } while (buf[3] == '-'); // multi-line response
         Str_chomp(buf);
-        if (sscanf(buf, "%d", &status) != 1 || status < 200 || status >= 400)
+        if (sscanf(buf, "%d", &status) != 1)
+                status = 0;
+        return status;
+}
+
+
+static void do_status(SendMail_T *S) {
+        char buf[STRLEN];
+        int status = read_status(S, buf, sizeof(buf));
+        if (status < 200 || status >= 400)
                 THROW(IOException, "%s", buf);
 }
 
 
+/*
+ * Read the responses to the pipelined commands, all responses are consumed before the first error is reported
+ */
+static void do_pipelined_status(SendMail_T *S, int count) {
+        char buf[STRLEN], error[STRLEN] = "";
+        for (int i = 0; i < count; i++) {
+                int status = read_status(S, buf, sizeof(buf));
+                if ((status < 200 || status >= 400) && ! *error)
+                        snprintf(error, sizeof(error), "%s", buf);
+        }
+        if (*error)
+                THROW(IOException, "%s", error);
+}
+
+
 static void open_server(SendMail_T *S) {
         MailServer_T mta = Run.mailservers;
         if (mta) {
@@ -183,127 +225,194 @@ static void close_server(SendMail_T *S) {
 }
 
 
+static void open_session(SendMail_T *S) {
+        S->pipelining = false;
+        open_server(S);
+        snprintf(S->localhost, sizeof(S->localhost), "%s", Run.mail_hostname ? Run.mail_hostname : Run.system->name);
+        do_status(S);
+        do_send(S, "%s %s\r\n", ((S->ssl.use_ssl && (S->ssl.version == SSL_TLSV1 || S->ssl.version == SSL_TLSV11 || S->ssl.version == SSL_TLSV12)) || S->username) ? "EHLO" : "HELO", S->localhost); // Use EHLO if TLS or Authentication is requested
+        do_status(S);
+        S->pipelining = StringBuffer_indexOf(S->status_message, "PIPELINING") > 0;
+        /* Switch to TLS now if configured */
+        if (S->ssl.use_ssl && (S->ssl.version == SSL_TLSV1 || S->ssl.version == SSL_TLSV11 || S->ssl.version == SSL_TLSV12)) {
+                do_send(S, "STARTTLS\r\n");
+                do_status(S);
+                if (! Socket_enableSsl(S->socket, S->ssl, NULL)) {
+                        S->quit = false;
+                        THROW(IOException, "Cannot switch to SSL");
+                }
+                /* After starttls, send ehlo again: RFC 3207: 4.2 Result of the STARTTLS Command */
+                do_send(S, "EHLO %s\r\n", S->localhost);
+                do_status(S);
+                S->pipelining = StringBuffer_indexOf(S->status_message, "PIPELINING") > 0;
+        }
+        /* Authenticate if possible */
+        if (S->username) {
+                char buffer[STRLEN];
+                // PLAIN takes precedence
+                if (StringBuffer_indexOf(S->status_message, " PLAIN") > 0) {
+                        int len = snprintf(buffer, STRLEN, "%c%s%c%s", '\0', S->username, '\0', S->password ? S->password : "");
+                        char *b64 = encode_base64(len, (unsigned char *)buffer);
+                        TRY
+                        {
+                                do_send(S, "AUTH PLAIN %s\r\n", b64);
+                                do_status(S);
+                        }
+                        FINALLY
+                        {
+                                FREE(b64);
+                        }
+                        END_TRY;
+                } else if (StringBuffer_indexOf(S->status_message, " LOGIN") > 0) {
+                        do_send(S, "AUTH LOGIN\r\n");
+                        do_status(S);
+                        snprintf(buffer, STRLEN, "%s", S->username);
+                        char *b64 = encode_base64(strlen(buffer), (unsigned char *)buffer);
+                        TRY
+                        {
+                                do_send(S, "%s\r\n", b64);
+                                do_status(S);
+                        }
+                        FINALLY
+                        {
+                                FREE(b64);
+                        }
+                        END_TRY;
+                        snprintf(buffer, STRLEN, "%s", S->password ? S->password : "");
+                        b64 = encode_base64(strlen(buffer), (unsigned char *)buffer);
+                        TRY
+                        {
+                                do_send(S, "%s\r\n", b64);
+                                do_status(S);
+                        }
+                        FINALLY
+                        {
+                                FREE(b64);
+                        }
+                        END_TRY;
+                } else {
+                        THROW(IOException, "Authentication failed -- no supported authentication methods found");
+                }
+        }
+}
+
+
+static void send_messages(SendMail_T *S, Mail_T mail) {
+        char now[STRLEN];
+        Time_gmtstring(Time_now(), now);
+        for (Mail_T m = mail; m; m = m->next) {
+                if (S->pipelining) {
+                        do_send(S, "MAIL FROM: <%s>\r\nRCPT TO: <%s>\r\nDATA\r\n", m->from, m->to);
+                        do_pipelined_status(S, 3);
+                } else {
+                        do_send(S, "MAIL FROM: <%s>\r\n", m->from);
+                        do_status(S);
+                        do_send(S, "RCPT TO: <%s>\r\n", m->to);
+                        do_status(S);
+                        do_send(S, "DATA\r\n");
+                        do_status(S);
+                }
+                do_send(S, "From: %s\r\n", m->from);
+                if (m->replyto)
+                        do_send(S, "Reply-To: %s\r\n", m->replyto);
+                do_send(S, "To: %s\r\n", m->to);
+                do_send(S, "Subject: %s\r\n", m->subject);
+                do_send(S, "Date: %s\r\n", now);
+                do_send(S, "X-Mailer: Monit %s\r\n", VERSION);
+                do_send(S, "MIME-Version: 1.0\r\n");
+                do_send(S, "Content-Type: text/plain; charset=\"iso-8859-1\"\r\n");
+                do_send(S, "Content-Transfer-Encoding: 8bit\r\n");
+                do_send(S, "Message-Id: <%lld.%lu@%s>\r\n", (long long)Time_now(), random(), S->localhost);
+                do_send(S, "\r\n");
+                do_send(S, "%s\r\n", m->message);
+                do_send(S, ".\r\n");
+                do_status(S);
+                S->sent++;
+        }
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
 /**
- * Send mail messages via SMTP
+ * Send mail messages via SMTP. The open SMTP session is reused, if the server
+ * closed it meanwhile, a new session is opened
  * @param mail A Mail object
  * @return false if failed, true if succeeded
  */
 boolean_t sendmail(Mail_T mail) {
-        SendMail_T S;
         boolean_t failed = false;
-        char now[STRLEN];
 
         ASSERT(mail);
 
-        memset(&S, 0, sizeof(S));
-        S.status_message = StringBuffer_create(STRLEN);
-
-        TRY
+        LOCK(mutex)
         {
-                open_server(&S);
-                Time_gmtstring(Time_now(), now);
-                snprintf(S.localhost, sizeof(S.localhost), "%s", Run.mail_hostname ? Run.mail_hostname : Run.system->name);
-                do_status(&S);
-                do_send(&S, "%s %s\r\n", ((S.ssl.use_ssl && (S.ssl.version == SSL_TLSV1 || S.ssl.version == SSL_TLSV11 || S.ssl.version == SSL_TLSV12)) || S.username) ? "EHLO" : "HELO", S.localhost); // Use EHLO if TLS or Authentication is requested
-                do_status(&S);
-                /* Switch to TLS now if configured */
-                if (S.ssl.use_ssl && (S.ssl.version == SSL_TLSV1 || S.ssl.version == SSL_TLSV11 || S.ssl.version == SSL_TLSV12)) {
-                        do_send(&S, "STARTTLS\r\n");
-                        do_status(&S);
-                        if (! Socket_enableSsl(S.socket, S.ssl, NULL)) {
-                                S.quit = false;
-                                THROW(IOException, "Cannot switch to SSL");
+                if (! session.status_message)
+                        session.status_message = StringBuffer_create(STRLEN);
+                boolean_t reused = false;
+                if (session.socket) {
+                        if (Net_canRead(Socket_getSocket(session.socket), 0)) {
+                                // The server closed the idle session or sent the timeout notification
+                                session.quit = false;
+                                close_server(&session);
+                        } else {
+                                reused = true;
                         }
-                        /* After starttls, send ehlo again: RFC 3207: 4.2 Result of the STARTTLS Command */
-                        do_send(&S, "EHLO %s\r\n", S.localhost);
-                        do_status(&S);
                 }
-                /* Authenticate if possible */
-                if (S.username) {
-                        char buffer[STRLEN];
-                        // PLAIN takes precedence
-                        if (StringBuffer_indexOf(S.status_message, " PLAIN") > 0) {
-                                int len = snprintf(buffer, STRLEN, "%c%s%c%s", '\0', S.username, '\0', S.password ? S.password : "");
-                                char *b64 = encode_base64(len, (unsigned char *)buffer);
-                                TRY
-                                {
-                                        do_send(&S, "AUTH PLAIN %s\r\n", b64);
-                                        do_status(&S);
-                                }
-                                FINALLY
-                                {
-                                        FREE(b64);
-                                }
-                                END_TRY;
-                        } else if (StringBuffer_indexOf(S.status_message, " LOGIN") > 0) {
-                                do_send(&S, "AUTH LOGIN\r\n");
-                                do_status(&S);
-                                snprintf(buffer, STRLEN, "%s", S.username);
-                                char *b64 = encode_base64(strlen(buffer), (unsigned char *)buffer);
-                                TRY
-                                {
-                                        do_send(&S, "%s\r\n", b64);
-                                        do_status(&S);
-                                }
-                                FINALLY
-                                {
-                                        FREE(b64);
-                                }
-                                END_TRY;
-                                snprintf(buffer, STRLEN, "%s", S.password ? S.password : "");
-                                b64 = encode_base64(strlen(buffer), (unsigned char *)buffer);
-                                TRY
-                                {
-                                        do_send(&S, "%s\r\n", b64);
-                                        do_status(&S);
-                                }
-                                FINALLY
-                                {
-                                        FREE(b64);
-                                }
-                                END_TRY;
+                session.ioerror = false;
+                session.sent = 0;
+                TRY
+                {
+                        if (! session.socket)
+                                open_session(&session);
+                        send_messages(&session, mail);
+                }
+                ELSE
+                {
+                        failed = true;
+                        // The server may drop the idle session without notification, retry once over a new session if no message was sent yet
+                        if (reused && session.ioerror && ! session.sent) {
+                                DEBUG("Sendmail: the reused session failed, retrying with a new session -- %s\n", Exception_frame.message);
+                                session.quit = false;
                         } else {
-                                THROW(IOException, "Authentication failed -- no supported authentication methods found");
+                                reused = false;
+                                LogError("Sendmail: %s\n", Exception_frame.message);
                         }
+                        close_server(&session);
                 }
-                for (Mail_T m = mail; m; m = m->next) {
-                        do_send(&S, "MAIL FROM: <%s>\r\n", m->from);
-                        do_status(&S);
-                        do_send(&S, "RCPT TO: <%s>\r\n", m->to);
-                        do_status(&S);
-                        do_send(&S, "DATA\r\n");
-                        do_status(&S);
-                        do_send(&S, "From: %s\r\n", m->from);
-                        if (m->replyto)
-                                do_send(&S, "Reply-To: %s\r\n", m->replyto);
-                        do_send(&S, "To: %s\r\n", m->to);
-                        do_send(&S, "Subject: %s\r\n", m->subject);
-                        do_send(&S, "Date: %s\r\n", now);
-                        do_send(&S, "X-Mailer: Monit %s\r\n", VERSION);
-                        do_send(&S, "MIME-Version: 1.0\r\n");
-                        do_send(&S, "Content-Type: text/plain; charset=\"iso-8859-1\"\r\n");
-                        do_send(&S, "Content-Transfer-Encoding: 8bit\r\n");
-                        do_send(&S, "Message-Id: <%lld.%lu@%s>\r\n", (long long)Time_now(), random(), S.localhost);
-                        do_send(&S, "\r\n");
-                        do_send(&S, "%s\r\n", m->message);
-                        do_send(&S, ".\r\n");
-                        do_status(&S);
+                END_TRY;
+                if (failed && reused) {
+                        failed = false;
+                        TRY
+                        {
+                                open_session(&session);
+                                send_messages(&session, mail);
+                        }
+                        ELSE
+                        {
+                                failed = true;
+                                LogError("Sendmail: %s\n", Exception_frame.message);
+                                close_server(&session);
+                        }
+                        END_TRY;
                 }
         }
-        ELSE
-        {
-                failed = true;
-                LogError("Sendmail: %s\n", Exception_frame.message);
-        }
-        FINALLY
-        {
-                close_server(&S);
-                StringBuffer_free(&(S.status_message));
-        }
-        END_TRY;
+        END_LOCK;
         return failed;
 }
 
+
+/**
+ * Close the SMTP session kept open by sendmail()
+ */
+void sendmail_close() {
+        LOCK(mutex)
+        {
+                if (session.socket)
+                        close_server(&session);
+                if (session.status_message)
+                        StringBuffer_free(&(session.status_message));
+        }
+        END_LOCK;
+}
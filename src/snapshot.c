@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "monit.h"
+#include "event.h"
+#include "snapshot.h"
+
+// libmonit
+#include "system/Time.h"
+
+/**
+ *  Shared status snapshot - the service states published by the daemon in
+ *  a memory mapped file and the status report formatted from it by the
+ *  CLI (see snapshot.h for the format).
+ *
+ *  The daemon is the only writer, the snapshot is updated by the main
+ *  thread once the services were checked. The readers never block the
+ *  daemon, they retry if they copied the file while it was written.
+ *
+ *  @file
+ */
+
+
+/* ------------------------------------------------------------- Definitions */
+
+
+/* The number of attempts to get a consistent copy */
+#define SNAPSHOT_RETRIES 100
+
+
+/* The status file header */
+typedef struct {
+        char magic[8];                                        /**< SNAPSHOT_MAGIC */
+        uint32_t version;                                   /**< SNAPSHOT_VERSION */
+        volatile uint32_t sequence;              /**< Odd while the slots are written */
+        uint32_t services;                                    /**< Number of slots */
+        uint32_t slotsize;                               /**< Size of one slot in bytes */
+        int64_t pid;                                              /**< The daemon pid */
+        int64_t started;                                   /**< The daemon start time */
+        int64_t updated;                                     /**< The snapshot time */
+        char reserved[16];                                   /**< Zero, pads to 64 bytes */
+} Header_T;
+
+
+/* The state and key metrics of one service */
+typedef struct {
+        char name[STRLEN];                                    /**< The service name */
+        int32_t type;                                         /**< The service type */
+        int32_t monitor;                                /**< The monitoring state */
+        int32_t error;                                   /**< Failed events bitmap */
+        int32_t error_hint;                             /**< Changed events bitmap */
+        int32_t doaction;                                   /**< The pending action */
+        int32_t collected;                /**< 1 if the data below were collected */
+        int32_t pid;                                               /**< Process pid */
+        int32_t ppid;                                       /**< Process parent pid */
+        int32_t children;                                     /**< Process children */
+        int32_t cpu_percent;                         /**< Process cpu, 1/10 percent */
+        int32_t total_cpu_percent;         /**< Cpu incl. children, 1/10 percent */
+        int32_t mem_percent;                      /**< Process memory, 1/10 percent */
+        int32_t total_mem_percent;      /**< Memory incl. children, 1/10 percent */
+        int32_t reserved;                                       /**< Zero, padding */
+        int64_t mem_kbyte;                                /**< Process memory in kB */
+        int64_t total_mem_kbyte;                  /**< Memory incl. children in kB */
+        int64_t uptime;                            /**< Process uptime in seconds */
+        int64_t size;                                     /**< File size in bytes */
+        int64_t space_total;                         /**< Filesystem size in bytes */
+        int64_t space_free;        /**< Filesystem space free for non superuser */
+        int64_t time;                                  /**< Data collection time */
+} Slot_T;
+
+
+/* The memory mapped status file of the daemon */
+static struct {
+        char *file;                                          /**< The mapped file */
+        int services;                                         /**< Number of slots */
+        void *data;                                                 /**< Mapped file */
+        size_t size;                                       /**< Mapped file size */
+        time_t started;                                    /**< The daemon start time */
+} map = {.data = MAP_FAILED};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static Slot_T *_slot(void *data, int i) {
+        return (Slot_T *)((char *)data + sizeof(Header_T) + i * sizeof(Slot_T));
+}
+
+
+static void _unmap() {
+        if (map.data != MAP_FAILED) {
+                munmap(map.data, map.size);
+                map.data = MAP_FAILED;
+                map.size = 0;
+        }
+        FREE(map.file);
+        map.services = 0;
+}
+
+
+/**
+ * Create the status file for the given number of services. The file is
+ * prepared under a temporary name and renamed, so a reader always sees a
+ * complete file, a reader of the replaced file keeps its copy valid
+ */
+static boolean_t _map(const char *file, int services) {
+        map.file = Str_dup(file);
+        map.services = services;
+        map.size = sizeof(Header_T) + services * sizeof(Slot_T);
+        char *tmp = Str_cat("%s.tmp", file);
+        boolean_t rv = false;
+        int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1) {
+                LogError("Status file '%s': cannot open -- %s\n", tmp, STRERROR);
+        } else {
+                if (ftruncate(fd, map.size) == -1) {
+                        LogError("Status file '%s': unable to resize -- %s\n", tmp, STRERROR);
+                } else if ((map.data = mmap(NULL, map.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+                        LogError("Status file '%s': unable to map -- %s\n", tmp, STRERROR);
+                } else {
+                        Header_T *header = map.data;
+                        memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+                        header->version = SNAPSHOT_VERSION;
+                        header->services = services;
+                        header->slotsize = sizeof(Slot_T);
+                        header->pid = getpid();
+                        header->started = map.started;
+                        if (rename(tmp, file) == -1)
+                                LogError("Status file '%s': cannot rename -- %s\n", file, STRERROR);
+                        else
+                                rv = true;
+                }
+                close(fd); // The mapping stays valid
+                if (! rv)
+                        unlink(tmp);
+        }
+        FREE(tmp);
+        return rv;
+}
+
+
+static void _fill(Slot_T *slot, Service_T s) {
+        memset(slot, 0, sizeof(Slot_T));
+        snprintf(slot->name, sizeof(slot->name), "%s", s->name);
+        slot->type = s->type;
+        slot->monitor = s->monitor;
+        slot->error = s->error;
+        slot->error_hint = s->error_hint;
+        slot->doaction = s->doaction;
+        slot->time = s->collected.tv_sec;
+        if ((slot->collected = Util_hasServiceStatus(s))) {
+                switch (s->type) {
+                        case Service_Process:
+                                slot->pid = s->inf->priv.process.pid;
+                                slot->ppid = s->inf->priv.process.ppid;
+                                slot->children = s->inf->priv.process.children;
+                                slot->cpu_percent = s->inf->priv.process.cpu_percent;
+                                slot->total_cpu_percent = s->inf->priv.process.total_cpu_percent;
+                                slot->mem_percent = s->inf->priv.process.mem_percent;
+                                slot->total_mem_percent = s->inf->priv.process.total_mem_percent;
+                                slot->mem_kbyte = s->inf->priv.process.mem_kbyte;
+                                slot->total_mem_kbyte = s->inf->priv.process.total_mem_kbyte;
+                                slot->uptime = s->inf->priv.process.uptime;
+                                break;
+                        case Service_File:
+                                slot->size = s->inf->priv.file.size;
+                                break;
+                        case Service_Filesystem:
+                                if (s->inf->priv.filesystem.f_bsize > 0) {
+                                        slot->space_total = s->inf->priv.filesystem.f_blocks * s->inf->priv.filesystem.f_bsize;
+                                        slot->space_free = s->inf->priv.filesystem.f_blocksfree * s->inf->priv.filesystem.f_bsize;
+                                }
+                                break;
+                        default:
+                                break;
+                }
+        }
+}
+
+
+/**
+ * The service status description, see get_service_status() in the HTTP interface
+ */
+static char *_status(Slot_T *slot, char *buf, int buflen) {
+        if (slot->monitor == Monitor_Not)
+                snprintf(buf, buflen, "Not monitored");
+        else if (slot->monitor & Monitor_Waiting)
+                snprintf(buf, buflen, "Waiting");
+        else if (slot->monitor & Monitor_Suppressed)
+                snprintf(buf, buflen, "Suppressed");
+        else if (slot->monitor & Monitor_Init)
+                snprintf(buf, buflen, "Initializing");
+        else if (slot->error == 0)
+                snprintf(buf, buflen, "%s", statusnames[slot->type]);
+        else
+                for (EventTable_T *et = Event_Table; (*et).id; et++)
+                        if (slot->error & (*et).id) {
+                                snprintf(buf, buflen, "%s", (slot->error_hint & (*et).id) ? (*et).description_changed : (*et).description_failed);
+                                break;
+                        }
+        if (slot->doaction)
+                snprintf(buf + strlen(buf), buflen - strlen(buf), " - %s pending", actionnames[slot->doaction]);
+        return buf;
+}
+
+
+static void _print(Slot_T *slot, Level_Type level) {
+        char buf[STRLEN];
+        *buf = 0;
+        if (level == Level_Summary) {
+                char prefix[STRLEN];
+                snprintf(prefix, STRLEN, "%s '%s'", servicetypes[slot->type], slot->name);
+                printf("%-35s %s\n", prefix, _status(slot, buf, sizeof(buf)));
+                return;
+        }
+        printf("%s '%s'\n  %-33s %s\n", servicetypes[slot->type], slot->name, "status", _status(slot, buf, sizeof(buf)));
+        printf("  %-33s %s\n", "monitoring status", slot->monitor == Monitor_Not ? "Not monitored" : slot->monitor & Monitor_Waiting ? "Waiting" : slot->monitor & Monitor_Suppressed ? "Suppressed" : slot->monitor & Monitor_Init ? "Initializing" : "Monitored");
+        if (slot->collected) {
+                switch (slot->type) {
+                        case Service_Process:
+                        {
+                                char *uptime = Util_getUptime(slot->uptime, " ");
+                                printf("  %-33s %d\n"
+                                       "  %-33s %d\n"
+                                       "  %-33s %s\n"
+                                       "  %-33s %d\n",
+                                       "pid", slot->pid > 0 ? slot->pid : 0,
+                                       "parent pid", slot->ppid > 0 ? slot->ppid : 0,
+                                       "uptime", uptime,
+                                       "children", slot->children);
+                                FREE(uptime);
+                                printf("  %-33s %s\n", "memory", Str_bytesToSize(slot->mem_kbyte * 1024., buf));
+                                printf("  %-33s %s\n", "memory total", Str_bytesToSize(slot->total_mem_kbyte * 1024., buf));
+                                printf("  %-33s %.1f%%\n"
+                                       "  %-33s %.1f%%\n"
+                                       "  %-33s %.1f%%\n"
+                                       "  %-33s %.1f%%\n",
+                                       "memory percent", slot->mem_percent / 10.0,
+                                       "memory percent total", slot->total_mem_percent / 10.0,
+                                       "cpu percent", slot->cpu_percent / 10.0,
+                                       "cpu percent total", slot->total_cpu_percent / 10.0);
+                                break;
+                        }
+                        case Service_File:
+                                printf("  %-33s %s\n", "size", Str_bytesToSize(slot->size, buf));
+                                break;
+                        case Service_Filesystem:
+                                printf("  %-33s %s\n", "space total", Str_bytesToSize(slot->space_total, buf));
+                                printf("  %-33s %s [%.1f%%]\n", "space free for non superuser", Str_bytesToSize(slot->space_free, buf), slot->space_total > 0 ? 100. * slot->space_free / slot->space_total : 0.);
+                                break;
+                        default:
+                                break;
+                }
+        }
+        printf("  %-33s %s\n\n", "data collected", Time_string(slot->time, buf));
+}
+
+
+/**
+ * Copy the status file consistently
+ * @return The copy or NULL if the file is being replaced or updated too often
+ */
+static void *_copy(void *data, size_t size) {
+        Header_T *header = data;
+        void *copy = ALLOC(size);
+        for (int i = 0; i < SNAPSHOT_RETRIES; i++) {
+                uint32_t sequence = header->sequence;
+                __sync_synchronize();
+                if (! (sequence & 1)) {
+                        memcpy(copy, data, size);
+                        __sync_synchronize();
+                        if (header->sequence == sequence)
+                                return copy;
+                }
+                usleep(1000);
+        }
+        FREE(copy);
+        return NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void Snapshot_open() {
+        if (! map.started)
+                map.started = Time_now();
+        int services = 0;
+        for (Service_T s = servicelist_conf; s; s = s->next_conf)
+                services++;
+        if (! Run.statusfile || ! IS(map.file, Run.statusfile) || map.services != services) {
+                if (map.file && ! IS(map.file, Run.statusfile))
+                        Snapshot_close();
+                else
+                        _unmap();
+                if (Run.statusfile && ! _map(Run.statusfile, services))
+                        _unmap();
+        }
+        Snapshot_update();
+}
+
+
+void Snapshot_close() {
+        if (map.file)
+                unlink(map.file); // The CLI falls back to the HTTP interface
+        _unmap();
+}
+
+
+void Snapshot_update() {
+        if (map.data != MAP_FAILED) {
+                Header_T *header = map.data;
+                header->sequence++;
+                __sync_synchronize();
+                int i = 0;
+                for (Service_T s = servicelist_conf; s && i < map.services; s = s->next_conf)
+                        _fill(_slot(map.data, i++), s);
+                header->updated = Time_now();
+                __sync_synchronize();
+                header->sequence++;
+        }
+}
+
+
+boolean_t Snapshot_print(Level_Type level) {
+        if (! Run.statusfile)
+                return false;
+        boolean_t rv = false;
+        int fd = open(Run.statusfile, O_RDONLY);
+        if (fd == -1) {
+                DEBUG("Status file '%s': cannot open -- %s\n", Run.statusfile, STRERROR);
+                return false;
+        }
+        struct stat st;
+        void *data = MAP_FAILED;
+        if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Header_T) || (data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+                DEBUG("Status file '%s': cannot map -- %s\n", Run.statusfile, STRERROR);
+        } else {
+                Header_T *header = _copy(data, st.st_size);
+                if (! header) {
+                        DEBUG("Status file '%s': busy\n", Run.statusfile);
+                } else if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) || header->version != SNAPSHOT_VERSION || header->slotsize != sizeof(Slot_T) || sizeof(Header_T) + (size_t)header->services * sizeof(Slot_T) != (size_t)st.st_size) {
+                        DEBUG("Status file '%s': incompatible format\n", Run.statusfile);
+                } else if (header->pid != exist_daemon()) {
+                        DEBUG("Status file '%s': not written by the running daemon\n", Run.statusfile);
+                } else {
+                        char *uptime = Util_getUptime(Time_now() - header->started, " ");
+                        printf("The Monit daemon %s uptime: %s\n\n", VERSION, uptime);
+                        FREE(uptime);
+                        for (uint32_t i = 0; i < header->services; i++)
+                                _print(_slot(header, i), level);
+                        rv = true;
+                }
+                FREE(header);
+                munmap(data, st.st_size);
+        }
+        close(fd);
+        return rv;
+}
+
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+
+
+#ifndef MONIT_SNAPSHOT_H
+#define MONIT_SNAPSHOT_H
+
+
+/**
+ * Shared status snapshot.
+ *
+ * If the "set statusfile" statement is used, the Monit daemon publishes
+ * the state and the key metrics of all services in a memory mapped file
+ * at the end of each check cycle. The "monit status" and "monit summary"
+ * commands read the file and format the report locally instead of
+ * requesting it from the daemon's HTTP interface. If the file is not
+ * available or it was written by another process than the running
+ * daemon, the commands fall back to the HTTP interface.
+ *
+ * The file is protected by a sequence lock: the daemon increments the
+ * sequence before and after the update, so the sequence is odd while
+ * the slots are written. A reader copies the file and accepts the copy
+ * if the sequence was even and did not change meanwhile, otherwise it
+ * tries again. The file has a fixed size for the number of services, if
+ * it changes on reload, the daemon replaces the file. The file uses the
+ * host byte order and is made of a 64 byte header followed by one slot
+ * per service, in the order of the control file:
+ *
+ *    header: char magic[8]         "MONITSTA"
+ *            uint32_t version      1
+ *            uint32_t sequence     the sequence lock
+ *            uint32_t services     number of slots
+ *            uint32_t slotsize     size of one slot in bytes
+ *            int64_t pid           the daemon pid
+ *            int64_t started       the daemon start time (Unix time)
+ *            int64_t updated       the snapshot time (Unix time)
+ *            char reserved[16]     zero
+ *
+ *    slot:   char name[256]        service name, NUL terminated
+ *            int32_t type          service type (Service_Type)
+ *            int32_t monitor       monitoring state (Monitor_State)
+ *            int32_t error         failed events bitmap
+ *            int32_t error_hint    changed events bitmap
+ *            int32_t doaction      pending action (Action_Type)
+ *            int32_t collected     1 if the data below were collected
+ *            int32_t pid           process pid
+ *            int32_t ppid          process parent pid
+ *            int32_t children      process children
+ *            int32_t cpu_percent          process cpu, 1/10 percent
+ *            int32_t total_cpu_percent    cpu incl. children, 1/10 percent
+ *            int32_t mem_percent          process memory, 1/10 percent
+ *            int32_t total_mem_percent    memory incl. children, 1/10 percent
+ *            int32_t reserved      zero
+ *            int64_t mem_kbyte            process memory in kB
+ *            int64_t total_mem_kbyte      memory incl. children in kB
+ *            int64_t uptime        process uptime in seconds
+ *            int64_t size          file size in bytes
+ *            int64_t space_total   filesystem size in bytes
+ *            int64_t space_free    filesystem space free for non superuser
+ *            int64_t time          data collection time (Unix time)
+ *
+ *  @file
+ */
+
+
+/**
+ * The status file magic and format version
+ */
+#define SNAPSHOT_MAGIC "MONITSTA"
+#define SNAPSHOT_VERSION 1
+
+
+/**
+ * Open the status file set by the "set statusfile" statement, or close it
+ * if the statement was removed. The file is replaced if the number of
+ * services changed. Used by the daemon
+ */
+void Snapshot_open();
+
+
+/**
+ * Close and remove the status file. Used by the daemon
+ */
+void Snapshot_close();
+
+
+/**
+ * Publish the current state of the services in the status file. Used by
+ * the daemon at the end of the check cycle
+ */
+void Snapshot_update();
+
+
+/**
+ * Print the status report of the running daemon from the status file
+ * @param level The report level (Level_Full or Level_Summary)
+ * @return true if the report was printed, false if the status file is
+ * not available and the report has to be requested over HTTP
+ */
+boolean_t Snapshot_print(Level_Type level);
+
+
+#endif
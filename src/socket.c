@@ -44,6 +44,14 @@
 #include <sys/socket.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
@@ -76,6 +84,10 @@
 #include "monit.h"
 #include "socket.h"
 #include "SslServer.h"
+#include "resolver.h"
+#include "protocol.h"
+#include "latency.h"
+#include "probe.h"
 
 // libmonit
 #include "exceptions/assert.h"
@@ -102,8 +114,16 @@ typedef enum {
 } __attribute__((__packed__)) Connection_Type;
 
 
-// One TCP frame data size
-#define RBUFFER_SIZE 1460
+// The SSL write coalescing limit (one TLS record)
+#define SSL_RECORD_SIZE 16384
+
+
+// The delay between the connection attempts to the addresses of one destination [ms], see RFC 8305
+#define CONNECTION_ATTEMPT_DELAY 250
+
+
+// Maximum number of destinations whose winning address family is remembered, the least recently used one is dropped when reached
+#define FAMILY_CACHE_SIZE 256
 
 
 #define T Socket_T
@@ -116,43 +136,79 @@ struct T {
         int timeout; // milliseconds
         int length;
         int offset;
+        int capacity; // The buffer size, the buffer is allocated by the first read and grows up to SOCKET_BUFFER_MAX
+        boolean_t reusable; // true if the connection can be reused for the next protocol test, see Socket_testReusing()
+        boolean_t reset; // true if the connection is closed with RST, see Port_T.reset
+        int tests; // The number of the protocol tests done over the connection before the current test
         char *host;
         Port_T Port;
 #ifdef HAVE_OPENSSL
         Ssl_T ssl;
         SslServer_T sslserver;
 #endif
-        unsigned char buffer[RBUFFER_SIZE + 1];
+        unsigned char *buffer;
 };
 
 
+/**
+ * The address family which won the last connection race to the destination
+ */
+typedef struct myfamily {
+        char *key;                                                /**< host:port */
+        int family;                                  /**< AF_INET or AF_INET6 */
+        struct myfamily *next;                                  /**< Next family */
+} *Family_T;
+
+
+static struct {
+        Mutex_T mutex;
+        int count;
+        Family_T list;                                     /**< Most recently used first */
+} families = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
 /* --------------------------------------------------------------- Private */
 
 
 /*
- * Fill the internal buffer. If an error occurs or if the read
- * operation timed out -1 is returned.
+ * Fill the internal buffer. The unread data are moved to the beginning of
+ * the buffer and the buffer grows if it is full. One read reads as much
+ * data as fits in the buffer. The buffered data are always followed by a
+ * NUL byte. If an error occurs or if the read operation timed out -1 is
+ * returned.
  * @param S A Socket object
  * @param timeout The number of milliseconds to wait for data to be read
  * @return the length of data read or -1 if an error occured
  */
 static int _fill(T S, int timeout) {
-        S->offset = 0;
-        S->length = 0;
-        if (S->type == Socket_Udp)
-                timeout = 500;
+        if (! S->buffer) {
+                S->capacity = Run.socketbuffer > 0 ? Run.socketbuffer : SOCKET_BUFFER;
+                S->buffer = ALLOC(S->capacity + 1);
+        }
+        if (S->offset > 0) {
+                S->length -= S->offset;
+                memmove(S->buffer, S->buffer + S->offset, S->length);
+                S->offset = 0;
+        }
+        if (S->length == S->capacity) {
+                if (S->capacity >= SOCKET_BUFFER_MAX)
+                        return 0;
+                S->capacity = S->capacity * 2 > SOCKET_BUFFER_MAX ? SOCKET_BUFFER_MAX : S->capacity * 2;
+                RESIZE(S->buffer, S->capacity + 1);
+        }
         int n;
 #ifdef HAVE_OPENSSL
         if (S->ssl)
-                n = Ssl_read(S->ssl, S->buffer + S->length, RBUFFER_SIZE - S->length, timeout);
+                n = Ssl_read(S->ssl, S->buffer + S->length, S->capacity - S->length, timeout);
         else
 #endif
-                n = (int)Net_read(S->socket, S->buffer + S->length,  RBUFFER_SIZE - S->length, timeout);
+                n = (int)Net_read(S->socket, S->buffer + S->length,  S->capacity - S->length, timeout);
         if (n > 0)
                 S->length += n;
-        else if (n < 0)
+        S->buffer[S->length] = 0;
+        if (n < 0)
                 return -1;
-        else if (! (errno == EAGAIN || errno == EWOULDBLOCK)) // Peer closed connection
+        else if (n == 0 && ! (errno == EAGAIN || errno == EWOULDBLOCK)) // Peer closed connection
                 return -1;
         return n;
 }
@@ -225,41 +281,241 @@ static boolean_t _doConnect(int s, const struct sockaddr *addr, socklen_t addrle
 }
 
 
-T _createIpSocket(const char *host, const struct sockaddr *addr, socklen_t addrlen, int family, int type, int protocol, SslOptions_T ssl, int timeout) {
-        ASSERT(host);
-        char error[STRLEN];
-        int s = socket(family, type, protocol);
-        if (s >= 0) {
-                if (Net_setNonBlocking(s)) {
-                        if (fcntl(s, F_SETFD, FD_CLOEXEC) != -1) {
-                                if (_doConnect(s, addr, addrlen, timeout, error, sizeof(error))) {
-                                        T S;
-                                        NEW(S);
-                                        S->socket = s;
-                                        S->type = type;
-                                        S->family = family == AF_INET ? Socket_Ip4 : Socket_Ip6;
-                                        S->timeout = timeout;
-                                        S->host = Str_dup(host);
-                                        S->port = _getPort(addr, addrlen);
-                                        S->connection_type = Connection_Client;
-                                        if (ssl.use_ssl && ! Socket_enableSsl(S, ssl, host)) {
-                                                Socket_free(&S);
-                                                THROW(IOException, "Could not switch socket to SSL");
-                                        }
-                                        return S;
+static int _getFamily(const char *key) {
+        int family = AF_UNSPEC;
+        LOCK(families.mutex)
+        {
+                for (Family_T f = families.list; f; f = f->next) {
+                        if (Str_isEqual(f->key, key)) {
+                                family = f->family;
+                                break;
+                        }
+                }
+        }
+        END_LOCK;
+        return family;
+}
+
+
+static void _setFamily(const char *key, int family) {
+        LOCK(families.mutex)
+        {
+                Family_T f = NULL;
+                for (Family_T *c = &families.list; *c; c = &(*c)->next) {
+                        if (Str_isEqual((*c)->key, key)) {
+                                f = *c;
+                                *c = f->next;
+                                families.count--;
+                                break;
+                        }
+                }
+                if (! f) {
+                        NEW(f);
+                        f->key = Str_dup(key);
+                }
+                f->family = family;
+                f->next = families.list;
+                families.list = f;
+                if (++families.count > FAMILY_CACHE_SIZE) {
+                        Family_T *last = &families.list;
+                        while ((*last)->next)
+                                last = &(*last)->next;
+                        FREE((*last)->key);
+                        FREE(*last);
+                        families.count--;
+                }
+        }
+        END_LOCK;
+}
+
+
+/*
+ * Return the addresses in the connection attempt order of RFC 8305: the
+ * address families alternate, starting with the family which won the last
+ * connection race to the destination or with the family of the first
+ * address if the destination is unknown. The caller frees the array
+ */
+static struct addrinfo **_sortAddresses(const char *key, struct addrinfo *result, int *count) {
+        int n = 0;
+        for (struct addrinfo *r = result; r; r = r->ai_next)
+                n++;
+        int preferred = _getFamily(key);
+        if (preferred == AF_UNSPEC)
+                preferred = result->ai_family;
+        struct addrinfo **addresses = CALLOC(n, sizeof(struct addrinfo *));
+        struct addrinfo *first = result, *second = result;
+        for (int i = 0; i < n;) {
+                while (first && first->ai_family != preferred)
+                        first = first->ai_next;
+                if (first) {
+                        addresses[i++] = first;
+                        first = first->ai_next;
+                }
+                while (second && second->ai_family == preferred)
+                        second = second->ai_next;
+                if (second) {
+                        addresses[i++] = second;
+                        second = second->ai_next;
+                }
+        }
+        *count = n;
+        return addresses;
+}
+
+
+static boolean_t _hasAddress(struct addrinfo **addresses, int count) {
+        for (int i = 0; i < count; i++)
+                if (addresses[i])
+                        return true;
+        return false;
+}
+
+
+/*
+ * Start the non-blocking connect to the address
+ * @return The socket or -1 if failed. The connected flag is set if the connection was established immediately
+ */
+static int _startConnect(struct addrinfo *a, boolean_t *connected, char *error, int errorlen) {
+        *connected = false;
+        int s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (s < 0) {
+                snprintf(error, errorlen, "Cannot create socket to %s -- %s", _addressToString(a->ai_addr, a->ai_addrlen, (char[STRLEN]){}, STRLEN), STRERROR);
+                return -1;
+        }
+        if (! Net_setNonBlocking(s)) {
+                snprintf(error, errorlen, "Cannot set nonblocking socket -- %s", STRERROR);
+        } else if (fcntl(s, F_SETFD, FD_CLOEXEC) == -1) {
+                snprintf(error, errorlen, "Cannot set socket close on exec -- %s", STRERROR);
+        } else if (! connect(s, a->ai_addr, a->ai_addrlen)) {
+                *connected = true;
+                return s;
+        } else if (errno == EINPROGRESS) {
+                return s;
+        } else {
+                snprintf(error, errorlen, "%s", STRERROR);
+        }
+        Net_close(s);
+        return -1;
+}
+
+
+/*
+ * Race the connection attempts to the addresses (RFC 8305 happy eyeballs).
+ * The next attempt starts CONNECTION_ATTEMPT_DELAY milliseconds after the
+ * previous one or as soon as the previous one failed, so a broken path of
+ * one address family doesn't delay the connection over the other family
+ * by the whole timeout. The first established connection wins and the
+ * other attempts are closed. The winning address and the addresses which
+ * failed or timed out are removed from the array (set to NULL), the caller
+ * can race the remaining addresses if the winning connection is not usable
+ * @return The connected socket or -1 if no connection was established
+ */
+static int _race(struct addrinfo **addresses, int count, int timeout, struct addrinfo **winner, char *error, int errorlen) {
+        int s = -1, pending = 0;
+        int *index = CALLOC(count, sizeof(int)); // The address index of the pending attempt
+        struct pollfd *fds = CALLOC(count, sizeof(struct pollfd));
+        long long now = Time_milli(), deadline = now + timeout, attempt = now;
+        for (int next = 0; s < 0;) {
+                while (next < count && ! addresses[next])
+                        next++;
+                if (next < count && (now >= attempt || ! pending)) {
+                        boolean_t connected;
+                        int fd = _startConnect(addresses[next], &connected, error, errorlen);
+                        if (connected) {
+                                s = fd;
+                                *winner = addresses[next];
+                        } else if (fd >= 0) {
+                                fds[pending] = (struct pollfd){.fd = fd, .events = POLLOUT};
+                                index[pending++] = next++;
+                                attempt = now + CONNECTION_ATTEMPT_DELAY;
+                                continue;
+                        }
+                        addresses[next++] = NULL;
+                        continue;
+                }
+                if (! pending)
+                        break;
+                if (now >= deadline) {
+                        snprintf(error, errorlen, "Connection timed out");
+                        break;
+                }
+                int rv = poll(fds, pending, (int)((next < count && attempt < deadline ? attempt : deadline) - now));
+                if (rv < 0 && errno != EINTR) {
+                        snprintf(error, errorlen, "Poll failed: %s", STRERROR);
+                        break;
+                }
+                for (int i = 0; rv > 0 && i < pending;) {
+                        if (fds[i].revents) {
+                                int status = 0;
+                                socklen_t statuslen = sizeof(status);
+                                if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &status, &statuslen) < 0) {
+                                        snprintf(error, errorlen, "Read of error details failed: %s", STRERROR);
+                                } else if (status) {
+                                        snprintf(error, errorlen, "%s", strerror(status));
+                                } else {
+                                        s = fds[i].fd;
+                                        *winner = addresses[index[i]];
+                                        break;
                                 }
+                                // The failed attempt starts the next one immediately
+                                Net_close(fds[i].fd);
+                                addresses[index[i]] = NULL;
+                                fds[i] = fds[--pending];
+                                index[i] = index[pending];
+                                attempt = 0;
                         } else {
-                                snprintf(error, sizeof(error), "Cannot set socket close on exec -- %s", STRERROR);
+                                i++;
                         }
-                } else {
-                        snprintf(error, sizeof(error), "Cannot set nonblocking socket -- %s", STRERROR);
                 }
-                Net_close(s);
-        } else {
-                snprintf(error, sizeof(error), "Cannot create socket to %s -- %s", _addressToString(addr, addrlen, (char[STRLEN]){}, STRLEN), STRERROR);
+                now = Time_milli();
         }
-        THROW(IOException, "%s", error);
-        return NULL;
+        for (int i = 0; i < pending; i++) {
+                if (fds[i].fd != s)
+                        Net_close(fds[i].fd);
+                addresses[index[i]] = NULL;
+        }
+        FREE(fds);
+        FREE(index);
+        return s;
+}
+
+
+/*
+ * Connect to the remaining addresses of the destination (see _race()) and
+ * create the socket object, with SSL if required. If the addresses have
+ * both families, the winning family is remembered for the next connection
+ * @exception IOException if failed
+ */
+static T _createIpSocket(const char *host, const char *key, struct addrinfo **addresses, int count, SslOptions_T ssl, int timeout) {
+        ASSERT(host);
+        char error[STRLEN] = "No address to connect to";
+        boolean_t inet = false, inet6 = false;
+        for (int i = 0; i < count; i++) {
+                if (addresses[i]) {
+                        inet |= addresses[i]->ai_family == AF_INET;
+                        inet6 |= addresses[i]->ai_family == AF_INET6;
+                }
+        }
+        struct addrinfo *a = NULL;
+        int s = _race(addresses, count, timeout, &a, error, sizeof(error));
+        if (s < 0)
+                THROW(IOException, "%s", error);
+        if (inet && inet6)
+                _setFamily(key, a->ai_family);
+        T S;
+        NEW(S);
+        S->socket = s;
+        S->type = a->ai_socktype;
+        S->family = a->ai_family == AF_INET ? Socket_Ip4 : Socket_Ip6;
+        S->timeout = timeout;
+        S->host = Str_dup(host);
+        S->port = _getPort(a->ai_addr, a->ai_addrlen);
+        S->connection_type = Connection_Client;
+        if (ssl.use_ssl && ! Socket_enableSsl(S, ssl, host)) {
+                Socket_free(&S);
+                THROW(IOException, "Could not switch socket to SSL");
+        }
+        return S;
 }
 
 
@@ -290,7 +546,7 @@ struct addrinfo *_resolve(const char *hostname, int port, Socket_Type type, Sock
         }
         char _port[6];
         snprintf(_port, sizeof(_port), "%d", port);
-        int status = getaddrinfo(hostname, _port, &hints, &result);
+        int status = Resolver_get(hostname, _port, &hints, &result);
         if (status != 0) {
                 LogError("Cannot translate '%s' to IP address -- %s\n", hostname, status == EAI_SYSTEM ? STRERROR : gai_strerror(status));
                 return NULL;
@@ -346,11 +602,15 @@ T Socket_create(const char *host, int port, Socket_Type type, Socket_Family fami
         struct addrinfo *result = _resolve(host, port, type, family);
         char error[STRLEN];
         if (result) {
+                char key[STRLEN];
+                snprintf(key, sizeof(key), "%s:%d", host, port);
+                int count;
+                struct addrinfo **addresses = _sortAddresses(key, result, &count);
                 // The host may resolve to multiple IPs and if at least one succeeded, we have no problem and don't have to flood the log with partial errors => log only the last error
-                for (struct addrinfo *r = result; r && S == NULL; r = r->ai_next) {
+                while (! S && _hasAddress(addresses, count)) {
                         TRY
                         {
-                                S = _createIpSocket(host, r->ai_addr, r->ai_addrlen, r->ai_family, r->ai_socktype, r->ai_protocol, ssl, timeout);
+                                S = _createIpSocket(host, key, addresses, count, ssl, timeout);
                         }
                         ELSE
                         {
@@ -358,7 +618,8 @@ T Socket_create(const char *host, int port, Socket_Type type, Socket_Family fami
                         }
                         END_TRY;
                 }
-                freeaddrinfo(result);
+                FREE(addresses);
+                Resolver_free(result);
         }
         if (! S)
                 LogError("Cannot create socket to [%s]:%d -- %s\n", host, port, error);
@@ -418,9 +679,17 @@ void Socket_free(T *S) {
         else
 #endif
         {
-                Net_shutdown((*S)->socket, SHUT_RDWR);
+                if ((*S)->reset) {
+                        // Abort the connection: the RST skips the FIN handshake and the TIME_WAIT state on both sides
+                        struct linger linger = {.l_onoff = 1, .l_linger = 0};
+                        if (setsockopt((*S)->socket, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger)) < 0)
+                                DEBUG("Cannot set the socket linger -- %s\n", STRERROR);
+                } else {
+                        Net_shutdown((*S)->socket, SHUT_RDWR);
+                }
                 Net_close((*S)->socket);
         }
+        FREE((*S)->buffer);
         FREE((*S)->host);
         FREE(*S);
 }
@@ -451,6 +720,18 @@ boolean_t Socket_isSecure(T S) {
 }
 
 
+boolean_t Socket_hasData(T S) {
+        ASSERT(S);
+        if (S->offset < S->length)
+                return true;
+#ifdef HAVE_OPENSSL
+        if (S->ssl)
+                return Ssl_pending(S->ssl) > 0;
+#endif
+        return false;
+}
+
+
 int Socket_getSocket(T S) {
         ASSERT(S);
         return S->socket;
@@ -463,6 +744,30 @@ Socket_Type Socket_getType(T S) {
 }
 
 
+void Socket_setReusable(T S, boolean_t reusable) {
+        ASSERT(S);
+        S->reusable = reusable;
+}
+
+
+boolean_t Socket_isReusable(T S) {
+        ASSERT(S);
+        return S->reusable;
+}
+
+
+boolean_t Socket_isReused(T S) {
+        ASSERT(S);
+        return S->tests > 0;
+}
+
+
+int Socket_getTests(T S) {
+        ASSERT(S);
+        return S->tests;
+}
+
+
 void *Socket_getPort(T S) {
         ASSERT(S);
         return S->Port;
@@ -509,20 +814,58 @@ const char *Socket_getLocalHost(T S, char *host, int hostlen) {
 }
 
 
-static void _testUnix(Port_T p) {
-        long long start = Time_milli();
-        T S = _createUnixSocket(p->pathname, p->type, p->timeout);
+/*
+ * Read the peer certificate expiry from the SSL connection if the port test has the certificate validity rule
+ */
+static void _testCertificate(Port_T p, T S) {
+#ifdef HAVE_OPENSSL
+        if (S->ssl && p->certificate.days)
+                p->certificate.expiry = Ssl_getCertificateExpiry(S->ssl, p->certificate.subject, sizeof(p->certificate.subject));
+#endif
+}
+
+
+/*
+ * Read the smoothed round trip time of the TCP connection from the kernel
+ * @return The round trip time in seconds or -1 if not available
+ */
+static double _getRoundTripTime(T S) {
+#if defined(TCP_INFO) && (defined(LINUX) || defined(FREEBSD))
+        if (S->type == Socket_Tcp) {
+                struct tcp_info info;
+                socklen_t infolen = sizeof(info);
+                if (! getsockopt(S->socket, IPPROTO_TCP, TCP_INFO, &info, &infolen))
+                        return info.tcpi_rtt / 1000000.;
+        }
+#endif
+        return -1;
+}
+
+
+static void _testUnix(Port_T p, T *kept) {
+        unsigned long long started = Latency_now();
+        volatile T S = _createUnixSocket(p->pathname, p->type, p->timeout);
         if (S) {
+                unsigned long long connected = Latency_now();
+                PROBE3(socket__connect, p->pathname, 0, connected - started);
                 S->Port = p;
+                S->reusable = kept != NULL;
                 TRY
                 {
                         p->protocol->check(S);
                         p->is_available = true;
-                        p->response = (Time_milli() - start) / 1000.;
+                        unsigned long long finished = Latency_now();
+                        PROBE4(socket__protocol, p->pathname, 0, false, finished - connected);
+                        p->response = (finished - started) / 1000000.;
+                        if (kept && S->reusable) {
+                                *kept = S;
+                                S = NULL;
+                        }
                 }
                 FINALLY
                 {
-                        Socket_free(&S);
+                        if (S)
+                                Socket_free((Socket_T *)&S);
                 }
                 END_TRY;
         } else {
@@ -531,26 +874,49 @@ static void _testUnix(Port_T p) {
 }
 
 
-static void _testIp(Port_T p) {
+static void _testIp(Port_T p, T *kept) {
         char error[STRLEN];
         struct addrinfo *result = _resolve(p->hostname, p->port, p->type, p->family);
         if (result) {
+                char key[STRLEN];
+                snprintf(key, sizeof(key), "%s:%d", p->hostname, p->port);
+                int count;
+                struct addrinfo **addresses = _sortAddresses(key, result, &count);
                 // The host may resolve to multiple IPs and if at least one succeeded, we have no problem and don't have to flood the log with partial errors => log only the last error
-                for (struct addrinfo *r = result; r && ! p->is_available; r = r->ai_next) {
+                while (! p->is_available && _hasAddress(addresses, count)) {
                         volatile T S = NULL;
                         TRY
                         {
-                                long long start = Time_milli();
-                                S = _createIpSocket(p->hostname, r->ai_addr, r->ai_addrlen, r->ai_family, r->ai_socktype, r->ai_protocol, p->SSL, p->timeout);
+                                unsigned long long started = Latency_now();
+                                S = _createIpSocket(p->hostname, key, addresses, count, p->SSL, p->timeout);
+                                unsigned long long connected = Latency_now();
+                                PROBE3(socket__connect, p->hostname, p->port, connected - started);
                                 S->Port = p;
+                                S->reusable = kept != NULL;
+                                // The connect-only test exchanges no data, so the connection can be reset instead of going to TIME_WAIT
+                                S->reset = p->reset && p->protocol == Protocol_get(Protocol_DEFAULT);
+                                p->rtt = _getRoundTripTime(S);
                                 p->protocol->check(S);
                                 p->is_available = true;
-                                p->response = (Time_milli() - start) / 1000.;
+                                unsigned long long finished = Latency_now();
+                                PROBE4(socket__protocol, p->hostname, p->port, false, finished - connected);
+                                p->response = (finished - started) / 1000000.;
+#ifdef HAVE_OPENSSL
+                                if (S->ssl) {
+                                        p->handshake = Ssl_getHandshakeTime(S->ssl);
+                                        PROBE3(socket__handshake, p->hostname, p->port, (unsigned long long)(p->handshake * 1000000.));
+                                }
+#endif
+                                _testCertificate(p, S);
+                                if (kept && S->reusable) {
+                                        *kept = S;
+                                        S = NULL;
+                                }
                         }
                         ELSE
                         {
                                 snprintf(error, sizeof(error), "%s", Exception_frame.message);
-                                DEBUG("Socket test failed for %s -- %s\n", _addressToString(r->ai_addr, r->ai_addrlen, (char[STRLEN]){}, STRLEN), error);
+                                DEBUG("Socket test failed for [%s]:%d -- %s\n", p->hostname, p->port, error);
                         }
                         FINALLY
                         {
@@ -559,7 +925,8 @@ static void _testIp(Port_T p) {
                         }
                         END_TRY;
                 }
-                freeaddrinfo(result);
+                FREE(addresses);
+                Resolver_free(result);
                 if (! p->is_available)
                         THROW(IOException, "%s", error);
         } else {
@@ -568,22 +935,71 @@ static void _testIp(Port_T p) {
 }
 
 
+/*
+ * Test the port over the connection kept open by the previous test. The
+ * server may have closed the idle connection meanwhile, so if the test
+ * fails, the connection is closed and false returned and the caller
+ * repeats the test over a new connection
+ */
+static boolean_t _testReused(Port_T p, T *S, boolean_t keep) {
+        volatile boolean_t rv = false;
+        T C = *S;
+        *S = NULL;
+        C->Port = p;
+        C->timeout = p->timeout;
+        C->reusable = keep;
+        C->tests++;
+        TRY
+        {
+                unsigned long long started = Latency_now();
+                p->protocol->check(C);
+                p->is_available = true;
+                unsigned long long finished = Latency_now();
+                PROBE4(socket__protocol, C->host ? C->host : p->pathname, C->port, true, finished - started);
+                p->response = (finished - started) / 1000000.;
+                _testCertificate(p, C);
+                rv = true;
+        }
+        ELSE
+        {
+                DEBUG("Socket test over the reused connection to %s:%d failed -- %s\n", C->host ? C->host : p->pathname, C->port, Exception_frame.message);
+        }
+        END_TRY;
+        if (rv && keep && C->reusable)
+                *S = C;
+        else
+                Socket_free(&C);
+        return rv;
+}
+
+
 /* ---------------------------------------------------------------- Public */
 
 
 void Socket_test(void *P) {
+        Socket_testReusing(P, NULL, false);
+}
+
+
+void Socket_testReusing(void *P, T *S, boolean_t keep) {
         ASSERT(P);
         Port_T p = P;
         p->response = -1;
+        p->handshake = -1;
+        p->rtt = -1;
         p->is_available = false;
+        p->certificate.expiry = 0;
+        if (S && *S && _testReused(p, S, keep))
+                return;
+        T *kept = S && keep ? S : NULL;
         switch (p->family) {
                 case Socket_Unix:
-                        _testUnix(p);
+                        _testUnix(p, kept);
                         break;
                 case Socket_Ip:
                 case Socket_Ip4:
                 case Socket_Ip6:
-                        _testIp(p);
+                        _testIp(p, kept);
                         break;
                 default:
                         LogError("Invalid socket family %d\n", p->family);
@@ -595,7 +1011,9 @@ void Socket_test(void *P) {
 boolean_t Socket_enableSsl(T S, SslOptions_T ssl, const char *name)  {
         assert(S);
 #ifdef HAVE_OPENSSL
-        if ((S->ssl = Ssl_new(ssl.clientpemfile, ssl.version)) && Ssl_connect(S->ssl, S->socket, name) && (! ssl.certmd5 || Ssl_checkCertificate(S->ssl, ssl.certmd5)))
+        char session[STRLEN];
+        snprintf(session, sizeof(session), "%s:%d", S->host ? S->host : "", S->port);
+        if ((S->ssl = Ssl_new(ssl.clientpemfile, ssl.version)) && (! ssl.alpn || Ssl_setAlpn(S->ssl, ssl.alpn)) && Ssl_connect(S->ssl, S->socket, S->timeout, name, session) && (! ssl.certmd5 || Ssl_checkCertificate(S->ssl, ssl.certmd5)))
                 return true;
 #endif
         return false;
@@ -645,6 +1063,52 @@ int Socket_write(T S, void *b, size_t size) {
 }
 
 
+int Socket_writev(T S, const struct iovec *iov, int count) {
+        ASSERT(S);
+        ASSERT(iov);
+        size_t total = 0;
+        for (int i = 0; i < count; i++)
+                total += iov[i].iov_len;
+#ifdef HAVE_OPENSSL
+        if (S->ssl) {
+                /* SSL has no gather write: a small message is coalesced, so it is sent in one record */
+                if (total <= SSL_RECORD_SIZE) {
+                        char buf[total + 1];
+                        size_t length = 0;
+                        for (int i = 0; i < count; i++) {
+                                memcpy(buf + length, iov[i].iov_base, iov[i].iov_len);
+                                length += iov[i].iov_len;
+                        }
+                        return Socket_write(S, buf, length);
+                }
+                for (int i = 0; i < count; i++)
+                        if (iov[i].iov_len && Socket_write(S, iov[i].iov_base, iov[i].iov_len) < 0)
+                                return -1;
+                return (int)total;
+        }
+#endif
+        struct iovec v[count];
+        memcpy(v, iov, count * sizeof(struct iovec));
+        struct iovec *p = v;
+        while (count > 0) {
+                ssize_t n = writev(S->socket, p, count);
+                if (n < 0) {
+                        if (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && Net_canWrite(S->socket, S->timeout)))
+                                continue;
+                        /* No write or a partial write is an error */
+                        return -1;
+                }
+                for (; count > 0 && (size_t)n >= p->iov_len; count--, p++)
+                        n -= p->iov_len;
+                if (count > 0) {
+                        p->iov_base = (char *)p->iov_base + n;
+                        p->iov_len -= n;
+                }
+        }
+        return (int)total;
+}
+
+
 int Socket_readByte(T S) {
         ASSERT(S);
         if (S->offset >= S->length)
@@ -655,23 +1119,44 @@ int Socket_readByte(T S) {
 
 
 int Socket_read(T S, void *b, int size) {
-        int c;
         unsigned char *p = b;
         ASSERT(S);
-        while ((size-- > 0) && ((c = Socket_readByte(S)) >= 0))
-                *p++ = c;
+        while (size > 0) {
+                if (S->offset >= S->length && _fill(S, S->timeout) <= 0)
+                        break;
+                int n = S->length - S->offset < size ? S->length - S->offset : size;
+                memcpy(p, S->buffer + S->offset, n);
+                S->offset += n;
+                p += n;
+                size -= n;
+                if (S->type == Socket_Udp) // One datagram is one message, don't wait for the next one
+                        break;
+        }
         return (int)((long)p - (long)b);
 }
 
 
 char *Socket_readLine(T S, char *s, int size) {
-        int c;
         unsigned char *p = (unsigned char *)s;
         ASSERT(S);
-        while (--size && ((c = Socket_readByte(S)) > 0)) { // Stop when \0 is read
-                *p++ = c;
-                if (c == '\n')
+        boolean_t done = false;
+        int room = size - 1;
+        while (room > 0 && ! done) {
+                if (S->offset >= S->length && _fill(S, S->timeout) <= 0)
                         break;
+                /* Copy from the buffer up to the end of line */
+                int i = S->offset, end = S->length - S->offset < room ? S->length : S->offset + room;
+                for (; i < end && ! done; i++) {
+                        unsigned char c = S->buffer[i];
+                        if (c == 0) { // Stop when \0 is read
+                                done = true;
+                        } else {
+                                *p++ = c;
+                                done = c == '\n';
+                        }
+                }
+                room -= i - S->offset;
+                S->offset = i;
         }
         *p = 0;
         if (*s)
@@ -679,3 +1164,22 @@ char *Socket_readLine(T S, char *s, int size) {
         return NULL;
 }
 
+
+void *Socket_peek(T S, int size, int *length) {
+        ASSERT(S);
+        ASSERT(length);
+        if (size > SOCKET_BUFFER_MAX)
+                size = SOCKET_BUFFER_MAX;
+        while (S->length - S->offset < size)
+                if (_fill(S, S->timeout) <= 0)
+                        break;
+        *length = S->length - S->offset;
+        return *length > 0 ? S->buffer + S->offset : NULL;
+}
+
+
+void Socket_skip(T S, int size) {
+        ASSERT(S);
+        S->offset += S->length - S->offset < size ? S->length - S->offset : size;
+}
+
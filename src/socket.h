@@ -53,6 +53,9 @@ typedef enum {
 typedef struct T *T;
 
 
+struct iovec;
+
+
 /**
  * Create a new Socket opened against host:port. The returned Socket
  * is a connected socket. This method can be used to create either TCP
@@ -145,6 +148,15 @@ int Socket_getTimeout(T S);
 boolean_t Socket_isSecure(T S);
 
 
+/**
+ * Return true if data was received already and is buffered for reading,
+ * so the next read won't block (polling the descriptor won't see it)
+ * @param S A Socket_T object
+ * @return true if buffered data is available otherwise false
+ */
+boolean_t Socket_hasData(T S);
+
+
 /**
  * Get the underlying socket descriptor
  * @param S A Socket_T object
@@ -161,6 +173,46 @@ int Socket_getSocket(T S);
 Socket_Type Socket_getType(T S);
 
 
+/**
+ * Set whether the connection can be kept open for the next protocol test
+ * of the same server. Socket_testReusing() enables it if the caller wants
+ * to reuse the connection, the protocol test disables it if the server
+ * doesn't keep the connection open (e.g. HTTP "Connection: close")
+ * @param S A Socket_T object
+ * @param reusable true if the connection can be reused
+ */
+void Socket_setReusable(T S, boolean_t reusable);
+
+
+/**
+ * Returns true if the connection is kept open for the next protocol test
+ * @param S A Socket_T object
+ * @return true if the connection can be reused, otherwise false
+ */
+boolean_t Socket_isReusable(T S);
+
+
+/**
+ * Returns true if the connection was kept open by the previous protocol
+ * test, so the protocol test can skip the connection setup (for example
+ * the login) and just ping the server
+ * @param S A Socket_T object
+ * @return true if the connection is reused, otherwise false
+ */
+boolean_t Socket_isReused(T S);
+
+
+/**
+ * Get the number of the protocol tests which were done over the connection
+ * before the current test (see Socket_testReusing()). A protocol which
+ * numbers its requests on a persistent connection (e.g. the HTTP/2 stream
+ * identifier) can derive the number from it
+ * @param S A Socket_T object
+ * @return The number of previous tests, 0 for a new connection
+ */
+int Socket_getTests(T S);
+
+
 /**
  * Get the Port object used to create this socket. If no Port object
  * was used this method returns NULL.
@@ -213,6 +265,22 @@ const char *Socket_getLocalHost(T S, char *host, int hostlen);
 void Socket_test(void *P);
 
 
+/**
+ * Test a Port_T object like Socket_test(), but over the connection kept
+ * open by the previous test of the same server if *S is not NULL. If the
+ * test over the kept connection fails, it's repeated over a new connection.
+ * If keep is true and the protocol keeps the connection open (the HTTP,
+ * REDIS, PGSQL and GRPC protocol tests), the connection is stored in *S for the
+ * next test, otherwise it's closed and *S is set to NULL. The caller frees
+ * the connection left in *S with Socket_free()
+ * @param P A port object to test
+ * @param S The kept connection or NULL
+ * @param keep true if the connection should be kept for the next test
+ * @exception IOException if test failed
+ */
+void Socket_testReusing(void *P, T *S, boolean_t keep);
+
+
 /**
  * Enables SSL on a connected socket.
  * @param S A connected Socket_T object
@@ -243,6 +311,18 @@ int Socket_print(T S, const char *m, ...) __attribute__((format (printf, 2, 3)))
 int Socket_write(T S, void *b, size_t size);
 
 
+/**
+ * Write the data of count buffers (for example a header and a body)
+ * with one gather write. If the socket uses SSL, a small message is
+ * coalesced and sent in one write.
+ * @param S A Socket_T object
+ * @param iov The buffers to be written
+ * @param count The number of buffers in iov
+ * @return The bytes sent or -1 if an error occured
+ */
+int Socket_writev(T S, const struct iovec *iov, int count);
+
+
 /**
  * Read a single byte. The byte is returned as an int in the range 0
  * to 255.
@@ -254,6 +334,7 @@ int Socket_readByte(T S);
 
 /**
  * Reads size bytes and stores them into the byte buffer pointed to by b.
+ * A read from an UDP socket returns at most one datagram.
  * @param S A Socket_T object
  * @param b A Byte buffer
  * @param size The size of the buffer b
@@ -276,6 +357,31 @@ int Socket_read(T S, void *b, int size);
 char *Socket_readLine(T S, char *s, int size);
 
 
+/**
+ * Get a view of the buffered data without copying. Reads until at least
+ * size bytes are buffered (up to SOCKET_BUFFER_MAX, the buffer grows if
+ * needed), the end of the stream is reached or the read timed out. Use
+ * a size of 1 to get the already buffered data or to read once if the
+ * buffer is empty. The data are followed by a '\0' byte and are valid
+ * until the next read from the socket. The data are not consumed, use
+ * Socket_skip().
+ * @param S A Socket_T object
+ * @param size The number of bytes requested
+ * @param length Set to the number of bytes available, may be less or
+ * more than size
+ * @return A pointer to the buffered data or NULL if no data are available
+ */
+void *Socket_peek(T S, int size, int *length);
+
+
+/**
+ * Consume size bytes of the buffered data (see Socket_peek()).
+ * @param S A Socket_T object
+ * @param size The number of bytes to consume, at most the buffered length
+ */
+void Socket_skip(T S, int size);
+
+
 #undef T
 #endif
 
@@ -68,6 +68,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SPAWN_H
+#include <spawn.h>
+#endif
+
 #include "event.h"
 #include "alert.h"
 #include "monit.h"
@@ -79,8 +83,13 @@
 
 
 /**
- *  Function for spawning of a process. This function fork's twice to
- *  avoid creating any zombie processes. Inspired by code from
+ *  Function for spawning of a process. The program is started using
+ *  posix_spawn(3), which does not copy the address space of the daemon
+ *  (on most systems it is implemented using vfork). The spawned children
+ *  are reaped by spawn_reap() and count against the spawn limit shared
+ *  with the program checks and the start/stop/restart methods. If the
+ *  program should run with a different uid or gid, the daemon fork's
+ *  twice to avoid creating any zombie processes. Inspired by code from
  *  W. Richard Stevens book, APUE.
  *
  *  @file
@@ -99,6 +108,21 @@ enum ExitStatus_E {
 } __attribute__((__packed__));
 
 
+#define SPAWN_WAIT 30000 // Milliseconds to wait for a free child slot when the spawn limit is reached
+
+
+extern char **environ;
+
+
+static struct {
+        Mutex_T mutex;
+        int running;                   /**< Children counted against the limit */
+        int count;                        /**< Spawned children not reaped yet */
+        int size;                            /**< Allocated size of the table */
+        pid_t *children;                           /**< Spawned children table */
+} pool = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -113,7 +137,7 @@ static void set_monit_environment(Service_T S, command_t C, Event_T E, const cha
         setenv("MONIT_EVENT", E ? Event_get_description(E) : C == S->start ? "Started" : C == S->stop ? "Stopped" : "No Event", 1);
         setenv("MONIT_DESCRIPTION", E ? Event_get_message(E) : C == S->start ? "Started" : C == S->stop ? "Stopped" : "No Event", 1);
         if (S->type == Service_Process) {
-                putenv(Str_cat("MONIT_PROCESS_PID=%d", Util_isProcessRunning(S, false)));
+                putenv(Str_cat("MONIT_PROCESS_PID=%d", S->instance.owner ? (int)S->instance.pid : Util_isProcessRunning(S, false)));
                 putenv(Str_cat("MONIT_PROCESS_MEMORY=%ld", S->inf->priv.process.mem_kbyte));
                 putenv(Str_cat("MONIT_PROCESS_CHILDREN=%d", S->inf->priv.process.children));
                 putenv(Str_cat("MONIT_PROCESS_CPU_PERCENT=%d", S->inf->priv.process.cpu_percent));
@@ -121,31 +145,176 @@ static void set_monit_environment(Service_T S, command_t C, Event_T E, const cha
 }
 
 
-/* ------------------------------------------------------------------ Public */
+/*
+ * Reap the spawned children which exited. Must be called with the pool locked
+ */
+static void _reap() {
+        for (int i = 0; i < pool.count;) {
+                pid_t pid = waitpid(pool.children[i], NULL, WNOHANG);
+                if (pid == pool.children[i] || (pid == -1 && errno == ECHILD)) {
+                        pool.children[i] = pool.children[--pool.count];
+                        pool.running--;
+                } else {
+                        i++;
+                }
+        }
+}
 
 
-/**
- * Execute the given command. If the execution fails, the wait_start()
- * thread in control.c should notice this and send an alert message.
- * @param S A Service object
- * @param C A Command object
- * @param E An optional event object. May be NULL.
+/*
+ * Take a child slot, waiting up to timeout milliseconds if the spawn limit is reached
  */
-void spawn(Service_T S, command_t C, Event_T E) {
+static boolean_t _acquire(int timeout) {
+        boolean_t acquired = false;
+        do {
+                LOCK(pool.mutex)
+                {
+                        _reap();
+                        if (Run.spawnlimit <= 0 || pool.running < Run.spawnlimit) {
+                                pool.running++;
+                                acquired = true;
+                        }
+                }
+                END_LOCK;
+                if (acquired)
+                        return true;
+                if (timeout > 0)
+                        Time_usleep(100000);
+                timeout -= 100;
+        } while (timeout > 0 && ! Run.stopped);
+        return false;
+}
+
+
+/*
+ * Remember the spawned child, it holds the slot until it is reaped
+ */
+static void _addChild(pid_t pid) {
+        LOCK(pool.mutex)
+        {
+                if (pool.count == pool.size) {
+                        pool.size = pool.size ? pool.size * 2 : 16;
+                        RESIZE(pool.children, pool.size * sizeof(pid_t));
+                }
+                pool.children[pool.count++] = pid;
+        }
+        END_LOCK;
+}
+
+
+#if defined HAVE_SPAWN_H && defined HAVE_POSIX_SPAWN
+
+
+/*
+ * Build the environment of the spawned program: the daemon environment with
+ * the MONIT_xxx variables. The caller frees the array and the variables from
+ * the index returned in first
+ */
+static char **_environment(Service_T S, command_t C, Event_T E, const char *date, int *first) {
+        int n = 0;
+        while (environ[n])
+                n++;
+        char **env = CALLOC(n + 10, sizeof(char *));
+        int i = 0;
+        for (int j = 0; j < n; j++)
+                if (! Str_startsWith(environ[j], "MONIT_"))
+                        env[i++] = environ[j];
+        *first = i;
+        env[i++] = Str_cat("MONIT_DATE=%s", date);
+        env[i++] = Str_cat("MONIT_SERVICE=%s", S->name);
+        env[i++] = Str_cat("MONIT_HOST=%s", Run.system->name);
+        env[i++] = Str_cat("MONIT_EVENT=%s", E ? Event_get_description(E) : C == S->start ? "Started" : C == S->stop ? "Stopped" : "No Event");
+        env[i++] = Str_cat("MONIT_DESCRIPTION=%s", E ? Event_get_message(E) : C == S->start ? "Started" : C == S->stop ? "Stopped" : "No Event");
+        if (S->type == Service_Process) {
+                env[i++] = Str_cat("MONIT_PROCESS_PID=%d", S->instance.owner ? (int)S->instance.pid : Util_isProcessRunning(S, false));
+                env[i++] = Str_cat("MONIT_PROCESS_MEMORY=%ld", S->inf->priv.process.mem_kbyte);
+                env[i++] = Str_cat("MONIT_PROCESS_CHILDREN=%d", S->inf->priv.process.children);
+                env[i++] = Str_cat("MONIT_PROCESS_CPU_PERCENT=%d", S->inf->priv.process.cpu_percent);
+        }
+        env[i] = NULL;
+        return env;
+}
+
+
+/*
+ * Close the inherited descriptors in the child, except stdio and descriptors which are closed on exec anyway
+ */
+static void _closeFds(posix_spawn_file_actions_t *actions) {
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+        posix_spawn_file_actions_addclosefrom_np(actions, 3);
+#else
+        int max_descriptors = getdtablesize();
+        for (int i = 3; i < max_descriptors; i++) {
+                int flags = fcntl(i, F_GETFD);
+                if (flags != -1 && ! (flags & FD_CLOEXEC))
+                        posix_spawn_file_actions_addclose(actions, i);
+        }
+#endif
+}
+
+
+static void _spawn(Service_T S, command_t C, Event_T E, const char *date) {
+        if (! _acquire(SPAWN_WAIT)) {
+                LogError("Cannot execute %s -- spawn limit of %d running programs reached\n", C->arg[0], Run.spawnlimit);
+                return;
+        }
+        posix_spawnattr_t attr;
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_init(&attr);
+        posix_spawn_file_actions_init(&actions);
+        /*
+         * Reset all signals, so the spawned process is *not* created
+         * with any inherited SIG_BLOCKs
+         */
+        sigset_t mask;
+        sigemptyset(&mask);
+        posix_spawnattr_setsigmask(&attr, &mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGHUP);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGUSR1);
+        sigaddset(&mask, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attr, &mask);
+#ifdef POSIX_SPAWN_SETSID
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSID);
+#else
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+#endif
+        if (! Run.isdaemon)
+                for (int i = 0; i < 3; i++)
+                        posix_spawn_file_actions_addopen(&actions, i, "/dev/null", O_RDWR, 0);
+        _closeFds(&actions);
+        int first;
+        char **env = _environment(S, C, E, date, &first);
+        pid_t pid;
+        int rv = posix_spawn(&pid, C->arg[0], &actions, &attr, C->arg, env);
+        for (int i = first; env[i]; i++)
+                FREE(env[i]);
+        FREE(env);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        if (rv == 0) {
+                _addChild(pid);
+        } else {
+                LogError("Cannot execute %s -- %s\n", C->arg[0], strerror(rv));
+                spawn_release();
+        }
+}
+
+
+#endif
+
+
+/*
+ * Fork twice, switch the uid/gid and execute the program
+ */
+static void _forkSpawn(Service_T S, command_t C, Event_T E, const char *date) {
         pid_t pid;
         sigset_t mask;
         sigset_t save;
         int stat_loc = 0;
         int exit_status;
-        char date[42];
-
-        ASSERT(S);
-        ASSERT(C);
-
-        if (access(C->arg[0], X_OK) != 0) {
-                LogError("Error: Could not execute %s\n", C->arg[0]);
-                return;
-        }
 
         /*
          * Block SIGCHLD
@@ -154,7 +323,6 @@ void spawn(Service_T S, command_t C, Event_T E) {
         sigaddset(&mask, SIGCHLD);
         pthread_sigmask(SIG_BLOCK, &mask, &save);
 
-        Time_string(Time_now(), date);
         pid = fork();
         if (pid < 0) {
                 LogError("Cannot fork a new process -- %s\n", STRERROR);
@@ -240,6 +408,72 @@ void spawn(Service_T S, command_t C, Event_T E) {
          * We do not need to wait for the second child since we forked twice,
          * the init system-process will wait for it. So we just return
          */
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+/**
+ * Execute the given command. If the execution fails, the wait_start()
+ * thread in control.c should notice this and send an alert message.
+ * @param S A Service object
+ * @param C A Command object
+ * @param E An optional event object. May be NULL.
+ */
+void spawn(Service_T S, command_t C, Event_T E) {
+        char date[42];
+
+        ASSERT(S);
+        ASSERT(C);
+
+        if (access(C->arg[0], X_OK) != 0) {
+                LogError("Error: Could not execute %s\n", C->arg[0]);
+                return;
+        }
+
+        Time_string(Time_now(), date);
+#if defined HAVE_SPAWN_H && defined HAVE_POSIX_SPAWN
+        // posix_spawn cannot switch the credentials, such programs are started the traditional way
+        if (! C->has_uid && ! C->has_gid) {
+                _spawn(S, C, E, date);
+                return;
+        }
+#endif
+        _forkSpawn(S, C, E, date);
+}
+
 
+/**
+ * Take a child slot for a program started with Command_execute(). If the
+ * spawn limit is reached, wait up to timeout milliseconds for a free slot.
+ * @param timeout Milliseconds to wait, 0 = don't wait
+ * @return true if the slot was taken, false if the limit is reached
+ */
+boolean_t spawn_acquire(int timeout) {
+        return _acquire(timeout);
 }
 
+
+/**
+ * Release a child slot taken by spawn_acquire()
+ */
+void spawn_release() {
+        LOCK(pool.mutex)
+        {
+                pool.running--;
+        }
+        END_LOCK;
+}
+
+
+/**
+ * Reap the programs started by spawn() which exited
+ */
+void spawn_reap() {
+        LOCK(pool.mutex)
+        {
+                _reap();
+        }
+        END_LOCK;
+}
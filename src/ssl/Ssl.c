@@ -84,6 +84,7 @@
 // libmonit
 #include "io/File.h"
 #include "system/Net.h"
+#include "system/Time.h"
 #include "exceptions/AssertException.h"
 
 
@@ -115,6 +116,18 @@
 #define RANDOM_DEVICE "/dev/random"
 
 
+/**
+ * Maximum number of client sessions kept for resumption, the least recently used session is dropped when reached
+ */
+#define SESSION_CACHE_SIZE 256
+
+
+/**
+ * Maximum number of parsed peer certificates kept, the least recently used certificate is dropped when reached
+ */
+#define CERTIFICATE_CACHE_SIZE 256
+
+
 #define SSLERROR ERR_error_string(ERR_get_error(),NULL)
 
 
@@ -123,12 +136,46 @@ struct T {
         boolean_t accepted;
         Ssl_Version version;
         int socket;
+        double handshake;
         SSL *handler;
         SSL_CTX *ctx;
         char *clientpemfile;
 };
 
 
+/**
+ * Shared client context, one per SSL version and client certificate
+ */
+typedef struct mycontext {
+        Ssl_Version version;                                      /**< SSL version */
+        char *clientpemfile;                   /**< Client certificate (optional) */
+        SSL_CTX *ctx;                                      /**< The shared context */
+        struct mycontext *next;                                /**< Next context */
+} *Context_T;
+
+
+/**
+ * Client session kept for resumption, keyed by host:port and context
+ */
+typedef struct mysession {
+        char *key;                                                /**< host:port */
+        SSL_CTX *ctx;                         /**< The context the session belongs to */
+        SSL_SESSION *session;                                 /**< Cached session */
+        struct mysession *next;                                /**< Next session */
+} *Session_T;
+
+
+/**
+ * Parsed peer certificate chain, keyed by the SHA1 fingerprint of the peer certificate
+ */
+typedef struct mycertificate {
+        unsigned char fingerprint[SHA_DIGEST_LENGTH];  /**< Peer certificate SHA1 */
+        time_t expiry;       /**< notAfter of the first expiring certificate or 0 */
+        char *subject;                /**< Subject of the first expiring certificate */
+        struct mycertificate *next;                        /**< Next certificate */
+} *Certificate_T;
+
+
 struct SslServer_T {
         int socket;
         SSL_CTX *ctx;
@@ -140,6 +187,26 @@ struct SslServer_T {
 static Mutex_T *instanceMutexTable;
 
 
+static struct {
+        Mutex_T mutex;
+        Context_T list;
+} contexts = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
+static struct {
+        Mutex_T mutex;
+        int count;
+        Session_T list;                                    /**< Most recently used first */
+} sessions = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
+static struct {
+        Mutex_T mutex;
+        int count;
+        Certificate_T list;                                /**< Most recently used first */
+} certificates = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -198,60 +265,8 @@ static boolean_t _setServerNameIdentification(T C, const char *hostname) {
 }
 
 
-/* ------------------------------------------------------------------ Public */
-
-
-void Ssl_start() {
-        SSL_library_init();
-        SSL_load_error_strings();
-        if (File_exist(URANDOM_DEVICE))
-                RAND_load_file(URANDOM_DEVICE, RANDOM_BYTES);
-        else if (File_exist(RANDOM_DEVICE))
-                RAND_load_file(RANDOM_DEVICE, RANDOM_BYTES);
-        else
-                THROW(AssertException, "SSL: cannot find %s nor %s on the system", URANDOM_DEVICE, RANDOM_DEVICE);
-        int locks = CRYPTO_num_locks();
-        instanceMutexTable = CALLOC(locks, sizeof(Mutex_T));
-        for (int i = 0; i < locks; i++)
-                Mutex_init(instanceMutexTable[i]);
-        CRYPTO_set_id_callback(_threadID);
-        CRYPTO_set_locking_callback(_mutexLock);
-}
-
-
-void Ssl_stop() {
-        CRYPTO_set_id_callback(NULL);
-        CRYPTO_set_locking_callback(NULL);
-        for (int i = 0; i < CRYPTO_num_locks(); i++)
-                Mutex_destroy(instanceMutexTable[i]);
-        FREE(instanceMutexTable);
-        RAND_cleanup();
-        ERR_free_strings();
-        Ssl_threadCleanup();
-}
-
-
-void Ssl_threadCleanup() {
-        ERR_remove_state(0);
-}
-
-
-void Ssl_setFipsMode(boolean_t enabled) {
-#ifdef OPENSSL_FIPS
-        if (enabled && ! FIPS_mode() && ! FIPS_mode_set(1))
-                THROW(AssertException, "SSL: cannot enter FIPS mode -- %s", SSLERROR);
-        else if (! enabled && FIPS_mode() && ! FIPS_mode_set(0))
-                THROW(AssertException, "SSL: cannot exit FIPS mode -- %s", SSLERROR);
-#endif
-}
-
-
-T Ssl_new(char *clientpemfile, Ssl_Version version) {
-        T C;
-        NEW(C);
-        C->version = version;
-        if (clientpemfile)
-                C->clientpemfile = Str_dup(clientpemfile);
+static SSL_CTX *_newContext(Ssl_Version version, const char *clientpemfile) {
+        SSL_CTX *ctx = NULL;
         const SSL_METHOD *method;
         switch (version) {
                 case SSL_V2:
@@ -295,38 +310,300 @@ T Ssl_new(char *clientpemfile, Ssl_Version version) {
                 LogError("SSL: client method initialization failed -- %s\n", SSLERROR);
                 goto sslerror;
         }
-        if (! (C->ctx = SSL_CTX_new(method))) {
+        if (! (ctx = SSL_CTX_new(method))) {
                 LogError("SSL: client context initialization failed -- %s\n", SSLERROR);
                 goto sslerror;
         }
         if (version == SSL_Auto)
-                SSL_CTX_set_options(C->ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+                SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
 #ifdef SSL_OP_NO_COMPRESSION
-        SSL_CTX_set_options(C->ctx, SSL_OP_NO_COMPRESSION);
+        SSL_CTX_set_options(ctx, SSL_OP_NO_COMPRESSION);
 #endif
-        if (SSL_CTX_set_cipher_list(C->ctx, CIPHER_LIST) != 1) {
+        // Sessions are cached by host:port in the session list, not by the OpenSSL internal cache
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        if (SSL_CTX_set_cipher_list(ctx, CIPHER_LIST) != 1) {
                 LogError("SSL: client cipher list [%s] error -- no valid ciphers\n", CIPHER_LIST);
                 goto sslerror;
         }
-        if (! (C->handler = SSL_new(C->ctx))) {
-                LogError("SSL: cannot create client handler -- %s\n", SSLERROR);
-                goto sslerror;
-        }
-        SSL_set_mode(C->handler, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
-        if (C->clientpemfile) {
-                if (SSL_CTX_use_certificate_chain_file(C->ctx, C->clientpemfile) != 1) {
+        if (clientpemfile) {
+                if (SSL_CTX_use_certificate_chain_file(ctx, clientpemfile) != 1) {
                         LogError("SSL: client certificate chain loading failed -- %s\n", SSLERROR);
                         goto sslerror;
                 }
-                if (SSL_CTX_use_PrivateKey_file(C->ctx, C->clientpemfile, SSL_FILETYPE_PEM) != 1) {
+                if (SSL_CTX_use_PrivateKey_file(ctx, clientpemfile, SSL_FILETYPE_PEM) != 1) {
                         LogError("SSL: client private key loading failed -- %s\n", SSLERROR);
                         goto sslerror;
                 }
-                if (SSL_CTX_check_private_key(C->ctx) != 1) {
+                if (SSL_CTX_check_private_key(ctx) != 1) {
                         LogError("SSL: client private key doesn't match the certificate -- %s\n", SSLERROR);
                         goto sslerror;
                 }
         }
+        return ctx;
+sslerror:
+        if (ctx)
+                SSL_CTX_free(ctx);
+        return NULL;
+}
+
+
+/**
+ * Get the shared client context for the given version and client certificate, the context is created on first use
+ */
+static SSL_CTX *_getContext(Ssl_Version version, const char *clientpemfile) {
+        SSL_CTX *ctx = NULL;
+        LOCK(contexts.mutex)
+        {
+                for (Context_T c = contexts.list; c; c = c->next) {
+                        if (c->version == version && (c->clientpemfile ? clientpemfile && Str_isEqual(c->clientpemfile, clientpemfile) : ! clientpemfile)) {
+                                ctx = c->ctx;
+                                break;
+                        }
+                }
+                if (! ctx && (ctx = _newContext(version, clientpemfile))) {
+                        Context_T c;
+                        NEW(c);
+                        c->version = version;
+                        c->clientpemfile = clientpemfile ? Str_dup(clientpemfile) : NULL;
+                        c->ctx = ctx;
+                        c->next = contexts.list;
+                        contexts.list = c;
+                }
+        }
+        END_LOCK;
+        return ctx;
+}
+
+
+static void _freeSession(Session_T *s) {
+        SSL_SESSION_free((*s)->session);
+        FREE((*s)->key);
+        FREE(*s);
+}
+
+
+/**
+ * Unlink and return the cached session for key. Must be called with the session list locked
+ */
+static Session_T _unlinkSession(const char *key, SSL_CTX *ctx) {
+        for (Session_T *s = &sessions.list; *s; s = &(*s)->next) {
+                if ((*s)->ctx == ctx && Str_isEqual((*s)->key, key)) {
+                        Session_T found = *s;
+                        *s = found->next;
+                        found->next = NULL;
+                        sessions.count--;
+                        return found;
+                }
+        }
+        return NULL;
+}
+
+
+/**
+ * Offer the cached session for key (if any) to the server
+ */
+static void _resumeSession(T C, const char *key) {
+        LOCK(sessions.mutex)
+        {
+                for (Session_T s = sessions.list; s; s = s->next) {
+                        if (s->ctx == C->ctx && Str_isEqual(s->key, key)) {
+                                SSL_set_session(C->handler, s->session);
+                                break;
+                        }
+                }
+        }
+        END_LOCK;
+}
+
+
+/**
+ * Store the negotiated session for key as the most recently used one
+ */
+static void _saveSession(T C, const char *key) {
+        SSL_SESSION *session = SSL_get1_session(C->handler);
+        if (session) {
+                LOCK(sessions.mutex)
+                {
+                        Session_T s = _unlinkSession(key, C->ctx);
+                        if (s) {
+                                SSL_SESSION_free(s->session);
+                        } else {
+                                NEW(s);
+                                s->key = Str_dup(key);
+                                s->ctx = C->ctx;
+                        }
+                        s->session = session;
+                        s->next = sessions.list;
+                        sessions.list = s;
+                        if (++sessions.count > SESSION_CACHE_SIZE) {
+                                Session_T *last = &sessions.list;
+                                while ((*last)->next)
+                                        last = &(*last)->next;
+                                _freeSession(last);
+                                sessions.count--;
+                        }
+                }
+                END_LOCK;
+        }
+}
+
+
+/**
+ * Drop the cached session for key, so the next connection performs a full handshake
+ */
+static void _removeSession(T C, const char *key) {
+        LOCK(sessions.mutex)
+        {
+                Session_T s = _unlinkSession(key, C->ctx);
+                if (s)
+                        _freeSession(&s);
+        }
+        END_LOCK;
+}
+
+
+static void _freeCertificate(Certificate_T *c) {
+        FREE((*c)->subject);
+        FREE(*c);
+}
+
+
+/**
+ * Unlink and return the cached certificate with the fingerprint. Must be called with the certificate list locked
+ */
+static Certificate_T _unlinkCertificate(const unsigned char *fingerprint) {
+        for (Certificate_T *c = &certificates.list; *c; c = &(*c)->next) {
+                if (! memcmp((*c)->fingerprint, fingerprint, SHA_DIGEST_LENGTH)) {
+                        Certificate_T found = *c;
+                        *c = found->next;
+                        found->next = NULL;
+                        certificates.count--;
+                        return found;
+                }
+        }
+        return NULL;
+}
+
+
+/**
+ * Parse the notAfter time of the peer certificate and the chain sent by the server and keep the first expiring one
+ */
+static void _parseCertificate(T C, X509 *peer, Certificate_T c) {
+        X509 *first = NULL;
+        STACK_OF(X509) *chain = SSL_get_peer_cert_chain(C->handler); // The client side chain includes the peer certificate, but may be missing for the resumed session
+        for (int i = -1; i < (chain ? sk_X509_num(chain) : 0); i++) {
+                X509 *cert = i < 0 ? peer : sk_X509_value(chain, i);
+                int days, seconds;
+                if (ASN1_TIME_diff(&days, &seconds, NULL, X509_get_notAfter(cert))) {
+                        time_t expiry = Time_now() + days * 86400LL + seconds;
+                        if (! first || expiry < c->expiry) {
+                                first = cert;
+                                c->expiry = expiry;
+                        }
+                } else {
+                        DEBUG("SSL: cannot parse the certificate notAfter time -- %s\n", SSLERROR);
+                }
+        }
+        if (first) {
+                char subject[STRLEN];
+                c->subject = Str_dup(X509_NAME_oneline(X509_get_subject_name(first), subject, sizeof(subject)));
+        }
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+void Ssl_start() {
+        SSL_library_init();
+        SSL_load_error_strings();
+        if (File_exist(URANDOM_DEVICE))
+                RAND_load_file(URANDOM_DEVICE, RANDOM_BYTES);
+        else if (File_exist(RANDOM_DEVICE))
+                RAND_load_file(RANDOM_DEVICE, RANDOM_BYTES);
+        else
+                THROW(AssertException, "SSL: cannot find %s nor %s on the system", URANDOM_DEVICE, RANDOM_DEVICE);
+        int locks = CRYPTO_num_locks();
+        instanceMutexTable = CALLOC(locks, sizeof(Mutex_T));
+        for (int i = 0; i < locks; i++)
+                Mutex_init(instanceMutexTable[i]);
+        CRYPTO_set_id_callback(_threadID);
+        CRYPTO_set_locking_callback(_mutexLock);
+}
+
+
+void Ssl_stop() {
+        LOCK(sessions.mutex)
+        {
+                while (sessions.list) {
+                        Session_T s = sessions.list;
+                        sessions.list = s->next;
+                        _freeSession(&s);
+                }
+                sessions.count = 0;
+        }
+        END_LOCK;
+        LOCK(certificates.mutex)
+        {
+                while (certificates.list) {
+                        Certificate_T c = certificates.list;
+                        certificates.list = c->next;
+                        _freeCertificate(&c);
+                }
+                certificates.count = 0;
+        }
+        END_LOCK;
+        LOCK(contexts.mutex)
+        {
+                while (contexts.list) {
+                        Context_T c = contexts.list;
+                        contexts.list = c->next;
+                        SSL_CTX_free(c->ctx);
+                        FREE(c->clientpemfile);
+                        FREE(c);
+                }
+        }
+        END_LOCK;
+        CRYPTO_set_id_callback(NULL);
+        CRYPTO_set_locking_callback(NULL);
+        for (int i = 0; i < CRYPTO_num_locks(); i++)
+                Mutex_destroy(instanceMutexTable[i]);
+        FREE(instanceMutexTable);
+        RAND_cleanup();
+        ERR_free_strings();
+        Ssl_threadCleanup();
+}
+
+
+void Ssl_threadCleanup() {
+        ERR_remove_state(0);
+}
+
+
+void Ssl_setFipsMode(boolean_t enabled) {
+#ifdef OPENSSL_FIPS
+        if (enabled && ! FIPS_mode() && ! FIPS_mode_set(1))
+                THROW(AssertException, "SSL: cannot enter FIPS mode -- %s", SSLERROR);
+        else if (! enabled && FIPS_mode() && ! FIPS_mode_set(0))
+                THROW(AssertException, "SSL: cannot exit FIPS mode -- %s", SSLERROR);
+#endif
+}
+
+
+T Ssl_new(char *clientpemfile, Ssl_Version version) {
+        T C;
+        NEW(C);
+        C->version = version;
+        C->handshake = -1.;
+        if (clientpemfile)
+                C->clientpemfile = Str_dup(clientpemfile);
+        if (! (C->ctx = _getContext(version, clientpemfile)))
+                goto sslerror;
+        if (! (C->handler = SSL_new(C->ctx))) {
+                LogError("SSL: cannot create client handler -- %s\n", SSLERROR);
+                goto sslerror;
+        }
+        SSL_set_mode(C->handler, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
         return C;
 sslerror:
         Ssl_free(&C);
@@ -338,8 +615,7 @@ void Ssl_free(T *C) {
         ASSERT(C && *C);
         if ((*C)->handler)
                 SSL_free((*C)->handler);
-        if ((*C)->ctx && ! (*C)->accepted)
-                SSL_CTX_free((*C)->ctx);
+        // The client context is shared and freed in Ssl_stop(), the accepted connection context belongs to the server
         FREE((*C)->clientpemfile);
         FREE(*C);
 }
@@ -353,26 +629,71 @@ void Ssl_close(T C) {
 }
 
 
-boolean_t Ssl_connect(T C, int socket, const char *name) {
+boolean_t Ssl_connect(T C, int socket, int timeout, const char *name, const char *session) {
         ASSERT(C);
         ASSERT(socket >= 0);
         C->socket = socket;
         SSL_set_connect_state(C->handler);
         SSL_set_fd(C->handler, C->socket);
         _setServerNameIdentification(C, name);
-        int rv = SSL_connect(C->handler);
-        if (rv < 0) {
+        if (session)
+                _resumeSession(C, session);
+        long long start = Time_milli();
+        boolean_t retry = false;
+        do {
+                int rv = SSL_connect(C->handler);
                 switch (SSL_get_error(C->handler, rv)) {
                         case SSL_ERROR_NONE:
+                                C->handshake = (Time_milli() - start) / 1000.;
+                                if (session) {
+                                        if (! SSL_session_reused(C->handler))
+                                                _saveSession(C, session);
+                                        DEBUG("SSL: %s handshake with %s done in %.3fs\n", SSL_session_reused(C->handler) ? "resumed" : "full", session, C->handshake);
+                                }
+                                return true;
                         case SSL_ERROR_WANT_READ:
+                                if (! (retry = Net_canRead(C->socket, timeout)))
+                                        LogError("SSL: handshake timed out\n");
+                                break;
                         case SSL_ERROR_WANT_WRITE:
+                                if (! (retry = Net_canWrite(C->socket, timeout)))
+                                        LogError("SSL: handshake timed out\n");
                                 break;
                         default:
                                 LogError("SSL: connection error -- %s\n", SSLERROR);
-                                return false;
+                                retry = false;
+                                break;
                 }
-        }
-        return true;
+        } while (retry);
+        if (session)
+                _removeSession(C, session);
+        return false;
+}
+
+
+boolean_t Ssl_setAlpn(T C, const char *protocol) {
+        ASSERT(C);
+        ASSERT(protocol);
+#ifdef HAVE_SSL_SET_ALPN_PROTOS
+        unsigned char protos[STRLEN];
+        int length = (int)strlen(protocol);
+        if (length < 1 || length >= (int)sizeof(protos) - 1)
+                return false;
+        protos[0] = length; // The ALPN protocol list is a sequence of length prefixed names
+        memcpy(protos + 1, protocol, length);
+        if (SSL_set_alpn_protos(C->handler, protos, length + 1) == 0)
+                return true;
+        LogError("SSL: unable to set the ALPN extension to %s\n", protocol);
+#else
+        LogError("SSL: the SSL library doesn't support the ALPN extension\n");
+#endif
+        return false;
+}
+
+
+double Ssl_getHandshakeTime(T C) {
+        ASSERT(C);
+        return C->handshake;
 }
 
 
@@ -458,6 +779,12 @@ int Ssl_read(T C, void *b, int size, int timeout) {
 }
 
 
+int Ssl_pending(T C) {
+        ASSERT(C);
+        return SSL_pending(C->handler);
+}
+
+
 boolean_t Ssl_checkCertificate(T C, char *md5sum) {
         ASSERT(C);
         ASSERT(md5sum);
@@ -487,6 +814,49 @@ boolean_t Ssl_checkCertificate(T C, char *md5sum) {
 }
 
 
+time_t Ssl_getCertificateExpiry(T C, char *subject, int subjectlength) {
+        ASSERT(C);
+        ASSERT(subject);
+        time_t expiry = 0;
+        *subject = 0;
+        X509 *cert = SSL_get_peer_certificate(C->handler);
+        if (cert) {
+                unsigned int len;
+                unsigned char fingerprint[EVP_MAX_MD_SIZE];
+                if (X509_digest(cert, EVP_sha1(), fingerprint, &len)) {
+                        LOCK(certificates.mutex)
+                        {
+                                Certificate_T c = _unlinkCertificate(fingerprint);
+                                if (! c) {
+                                        NEW(c);
+                                        memcpy(c->fingerprint, fingerprint, SHA_DIGEST_LENGTH);
+                                        _parseCertificate(C, cert, c);
+                                }
+                                c->next = certificates.list;
+                                certificates.list = c;
+                                if (++certificates.count > CERTIFICATE_CACHE_SIZE) {
+                                        Certificate_T *last = &certificates.list;
+                                        while ((*last)->next)
+                                                last = &(*last)->next;
+                                        _freeCertificate(last);
+                                        certificates.count--;
+                                }
+                                expiry = c->expiry;
+                                if (c->subject)
+                                        snprintf(subject, subjectlength, "%s", c->subject);
+                        }
+                        END_LOCK;
+                } else {
+                        LogError("SSL: cannot get peer certificate fingerprint -- %s\n", SSLERROR);
+                }
+                X509_free(cert);
+        } else {
+                LogError("SSL: cannot get peer certificate\n");
+        }
+        return expiry;
+}
+
+
 /* -------------------------------------------------------------- SSL Server */
 
 
@@ -516,7 +886,21 @@ SslServer_T SslServer_new(char *pemfile, char *clientpemfile, int socket) {
 #ifdef SSL_OP_NO_COMPRESSION
         SSL_CTX_set_options(S->ctx, SSL_OP_NO_COMPRESSION);
 #endif
-        SSL_CTX_set_session_cache_mode(S->ctx, SSL_SESS_CACHE_OFF);
+        if (Run.httpd.socket.net.ssl.sessioncache > 0) {
+                // The session ID context is required for resumption if the client certificate is verified
+                SSL_CTX_set_session_id_context(S->ctx, (const unsigned char *)prog, (unsigned int)strlen(prog));
+                SSL_CTX_set_session_cache_mode(S->ctx, SSL_SESS_CACHE_SERVER);
+                SSL_CTX_sess_set_cache_size(S->ctx, Run.httpd.socket.net.ssl.sessioncache);
+                SSL_CTX_set_timeout(S->ctx, Run.httpd.socket.net.ssl.sessiontimeout);
+        } else {
+                SSL_CTX_set_session_cache_mode(S->ctx, SSL_SESS_CACHE_OFF);
+        }
+#ifdef SSL_OP_NO_TICKET
+        if (! (Run.httpd.flags & Httpd_SessionTickets))
+                SSL_CTX_set_options(S->ctx, SSL_OP_NO_TICKET);
+        else if (Run.httpd.socket.net.ssl.sessioncache <= 0)
+                SSL_CTX_set_timeout(S->ctx, Run.httpd.socket.net.ssl.sessiontimeout);
+#endif
         if (SSL_CTX_use_certificate_chain_file(S->ctx, pemfile) != 1) {
                 LogError("SSL: server certificate chain loading failed -- %s\n", SSLERROR);
                 goto sslerror;
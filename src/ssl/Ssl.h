@@ -76,7 +76,8 @@ void Ssl_setFipsMode(boolean_t enabled);
 
 
 /**
- * Create a new SSL connection object
+ * Create a new SSL connection object. The SSL context is shared by all
+ * connections with the same version and client certificate.
  * @return a new SSL connection object or NULL if failed
  */
 T Ssl_new(char *clientpemfile, Ssl_Version version);
@@ -90,14 +91,38 @@ void Ssl_free(T *C);
 
 
 /**
- * Connect a socket using SSL. If name is set and TLS is used,
- * the Server Name Indication (SNI) TLS extension is enabled.
+ * Connect a socket using SSL and complete the handshake. If name is
+ * set and TLS is used, the Server Name Indication (SNI) TLS extension
+ * is enabled. If session is set, the session negotiated with the server
+ * is cached under this key (host:port) and offered for resumption on
+ * the next connection with the same key.
  * @param C An SSL connection object
  * @param socket A socket
+ * @param timeout Milliseconds to wait for the handshake I/O
  * @param name A server name string (optional)
+ * @param session The session cache key (optional)
  * @return true if succeeded or false if failed
  */
-boolean_t Ssl_connect(T C, int socket, const char *name);
+boolean_t Ssl_connect(T C, int socket, int timeout, const char *name, const char *session);
+
+
+/**
+ * Offer the application protocol to the server using the Application-Layer
+ * Protocol Negotiation (ALPN) TLS extension. Must be called before
+ * Ssl_connect()
+ * @param C An SSL connection object
+ * @param protocol The protocol name, for example "h2"
+ * @return true if succeeded or false if the SSL library doesn't support ALPN
+ */
+boolean_t Ssl_setAlpn(T C, const char *protocol);
+
+
+/**
+ * Get the time the SSL handshake took
+ * @param C An SSL connection object
+ * @return The handshake time in seconds or -1 if not connected
+ */
+double Ssl_getHandshakeTime(T C);
 
 
 /**
@@ -129,6 +154,15 @@ int Ssl_write(T C, void *b, int size, int timeout);
 int Ssl_read(T C, void *b, int size, int timeout);
 
 
+/**
+ * Returns the number of decrypted bytes buffered in the SSL connection
+ * which can be read without waiting for the socket
+ * @param C An SSL connection object
+ * @return Number of buffered bytes
+ */
+int Ssl_pending(T C);
+
+
 /**
  * Compare a peer certificate with a given MD5 checksum
  * @param C An SSL connection object
@@ -138,6 +172,19 @@ int Ssl_read(T C, void *b, int size, int timeout);
 boolean_t Ssl_checkCertificate(T C, char *md5sum);
 
 
+/**
+ * Get the expiry of the peer certificate chain, i.e. the notAfter time of
+ * the certificate in the chain which expires first. The parsed chain is
+ * cached by the SHA1 fingerprint of the peer certificate, so it's parsed
+ * again only when the server presents a different certificate
+ * @param C An SSL connection object
+ * @param subject A buffer for the subject of the first expiring certificate
+ * @param subjectlength The subject buffer length
+ * @return The notAfter time or 0 if the peer certificate is not available
+ */
+time_t Ssl_getCertificateExpiry(T C, char *subject, int subjectlength);
+
+
 #undef T
 #endif
 
@@ -35,6 +35,7 @@ typedef struct T {
         Ssl_Version version;            /**< The SSL version to use for connection */
         char *certmd5;       /**< The expected md5 sum of the server's certificate */
         char *clientpemfile;                      /**< Optional client certificate */
+        const char *alpn;                  /**< Optional ALPN application protocol */
 } T;
 
 
@@ -48,12 +48,22 @@
 #include <errno.h>
 #endif
 
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 
 
 #include "monit.h"
 #include "state.h"
+#include "instance.h"
 
 // libmonit
+#include "system/Time.h"
 #include "exceptions/IOException.h"
 
 
@@ -79,7 +89,9 @@
  *
  *    4.) inode number and read position for the file check
  *        Allows to skip the content match test for the content which was checked
- *        already to suppress duplicate events.
+ *        already to suppress duplicate events. The file instances of the file
+ *        service with a wildcard path are saved after the service list, named
+ *        after the template and the file path, and restored into the template.
  *
  * Data is stored in binary form in the statefile using the following format:
  *    <MAGIC><VERSION>{<SERVICE_STATE>}+
@@ -88,6 +100,11 @@
  * with State_update() and State_save(). The version allows to recognize the
  * service state structure and file format.
  *
+ * The statefile is memory mapped when saved, each service has a fixed slot in
+ * the record table (by its position in the service list), so State_save() only
+ * touches the records which changed. The file is synchronized to disk if some
+ * record changed and the "set statefile ... sync every" interval elapsed.
+ *
  * The backward compatibility of monitoring state restore is very important if
  * Monit runs in cluster => keep previous formats compatibility.
  *
@@ -135,6 +152,15 @@ typedef struct mystate1 {
 static int file = -1;
 
 
+/* The memory mapped statefile */
+static struct {
+        void *data;                                             /**< Mapped file */
+        size_t size;                                       /**< Mapped file size */
+        boolean_t dirty;                        /**< Changed since the last sync */
+        time_t synced;                                   /**< The last sync time */
+} map = {.data = MAP_FAILED};
+
+
 /* ----------------------------------------------------------------- Private */
 
 
@@ -144,6 +170,7 @@ static void update_v0(int services) {
                 if (read(file, &state, sizeof(state)) != sizeof(state))
                         THROW(IOException, "Unable to read service state");
                 Service_T service;
+                state.name[sizeof(state.name) - 1] = 0;
                 if ((service = Util_getService(state.name))) {
                         service->nstart = state.nstart;
                         service->ncycle = state.ncycle;
@@ -160,6 +187,7 @@ static void update_v1() {
         State1_T state;
         while (read(file, &state, sizeof(state)) == sizeof(state)) {
                 Service_T service;
+                state.name[sizeof(state.name) - 1] = 0;
                 if ((service = Util_getService(state.name)) && service->type == state.type) {
                         service->nstart = state.nstart;
                         service->ncycle = state.ncycle;
@@ -171,11 +199,53 @@ static void update_v1() {
                                 service->inf->priv.file.inode = state.priv.file.inode;
                                 service->inf->priv.file.readpos = state.priv.file.readpos;
                         }
+                } else if (! service && state.type == Service_File) {
+                        Instance_restoreFile(state.name, state.priv.file.inode, state.priv.file.readpos);
                 }
         }
 }
 
 
+static void _record(State1_T *record, Service_T service) {
+        State1_T state;
+        memset(&state, 0, sizeof(state));
+        snprintf(state.name, sizeof(state.name), "%s", service->name);
+        state.type = service->type;
+        state.monitor = service->monitor & ~(Monitor_Waiting | Monitor_Suppressed);
+        state.nstart = service->nstart;
+        state.ncycle = service->ncycle;
+        if (service->type == Service_File) {
+                state.priv.file.inode = service->inf->priv.file.inode;
+                state.priv.file.readpos = service->inf->priv.file.readpos;
+        }
+        // Only the changed records are written, the unchanged pages stay clean
+        if (memcmp(record, &state, sizeof(state))) {
+                memcpy(record, &state, sizeof(state));
+                map.dirty = true;
+        }
+}
+
+
+static void _sync() {
+        if (map.dirty && map.data != MAP_FAILED) {
+                if (msync(map.data, map.size, MS_SYNC))
+                        LogError("State file '%s': unable to sync -- %s\n", Run.statefile, STRERROR);
+                map.dirty = false;
+                map.synced = Time_now();
+        }
+}
+
+
+static void _unmap() {
+        if (map.data != MAP_FAILED) {
+                _sync();
+                munmap(map.data, map.size);
+                map.data = MAP_FAILED;
+                map.size = 0;
+        }
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
@@ -191,6 +261,7 @@ boolean_t State_open() {
 
 
 void State_close() {
+        _unmap();
         if (file != -1) {
                 if (close(file) == -1)
                         LogError("State file '%s': close error -- %s\n", Run.statefile, STRERROR);
@@ -201,42 +272,47 @@ void State_close() {
 
 
 void State_save() {
+        // The file instances are written by the template check
+        Instance_lock();
         TRY
         {
-                if (ftruncate(file, 0L) == -1)
-                        THROW(IOException, "Unable to truncate");
-                if (lseek(file, 0L, SEEK_SET) == -1)
-                        THROW(IOException, "Unable to seek");
-                int magic = 0;
-                if (write(file, &magic, sizeof(magic)) != sizeof(magic))
-                        THROW(IOException, "Unable to write magic");
-                // Save always using the latest format version
-                int version = StateVersion1;
-                if (write(file, &version, sizeof(version)) != sizeof(version))
-                        THROW(IOException, "Unable to write format version");
+                int services = 0;
                 for (Service_T service = servicelist; service; service = service->next) {
-                        State1_T state;
-                        memset(&state, 0, sizeof(state));
-                        snprintf(state.name, sizeof(state.name), "%s", service->name);
-                        state.type = service->type;
-                        state.monitor = service->monitor & ~Monitor_Waiting;
-                        state.nstart = service->nstart;
-                        state.ncycle = service->ncycle;
-                        if (service->type == Service_File) {
-                                state.priv.file.inode = service->inf->priv.file.inode;
-                                state.priv.file.readpos = service->inf->priv.file.readpos;
-                        }
-                        if (write(file, &state, sizeof(state)) != sizeof(state))
-                                THROW(IOException, "Unable to write service state");
+                        services++;
+                        if (service->type == Service_File && service->instance.max)
+                                services += service->instance.count;
+                }
+                size_t size = 2 * sizeof(int) + services * sizeof(State1_T);
+                if (map.data == MAP_FAILED || map.size != size) {
+                        // (Re)create the record table for the current service list
+                        _unmap();
+                        if (ftruncate(file, size) == -1)
+                                THROW(IOException, "Unable to resize -- %s", STRERROR);
+                        if ((map.data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0)) == MAP_FAILED)
+                                THROW(IOException, "Unable to map -- %s", STRERROR);
+                        map.size = size;
+                        map.dirty = true;
+                        map.synced = 0;
+                        // Save always using the latest format version
+                        int header[2] = {0, StateVersion1};
+                        memcpy(map.data, header, sizeof(header));
+                }
+                State1_T *record = (State1_T *)((char *)map.data + 2 * sizeof(int));
+                for (Service_T service = servicelist; service; service = service->next) {
+                        _record(record++, service);
+                        if (service->type == Service_File && service->instance.max)
+                                for (Service_T instance = service->instance.list; instance; instance = instance->next)
+                                        _record(record++, instance);
                 }
-                if (fsync(file))
-                        THROW(IOException, "Unable to sync -- %s", STRERROR);
+                if (map.dirty && Time_now() - map.synced >= Run.statesync)
+                        _sync();
         }
         ELSE
         {
                 LogError("State file '%s': %s\n", Run.statefile, Exception_frame.message);
         }
         END_TRY;
+        Instance_unlock();
 }
 
 
@@ -57,6 +57,7 @@
 #include "socket.h"
 #include "process.h"
 #include "device.h"
+#include "snapshot.h"
 
 
 /**
@@ -78,6 +79,9 @@ boolean_t status(char *level) {
                 LogError("Status not available -- the monit daemon is not running\n");
                 return status;
         }
+        /* The status file published by the daemon is formatted locally, without a request to the daemon */
+        if (Snapshot_print(IS(level, LEVEL_NAME_SUMMARY) ? Level_Summary : Level_Full))
+                return true;
         Socket_T S = NULL;
         if (Run.httpd.flags & Httpd_Net)
                 // FIXME: Monit HTTP support IPv4 only currently ... when IPv6 is implemented change the family to Socket_Ip
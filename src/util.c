@@ -32,6 +32,14 @@
 #include <stdarg.h>
 #endif
 
+#ifdef HAVE_STDDEF_H
+#include <stddef.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
@@ -80,6 +88,10 @@
 #include <sys/stat.h>
 #endif
 
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
 #ifdef HAVE_CRYPT_H
 #include <crypt.h>
 #endif
@@ -108,6 +120,14 @@
 #include <grp.h>
 #endif
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+
 #include "monit.h"
 #include "engine.h"
 #include "md5.h"
@@ -116,6 +136,7 @@
 #include "base64.h"
 #include "alert.h"
 #include "process.h"
+#include "cgroup.h"
 #include "event.h"
 #include "state.h"
 
@@ -130,6 +151,35 @@ struct ad_user {
 };
 
 
+/* Size of the read buffer used for the file digests computation; must be a multiple of 64 */
+#define HASHBLOCKSIZE 65536
+
+
+/* The check results table slots are aligned to the cache line size */
+#define CACHE_LINE 64
+
+
+/* The MD5 and SHA1 computation contexts. If OpenSSL is available, its EVP interface is used as it selects the CPU accelerated implementation (e.g. SHA-NI or ARMv8 crypto extensions) at runtime; the builtin implementation is the fallback */
+struct digests {
+        boolean_t md5;                               /**< true if MD5 is computed */
+        boolean_t sha1;                             /**< true if SHA1 is computed */
+#ifdef HAVE_OPENSSL
+        EVP_MD_CTX *evp_md5;                /**< OpenSSL MD5 context or NULL */
+        EVP_MD_CTX *evp_sha1;              /**< OpenSSL SHA1 context or NULL */
+#endif
+        md5_context_t ctx_md5;                         /**< Builtin MD5 context */
+        sha1_context_t ctx_sha1;                      /**< Builtin SHA1 context */
+};
+
+
+/* The service name -> service open addressing hash table, maintained by the parser */
+static struct {
+        int count;                                    /**< Number of indexed services */
+        int size;                                           /**< Hash table size */
+        Service_T *service;                                      /**< Hash table */
+} serviceindex;
+
+
 /* Unsafe URL characters: <>\"#%{}|\\^[] ` */
 static const unsigned char urlunsafe[256] = {
         1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
@@ -206,6 +256,25 @@ static char *is_str_defined(char *s) {
 }
 
 
+/**
+ * Case insensitive hash of the service name (the names are compared with IS())
+ */
+static unsigned int _serviceHash(const char *name) {
+        unsigned int h = 2166136261U;
+        while (*name)
+                h = (h ^ (unsigned char)tolower((unsigned char)*name++)) * 16777619U;
+        return h;
+}
+
+
+static void _serviceIndexInsert(Service_T s) {
+        unsigned int i = _serviceHash(s->name) % serviceindex.size;
+        while (serviceindex.service[i])
+                i = (i + 1) % serviceindex.size;
+        serviceindex.service[i] = s;
+}
+
+
 /**
  * Convert a hex char to a char
  */
@@ -412,6 +481,112 @@ static Auth_T PAMcheckUserGroup(const char *uname) {
 #endif
 
 
+static void _initDigests(struct digests *d) {
+#ifdef HAVE_OPENSSL
+        /* Fallback to the builtin implementation if the OpenSSL digest is not available (e.g. MD5 in FIPS mode) */
+        if (d->md5 && (d->evp_md5 = EVP_MD_CTX_create()) && ! EVP_DigestInit_ex(d->evp_md5, EVP_md5(), NULL)) {
+                EVP_MD_CTX_destroy(d->evp_md5);
+                d->evp_md5 = NULL;
+        }
+        if (d->sha1 && (d->evp_sha1 = EVP_MD_CTX_create()) && ! EVP_DigestInit_ex(d->evp_sha1, EVP_sha1(), NULL)) {
+                EVP_MD_CTX_destroy(d->evp_sha1);
+                d->evp_sha1 = NULL;
+        }
+        if (d->md5 && ! d->evp_md5)
+                md5_init(&d->ctx_md5);
+        if (d->sha1 && ! d->evp_sha1)
+                sha1_init(&d->ctx_sha1);
+#else
+        if (d->md5)
+                md5_init(&d->ctx_md5);
+        if (d->sha1)
+                sha1_init(&d->ctx_sha1);
+#endif
+}
+
+
+static void _updateDigests(struct digests *d, const unsigned char *data, size_t length) {
+#ifdef HAVE_OPENSSL
+        if (d->evp_md5)
+                EVP_DigestUpdate(d->evp_md5, data, length);
+        else
+#endif
+        if (d->md5)
+                md5_append(&d->ctx_md5, (const md5_byte_t *)data, (int)length);
+#ifdef HAVE_OPENSSL
+        if (d->evp_sha1)
+                EVP_DigestUpdate(d->evp_sha1, data, length);
+        else
+#endif
+        if (d->sha1)
+                sha1_append(&d->ctx_sha1, data, length);
+}
+
+
+static void _finishDigests(struct digests *d, void *sha1_resblock, void *md5_resblock) {
+#ifdef HAVE_OPENSSL
+        if (d->evp_md5) {
+                EVP_DigestFinal_ex(d->evp_md5, md5_resblock, NULL);
+                EVP_MD_CTX_destroy(d->evp_md5);
+        } else
+#endif
+        if (d->md5)
+                md5_finish(&d->ctx_md5, md5_resblock);
+#ifdef HAVE_OPENSSL
+        if (d->evp_sha1) {
+                EVP_DigestFinal_ex(d->evp_sha1, sha1_resblock, NULL);
+                EVP_MD_CTX_destroy(d->evp_sha1);
+        } else
+#endif
+        if (d->sha1)
+                sha1_finish(&d->ctx_sha1, sha1_resblock);
+}
+
+
+/**
+ * Get the pid from the pidfile of the process service. The parsed pid is
+ * reused while the pidfile's inode, size, modification and change time are
+ * the same, so an unchanged pidfile costs one stat. The pidfile modified
+ * within the last second is read again, as a rewrite in the same second
+ * doesn't have to change the times. If the pid was reused by another
+ * process while the pidfile didn't change (see update_process_data), the
+ * pidfile is stale and the process is not running
+ */
+static pid_t _getPidCached(Service_T s) {
+        ASSERT(s->pidfile);
+        struct stat st;
+        if (stat(s->path, &st) == -1) {
+                DEBUG("pidfile '%s' does not exist\n", s->path);
+                s->pidfile->pid = 0;
+                return 0;
+        }
+        if (! S_ISREG(st.st_mode)) {
+                LogError("pidfile '%s' is not a regular file\n", s->path);
+                s->pidfile->pid = 0;
+                return 0;
+        }
+        boolean_t changed = s->pidfile->device != st.st_dev || s->pidfile->inode != st.st_ino || s->pidfile->size != st.st_size || s->pidfile->mtime != st.st_mtime || s->pidfile->ctime != st.st_ctime;
+        if (s->pidfile->pid <= 0 || changed || Time_now() - st.st_mtime <= 1) {
+                pid_t pid = Util_getPid(s->path);
+                if (changed || pid != s->pidfile->pid) {
+                        s->pidfile->starttime = 0;
+                        s->pidfile->stale = false;
+                }
+                s->pidfile->device = st.st_dev;
+                s->pidfile->inode = st.st_ino;
+                s->pidfile->size = st.st_size;
+                s->pidfile->mtime = st.st_mtime;
+                s->pidfile->ctime = st.st_ctime;
+                s->pidfile->pid = pid;
+        }
+        if (s->pidfile->stale) {
+                DEBUG("'%s' pidfile '%s' is stale -- the pid %d belongs to another process\n", s->name, s->path, (int)s->pidfile->pid);
+                return 0;
+        }
+        return s->pidfile->pid;
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
@@ -579,73 +754,40 @@ char *Util_digest2Bytes(unsigned char *digest, int mdlen, MD_T result) {
 }
 
 
-boolean_t Util_getStreamDigests(FILE *stream, void *sha1_resblock, void *md5_resblock) {
-#define HASHBLOCKSIZE 4096
-        md5_context_t ctx_md5;
-        sha1_context_t ctx_sha1;
-        unsigned char buffer[HASHBLOCKSIZE + 72];
-        size_t sum;
-
-        /* Initialize the computation contexts */
-        if (md5_resblock)
-                md5_init(&ctx_md5);
-        if (sha1_resblock)
-                sha1_init(&ctx_sha1);
-
-        /* Iterate over full file contents */
-        while (1)  {
-                /* We read the file in blocks of HASHBLOCKSIZE bytes. One call of the computation function processes the whole buffer so that with the next round of the loop another block can be read */
-                size_t n;
-                sum = 0;
+boolean_t Util_getDigests(int fd, void *sha1_resblock, void *md5_resblock) {
+        struct digests d = {.md5 = md5_resblock != NULL, .sha1 = sha1_resblock != NULL};
+        boolean_t rv = true;
 
-                /* Read block. Take care for partial reads */
-                while (1) {
-                        n = fread(buffer + sum, 1, HASHBLOCKSIZE - sum, stream);
-                        sum += n;
-                        if (sum == HASHBLOCKSIZE)
-                                break;
-                        if (n == 0) {
-                                /* Check for the error flag IFF N == 0, so that we don't exit the loop after a partial read due to e.g., EAGAIN or EWOULDBLOCK */
-                                if (ferror(stream))
-                                        return false;
-                                goto process_partial_block;
-                        }
-
-                        /* We've read at least one byte, so ignore errors. But always check for EOF, since feof may be true even though N > 0. Otherwise, we could end up calling fread after EOF */
-                        if (feof(stream))
-                                goto process_partial_block;
+        _initDigests(&d);
+#ifdef HAVE_POSIX_FADVISE
+        /* Hint the kernel to use a larger readahead, the file is read only once */
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        unsigned char *buffer = ALLOC(HASHBLOCKSIZE);
+        /* Both digests are computed in the same pass over the file */
+        while (1) {
+                ssize_t n = read(fd, buffer, HASHBLOCKSIZE);
+                if (n > 0) {
+                        _updateDigests(&d, buffer, n);
+                } else if (n == 0) {
+                        break;
+                } else if (errno != EINTR && errno != EAGAIN) {
+                        rv = false;
+                        break;
                 }
-
-                /* Process buffer with HASHBLOCKSIZE bytes. Note that HASHBLOCKSIZE % 64 == 0 */
-                if (md5_resblock)
-                        md5_append(&ctx_md5, (const md5_byte_t *)buffer, HASHBLOCKSIZE);
-                if (sha1_resblock)
-                        sha1_append(&ctx_sha1, buffer, HASHBLOCKSIZE);
-        }
-
-process_partial_block:
-        /* Process any remaining bytes */
-        if (sum > 0) {
-                if (md5_resblock)
-                        md5_append(&ctx_md5, (const md5_byte_t *)buffer, (int)sum);
-                if (sha1_resblock)
-                        sha1_append(&ctx_sha1, buffer, sum);
-        }
-        /* Construct result in desired memory */
-        if (md5_resblock)
-                md5_finish(&ctx_md5, md5_resblock);
-        if (sha1_resblock)
-                sha1_finish(&ctx_sha1, sha1_resblock);
-        return true;
+        }
+        FREE(buffer);
+        _finishDigests(&d, sha1_resblock, md5_resblock);
+        return rv;
 }
 
 
 void Util_printHash(char *file) {
         MD_T hash;
         unsigned char sha1[STRLEN], md5[STRLEN];
-        FILE *fhandle = NULL;
+        int fd;
 
-        if (! (fhandle = file ? fopen(file, "r") : stdin) || ! Util_getStreamDigests(fhandle, sha1, md5) || (file && fclose(fhandle))) {
+        if ((fd = file ? open(file, O_RDONLY) : STDIN_FILENO) == -1 || ! Util_getDigests(fd, sha1, md5) || (file && close(fd))) {
                 printf("%s: %s\n", file, STRERROR);
                 exit(1);
         }
@@ -674,29 +816,30 @@ boolean_t Util_getChecksum(char *file, Hash_Type hashtype, char *buf, int bufsiz
         }
 
         if (File_isFile(file)) {
-                FILE *f = fopen(file, "r");
-                if (f) {
+                int fd = open(file, O_RDONLY);
+                if (fd != -1) {
                         boolean_t fresult = false;
                         MD_T sum;
 
                         switch (hashtype) {
                                 case Hash_Md5:
-                                        fresult = Util_getStreamDigests(f, NULL, sum);
+                                        fresult = Util_getDigests(fd, NULL, sum);
                                         break;
                                 case Hash_Sha1:
-                                        fresult = Util_getStreamDigests(f, sum, NULL);
+                                        fresult = Util_getDigests(fd, sum, NULL);
                                         break;
                                 default:
                                         break;
                         }
 
-                        if (fclose(f))
+                        if (! fresult)
+                                LogError("checksum: file %s read error -- %s\n", file, STRERROR);
+
+                        if (close(fd))
                                 LogError("checksum: error closing file '%s' -- %s\n", file, STRERROR);
 
-                        if (! fresult) {
-                                LogError("checksum: file %s stream error (0x%x)\n", file, fresult);
+                        if (! fresult)
                                 return false;
-                        }
 
                         Util_digest2Bytes((unsigned char *)sum, hashlength, buf);
                         return true;
@@ -709,6 +852,68 @@ boolean_t Util_getChecksum(char *file, Hash_Type hashtype, char *buf, int bufsiz
 }
 
 
+char *Util_getRegexLiteral(const char *pattern) {
+        if (strchr(pattern, '|'))
+                return NULL;
+        int length = (int)strlen(pattern);
+        char *best = CALLOC(1, length + 1);
+        char *current = CALLOC(1, length + 1);
+        int bestlength = 0, currentlength = 0, depth = 0;
+        boolean_t literal = false;
+        for (const char *p = pattern; ; p++) {
+                char c = 0;
+                if (! *p) {
+                        // End of the pattern: close the last run
+                } else if (*p == '\\' && p[1]) {
+                        p++;
+                        if (! isalnum((unsigned char)*p) && ! depth)
+                                c = *p;
+                } else if (*p == '[') {
+                        /* Skip the bracket expression, the ']' right after '[' or '[^' is part of the list */
+                        if (*++p == '^')
+                                p++;
+                        if (*p == ']')
+                                p++;
+                        while (*p && *p != ']')
+                                p++;
+                        if (! *p)
+                                p--;
+                } else if (*p == '*' || *p == '?' || *p == '{') {
+                        /* The previous character is optional */
+                        if (literal)
+                                currentlength--;
+                        if (*p == '{')
+                                while (p[1] && *p != '}')
+                                        p++;
+                } else if (*p == '(') {
+                        depth++;
+                } else if (*p == ')') {
+                        depth--;
+                } else if (! strchr(".^$+\\", *p) && ! depth) {
+                        c = *p;
+                }
+                if (c) {
+                        current[currentlength++] = c;
+                        literal = true;
+                } else {
+                        if (currentlength > bestlength) {
+                                memcpy(best, current, currentlength);
+                                best[currentlength] = 0;
+                                bestlength = currentlength;
+                        }
+                        currentlength = 0;
+                        literal = false;
+                }
+                if (! *p)
+                        break;
+        }
+        FREE(current);
+        if (! bestlength)
+                FREE(best);
+        return best;
+}
+
+
 void Util_hmacMD5(const unsigned char *data, int datalen, const unsigned char *key, int keylen, unsigned char *digest) {
         md5_context_t ctx;
         md5_init(&ctx);
@@ -749,19 +954,87 @@ void Util_hmacMD5(const unsigned char *data, int datalen, const unsigned char *k
 
 
 Service_T Util_getService(const char *name) {
-        Service_T s;
-
         ASSERT(name);
-
-        for (s = servicelist; s; s = s->next) {
-                if (IS(s->name, name)) {
-                        return s;
-                }
+        if (serviceindex.count) {
+                for (unsigned int i = _serviceHash(name) % serviceindex.size; serviceindex.service[i]; i = (i + 1) % serviceindex.size)
+                        if (IS(serviceindex.service[i]->name, name))
+                                return serviceindex.service[i];
+                return NULL;
         }
+        for (Service_T s = servicelist; s; s = s->next)
+                if (IS(s->name, name))
+                        return s;
         return NULL;
 }
 
 
+void Util_addServiceIndex(Service_T s) {
+        ASSERT(s);
+        ASSERT(s->name);
+        // Keep the load factor below 1/2
+        if (2 * (serviceindex.count + 1) > serviceindex.size) {
+                Service_T *old = serviceindex.service;
+                int oldsize = serviceindex.size;
+                serviceindex.size = oldsize ? 2 * oldsize + 1 : 127;
+                serviceindex.service = CALLOC(serviceindex.size, sizeof(Service_T));
+                for (int i = 0; i < oldsize; i++)
+                        if (old[i])
+                                _serviceIndexInsert(old[i]);
+                FREE(old);
+        }
+        _serviceIndexInsert(s);
+        serviceindex.count++;
+}
+
+
+void Util_resetServiceIndex() {
+        FREE(serviceindex.service);
+        serviceindex.size = serviceindex.count = 0;
+}
+
+
+size_t Util_getInfoSize(Service_Type type) {
+        switch (type) {
+                case Service_Filesystem:
+                        return offsetof(struct myinfo, priv) + sizeof(((Info_T)0)->priv.filesystem);
+                case Service_File:
+                        return offsetof(struct myinfo, priv) + sizeof(((Info_T)0)->priv.file);
+                case Service_Directory:
+                        return offsetof(struct myinfo, priv) + sizeof(((Info_T)0)->priv.directory);
+                case Service_Fifo:
+                        return offsetof(struct myinfo, priv) + sizeof(((Info_T)0)->priv.fifo);
+                case Service_Net:
+                        return offsetof(struct myinfo, priv) + sizeof(((Info_T)0)->priv.net);
+                default:
+                        // Process, cgroup and system services and the generic readers (history, sampler) use the process data
+                        return offsetof(struct myinfo, priv) + sizeof(((Info_T)0)->priv.process);
+        }
+}
+
+
+static size_t _infoStride(Service_Type type) {
+        return (Util_getInfoSize(type) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+}
+
+
+void Util_buildInfoTable() {
+        ASSERT(! Run.infotable);
+        size_t size = 0;
+        for (Service_T s = servicelist; s; s = s->next)
+                size += _infoStride(s->type);
+        Run.infotable = CALLOC(1, size + CACHE_LINE);
+        char *slot = (char *)(((uintptr_t)Run.infotable + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+        int ordinal = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                memcpy(slot, s->inf, Util_getInfoSize(s->type));
+                FREE(s->inf);
+                s->inf = (Info_T)slot;
+                s->ordinal = ordinal++;
+                slot += _infoStride(s->type);
+        }
+}
+
+
 int Util_getNumberOfServices() {
         int i = 0;
         Service_T s;
@@ -784,13 +1057,52 @@ void Util_printRunList() {
         printf(" %-18s = %s\n", "Pid file", is_str_defined(Run.pidfile));
         printf(" %-18s = %s\n", "Id file", is_str_defined(Run.idfile));
         printf(" %-18s = %s\n", "State file", is_str_defined(Run.statefile));
+        if (Run.statesync > 0)
+                printf(" %-18s = every %d seconds\n", "State file sync", Run.statesync);
+        if (Run.historyfile)
+                printf(" %-18s = %s (%d slots)\n", "History file", Run.historyfile, Run.historyslots);
+        if (Run.statusfile)
+                printf(" %-18s = %s\n", "Status file", Run.statusfile);
         printf(" %-18s = %s\n", "Debug", Run.debug ? "True" : "False");
         printf(" %-18s = %s\n", "Log", Run.dolog ? "True" : "False");
         printf(" %-18s = %s\n", "Use syslog", Run.use_syslog ? "True" : "False");
+        if (Run.jsonlog)
+                printf(" %-18s = %s\n", "Log format", "JSON");
         printf(" %-18s = %s\n", "Is Daemon", Run.isdaemon ? "True" : "False");
         printf(" %-18s = %s\n", "Use process engine", Run.doprocess ? "True" : "False");
         printf(" %-18s = %d seconds with start delay %d seconds\n", "Poll time", Run.polltime, Run.startdelay);
         printf(" %-18s = %d bytes\n", "Expect buffer", Run.expectbuffer);
+        printf(" %-18s = %d bytes\n", "Socket buffer", Run.socketbuffer);
+        if (Run.scheduler_workers > 1)
+                printf(" %-18s = %d workers\n", "Check scheduler", Run.scheduler_workers);
+        else
+                printf(" %-18s = serial\n", "Check scheduler");
+        printf(" %-18s = %s\n", "Process events", Run.processevents ? "True" : "False");
+        printf(" %-18s = %s\n", "Program events", Run.programevents ? "True" : "False");
+        if (Run.programlimit > 0)
+                printf(" %-18s = %d programs\n", "Program limit", Run.programlimit);
+        printf(" %-18s = %s\n", "File events", Run.fileevents ? "True" : "False");
+        printf(" %-18s = %s\n", "Network events", Run.networkevents ? "True" : "False");
+        printf(" %-18s = %s\n", "M/Monit relay", Run.relay ? "True" : "False");
+        printf(" %-18s = %s\n", "Power save", Run.powersave ? "True" : "False");
+        printf(" %-18s = %s\n", "Depend suppression", Run.dependsuppress ? "True" : "False");
+        if (Run.cluster.peers) {
+                for (Peer_T p = Run.cluster.peers; p; p = p->next)
+                        printf(" %-18s = %s\n", "Cluster peer", p->url->url);
+                printf(" %-18s = %d\n", "Cluster replicas", Run.cluster.replicas);
+        }
+        if (Run.control_workers > 1)
+                printf(" %-18s = %d workers\n", "Service control", Run.control_workers);
+        if (Run.process_workers > 1)
+                printf(" %-18s = %d workers\n", "Process table", Run.process_workers);
+        if (Run.spawnlimit > 0)
+                printf(" %-18s = %d programs\n", "Spawn limit", Run.spawnlimit);
+        if (Run.restartlimit > 0)
+                printf(" %-18s = %d services per cycle\n", "Restart limit", Run.restartlimit);
+        if (Run.dnscache > 0)
+                printf(" %-18s = max age %d seconds\n", "DNS cache", Run.dnscache);
+        else
+                printf(" %-18s = disabled\n", "DNS cache");
 
         if (Run.eventlist_dir) {
                 char slots[STRLEN];
@@ -802,15 +1114,19 @@ void Util_printRunList() {
 
                 printf(" %-18s = base directory %s with %s slots\n",
                        "Event queue", Run.eventlist_dir, slots);
+                if (Run.eventlist_buffer > 0)
+                        printf(" %-18s = %d events\n", "Event buffer", Run.eventlist_buffer);
+                printf(" %-18s = %d events per cycle, %d events per batch\n", "Event replay", Run.eventlist_replay, Run.eventlist_batch);
         }
 
         if (Run.mmonits) {
                 Mmonit_T c;
                 printf(" %-18s = ", "M/Monit(s)");
                 for (c = Run.mmonits; c; c = c->next) {
-                        printf("%s with timeout %d seconds%s%s%s%s%s%s",
+                        printf("%s with timeout %d seconds%s%s%s%s%s%s%s",
                                c->url->url,
                                c->timeout / 1000,
+                               c->json ? " format json" : "",
                                (c->ssl.use_ssl && c->ssl.version) ? " ssl version " : "",
                                (c->ssl.use_ssl && c->ssl.version) ? sslnames[c->ssl.version] : "",
                                c->ssl.certmd5 ? " server cert md5 sum " : "",
@@ -820,6 +1136,12 @@ void Util_printRunList() {
                 }
                 if (! Run.dommonitcredentials)
                         printf("\n                      register without credentials");
+                if (Run.mmonitdelta)
+                        printf("\n                      delta status reports, full every %d cycles", Run.mmonitdelta);
+                if (Run.mmonitjitter)
+                        printf("\n                      heartbeat jitter %d seconds", Run.mmonitjitter);
+                if (Run.mmonitparallel != Mmonit_Sequential)
+                        printf("\n                      parallel, %s success", Run.mmonitparallel == Mmonit_AllSuccess ? "all" : "first");
                 printf("\n");
         }
 
@@ -852,15 +1174,22 @@ void Util_printRunList() {
                         printf(" %-18s = %s\n", "httpd bind address", Run.httpd.socket.net.address ? Run.httpd.socket.net.address : "Any/All");
                         printf(" %-18s = %d\n", "httpd portnumber", Run.httpd.socket.net.port);
                         printf(" %-18s = %s\n", "httpd ssl", Run.httpd.flags & Httpd_Ssl ? "Enabled" : "Disabled");
-                } else if (Run.httpd.flags & Httpd_Unix) {
-                        printf(" %-18s = %s\n", "httpd unix socket", Run.httpd.socket.unix.path);
                 }
+                if (Run.httpd.flags & Httpd_Unix)
+                        printf(" %-18s = %s\n", "httpd unix socket", Run.httpd.socket.unix.path);
+                printf(" %-18s = %d\n", "httpd workers", Run.httpd.workers);
+                printf(" %-18s = %d\n", "httpd max conns", Run.httpd.maxconnections);
                 printf(" %-18s = %s\n", "httpd signature", Run.httpd.flags & Httpd_Signature ? "Enabled" : "Disabled");
                 if (Run.httpd.flags & Httpd_Ssl) {
                         printf(" %-18s = %s\n", "PEM key/cert file", Run.httpd.socket.net.ssl.pem);
                         if (Run.httpd.socket.net.ssl.clientpem)
                                 printf(" %-18s = %s\n", "Client cert file", Run.httpd.socket.net.ssl.clientpem);
                         printf(" %-18s = %s\n", "Allow self certs", (Run.httpd.flags & Httpd_AllowSelfSignedCertificates) ? "True" : "False");
+                        if (Run.httpd.socket.net.ssl.sessioncache > 0)
+                                printf(" %-18s = %d sessions, timeout %ds\n", "SSL session cache", Run.httpd.socket.net.ssl.sessioncache, Run.httpd.socket.net.ssl.sessiontimeout);
+                        else
+                                printf(" %-18s = %s\n", "SSL session cache", "Disabled");
+                        printf(" %-18s = %s\n", "SSL tickets", (Run.httpd.flags & Httpd_SessionTickets) ? "Enabled" : "Disabled");
                 }
 
                 printf(" %-18s = %s\n", "httpd auth. style",
@@ -905,17 +1234,31 @@ void Util_printService(Service_T s) {
         if (sgheader)
                 printf("\n");
 
-        if (s->type == Service_Process) {
+        if (s->type == Service_Process || s->type == Service_Processes) {
                 if (s->matchlist)
                         printf(" %-20s = %s\n", "Match", s->path);
                 else
                         printf(" %-20s = %s\n", "Pid file", s->path);
+                if (s->cgroup)
+                        printf(" %-20s = %s\n", "Totals", "from the process cgroup");
+                if (s->instance.max)
+                        printf(" %-20s = %d at maximum\n", "Process instances", s->instance.max);
         } else if (s->type == Service_Host) {
                 printf(" %-20s = %s\n", "Address", s->path);
         } else if (s->type == Service_Net) {
                 printf(" %-20s = %s\n", "Interface", s->path);
+        } else if (s->type == Service_Cgroup) {
+                printf(" %-20s = %s\n", "Cgroup", s->path);
+        } else if (s->type == Service_Filesystem && s->instance.max) {
+                printf(" %-20s = all", "Mounts");
+                for (int i = 0; s->instance.excluded && s->instance.excluded[i]; i++)
+                        printf("%s%s", i ? ", " : " excluding type ", s->instance.excluded[i]);
+                printf("\n");
+                printf(" %-20s = %d at maximum\n", "Filesystem instances", s->instance.max);
         } else if (s->type != Service_System) {
                 printf(" %-20s = %s\n", "Path", s->path);
+                if (s->type == Service_File && s->instance.max)
+                        printf(" %-20s = %d at maximum\n", "File instances", s->instance.max);
         }
         printf(" %-20s = %s\n", "Monitoring mode", modenames[s->mode]);
         if (s->start) {
@@ -980,8 +1323,13 @@ void Util_printService(Service_T s) {
         }
 
         if (s->type == Service_Program) {
-                printf(" %-20s = ", "Program timeout");
-                printf("terminate the program if not finished within %d seconds\n", s->program->timeout);
+                if (s->program->plugin) {
+                        printf(" %-20s = ", "Plugin timeout");
+                        printf("fail the check if not finished within %d seconds\n", s->program->timeout);
+                } else {
+                        printf(" %-20s = ", "Program timeout");
+                        printf("terminate the program if not finished within %d seconds\n", s->program->timeout);
+                }
                 for (Status_T o = s->statuslist; o; o = o->next) {
                         StringBuffer_clear(buf);
                         if (o->operator == Operator_Changed)
@@ -993,13 +1341,15 @@ void Util_printService(Service_T s) {
 
         if (s->checksum && s->checksum->action) {
                 StringBuffer_clear(buf);
-                printf(" %-20s = %s\n", "Checksum",
+                printf(" %-20s = %s\n", s->checksum->tree ? "Checksum tree" : "Checksum",
                        s->checksum->test_changes
                        ?
                        StringBuffer_toString(Util_printRule(buf, s->checksum->action, "if changed %s", checksumnames[s->checksum->type]))
                        :
                        StringBuffer_toString(Util_printRule(buf, s->checksum->action, "if failed %s(%s)", s->checksum->hash, checksumnames[s->checksum->type]))
                        );
+                if (s->checksum->verify)
+                        printf(" %-20s = every %d cycle(s)\n", "Checksum verify", s->checksum->verify);
         }
 
         if (s->perm && s->perm->action) {
@@ -1051,6 +1401,14 @@ void Util_printService(Service_T s) {
                         printf(" %-20s = %s\n", "Port", StringBuffer_toString(Util_printRule(buf, o->action, "if failed [%s]:%d%s type %s/%s protocol %s with timeout %d seconds", o->hostname, o->port, o->request ? o->request : "", Util_portTypeDescription(o), Util_portIpDescription(o), o->protocol->name, o->timeout / 1000)));
                 if (o->SSL.certmd5 != NULL)
                         printf(" %-20s = %s\n", "Server cert md5 sum", o->SSL.certmd5);
+                if (o->certificate.days)
+                        printf(" %-20s = more than %d days\n", "Certificate valid", o->certificate.days);
+                if (o->fullevery > 1)
+                        printf(" %-20s = every %d cycles\n", "Full protocol test", o->fullevery);
+                if (o->recheck)
+                        printf(" %-20s = %d seconds\n", "Failure recheck", o->recheck);
+                if (o->reset)
+                        printf(" %-20s = %s\n", "Connection close", "reset");
         }
 
         for (Port_T o = s->socketlist; o; o = o->next) {
@@ -1059,6 +1417,10 @@ void Util_printService(Service_T s) {
                         printf(" %-20s = %s\n", "Unix Socket", StringBuffer_toString(Util_printRule(buf, o->action, "if failed %s type %s protocol %s with timeout %d seconds and retry %d times", o->pathname, Util_portTypeDescription(o), o->protocol->name, o->timeout / 1000, o->retry)));
                 else
                         printf(" %-20s = %s\n", "Unix Socket", StringBuffer_toString(Util_printRule(buf, o->action, "if failed %s type %s protocol %s with timeout %d seconds", o->pathname, Util_portTypeDescription(o), o->protocol->name, o->timeout / 1000, o->retry)));
+                if (o->fullevery > 1)
+                        printf(" %-20s = every %d cycles\n", "Full protocol test", o->fullevery);
+                if (o->recheck)
+                        printf(" %-20s = %d seconds\n", "Failure recheck", o->recheck);
         }
 
         for (Timestamp_T o = s->timestamplist; o; o = o->next) {
@@ -1079,6 +1441,10 @@ void Util_printService(Service_T s) {
                        ?
                        StringBuffer_toString(Util_printRule(buf, o->action, "if changed"))
                        :
+                       o->rate
+                       ?
+                       StringBuffer_toString(Util_printRule(buf, o->action, "if rate %s %llu byte(s) per %d second(s)", operatornames[o->operator], o->size, o->rate))
+                       :
                        StringBuffer_toString(Util_printRule(buf, o->action, "if %s %llu byte(s)", operatornames[o->operator], o->size))
                        );
         }
@@ -1101,7 +1467,10 @@ void Util_printService(Service_T s) {
         for (Bandwidth_T o = s->uploadbyteslist; o; o = o->next) {
                 StringBuffer_clear(buf);
                 if (o->range == Time_Second) {
-                        printf(" %-20s = %s\n", "Upload bytes", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %s/s", operatornames[o->operator], Str_bytesToSize(o->limit, buffer))));
+                        char peak[STRLEN] = "";
+                        if (o->sampled)
+                                snprintf(peak, sizeof(peak), "peak sampled every %d seconds ", o->sampled);
+                        printf(" %-20s = %s\n", "Upload bytes", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %s/s", peak, operatornames[o->operator], Str_bytesToSize(o->limit, buffer))));
                 } else {
                         printf(" %-20s = %s\n", "Total upload bytes", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %s in last %d %s(s)", operatornames[o->operator], Str_bytesToSize(o->limit, buffer), o->rangecount, Util_timestr(o->range))));
                 }
@@ -1110,7 +1479,10 @@ void Util_printService(Service_T s) {
         for (Bandwidth_T o = s->uploadpacketslist; o; o = o->next) {
                 StringBuffer_clear(buf);
                 if (o->range == Time_Second) {
-                        printf(" %-20s = %s\n", "Upload packets", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %lld packets/s", operatornames[o->operator], o->limit)));
+                        char peak[STRLEN] = "";
+                        if (o->sampled)
+                                snprintf(peak, sizeof(peak), "peak sampled every %d seconds ", o->sampled);
+                        printf(" %-20s = %s\n", "Upload packets", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %lld packets/s", peak, operatornames[o->operator], o->limit)));
                 } else {
                         printf(" %-20s = %s\n", "Total upload packets", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %lld packets in last %d %s(s)", operatornames[o->operator], o->limit, o->rangecount, Util_timestr(o->range))));
                 }
@@ -1119,7 +1491,10 @@ void Util_printService(Service_T s) {
         for (Bandwidth_T o = s->downloadbyteslist; o; o = o->next) {
                 StringBuffer_clear(buf);
                 if (o->range == Time_Second) {
-                        printf(" %-20s = %s\n", "Download bytes", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %s/s", operatornames[o->operator], Str_bytesToSize(o->limit, buffer))));
+                        char peak[STRLEN] = "";
+                        if (o->sampled)
+                                snprintf(peak, sizeof(peak), "peak sampled every %d seconds ", o->sampled);
+                        printf(" %-20s = %s\n", "Download bytes", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %s/s", peak, operatornames[o->operator], Str_bytesToSize(o->limit, buffer))));
                 } else {
                         printf(" %-20s = %s\n", "Total download bytes", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %s in last %d %s(s)", operatornames[o->operator], Str_bytesToSize(o->limit, buffer), o->rangecount, Util_timestr(o->range))));
                 }
@@ -1128,7 +1503,10 @@ void Util_printService(Service_T s) {
         for (Bandwidth_T o = s->downloadpacketslist; o; o = o->next) {
                 StringBuffer_clear(buf);
                 if (o->range == Time_Second) {
-                        printf(" %-20s = %s\n", "Download packets", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %lld packets/s", operatornames[o->operator], o->limit)));
+                        char peak[STRLEN] = "";
+                        if (o->sampled)
+                                snprintf(peak, sizeof(peak), "peak sampled every %d seconds ", o->sampled);
+                        printf(" %-20s = %s\n", "Download packets", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %lld packets/s", peak, operatornames[o->operator], o->limit)));
                 } else {
                         printf(" %-20s = %s\n", "Total downl. packets", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %lld packets in last %d %s(s)", operatornames[o->operator], o->limit, o->rangecount, Util_timestr(o->range))));
                 }
@@ -1139,7 +1517,7 @@ void Util_printService(Service_T s) {
                 printf(" %-20s = %s\n", "Uptime", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %llu second(s)", operatornames[o->operator], o->uptime)));
         }
 
-        if (s->type != Service_Process) {
+        if (s->type != Service_Process && s->type != Service_Processes) {
                 for (Match_T o = s->matchignorelist; o; o = o->next) {
                         StringBuffer_clear(buf);
                         printf(" %-20s = %s\n", "Ignore pattern", StringBuffer_toString(Util_printRule(buf, o->action, "if%s match \"%s\"", o->not ? " not" : "", o->match_string)));
@@ -1148,6 +1526,12 @@ void Util_printService(Service_T s) {
                         StringBuffer_clear(buf);
                         printf(" %-20s = %s\n", "Pattern", StringBuffer_toString(Util_printRule(buf, o->action, "if%s match \"%s\"", o->not ? " not" : "", o->match_string)));
                 }
+                if (s->matchbudget.bytes)
+                        printf(" %-20s = %s per cycle\n", "Content budget", Str_bytesToSize(s->matchbudget.bytes, buffer));
+                if (s->matchbudget.timeout)
+                        printf(" %-20s = %d second(s) per cycle\n", "Content timeout", s->matchbudget.timeout);
+                if (s->matchbudget.behind)
+                        printf(" %-20s = if behind %s\n", "Content skip", Str_bytesToSize(s->matchbudget.behind, buffer));
         }
 
         for (Filesystem_T o = s->filesystemlist; o; o = o->next) {
@@ -1190,6 +1574,11 @@ void Util_printService(Service_T s) {
         }
 
         for (Resource_T o = s->resourcelist; o; o = o->next) {
+                char average[STRLEN] = "";
+                if (o->window)
+                        snprintf(average, sizeof(average), "average over %d seconds ", o->window);
+                else if (o->sampled)
+                        snprintf(average, sizeof(average), "peak sampled every %d seconds ", o->sampled);
                 StringBuffer_clear(buf);
                 switch (o->resource_id) {
                         case Resource_CpuPercent:
@@ -1212,6 +1601,14 @@ void Util_printService(Service_T s) {
                                 printf(" %-20s = ", "CPU wait limit");
                                 break;
 
+                        case Resource_CpuMax:
+                                printf(" %-20s = ", "Max CPU usage limit");
+                                break;
+
+                        case Resource_CpuNodeMax:
+                                printf(" %-20s = ", "Max node CPU usage limit");
+                                break;
+
                         case Resource_MemoryPercent:
                                 printf(" %-20s = ", "Memory usage limit");
                                 break;
@@ -1251,6 +1648,34 @@ void Util_printService(Service_T s) {
                         case Resource_MemoryPercentTotal:
                                 printf(" %-20s = ", "Memory usage limit (incl. children)");
                                 break;
+
+                        case Resource_Tasks:
+                                printf(" %-20s = ", "Tasks");
+                                break;
+
+                        case Resource_FileDescriptors:
+                                printf(" %-20s = ", "File descriptors");
+                                break;
+
+                        case Resource_ReadBytes:
+                                printf(" %-20s = ", "Read rate limit");
+                                break;
+
+                        case Resource_WriteBytes:
+                                printf(" %-20s = ", "Write rate limit");
+                                break;
+
+                        case Resource_MonitCpu:
+                                printf(" %-20s = ", "Monit CPU usage limit");
+                                break;
+
+                        case Resource_MonitMemory:
+                                printf(" %-20s = ", "Monit memory limit");
+                                break;
+
+                        case Resource_MonitFileDescriptors:
+                                printf(" %-20s = ", "Monit file descriptors");
+                                break;
                         default:
                                 break;
                 }
@@ -1261,25 +1686,37 @@ void Util_printService(Service_T s) {
                         case Resource_CpuUser:
                         case Resource_CpuSystem:
                         case Resource_CpuWait:
+                        case Resource_CpuMax:
+                        case Resource_CpuNodeMax:
                         case Resource_MemoryPercent:
                         case Resource_SwapPercent:
-                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %.1f%%", operatornames[o->operator], o->limit / 10.0)));
+                        case Resource_MonitCpu:
+                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %.1f%%", average, operatornames[o->operator], o->limit / 10.0)));
                                 break;
 
                         case Resource_MemoryKbyte:
                         case Resource_SwapKbyte:
                         case Resource_MemoryKbyteTotal:
-                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %s", operatornames[o->operator], Str_bytesToSize(o->limit * 1024., buffer))));
+                        case Resource_MonitMemory:
+                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %s", average, operatornames[o->operator], Str_bytesToSize(o->limit * 1024., buffer))));
                                 break;
 
                         case Resource_LoadAverage1m:
                         case Resource_LoadAverage5m:
                         case Resource_LoadAverage15m:
-                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %.1f", operatornames[o->operator], o->limit / 10.0)));
+                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %.1f", average, operatornames[o->operator], o->limit / 10.0)));
                                 break;
 
                         case Resource_Children:
-                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s %ld", operatornames[o->operator], o->limit)));
+                        case Resource_Tasks:
+                        case Resource_FileDescriptors:
+                        case Resource_MonitFileDescriptors:
+                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %ld", average, operatornames[o->operator], o->limit)));
+                                break;
+
+                        case Resource_ReadBytes:
+                        case Resource_WriteBytes:
+                                printf("%s", StringBuffer_toString(Util_printRule(buf, o->action, "if %s%s %s/s", average, operatornames[o->operator], Str_bytesToSize(o->limit, buffer))));
                                 break;
 
                         default:
@@ -1290,10 +1727,12 @@ void Util_printService(Service_T s) {
 
         if (s->every.type == Every_SkipCycles)
                 printf(" %-20s = Check service every %d cycles\n", "Every", s->every.spec.cycle.number);
+        else if (s->every.type == Every_Interval)
+                printf(" %-20s = Check service every %d seconds\n", "Every", s->every.spec.interval.seconds);
         else if (s->every.type == Every_Cron)
-                printf(" %-20s = Check service every %s\n", "Every", s->every.spec.cron);
+                printf(" %-20s = Check service every %s\n", "Every", s->every.spec.cron.spec);
         else if (s->every.type == Every_NotInCron)
-                printf(" %-20s = Don't check service every %s\n", "Every", s->every.spec.cron);
+                printf(" %-20s = Don't check service every %s\n", "Every", s->every.spec.cron.spec);
 
         for (ActionRate_T o = s->actionratelist; o; o = o->next) {
                 StringBuffer_clear(buf);
@@ -1413,33 +1852,25 @@ int Util_isProcessRunning(Service_T s, boolean_t refresh) {
         ASSERT(s);
         errno = 0;
         if (s->matchlist) {
-                if (refresh || ! ptree || ! ptreesize)
+                if (refresh || ! ptree || ! ptreesize) {
+                        lockprocesstree(true);
                         initprocesstree(&ptree, &ptreesize, &oldptree, &oldptreesize);
+                        unlockprocesstree();
+                }
                 /* The process table read may sporadically fail during read, because we're using glob on some platforms which may fail if the proc filesystem
                  * which it traverses is changed during glob (process stopped). Note that the glob failure is rare and temporary - it will be OK on next cycle.
                  * We skip the process matching that cycle however because we don't have process informations - will retry next cycle */
                 if (Run.doprocess) {
-                        for (int i = 0; i < ptreesize; i++) {
-                                boolean_t found = false;
-                                if (ptree[i].cmdline) {
-#ifdef HAVE_REGEX_H
-                                        found = regexec(s->matchlist->regex_comp, ptree[i].cmdline, 0, NULL, 0) ? false : true;
-#else
-                                        found = strstr(ptree[i].cmdline, s->matchlist->match_string) ? true : false;
-#endif
-                                }
-                                if (found) {
-                                        pid = ptree[i].pid;
-                                        break;
-                                }
-                        }
+                        lockprocesstree(false);
+                        pid = findprocessmatch(s);
+                        unlockprocesstree();
                 } else {
                         DEBUG("Process information not available -- skipping service %s process existence check for this cycle\n", s->name);
                         /* Return value is NOOP - it is based on existing errors bitmap so we don't generate false recovery/failures */
                         return ! (s->error & Event_Nonexist);
                 }
         } else {
-                pid = Util_getPid(s->path);
+                pid = _getPidCached(s);
         }
         if (pid > 0) {
                 if ((getpgid(pid) > -1) || (errno == EPERM))
@@ -1599,6 +2030,16 @@ void Util_closeFds() {
 }
 
 
+int Util_openPidfd(pid_t pid) {
+#if defined LINUX && defined HAVE_SYS_SYSCALL_H && defined SYS_pidfd_open
+        return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+
 Auth_T Util_getUserCredentials(char *uname) {
         /* check allowed user names */
         for (Auth_T c = Run.httpd.credentials; c; c = c->next)
@@ -1714,6 +2155,8 @@ void Util_resetInfo(Service_T s) {
                         s->inf->priv.directory.uid = 0;
                         s->inf->priv.directory.gid = 0;
                         s->inf->priv.directory.timestamp = 0;
+                        s->inf->priv.directory.cs_files = 0;
+                        *s->inf->priv.directory.cs_sum = 0;
                         break;
                 case Service_Fifo:
                         s->inf->priv.fifo.mode = 0;
@@ -1722,6 +2165,7 @@ void Util_resetInfo(Service_T s) {
                         s->inf->priv.fifo.timestamp = 0;
                         break;
                 case Service_Process:
+                case Service_Cgroup:
                         s->inf->priv.process._pid = -1;
                         s->inf->priv.process._ppid = -1;
                         s->inf->priv.process.pid = -1;
@@ -1738,6 +2182,13 @@ void Util_resetInfo(Service_T s) {
                         s->inf->priv.process.cpu_percent = 0;
                         s->inf->priv.process.total_cpu_percent = 0;
                         s->inf->priv.process.uptime = 0;
+                        s->inf->priv.process.threads = -1;
+                        s->inf->priv.process.fds = -1;
+                        s->inf->priv.process.read_rate = -1LL;
+                        s->inf->priv.process.write_rate = -1LL;
+                        s->inf->priv.process.read_bytes = 0ULL;
+                        s->inf->priv.process.write_bytes = 0ULL;
+                        s->inf->priv.process.io_sampled = 0ULL;
                         break;
                 case Service_Net:
                         if (s->inf->priv.net.stats)
@@ -1746,6 +2197,13 @@ void Util_resetInfo(Service_T s) {
                 default:
                         break;
         }
+        if (s->cgroup)
+                Cgroup_reset(s->cgroup);
+        if (s->processes) {
+                for (int i = 0; i < s->processes->top; i++)
+                        FREE(s->processes->offender[i].cmdline);
+                memset(s->processes, 0, sizeof(*(s->processes)));
+        }
 }
 
 
@@ -1837,6 +2295,8 @@ void Util_monitorUnset(Service_T s) {
         s->ncycle = 0;
         if (s->every.type == Every_SkipCycles)
                 s->every.spec.cycle.counter = 0;
+        else if (s->every.type == Every_Interval)
+                s->every.spec.interval.next = 0;
         s->error = Event_Null;
         if (s->eventlist)
                 gc_event(&s->eventlist);
@@ -2003,3 +2463,32 @@ const char *Util_timestr(int time) {
         return NULL;
 }
 
+
+unsigned char *Util_gzip(const void *data, size_t length, size_t *size) {
+        ASSERT(data);
+        ASSERT(size);
+#if defined HAVE_LIBZ && defined HAVE_ZLIB_H
+        z_stream z = {};
+        if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { // windowBits + 16 = gzip wrapper
+                LogError("Compression initialization failed -- %s\n", z.msg ? z.msg : "unknown error");
+                return NULL;
+        }
+        uLong bound = deflateBound(&z, length);
+        unsigned char *result = ALLOC(bound);
+        z.next_in = (Bytef *)data;
+        z.avail_in = length;
+        z.next_out = result;
+        z.avail_out = bound;
+        int rv = deflate(&z, Z_FINISH);
+        *size = z.total_out;
+        deflateEnd(&z);
+        if (rv != Z_STREAM_END) {
+                LogError("Compression failed -- %s\n", z.msg ? z.msg : "unknown error");
+                FREE(result);
+        }
+        return result;
+#else
+        return NULL;
+#endif
+}
+
@@ -83,15 +83,17 @@ char *Util_digest2Bytes(unsigned char *digest, int mdlen, MD_T result);
 
 /**
  * Compute SHA1 and MD5 message digests simultaneously for bytes read
- * from STREAM (suitable for stdin, which is not always rewindable).
- * The resulting message digest numbers will be written into the first
- * bytes of resblock buffers.
- * @param stream The stream from where the digests are computed
+ * from the file descriptor (suitable for stdin, which is not always
+ * rewindable). The data is read in large blocks and the OpenSSL CPU
+ * accelerated digests are used if available. The resulting message
+ * digest numbers will be written into the first bytes of resblock
+ * buffers.
+ * @param fd The file descriptor from where the digests are computed
  * @param sha_resblock The buffer to write the SHA1 result to or NULL to skip the SHA1
  * @param md5_resblock The buffer to write the MD5 result to or NULL to skip the MD5
  * @return false if failed, otherwise true
  */
-boolean_t Util_getStreamDigests(FILE *stream, void *sha_resblock, void *md5_resblock);
+boolean_t Util_getDigests(int fd, void *sha_resblock, void *md5_resblock);
 
 
 /**
@@ -112,6 +114,17 @@ void Util_printHash(char *file);
 boolean_t Util_getChecksum(char *file, Hash_Type hashtype, char *buf, int bufsize);
 
 
+/**
+ * Get the longest substring which must be part of any string matching the given
+ * extended regular expression. It can be used to reject strings with strstr()
+ * before the regular expression is evaluated. Only the top level literals are
+ * considered and if the pattern contains an alternation, there is no such substring.
+ * @param pattern The extended regular expression
+ * @return The literal string (must be freed by the caller) or NULL
+ */
+char *Util_getRegexLiteral(const char *pattern);
+
+
 /**
  * Get the HMAC-MD5 signature
  * @param data The data to sign
@@ -130,6 +143,41 @@ void Util_hmacMD5(const unsigned char *data, int datalen, const unsigned char *k
 Service_T Util_getService(const char *name);
 
 
+/**
+ * Add the service to the name index used by Util_getService(). Called by
+ * the parser for each service added to the service list
+ * @param s A Service object
+ */
+void Util_addServiceIndex(Service_T s);
+
+
+/**
+ * Drop the service name index, called when the service list is destroyed
+ */
+void Util_resetServiceIndex();
+
+
+/**
+ * Get the size of the check results (Info_T) of the given service type.
+ * The Run.infotable slot of a service holds only the part of the union
+ * used by its type
+ * @param type The service type
+ * @return The size of the used part of struct myinfo
+ */
+size_t Util_getInfoSize(Service_Type type);
+
+
+/**
+ * Move the check results (Info_T) of all services in the service list
+ * to one table, in the service list order and each in its own cache
+ * line(s) sized by the service type, so the check cycle and the status reports scan them linearly
+ * and the services checked in parallel don't share cache lines. Sets
+ * the service ordinal and Run.infotable, which is released by gc().
+ * Called by the parser when the service list is complete
+ */
+void Util_buildInfoTable();
+
+
 /**
  * @param name A service name as stated in the config file
  * @return true if the service name exist in the
@@ -267,6 +315,17 @@ void Util_redirectStdFds();
 void Util_closeFds();
 
 
+/**
+ * Open a process file descriptor for the given pid. The descriptor
+ * becomes readable when the process exits, so the caller can wait for
+ * the process exit using poll(2). Supported on Linux 5.3 and later.
+ * @param pid The process id
+ * @return The process descriptor or -1 if failed (errno is set to
+ * ENOSYS if the process descriptors are not supported)
+ */
+int Util_openPidfd(pid_t pid);
+
+
 /*
  * Check if monit does have credentials for this user.  If successful
  * a pointer to the password is returned.
@@ -428,5 +487,17 @@ int Util_getfqdnhostname(char *buf, unsigned len);
 const char *Util_timestr(int time);
 
 
+/**
+ * Compress the data using the gzip format (RFC 1952). The caller must free
+ * the returned buffer.
+ * @param data The data to compress
+ * @param length The data length
+ * @param size Set to the compressed data length
+ * @return the compressed data or NULL if the compression failed or it is
+ * not supported (monit was built without zlib)
+ */
+unsigned char *Util_gzip(const void *data, size_t length, size_t *size);
+
+
 #endif
 
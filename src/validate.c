@@ -40,6 +40,10 @@
 #include <stdlib.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
 #ifdef HAVE_SIGNAL_H
 #include <signal.h>
 #endif
@@ -72,10 +76,26 @@
 #include <sys/time.h>
 #endif
 
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#ifdef HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
+
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
 
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#ifdef HAVE_MALLOC_H
+#include <malloc.h>
+#endif
+
 #ifdef HAVE_NETINET_IN_SYSTM_H
 #include <netinet/in_systm.h>
 #endif
@@ -98,8 +118,22 @@
 #include "socket.h"
 #include "net.h"
 #include "device.h"
+#include "filewatch.h"
+#include "programwatch.h"
+#include "linkwatch.h"
+#include "latency.h"
+#include "probe.h"
 #include "process.h"
 #include "protocol.h"
+#include "cgroup.h"
+#include "history.h"
+#include "snapshot.h"
+#include "instance.h"
+#include "merkle.h"
+#include "sampler.h"
+#include "plugin.h"
+#include "cron.h"
+#include "cluster.h"
 
 // libmonit
 #include "system/Time.h"
@@ -118,11 +152,89 @@
 
 
 #define MATCH_LINE_LENGTH 512
+#define MATCH_BLOCK_SIZE 262144
+#define BACKOFF_MAX 16 /* The longest probing interval of a failing remote test in cycles */
+#define METRIC_UNKNOWN LLONG_MIN /* The metric of the compiled rule is not collected */
+#define UPSTREAM_DOWN (Event_Nonexist | Event_Connection | Event_Icmp | Event_Link) /* The failures of a service which suppress the checks of its dependants */
+
+
+/* Sub-second file timestamps, if the stat structure provides them */
+#if defined HAVE_STRUCT_STAT_ST_MTIM
+#define STAT_MTIME_NSEC(sb) ((sb)->st_mtim.tv_nsec)
+#define STAT_CTIME_NSEC(sb) ((sb)->st_ctim.tv_nsec)
+#elif defined HAVE_STRUCT_STAT_ST_MTIMESPEC
+#define STAT_MTIME_NSEC(sb) ((sb)->st_mtimespec.tv_nsec)
+#define STAT_CTIME_NSEC(sb) ((sb)->st_ctimespec.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(sb) 0L
+#define STAT_CTIME_NSEC(sb) 0L
+#endif
+
+
+typedef enum {
+        Job_Queued = 0,
+        Job_Running,
+        Job_Done
+} __attribute__((__packed__)) Job_State;
+
+
+typedef struct myjob {
+        Service_T s;                                 /**< The service to check */
+        Job_State state;                                     /**< The job state */
+        int dependencies;     /**< Number of scheduled services we depend on */
+        int *depends;       /**< Indexes of the scheduled services we depend on */
+} *Job_T;
+
+
+/* The check scheduler state, shared by the worker threads */
+static struct {
+        int count;                                 /**< Number of scheduled jobs */
+        int queued;                            /**< Number of jobs not started yet */
+        int errors;                            /**< Number of failed service checks */
+        struct myjob *jobs;                          /**< The scheduled jobs */
+        Mutex_T mutex;
+        Sem_T done;                           /**< Signaled when some job finished */
+} scheduler = {.mutex = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+
+/* Whether the process tree was collected this cycle, otherwise the process services read their process directly */
+static boolean_t processtree = true;
 
 
 /* ----------------------------------------------------------------- Private */
 
 
+/* The tests of the compiled rules, one per operator, so the evaluation doesn't switch on the operator */
+static boolean_t _greater(long long value, long long limit) {
+        return value > limit;
+}
+
+
+static boolean_t _less(long long value, long long limit) {
+        return value < limit;
+}
+
+
+static boolean_t _equal(long long value, long long limit) {
+        return value == limit;
+}
+
+
+static boolean_t _notEqual(long long value, long long limit) {
+        return value != limit;
+}
+
+
+/* The compiled rule's test, indexed by the rule operator */
+static boolean_t (*comparators[])(long long, long long) = {
+        [Operator_Greater] = _greater,
+        [Operator_Less] = _less,
+        [Operator_Equal] = _equal,
+        [Operator_NotEqual] = _notEqual,
+        [Operator_Changed] = _notEqual
+};
+
+
 /**
  * Read program output into stringbuffer. Limit the output to 1kB
  */
@@ -141,35 +253,431 @@ static void _programOutput(InputStream_T I, StringBuffer_T S) {
 
 
 /**
- * Test the connection and protocol
+ * Returns true if the probe of the failing remote test should be skipped in
+ * this cycle. The healthy tests are never skipped
+ * @param B The test backoff
+ */
+static boolean_t _backoffSkip(Backoff_T *B) {
+        if (B->skip > 0) {
+                B->skip--;
+                return true;
+        }
+        return false;
+}
+
+
+/**
+ * Update the backoff of the remote test with the probe result. After the
+ * first failure the test is probed again in the next cycle, then the
+ * probing interval doubles with each failure up to BACKOFF_MAX cycles.
+ * The success resets the backoff
+ * @param B The test backoff
+ * @param succeeded The probe result
+ */
+static void _backoffUpdate(Backoff_T *B, boolean_t succeeded) {
+        if (succeeded) {
+                B->failures = 0;
+                B->skip = 0;
+        } else {
+                if ((1 << B->failures) <= BACKOFF_MAX)
+                        B->failures++;
+                B->skip = (1 << (B->failures - 1)) - 1;
+        }
+}
+
+
+/**
+ * Returns true if the port test of the remote host is skipped in this cycle,
+ * because the test is failing and the next probe is not due yet
+ */
+static boolean_t _portBackoff(Service_T s, Port_T p) {
+        if (s->type == Service_Host && _backoffSkip(&p->backoff)) {
+                char buf[STRLEN];
+                DEBUG("'%s' test skipped as %s failed %d times -- next probe in %d cycle(s)\n", s->name, Util_portDescription(p, buf, sizeof(buf)), p->backoff.failures, p->backoff.skip + 1);
+                return true;
+        }
+        return false;
+}
+
+
+/**
+ * Returns true if the healthy port test runs just the connection probe in
+ * this cycle (the connect and SSL handshake, without the protocol exchange).
+ * The full protocol test runs every p->fullevery cycles and in every cycle
+ * while the test is failing
+ */
+static boolean_t _probeOnly(Port_T p) {
+        if (p->fullevery < 2 || p->failures) {
+                p->fullcycle = 0;
+                return false;
+        }
+        boolean_t probe = p->fullcycle > 0;
+        p->fullcycle = (p->fullcycle + 1) % p->fullevery;
+        return probe;
+}
+
+
+/**
+ * Test the connection without the protocol exchange, using the default
+ * protocol test on a copy of the port
  */
-static void check_connection(Service_T s, Port_T p) {
+static void _probeConnection(Port_T p) {
+        struct myport probe = *p;
+        probe.protocol = Protocol_get(Protocol_DEFAULT);
+        TRY
+        {
+                Socket_test(&probe);
+        }
+        FINALLY
+        {
+                p->is_available = probe.is_available;
+                p->response = probe.response;
+                p->handshake = probe.handshake;
+                p->rtt = probe.rtt;
+                p->certificate = probe.certificate;
+        }
+        END_TRY;
+}
+
+
+/**
+ * Test the connection and protocol. A failing test is probed once, without
+ * the retries. The test reuses the connection kept open by the previous
+ * test of the same server and keeps it open for the next test if keep is true
+ * @return true if succeeded, otherwise false and the error is in the report buffer
+ */
+static boolean_t _testProtocol(Service_T s, Port_T p, Socket_T *connection, boolean_t keep, char *report, int reportlength) {
         ASSERT(s && p);
-        volatile int retry_count = p->retry;
+        volatile int retry_count = p->backoff.failures ? 1 : p->retry;
         volatile boolean_t rv = true;
         char buf[STRLEN];
-        char report[STRLEN] = {};
+        if (_probeOnly(p)) {
+                TRY
+                {
+                        _probeConnection(p);
+                        DEBUG("'%s' succeeded probing the connection to %s, the full protocol [%s] test runs every %d cycles\n", s->name, Util_portDescription(p, buf, sizeof(buf)), p->protocol->name, p->fullevery);
+                }
+                ELSE
+                {
+                        snprintf(report, reportlength, "failed connection probe at %s -- %s", Util_portDescription(p, buf, sizeof(buf)), Exception_frame.message);
+                        rv = false;
+                }
+                END_TRY;
+                return rv;
+        }
+        if (p->batched) {
+                /* The result of the UDP batch is the first attempt */
+                p->batched = false;
+                if (! p->batch_error) {
+                        DEBUG("'%s' succeeded testing protocol [%s] at %s\n", s->name, p->protocol->name, Util_portDescription(p, buf, sizeof(buf)));
+                        return true;
+                }
+                snprintf(report, reportlength, "failed protocol test [%s] at %s -- %s", p->protocol->name, Util_portDescription(p, buf, sizeof(buf)), p->batch_error);
+                FREE(p->batch_error);
+                if (retry_count-- <= 1)
+                        return false;
+                DEBUG("'%s' %s (attempt %d/%d)\n", s->name, report, p->retry - retry_count, p->retry);
+        }
 retry:
         TRY
         {
-                Socket_test(p);
+                Socket_testReusing(p, connection, keep);
                 DEBUG("'%s' succeeded testing protocol [%s] at %s\n", s->name, p->protocol->name, Util_portDescription(p, buf, sizeof(buf)));
         }
         ELSE
         {
-                snprintf(report, STRLEN, "failed protocol test [%s] at %s -- %s", p->protocol->name, Util_portDescription(p, buf, sizeof(buf)), Exception_frame.message);
+                snprintf(report, reportlength, "failed protocol test [%s] at %s -- %s", p->protocol->name, Util_portDescription(p, buf, sizeof(buf)), Exception_frame.message);
                 rv = false;
         }
         END_TRY;
-        if (! rv) {
-                if (retry_count-- > 1) {
-                        DEBUG("'%s' %s (attempt %d/%d)\n", s->name, report, p->retry - retry_count, p->retry);
-                        goto retry;
+        if (! rv && retry_count-- > 1) {
+                DEBUG("'%s' %s (attempt %d/%d)\n", s->name, report, p->retry - retry_count, p->retry);
+                rv = true;
+                goto retry;
+        }
+        return rv;
+}
+
+
+/**
+ * Test the connection and protocol and the validity of the certificate the
+ * server presented in the SSL handshake of the test, so the certificate
+ * test doesn't need its own connection
+ * @return true if succeeded, otherwise false and the error is in the report buffer
+ */
+static boolean_t _testConnection(Service_T s, Port_T p, Socket_T *connection, boolean_t keep, char *report, int reportlength) {
+        if (! _testProtocol(s, p, connection, keep, report, reportlength))
+                return false;
+        if (p->certificate.days && p->certificate.expiry) {
+                char buf[STRLEN];
+                time_t now = Time_now();
+                long long days = (p->certificate.expiry - now) / 86400;
+                if (days <= p->certificate.days) {
+                        if (p->certificate.expiry <= now)
+                                snprintf(report, reportlength, "certificate %s at %s expired", p->certificate.subject, Util_portDescription(p, buf, sizeof(buf)));
+                        else
+                                snprintf(report, reportlength, "certificate %s at %s is valid only %lld days, expected more than %d days", p->certificate.subject, Util_portDescription(p, buf, sizeof(buf)), days, p->certificate.days);
+                        return false;
                 }
+                DEBUG("'%s' certificate %s at %s is valid %lld days\n", s->name, p->certificate.subject, Util_portDescription(p, buf, sizeof(buf)), days);
+        }
+        return true;
+}
+
+
+static void _postConnection(Service_T s, Port_T p, boolean_t succeeded, const char *report) {
+        char buf[STRLEN];
+        if (s->type == Service_Host)
+                _backoffUpdate(&p->backoff, succeeded);
+        p->failures = succeeded ? 0 : p->failures + 1;
+        /* The failure which doesn't trigger the action yet is rechecked before the next cycle, to confirm it sooner */
+        if (! succeeded && p->recheck && p->failures < p->action->failed->count)
+                p->recheck_due = Latency_now() + p->recheck * 1000000ULL;
+        else
+                p->recheck_due = 0;
+        if (! succeeded)
                 Event_post(s, Event_Connection, State_Failed, p->action, "%s", report);
-        } else {
+        else
                 Event_post(s, Event_Connection, State_Succeeded, p->action, "connection succeeded to %s", Util_portDescription(p, buf, sizeof(buf)));
+}
+
+
+static boolean_t _isEqual(const char *a, const char *b) {
+        return a == b || IS(a, b);
+}
+
+
+/**
+ * Returns true if both port tests can run over one connection, i.e. they
+ * are HTTP or GRPC tests of the same server using the same SSL options
+ */
+static boolean_t _sameConnection(Port_T a, Port_T b) {
+        if ((a->protocol != Protocol_get(Protocol_HTTP) && a->protocol != Protocol_get(Protocol_GRPC)) || b->protocol != a->protocol || a->type != Socket_Tcp || b->type != Socket_Tcp || a->family != b->family)
+                return false;
+        if (a->family == Socket_Unix)
+                return _isEqual(a->pathname, b->pathname);
+        return a->port == b->port && _isEqual(a->hostname, b->hostname) && a->SSL.use_ssl == b->SSL.use_ssl && a->SSL.version == b->SSL.version && _isEqual(a->SSL.certmd5, b->SSL.certmd5) && _isEqual(a->SSL.clientpemfile, b->SSL.clientpemfile);
+}
+
+
+/**
+ * Returns true if both port tests probe the target the same way, so the
+ * result of one is the result of the other: the same target, protocol,
+ * request, SSL options and test parameters. The tests with the options
+ * which are objects of their own (send/expect, URL request, headers) are
+ * equal only if they share the object
+ */
+static boolean_t _sameProbe(Port_T a, Port_T b) {
+        return a->protocol == b->protocol && a->type == b->type && a->family == b->family && a->port == b->port && a->timeout == b->timeout && a->retry == b->retry && (a->backoff.failures > 0) == (b->backoff.failures > 0)
+                && a->reset == b->reset && a->maxforward == b->maxforward && a->version == b->version && a->operator == b->operator && a->status == b->status && a->request_hashtype == b->request_hashtype && a->certificate.days == b->certificate.days
+                && a->generic == b->generic && a->http_headers == b->http_headers && a->url_request == b->url_request
+                && _isEqual(a->hostname, b->hostname) && _isEqual(a->pathname, b->pathname) && _isEqual(a->request, b->request) && _isEqual(a->request_checksum, b->request_checksum) && _isEqual(a->request_hostheader, b->request_hostheader)
+                && a->SSL.use_ssl == b->SSL.use_ssl && a->SSL.version == b->SSL.version && _isEqual(a->SSL.certmd5, b->SSL.certmd5) && _isEqual(a->SSL.clientpemfile, b->SSL.clientpemfile) && _isEqual(a->SSL.alpn, b->SSL.alpn)
+                && ! memcmp(&a->ApacheStatus, &b->ApacheStatus, sizeof(struct apache_status));
+}
+
+
+/* The port test results of this cycle, the identical tests of other services reuse them instead of probing the target again */
+static struct {
+        Mutex_T mutex;
+        int count;
+        int size;
+        struct myprobe {
+                Port_T port;                     /**< The test which probed the target */
+                boolean_t succeeded;
+                char report[STRLEN];
+        } *probe;
+} probes = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+
+/**
+ * Returns true if the port test can share its result. The keepalive tests
+ * and the tests alternating between the probe and the full protocol test
+ * keep a state of their own and the UDP batch result is already shared
+ */
+static inline boolean_t _probeShared(Port_T p) {
+        return ! p->keepalive && p->fullevery < 2 && ! p->batched;
+}
+
+
+/**
+ * Get the result of the identical test which ran in this cycle. The
+ * response times and the certificate are copied to the port
+ * @return true if the result was found, otherwise false
+ */
+static boolean_t _probeGet(Service_T s, Port_T p, boolean_t *succeeded, char *report, int reportlength) {
+        boolean_t found = false;
+        if (! _probeShared(p))
+                return false;
+        LOCK(probes.mutex)
+        {
+                for (int i = 0; i < probes.count; i++) {
+                        Port_T q = probes.probe[i].port;
+                        if (_sameProbe(p, q)) {
+                                p->is_available = q->is_available;
+                                p->response = q->response;
+                                p->handshake = q->handshake;
+                                p->rtt = q->rtt;
+                                p->certificate = q->certificate;
+                                *succeeded = probes.probe[i].succeeded;
+                                snprintf(report, reportlength, "%s", probes.probe[i].report);
+                                found = true;
+                                break;
+                        }
+                }
+        }
+        END_LOCK;
+        if (found) {
+                char buf[STRLEN];
+                DEBUG("'%s' reused the result of the identical test at %s in this cycle\n", s->name, Util_portDescription(p, buf, sizeof(buf)));
+        }
+        return found;
+}
+
+
+static void _probePut(Port_T p, boolean_t succeeded, const char *report) {
+        if (! _probeShared(p))
+                return;
+        LOCK(probes.mutex)
+        {
+                if (probes.count == probes.size) {
+                        probes.size = probes.size ? probes.size * 2 : 16;
+                        RESIZE(probes.probe, probes.size * sizeof(struct myprobe));
+                }
+                probes.probe[probes.count].port = p;
+                probes.probe[probes.count].succeeded = succeeded;
+                snprintf(probes.probe[probes.count].report, STRLEN, "%s", report);
+                probes.count++;
+        }
+        END_LOCK;
+}
+
+
+/* The port tests of one service, the tests of one group share the connection and run in sequence, the groups may run in parallel */
+typedef struct myconnections {
+        Service_T s;
+        int count;                                      /**< Number of port tests */
+        int groups;                                    /**< Number of test groups */
+        int next;                                /**< The next test group to start */
+        Port_T *ports;
+        int *group;                          /**< The first port test of each group */
+        int *chain;      /**< The next port test of the same group or -1 if the last */
+        boolean_t *succeeded;
+        unsigned long long *duration;                /**< Port test durations [us] */
+        char (*report)[STRLEN];
+        Mutex_T mutex;
+} *Connections_T;
+
+
+static void *_connectionWorker(void *args) {
+        Connections_T C = args;
+        while (true) {
+                int i;
+                LOCK(C->mutex)
+                {
+                        i = C->next < C->groups ? C->group[C->next++] : -1;
+                }
+                END_LOCK;
+                if (i < 0)
+                        break;
+                Port_T head = C->ports[i];
+                Socket_T connection = NULL, *session = head->keepalive ? &head->session : &connection; // The keepalive session of the group head is kept open between the cycles
+                for (; i >= 0; i = C->chain[i]) {
+                        Port_T p = C->ports[i];
+                        unsigned long long started = Latency_now();
+                        if (! _probeGet(C->s, p, &C->succeeded[i], C->report[i], STRLEN)) {
+                                C->succeeded[i] = _testConnection(C->s, p, session, head->keepalive || C->chain[i] >= 0, C->report[i], STRLEN);
+                                _probePut(p, C->succeeded[i], C->report[i]);
+                        }
+                        C->duration[i] = Latency_now() - started;
+                }
+                if (connection)
+                        Socket_free(&connection);
+        }
+#ifdef HAVE_OPENSSL
+        Ssl_threadCleanup();
+#endif
+        return NULL;
+}
+
+
+/**
+ * Test all connections in the list. The HTTP and GRPC tests of the same
+ * server run in sequence over one persistent connection, so the requests
+ * don't pay for the connect and SSL handshake each. If the check scheduler runs in
+ * parallel mode, the test groups run in parallel as well (using up to
+ * Run.scheduler_workers threads), so the test of all ports takes about as
+ * long as the slowest group. The events are posted in the configuration
+ * order once all tests finished.
+ */
+static void check_connections(Service_T s, Port_T list) {
+        int count = 0;
+        for (Port_T p = list; p; p = p->next)
+                count++;
+        if (! count)
+                return;
+        struct myconnections C = {.s = s, .next = 0, .mutex = PTHREAD_MUTEX_INITIALIZER};
+        C.ports = CALLOC(count, sizeof(Port_T));
+        count = 0;
+        for (Port_T p = list; p; p = p->next)
+                if (! _portBackoff(s, p))
+                        C.ports[count++] = p;
+        if (! count) {
+                FREE(C.ports);
+                return;
+        }
+        C.count = count;
+        C.group = CALLOC(count, sizeof(int));
+        C.chain = CALLOC(count, sizeof(int));
+        for (int i = 0; i < count; i++) {
+                C.chain[i] = -1;
+                int g = 0;
+                while (g < C.groups && ! _sameConnection(C.ports[C.group[g]], C.ports[i]))
+                        g++;
+                if (g < C.groups) {
+                        // Append to the group's chain
+                        int j = C.group[g];
+                        while (C.chain[j] >= 0)
+                                j = C.chain[j];
+                        C.chain[j] = i;
+                } else {
+                        C.group[C.groups++] = i;
+                }
         }
+        C.succeeded = CALLOC(count, sizeof(boolean_t));
+        C.duration = CALLOC(count, sizeof(unsigned long long));
+        C.report = CALLOC(count, STRLEN);
+        int workers = C.groups < Run.scheduler_workers ? C.groups : Run.scheduler_workers;
+        Thread_T *threads = NULL;
+        volatile int started = 0;
+        if (workers > 1) {
+                threads = CALLOC(workers, sizeof(Thread_T));
+                TRY
+                {
+                        for (; started < workers; started++)
+                                Thread_create(threads[started], _connectionWorker, &C);
+                }
+                ELSE
+                {
+                        LogError("'%s' cannot create port test thread -- %s\n", s->name, Exception_frame.message);
+                }
+                END_TRY;
+        }
+        if (! started) // Serial test
+                _connectionWorker(&C);
+        for (int i = 0; i < started; i++)
+                Thread_join(threads[i]);
+        for (int i = 0; i < count; i++) {
+                Latency_add(Latency_get(&s->latency[Latency_Port]), C.duration[i]);
+                _postConnection(s, C.ports[i], C.succeeded[i], C.report[i]);
+        }
+        FREE(threads);
+        FREE(C.ports);
+        FREE(C.group);
+        FREE(C.chain);
+        FREE(C.succeeded);
+        FREE(C.duration);
+        FREE(C.report);
 }
 
 
@@ -226,238 +734,540 @@ static void check_process_ppid(Service_T s) {
 
 
 /**
- * Check process resources
+ * The resource name for the reports of the average rules
  */
-static void check_process_resources(Service_T s, Resource_T r) {
-        ASSERT(s && r);
+static const char *_resourceName(Resource_Type id) {
+        switch (id) {
+                case Resource_CpuPercent:          return "cpu usage";
+                case Resource_CpuPercentTotal:     return "total cpu usage";
+                case Resource_CpuUser:             return "cpu user usage";
+                case Resource_CpuSystem:           return "cpu system usage";
+                case Resource_CpuWait:             return "cpu wait usage";
+                case Resource_CpuMax:              return "max cpu usage";
+                case Resource_CpuNodeMax:          return "max node cpu usage";
+                case Resource_MemoryPercent:       return "mem usage";
+                case Resource_MemoryKbyte:         return "mem amount";
+                case Resource_MemoryPercentTotal:  return "total mem usage";
+                case Resource_MemoryKbyteTotal:    return "total mem amount";
+                case Resource_SwapPercent:         return "swap usage";
+                case Resource_SwapKbyte:           return "swap amount";
+                case Resource_LoadAverage1m:       return "loadavg(1min)";
+                case Resource_LoadAverage5m:       return "loadavg(5min)";
+                case Resource_LoadAverage15m:      return "loadavg(15min)";
+                case Resource_Children:            return "children";
+                case Resource_Tasks:               return "tasks";
+                case Resource_FileDescriptors:     return "file descriptors";
+                case Resource_MonitCpu:            return "monit cpu usage";
+                case Resource_MonitMemory:         return "monit mem amount";
+                case Resource_MonitFileDescriptors: return "monit file descriptors";
+                case Resource_ReadBytes:           return "read rate";
+                case Resource_WriteBytes:          return "write rate";
+                default:                           return "resource";
+        }
+}
 
-        boolean_t okay = true;
-        char report[STRLEN]={0}, buf1[STRLEN], buf2[STRLEN];
-        switch (r->resource_id) {
 
+/**
+ * Format the resource value in the units of the resource rules
+ */
+static char *_resourceFormat(Resource_Type id, double value, char buf[STRLEN]) {
+        switch (id) {
                 case Resource_CpuPercent:
-                        if (s->monitor & Monitor_Init || s->inf->priv.process.cpu_percent < 0) {
-                                DEBUG("'%s' cpu usage check skipped (initializing)\n", s->name);
-                                return;
-                        } else if (Util_evalQExpression(r->operator, s->inf->priv.process.cpu_percent, r->limit)) {
-                                snprintf(report, STRLEN, "cpu usage of %.1f%% matches resource limit [cpu usage%s%.1f%%]", s->inf->priv.process.cpu_percent / 10., operatorshortnames[r->operator], r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "cpu usage check succeeded [current cpu usage=%.1f%%]", s->inf->priv.process.cpu_percent / 10.);
-                        break;
-
                 case Resource_CpuPercentTotal:
-                        if (s->monitor & Monitor_Init || s->inf->priv.process.total_cpu_percent < 0) {
-                                DEBUG("'%s' total cpu usage check skipped (initializing)\n", s->name);
-                                return;
-                        } else if (Util_evalQExpression(r->operator, s->inf->priv.process.total_cpu_percent, r->limit)) {
-                                snprintf(report, STRLEN, "total cpu usage of %.1f%% matches resource limit [cpu usage%s%.1f%%]", s->inf->priv.process.total_cpu_percent / 10., operatorshortnames[r->operator], r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "total cpu usage check succeeded [current cpu usage=%.1f%%]", s->inf->priv.process.total_cpu_percent / 10.);
-                        break;
-
                 case Resource_CpuUser:
-                        if (s->monitor & Monitor_Init || systeminfo.total_cpu_user_percent < 0) {
-                                DEBUG("'%s' cpu user usage check skipped (initializing)\n", s->name);
-                                return;
-                        } else if (Util_evalQExpression(r->operator, systeminfo.total_cpu_user_percent, r->limit)) {
-                                snprintf(report, STRLEN, "cpu user usage of %.1f%% matches resource limit [cpu user usage%s%.1f%%]", systeminfo.total_cpu_user_percent / 10., operatorshortnames[r->operator], r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "cpu user usage check succeeded [current cpu user usage=%.1f%%]", systeminfo.total_cpu_user_percent / 10.);
-                        break;
-
                 case Resource_CpuSystem:
-                        if (s->monitor & Monitor_Init || systeminfo.total_cpu_syst_percent < 0) {
-                                DEBUG("'%s' cpu system usage check skipped (initializing)\n", s->name);
-                                return;
-                        } else if (Util_evalQExpression(r->operator, systeminfo.total_cpu_syst_percent, r->limit)) {
-                                snprintf(report, STRLEN, "cpu system usage of %.1f%% matches resource limit [cpu system usage%s%.1f%%]", systeminfo.total_cpu_syst_percent / 10., operatorshortnames[r->operator], r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "cpu system usage check succeeded [current cpu system usage=%.1f%%]", systeminfo.total_cpu_syst_percent / 10.);
-                        break;
-
                 case Resource_CpuWait:
-                        if (s->monitor & Monitor_Init || systeminfo.total_cpu_wait_percent < 0) {
-                                DEBUG("'%s' cpu wait usage check skipped (initializing)\n", s->name);
-                                return;
-                        } else if (Util_evalQExpression(r->operator, systeminfo.total_cpu_wait_percent, r->limit)) {
-                                snprintf(report, STRLEN, "cpu wait usage of %.1f%% matches resource limit [cpu wait usage%s%.1f%%]", systeminfo.total_cpu_wait_percent / 10., operatorshortnames[r->operator], r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "cpu wait usage check succeeded [current cpu wait usage=%.1f%%]", systeminfo.total_cpu_wait_percent / 10.);
-                        break;
-
+                case Resource_CpuMax:
+                case Resource_CpuNodeMax:
                 case Resource_MemoryPercent:
-                        if (s->type == Service_System) {
-                                if (Util_evalQExpression(r->operator, systeminfo.total_mem_percent, r->limit)) {
-                                        snprintf(report, STRLEN, "mem usage of %.1f%% matches resource limit [mem usage%s%.1f%%]", systeminfo.total_mem_percent / 10., operatorshortnames[r->operator], r->limit / 10.);
-                                        okay = false;
-                                } else
-                                        snprintf(report, STRLEN, "mem usage check succeeded [current mem usage=%.1f%%]", systeminfo.total_mem_percent / 10.);
-                        } else {
-                                if (Util_evalQExpression(r->operator, s->inf->priv.process.mem_percent, r->limit)) {
-                                        snprintf(report, STRLEN, "mem usage of %.1f%% matches resource limit [mem usage%s%.1f%%]", s->inf->priv.process.mem_percent / 10., operatorshortnames[r->operator], r->limit / 10.);
-                                        okay = false;
-                                } else
-                                        snprintf(report, STRLEN, "mem usage check succeeded [current mem usage=%.1f%%]", s->inf->priv.process.mem_percent / 10.);
-                        }
-                        break;
-
-                case Resource_MemoryKbyte:
-                        if (s->type == Service_System) {
-                                if (Util_evalQExpression(r->operator, systeminfo.total_mem_kbyte, r->limit)) {
-                                        snprintf(report, STRLEN, "mem amount of %s matches resource limit [mem amount%s%s]", Str_bytesToSize(systeminfo.total_mem_kbyte * 1024., buf1), operatorshortnames[r->operator], Str_bytesToSize(r->limit * 1024., buf2));
-                                        okay = false;
-                                } else
-                                        snprintf(report, STRLEN, "mem amount check succeeded [current mem amount=%s]", Str_bytesToSize(systeminfo.total_mem_kbyte * 1024., buf1));
-                        } else {
-                                if (Util_evalQExpression(r->operator, s->inf->priv.process.mem_kbyte, r->limit)) {
-                                        snprintf(report, STRLEN, "mem amount of %s matches resource limit [mem amount%s%s]", Str_bytesToSize(s->inf->priv.process.mem_kbyte * 1024., buf1), operatorshortnames[r->operator], Str_bytesToSize(r->limit * 1024., buf2));
-                                        okay = false;
-                                } else
-                                        snprintf(report, STRLEN, "mem amount check succeeded [current mem amount=%s]", Str_bytesToSize(s->inf->priv.process.mem_kbyte * 1024., buf1));
-                        }
-                        break;
-
+                case Resource_MemoryPercentTotal:
                 case Resource_SwapPercent:
-                        if (s->type == Service_System) {
-                                if (Util_evalQExpression(r->operator, systeminfo.total_swap_percent, r->limit)) {
-                                        snprintf(report, STRLEN, "swap usage of %.1f%% matches resource limit [swap usage%s%.1f%%]", systeminfo.total_swap_percent / 10., operatorshortnames[r->operator], r->limit / 10.);
-                                        okay = false;
-                                } else
-                                        snprintf(report, STRLEN, "swap usage check succeeded [current swap usage=%.1f%%]", systeminfo.total_swap_percent / 10.);
-                        }
+                case Resource_MonitCpu:
+                        snprintf(buf, STRLEN, "%.1f%%", value / 10.);
                         break;
-
+                case Resource_MemoryKbyte:
+                case Resource_MemoryKbyteTotal:
                 case Resource_SwapKbyte:
-                        if (s->type == Service_System) {
-                                if (Util_evalQExpression(r->operator, systeminfo.total_swap_kbyte, r->limit)) {
-                                        snprintf(report, STRLEN, "swap amount of %s matches resource limit [swap amount%s%s]", Str_bytesToSize(systeminfo.total_swap_kbyte * 1024., buf1), operatorshortnames[r->operator], Str_bytesToSize(r->limit * 1024., buf2));
-                                        okay = false;
-                                } else
-                                        snprintf(report, STRLEN, "swap amount check succeeded [current swap amount=%s]", Str_bytesToSize(systeminfo.total_swap_kbyte * 1024., buf1));
-                        }
+                case Resource_MonitMemory:
+                        Str_bytesToSize(value * 1024., buf);
                         break;
-
                 case Resource_LoadAverage1m:
-                        if (Util_evalQExpression(r->operator, (int)(systeminfo.loadavg[0] * 10.), r->limit)) {
-                                snprintf(report, STRLEN, "loadavg(1min) of %.1f matches resource limit [loadavg(1min)%s%.1f]", systeminfo.loadavg[0], operatorshortnames[r->operator], r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "loadavg(1min) check succeeded [current loadavg(1min)=%.1f]", systeminfo.loadavg[0]);
-                        break;
-
                 case Resource_LoadAverage5m:
-                        if (Util_evalQExpression(r->operator, (int)(systeminfo.loadavg[1] * 10.), r->limit)) {
-                                snprintf(report, STRLEN, "loadavg(5min) of %.1f matches resource limit [loadavg(5min)%s%.1f]", systeminfo.loadavg[1], operatorshortnames[r->operator], r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "loadavg(5min) check succeeded [current loadavg(5min)=%.1f]", systeminfo.loadavg[1]);
-                        break;
-
                 case Resource_LoadAverage15m:
-                        if (Util_evalQExpression(r->operator, (int)(systeminfo.loadavg[2] * 10.), r->limit)) {
-                                snprintf(report, STRLEN, "loadavg(15min) of %.1f matches resource limit [loadavg(15min)%s%.1f]", systeminfo.loadavg[2], operatorshortnames[r->operator], r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "loadavg(15min) check succeeded [current loadavg(15min)=%.1f]", systeminfo.loadavg[2]);
+                        snprintf(buf, STRLEN, "%.1f", value / 10.);
                         break;
-
                 case Resource_Children:
-                        if (Util_evalQExpression(r->operator, s->inf->priv.process.children, r->limit)) {
-                                snprintf(report, STRLEN, "children of %i matches resource limit [children%s%ld]", s->inf->priv.process.children, operatorshortnames[r->operator], r->limit);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "children check succeeded [current children=%i]", s->inf->priv.process.children);
+                case Resource_Tasks:
+                case Resource_FileDescriptors:
+                case Resource_MonitFileDescriptors:
+                        snprintf(buf, STRLEN, "%.10g", value);
                         break;
-
-                case Resource_MemoryKbyteTotal:
-                        if (Util_evalQExpression(r->operator, s->inf->priv.process.total_mem_kbyte, r->limit)) {
-                                snprintf(report, STRLEN, "total mem amount of %s matches resource limit [total mem amount%s%s]", Str_bytesToSize(s->inf->priv.process.total_mem_kbyte * 1024., buf1), operatorshortnames[r->operator], Str_bytesToSize(r->limit * 1024., buf2));
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "total mem amount check succeeded [current total mem amount=%s]", Str_bytesToSize(s->inf->priv.process.total_mem_kbyte * 1024., buf1));
-                        break;
-
-                case Resource_MemoryPercentTotal:
-                        if (Util_evalQExpression(r->operator, s->inf->priv.process.total_mem_percent, r->limit)) {
-                                snprintf(report, STRLEN, "total mem amount of %.1f%% matches resource limit [total mem amount%s%.1f%%]", (float)s->inf->priv.process.total_mem_percent / 10., operatorshortnames[r->operator], (float)r->limit / 10.);
-                                okay = false;
-                        } else
-                                snprintf(report, STRLEN, "total mem amount check succeeded [current total mem amount=%.1f%%]", s->inf->priv.process.total_mem_percent / 10.);
+                case Resource_ReadBytes:
+                case Resource_WriteBytes:
+                        Str_bytesToSize(value, buf);
+                        strncat(buf, "/s", STRLEN - strlen(buf) - 1);
                         break;
-
                 default:
-                        LogError("'%s' error -- unknown resource ID: [%d]\n", s->name, r->resource_id);
-                        return;
+                        snprintf(buf, STRLEN, "%.1f", value);
+                        break;
         }
-        Event_post(s, Event_Resource, okay ? State_Succeeded : State_Failed, r->action, "%s", report);
+        return buf;
 }
 
 
 /**
- * Test for associated path checksum change
+ * Check the average of the resource over the time window of the rule. The
+ * test is skipped until the history covers the window
  */
-static void check_checksum(Service_T s) {
-        int         changed;
-        Checksum_T  cs;
-
-        ASSERT(s && s->path && s->checksum);
+static void check_process_average(Service_T s, Resource_T r) {
+        double average;
+        if (! History_average(s, r->resource_id, r->window, &average)) {
+                DEBUG("'%s' average %s check skipped (collecting the history)\n", s->name, _resourceName(r->resource_id));
+                return;
+        }
+        char buf1[STRLEN], buf2[STRLEN];
+        if (Util_evalQExpression(r->operator, (long long)average, r->limit))
+                Event_post(s, Event_Resource, State_Failed, r->action, "average %s of %s over %ds matches resource limit [average %s%s%s]", _resourceName(r->resource_id), _resourceFormat(r->resource_id, average, buf1), r->window, _resourceName(r->resource_id), operatorshortnames[r->operator], _resourceFormat(r->resource_id, r->limit, buf2));
+        else
+                Event_post(s, Event_Resource, State_Succeeded, r->action, "average %s check succeeded [current average %s=%s over %ds]", _resourceName(r->resource_id), _resourceName(r->resource_id), _resourceFormat(r->resource_id, average, buf1), r->window);
+}
 
-        cs = s->checksum;
 
-        if (Util_getChecksum(s->path, cs->type, s->inf->priv.file.cs_sum, sizeof(s->inf->priv.file.cs_sum))) {
+/**
+ * Check the peak of the resource sampled by the high frequency sampler
+ * since the last cycle: the minimum for the less than rules, otherwise
+ * the maximum
+ * @return true if tested, false if there are no samples
+ */
+static boolean_t check_process_sampled(Service_T s, Resource_T r) {
+        Sample_T sample;
+        if (! Sampler_get(s, Sampler_getType(r->resource_id), &sample))
+                return false;
+        long long peak = r->operator == Operator_Less ? sample.min : sample.max;
+        char buf1[STRLEN], buf2[STRLEN], buf3[STRLEN];
+        if (Util_evalQExpression(r->operator, peak, r->limit))
+                Event_post(s, Event_Resource, State_Failed, r->action, "peak %s of %s in %d samples matches resource limit [%s%s%s]", _resourceName(r->resource_id), _resourceFormat(r->resource_id, peak, buf1), sample.count, _resourceName(r->resource_id), operatorshortnames[r->operator], _resourceFormat(r->resource_id, r->limit, buf2));
+        else
+                Event_post(s, Event_Resource, State_Succeeded, r->action, "%s check succeeded [peak %s=%s, average %s in %d samples]", _resourceName(r->resource_id), _resourceName(r->resource_id), _resourceFormat(r->resource_id, peak, buf1), _resourceFormat(r->resource_id, sample.average, buf3), sample.count);
+        return true;
+}
 
-                Event_post(s, Event_Data, State_Succeeded, s->action_DATA, "checksum computed for %s", s->path);
 
-                if (! cs->initialized) {
-                        cs->initialized = true;
-                        snprintf(cs->hash, sizeof(cs->hash), "%s", s->inf->priv.file.cs_sum);
+/**
+ * Read the metrics of the service's resource rules into the vector indexed
+ * by the resource type. The metrics which are not collected yet are unknown
+ */
+static void _resourceMetrics(Service_T s, long long metric[Resource_Types]) {
+        boolean_t init = s->monitor & Monitor_Init;
+        for (int i = 0; i < Resource_Types; i++)
+                metric[i] = METRIC_UNKNOWN;
+        metric[Resource_CpuUser] = init || systeminfo.total_cpu_user_percent < 0 ? METRIC_UNKNOWN : systeminfo.total_cpu_user_percent;
+        metric[Resource_CpuSystem] = init || systeminfo.total_cpu_syst_percent < 0 ? METRIC_UNKNOWN : systeminfo.total_cpu_syst_percent;
+        metric[Resource_CpuWait] = init || systeminfo.total_cpu_wait_percent < 0 ? METRIC_UNKNOWN : systeminfo.total_cpu_wait_percent;
+        metric[Resource_CpuMax] = init || systeminfo.cpu_max_percent < 0 ? METRIC_UNKNOWN : systeminfo.cpu_max_percent;
+        metric[Resource_CpuNodeMax] = init || systeminfo.node_max_percent < 0 ? METRIC_UNKNOWN : systeminfo.node_max_percent;
+        metric[Resource_LoadAverage1m] = (int)(systeminfo.loadavg[0] * 10.);
+        metric[Resource_LoadAverage5m] = (int)(systeminfo.loadavg[1] * 10.);
+        metric[Resource_LoadAverage15m] = (int)(systeminfo.loadavg[2] * 10.);
+        if (s->type == Service_System) {
+                metric[Resource_MemoryPercent] = systeminfo.total_mem_percent;
+                metric[Resource_MemoryKbyte] = systeminfo.total_mem_kbyte;
+                metric[Resource_SwapPercent] = systeminfo.total_swap_percent;
+                metric[Resource_SwapKbyte] = systeminfo.total_swap_kbyte;
+                // The daemon's own footprint, measured at the end of the previous cycle
+                if (! init) {
+                        metric[Resource_MonitCpu] = Run.latency.usage.cpupercent;
+                        metric[Resource_MonitMemory] = Run.latency.usage.rss;
+                        metric[Resource_MonitFileDescriptors] = Run.latency.usage.fds;
                 }
+        } else {
+                metric[Resource_CpuPercent] = init || s->inf->priv.process.cpu_percent < 0 ? METRIC_UNKNOWN : s->inf->priv.process.cpu_percent;
+                metric[Resource_CpuPercentTotal] = init || s->inf->priv.process.total_cpu_percent < 0 ? METRIC_UNKNOWN : s->inf->priv.process.total_cpu_percent;
+                metric[Resource_MemoryPercent] = s->inf->priv.process.mem_percent;
+                metric[Resource_MemoryKbyte] = s->inf->priv.process.mem_kbyte;
+                metric[Resource_MemoryPercentTotal] = s->inf->priv.process.total_mem_percent;
+                metric[Resource_MemoryKbyteTotal] = s->inf->priv.process.total_mem_kbyte;
+                metric[Resource_Children] = s->inf->priv.process.children;
+                metric[Resource_Tasks] = s->inf->priv.process.threads < 0 ? METRIC_UNKNOWN : s->inf->priv.process.threads;
+                metric[Resource_FileDescriptors] = s->inf->priv.process.fds < 0 ? METRIC_UNKNOWN : s->inf->priv.process.fds;
+                metric[Resource_ReadBytes] = init || s->inf->priv.process.read_rate < 0 ? METRIC_UNKNOWN : s->inf->priv.process.read_rate;
+                metric[Resource_WriteBytes] = init || s->inf->priv.process.write_rate < 0 ? METRIC_UNKNOWN : s->inf->priv.process.write_rate;
+        }
+}
 
-                switch (cs->type) {
-                        case Hash_Md5:
-                                changed = strncmp(cs->hash, s->inf->priv.file.cs_sum, 32);
-                                break;
-                        case Hash_Sha1:
-                                changed = strncmp(cs->hash, s->inf->priv.file.cs_sum, 40);
-                                break;
-                        default:
-                                LogError("'%s' unknown hash type\n", s->name);
-                                *s->inf->priv.file.cs_sum = 0;
-                                return;
+
+/**
+ * Check the resource rules of the process, cgroup or system service. The
+ * metrics are read once into a vector, then the compiled rules are tested
+ * in one pass over the service's rule table
+ * @param s The service
+ * @param average true if the average rules should be tested as well
+ */
+static void check_process_resources(Service_T s, boolean_t average) {
+        ASSERT(s);
+        RuleTable_T T = s->ruletable;
+        if (! T)
+                return;
+        long long metric[Resource_Types];
+        _resourceMetrics(s, metric);
+        for (int i = 0; i < T->count; i++) {
+                Rule_T *rule = &T->rule[i];
+                Resource_T r = rule->source.resource;
+                if (r->window) {
+                        if (average)
+                                check_process_average(s, r);
+                        continue;
                 }
+                if (r->sampled && check_process_sampled(s, r))
+                        continue;
+                long long value = metric[rule->metric];
+                if (value == METRIC_UNKNOWN) {
+                        DEBUG("'%s' %s check skipped (%s)\n", s->name, _resourceName(r->resource_id), s->monitor & Monitor_Init ? "initializing" : "not available");
+                        continue;
+                }
+                char buf1[STRLEN], buf2[STRLEN], detail[STRLEN] = {0};
+                if (r->resource_id == Resource_CpuMax)
+                        snprintf(detail, sizeof(detail), " (cpu %d)", systeminfo.cpu_max);
+                else if (r->resource_id == Resource_CpuNodeMax)
+                        snprintf(detail, sizeof(detail), " (node %d)", systeminfo.node_max);
+                if (rule->matches(value, rule->limit))
+                        Event_post(s, Event_Resource, State_Failed, r->action, "%s of %s%s matches resource limit [%s%s%s]", _resourceName(r->resource_id), _resourceFormat(r->resource_id, value, buf1), detail, _resourceName(r->resource_id), operatorshortnames[r->operator], _resourceFormat(r->resource_id, rule->limit, buf2));
+                else
+                        Event_post(s, Event_Resource, State_Succeeded, r->action, "%s check succeeded [current %s=%s%s]", _resourceName(r->resource_id), _resourceName(r->resource_id), _resourceFormat(r->resource_id, value, buf1), detail);
+        }
+}
 
-                if (changed) {
 
-                        if (cs->test_changes) {
-                                /* if we are testing for changes only, the value is variable */
-                                Event_post(s, Event_Checksum, State_Changed, cs->action, "checksum was changed for %s", s->path);
-                                /* reset expected value for next cycle */
-                                snprintf(cs->hash, sizeof(cs->hash), "%s", s->inf->priv.file.cs_sum);
-                        } else {
-                                /* we are testing constant value for failed or succeeded state */
-                                Event_post(s, Event_Checksum, State_Failed, cs->action, "checksum test failed for %s", s->path);
-                        }
+/**
+ * Take the process totals from the control group statistics: the cgroup
+ * accounts also for the processes which left the process tree
+ */
+static void _cgroupTotals(Service_T s) {
+        s->inf->priv.process.total_cpu_percent = s->cgroup->cpu_percent;
+        s->inf->priv.process.total_mem_kbyte = s->cgroup->mem_kbyte;
+        s->inf->priv.process.total_mem_percent = s->cgroup->mem_percent;
+        s->inf->priv.process.children = s->cgroup->processes > 0 ? s->cgroup->processes - 1 : 0;
+}
 
-                } else if (cs->test_changes) {
-                        Event_post(s, Event_Checksum, State_ChangedNot, cs->action, "checksum has not changed");
-                } else {
-                        Event_post(s, Event_Checksum, State_Succeeded, cs->action, "checksum is valid");
+
+/* The ranked process table entry of the processes service */
+typedef struct {
+        int index;                                 /* The process tree entry */
+        double key;                /* The rank (the value to the limit ratio) */
+} Rank_T;
+
+
+/**
+ * Add the entry to the bounded min-heap of the K highest ranked entries.
+ * The lowest ranked entry is the root, so the entry is added in O(log K)
+ * and dropped in O(1) if it ranks below all kept entries
+ * @param heap The heap of size entries
+ * @param count The number of entries in the heap
+ */
+static void _rankPush(Rank_T *heap, int *count, int size, int index, double key) {
+        int i;
+        if (*count < size) {
+                for (i = (*count)++; i > 0 && heap[(i - 1) / 2].key > key; i = (i - 1) / 2)
+                        heap[i] = heap[(i - 1) / 2];
+        } else if (key > heap[0].key) {
+                for (i = 0; 2 * i + 1 < size; ) {
+                        int child = 2 * i + 1;
+                        if (child + 1 < size && heap[child + 1].key < heap[child].key)
+                                child++;
+                        if (heap[child].key >= key)
+                                break;
+                        heap[i] = heap[child];
+                        i = child;
                 }
+        } else {
                 return;
         }
+        heap[i].index = index;
+        heap[i].key = key;
+}
 
-        Event_post(s, Event_Data, State_Failed, s->action_DATA, "cannot compute checksum for %s", s->path);
 
+static int _rankCompare(const void *a, const void *b) {
+        double x = ((const Rank_T *)a)->key;
+        double y = ((const Rank_T *)b)->key;
+        return x > y ? -1 : x < y ? 1 : 0;
 }
 
 
 /**
- * Test for associated path permission change
+ * Returns the process table entry value tested by the processes service
+ * resource rule (in the rule's limit units) or -1 if not available
+ */
+static long long _processesValue(Service_T s, Resource_T r, ProcessTree_T *p) {
+        switch (r->resource_id) {
+                case Resource_CpuPercent:
+                        return s->monitor & Monitor_Init ? -1 : p->cpu_percent;
+                case Resource_CpuPercentTotal:
+                        return s->monitor & Monitor_Init ? -1 : p->cpu_percent_sum;
+                case Resource_MemoryKbyte:
+                        return p->mem_kbyte;
+                case Resource_MemoryKbyteTotal:
+                        return p->mem_kbyte_sum;
+                case Resource_MemoryPercent:
+                        return systeminfo.mem_kbyte_max > 0 ? (long long)(1000. * p->mem_kbyte / systeminfo.mem_kbyte_max) : -1;
+                case Resource_MemoryPercentTotal:
+                        return systeminfo.mem_kbyte_max > 0 ? (long long)(1000. * p->mem_kbyte_sum / systeminfo.mem_kbyte_max) : -1;
+                default:
+                        return -1;
+        }
+}
+
+
+/**
+ * Format the processes service resource rule value
+ */
+static char *_processesFormat(Resource_T r, long long value, char *buf) {
+        if (r->resource_id == Resource_MemoryKbyte || r->resource_id == Resource_MemoryKbyteTotal)
+                return Str_bytesToSize(value * 1024., buf);
+        snprintf(buf, STRLEN, "%.1f%%", value / 10.);
+        return buf;
+}
+
+
+/**
+ * Returns true if the file status is the same as at the last checksum computation
+ */
+static boolean_t _isChecksumStatValid(Service_T s, struct stat *sb) {
+        return s->inf->priv.file.cs_stat.dev == sb->st_dev &&
+               s->inf->priv.file.cs_stat.inode == sb->st_ino &&
+               s->inf->priv.file.cs_stat.size == sb->st_size &&
+               s->inf->priv.file.cs_stat.mtime == sb->st_mtime &&
+               s->inf->priv.file.cs_stat.mtime_nsec == STAT_MTIME_NSEC(sb) &&
+               s->inf->priv.file.cs_stat.ctime == sb->st_ctime &&
+               s->inf->priv.file.cs_stat.ctime_nsec == STAT_CTIME_NSEC(sb);
+}
+
+
+/**
+ * Remember the file status the checksum was computed for
+ */
+static void _setChecksumStat(Service_T s, struct stat *sb) {
+        s->inf->priv.file.cs_stat.dev = sb->st_dev;
+        s->inf->priv.file.cs_stat.inode = sb->st_ino;
+        s->inf->priv.file.cs_stat.size = sb->st_size;
+        s->inf->priv.file.cs_stat.mtime = sb->st_mtime;
+        s->inf->priv.file.cs_stat.mtime_nsec = STAT_MTIME_NSEC(sb);
+        s->inf->priv.file.cs_stat.ctime = sb->st_ctime;
+        s->inf->priv.file.cs_stat.ctime_nsec = STAT_CTIME_NSEC(sb);
+}
+
+
+/**
+ * Get the status of the file, directory or fifo service path. If statx()
+ * is available, only the fields which the service rules need are requested,
+ * so a network filesystem can skip asking the server for the others (the
+ * file size is always requested for the file size history). The fields
+ * which the filesystem didn't return keep the last known values. The
+ * status is read once per cycle and all tests of the service use it
+ * @param s The service
+ * @param sb The stat buffer
+ * @return 0 if succeeded, otherwise -1 and errno is set
+ */
+static int _stat(Service_T s, struct stat *sb) {
+#if defined HAVE_STATX && defined STATX_TYPE
+        unsigned int mask = STATX_TYPE;
+        if (s->perm)
+                mask |= STATX_MODE;
+        if (s->uid)
+                mask |= STATX_UID;
+        if (s->gid)
+                mask |= STATX_GID;
+        if (s->timestamplist)
+                mask |= STATX_MTIME | STATX_CTIME;
+        if (s->type == Service_File) {
+                mask |= STATX_SIZE;
+                if (s->matchlist)
+                        mask |= STATX_INO;
+                if (s->checksum)
+                        mask |= STATX_INO | STATX_MTIME | STATX_CTIME;
+        }
+        struct statx sx;
+        if (statx(AT_FDCWD, s->path, AT_STATX_SYNC_AS_STAT, mask, &sx) == 0) {
+                memset(sb, 0, sizeof(struct stat));
+                switch (s->type) {
+                        case Service_File:
+                                sb->st_mode = s->inf->priv.file.mode;
+                                sb->st_ino = s->inf->priv.file.inode;
+                                sb->st_uid = s->inf->priv.file.uid;
+                                sb->st_gid = s->inf->priv.file.gid;
+                                sb->st_size = s->inf->priv.file.size;
+                                sb->st_mtime = sb->st_ctime = s->inf->priv.file.timestamp;
+                                break;
+                        case Service_Directory:
+                                sb->st_mode = s->inf->priv.directory.mode;
+                                sb->st_uid = s->inf->priv.directory.uid;
+                                sb->st_gid = s->inf->priv.directory.gid;
+                                sb->st_mtime = sb->st_ctime = s->inf->priv.directory.timestamp;
+                                break;
+                        case Service_Fifo:
+                                sb->st_mode = s->inf->priv.fifo.mode;
+                                sb->st_uid = s->inf->priv.fifo.uid;
+                                sb->st_gid = s->inf->priv.fifo.gid;
+                                sb->st_mtime = sb->st_ctime = s->inf->priv.fifo.timestamp;
+                                break;
+                        default:
+                                break;
+                }
+                sb->st_dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+                sb->st_nlink = sx.stx_nlink;
+                if (sx.stx_mask & STATX_TYPE)
+                        sb->st_mode = (sb->st_mode & ~S_IFMT) | (sx.stx_mode & S_IFMT);
+                if (sx.stx_mask & STATX_MODE)
+                        sb->st_mode = (sb->st_mode & S_IFMT) | (sx.stx_mode & ~S_IFMT);
+                if (sx.stx_mask & STATX_INO)
+                        sb->st_ino = sx.stx_ino;
+                if (sx.stx_mask & STATX_UID)
+                        sb->st_uid = sx.stx_uid;
+                if (sx.stx_mask & STATX_GID)
+                        sb->st_gid = sx.stx_gid;
+                if (sx.stx_mask & STATX_SIZE)
+                        sb->st_size = sx.stx_size;
+                if (sx.stx_mask & STATX_MTIME) {
+                        sb->st_mtime = sx.stx_mtime.tv_sec;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+                        sb->st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+#endif
+                }
+                if (sx.stx_mask & STATX_CTIME) {
+                        sb->st_ctime = sx.stx_ctime.tv_sec;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+                        sb->st_ctim.tv_nsec = sx.stx_ctime.tv_nsec;
+#endif
+                }
+                return 0;
+        } else if (errno != ENOSYS) {
+                return -1;
+        }
+        /* The kernel doesn't support statx(), fall back to stat() */
+#endif
+        return stat(s->path, sb);
+}
+
+
+/**
+ * Compare the computed checksum with the expected one
+ */
+static void _testChecksum(Service_T s, char *sum) {
+        int changed;
+        Checksum_T cs = s->checksum;
+
+        if (! cs->initialized) {
+                cs->initialized = true;
+                snprintf(cs->hash, sizeof(cs->hash), "%s", sum);
+        }
+
+        switch (cs->type) {
+                case Hash_Md5:
+                        changed = strncmp(cs->hash, sum, 32);
+                        break;
+                case Hash_Sha1:
+                        changed = strncmp(cs->hash, sum, 40);
+                        break;
+                default:
+                        LogError("'%s' unknown hash type\n", s->name);
+                        *sum = 0;
+                        return;
+        }
+
+        if (changed) {
+
+                if (cs->test_changes) {
+                        /* if we are testing for changes only, the value is variable */
+                        Event_post(s, Event_Checksum, State_Changed, cs->action, "checksum was changed for %s", s->path);
+                        /* reset expected value for next cycle */
+                        snprintf(cs->hash, sizeof(cs->hash), "%s", sum);
+                } else {
+                        /* we are testing constant value for failed or succeeded state */
+                        Event_post(s, Event_Checksum, State_Failed, cs->action, "checksum test failed for %s", s->path);
+                }
+
+        } else if (cs->test_changes) {
+                Event_post(s, Event_Checksum, State_ChangedNot, cs->action, "checksum has not changed");
+        } else {
+                Event_post(s, Event_Checksum, State_Succeeded, cs->action, "checksum is valid");
+        }
+
+}
+
+
+/**
+ * Test for associated path checksum change. The checksum is computed
+ * only if the file status (sb) differs from the one at the last
+ * computation. If sb is NULL, the file events watcher reported no
+ * change since the last test.
+ */
+static void check_checksum(Service_T s, struct stat *sb) {
+        Checksum_T  cs;
+
+        ASSERT(s && s->path && s->checksum);
+
+        cs = s->checksum;
+
+        /* Rehash only if the file status changed since the last computation or the forced verification is due */
+        boolean_t compute = ! *s->inf->priv.file.cs_sum || (sb && ! _isChecksumStatValid(s, sb));
+        if (! compute && cs->verify && ++cs->cycles >= cs->verify) {
+                DEBUG("'%s' forced checksum verification\n", s->name);
+                compute = true;
+        }
+        if (compute) {
+                cs->cycles = 0;
+                if (! Util_getChecksum(s->path, cs->type, s->inf->priv.file.cs_sum, sizeof(s->inf->priv.file.cs_sum))) {
+                        *s->inf->priv.file.cs_sum = 0;
+                        Event_post(s, Event_Data, State_Failed, s->action_DATA, "cannot compute checksum for %s", s->path);
+                        return;
+                }
+                /* The status was read before hashing, so a modification during the computation triggers a rehash in the next cycle */
+                if (sb)
+                        _setChecksumStat(s, sb);
+        } else {
+                DEBUG("'%s' file status has not changed, reusing the last checksum\n", s->name);
+        }
+
+        Event_post(s, Event_Data, State_Succeeded, s->action_DATA, "checksum computed for %s", s->path);
+
+        _testChecksum(s, s->inf->priv.file.cs_sum);
+}
+
+
+/**
+ * Test the checksum of the directory tree. The tree is hashed by the
+ * background worker, the test uses the result of the last completed pass
+ */
+static void check_checksum_tree(Service_T s) {
+        ASSERT(s && s->checksum && s->checksum->tree);
+
+        Checksum_T cs = s->checksum;
+        boolean_t verify = false;
+        if (cs->verify && ++cs->cycles >= cs->verify) {
+                DEBUG("'%s' forced tree checksum verification\n", s->name);
+                cs->cycles = 0;
+                verify = true;
+        }
+        char error[STRLEN];
+        switch (Merkle_update(cs->tree, verify, s->inf->priv.directory.cs_sum, &s->inf->priv.directory.cs_files, error, sizeof(error))) {
+                case Merkle_Pending:
+                        DEBUG("'%s' tree checksum computation is in progress\n", s->name);
+                        return;
+                case Merkle_Failed:
+                        Event_post(s, Event_Data, State_Failed, s->action_DATA, "cannot compute the tree checksum -- %s", error);
+                        return;
+                default:
+                        break;
+        }
+
+        Event_post(s, Event_Data, State_Succeeded, s->action_DATA, "tree checksum computed for %s [%d files]", s->path, s->inf->priv.directory.cs_files);
+
+        _testChecksum(s, s->inf->priv.directory.cs_sum);
+}
+
+
+/**
+ * Test for associated path permission change
  */
 static void check_perm(Service_T s, mode_t mode) {
         ASSERT(s && s->perm);
@@ -564,10 +1374,22 @@ static void check_timestamp(Service_T s, time_t timestamp) {
  */
 static void check_size(Service_T s) {
         ASSERT(s && s->sizelist);
-        char buf[10];
+        char buf[10], limit[10];
         for (Size_T sl = s->sizelist; sl; sl = sl->next) {
-                /* if we are testing for changes only, the value is variable */
-                if (sl->test_changes) {
+                if (sl->rate) {
+                        /* the size change over the time window of the rule, the test is skipped until the history covers the window */
+                        double rate;
+                        if (! History_rate(s, Resource_Size, sl->rate, &rate)) {
+                                DEBUG("'%s' size rate check skipped (collecting the history)\n", s->name);
+                                continue;
+                        }
+                        long long change = (long long)(rate * sl->rate);
+                        if (Util_evalQExpression(sl->operator, change, sl->size))
+                                Event_post(s, Event_Size, State_Failed, sl->action, "size rate test failed for %s -- size changed by %s%s in %ds [limit %s]", s->path, change < 0 ? "-" : "", Str_bytesToSize(change < 0 ? -change : change, buf), sl->rate, Str_bytesToSize(sl->size, limit));
+                        else
+                                Event_post(s, Event_Size, State_Succeeded, sl->action, "size rate check succeeded [size changed by %s%s in %ds]", change < 0 ? "-" : "", Str_bytesToSize(change < 0 ? -change : change, buf), sl->rate);
+                } else if (sl->test_changes) {
+                        /* if we are testing for changes only, the value is variable */
                         if (! sl->initialized) {
                                 /* the size was not initialized during monit start, so set the size now
                                  * and allow further size change testing */
@@ -620,6 +1442,70 @@ static int check_pattern(Match_T pattern, const char *line) {
 }
 
 
+/**
+ * Returns true if the content line matches the pattern (or doesn't match the
+ * negated pattern). The regular expression is evaluated only if the line
+ * contains the literal part of the pattern.
+ */
+static boolean_t _matchLine(Match_T ml, const char *line) {
+        if (ml->literal && (ml->absent || ! strstr(line, ml->literal)))
+                return ml->not;
+        return (check_pattern(ml, line) == 0) ^ ml->not;
+}
+
+
+/**
+ * Mark the patterns whose literal part is not contained in the block of content
+ * lines, so they can be resolved for every line of the block without a search
+ */
+static void _prefilterBlock(Match_T list, const char *block, size_t length) {
+        for (Match_T ml = list; ml; ml = ml->next)
+#ifdef HAVE_MEMMEM
+                ml->absent = ml->literal && ! memmem(block, length, ml->literal, strlen(ml->literal));
+#else
+                ml->absent = false;
+#endif
+}
+
+
+/**
+ * Test the content line against the ignore and match patterns
+ */
+static void _matchContent(Service_T s, const char *line) {
+        Match_T ml;
+
+        /* Check ignores */
+        for (ml = s->matchignorelist; ml; ml = ml->next) {
+                if (_matchLine(ml, line)) {
+                        /* We match! -> line is ignored! */
+                        DEBUG("'%s' Ignore pattern %s'%s' match on content line\n", s->name, ml->not ? "not " : "", ml->match_string);
+                        return;
+                }
+        }
+
+        /* Check non ignores */
+        for (ml = s->matchlist; ml; ml = ml->next) {
+                if (_matchLine(ml, line)) {
+                        DEBUG("'%s' Pattern %s'%s' match on content line [%s]\n", s->name, ml->not ? "not " : "", ml->match_string, line);
+                        /* Save the line: we limit the content showed in the event roughly to MATCH_LINE_LENGTH (we allow exceed to not break the line) */
+                        if (! ml->log)
+                                ml->log = StringBuffer_create(MATCH_LINE_LENGTH);
+                        if (StringBuffer_length(ml->log) < MATCH_LINE_LENGTH) {
+                                /* The lines of the file instances are reported by the template together, prefixed with the file path */
+                                if (s->instance.owner)
+                                        StringBuffer_append(ml->log, "%s: %s\n", s->path, line);
+                                else
+                                        StringBuffer_append(ml->log, "%s\n", line);
+                                if (StringBuffer_length(ml->log) >= MATCH_LINE_LENGTH)
+                                        StringBuffer_append(ml->log, "...\n");
+                        }
+                } else {
+                        DEBUG("'%s' Pattern %s'%s' doesn't match on content line [%s]\n", s->name, ml->not ? "not " : "", ml->match_string, line);
+                }
+        }
+}
+
+
 /**
  * Match content.
  *
@@ -629,18 +1515,29 @@ static int check_pattern(Match_T pattern, const char *line) {
  * The test will resume at the beginning of the incomplete line during the next cycle, allowing the writer to finish the write.
  *
  * We test only MATCH_LINE_LENGTH at maximum (512 bytes) - in the case that the line is bigger, we read the rest of the line (till '\n') but ignore the characters past the maximum (512+).
+ *
+ * The file is read in MATCH_BLOCK_SIZE blocks and the lines are scanned in place. The patterns whose literal part is not contained in the block are resolved without the regular expression evaluation.
+ *
+ * If the file did not change since the last test, there is no new content and the file is not read.
+ *
+ * The matching lines are collected in the patterns, the events are posted by _reportMatch(). Returns false if the file cannot be opened.
  */
-static void check_match(Service_T s) {
-        Match_T ml;
-        FILE *file;
+static boolean_t _matchFile(Service_T s, boolean_t unchanged, char *buffer) {
+        int fd;
         char line[MATCH_LINE_LENGTH];
 
         ASSERT(s && s->matchlist);
 
+        /* The content left over by the budget of the last cycle must be matched even if the file did not change */
+        if (unchanged && ! Str_startsWith(s->path, "/proc") && s->inf->priv.file.readpos == s->inf->priv.file.size) {
+                DEBUG("'%s' content match skipped - file has not changed since last test\n", s->name);
+                return true;
+        }
+
         /* Open the file */
-        if (! (file = fopen(s->path, "r"))) {
+        if ((fd = open(s->path, O_RDONLY)) == -1) {
                 LogError("'%s' cannot open file %s: %s\n", s->name, s->path, STRERROR);
-                return;
+                return false;
         }
 
         /* FIXME: Refactor: Initialize the filesystems table ahead of file and filesystems test and index it by device id + replace the Str_startsWith() with lookup to the table by device id (obtained via file's stat()).
@@ -659,79 +1556,85 @@ static void check_match(Service_T s) {
                         DEBUG("'%s' content match skipped - file size nor inode has not changed since last test\n", s->name);
                         goto final;
                 }
-        }
 
-        while (true) {
-        next:
-                /* Seek to the read position */
-                if (fseek(file, (long)s->inf->priv.file.readpos, SEEK_SET)) {
-                        LogError("'%s' cannot seek file %s: %s\n", s->name, s->path, STRERROR);
+                /* If the matcher is too far behind, skip the backlog to keep the cycle time bounded */
+                if (s->matchbudget.behind && (unsigned long long)(s->inf->priv.file.size - s->inf->priv.file.readpos) > s->matchbudget.behind) {
+                        LogWarning("'%s' content match is %llu bytes behind -- skipping to the end of file %s\n", s->name, (unsigned long long)(s->inf->priv.file.size - s->inf->priv.file.readpos), s->path);
+                        s->inf->priv.file.readpos = s->inf->priv.file.size;
                         goto final;
                 }
+        }
 
-                if (! fgets(line, MATCH_LINE_LENGTH, file)) {
-                        if (! feof(file))
-                                LogError("'%s' cannot read file %s: %s\n", s->name, s->path, STRERROR);
-                        goto final;
-                }
+        /* Seek to the read position */
+        if (lseek(fd, s->inf->priv.file.readpos, SEEK_SET) == -1) {
+                LogError("'%s' cannot seek file %s: %s\n", s->name, s->path, STRERROR);
+                goto final;
+        }
 
-                size_t length = strlen(line);
-                if (length == 0) {
-                        /* No content: shouldn't happen - empty line will contain at least '\n' */
-                        goto final;
-                } else if (line[length-1] != '\n') {
-                        if (length < MATCH_LINE_LENGTH-1) {
+        size_t used = 0;      // Bytes in the buffer, the buffer starts at the beginning of an unprocessed line
+        size_t scanned = 0;   // Bytes of the buffer already searched for the newline
+        size_t discarded = 0; // Bytes of an overlong line dropped from the buffer past MATCH_LINE_LENGTH
+        off_t startpos = s->inf->priv.file.readpos;
+        long long started = Time_milli();
+        while (true) {
+                /* If the budget is exhausted, keep the read position and continue in the next cycle */
+                if ((s->matchbudget.bytes && (unsigned long long)(s->inf->priv.file.readpos - startpos) >= s->matchbudget.bytes) || (s->matchbudget.timeout && Time_milli() - started >= s->matchbudget.timeout * 1000LL)) {
+                        LogInfo("'%s' content match budget exceeded, %llu bytes behind -- continuing in the next cycle\n", s->name, (unsigned long long)MAX(s->inf->priv.file.size - s->inf->priv.file.readpos, 0));
+                        break;
+                }
+                ssize_t n = read(fd, buffer + used, MATCH_BLOCK_SIZE - used);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        LogError("'%s' cannot read file %s: %s\n", s->name, s->path, STRERROR);
+                        break;
+                } else if (n == 0) {
+                        if (used)
                                 /* Incomplete line: we gonna read it next time again, allowing the writer to complete the write */
                                 DEBUG("'%s' content match: incomplete line read - no new line at end. (retrying next cycle)\n", s->name);
-                                goto final;
-                        } else if (length == MATCH_LINE_LENGTH-1) {
-                                /* Our read buffer is full: ignore the content past the MATCH_LINE_LENGTH */
-                                int rv;
-                                do {
-                                        if ((rv = fgetc(file)) == EOF)
-                                                goto final;
-                                        length++;
-                                } while (rv != '\n');
-                        }
-                } else {
-                        /* Remove appending newline */
-                        line[length - 1] = 0;
-                }
-                /* Set read position to the end of last read */
-                s->inf->priv.file.readpos += length;
-
-                /* Check ignores */
-                for (ml = s->matchignorelist; ml; ml = ml->next) {
-                        if ((check_pattern(ml, line) == 0)  ^ (ml->not)) {
-                                /* We match! -> line is ignored! */
-                                DEBUG("'%s' Ignore pattern %s'%s' match on content line\n", s->name, ml->not ? "not " : "", ml->match_string);
-                                goto next;
-                        }
+                        break;
                 }
+                used += n;
 
-                /* Check non ignores */
-                for (ml = s->matchlist; ml; ml = ml->next) {
-                        if ((check_pattern(ml, line) == 0) ^ (ml->not)) {
-                                DEBUG("'%s' Pattern %s'%s' match on content line [%s]\n", s->name, ml->not ? "not " : "", ml->match_string, line);
-                                /* Save the line: we limit the content showed in the event roughly to MATCH_LINE_LENGTH (we allow exceed to not break the line) */
-                                if (! ml->log)
-                                        ml->log = StringBuffer_create(MATCH_LINE_LENGTH);
-                                if (StringBuffer_length(ml->log) < MATCH_LINE_LENGTH) {
-                                        StringBuffer_append(ml->log, "%s\n", line);
-                                        if (StringBuffer_length(ml->log) >= MATCH_LINE_LENGTH)
-                                                StringBuffer_append(ml->log, "...\n");
-                                }
-                        } else {
-                                DEBUG("'%s' Pattern %s'%s' doesn't match on content line [%s]\n", s->name, ml->not ? "not " : "", ml->match_string, line);
-                        }
+                /* Scan the complete lines in place. The incomplete line at the end of the block is moved to the beginning of the buffer */
+                char *start = buffer, *eol = memchr(buffer + scanned, '\n', used - scanned);
+                if (eol) {
+                        _prefilterBlock(s->matchignorelist, buffer, used);
+                        _prefilterBlock(s->matchlist, buffer, used);
+                }
+                while (eol) {
+                        /* Test the line content up to MATCH_LINE_LENGTH */
+                        size_t length = MIN((size_t)(eol - start), MATCH_LINE_LENGTH - 1);
+                        memcpy(line, start, length);
+                        line[length] = 0;
+                        /* Set read position to the end of last read */
+                        s->inf->priv.file.readpos += eol - start + 1 + discarded;
+                        discarded = 0;
+                        _matchContent(s, line);
+                        start = eol + 1;
+                        eol = memchr(start, '\n', buffer + used - start);
+                }
+                used -= start - buffer;
+                memmove(buffer, start, used);
+                scanned = used;
+                if (used == MATCH_BLOCK_SIZE) {
+                        /* Overlong line: keep its beginning only and ignore the content past the MATCH_LINE_LENGTH */
+                        discarded += used - (MATCH_LINE_LENGTH - 1);
+                        used = scanned = MATCH_LINE_LENGTH - 1;
                 }
         }
 final:
-        if (fclose(file))
+        if (close(fd))
                 LogError("'%s' cannot close file %s: %s\n", s->name, s->path, STRERROR);
+        return true;
+}
 
-        /* Post process the matches: generate events for particular patterns */
-        for (ml = s->matchlist; ml; ml = ml->next) {
+
+/**
+ * Post process the matches: generate events for particular patterns
+ */
+static void _reportMatch(Service_T s) {
+        for (Match_T ml = s->matchlist; ml; ml = ml->next) {
                 if (ml->log) {
                         Event_post(s, Event_Content, State_Changed, ml->action, "content match:\n%s", StringBuffer_toString(ml->log));
                         StringBuffer_free(&ml->log);
@@ -742,6 +1645,15 @@ final:
 }
 
 
+static void check_match(Service_T s, boolean_t unchanged) {
+        char *buffer = ALLOC(MATCH_BLOCK_SIZE);
+        boolean_t opened = _matchFile(s, unchanged, buffer);
+        FREE(buffer);
+        if (opened)
+                _reportMatch(s);
+}
+
+
 /**
  * Test filesystem flags for possible change since last cycle
  */
@@ -758,109 +1670,50 @@ static void check_filesystem_flags(Service_T s) {
 }
 
 /**
- * Filesystem test
+ * Check the filesystem rules of the service in one pass over its rule
+ * table. The metric index of a compiled rule is the resource (inode, inode
+ * free, space or space free) * 2 + 1 for the absolute limit, see
+ * validate_compileRules()
  */
-static void check_filesystem_resources(Service_T s, Filesystem_T td) {
-        ASSERT(s && td);
-
-        if ( (td->limit_percent < 0) && (td->limit_absolute < 0) ) {
-                LogError("'%s' error: filesystem limit not set\n", s->name);
+static void check_filesystem_resources(Service_T s) {
+        ASSERT(s);
+        static const char *names[] = {"inode usage", "inode free", "space usage", "space free"};
+        RuleTable_T T = s->ruletable;
+        if (! T)
                 return;
+        boolean_t inodes = s->inf->priv.filesystem.f_files > 0;
+        long long metric[] = {
+                inodes ? s->inf->priv.filesystem.inode_percent : METRIC_UNKNOWN,
+                inodes ? s->inf->priv.filesystem.inode_total : METRIC_UNKNOWN,
+                inodes ? 1000 - s->inf->priv.filesystem.inode_percent : METRIC_UNKNOWN,
+                inodes ? s->inf->priv.filesystem.f_filesfree : METRIC_UNKNOWN,
+                s->inf->priv.filesystem.space_percent,
+                s->inf->priv.filesystem.space_total,
+                1000 - s->inf->priv.filesystem.space_percent,
+                s->inf->priv.filesystem.f_blocksfreetotal
+        };
+        for (int i = 0; i < T->count; i++) {
+                Rule_T *rule = &T->rule[i];
+                Filesystem_T td = rule->source.filesystem;
+                const char *name = names[rule->metric / 2];
+                long long value = metric[rule->metric];
+                if (value == METRIC_UNKNOWN) {
+                        DEBUG("'%s' filesystem doesn't support inodes\n", s->name);
+                        continue;
+                }
+                if (! rule->matches(value, rule->limit)) {
+                        Event_post(s, Event_Resource, State_Succeeded, td->action, "%s test succeeded [current %s=%.1f%%]", name, name, metric[rule->metric & ~1] / 10.);
+                } else if (! (rule->metric & 1)) {
+                        Event_post(s, Event_Resource, State_Failed, td->action, "%s %.1f%% matches resource limit [%s%s%.1f%%]", name, value / 10., name, operatorshortnames[td->operator], rule->limit / 10.);
+                } else if (rule->metric < 4) {
+                        Event_post(s, Event_Resource, State_Failed, td->action, "%s %lld matches resource limit [%s%s%lld]", name, value, name, operatorshortnames[td->operator], rule->limit);
+                } else if (s->inf->priv.filesystem.f_bsize > 0) {
+                        char buf1[STRLEN], buf2[STRLEN];
+                        Event_post(s, Event_Resource, State_Failed, td->action, "%s %s matches resource limit [%s%s%s]", name, Str_bytesToSize(value * s->inf->priv.filesystem.f_bsize, buf1), name, operatorshortnames[td->operator], Str_bytesToSize(rule->limit * s->inf->priv.filesystem.f_bsize, buf2));
+                } else {
+                        Event_post(s, Event_Resource, State_Failed, td->action, "%s %lld blocks matches resource limit [%s%s%lld blocks]", name, value, name, operatorshortnames[td->operator], rule->limit);
+                }
         }
-
-        switch (td->resource) {
-
-                case Resource_Inode:
-                        if (s->inf->priv.filesystem.f_files <= 0) {
-                                DEBUG("'%s' filesystem doesn't support inodes\n", s->name);
-                                return;
-                        }
-
-                        if (td->limit_percent >= 0) {
-                                if (Util_evalQExpression(td->operator, s->inf->priv.filesystem.inode_percent, td->limit_percent)) {
-                                        Event_post(s, Event_Resource, State_Failed, td->action, "inode usage %.1f%% matches resource limit [inode usage%s%.1f%%]", s->inf->priv.filesystem.inode_percent / 10., operatorshortnames[td->operator], td->limit_percent / 10.);
-                                        return;
-                                }
-                        } else {
-                                if (Util_evalQExpression(td->operator, s->inf->priv.filesystem.inode_total, td->limit_absolute)) {
-                                        Event_post(s, Event_Resource, State_Failed, td->action, "inode usage %lld matches resource limit [inode usage%s%lld]", s->inf->priv.filesystem.inode_total, operatorshortnames[td->operator], td->limit_absolute);
-                                        return;
-                                }
-                        }
-                        Event_post(s, Event_Resource, State_Succeeded, td->action, "inode usage test succeeded [current inode usage=%.1f%%]", s->inf->priv.filesystem.inode_percent / 10.);
-                        return;
-
-                case Resource_InodeFree:
-                        if (s->inf->priv.filesystem.f_files <= 0) {
-                                DEBUG("'%s' filesystem doesn't support inodes\n", s->name);
-                                return;
-                        }
-
-                        if (td->limit_percent >= 0) {
-                                if (Util_evalQExpression(td->operator, 1000 - s->inf->priv.filesystem.inode_percent, td->limit_percent)) {
-                                        Event_post(s, Event_Resource, State_Failed, td->action, "inode free %.1f%% matches resource limit [inode free%s%.1f%%]", (1000. - s->inf->priv.filesystem.inode_percent) / 10., operatorshortnames[td->operator], td->limit_percent / 10.);
-                                        return;
-                                }
-                        } else {
-                                if (Util_evalQExpression(td->operator, s->inf->priv.filesystem.f_filesfree, td->limit_absolute)) {
-                                        Event_post(s, Event_Resource, State_Failed, td->action, "inode free %lld matches resource limit [inode free%s%lld]", s->inf->priv.filesystem.f_filesfree, operatorshortnames[td->operator], td->limit_absolute);
-                                        return;
-                                }
-                        }
-                        Event_post(s, Event_Resource, State_Succeeded, td->action, "inode free test succeeded [current inode free=%.1f%%]", (1000. - s->inf->priv.filesystem.inode_percent) / 10.);
-                        return;
-
-                case Resource_Space:
-                        if (td->limit_percent >= 0) {
-                                if (Util_evalQExpression(td->operator, s->inf->priv.filesystem.space_percent, td->limit_percent)) {
-                                        Event_post(s, Event_Resource, State_Failed, td->action, "space usage %.1f%% matches resource limit [space usage%s%.1f%%]", s->inf->priv.filesystem.space_percent / 10., operatorshortnames[td->operator], td->limit_percent / 10.);
-                                        return;
-                                }
-                        } else {
-                                if (Util_evalQExpression(td->operator, s->inf->priv.filesystem.space_total, td->limit_absolute)) {
-                                        if (s->inf->priv.filesystem.f_bsize > 0) {
-                                                char buf1[STRLEN];
-                                                char buf2[STRLEN];
-                                                Str_bytesToSize(s->inf->priv.filesystem.space_total * s->inf->priv.filesystem.f_bsize, buf1);
-                                                Str_bytesToSize(td->limit_absolute * s->inf->priv.filesystem.f_bsize, buf2);
-                                                Event_post(s, Event_Resource, State_Failed, td->action, "space usage %s matches resource limit [space usage%s%s]", buf1, operatorshortnames[td->operator], buf2);
-                                        } else {
-                                                Event_post(s, Event_Resource, State_Failed, td->action, "space usage %lld blocks matches resource limit [space usage%s%lld blocks]", s->inf->priv.filesystem.space_total, operatorshortnames[td->operator], td->limit_absolute);
-                                        }
-                                        return;
-                                }
-                        }
-                        Event_post(s, Event_Resource, State_Succeeded, td->action, "space usage test succeeded [current space usage=%.1f%%]", s->inf->priv.filesystem.space_percent / 10.);
-                        return;
-
-                case Resource_SpaceFree:
-                        if (td->limit_percent >= 0) {
-                                if (Util_evalQExpression(td->operator, 1000 - s->inf->priv.filesystem.space_percent, td->limit_percent)) {
-                                        Event_post(s, Event_Resource, State_Failed, td->action, "space free %.1f%% matches resource limit [space free%s%.1f%%]", (1000. - s->inf->priv.filesystem.space_percent) / 10., operatorshortnames[td->operator], td->limit_percent / 10.);
-                                        return;
-                                }
-                        } else {
-                                if (Util_evalQExpression(td->operator, s->inf->priv.filesystem.f_blocksfreetotal, td->limit_absolute)) {
-                                        if (s->inf->priv.filesystem.f_bsize > 0) {
-                                                char buf1[STRLEN];
-                                                char buf2[STRLEN];
-                                                Str_bytesToSize(s->inf->priv.filesystem.f_blocksfreetotal * s->inf->priv.filesystem.f_bsize, buf1);
-                                                Str_bytesToSize(td->limit_absolute * s->inf->priv.filesystem.f_bsize, buf2);
-                                                Event_post(s, Event_Resource, State_Failed, td->action, "space free %s matches resource limit [space free%s%s]", buf1, operatorshortnames[td->operator], buf2);
-                                        } else {
-                                                Event_post(s, Event_Resource, State_Failed, td->action, "space free %lld blocks matches resource limit [space free%s%lld blocks]", s->inf->priv.filesystem.f_blocksfreetotal, operatorshortnames[td->operator], td->limit_absolute);
-                                        }
-                                        return;
-                                }
-                        }
-                        Event_post(s, Event_Resource, State_Succeeded, td->action, "space free test succeeded [current space free=%.1f%%]", (1000. - s->inf->priv.filesystem.space_percent) / 10.);
-                        return;
-
-                default:
-                        LogError("'%s' error -- unknown resource type: [%d]\n", s->name, td->resource);
-                        return;
-        }
-
 }
 
 
@@ -890,64 +1743,644 @@ static void check_timeout(Service_T s) {
 }
 
 
-static boolean_t _incron(Service_T s, time_t now) {
-        if ((now - s->every.last_run) > 59) { // Minute is the lowest resolution, so only run once per minute
-                if (Time_incron(s->every.spec.cron, now)) {
-                        s->every.last_run = now;
-                        return true;
-                }
-        }
-        return false;
+/**
+ * Returns true if the cron scheduled check of the service is due. The next
+ * time the check may run is computed when the check runs or is found not
+ * due, so the cron spec is not matched in the cycles before it. Minute is
+ * the lowest resolution, so the check runs at most once per minute
+ * @param s A service with the cron spec
+ * @param now The current time
+ */
+static boolean_t _incron(Service_T s, time_t now) {
+        Cron_T cron = s->every.spec.cron.schedule;
+        if (now < cron->checked)
+                cron->next = 0; // The clock went back
+        cron->checked = now;
+        if (cron->next && now < cron->next)
+                return false;
+        if (! Cron_matches(cron, now)) {
+                cron->next = Cron_next(cron, now, true);
+                return false;
+        }
+        if (now - s->every.last_run <= 59) {
+                cron->next = Cron_next(cron, s->every.last_run + 60, true);
+                return false;
+        }
+        s->every.last_run = now;
+        cron->next = Cron_next(cron, now + 60, true);
+        return true;
+}
+
+
+/**
+ * Returns true if the check of the service is in its "not every" cron
+ * window. The window state is kept until the next change computed from
+ * the cron spec
+ * @param s A service with the negated cron spec
+ * @param now The current time
+ */
+static boolean_t _notincron(Service_T s, time_t now) {
+        Cron_T cron = s->every.spec.cron.schedule;
+        if (now < cron->checked || ! cron->next || now >= cron->next) {
+                cron->skip = Cron_matches(cron, now);
+                cron->next = Cron_next(cron, now, ! cron->skip);
+        }
+        cron->checked = now;
+        return cron->skip;
+}
+
+
+/**
+ * Returns true if the "every N seconds" check of the service is due in this
+ * cycle. The check runs in the cycle nearest to its deadline, so a deadline
+ * which falls between two cycles doesn't wait for the whole poll time
+ * @param s A service with the interval spec
+ * @param now The current time as returned by Latency_now()
+ */
+static boolean_t _intervalDue(Service_T s, unsigned long long now) {
+        return now + Run.polltime * 500000ULL >= s->every.spec.interval.next;
+}
+
+
+/**
+ * Returns true if the check of the service is due in this cycle. Unlike
+ * check_skip(), the test doesn't count the cycle and doesn't update the
+ * cron schedule, the cron based service is due once its next time passed
+ * @param s A service
+ * @param now The current time as returned by Latency_now()
+ */
+static boolean_t _due(Service_T s, unsigned long long now) {
+        if (s->every.type == Every_SkipCycles)
+                return s->every.spec.cycle.counter + 1 >= s->every.spec.cycle.number;
+        if (s->every.type == Every_Interval)
+                return _intervalDue(s, now);
+        if (s->every.type == Every_Cron)
+                return Time_now() >= s->every.spec.cron.schedule->next;
+        if (s->every.type == Every_NotInCron)
+                return ! s->every.spec.cron.schedule->skip || Time_now() >= s->every.spec.cron.schedule->next;
+        return true;
+}
+
+
+/**
+ * Returns true if some process service is checked in this cycle, so the
+ * process tree is needed. Used by the power save mode, which doesn't
+ * refresh the tree in the cycles without a process check
+ */
+static boolean_t _processDue(unsigned long long now) {
+        for (Service_T s = servicelist; s; s = s->next)
+                if ((s->type == Service_Process || s->type == Service_Processes) && s->monitor != Monitor_Not && _due(s, now))
+                        return true;
+        return false;
+}
+
+
+/**
+ * Schedule the first deadline of the services with the "every N seconds"
+ * spec. The deadlines are spread evenly across the interval, each service
+ * gets its own slot and a random offset within the slot, so the checks of
+ * the services with the same interval don't fire in the same cycle. The
+ * next deadlines follow at fixed rate, see check_skip()
+ * @param now The current time as returned by Latency_now()
+ */
+static void _scheduleIntervals(unsigned long long now) {
+        int count = 0;
+        for (Service_T s = servicelist; s; s = s->next)
+                if (s->every.type == Every_Interval && ! s->every.spec.interval.next)
+                        count++;
+        if (! count)
+                return;
+        int i = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (s->every.type == Every_Interval && ! s->every.spec.interval.next) {
+                        unsigned long long slot = s->every.spec.interval.seconds * 1000000ULL / count;
+                        s->every.spec.interval.next = now + slot * i++ + (slot ? (unsigned long long)random() % slot : 0) + 1;
+                        DEBUG("'%s' first check scheduled in %.1fs\n", s->name, (s->every.spec.interval.next - now) / 1000000.);
+                }
+        }
+}
+
+
+/**
+ * Returns true if validation should be skiped for
+ * this service in this cycle, otherwise false. Handle
+ * every statement
+ */
+static boolean_t check_skip(Service_T s) {
+        ASSERT(s);
+        if (s->visited) {
+                DEBUG("'%s' check skipped -- service already handled in a dependency chain\n", s->name);
+                return true;
+        }
+        Peer_T owner = NULL;
+        if (! Cluster_owns(s, &owner)) {
+                DEBUG("'%s' test skipped -- the host is checked by the cluster peer %s\n", s->name, owner ? owner->url->url : "");
+                return true;
+        }
+        time_t now = Time_now();
+        if (s->every.type == Every_SkipCycles) {
+                s->every.spec.cycle.counter++;
+                if (s->every.spec.cycle.counter < s->every.spec.cycle.number) {
+                        s->monitor |= Monitor_Waiting;
+                        DEBUG("'%s' test skipped as current cycle (%d) < every cycle (%d) \n", s->name, s->every.spec.cycle.counter, s->every.spec.cycle.number);
+                        return true;
+                }
+                s->every.spec.cycle.counter = 0;
+        } else if (s->every.type == Every_Cron && ! _incron(s, now)) {
+                s->monitor |= Monitor_Waiting;
+                DEBUG("'%s' test skipped as current time (%lld) does not match every's cron spec \"%s\"\n", s->name, (long long)now, s->every.spec.cron.spec);
+                return true;
+        } else if (s->every.type == Every_NotInCron && _notincron(s, now)) {
+                s->monitor |= Monitor_Waiting;
+                DEBUG("'%s' test skipped as current time (%lld) matches every's cron spec \"not %s\"\n", s->name, (long long)now, s->every.spec.cron.spec);
+                return true;
+        } else if (s->every.type == Every_Interval) {
+                unsigned long long clock = Latency_now();
+                if (! _intervalDue(s, clock)) {
+                        s->monitor |= Monitor_Waiting;
+                        DEBUG("'%s' test skipped as the next check is due in %.1fs\n", s->name, (s->every.spec.interval.next - clock) / 1000000.);
+                        return true;
+                }
+                /* Fixed-rate: the next deadline follows the previous one, the deadlines missed while the cycle overran are skipped */
+                unsigned long long period = s->every.spec.interval.seconds * 1000000ULL;
+                do {
+                        s->every.spec.interval.next += period;
+                } while (_intervalDue(s, clock));
+        }
+        s->monitor &= ~Monitor_Waiting;
+        return false;
+}
+
+
+/**
+ * Post the action done event and reset the scheduled action of the service s
+ */
+static void _actionDone(Service_T s) {
+        Event_post(s, Event_Action, State_Changed, s->action_ACTION, "%s action done", actionnames[s->doaction]);
+        s->doaction = Action_Ignored;
+        FREE(s->token);
+}
+
+
+/**
+ * Returns true if scheduled action was performed
+ */
+static boolean_t do_scheduled_action(Service_T s) {
+        int rv = false;
+        if (s->doaction != Action_Ignored) {
+                // FIXME: let the event engine do the action directly? (just replace s->action_ACTION with s->doaction and drop control_service call)
+                rv = control_service(s->name, s->doaction);
+                _actionDone(s);
+        }
+        return rv;
+}
+
+
+/**
+ * Perform all pending actions. The start and stop actions are passed to
+ * the service control in one batch, so independent services are started
+ * and stopped in parallel
+ */
+static void _doScheduledActions() {
+        int size = 0;
+        for (Service_T s = servicelist; s; s = s->next)
+                size++;
+        Service_T *services = CALLOC(size ? size : 1, sizeof(Service_T));
+        for (Service_T s = servicelist; s; s = s->next)
+                if (s->doaction != Action_Start && s->doaction != Action_Stop)
+                        do_scheduled_action(s);
+        Action_Type batch[] = {Action_Stop, Action_Start};
+        for (int i = 0; i < sizeof(batch) / sizeof(batch[0]); i++) {
+                int count = 0;
+                for (Service_T s = servicelist; s; s = s->next)
+                        if (s->doaction == batch[i])
+                                services[count++] = s;
+                if (count) {
+                        control_services(services, count, batch[i]);
+                        for (int j = 0; j < count; j++)
+                                _actionDone(services[j]);
+                }
+        }
+        FREE(services);
+}
+
+
+/**
+ * Run the service tests and update the monitoring state
+ * @return false if the service check failed, otherwise true
+ */
+/**
+ * Returns the service which the service depends on and which is down (it
+ * doesn't exist or its connection or ping test failed) or suppressed, or
+ * NULL if there is no such service. The services we depend on precede us
+ * in the servicelist, so their state is of this cycle
+ */
+static Service_T _downUpstream(Service_T s) {
+        for (Dependant_T d = s->dependantlist; d; d = d->next) {
+                Service_T u = Util_getService(d->dependant);
+                if (u && u->monitor != Monitor_Not && ((u->monitor & Monitor_Suppressed) || (u->error & ~u->error_hint & UPSTREAM_DOWN)))
+                        return u;
+        }
+        return NULL;
+}
+
+
+/**
+ * Probe the suppressed service instead of the full check: the process
+ * existence or the connection to the first port, without the protocol
+ * test. The probe posts no events, the event states are kept until the
+ * full check resumes
+ */
+static void _probeSuppressed(Service_T s) {
+        if (s->type == Service_Process) {
+                DEBUG("'%s' suppressed check probe -- the process is %s\n", s->name, Util_isProcessRunning(s, false) ? "running" : "not running");
+        } else if (s->portlist) {
+                char buf[STRLEN];
+                TRY
+                {
+                        _probeConnection(s->portlist);
+                        DEBUG("'%s' suppressed check probe -- %s is available\n", s->name, Util_portDescription(s->portlist, buf, sizeof(buf)));
+                }
+                ELSE
+                {
+                        DEBUG("'%s' suppressed check probe -- %s is not available: %s\n", s->name, Util_portDescription(s->portlist, buf, sizeof(buf)), Exception_frame.message);
+                }
+                END_TRY;
+        }
+}
+
+
+static boolean_t _checkService(Service_T s) {
+        boolean_t rv = true;
+        check_timeout(s); // Can disable monitoring => need to check s->monitor again
+        Service_T upstream = Run.dependsuppress && s->monitor ? _downUpstream(s) : NULL;
+        if (upstream) {
+                if (! (s->monitor & Monitor_Suppressed)) {
+                        LogInfo("'%s' checks suppressed -- the service '%s' it depends on is down\n", s->name, upstream->name);
+                        s->monitor |= Monitor_Suppressed;
+                }
+                _probeSuppressed(s);
+        } else if (s->monitor) {
+                if (s->monitor & Monitor_Suppressed)
+                        LogInfo("'%s' checks resumed -- the services it depends on are up\n", s->name);
+                unsigned long long started = Latency_now(), cpu = Latency_cpu();
+                PROBE1(check__start, s->name);
+                rv = s->check(s);
+                Latency_cost(Cost_Check, cpu);
+                Latency_record(Latency_get(&s->latency[Latency_Check]), started);
+                PROBE3(check__end, s->name, rv, Latency_now() - started);
+                /* The monitoring may be disabled by some matching rule in s->check
+                 * so we have to check again before setting to Monitor_Yes */
+                if (s->monitor != Monitor_Not)
+                        s->monitor = Monitor_Yes;
+        }
+        gettimeofday(&s->collected, NULL);
+        return rv;
+}
+
+
+/**
+ * Returns true if all services the job depends on were checked already
+ */
+static boolean_t _isRunnable(Job_T job) {
+        for (int i = 0; i < job->dependencies; i++)
+                if (scheduler.jobs[job->depends[i]].state != Job_Done)
+                        return false;
+        return true;
+}
+
+
+/**
+ * The check scheduler worker. Picks the first queued job whose dependencies
+ * were checked already - the servicelist is sorted by dependencies, so the
+ * scheduler keeps the "depend on" order and independent services are
+ * checked in parallel
+ */
+static void *_worker(void *args) {
+        LOCK(scheduler.mutex)
+        {
+                while (scheduler.queued && ! Run.stopped) {
+                        Job_T job = NULL;
+                        for (int i = 0; i < scheduler.count; i++) {
+                                if (scheduler.jobs[i].state == Job_Queued && _isRunnable(&scheduler.jobs[i])) {
+                                        job = &scheduler.jobs[i];
+                                        break;
+                                }
+                        }
+                        if (! job) {
+                                /* All queued jobs wait for a running check of the service they depend on */
+                                Sem_wait(scheduler.done, scheduler.mutex);
+                                continue;
+                        }
+                        job->state = Job_Running;
+                        scheduler.queued--;
+                        /* The service may be handled in a dependency chain by the action of some service checked earlier */
+                        boolean_t skip = check_skip(job->s);
+                        Mutex_unlock(scheduler.mutex);
+                        boolean_t failed = skip ? false : ! _checkService(job->s);
+                        Mutex_lock(scheduler.mutex);
+                        if (failed)
+                                scheduler.errors++;
+                        job->state = Job_Done;
+                        Sem_broadcast(scheduler.done);
+                }
+        }
+        END_LOCK;
+#ifdef HAVE_OPENSSL
+        Ssl_threadCleanup();
+#endif
+        return NULL;
+}
+
+
+/**
+ * Check the services using the pool of Run.scheduler_workers threads
+ * @return The number of failed service checks
+ */
+static int _checkParallel() {
+        int count = 0;
+        for (Service_T s = servicelist; s; s = s->next)
+                count++;
+        scheduler.count = scheduler.queued = scheduler.errors = 0;
+        scheduler.jobs = CALLOC(count, sizeof(struct myjob));
+        /* The job of each service by the service ordinal: the job index + 1, or 0 if the service is not checked in this cycle */
+        int *scheduled = CALLOC(count, sizeof(int));
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (Run.stopped)
+                        break;
+                if (do_scheduled_action(s) || ! s->monitor)
+                        continue;
+                Job_T job = &scheduler.jobs[scheduler.count];
+                job->s = s;
+                job->state = Job_Queued;
+                /* The services we depend on precede us in the servicelist, the dependencies were resolved when the configuration was loaded */
+                int dependencies = 0;
+                for (Dependant_T d = s->dependantlist; d; d = d->next)
+                        dependencies++;
+                if (dependencies) {
+                        job->depends = CALLOC(dependencies, sizeof(int));
+                        for (Dependant_T d = s->dependantlist; d; d = d->next)
+                                if (d->service && scheduled[d->service->ordinal])
+                                        job->depends[job->dependencies++] = scheduled[d->service->ordinal] - 1;
+                }
+                ASSERT(s->ordinal < count);
+                scheduled[s->ordinal] = ++scheduler.count;
+        }
+        FREE(scheduled);
+        scheduler.queued = scheduler.count;
+        int workers = Run.scheduler_workers < scheduler.count ? Run.scheduler_workers : scheduler.count;
+        Thread_T *threads = CALLOC(workers > 0 ? workers : 1, sizeof(Thread_T));
+        volatile int started = 0;
+        TRY
+        {
+                for (; started < workers; started++)
+                        Thread_create(threads[started], _worker, NULL);
+        }
+        ELSE
+        {
+                LogError("Check scheduler -- cannot create worker thread -- %s\n", Exception_frame.message);
+        }
+        END_TRY;
+        if (! started) // Fallback to serial check in the main thread
+                _worker(NULL);
+        for (int i = 0; i < started; i++)
+                Thread_join(threads[i]);
+        FREE(threads);
+        for (int i = 0; i < scheduler.count; i++)
+                FREE(scheduler.jobs[i].depends);
+        FREE(scheduler.jobs);
+        return scheduler.errors;
+}
+
+
+/**
+ * Returns true if the remote host will be checked in this cycle and its
+ * tests can be batched. Services with a cron based "every" spec are tested
+ * in their check, the hosts checked by another cluster member are skipped
+ */
+static boolean_t _batchDue(Service_T s) {
+        if (s->type != Service_Host || ! s->monitor || s->visited || s->every.type == Every_Cron || s->every.type == Every_NotInCron)
+                return false;
+        if (s->every.type == Every_SkipCycles && s->every.spec.cycle.counter + 1 < s->every.spec.cycle.number)
+                return false;
+        if (s->every.type == Every_Interval && ! _intervalDue(s, Latency_now()))
+                return false;
+        return Cluster_owns(s, NULL);
+}
+
+
+/**
+ * Ping all remote hosts which will be checked in this cycle in one batch, so
+ * a cycle with many hosts costs one ping timeout rather than the sum of all
+ * of them. A host pinged by several services with the same parameters is
+ * pinged once, the duplicate tests get the response of the first one
+ */
+static void _pingHosts() {
+        int count = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                for (Icmp_T icmp = s->icmplist; icmp; icmp = icmp->next) {
+                        icmp->batched = false;
+                        count++;
+                }
+        }
+        if (count < 2)
+                return;
+        const char **hostname = CALLOC(count, sizeof(char *));
+        Icmp_T *icmp = CALLOC(count, sizeof(Icmp_T));
+        Icmp_T *duplicate = CALLOC(count, sizeof(Icmp_T));
+        int *original = CALLOC(count, sizeof(int));
+        int duplicates = 0;
+        count = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (! _batchDue(s))
+                        continue;
+                for (Icmp_T i = s->icmplist; i; i = i->next) {
+                        if (i->type == ICMP_ECHO && ! i->backoff.skip) {
+                                int j = 0;
+                                while (j < count && ! (IS(hostname[j], s->path) && icmp[j]->family == i->family && icmp[j]->timeout == i->timeout && (icmp[j]->backoff.failures ? 1 : icmp[j]->count) == (i->backoff.failures ? 1 : i->count)))
+                                        j++;
+                                if (j < count) {
+                                        duplicate[duplicates] = i;
+                                        original[duplicates++] = j;
+                                } else {
+                                        hostname[count] = s->path;
+                                        icmp[count++] = i;
+                                }
+                        }
+                }
+        }
+        if (count + duplicates > 1) {
+                icmp_echo_batch(count, hostname, icmp);
+                for (int i = 0; i < count; i++)
+                        icmp[i]->batched = true;
+                for (int i = 0; i < duplicates; i++) {
+                        duplicate[i]->response = icmp[original[i]]->response;
+                        duplicate[i]->batched = true;
+                }
+                if (duplicates)
+                        DEBUG("Ping of %d host(s) shared by %d duplicate test(s)\n", count, duplicates);
+        }
+        FREE(original);
+        FREE(duplicate);
+        FREE(hostname);
+        FREE(icmp);
+}
+
+
+/**
+ * Probe the UDP ports with a batch capable protocol (DNS, NTP3 and RADIUS)
+ * of all remote hosts which will be checked in this cycle in one batch, so
+ * a cycle with many UDP tests costs one timeout rather than the sum of all
+ * of them. The port test then uses the batch result as its first attempt
+ */
+static void _probePorts() {
+        int count = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                for (Port_T p = s->portlist; p; p = p->next) {
+                        p->batched = false;
+                        FREE(p->batch_error);
+                        count++;
+                }
+        }
+        if (count < 2)
+                return;
+        Port_T *port = CALLOC(count, sizeof(Port_T));
+        count = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (! _batchDue(s))
+                        continue;
+                for (Port_T p = s->portlist; p; p = p->next)
+                        if (p->type == Socket_Udp && p->family != Socket_Unix && p->protocol->datagram && ! p->backoff.skip)
+                                port[count++] = p;
+        }
+        if (count > 1) {
+                udp_probe_batch(count, port);
+                for (int i = 0; i < count; i++)
+                        port[i]->batched = true;
+        }
+        FREE(port);
+}
+
+
+/**
+ * Returns the resident set size of the Monit process in kB. The current
+ * size is known on Linux only, the peak is used elsewhere
+ */
+static long _selfRss(struct rusage *usage) {
+#ifdef LINUX
+        long size, resident;
+        FILE *f = fopen("/proc/self/statm", "r");
+        if (f) {
+                int n = fscanf(f, "%ld %ld", &size, &resident);
+                fclose(f);
+                if (n == 2)
+                        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+#endif
+#ifdef DARWIN
+        return usage->ru_maxrss / 1024; // bytes on OS X
+#else
+        return usage->ru_maxrss;
+#endif
+}
+
+
+/**
+ * Returns the heap in use by the Monit process in bytes or -1 if the
+ * allocator cannot tell
+ */
+static long long _selfHeap() {
+#ifdef HAVE_MALLINFO2
+        struct mallinfo2 mi = mallinfo2();
+        return (long long)mi.uordblks + (long long)mi.hblkhd;
+#else
+        return -1LL;
+#endif
 }
 
 
 /**
- * Returns true if validation should be skiped for
- * this service in this cycle, otherwise false. Handle
- * every statement
+ * Returns the number of the descriptors open by the Monit process
  */
-static boolean_t check_skip(Service_T s) {
-        ASSERT(s);
-        if (s->visited) {
-                DEBUG("'%s' check skipped -- service already handled in a dependency chain\n", s->name);
-                return true;
-        }
-        time_t now = Time_now();
-        if (s->every.type == Every_SkipCycles) {
-                s->every.spec.cycle.counter++;
-                if (s->every.spec.cycle.counter < s->every.spec.cycle.number) {
-                        s->monitor |= Monitor_Waiting;
-                        DEBUG("'%s' test skipped as current cycle (%d) < every cycle (%d) \n", s->name, s->every.spec.cycle.counter, s->every.spec.cycle.number);
-                        return true;
-                }
-                s->every.spec.cycle.counter = 0;
-        } else if (s->every.type == Every_Cron && ! _incron(s, now)) {
-                s->monitor |= Monitor_Waiting;
-                DEBUG("'%s' test skipped as current time (%lld) does not match every's cron spec \"%s\"\n", s->name, (long long)now, s->every.spec.cron);
-                return true;
-        } else if (s->every.type == Every_NotInCron && Time_incron(s->every.spec.cron, now)) {
-                s->monitor |= Monitor_Waiting;
-                DEBUG("'%s' test skipped as current time (%lld) matches every's cron spec \"not %s\"\n", s->name, (long long)now, s->every.spec.cron);
-                return true;
+static int _selfDescriptors() {
+        int count = 0;
+#if defined LINUX && defined HAVE_DIRENT_H
+        DIR *dir = opendir("/proc/self/fd");
+        if (dir) {
+                struct dirent *de;
+                while ((de = readdir(dir)))
+                        if (*de->d_name != '.')
+                                count++;
+                closedir(dir);
+                return count - 1; // The descriptor of the directory stream
         }
-        s->monitor &= ~Monitor_Waiting;
-        return false;
+#endif
+        for (int i = 0, max = getdtablesize(); i < max; i++)
+                if (fcntl(i, F_GETFD) != -1)
+                        count++;
+        return count;
 }
 
 
 /**
- * Returns true if scheduled action was performed
+ * Save the daemon's own footprint: the memory and descriptors, the CPU
+ * usage and the request rate since the previous cycle, the CPU time by
+ * subsystem and the event queue. The values are read by the reports and
+ * the "check system" monit rules, which see the previous cycle's values
+ * @param after The resource usage at the end of the cycle
  */
-static boolean_t do_scheduled_action(Service_T s) {
-        int rv = false;
-        if (s->doaction != Action_Ignored) {
-                // FIXME: let the event engine do the action directly? (just replace s->action_ACTION with s->doaction and drop control_service call)
-                rv = control_service(s->name, s->doaction);
-                Event_post(s, Event_Action, State_Changed, s->action_ACTION, "%s action done", actionnames[s->doaction]);
-                s->doaction = Action_Ignored;
-                FREE(s->token);
+static void _selfUsage(struct rusage *after) {
+        static struct {
+                unsigned long long time;
+                unsigned long long cpu;
+                unsigned long long requests;
+                long long heap;
+        } previous;
+        unsigned long long now = Latency_now();
+        unsigned long long cpu = (after->ru_utime.tv_sec + after->ru_stime.tv_sec) * 1000000ULL + after->ru_utime.tv_usec + after->ru_stime.tv_usec;
+        unsigned long long requests = Run.latency.request.count;
+        if (previous.time && now > previous.time) {
+                Run.latency.usage.cpupercent = (int)((cpu - previous.cpu) * 1000ULL / (now - previous.time));
+                Run.latency.usage.requestrate = (double)(requests - previous.requests) * 1000000. / (now - previous.time);
         }
-        return rv;
+        for (int i = 0; i < Cost_Types; i++)
+                Run.latency.usage.cost[i] = __sync_fetch_and_and(&Run.latency.cost[i], 0ULL);
+        Run.latency.usage.rss = _selfRss(after);
+        Run.latency.usage.heap = _selfHeap();
+        Run.latency.usage.heapgrowth = Run.latency.usage.heap >= 0 && previous.heap >= 0 && previous.time ? Run.latency.usage.heap - previous.heap : 0;
+        Run.latency.usage.fds = _selfDescriptors();
+        Event_queue_usage(&Run.latency.usage.queue, &Run.latency.usage.queuesize);
+        previous.time = now;
+        previous.cpu = cpu;
+        previous.requests = requests;
+        previous.heap = Run.latency.usage.heap;
+        DEBUG("Monit footprint: %.1f%% CPU, %ldkB RSS, %lldB heap (%+lldB), %d descriptors, %d queued events (%lluB), %.2f requests/s\n",
+              Run.latency.usage.cpupercent / 10., Run.latency.usage.rss, Run.latency.usage.heap, Run.latency.usage.heapgrowth, Run.latency.usage.fds, Run.latency.usage.queue, Run.latency.usage.queuesize, Run.latency.usage.requestrate);
+}
+
+
+/**
+ * Save the resource usage of the cycle which started with the given usage
+ * snapshot. The usage is counted for the whole Monit process (all threads)
+ * @param before The resource usage at the start of the cycle
+ */
+static void _cycleUsage(struct rusage *before) {
+        struct rusage after;
+        if (getrusage(RUSAGE_SELF, &after) != 0)
+                return;
+        Run.latency.usage.cpuuser = (after.ru_utime.tv_sec - before->ru_utime.tv_sec) * 1000000ULL + after.ru_utime.tv_usec - before->ru_utime.tv_usec;
+        Run.latency.usage.cpusystem = (after.ru_stime.tv_sec - before->ru_stime.tv_sec) * 1000000ULL + after.ru_stime.tv_usec - before->ru_stime.tv_usec;
+#ifdef DARWIN
+        Run.latency.usage.maxrss = after.ru_maxrss / 1024; // bytes on OS X
+#else
+        Run.latency.usage.maxrss = after.ru_maxrss;
+#endif
+        Run.latency.usage.faults = (after.ru_minflt - before->ru_minflt) + (after.ru_majflt - before->ru_majflt);
+        Run.latency.usage.switches = (after.ru_nvcsw - before->ru_nvcsw) + (after.ru_nivcsw - before->ru_nivcsw);
+        Run.latency.usage.blockio = (after.ru_inblock - before->ru_inblock) + (after.ru_oublock - before->ru_oublock);
+        DEBUG("Cycle profile: %.3fs user, %.3fs system, %ldkB max RSS, %ld page faults, %ld context switches, %ld block I/O operations\n",
+              Run.latency.usage.cpuuser / 1000000., Run.latency.usage.cpusystem / 1000000., Run.latency.usage.maxrss, Run.latency.usage.faults, Run.latency.usage.switches, Run.latency.usage.blockio);
+        _selfUsage(&after);
 }
 
 
@@ -962,52 +2395,269 @@ static boolean_t do_scheduled_action(Service_T s) {
 int validate() {
         int errors = 0;
         Service_T s;
+        unsigned long long started = Latency_now();
+        struct rusage usage;
+        boolean_t profile = getrusage(RUSAGE_SELF, &usage) == 0;
 
+        PROBE0(cycle__start);
         Run.handler_flag = Handler_Succeeded;
         Event_queue_process();
-
-        update_system_load();
-        initprocesstree(&ptree, &ptreesize, &oldptree, &oldptreesize);
+        spawn_reap();
+
+        /* The port test results are shared within the cycle only */
+        probes.count = 0;
+
+        /* Collect only the data the checks need: the system wide statistic for the system service and the process tree if some rule needs it */
+        if (Run.system->monitor != Monitor_Not)
+                update_system_load();
+        LinkWatch_update();
+        processtree = processtree_needed();
+        lockprocesstree(true);
+        if (processtree && Run.powersave && ptree && ! _processDue(Latency_now())) {
+                /* The tree of the last process check is kept, it is refreshed in the next cycle with a process check */
+                DEBUG("No process check is due in this cycle -- the process tree is not refreshed\n");
+        } else if (processtree) {
+                unsigned long long treestarted = Latency_now(), cpu = Latency_cpu();
+                initprocesstree(&ptree, &ptreesize, &oldptree, &oldptreesize);
+                Latency_cost(Cost_ProcessTree, cpu);
+                Latency_record(&Run.latency.processtree, treestarted);
+        } else if (ptree || oldptree) {
+                /* The snapshot is not refreshed anymore (the config was reloaded), drop it */
+                delprocesstree(&oldptree, &oldptreesize);
+                delprocesstree(&ptree, &ptreesize);
+        }
+        unlockprocesstree();
         gettimeofday(&systeminfo.collected, NULL);
 
         /* In the case that at least one action is pending, perform quick loop to handle the actions ASAP */
         if (Run.doaction) {
                 Run.doaction = false;
-                for (s = servicelist; s; s = s->next)
-                        do_scheduled_action(s);
+                _doScheduledActions();
         }
 
+        _scheduleIntervals(Latency_now());
+
+        /* The remote hosts checked by the other cluster members are not batched */
+        if (Run.cluster.peers)
+                Cluster_update();
+        _pingHosts();
+        _probePorts();
+
         /* Check the services */
-        for (s = servicelist; s; s = s->next) {
-                if (Run.stopped)
-                        break;
-                if (! do_scheduled_action(s) && s->monitor && ! check_skip(s)) {
-                        check_timeout(s); // Can disable monitoring => need to check s->monitor again
-                        if (s->monitor) {
-                                if (! s->check(s))
-                                        errors++;
-                                /* The monitoring may be disabled by some matching rule in s->check
-                                 * so we have to check again before setting to Monitor_Yes */
-                                if (s->monitor != Monitor_Not)
-                                        s->monitor = Monitor_Yes;
-                        }
-                        gettimeofday(&s->collected, NULL);
+        if (Run.scheduler_workers > 1) {
+                errors = _checkParallel();
+        } else {
+                for (s = servicelist; s; s = s->next) {
+                        if (Run.stopped)
+                                break;
+                        if (! do_scheduled_action(s) && s->monitor && ! check_skip(s) && ! _checkService(s))
+                                errors++;
                 }
         }
 
         reset_depend();
 
+        /* The service actions triggered by the events of this cycle */
+        control_queue_process();
+
+        status_xml_reset();
+
+        /* Publish the results for the status and summary commands */
+        if (Run.isdaemon)
+                Snapshot_update();
+
+        /* The filesystem statistics are collected once per cycle */
+        filesystem_usage_reset();
+
+        /* Group fsync of the events queued in this cycle */
+        Event_queue_sync();
+
+        /* The alerts of this cycle were sent over one SMTP session */
+        sendmail_close();
+
+        unsigned long long duration = Latency_now() - started;
+        Latency_add(&Run.latency.cycle, duration);
+        PROBE2(cycle__end, errors, duration);
+        if (Run.isdaemon && Run.polltime > 0 && duration > (unsigned long long)Run.polltime * 1000000ULL) {
+                Run.latency.overruns++;
+                DEBUG("The check cycle took %.3fs, which is longer than the poll time %ds\n", duration / 1000000., Run.polltime);
+        }
+        if (profile)
+                _cycleUsage(&usage);
+
         return errors;
 }
 
 
+/**
+ * Compile the resource rules of the process, cgroup or system service, or
+ * the filesystem rules of the filesystem service, into the flat evaluation
+ * table. Each entry holds the metric index, the operator's test and the
+ * limit, so the check reads the metrics once and tests the rules in a tight
+ * loop instead of walking the rule list and switching on the resource. The
+ * table is allocated from the service's arena
+ * @param s The service with all its rules parsed
+ */
+void validate_compileRules(Service_T s) {
+        ASSERT(s);
+        int count = 0;
+        s->ruletable = NULL;
+        if (s->type == Service_Filesystem) {
+                for (Filesystem_T td = s->filesystemlist; td; td = td->next)
+                        count++;
+        } else if (s->type == Service_Process || s->type == Service_System || s->type == Service_Cgroup) {
+                for (Resource_T r = s->resourcelist; r; r = r->next)
+                        count++;
+        }
+        if (! count)
+                return;
+        RuleTable_T T = Arena_alloc(s->arena, sizeof(struct myruletable) + count * sizeof(Rule_T));
+        T->count = 0;
+        if (s->type == Service_Filesystem) {
+                for (Filesystem_T td = s->filesystemlist; td; td = td->next) {
+                        if (td->limit_percent < 0 && td->limit_absolute < 0) {
+                                LogError("'%s' error: filesystem limit not set\n", s->name);
+                                continue;
+                        }
+                        Rule_T *rule = &T->rule[T->count++];
+                        rule->matches = comparators[td->operator];
+                        rule->metric = (td->resource - Resource_Inode) * 2 + (td->limit_percent < 0);
+                        rule->limit = td->limit_percent >= 0 ? td->limit_percent : td->limit_absolute;
+                        rule->source.filesystem = td;
+                }
+        } else {
+                for (Resource_T r = s->resourcelist; r; r = r->next) {
+                        Rule_T *rule = &T->rule[T->count++];
+                        rule->matches = comparators[r->operator];
+                        rule->metric = r->resource_id;
+                        rule->limit = r->limit;
+                        rule->source.resource = r;
+                }
+        }
+        s->ruletable = T;
+}
+
+
+/**
+ * Returns the earliest deadline of the failure rechecks (Latency_now() time)
+ * or 0 if no recheck is pending
+ */
+unsigned long long validate_nextRecheck() {
+        unsigned long long next = 0;
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (s->monitor != Monitor_Yes)
+                        continue;
+                for (Port_T p = s->portlist; p; p = p->next)
+                        if (p->recheck_due && (! next || p->recheck_due < next))
+                                next = p->recheck_due;
+                for (Port_T p = s->socketlist; p; p = p->next)
+                        if (p->recheck_due && (! next || p->recheck_due < next))
+                                next = p->recheck_due;
+        }
+        return next;
+}
+
+
+/**
+ * Returns the earliest deadline of the checks (Latency_now() time) or 0 if
+ * some monitored service is checked in every cycle. The services with the
+ * "every N seconds" spec and the services waiting for their cron window have
+ * a deadline, the cycles before it can be skipped by the power save mode
+ */
+unsigned long long validate_nextDue() {
+        unsigned long long next = 0, now = Latency_now();
+        for (Service_T s = servicelist; s; s = s->next) {
+                // The system service without a resource rule only collects the statistics
+                if (s->monitor == Monitor_Not || (s->type == Service_System && ! s->resourcelist))
+                        continue;
+                unsigned long long due;
+                if (s->every.type == Every_Interval && s->every.spec.interval.next) {
+                        due = s->every.spec.interval.next;
+                } else if ((s->every.type == Every_Cron || (s->every.type == Every_NotInCron && s->every.spec.cron.schedule->skip)) && s->every.spec.cron.schedule->next) {
+                        time_t clock = Time_now(), at = s->every.spec.cron.schedule->next;
+                        due = now + (at > clock ? (at - clock) * 1000000ULL : 0);
+                } else {
+                        return 0;
+                }
+                if (! next || due < next)
+                        next = due;
+        }
+        return next;
+}
+
+
+static void _recheckConnections(Service_T s, Port_T list, unsigned long long now) {
+        for (Port_T p = list; p; p = p->next) {
+                if (s->monitor != Monitor_Yes) {
+                        p->recheck_due = 0; // The service is not monitored or waits for its "every" cycle, the recheck is dropped
+                } else if (p->recheck_due && p->recheck_due <= now) {
+                        char report[STRLEN] = {0};
+                        DEBUG("'%s' rechecking the failed test at %s\n", s->name, Util_portDescription(p, report, sizeof(report)));
+                        unsigned long long started = Latency_now();
+                        boolean_t succeeded = _testConnection(s, p, p->session ? &p->session : NULL, p->session != NULL, report, sizeof(report));
+                        Latency_add(Latency_get(&s->latency[Latency_Port]), Latency_now() - started);
+                        _postConnection(s, p, succeeded, report);
+                }
+        }
+}
+
+
+/**
+ * Recheck the failed port tests whose recheck is due. The main loop calls
+ * it between the cycles (see validate_nextRecheck()), so a failure which
+ * needs more than one failed test to trigger the action is confirmed
+ * within seconds instead of the poll cycles. The recheck posts the event
+ * like the test in the cycle does
+ */
+void validate_recheck() {
+        unsigned long long now = Latency_now();
+        for (Service_T s = servicelist; s; s = s->next) {
+                if (Run.stopped)
+                        break;
+                _recheckConnections(s, s->portlist, now);
+                _recheckConnections(s, s->socketlist, now);
+        }
+        control_queue_process();
+        Event_queue_sync();
+        sendmail_close();
+}
+
+
+/**
+ * Update the process instances of the template and test them. The
+ * instances have no history, so the average resource tests are skipped
+ */
+static void _checkInstances(Service_T s) {
+        Instance_update(s);
+        for (Service_T i = s->instance.list; i; i = i->next) {
+                unsigned long long started = Latency_now();
+                update_process_resources(i, i->instance.pid);
+                if (i->uid)
+                        check_uid(i, i->inf->priv.process.uid);
+                if (i->euid)
+                        check_euid(i, i->inf->priv.process.euid);
+                if (i->gid)
+                        check_gid(i, i->inf->priv.process.gid);
+                if (i->uptimelist)
+                        check_uptime(i);
+                check_process_resources(i, false);
+                i->monitor = Monitor_Yes;
+                gettimeofday(&i->collected, NULL);
+                Latency_record(Latency_get(&i->latency[Latency_Check]), started);
+        }
+}
+
+
 /**
  * Validate a given process service s. Events are posted according to
  * its configuration. In case of a fatal event false is returned.
  */
 boolean_t check_process(Service_T s) {
         ASSERT(s);
+        Sampler_collect(s);
         pid_t pid = Util_isProcessRunning(s, false);
+        if (s->instance.max)
+                _checkInstances(s);
         if (! pid) {
                 for (Nonexist_T l = s->nonexistlist; l; l = l->next)
                         Event_post(s, Event_Nonexist, State_Failed, l->action, "process is not running");
@@ -1023,7 +2673,18 @@ boolean_t check_process(Service_T s) {
                 for (ActionRate_T ar = s->actionratelist; ar; ar = ar->next)
                         Event_post(s, Event_Timeout, State_Succeeded, ar->action, "process is running after previous restart timeout (manually recovered?)");
         if (Run.doprocess) {
-                if (update_process_data(s, ptree, ptreesize, pid)) {
+                lockprocesstree(false);
+                boolean_t updated = update_process_data(s, processtree ? ptree : NULL, ptreesize, pid);
+                unlockprocesstree();
+                if (updated && s->cgroup) {
+                        if (Cgroup_update(s->cgroup, pid))
+                                _cgroupTotals(s);
+                        else
+                                DEBUG("'%s' cannot read the cgroup of the process -- using the process tree totals\n", s->name);
+                }
+                if (updated) {
+                        update_process_resources(s, pid);
+                        History_update(s);
                         check_process_state(s);
                         check_process_pid(s);
                         check_process_ppid(s);
@@ -1035,8 +2696,7 @@ boolean_t check_process(Service_T s) {
                                 check_gid(s, s->inf->priv.process.gid);
                         if (s->uptimelist)
                                 check_uptime(s);
-                        for (Resource_T pr = s->resourcelist; pr; pr = pr->next)
-                                check_process_resources(s, pr);
+                        check_process_resources(s, true);
                 } else {
                         LogError("'%s' failed to get service data\n", s->name);
                 }
@@ -1044,27 +2704,22 @@ boolean_t check_process(Service_T s) {
         if (s->portlist) {
                 /* pause port tests in the start timeout timeframe while the process is starting (it may take some time to the process before it starts accepting connections) */
                 if (! s->start || s->inf->priv.process.uptime > s->start->timeout)
-                        for (Port_T pp = s->portlist; pp; pp = pp->next)
-                                check_connection(s, pp);
+                        check_connections(s, s->portlist);
         }
         if (s->socketlist) {
                 /* pause socket tests in the start timeout timeframe while the process is starting (it may take some time to the process before it starts accepting connections) */
                 if (! s->start || s->inf->priv.process.uptime > s->start->timeout)
-                        for (Port_T pp = s->socketlist; pp; pp = pp->next)
-                                check_connection(s, pp);
+                        check_connections(s, s->socketlist);
         }
         return true;
 }
 
 
 /**
- * Validate a given filesystem service s. Events are posted according to
- * its configuration. In case of a fatal event false is returned.
+ * Test the filesystem statistics collected for the service
  */
-boolean_t check_filesystem(Service_T s) {
-        ASSERT(s);
-
-        if (! filesystem_usage(s)) {
+static boolean_t _checkFilesystem(Service_T s, boolean_t usage) {
+        if (! usage) {
                 Event_post(s, Event_Data, State_Failed, s->action_DATA, "unable to read filesystem '%s' state", s->path);
                 return false;
         }
@@ -1081,9 +2736,111 @@ boolean_t check_filesystem(Service_T s) {
 
         check_filesystem_flags(s);
 
-        for (Filesystem_T td = s->filesystemlist; td; td = td->next)
-                check_filesystem_resources(s, td);
+        check_filesystem_resources(s);
+
+        return true;
+}
+
+
+/**
+ * Update the filesystem instances of the template and test them. The
+ * statistics of all instances are collected in one batch. The template
+ * shows the statistics of the fullest filesystem
+ */
+static boolean_t _checkFilesystemInstances(Service_T s) {
+        if (! Instance_updateFilesystems(s)) {
+                Event_post(s, Event_Data, State_Failed, s->action_DATA, "unable to read the mount table");
+                return false;
+        }
+        int count = s->instance.count;
+        Service_T *services = CALLOC(count > 0 ? count : 1, sizeof(Service_T));
+        boolean_t *succeeded = CALLOC(count > 0 ? count : 1, sizeof(boolean_t));
+        int i = 0;
+        for (Service_T fs = s->instance.list; fs && i < count; fs = fs->next)
+                services[i++] = fs;
+        unsigned long long started = Latency_now();
+        filesystem_usage_batch(services, count, succeeded);
+        Latency_record(Latency_get(&s->latency[Latency_Filesystem]), started);
+        Service_T fullest = NULL;
+        for (i = 0; i < count; i++) {
+                Service_T fs = services[i];
+                _checkFilesystem(fs, succeeded[i]);
+                fs->monitor = Monitor_Yes;
+                gettimeofday(&fs->collected, NULL);
+                if (succeeded[i] && (! fullest || fs->inf->priv.filesystem.space_percent > fullest->inf->priv.filesystem.space_percent))
+                        fullest = fs;
+        }
+        if (fullest)
+                s->inf->priv.filesystem = fullest->inf->priv.filesystem;
+        FREE(succeeded);
+        FREE(services);
+        Event_post(s, Event_Data, State_Succeeded, s->action_DATA, "succeeded getting the mount table [%d filesystems]", count);
+        return true;
+}
+
+
+/**
+ * Validate a given filesystem service s. Events are posted according to
+ * its configuration. In case of a fatal event false is returned.
+ */
+boolean_t check_filesystem(Service_T s) {
+        ASSERT(s);
+
+        if (s->instance.max)
+                return _checkFilesystemInstances(s);
+        unsigned long long started = Latency_now();
+        boolean_t usage = filesystem_usage(s);
+        Latency_record(Latency_get(&s->latency[Latency_Filesystem]), started);
+        return _checkFilesystem(s, usage);
+}
+
 
+/**
+ * Update the file instances of the template and match their new content.
+ * The directory watch reports the new files as well as the changes of the
+ * matching files, so the pattern is expanded and the files are read only
+ * if something changed. All files are read through one buffer and their
+ * lines are matched by the template's patterns, the matches of all files
+ * are reported by the template in one event per pattern
+ */
+static boolean_t _checkFileInstances(Service_T s) {
+        boolean_t unchanged = FileWatch_isUnchanged(s);
+        if (unchanged) {
+                DEBUG("'%s' files have not changed since last test\n", s->name);
+        } else if (! Instance_updateFiles(s)) {
+                Event_post(s, Event_Data, State_Failed, s->action_DATA, "unable to expand the path %s", s->path);
+                return false;
+        }
+        if (! s->instance.count) {
+                for (Nonexist_T l = s->nonexistlist; l; l = l->next)
+                        Event_post(s, Event_Nonexist, State_Failed, l->action, "no file matches %s", s->path);
+                return false;
+        }
+        for (Nonexist_T l = s->nonexistlist; l; l = l->next)
+                Event_post(s, Event_Nonexist, State_Succeeded, l->action, "%d files match", s->instance.count);
+        unsigned long long started = Latency_now();
+        char *buffer = ALLOC(MATCH_BLOCK_SIZE);
+        for (Service_T f = s->instance.list; f; f = f->next) {
+                struct stat stat_buf;
+                if (! unchanged) {
+                        if (_stat(f, &stat_buf) != 0)
+                                continue; // Removed meanwhile, the instance is retired by the next update
+                        f->inf->priv.file.mode = stat_buf.st_mode;
+                        if (f->inf->priv.file.inode)
+                                f->inf->priv.file.inode_prev = f->inf->priv.file.inode;
+                        f->inf->priv.file.inode = stat_buf.st_ino;
+                        f->inf->priv.file.size = stat_buf.st_size;
+                }
+                if (S_ISREG(f->inf->priv.file.mode)) {
+                        _matchFile(f, unchanged, buffer);
+                        f->inf->priv.file.inode_prev = f->inf->priv.file.inode;
+                }
+                f->monitor = Monitor_Yes;
+                gettimeofday(&f->collected, NULL);
+        }
+        FREE(buffer);
+        _reportMatch(s);
+        Latency_record(Latency_get(&s->latency[Latency_Match]), started);
         return true;
 }
 
@@ -1097,7 +2854,14 @@ boolean_t check_file(Service_T s) {
 
         ASSERT(s);
 
-        if (stat(s->path, &stat_buf) != 0) {
+        if (s->instance.max)
+                return _checkFileInstances(s);
+
+        /* If the file events watcher reports no change, the last file status is still valid */
+        boolean_t unchanged = FileWatch_isUnchanged(s);
+        if (unchanged) {
+                DEBUG("'%s' file has not changed since last test\n", s->name);
+        } else if (_stat(s, &stat_buf) != 0) {
                 for (Nonexist_T l = s->nonexistlist; l; l = l->next)
                         Event_post(s, Event_Nonexist, State_Failed, l->action, "file doesn't exist");
                 return false;
@@ -1121,8 +2885,13 @@ boolean_t check_file(Service_T s) {
                 Event_post(s, Event_Invalid, State_Succeeded, s->action_INVALID, "is a regular file or socket");
         }
 
-        if (s->checksum)
-                check_checksum(s);
+        History_update(s);
+
+        if (s->checksum) {
+                unsigned long long started = Latency_now();
+                check_checksum(s, unchanged ? NULL : &stat_buf);
+                Latency_record(Latency_get(&s->latency[Latency_Checksum]), started);
+        }
 
         if (s->perm)
                 check_perm(s, s->inf->priv.file.mode);
@@ -1139,8 +2908,11 @@ boolean_t check_file(Service_T s) {
         if (s->timestamplist)
                 check_timestamp(s, s->inf->priv.file.timestamp);
 
-        if (s->matchlist)
-                check_match(s);
+        if (s->matchlist) {
+                unsigned long long started = Latency_now();
+                check_match(s, unchanged);
+                Latency_record(Latency_get(&s->latency[Latency_Match]), started);
+        }
 
         return true;
 
@@ -1157,7 +2929,10 @@ boolean_t check_directory(Service_T s) {
 
         ASSERT(s);
 
-        if (stat(s->path, &stat_buf) != 0) {
+        /* If the file events watcher reports no change, the last directory status is still valid */
+        if (FileWatch_isUnchanged(s)) {
+                DEBUG("'%s' directory has not changed since last test\n", s->name);
+        } else if (_stat(s, &stat_buf) != 0) {
                 for (Nonexist_T l = s->nonexistlist; l; l = l->next)
                         Event_post(s, Event_Nonexist, State_Failed, l->action, "directory doesn't exist");
                 return false;
@@ -1189,6 +2964,13 @@ boolean_t check_directory(Service_T s) {
         if (s->timestamplist)
                 check_timestamp(s, s->inf->priv.directory.timestamp);
 
+        /* The tree is checked even if the directory itself didn't change, the watch doesn't report the changes in the subtree */
+        if (s->checksum) {
+                unsigned long long started = Latency_now();
+                check_checksum_tree(s);
+                Latency_record(Latency_get(&s->latency[Latency_Checksum]), started);
+        }
+
         return true;
 
 }
@@ -1204,7 +2986,10 @@ boolean_t check_fifo(Service_T s) {
 
         ASSERT(s);
 
-        if (stat(s->path, &stat_buf) != 0) {
+        /* If the file events watcher reports no change, the last fifo status is still valid */
+        if (FileWatch_isUnchanged(s)) {
+                DEBUG("'%s' fifo has not changed since last test\n", s->name);
+        } else if (_stat(s, &stat_buf) != 0) {
                 for (Nonexist_T l = s->nonexistlist; l; l = l->next)
                         Event_post(s, Event_Nonexist, State_Failed, l->action, "fifo doesn't exist");
                 return false;
@@ -1241,6 +3026,90 @@ boolean_t check_fifo(Service_T s) {
 }
 
 
+/**
+ * Evaluate the program exit status (or the plugin check status) against the status tests
+ */
+static void _checkProgramStatus(Service_T s) {
+        // Evaluate program's exit status against our status checks.
+        /* TODO: Multiple checks we have now should be deprecated and removed - not useful because it
+         will alert on everything if != is used other than the match or if = is used, might report nothing on error. */
+        for (Status_T status = s->statuslist; status; status = status->next) {
+                if (status->operator == Operator_Changed) {
+                        if (status->initialized) {
+                                if (Util_evalQExpression(status->operator, s->program->exitStatus, status->return_value)) {
+                                        Event_post(s, Event_Status, State_Changed, status->action, "program status changed (%d -> %d) -- %s", status->return_value, s->program->exitStatus, StringBuffer_length(s->program->output) ? StringBuffer_toString(s->program->output) : "no output");
+                                        status->return_value = s->program->exitStatus;
+                                } else {
+                                        Event_post(s, Event_Status, State_ChangedNot, status->action, "program status didn't change [status=%d] -- %s", s->program->exitStatus, StringBuffer_length(s->program->output) ? StringBuffer_toString(s->program->output) : "no output");
+                                }
+                        } else {
+                                status->initialized = true;
+                                status->return_value = s->program->exitStatus;
+                        }
+                } else {
+                        if (Util_evalQExpression(status->operator, s->program->exitStatus, status->return_value))
+                                Event_post(s, Event_Status, State_Failed, status->action, "'%s' failed with exit status (%d) -- %s", s->path, s->program->exitStatus, StringBuffer_length(s->program->output) ? StringBuffer_toString(s->program->output) : "no output");
+                        else
+                                Event_post(s, Event_Status, State_Succeeded, status->action, "status succeeded [status=%d] -- %s", s->program->exitStatus, StringBuffer_length(s->program->output) ? StringBuffer_toString(s->program->output) : "no output");
+                }
+        }
+}
+
+
+/**
+ * Evaluate the exit status and output of the finished program against the
+ * status tests and free the sub-process. Called by check_program() or by the
+ * program watcher thread as soon as the program exited.
+ */
+void check_program_result(Service_T s) {
+        ASSERT(s);
+        ASSERT(s->program);
+        Process_T P = s->program->P;
+        ASSERT(P);
+        s->program->exitStatus = Process_exitStatus(P); // Save exit status for web-view display
+        // Save program output
+        StringBuffer_clear(s->program->output);
+        _programOutput(Process_getErrorStream(P), s->program->output);
+        _programOutput(Process_getInputStream(P), s->program->output);
+        StringBuffer_trim(s->program->output);
+        _checkProgramStatus(s);
+        Process_free(&s->program->P);
+        spawn_release();
+}
+
+
+/**
+ * Returns true if the program may be started without exceeding the limit of concurrently running program checks
+ */
+static boolean_t _canStartProgram() {
+        if (Run.programlimit <= 0)
+                return true;
+        int running = 0;
+        for (Service_T s = servicelist; s; s = s->next)
+                if (s->type == Service_Program && s->program->P)
+                        running++;
+        return running < Run.programlimit;
+}
+
+
+/**
+ * Run the check of the in-process plugin and evaluate its status like the
+ * program exit status
+ */
+static void check_plugin(Service_T s) {
+        int status;
+        StringBuffer_clear(s->program->output);
+        s->program->started = Time_now();
+        if (Plugin_check(s->program->plugin, s->program->timeout, &status, s->program->output)) {
+                s->program->exitStatus = status;
+                StringBuffer_trim(s->program->output);
+                _checkProgramStatus(s);
+        } else {
+                Event_post(s, Event_Status, State_Failed, s->action_EXEC, "plugin '%s' failed -- %s", s->path, StringBuffer_toString(s->program->output));
+        }
+}
+
+
 /**
  * Validate a program status. Events are posted according to
  * its configuration. In case of a fatal event false is returned.
@@ -1248,6 +3117,15 @@ boolean_t check_fifo(Service_T s) {
 boolean_t check_program(Service_T s) {
         ASSERT(s);
         ASSERT(s->program);
+        if (s->program->plugin) {
+                check_plugin(s);
+                return true;
+        }
+        if (ProgramWatch_isWatched(s)) {
+                // The program watcher posts the result as soon as the program exits
+                DEBUG("'%s' status check defered - program watcher waits on program to exit\n", s->name);
+                return true;
+        }
         time_t now = Time_now();
         Process_T P = s->program->P;
         if (P) {
@@ -1264,44 +3142,21 @@ boolean_t check_program(Service_T s) {
                                 return true;
                         }
                 }
-                s->program->exitStatus = Process_exitStatus(P); // Save exit status for web-view display
-                // Save program output
-                StringBuffer_clear(s->program->output);
-                _programOutput(Process_getErrorStream(P), s->program->output);
-                _programOutput(Process_getInputStream(P), s->program->output);
-                StringBuffer_trim(s->program->output);
-                // Evaluate program's exit status against our status checks.
-                /* TODO: Multiple checks we have now should be deprecated and removed - not useful because it
-                 will alert on everything if != is used other than the match or if = is used, might report nothing on error. */
-                for (Status_T status = s->statuslist; status; status = status->next) {
-                        if (status->operator == Operator_Changed) {
-                                if (status->initialized) {
-                                        if (Util_evalQExpression(status->operator, s->program->exitStatus, status->return_value)) {
-                                                Event_post(s, Event_Status, State_Changed, status->action, "program status changed (%d -> %d) -- %s", status->return_value, s->program->exitStatus, StringBuffer_length(s->program->output) ? StringBuffer_toString(s->program->output) : "no output");
-                                                status->return_value = s->program->exitStatus;
-                                        } else {
-                                                Event_post(s, Event_Status, State_ChangedNot, status->action, "program status didn't change [status=%d] -- %s", s->program->exitStatus, StringBuffer_length(s->program->output) ? StringBuffer_toString(s->program->output) : "no output");
-                                        }
-                                } else {
-                                        status->initialized = true;
-                                        status->return_value = s->program->exitStatus;
-                                }
-                        } else {
-                                if (Util_evalQExpression(status->operator, s->program->exitStatus, status->return_value))
-                                        Event_post(s, Event_Status, State_Failed, status->action, "'%s' failed with exit status (%d) -- %s", s->path, s->program->exitStatus, StringBuffer_length(s->program->output) ? StringBuffer_toString(s->program->output) : "no output");
-                                else
-                                        Event_post(s, Event_Status, State_Succeeded, status->action, "status succeeded [status=%d] -- %s", s->program->exitStatus, StringBuffer_length(s->program->output) ? StringBuffer_toString(s->program->output) : "no output");
-                        }
-                }
-                Process_free(&s->program->P);
+                check_program_result(s);
+        }
+        // Start program, if the limit is reached the start is deferred to the next cycle
+        if (! _canStartProgram() || ! spawn_acquire(0)) {
+                DEBUG("'%s' program start deferred - limit of running programs reached\n", s->name);
+                return true;
         }
-        // Start program
         s->program->P = Command_execute(s->program->C);
         if (! s->program->P) {
+                spawn_release();
                 Event_post(s, Event_Status, State_Failed, s->action_EXEC, "failed to execute '%s' -- %s", s->path, STRERROR);
         } else {
                 Event_post(s, Event_Status, State_Succeeded, s->action_EXEC, "'%s' program started", s->name);
                 s->program->started = now;
+                ProgramWatch_add(s);
         }
         return true;
 }
@@ -1323,7 +3178,16 @@ boolean_t check_remote_host(Service_T s) {
                 switch (icmp->type) {
                         case ICMP_ECHO:
 
-                                icmp->response = icmp_echo(s->path, icmp->family, icmp->timeout, icmp->count);
+                                last_ping = icmp;
+                                if (icmp->batched) {
+                                        icmp->batched = false;
+                                } else if (_backoffSkip(&icmp->backoff)) {
+                                        DEBUG("'%s' ping test skipped as it failed %d times -- next probe in %d cycle(s)\n", s->name, icmp->backoff.failures, icmp->backoff.skip + 1);
+                                        break;
+                                } else {
+                                        /* A failing host gets a single recovery probe */
+                                        icmp->response = icmp_echo(s->path, icmp->family, icmp->timeout, icmp->backoff.failures ? 1 : icmp->count);
+                                }
 
                                 if (icmp->response == -2) {
                                         icmp->is_available = true;
@@ -1339,7 +3203,7 @@ boolean_t check_remote_host(Service_T s) {
                                         icmp->is_available = true;
                                         Event_post(s, Event_Icmp, State_Succeeded, icmp->action, "ping test succeeded [response time %.3fs]", icmp->response);
                                 }
-                                last_ping = icmp;
+                                _backoffUpdate(&icmp->backoff, icmp->is_available);
                                 break;
 
                         default:
@@ -1357,8 +3221,7 @@ boolean_t check_remote_host(Service_T s) {
         }
 
         /* Test each host:port and protocol in the service's portlist */
-        for (Port_T p = s->portlist; p; p = p->next)
-                check_connection(s, p);
+        check_connections(s, s->portlist);
 
         return true;
 
@@ -1371,13 +3234,168 @@ boolean_t check_remote_host(Service_T s) {
  */
 boolean_t check_system(Service_T s) {
         ASSERT(s);
+        Sampler_collect(s);
+        History_update(s);
+        check_process_resources(s, true);
+        return true;
+}
+
+
+/**
+ * Validate a given control group service s. Events are posted according
+ * to its configuration. In case of a fatal event false is returned.
+ */
+boolean_t check_cgroup(Service_T s) {
+        ASSERT(s && s->cgroup);
+        if (! Cgroup_update(s->cgroup, 0)) {
+                Event_post(s, Event_Data, State_Failed, s->action_DATA, "unable to read cgroup '%s' statistics", s->path);
+                return false;
+        }
+        Event_post(s, Event_Data, State_Succeeded, s->action_DATA, "succeeded getting cgroup statistics for '%s'", s->path);
+        // The cgroup itself is the total, the resource tests are shared with the process
+        _cgroupTotals(s);
+        s->inf->priv.process.cpu_percent = s->cgroup->cpu_percent;
+        s->inf->priv.process.mem_kbyte = s->cgroup->mem_kbyte;
+        s->inf->priv.process.mem_percent = s->cgroup->mem_percent;
+        s->inf->priv.process.threads = s->cgroup->tasks;
+        s->inf->priv.process.read_rate = s->cgroup->read_rate;
+        s->inf->priv.process.write_rate = s->cgroup->write_rate;
+        History_update(s);
+        check_process_resources(s, true);
+        return true;
+}
+
+
+/**
+ * Validate a given processes service s. The matching processes are tested in
+ * one pass over the process table, each resource rule keeps the top offenders
+ * in a bounded heap, so the cost is O(n log K) for n processes. The rule's
+ * event reports the number of the processes above the limit and the worst
+ * PROCESSES_TOP of them. In case of a fatal event false is returned.
+ */
+boolean_t check_processes(Service_T s) {
+        ASSERT(s && s->processes && s->matchlist);
+        Match_T m = s->matchlist;
+        Processes_T P = s->processes;
+        int rules = 0;
         for (Resource_T r = s->resourcelist; r; r = r->next)
-                check_process_resources(s, r);
+                rules++;
+        // The rule heaps and the overall heap (the worst rule of each offender) last
+        Rank_T *rank = CALLOC((rules + 1) * PROCESSES_TOP, sizeof(Rank_T));
+        int *ranked = CALLOC(rules + 1, sizeof(int));
+        int *offenders = CALLOC(rules + 1, sizeof(int));
+        StringBuffer_T *report = CALLOC(rules + 1, sizeof(StringBuffer_T));
+        lockprocesstree(false);
+        if (! Run.doprocess || ! processtree || ! ptree) {
+                unlockprocesstree();
+                FREE(report);
+                FREE(offenders);
+                FREE(ranked);
+                FREE(rank);
+                Event_post(s, Event_Data, State_Failed, s->action_DATA, "process table not available");
+                return false;
+        }
+        int matched = 0;
+        for (int i = 0; i < ptreesize; i++) {
+                ProcessTree_T *p = &ptree[i];
+                if (! p->cmdline || (m->literal && ! strstr(p->cmdline, m->literal)))
+                        continue;
+#ifdef HAVE_REGEX_H
+                if (regexec(m->regex_comp, p->cmdline, 0, NULL, 0))
+#else
+                if (! strstr(p->cmdline, m->match_string))
+#endif
+                        continue;
+                matched++;
+                double worst = -1.;
+                int j = 0;
+                for (Resource_T r = s->resourcelist; r; r = r->next, j++) {
+                        long long value = _processesValue(s, r, p);
+                        if (value < 0 || ! Util_evalQExpression(r->operator, value, r->limit))
+                                continue;
+                        offenders[j]++;
+                        double key = r->operator == Operator_Greater && r->limit > 0 ? (double)value / r->limit : 1.;
+                        _rankPush(rank + j * PROCESSES_TOP, &ranked[j], PROCESSES_TOP, i, key);
+                        if (key > worst)
+                                worst = key;
+                }
+                if (worst >= 0) {
+                        offenders[rules]++;
+                        _rankPush(rank + rules * PROCESSES_TOP, &ranked[rules], PROCESSES_TOP, i, worst);
+                }
+        }
+        // Report the offenders while the process table is locked, the events are posted after unlock
+        char buf1[STRLEN], buf2[STRLEN];
+        int j = 0;
+        for (Resource_T r = s->resourcelist; r; r = r->next, j++) {
+                Rank_T *heap = rank + j * PROCESSES_TOP;
+                qsort(heap, ranked[j], sizeof(Rank_T), _rankCompare);
+                report[j] = StringBuffer_create(STRLEN);
+                for (int k = 0; k < ranked[j]; k++) {
+                        ProcessTree_T *p = &ptree[heap[k].index];
+                        StringBuffer_append(report[j], "%s%d '%.64s' %s", k ? ", " : "", p->pid, p->cmdline, _processesFormat(r, _processesValue(s, r, p), buf1));
+                }
+        }
+        Util_resetInfo(s);
+        P->matched = matched;
+        P->offenders = offenders[rules];
+        Rank_T *heap = rank + rules * PROCESSES_TOP;
+        qsort(heap, ranked[rules], sizeof(Rank_T), _rankCompare);
+        for (P->top = 0; P->top < ranked[rules]; P->top++) {
+                ProcessTree_T *p = &ptree[heap[P->top].index];
+                P->offender[P->top].pid = p->pid;
+                P->offender[P->top].cpu_percent = p->cpu_percent;
+                P->offender[P->top].mem_kbyte = p->mem_kbyte;
+                P->offender[P->top].mem_percent = systeminfo.mem_kbyte_max > 0 ? (short)(1000. * p->mem_kbyte / systeminfo.mem_kbyte_max) : 0;
+                P->offender[P->top].cmdline = Str_dup(p->cmdline);
+        }
+        unlockprocesstree();
+        Event_post(s, Event_Data, State_Succeeded, s->action_DATA, "succeeded getting the process table, %d processes match", matched);
+        j = 0;
+        for (Resource_T r = s->resourcelist; r; r = r->next, j++) {
+                char *name = r->resource_id == Resource_CpuPercent || r->resource_id == Resource_CpuPercentTotal ? "cpu usage" : "memory usage";
+                if (offenders[j])
+                        Event_post(s, Event_Resource, State_Failed, r->action, "%d of %d processes match resource limit [%s%s%s]: %s",
+                                   offenders[j], matched, name, operatorshortnames[r->operator], _processesFormat(r, r->limit, buf2), StringBuffer_toString(report[j]));
+                else
+                        Event_post(s, Event_Resource, State_Succeeded, r->action, "%s check succeeded [%d processes match]", name, matched);
+                StringBuffer_free(&report[j]);
+        }
+        FREE(report);
+        FREE(offenders);
+        FREE(ranked);
+        FREE(rank);
         return true;
 }
 
 
+/**
+ * Returns the peak of the link rate sampled by the high frequency sampler
+ * since the last cycle (the minimum for the less than rules, otherwise the
+ * maximum) or the cycle value if the rule is not sampled or there are no
+ * samples
+ */
+static long long _linkPeak(Service_T s, Bandwidth_T b, Sample_Type type, long long value, boolean_t *peak) {
+        Sample_T sample;
+        if (b->sampled && Sampler_get(s, type, &sample)) {
+                *peak = true;
+                return b->operator == Operator_Less ? sample.min : sample.max;
+        }
+        *peak = false;
+        return value;
+}
+
+
 boolean_t check_net(Service_T s) {
+        Sampler_collect(s);
+        /* The network events watcher knows the state of all interfaces from the cycle dump, a link which is down needs no statistics */
+        if (s->inf->priv.net.interface && LinkWatch_getState(s->path) == 0) {
+                for (LinkStatus_T link = s->linkstatuslist; link; link = link->next) {
+                        Event_post(s, Event_Size, State_Succeeded, link->action, "link data gathering succeeded");
+                        Event_post(s, Event_Link, State_Failed, link->action, "link down");
+                }
+                return false; // Terminate test if the link is down
+        }
         boolean_t havedata = true;
         TRY
         {
@@ -1463,6 +3481,7 @@ boolean_t check_net(Service_T s) {
         char buf1[STRLEN], buf2[STRLEN];
         for (Bandwidth_T upload = s->uploadbyteslist; upload; upload = upload->next) {
                 long long obytes;
+                boolean_t peak = false;
                 switch (upload->range) {
                         case Time_Minute:
                                 obytes = Link_getBytesOutPerMinute(s->inf->priv.net.stats, upload->rangecount);
@@ -1474,16 +3493,17 @@ boolean_t check_net(Service_T s) {
                                         obytes = Link_getBytesOutPerHour(s->inf->priv.net.stats, upload->rangecount);
                                 break;
                         default:
-                                obytes = Link_getBytesOutPerSecond(s->inf->priv.net.stats);
+                                obytes = _linkPeak(s, upload, Sample_BytesOut, Link_getBytesOutPerSecond(s->inf->priv.net.stats), &peak);
                                 break;
                 }
                 if (Util_evalQExpression(upload->operator, obytes, upload->limit))
-                        Event_post(s, Event_ByteOut, State_Failed, upload->action, "%supload %s matches limit [upload rate %s %s in last %d %s]", upload->range != Time_Second ? "total " : "", Str_bytesToSize(obytes, buf1), operatorshortnames[upload->operator], Str_bytesToSize(upload->limit, buf2), upload->rangecount, Util_timestr(upload->range));
+                        Event_post(s, Event_ByteOut, State_Failed, upload->action, "%supload %s matches limit [upload rate %s %s in last %d %s]", upload->range != Time_Second ? "total " : peak ? "peak " : "", Str_bytesToSize(obytes, buf1), operatorshortnames[upload->operator], Str_bytesToSize(upload->limit, buf2), upload->rangecount, Util_timestr(upload->range));
                 else
-                        Event_post(s, Event_ByteOut, State_Succeeded, upload->action, "%supload check succeeded [current upload rate %s in last %d %s]", upload->range != Time_Second ? "total " : "", Str_bytesToSize(obytes, buf1), upload->rangecount, Util_timestr(upload->range));
+                        Event_post(s, Event_ByteOut, State_Succeeded, upload->action, "%supload check succeeded [current upload rate %s in last %d %s]", upload->range != Time_Second ? "total " : peak ? "peak " : "", Str_bytesToSize(obytes, buf1), upload->rangecount, Util_timestr(upload->range));
         }
         for (Bandwidth_T upload = s->uploadpacketslist; upload; upload = upload->next) {
                 long long opackets;
+                boolean_t peak = false;
                 switch (upload->range) {
                         case Time_Minute:
                                 opackets = Link_getPacketsOutPerMinute(s->inf->priv.net.stats, upload->rangecount);
@@ -1495,17 +3515,18 @@ boolean_t check_net(Service_T s) {
                                         opackets = Link_getPacketsOutPerHour(s->inf->priv.net.stats, upload->rangecount);
                                 break;
                         default:
-                                opackets = Link_getPacketsOutPerSecond(s->inf->priv.net.stats);
+                                opackets = _linkPeak(s, upload, Sample_PacketsOut, Link_getPacketsOutPerSecond(s->inf->priv.net.stats), &peak);
                                 break;
                 }
                 if (Util_evalQExpression(upload->operator, opackets, upload->limit))
-                        Event_post(s, Event_PacketOut, State_Failed, upload->action, "%supload packets %lld matches limit [upload packets %s %lld in last %d %s]", upload->range != Time_Second ? "total " : "", opackets, operatorshortnames[upload->operator], upload->limit, upload->rangecount, Util_timestr(upload->range));
+                        Event_post(s, Event_PacketOut, State_Failed, upload->action, "%supload packets %lld matches limit [upload packets %s %lld in last %d %s]", upload->range != Time_Second ? "total " : peak ? "peak " : "", opackets, operatorshortnames[upload->operator], upload->limit, upload->rangecount, Util_timestr(upload->range));
                 else
-                        Event_post(s, Event_PacketOut, State_Succeeded, upload->action, "%supload packets check succeeded [current upload packets %lld in last %d %s]", upload->range != Time_Second ? "total " : "", opackets, upload->rangecount, Util_timestr(upload->range));
+                        Event_post(s, Event_PacketOut, State_Succeeded, upload->action, "%supload packets check succeeded [current upload packets %lld in last %d %s]", upload->range != Time_Second ? "total " : peak ? "peak " : "", opackets, upload->rangecount, Util_timestr(upload->range));
         }
         // Download
         for (Bandwidth_T download = s->downloadbyteslist; download; download = download->next) {
                 long long ibytes;
+                boolean_t peak = false;
                 switch (download->range) {
                         case Time_Minute:
                                 ibytes = Link_getBytesInPerMinute(s->inf->priv.net.stats, download->rangecount);
@@ -1517,16 +3538,17 @@ boolean_t check_net(Service_T s) {
                                         ibytes = Link_getBytesInPerHour(s->inf->priv.net.stats, download->rangecount);
                                 break;
                         default:
-                                ibytes = Link_getBytesInPerSecond(s->inf->priv.net.stats);
+                                ibytes = _linkPeak(s, download, Sample_BytesIn, Link_getBytesInPerSecond(s->inf->priv.net.stats), &peak);
                                 break;
                 }
                 if (Util_evalQExpression(download->operator, ibytes, download->limit))
-                        Event_post(s, Event_ByteIn, State_Failed, download->action, "%sdownload %s matches limit [download rate %s %s in last %d %s]", download->range != Time_Second ? "total " : "", Str_bytesToSize(ibytes, buf1), operatorshortnames[download->operator], Str_bytesToSize(download->limit, buf2), download->rangecount, Util_timestr(download->range));
+                        Event_post(s, Event_ByteIn, State_Failed, download->action, "%sdownload %s matches limit [download rate %s %s in last %d %s]", download->range != Time_Second ? "total " : peak ? "peak " : "", Str_bytesToSize(ibytes, buf1), operatorshortnames[download->operator], Str_bytesToSize(download->limit, buf2), download->rangecount, Util_timestr(download->range));
                 else
-                        Event_post(s, Event_ByteIn, State_Succeeded, download->action, "%sdownload check succeeded [current download rate %s in last %d %s]", download->range != Time_Second ? "total " : "", Str_bytesToSize(ibytes, buf1), download->rangecount, Util_timestr(download->range));
+                        Event_post(s, Event_ByteIn, State_Succeeded, download->action, "%sdownload check succeeded [current download rate %s in last %d %s]", download->range != Time_Second ? "total " : peak ? "peak " : "", Str_bytesToSize(ibytes, buf1), download->rangecount, Util_timestr(download->range));
         }
         for (Bandwidth_T download = s->downloadpacketslist; download; download = download->next) {
                 long long ipackets;
+                boolean_t peak = false;
                 switch (download->range) {
                         case Time_Minute:
                                 ipackets = Link_getPacketsInPerMinute(s->inf->priv.net.stats, download->rangecount);
@@ -1538,13 +3560,13 @@ boolean_t check_net(Service_T s) {
                                         ipackets = Link_getPacketsInPerHour(s->inf->priv.net.stats, download->rangecount);
                                 break;
                         default:
-                                ipackets = Link_getPacketsInPerSecond(s->inf->priv.net.stats);
+                                ipackets = _linkPeak(s, download, Sample_PacketsIn, Link_getPacketsInPerSecond(s->inf->priv.net.stats), &peak);
                                 break;
                 }
                 if (Util_evalQExpression(download->operator, ipackets, download->limit))
-                        Event_post(s, Event_PacketIn, State_Failed, download->action, "%sdownload packets %lld matches limit [download packets %s %lld in last %d %s]", download->range != Time_Second ? "total " : "", ipackets, operatorshortnames[download->operator], download->limit, download->rangecount, Util_timestr(download->range));
+                        Event_post(s, Event_PacketIn, State_Failed, download->action, "%sdownload packets %lld matches limit [download packets %s %lld in last %d %s]", download->range != Time_Second ? "total " : peak ? "peak " : "", ipackets, operatorshortnames[download->operator], download->limit, download->rangecount, Util_timestr(download->range));
                 else
-                        Event_post(s, Event_PacketIn, State_Succeeded, download->action, "%sdownload packets check succeeded [current download packets %lld in last %d %s]", download->range != Time_Second ? "total " : "", ipackets, download->rangecount, Util_timestr(download->range));
+                        Event_post(s, Event_PacketIn, State_Succeeded, download->action, "%sdownload packets check succeeded [current download packets %lld in last %d %s]", download->range != Time_Second ? "total " : peak ? "peak " : "", ipackets, download->rangecount, Util_timestr(download->range));
         }
         return true;
 }
@@ -48,6 +48,9 @@
 #include "monit.h"
 #include "event.h"
 #include "process.h"
+#include "latency.h"
+#include "output.h"
+#include "engine.h"
 
 
 /**
@@ -57,21 +60,55 @@
  */
 
 
+/* ------------------------------------------------------------- Definitions */
+
+
+#define SNAPSHOT_SIZE 8
+
+#define DOCUMENT_FOOT "</monit>"
+
+
+/* The rendered status documents of the current cycle */
+static struct {
+        Mutex_T mutex;
+        unsigned generation;
+        struct {
+                unsigned generation;                  /**< Cycle the document belongs to */
+                Level_Type level;                              /**< Document level */
+                int version;                                 /**< Document version */
+                char *myip;                           /**< The client-side IP address */
+                StringBuffer_T document;                      /**< Rendered document */
+        } entry[SNAPSHOT_SIZE];
+        int next;
+        boolean_t watched;           /**< The changes are tracked for http clients */
+} snapshot = {.mutex = PTHREAD_MUTEX_INITIALIZER, .generation = 1};
+
+
 /* ----------------------------------------------------------------- Private */
 
 
 /**
- * Escape the CDATA "]]>" stop sequence in string
- * @param B Output StringBuffer object
- * @param buf String to escape
+ * Prints a latency histogram summary, the durations are in microseconds
+ * @param B StringBuffer object
+ * @param name The element name
+ * @param L Latency histogram
  */
-static void _escapeCDATA(StringBuffer_T B, const char *buf) {
-        for (int i = 0; buf[i]; i++) {
-                if (buf[i] == '>' && i > 1 && (buf[i - 1] == ']' && buf[i - 2] == ']'))
-                        StringBuffer_append(B, "&gt;");
-                else
-                        StringBuffer_append(B, "%c", buf[i]);
-        }
+static void _latency(StringBuffer_T B, const char *name, Latency_T L) {
+        StringBuffer_append(B,
+                            "<%s>"
+                            "<count>%llu</count>"
+                            "<min>%llu</min>"
+                            "<avg>%llu</avg>"
+                            "<p99>%llu</p99>"
+                            "<max>%llu</max>"
+                            "</%s>",
+                            name,
+                            L->count,
+                            L->min,
+                            Latency_average(L),
+                            Latency_percentile(L, 99),
+                            L->max,
+                            name);
 }
 
 
@@ -80,10 +117,14 @@ static void _escapeCDATA(StringBuffer_T B, const char *buf) {
  * @param B StringBuffer object
  * @param V Format version
  * @param myip The client-side IP address
+ * @param delta The status generation of a document which contains only the
+ * changed services, 0 for the full document
  */
-static void document_head(StringBuffer_T B, int V, const char *myip) {
+static void document_head(StringBuffer_T B, int V, const char *myip, unsigned long long delta) {
         StringBuffer_append(B, "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>");
-        if (V == 2)
+        if (V == 2 && delta)
+                StringBuffer_append(B, "<monit id=\"%s\" incarnation=\"%lld\" version=\"%s\" delta=\"true\" generation=\"%llu\"><server>", Run.id, (long long)Run.incarnation, VERSION, delta);
+        else if (V == 2)
                 StringBuffer_append(B, "<monit id=\"%s\" incarnation=\"%lld\" version=\"%s\"><server>", Run.id, (long long)Run.incarnation, VERSION);
         else
                 StringBuffer_append(B,
@@ -106,6 +147,53 @@ static void document_head(StringBuffer_T B, int V, const char *myip) {
                             Run.startdelay,
                             Run.system->name ? Run.system->name : "",
                             Run.controlfile ? Run.controlfile : "");
+        StringBuffer_append(B, "<latency>");
+        _latency(B, "cycle", &Run.latency.cycle);
+        _latency(B, "processtree", &Run.latency.processtree);
+        _latency(B, "event", &Run.latency.event);
+        _latency(B, "request", &Run.latency.request);
+        _latency(B, "report", &Run.latency.report);
+        _latency(B, "delivery", &Run.latency.delivery);
+        StringBuffer_append(B,
+                            "<deliveries>%d</deliveries>"
+                            "<deliveriespeak>%d</deliveriespeak>"
+                            "<overruns>%llu</overruns>"
+                            "<usage>"
+                            "<cpuuser>%llu</cpuuser>"
+                            "<cpusystem>%llu</cpusystem>"
+                            "<maxrss>%ld</maxrss>"
+                            "<faults>%ld</faults>"
+                            "<switches>%ld</switches>"
+                            "<blockio>%ld</blockio>"
+                            "<cpupercent>%.1f</cpupercent>"
+                            "<rss>%ld</rss>"
+                            "<heap>%lld</heap>"
+                            "<heapgrowth>%lld</heapgrowth>"
+                            "<fds>%d</fds>"
+                            "<queue>%d</queue>"
+                            "<queuesize>%llu</queuesize>"
+                            "<requestrate>%.2f</requestrate>"
+                            "<cost>",
+                            Run.latency.deliveries,
+                            Run.latency.deliveries_peak,
+                            Run.latency.overruns,
+                            Run.latency.usage.cpuuser,
+                            Run.latency.usage.cpusystem,
+                            Run.latency.usage.maxrss,
+                            Run.latency.usage.faults,
+                            Run.latency.usage.switches,
+                            Run.latency.usage.blockio,
+                            Run.latency.usage.cpupercent / 10.,
+                            Run.latency.usage.rss,
+                            Run.latency.usage.heap,
+                            Run.latency.usage.heapgrowth,
+                            Run.latency.usage.fds,
+                            Run.latency.usage.queue,
+                            Run.latency.usage.queuesize,
+                            Run.latency.usage.requestrate);
+        for (int i = 0; i < Cost_Types; i++)
+                StringBuffer_append(B, "<%s>%llu</%s>", Latency_costName(i), Run.latency.usage.cost[i], Latency_costName(i));
+        StringBuffer_append(B, "</cost></usage></latency>");
 
         if (Run.httpd.flags & Httpd_Net || Run.httpd.flags & Httpd_Unix) {
                 if (Run.httpd.flags & Httpd_Net)
@@ -143,7 +231,7 @@ static void document_head(StringBuffer_T B, int V, const char *myip) {
  * @param B StringBuffer object
  */
 static void document_foot(StringBuffer_T B) {
-        StringBuffer_append(B, "</monit>");
+        StringBuffer_append(B, DOCUMENT_FOOT);
 }
 
 
@@ -176,12 +264,21 @@ static void status_service(Service_T S, StringBuffer_T B, Level_Type L, int V) {
                             S->monitor,
                             S->mode,
                             S->doaction);
+        if (L == Level_Full) {
+                StringBuffer_append(B, "<latency>");
+                for (int i = 0; i < Latency_Types; i++)
+                        if (S->latency[i] && S->latency[i]->count)
+                                _latency(B, Latency_name(i), S->latency[i]);
+                StringBuffer_append(B, "</latency>");
+        }
         if (S->every.type != Every_Cycle) {
                 StringBuffer_append(B, "<every><type>%d</type>", S->every.type);
                 if (S->every.type == 1)
                         StringBuffer_append(B, "<counter>%d</counter><number>%d</number>", S->every.spec.cycle.counter, S->every.spec.cycle.number);
+                else if (S->every.type == Every_Interval)
+                        StringBuffer_append(B, "<interval>%d</interval>", S->every.spec.interval.seconds);
                 else
-                        StringBuffer_append(B, "<cron>%s</cron>", S->every.spec.cron);
+                        StringBuffer_append(B, "<cron>%s</cron>", S->every.spec.cron.spec);
                 StringBuffer_append(B, "</every>");
         }
 
@@ -222,6 +319,8 @@ static void status_service(Service_T S, StringBuffer_T B, Level_Type L, int V) {
                                                 (int)S->inf->priv.directory.uid,
                                                 (int)S->inf->priv.directory.gid,
                                                 (long long)S->inf->priv.directory.timestamp);
+                                        if (S->checksum)
+                                                StringBuffer_append(B, "<checksum type=\"%s\" files=\"%d\">%s</checksum>", checksumnames[S->checksum->type], S->inf->priv.directory.cs_files, S->inf->priv.directory.cs_sum);
                                         break;
 
                                 case Service_Fifo:
@@ -353,12 +452,67 @@ static void status_service(Service_T S, StringBuffer_T B, Level_Type L, int V) {
                                                         S->inf->priv.process.total_mem_kbyte,
                                                         S->inf->priv.process.cpu_percent/10.0,
                                                         S->inf->priv.process.total_cpu_percent/10.0);
+                                                if (S->inf->priv.process.threads >= 0)
+                                                        StringBuffer_append(B, "<threads>%d</threads>", S->inf->priv.process.threads);
+                                                if (S->inf->priv.process.fds >= 0)
+                                                        StringBuffer_append(B, "<filedescriptors>%d</filedescriptors>", S->inf->priv.process.fds);
+                                                if (S->inf->priv.process.read_rate >= 0)
+                                                        StringBuffer_append(B, "<read>%lld</read><write>%lld</write>", S->inf->priv.process.read_rate, S->inf->priv.process.write_rate);
                                         }
                                         break;
 
                                 default:
                                         break;
                         }
+                        if (S->cgroup) {
+                                StringBuffer_append(B,
+                                        "<cgroup>"
+                                        "<version>%d</version>"
+                                        "<processes>%d</processes>"
+                                        "<tasks>%d</tasks>"
+                                        "<memory>"
+                                        "<percent>%.1f</percent>"
+                                        "<kilobyte>%lld</kilobyte>"
+                                        "</memory>"
+                                        "<cpu>"
+                                        "<percent>%.1f</percent>"
+                                        "</cpu>"
+                                        "<read>%lld</read>"
+                                        "<write>%lld</write>"
+                                        "</cgroup>",
+                                        S->cgroup->version,
+                                        S->cgroup->processes,
+                                        S->cgroup->tasks,
+                                        S->cgroup->mem_percent/10.0,
+                                        S->cgroup->mem_kbyte,
+                                        S->cgroup->cpu_percent/10.0,
+                                        S->cgroup->read_rate,
+                                        S->cgroup->write_rate);
+                        }
+                        if (S->processes) {
+                                StringBuffer_append(B,
+                                        "<processes>"
+                                        "<matched>%d</matched>"
+                                        "<offenders>%d</offenders>",
+                                        S->processes->matched,
+                                        S->processes->offenders);
+                                for (int i = 0; i < S->processes->top; i++) {
+                                        Offender_T *o = &S->processes->offender[i];
+                                        StringBuffer_append(B,
+                                                "<offender>"
+                                                "<pid>%d</pid>"
+                                                "<cpu><percent>%.1f</percent></cpu>"
+                                                "<memory><percent>%.1f</percent><kilobyte>%lld</kilobyte></memory>"
+                                                "<cmdline><![CDATA[",
+                                                (int)o->pid,
+                                                o->cpu_percent/10.0,
+                                                o->mem_percent/10.0,
+                                                o->mem_kbyte);
+                                        Output_escape(B, o->cmdline, Output_Cdata);
+                                        StringBuffer_append(B, "]]></cmdline></offender>");
+                                }
+                                StringBuffer_append(B, "</processes>");
+                        }
                         for (Icmp_T i = S->icmplist; i; i = i->next) {
                                 StringBuffer_append(B,
                                                     "<icmp>"
@@ -441,7 +595,7 @@ static void status_service(Service_T S, StringBuffer_T B, Level_Type L, int V) {
                                                     "<output><![CDATA[",
                                                     (long long)S->program->started,
                                                     S->program->exitStatus);
-                                _escapeCDATA(B, StringBuffer_toString(S->program->output));
+                                Output_escape(B, StringBuffer_toString(S->program->output), Output_Cdata);
                                 StringBuffer_append(B,
                                                     "]]></output>"
                                                     "</program>");
@@ -490,7 +644,7 @@ static void status_event(Event_T E, StringBuffer_T B) {
                             Event_get_id(E),
                             Event_get_state(E),
                             Event_get_action(E));
-        _escapeCDATA(B, Event_get_message(E));
+        Output_escape(B, Event_get_message(E), Output_Cdata);
         StringBuffer_append(B, "]]></message>");
         Service_T s = Event_get_source(E);
         if (s && s->token)
@@ -499,6 +653,84 @@ static void status_event(Event_T E, StringBuffer_T B) {
 }
 
 
+/**
+ * Returns the hash of the service status report. The collection timestamp
+ * and the check latency are excluded, so only the change of the status,
+ * metrics or events counts
+ * @param S Service object
+ * @param B StringBuffer object used for the report
+ */
+static unsigned long long _fingerprint(Service_T S, StringBuffer_T B) {
+        static const char *excluded[][2] = {{"<collected_sec>", "</collected_usec>"}, {"<latency>", "</latency>"}};
+        StringBuffer_clear(B);
+        status_service(S, B, Level_Full, 2);
+        const char *report = StringBuffer_toString(B);
+        unsigned long long hash = 14695981039346656037ULL; // FNV-1a
+        for (const char *p = report; *p; p++) {
+                if (*p == '<') {
+                        for (int i = 0; i < (int)(sizeof(excluded) / sizeof(excluded[0])); i++) {
+                                const char *resume;
+                                if (Str_startsWith(p, excluded[i][0]) && (resume = strstr(p, excluded[i][1]))) {
+                                        p = resume;
+                                        break;
+                                }
+                        }
+                }
+                hash ^= (unsigned char)*p;
+                hash *= 1099511628211ULL;
+        }
+        return hash;
+}
+
+
+/**
+ * Append the status document of the current cycle, the document is
+ * rendered if it isn't cached yet. If the event is given, it is inserted
+ * before the document foot
+ * @param B StringBuffer object
+ * @param E An event object or NULL for general status
+ * @param L Status information level
+ * @param V Format version
+ * @param myip The client-side IP address
+ */
+static void _snapshot(StringBuffer_T B, Event_T E, Level_Type L, int V, const char *myip) {
+        LOCK(snapshot.mutex)
+        {
+                int i;
+                for (i = 0; i < SNAPSHOT_SIZE; i++)
+                        if (snapshot.entry[i].generation == snapshot.generation && snapshot.entry[i].level == L && snapshot.entry[i].version == V && IS(snapshot.entry[i].myip ? snapshot.entry[i].myip : "", myip ? myip : ""))
+                                break;
+                if (i == SNAPSHOT_SIZE) {
+                        /* Prefer a slot from the previous cycles, otherwise replace the slots in round-robin order */
+                        for (i = 0; i < SNAPSHOT_SIZE && snapshot.entry[i].generation == snapshot.generation; i++)
+                                ;
+                        if (i == SNAPSHOT_SIZE) {
+                                i = snapshot.next;
+                                snapshot.next = (snapshot.next + 1) % SNAPSHOT_SIZE;
+                        }
+                        if (snapshot.entry[i].document)
+                                StringBuffer_clear(snapshot.entry[i].document);
+                        else
+                                snapshot.entry[i].document = StringBuffer_create(256);
+                        FREE(snapshot.entry[i].myip);
+                        snapshot.entry[i].myip = myip ? Str_dup(myip) : NULL;
+                        snapshot.entry[i].level = L;
+                        snapshot.entry[i].version = V;
+                        snapshot.entry[i].generation = snapshot.generation;
+                        status_xml(snapshot.entry[i].document, NULL, L, V, myip);
+                }
+                if (E) {
+                        StringBuffer_append(B, "%.*s", StringBuffer_length(snapshot.entry[i].document) - (int)strlen(DOCUMENT_FOOT), StringBuffer_toString(snapshot.entry[i].document));
+                        status_event(E, B);
+                        document_foot(B);
+                } else {
+                        StringBuffer_append(B, "%s", StringBuffer_toString(snapshot.entry[i].document));
+                }
+        }
+        END_LOCK;
+}
+
+
 /* ------------------------------------------------------------------ Public */
 
 
@@ -514,7 +746,7 @@ void status_xml(StringBuffer_T B, Event_T E, Level_Type L, int V, const char *my
         Service_T S;
         ServiceGroup_T SG;
 
-        document_head(B, V, myip);
+        document_head(B, V, myip, 0);
         if (V == 2)
                 StringBuffer_append(B, "<services>");
         for (S = servicelist_conf; S; S = S->next_conf)
@@ -529,3 +761,146 @@ void status_xml(StringBuffer_T B, Event_T E, Level_Type L, int V, const char *my
                 status_event(E, B);
         document_foot(B);
 }
+
+
+/**
+ * Get a XML formated message with general status of monitored services
+ * and resources. The document is rendered once per cycle for the given
+ * level, version and client-side IP address and reused until the cycle
+ * finishes, see status_xml_reset()
+ * @param B StringBuffer object
+ * @param L Status information level
+ * @param V Format version
+ * @param myip The client-side IP address
+ */
+void status_xml_snapshot(StringBuffer_T B, Level_Type L, int V, const char *myip) {
+        _snapshot(B, NULL, L, V, myip);
+}
+
+
+/**
+ * Get a XML formated event message, the status part is the document of
+ * the current cycle (see status_xml_snapshot()), so many events can be
+ * rendered without walking the services for each of them
+ * @param B StringBuffer object
+ * @param E An event object
+ * @param L Status information level
+ * @param V Format version
+ * @param myip The client-side IP address
+ */
+void status_xml_event(StringBuffer_T B, Event_T E, Level_Type L, int V, const char *myip) {
+        _snapshot(B, E, L, V, myip);
+}
+
+
+/**
+ * Get a XML formated message with the status of the services which changed
+ * since the given generation (delta status report)
+ * @param B StringBuffer object
+ * @param since The status generation of the last report
+ * @param myip The client-side IP address
+ * @return The status generation of the report
+ */
+unsigned long long status_xml_delta(StringBuffer_T B, unsigned long long since, const char *myip) {
+        unsigned long long generation = status_xml_generation();
+        document_head(B, 2, myip, generation);
+        StringBuffer_append(B, "<services>");
+        for (Service_T S = servicelist_conf; S; S = S->next_conf)
+                if (status_xml_changed(S, since))
+                        status_service(S, B, Level_Full, 2);
+        StringBuffer_append(B, "</services><servicegroups>");
+        for (ServiceGroup_T SG = servicegrouplist; SG; SG = SG->next)
+                status_servicegroup(SG, B, Level_Full);
+        StringBuffer_append(B, "</servicegroups>");
+        document_foot(B);
+        return generation;
+}
+
+
+/**
+ * Get the current status generation, it is incremented after each cycle
+ * @return The status generation
+ */
+unsigned long long status_xml_generation() {
+        unsigned long long generation;
+        LOCK(snapshot.mutex)
+        {
+                generation = snapshot.generation;
+        }
+        END_LOCK;
+        return generation;
+}
+
+
+/**
+ * Test if the status report of the service changed since the given
+ * generation. The service, whose changes are not tracked (see
+ * status_xml_watch()), is reported as changed
+ * @param S The service
+ * @param since The status generation of the last report
+ * @return true if the service status changed since the generation
+ */
+boolean_t status_xml_changed(Service_T S, unsigned long long since) {
+        return S->status_generation > since || ! S->status_fingerprint;
+}
+
+
+/**
+ * Track the changes of the services status reports for the http clients
+ * which wait for the status changes (see the long-poll and WebSocket
+ * status requests). The services which were not tracked yet (for example
+ * after the first request or the configuration reload) are marked with
+ * the current generation, so the clients wait for the next change
+ * @return The current status generation
+ */
+unsigned long long status_xml_watch() {
+        unsigned long long generation;
+        LOCK(snapshot.mutex)
+        {
+                snapshot.watched = true;
+                generation = snapshot.generation;
+                StringBuffer_T B = NULL;
+                for (Service_T S = servicelist_conf; S; S = S->next_conf) {
+                        if (! S->status_fingerprint) {
+                                if (! B)
+                                        B = StringBuffer_create(256);
+                                S->status_fingerprint = _fingerprint(S, B);
+                                S->status_generation = generation;
+                        }
+                }
+                if (B)
+                        StringBuffer_free(&B);
+        }
+        END_LOCK;
+        return generation;
+}
+
+
+/**
+ * Invalidate the status documents rendered by status_xml_snapshot(). Called
+ * when the cycle finished and the status of the services changed. If the
+ * M/Monit delta status reports are enabled or some http client waits for
+ * the status changes, the services whose status report changed are marked
+ * with the new status generation
+ */
+void status_xml_reset() {
+        LOCK(snapshot.mutex)
+        {
+                snapshot.generation++;
+                if ((Run.mmonits && Run.mmonitdelta) || snapshot.watched) {
+                        StringBuffer_T B = StringBuffer_create(256);
+                        for (Service_T S = servicelist_conf; S; S = S->next_conf) {
+                                unsigned long long fingerprint = _fingerprint(S, B);
+                                if (fingerprint != S->status_fingerprint) {
+                                        S->status_fingerprint = fingerprint;
+                                        S->status_generation = snapshot.generation;
+                                }
+                        }
+                        StringBuffer_free(&B);
+                }
+        }
+        END_LOCK;
+        /* The http clients waiting for the status changes are woken up */
+        if (snapshot.watched)
+                Engine_notify();
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <locale.h>
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+
+#include "monit.h"
+#include "protocol.h"
+
+// libmonit
+#include "Bootstrap.h"
+#include "system/Net.h"
+#include "thread/Thread.h"
+
+
+/**
+ *  Tests of the gRPC health check response decoding.
+ *
+ *  A fake server listens at a unix socket and answers the health check
+ *  with the given response frames, the test checks the port with the
+ *  GRPC protocol test like the validation does.
+ *
+ *  The program is linked with the Monit sources, monit.c is compiled with
+ *  its main() renamed (see the tests in Makefile.am).
+ *
+ *  @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+/* monit.c's main() is renamed by the preprocessor for this program */
+#undef main
+
+typedef struct {
+        int server;
+        unsigned char response[1024];
+        int length;
+} Server_T;
+
+/* The server's SETTINGS frame and the response headers: ":status: 200" (indexed) and "content-type: application/grpc" (literal, indexed name) */
+static const unsigned char headers[] = {
+        0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x14, 0x01, 0x04, 0x00, 0x00, 0x00, 0x01,
+        0x88, 0x0f, 0x10, 0x10, 'a', 'p', 'p', 'l', 'i', 'c', 'a', 't', 'i', 'o', 'n', '/', 'g', 'r', 'p', 'c'
+};
+
+/* The DATA frame with the HealthCheckResponse message, status SERVING */
+static const unsigned char serving[] = {
+        0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x02, 0x08, 0x01
+};
+
+/* The trailers "grpc-status: 0", literal without indexing, the name is a literal too */
+static const unsigned char ok[] = {
+        0x00, 0x0b, 'g', 'r', 'p', 'c', '-', 's', 't', 'a', 't', 'u', 's', 0x01, '0'
+};
+
+/* The trailers "grpc-status: 14" and "grpc-message: unavailable", literal without indexing */
+static const unsigned char unavailable[] = {
+        0x00, 0x0b, 'g', 'r', 'p', 'c', '-', 's', 't', 'a', 't', 'u', 's', 0x02, '1', '4',
+        0x00, 0x0c, 'g', 'r', 'p', 'c', '-', 'm', 'e', 's', 's', 'a', 'g', 'e', 0x0b, 'u', 'n', 'a', 'v', 'a', 'i', 'l', 'a', 'b', 'l', 'e'
+};
+
+/* The same trailers Huffman coded, literal with incremental indexing (RFC 7541 Appendix B) */
+static const unsigned char unavailableHuffman[] = {
+        0x40, 0x88, 0x9a, 0xca, 0xc8, 0xb2, 0x12, 0x34, 0xda, 0x8f, 0x82, 0x0b, 0x5f,
+        0x40, 0x89, 0x9a, 0xca, 0xc8, 0xb5, 0x25, 0x42, 0x07, 0x31, 0x7f, 0x88, 0xb6, 0xa1, 0xf7, 0x19, 0xa8, 0x1c, 0x74, 0x17
+};
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+/* Answer one connection with the response and wait until the client closed it */
+static void *_server(void *args) {
+        Server_T *S = args;
+        int client = accept(S->server, NULL, NULL);
+        assert(client >= 0);
+        assert(write(client, S->response, S->length) == S->length);
+        char buf[1024];
+        while (Net_canRead(client, 5000) && read(client, buf, sizeof(buf)) > 0)
+                ;
+        close(client);
+        return NULL;
+}
+
+
+/* Check the port with the response: the headers, the message if given and the trailers. Returns the error or NULL */
+static char *_check(const char *path, boolean_t message, const unsigned char *trailers, int length, char *error, int size) {
+        Server_T S = {.length = 0};
+        memcpy(S.response, headers, sizeof(headers));
+        S.length += sizeof(headers);
+        if (message) {
+                memcpy(S.response + S.length, serving, sizeof(serving));
+                S.length += sizeof(serving);
+        }
+        // The trailers HEADERS frame ends the stream
+        unsigned char frame[9] = {0x00, 0x00, (unsigned char)length, 0x01, 0x05, 0x00, 0x00, 0x00, 0x01};
+        memcpy(S.response + S.length, frame, sizeof(frame));
+        S.length += sizeof(frame);
+        memcpy(S.response + S.length, trailers, length);
+        S.length += length;
+        struct sockaddr_un address = {.sun_family = AF_UNIX};
+        snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+        assert((S.server = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0);
+        assert(bind(S.server, (struct sockaddr *)&address, sizeof(address)) == 0);
+        assert(listen(S.server, 1) == 0);
+        Thread_T thread;
+        Thread_create(thread, _server, &S);
+        struct myport P = {
+                .family = Socket_Unix,
+                .type = Socket_Tcp,
+                .pathname = (char *)path,
+                .request_hostheader = "localhost",
+                .timeout = 5000,
+                .protocol = Protocol_get(Protocol_GRPC)
+        };
+        *error = 0;
+        TRY
+        {
+                Socket_test(&P);
+                assert(P.is_available);
+        }
+        ELSE
+        {
+                snprintf(error, size, "%s", Exception_frame.message);
+        }
+        END_TRY;
+        Thread_join(thread);
+        close(S.server);
+        unlink(path);
+        return *error ? error : NULL;
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(void) {
+        Bootstrap();
+        setlocale(LC_ALL, "C");
+        char directory[] = "/tmp/grpc_test.XXXXXX", path[STRLEN], error[STRLEN];
+        assert(mkdtemp(directory));
+        snprintf(path, sizeof(path), "%s/grpc.sock", directory);
+
+        printf("============> Start gRPC Tests\n\n");
+
+        printf("=> Test1: SERVING\n");
+        {
+                assert(_check(path, true, ok, sizeof(ok), error, sizeof(error)) == NULL);
+        }
+        printf("=> Test1: OK\n\n");
+
+        printf("=> Test2: grpc-status 14 literal\n");
+        {
+                assert(_check(path, false, unavailable, sizeof(unavailable), error, sizeof(error)));
+                assert(Str_sub(error, "grpc-status 14 -- unavailable"));
+        }
+        printf("=> Test2: OK\n\n");
+
+        printf("=> Test3: grpc-status 14 Huffman coded\n");
+        {
+                assert(_check(path, false, unavailableHuffman, sizeof(unavailableHuffman), error, sizeof(error)));
+                assert(Str_sub(error, "grpc-status 14 -- unavailable"));
+        }
+        printf("=> Test3: OK\n\n");
+
+        printf("============> gRPC Tests: OK\n\n");
+
+        rmdir(directory);
+        return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU Affero General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <locale.h>
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+
+#include "monit.h"
+#include "processor.h"
+
+// libmonit
+#include "Bootstrap.h"
+#include "system/Net.h"
+
+
+/**
+ *  Tests of the WebSocket frames sent by a client to the /_watch URL.
+ *
+ *  The HTTP processor serves one end of a socket pair and the test is
+ *  the client at the other end. The cervlet upgrades the connection and
+ *  parks it, the test sends the frames and resumes the parked response
+ *  like the server does when the client sent data.
+ *
+ *  The program is linked with the Monit sources, monit.c is compiled with
+ *  its main() renamed (see the tests in Makefile.am).
+ *
+ *  @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+/* monit.c's main() is renamed by the preprocessor for this program */
+#undef main
+
+#define HANDSHAKE "GET /_watch HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n"
+
+
+static int client;
+static Socket_T S;
+static Arena_T arena;
+static HttpWatch watch;
+
+
+/* ----------------------------------------------------------------- Private */
+
+
+static void _doGet(HttpRequest req, HttpResponse res) {
+        if (upgrade_websocket(req, res))
+                watch_response(res)->websocket = true;
+}
+
+
+static void _doPost(HttpRequest req, HttpResponse res) {
+        send_error(res, SC_NOT_IMPLEMENTED, "Method not implemented");
+}
+
+
+static boolean_t _doWatch(HttpResponse res, HttpWatch W, boolean_t force) {
+        // The status didn't change, the server only answers the client's frames
+        return false;
+}
+
+
+static void _open() {
+        int fd[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0);
+        struct sockaddr_un address = {.sun_family = AF_UNIX};
+        S = Socket_createAccepted(fd[0], (struct sockaddr *)&address, sizeof(address), NULL);
+        assert(S);
+        client = fd[1];
+        assert(write(client, HANDSHAKE, sizeof(HANDSHAKE) - 1) == sizeof(HANDSHAKE) - 1);
+        assert(http_processor(S, arena, true, &watch) == Http_Watch);
+        assert(watch && watch->websocket);
+        char response[1024] = {0};
+        for (int n = 0; ! strstr(response, "\r\n\r\n"); n += (int)read(client, response + n, 1))
+                assert(n < sizeof(response) - 1 && Net_canRead(client, 1000));
+        assert(Str_startsWith(response, "HTTP/1.1 101"));
+}
+
+
+static void _close() {
+        http_release(&watch);
+        Socket_free(&S);
+        close(client);
+}
+
+
+/* Write the frame head and the masked data of a client frame, the data is omitted if send is false */
+static void _send(int head, const char *data, int length, boolean_t send) {
+        unsigned char frame[WEBSOCKET_FRAME + 16], mask[4] = {0x12, 0x34, 0x56, 0x78};
+        int n = 0;
+        frame[n++] = head;
+        if (length < 126) {
+                frame[n++] = 0x80 | length;
+        } else {
+                frame[n++] = 0x80 | 126;
+                frame[n++] = (unsigned char)(length >> 8);
+                frame[n++] = (unsigned char)length;
+        }
+        memcpy(frame + n, mask, 4);
+        n += 4;
+        if (send) {
+                assert(n + length <= sizeof(frame));
+                for (int i = 0; i < length; i++)
+                        frame[n++] = data[i] ^ mask[i % 4];
+        }
+        assert(write(client, frame, n) == n);
+}
+
+
+/* Read the server frame, its payload is small. Returns the frame head */
+static int _receive(unsigned char *data, int *length) {
+        unsigned char head[2];
+        assert(Net_canRead(client, 1000));
+        assert(read(client, head, 2) == 2);
+        assert(! (head[1] & 0x80) && (head[1] & 0x7f) < 126);
+        *length = head[1] & 0x7f;
+        if (*length)
+                assert(read(client, data, *length) == *length);
+        return head[0];
+}
+
+
+/* Check that the server closed the connection with the given status code */
+static void _closed(int status) {
+        unsigned char data[125];
+        int length;
+        assert(http_resume(&watch, true) == Http_Close);
+        assert(watch == NULL);
+        assert(_receive(data, &length) == 0x88);
+        assert(length == 2 && ((data[0] << 8) | data[1]) == status);
+}
+
+
+/* ------------------------------------------------------------------ Public */
+
+
+int main(void) {
+        Bootstrap();
+        setlocale(LC_ALL, "C");
+        add_Impl(_doGet, _doPost, _doWatch);
+        arena = Arena_new();
+
+        printf("============> Start WebSocket Tests\n\n");
+
+        printf("=> Test1: fragmented message\n");
+        {
+                unsigned char data[125];
+                int length;
+                _open();
+                _send(0x01, "Hello", 5, true);
+                // A control frame in the middle of the fragmented message
+                _send(0x89, "ping", 4, true);
+                _send(0x00, ", Web", 5, true);
+                assert(http_resume(&watch, true) == Http_Watch);
+                assert(_receive(data, &length) == 0x8A);
+                assert(length == 4 && memcmp(data, "ping", 4) == 0);
+                assert(watch->opcode == 0x1);
+                assert(watch->messagelength == 10 && memcmp(watch->message, "Hello, Web", 10) == 0);
+                _send(0x80, "Socket", 6, true);
+                assert(http_resume(&watch, true) == Http_Watch);
+                assert(watch->opcode == 0 && watch->messagelength == 0);
+                _close();
+        }
+        printf("=> Test1: OK\n\n");
+
+        printf("=> Test2: partial frame\n");
+        {
+                // The client stalls in the middle of the frame, the worker doesn't wait for the rest
+                unsigned char frame[10] = {0x89, 0x84, 0x00, 0x00, 0x00, 0x00, 'p', 'i', 'n', 'g'}, data[125];
+                int length;
+                _open();
+                assert(write(client, frame, 3) == 3);
+                assert(http_resume(&watch, true) == Http_Watch);
+                assert(watch->framelength == 3);
+                assert(write(client, frame + 3, 7) == 7);
+                assert(http_resume(&watch, true) == Http_Watch);
+                assert(watch->framelength == 0);
+                assert(_receive(data, &length) == 0x8A);
+                assert(length == 4 && memcmp(data, "ping", 4) == 0);
+                _close();
+        }
+        printf("=> Test2: OK\n\n");
+
+        printf("=> Test3: unexpected continuation frame\n");
+        {
+                _open();
+                _send(0x80, "orphan", 6, true);
+                _closed(1002);
+                _close();
+        }
+        printf("=> Test3: OK\n\n");
+
+        printf("=> Test4: oversized frame\n");
+        {
+                // The server closes the connection when it got the frame head, the data is not sent
+                _open();
+                _send(0x81, NULL, WEBSOCKET_MAX + 1, false);
+                _closed(1009);
+                _close();
+        }
+        printf("=> Test4: OK\n\n");
+
+        printf("=> Test5: oversized fragmented message\n");
+        {
+                char data[WEBSOCKET_MAX / 2 + 1];
+                memset(data, 'x', sizeof(data));
+                _open();
+                _send(0x01, data, sizeof(data), true);
+                _send(0x80, data, sizeof(data), true);
+                _closed(1009);
+                _close();
+        }
+        printf("=> Test5: OK\n\n");
+
+        printf("============> WebSocket Tests: OK\n\n");
+
+        Arena_free(&arena);
+        return 0;
+}